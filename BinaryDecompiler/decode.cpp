@@ -7,6 +7,8 @@
 #include "internal_includes/debug.h"
 #include "log.h"
 
+#include <atomic>
+
 #define FOURCC(a, b, c, d) ((uint32_t)(uint8_t)(a) | ((uint32_t)(uint8_t)(b) << 8) | ((uint32_t)(uint8_t)(c) << 16) | ((uint32_t)(uint8_t)(d) << 24 ))
 enum {FOURCC_DXBC = FOURCC('D', 'X', 'B', 'C')}; //DirectX byte code
 enum {FOURCC_SHDR = FOURCC('S', 'H', 'D', 'R')}; //Shader model 4 code
@@ -37,8 +39,9 @@ typedef struct DXBCChunkHeaderTAG
 } DXBCChunkHeader;
 
 #ifdef _DEBUG
-static uint64_t operandID = 0;
-static uint64_t instructionID = 0;
+// Atomic since shaders may be decoded on several threads at once:
+static std::atomic<uint64_t> operandID(0);
+static std::atomic<uint64_t> instructionID(0);
 #endif
 
 #if defined(_WIN32)
@@ -169,7 +172,7 @@ void MarkTextureAsShadow(ShaderInfo* psShaderInfo, std::vector<Declaration> &psD
 	}
 }
 
-uint32_t DecodeOperand (const uint32_t *pui32Tokens, Operand* psOperand)
+uint32_t DecodeOperand (Shader* psShader, const uint32_t *pui32Tokens, Operand* psOperand)
 {
     int i;
 	uint32_t ui32NumTokens = 1;
@@ -312,8 +315,8 @@ uint32_t DecodeOperand (const uint32_t *pui32Tokens, Operand* psOperand)
             }
             case OPERAND_INDEX_RELATIVE:
             {
-                psOperand->psSubOperand[i] = new Operand();
-                    DecodeOperand(pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]);
+                psOperand->psSubOperand[i] = psShader->arena.AllocateOperands(1);
+                    DecodeOperand(psShader, pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]);
 
                     ui32NumTokens++;
                 break;
@@ -325,8 +328,8 @@ uint32_t DecodeOperand (const uint32_t *pui32Tokens, Operand* psOperand)
 
                 ui32NumTokens++;
 
-                psOperand->psSubOperand[i] = new Operand();
-                    DecodeOperand(pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]);
+                psOperand->psSubOperand[i] = psShader->arena.AllocateOperands(1);
+                    DecodeOperand(psShader, pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]);
 
 				ui32NumTokens++;
 				break;
@@ -341,7 +344,7 @@ uint32_t DecodeOperand (const uint32_t *pui32Tokens, Operand* psOperand)
         ui32NumTokens++;
     }
 
-	psOperand->specialName.clear();
+	psOperand->specialName = "";
 
     return ui32NumTokens;
 }
@@ -352,6 +355,14 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
     const uint32_t bExtended = DecodeIsOpcodeExtended(*pui32Token);
     const OPCODE_TYPE eOpcode = DecodeOpcodeType(*pui32Token);
     uint32_t ui32OperandOffset = 1;
+    //Decoded here until we know how many there are, then moved to the arena:
+    Operand asOperands[MAX_DECLARATION_OPERANDS];
+
+    memset(asOperands, 0, sizeof(asOperands));
+    psDecl->asOperands = asOperands;
+    psDecl->ui32NumOperands = 0;
+    psDecl->asImmediateConstBuffer = 0;
+    psDecl->ui32ImmediateConstBufferSize = 0;
 
     psDecl->eOpcode = eOpcode;
 
@@ -368,13 +379,13 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         {
             psDecl->value.eResourceDimension = DecodeResourceDimension(*pui32Token);
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_CONSTANT_BUFFER: // custom operand formats.
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_SAMPLER:
@@ -384,7 +395,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         case OPCODE_DCL_INDEX_RANGE:
         {
             psDecl->ui32NumOperands = 1;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             psDecl->value.ui32IndexRange = pui32Token[ui32OperandOffset];
 
             if(psDecl->asOperands[0].eType == OPERAND_TYPE_INPUT)
@@ -451,13 +462,13 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         case OPCODE_DCL_INPUT:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_INPUT_SIV:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             if(psShader->eShaderType == PIXEL_SHADER)
             {
                 psDecl->value.eInterpolation = DecodeInterpolationMode(*pui32Token);
@@ -469,14 +480,14 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         {
             psDecl->ui32NumOperands = 1;
             psDecl->value.eInterpolation = DecodeInterpolationMode(*pui32Token);
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_INPUT_SGV:
         case OPCODE_DCL_INPUT_PS_SGV:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             DecodeNameToken(pui32Token + 3, &psDecl->asOperands[0]);
             break;
         }
@@ -488,7 +499,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         case OPCODE_DCL_OUTPUT:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_OUTPUT_SGV:
@@ -498,7 +509,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         case OPCODE_DCL_OUTPUT_SIV:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             DecodeNameToken(pui32Token + 3, &psDecl->asOperands[0]);
             break;
         }
@@ -549,7 +560,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         case OPCODE_DCL_FUNCTION_BODY:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_FUNCTION_TABLE:
@@ -613,7 +624,6 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
 				CUSTOMDATA_CLASS eClass = DecodeCustomDataClass(pui32Token[0]);
 
 				const uint32_t ui32NumVec4 = (ui32TokenLength - 2) / 4;
-				uint32_t uIdx = 0;
 
 				ICBVec4 const *pVec4Array = (ICBVec4 const *) (pui32Token + 2);
 
@@ -623,12 +633,9 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
 				/* must be a multiple of 4 */
 				ASSERT(((ui32TokenLength - 2) % 4) == 0);
 
-				for (uIdx = 0; uIdx < ui32NumVec4; uIdx++)
-				{
-					psDecl->asImmediateConstBuffer[uIdx] = pVec4Array[uIdx];
-				}
-
-				psDecl->ui32NumOperands = ui32NumVec4;
+				psDecl->asImmediateConstBuffer = (ICBVec4*)psShader->arena.Allocate(ui32NumVec4 * sizeof(ICBVec4));
+				memcpy(psDecl->asImmediateConstBuffer, pVec4Array, ui32NumVec4 * sizeof(ICBVec4));
+				psDecl->ui32ImmediateConstBufferSize = ui32NumVec4;
 			}
 			break;
 		}
@@ -644,7 +651,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
             psDecl->sUAV.ui32GloballyCoherentAccess = DecodeAccessCoherencyFlags(*pui32Token);
 			psDecl->sUAV.bCounter = 0;
 			psDecl->sUAV.ui32BufferSize = 0;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
 			psDecl->sUAV.Type = DecodeResourceReturnType(0, pui32Token[ui32OperandOffset]);
             break;
         }
@@ -657,7 +664,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
             psDecl->sUAV.ui32GloballyCoherentAccess = DecodeAccessCoherencyFlags(*pui32Token);
 			psDecl->sUAV.bCounter = 0;
 			psDecl->sUAV.ui32BufferSize = 0;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
 			//This should be a RTYPE_UAV_RWBYTEADDRESS buffer. It is memory backed by
 			//a shader storage buffer whose is unknown at compile time.
 			psDecl->sUAV.ui32BufferSize = 0;
@@ -672,7 +679,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
             psDecl->sUAV.ui32GloballyCoherentAccess = DecodeAccessCoherencyFlags(*pui32Token);
 			psDecl->sUAV.bCounter = 0;
 			psDecl->sUAV.ui32BufferSize = 0;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
 			
             // Upstream dropped the 'if' here when they reworked
             // StructuredBuffers, leading to a NULL pointer dereference on
@@ -702,13 +709,13 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         case OPCODE_DCL_RESOURCE_STRUCTURED:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_RESOURCE_RAW:
         {
             psDecl->ui32NumOperands = 1;
-            DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
             break;
         }
         case OPCODE_DCL_THREAD_GROUP_SHARED_MEMORY_STRUCTURED:
@@ -719,7 +726,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
             psDecl->ui32NumOperands = 1;
             psDecl->sUAV.ui32GloballyCoherentAccess = 0;
 
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
 
             psDecl->sTGSM.ui32Stride = pui32Token[ui32OperandOffset++];
             psDecl->sTGSM.ui32Count = pui32Token[ui32OperandOffset++];
@@ -733,7 +740,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
             psDecl->ui32NumOperands = 1;
             psDecl->sUAV.ui32GloballyCoherentAccess = 0;
 
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
 
             psDecl->sTGSM.ui32Stride = 4;
             psDecl->sTGSM.ui32Count = pui32Token[ui32OperandOffset++];
@@ -742,7 +749,7 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
 		case OPCODE_DCL_STREAM:
 		{
 			psDecl->ui32NumOperands = 1;
-			DecodeOperand(pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
+			DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psDecl->asOperands[0]);
 			break;
 		}
 		case OPCODE_DCL_GS_INSTANCE_COUNT:
@@ -758,6 +765,9 @@ const uint32_t* DecodeDeclaration(Shader* psShader, const uint32_t* pui32Token,
         }
     }
 
+    psDecl->asOperands = psShader->arena.AllocateOperands(psDecl->ui32NumOperands, asOperands,
+            MAX_DECLARATION_OPERANDS);
+
     return pui32Token + ui32TokenLength;
 }
 
@@ -767,6 +777,11 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
     const uint32_t bExtended = DecodeIsOpcodeExtended(*pui32Token);
     const OPCODE_TYPE eOpcode = DecodeOpcodeType(*pui32Token);
     uint32_t ui32OperandOffset = 1;
+    //Decoded here until we know how many there are, then moved to the arena:
+    Operand asOperands[MAX_INSTRUCTION_OPERANDS];
+
+    memset(asOperands, 0, sizeof(asOperands));
+    psInst->asOperands = asOperands;
 
 #ifdef _DEBUG
     psInst->id = instructionID++;
@@ -777,6 +792,9 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
     psInst->bSaturate = DecodeInstructionSaturate(*pui32Token);
 
     psInst->bAddressOffset = 0;
+    psInst->xType = psInst->yType = psInst->zType = psInst->wType = (RESOURCE_RETURN_TYPE)0;
+    psInst->eResDim = RESOURCE_DIMENSION_UNKNOWN;
+    psInst->ui32ResDimStructureStride = 0;
 
     if(bExtended)
     {
@@ -805,6 +823,7 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
 			else if(eExtType == EXTENDED_OPCODE_RESOURCE_DIM)
 			{
 				psInst->eResDim = DecodeExtendedResourceDimension(ui32ExtOpcodeToken);
+				psInst->ui32ResDimStructureStride = DecodeExtendedResourceStructureStride(ui32ExtOpcodeToken);
 			}
 
 			ui32OperandOffset++;
@@ -856,7 +875,7 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_LABEL:
         {
             psInst->ui32NumOperands = 1;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
 
 			if(eOpcode == OPCODE_CASE)
 			{
@@ -870,7 +889,7 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
             psInst->ui32NumOperands = 1;
             psInst->ui32FuncIndexWithinInterface = pui32Token[ui32OperandOffset];
             ui32OperandOffset++;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
             
             break;
         }
@@ -881,8 +900,8 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_MOV:
         {
             psInst->ui32NumOperands = 2;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
 
             //Mov with an integer dest. If src is an immediate then it must be encoded as an integer.
             if(psInst->asOperands[0].eMinPrecision == OPERAND_MIN_PRECISION_SINT_16 ||
@@ -929,8 +948,8 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_NOT:
         {
             psInst->ui32NumOperands = 2;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
             break;
         }
 
@@ -987,9 +1006,9 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
 		case OPCODE_SAMPLE_POS:		// bo3b: added for WatchDogs
         {
             psInst->ui32NumOperands = 3;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
             break;
         }
         //Instructions with four operands go here
@@ -1017,10 +1036,10 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_DFMA:
 		{
             psInst->ui32NumOperands = 4;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
             break;
 		}
         case OPCODE_GATHER4_PO:
@@ -1030,11 +1049,11 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_IMM_ATOMIC_CMP_EXCH:
         {
             psInst->ui32NumOperands = 5;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[4]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[4]);
             break;
         }
         case OPCODE_GATHER4_C:
@@ -1043,11 +1062,11 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_SAMPLE_B:
 		{
             psInst->ui32NumOperands = 5;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[4]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[4]);
 
 			/* sample_b is not a shadow sampler, others need flagging */
 			if (eOpcode != OPCODE_SAMPLE_B)
@@ -1063,12 +1082,12 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_SAMPLE_D:
         {
             psInst->ui32NumOperands = 6;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[4]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[5]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[4]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[5]);
 
 			/* sample_d is not a shadow sampler, others need flagging */
 			if (eOpcode != OPCODE_SAMPLE_D)
@@ -1088,8 +1107,8 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         {
             psInst->eBooleanTestType = DecodeInstrTestBool(*pui32Token);
             psInst->ui32NumOperands = 2;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
             break;
         }
 		case OPCODE_CUSTOMDATA:
@@ -1101,17 +1120,17 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_EVAL_CENTROID:
         {
             psInst->ui32NumOperands = 2;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
             break;
         }
         case OPCODE_EVAL_SAMPLE_INDEX:
         case OPCODE_EVAL_SNAPPED:
         {
             psInst->ui32NumOperands = 3;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
             break;
         }
         case OPCODE_STORE_UAV_TYPED:
@@ -1120,19 +1139,19 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         case OPCODE_STORE_RAW:
         {
             psInst->ui32NumOperands = 3;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
             break;
         }
         case OPCODE_STORE_STRUCTURED:
         case OPCODE_LD_STRUCTURED:
         {
             psInst->ui32NumOperands = 4;
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[3]);
             break;
         }
 		case OPCODE_RESINFO:
@@ -1141,9 +1160,9 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
 
 			psInst->eResInfoReturnType = DecodeResInfoReturnType(pui32Token[0]);
 
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
-            ui32OperandOffset += DecodeOperand(pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[0]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[1]);
+            ui32OperandOffset += DecodeOperand(psShader, pui32Token+ui32OperandOffset, &psInst->asOperands[2]);
             break;
         }
         case OPCODE_MSAD:
@@ -1158,6 +1177,9 @@ const uint32_t* DeocdeInstruction(const uint32_t* pui32Token, Instruction* psIns
         }
     }
 
+	psInst->asOperands = psShader->arena.AllocateOperands(psInst->ui32NumOperands, asOperands,
+			MAX_INSTRUCTION_OPERANDS);
+
 	UpdateOperandReferences(psShader, psInst);
 
     return pui32Token + ui32TokenLength;
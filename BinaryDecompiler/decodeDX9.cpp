@@ -7,16 +7,26 @@
 #include "internal_includes/reflect.h"
 #include "internal_includes/debug.h"
 #include "log.h"
+
+#include <atomic>
+#include <mutex>
 class DecompileErrorDX9 : public std::exception {} decompileErrorDX9; // 3DMigoto specific
 
 #define FOURCC(a, b, c, d) ((uint32_t)(uint8_t)(a) | ((uint32_t)(uint8_t)(b) << 8) | ((uint32_t)(uint8_t)(c) << 16) | ((uint32_t)(uint8_t)(d) << 24 ))
 enum {FOURCC_CTAB = FOURCC('C', 'T', 'A', 'B')}; //Constant table
 
 #ifdef _DEBUG
-static uint64_t operandID = 0;
-static uint64_t instructionID = 0;
+// Atomic since shaders may be decoded on several threads at once:
+static std::atomic<uint64_t> operandID(0);
+static std::atomic<uint64_t> instructionID(0);
 #endif
 
+// 3DMigoto: The DX9 decoder keeps some state in these globals while decoding
+// a shader, so we hold dx9_decode_lock for the duration of DecodeDX9BC() to
+// allow shaders to be decoded from multiple threads, and reset them at the
+// start of each shader so the result doesn't depend on what was decoded
+// before it.
+static std::mutex dx9_decode_lock;
 static uint32_t aui32ImmediateConst[256];
 static uint32_t ui32MaxTemp = 0;
 
@@ -33,7 +43,7 @@ uint32_t DX9_DECODE_OPERAND_IS_BCONST = 0x20;
 static DECLUSAGE_DX9 aeInputUsage[MAX_INPUTS];
 static uint32_t aui32InputUsageIndex[MAX_INPUTS];
 
-static void DecodeOperandDX9(const Shader* psShader,
+static void DecodeOperandDX9(Shader* psShader,
                              const uint32_t ui32Token,
 							 const uint32_t ui32Token1,
                              uint32_t ui32Flags,
@@ -201,7 +211,7 @@ static void DecodeOperandDX9(const Shader* psShader,
 
         if(bRelativeAddr)
         {
-			psOperand->psSubOperand[0] = new Operand();
+			psOperand->psSubOperand[0] = psShader->arena.AllocateOperands(1);
             DecodeOperandDX9(psShader, ui32Token1, 0, ui32Flags, psOperand->psSubOperand[0]);
 
             psOperand->iIndexDims = INDEX_1D;
@@ -424,7 +434,7 @@ static void SetupRegisterUsage(const Shader* psShader,
 
 //Declaring one constant from a constant buffer will cause all constants in the buffer decalared.
 //In dx9 there is only one constant buffer per shader.
-static void DeclareConstantBuffer(const Shader* psShader,
+static void DeclareConstantBuffer(Shader* psShader,
                                 Declaration* psDecl)
 {
     DECLUSAGE_DX9 eUsage = (DECLUSAGE_DX9)0;
@@ -468,7 +478,7 @@ static void DeclareConstantBuffer(const Shader* psShader,
 	}
 }
 
-static void DecodeDeclarationDX9(const Shader* psShader,
+static void DecodeDeclarationDX9(Shader* psShader,
                                 const uint32_t ui32Token0,
                                 const uint32_t ui32Token1,
                                 Declaration* psDecl)
@@ -567,6 +577,10 @@ static void CreateD3D10Instruction(
 
     memset(psInst, 0, sizeof(Instruction));
 
+    //The callers rearrange the operands to match the SM4 equivalent of the
+    //instruction afterwards, so always give it room for all of them:
+    psInst->asOperands = psShader->arena.AllocateOperands(MAX_INSTRUCTION_OPERANDS);
+
 #ifdef _DEBUG
     psInst->id = instructionID++;
 #endif
@@ -615,8 +629,12 @@ Shader* DecodeDX9BC(const uint32_t* pui32Tokens)
     uint32_t decl, inst;
     uint32_t bDeclareConstantTable = 0;
     Shader* psShader = new Shader();
+    std::lock_guard<std::mutex> lock(dx9_decode_lock);
 
-    memset(aui32ImmediateConst, 0, 256);
+    memset(aui32ImmediateConst, 0, sizeof(aui32ImmediateConst));
+    memset(aeInputUsage, 0, sizeof(aeInputUsage));
+    memset(aui32InputUsageIndex, 0, sizeof(aui32InputUsageIndex));
+    ui32MaxTemp = 0;
 
 	psShader->dx9Shader = true; // 3DMigoto specific
 	psShader->ui32MajorVersion = DecodeProgramMajorVersionDX9(*pui32CurrentToken);
@@ -710,6 +728,10 @@ Shader* DecodeDX9BC(const uint32_t* pui32Tokens)
 
 	psShader->asPhase[MAIN_PHASE].ppsDecl[0].resize(ui32NumDeclarations);
 	psDecl = &psShader->asPhase[MAIN_PHASE].ppsDecl[0][0];
+	for(decl = 0; decl < ui32NumDeclarations; ++decl)
+	{
+		psDecl[decl].asOperands = psShader->arena.AllocateOperands(MAX_DECLARATION_OPERANDS);
+	}
 
     pui32CurrentToken = pui32Tokens + 1;
 
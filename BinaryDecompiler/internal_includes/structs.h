@@ -1,8 +1,11 @@
 #pragma once
 
 #include <map>
+#include <new>
 #include <vector>
 #include <string>
+#include <stdlib.h>
+#include <string.h>
 #include "hlslcc.h"
 
 #include "internal_includes/tokens.h"
@@ -31,18 +34,23 @@ struct Operand
 
     uint32_t aui32ArraySizes[3];
     uint32_t ui32RegisterNumber;
-    //If eType is OPERAND_TYPE_IMMEDIATE32
-    float afImmediates[4];
-    //If eType is OPERAND_TYPE_IMMEDIATE64
-    double adImmediates[4];
+    union {
+        //If eType is OPERAND_TYPE_IMMEDIATE32
+        float afImmediates[4];
+        //If eType is OPERAND_TYPE_IMMEDIATE64
+        double adImmediates[4];
+    };
 
 	int iIntegerImmediate;
 
     SPECIAL_NAME eSpecialName;
-    std::string specialName;
+    //Points to a string literal in DecodeNameToken, never freed. Left NULL
+    //by the DX9 decoder.
+    const char *specialName;
 
     OPERAND_INDEX_REPRESENTATION eIndexRep[3];
 
+    //Allocated from the ShaderArena.
     Operand* psSubOperand[MAX_SUB_OPERANDS];
 
 	//One type for each component.
@@ -52,6 +60,8 @@ struct Operand
 #endif
 };
 
+enum{ MAX_INSTRUCTION_OPERANDS = 6};
+
 struct Instruction
 {
     OPCODE_TYPE eOpcode;
@@ -60,7 +70,10 @@ struct Instruction
     uint32_t ui32SyncFlags;
     uint32_t ui32NumOperands;
 	uint32_t ui32FirstSrc;
-    Operand asOperands[6];
+    //Allocated from the ShaderArena, at least MAX_INSTRUCTION_OPERANDS
+    //long with everything after ui32NumOperands zeroed (see
+    //ShaderArena::AllocateOperands).
+    Operand *asOperands;
     uint32_t bSaturate;
     uint32_t ui32FuncIndexWithinInterface;
 	RESINFO_RETURN_TYPE eResInfoReturnType;
@@ -69,8 +82,11 @@ struct Instruction
     int iUAddrOffset;
     int iVAddrOffset;
     int iWAddrOffset;
+	//Left 0 / RESOURCE_DIMENSION_UNKNOWN when the opcode has no extended
+	//resource return type / dimension token:
 	RESOURCE_RETURN_TYPE xType, yType, zType, wType;
 	RESOURCE_DIMENSION eResDim;
+	uint32_t ui32ResDimStructureStride;
 
 #ifdef _DEBUG
     uint64_t id;
@@ -78,6 +94,7 @@ struct Instruction
 };
 
 enum{ MAX_IMMEDIATE_CONST_BUFFER_VEC4_SIZE = 1024};
+enum{ MAX_DECLARATION_OPERANDS = 2};
 
 struct ICBVec4 {
 	uint32_t a;
@@ -92,9 +109,13 @@ struct Declaration
 
     uint32_t ui32NumOperands;
 
-    Operand asOperands[2];
+    //Allocated from the ShaderArena, at least MAX_DECLARATION_OPERANDS
+    //long with everything after ui32NumOperands zeroed.
+    Operand *asOperands;
 
-	ICBVec4 asImmediateConstBuffer[MAX_IMMEDIATE_CONST_BUFFER_VEC4_SIZE];
+    //Only used by dcl_immediateConstantBuffer. Also in the ShaderArena.
+    ICBVec4 *asImmediateConstBuffer;
+    uint32_t ui32ImmediateConstBufferSize;
     //The declaration can set one of these
     //values depending on the opcode.
     union {
@@ -143,6 +164,86 @@ struct Declaration
 
 };
 
+// Bump allocator for the operands, sub-operands and immediate constant
+// buffers of one decoded shader, so that they are not embedded in every
+// Instruction and Declaration and copied along with them, immediate constant
+// buffers cost what they actually use, and they are all freed in one go with
+// the Shader. Everything it hands out is zeroed, and must be trivially
+// copyable since it is never destructed.
+class ShaderArena
+{
+    enum{ BLOCK_SIZE = 16384 };
+
+    std::vector<char*> blocks;
+    char *pCurrent;
+    size_t uRemaining;
+
+    ShaderArena(const ShaderArena&);
+    ShaderArena& operator=(const ShaderArena&);
+
+public:
+    ShaderArena() :
+        pCurrent(0),
+        uRemaining(0)
+    {
+    }
+
+    ~ShaderArena()
+    {
+        for (size_t i = 0; i < blocks.size(); ++i)
+            free(blocks[i]);
+    }
+
+    void* Allocate(size_t size)
+    {
+        char *p;
+
+        size = (size + 7) & ~(size_t)7;
+
+        //Large allocations (in practice immediate constant buffers) get a
+        //block of their own so they don't waste the rest of the current one:
+        if(size > BLOCK_SIZE / 4)
+        {
+            p = (char*)calloc(1, size);
+            if(!p)
+                throw std::bad_alloc();
+            blocks.push_back(p);
+            return p;
+        }
+
+        if(size > uRemaining || !pCurrent)
+        {
+            pCurrent = (char*)calloc(1, BLOCK_SIZE);
+            if(!pCurrent)
+                throw std::bad_alloc();
+            blocks.push_back(pCurrent);
+            uRemaining = BLOCK_SIZE;
+        }
+
+        p = pCurrent;
+        pCurrent += size;
+        uRemaining -= size;
+        return p;
+    }
+
+    //Parts of the HLSL decompiler index asOperands by the layout they
+    //expect for the opcode rather than checking ui32NumOperands, and used
+    //to find zeroes there when the operands were embedded at their maximum
+    //size. Operands are packed back to back in the arena, so every array
+    //is still given at least ui32Min slots for such a read to find zeroed
+    //ones of its own rather than the next instruction's. The first
+    //ui32Count are copied from psCopyFrom if it is set.
+    Operand* AllocateOperands(uint32_t ui32Count, const Operand *psCopyFrom = 0, uint32_t ui32Min = 0)
+    {
+        Operand *psOperands;
+
+        psOperands = (Operand*)Allocate((ui32Count > ui32Min ? ui32Count : ui32Min) * sizeof(Operand));
+        if(psCopyFrom)
+            memcpy(psOperands, psCopyFrom, ui32Count * sizeof(Operand));
+        return psOperands;
+    }
+};
+
 static const uint32_t MAIN_PHASE = 0;
 static const uint32_t HS_GLOBAL_DECL = 1;
 static const uint32_t HS_CTRL_POINT_PHASE = 2;
@@ -226,6 +327,8 @@ struct Shader
 	bool dx9Shader; // 3DMIGOTO ADDITION
 	uint32_t ui32CurrentVertexOutputStream;
 
+	ShaderArena arena;
+
 	Shader() :
 		ui32MajorVersion(0),
 		ui32MinorVersion(0),
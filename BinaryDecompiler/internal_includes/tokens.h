@@ -545,6 +545,11 @@ static RESOURCE_DIMENSION DecodeExtendedResourceDimension(uint32_t ui32Token)
 	return (RESOURCE_DIMENSION)((ui32Token & 0x000007C0) >> 6);
 }
 
+static uint32_t DecodeExtendedResourceStructureStride(uint32_t ui32Token)
+{
+	return (ui32Token & 0x007FF800) >> 11;
+}
+
 typedef enum INSTRUCTION_TEST_BOOLEAN
 {
     INSTRUCTION_TEST_ZERO       = 0,
@@ -1,5 +1,8 @@
 #include "stdafx.h"
 #include "float.h"
+#include <mutex>
+#include <cmath>
+#include <stdexcept>
 
 #if MIGOTO_DX == 9
 #include <d3dx9shader.h>
@@ -15,7 +18,12 @@ using namespace std;
 // for sscanf_s convinience. Explanation in DecompileHLSL.cpp
 #define UCOUNTOF(...) (unsigned)_countof(__VA_ARGS__)
 
+// Lookup table of instructions that failed to round trip through the
+// assembler, written out by writeLUT() for debugging. The disassembler may be
+// called from several threads at once (e.g. cmd_Decompiler -j), so any access
+// must hold codeBinLock:
 static unordered_map<string, vector<DWORD>> codeBin;
+static mutex codeBinLock;
 
 static DWORD strToDWORD(string s)
 {
@@ -178,6 +186,7 @@ static string convertD(DWORD v1, DWORD v2)
 
 void writeLUT()
 {
+	lock_guard<mutex> lock(codeBinLock);
 	FILE* f;
 
 	fopen_s(&f, "lut.asm", "wb");
@@ -216,33 +225,39 @@ void writeLUT()
 	fclose(f);
 }
 
-static void handleSwizzle(string s, token_operand* tOp, bool special = false)
+static void parseMask(const char *s, token_operand* tOp)
 {
+	tOp->mode = 0; // Mask
+	if (*s == 'x') {
+		tOp->sel |= 0x1;
+		s++;
+	}
+	if (*s == 'y') {
+		tOp->sel |= 0x2;
+		s++;
+	}
+	if (*s == 'z') {
+		tOp->sel |= 0x4;
+		s++;
+	}
+	if (*s == 'w')
+		tOp->sel |= 0x8;
+}
+
+// Takes a pointer into the operand string rather than a copy of the swizzle,
+// as this is called for almost every operand we assemble:
+static void handleSwizzle(const char *s, token_operand* tOp, bool special = false)
+{
+	size_t len = strlen(s);
+
 	if (special == true){
-		// Mask
-		tOp->mode = 0; // Mask
-		if (s.size() > 0 && s[0] == 'x') {
-			tOp->sel |= 0x1;
-			s.erase(s.begin());
-		}
-		if (s.size() > 0 && s[0] == 'y') {
-			tOp->sel |= 0x2;
-			s.erase(s.begin());
-		}
-		if (s.size() > 0 && s[0] == 'z') {
-			tOp->sel |= 0x4;
-			s.erase(s.begin());
-		}
-		if (s.size() > 0 && s[0] == 'w') {
-			tOp->sel |= 0x8;
-			s.erase(s.begin());
-		}
+		parseMask(s, tOp);
 		return;
-	} else if (s.size() == 0) {
+	} else if (len == 0) {
 		tOp->mode = 0;
 		tOp->comps_enum = 0;
 		return;
-	} else if(s.size() == 4) {
+	} else if(len == 4) {
 		// Swizzle
 		tOp->mode = 1; // Swizzle
 		for (int i = 0; i < 4; i++) {
@@ -255,7 +270,7 @@ static void handleSwizzle(string s, token_operand* tOp, bool special = false)
 			if (s[i] == 'w')
 				tOp->sel |= 3 << (2 * i);
 		}
-	} else if (s.size() == 1){
+	} else if (len == 1){
 		tOp->mode = 2; // Scalar
 		if (s[0] == 'x')
 			tOp->sel = 0;
@@ -266,24 +281,7 @@ static void handleSwizzle(string s, token_operand* tOp, bool special = false)
 		if (s[0] == 'w')
 			tOp->sel = 3;
 	} else {
-		// Mask
-		tOp->mode = 0; // Mask
-		if (s.size() > 0 && s[0] == 'x') {
-			tOp->sel |= 0x1;
-			s.erase(s.begin());
-		}
-		if (s.size() > 0 && s[0] == 'y') {
-			tOp->sel |= 0x2;
-			s.erase(s.begin());
-		}
-		if (s.size() > 0 && s[0] == 'z') {
-			tOp->sel |= 0x4;
-			s.erase(s.begin());
-		}
-		if (s.size() > 0 && s[0] == 'w') {
-			tOp->sel |= 0x8;
-			s.erase(s.begin());
-		}
+		parseMask(s, tOp);
 	}
 }
 
@@ -343,6 +341,10 @@ static bool assemble_special_purpose_register(string &s, vector<DWORD> &v, token
 	int i;
 
 	for (i = 0; i < ARRAYSIZE(special_purpose_registers); i++) {
+		// Cheap first character check before the full comparison,
+		// since this is tried for every operand we assemble:
+		if (s[0] != special_purpose_registers[i].name[0])
+			continue;
 		if (s.compare(0, swiz_pos, special_purpose_registers[i].name))
 			continue;
 
@@ -350,7 +352,7 @@ static bool assemble_special_purpose_register(string &s, vector<DWORD> &v, token
 
 		// comps_enum was set to 2 as a default at the start of assembleOp
 		if (swiz_pos != string::npos)
-			handleSwizzle(s.substr(swiz_pos + 1), tOp, special);
+			handleSwizzle(s.c_str() + swiz_pos + 1, tOp, special);
 		else
 			tOp->comps_enum = special_purpose_registers[i].comps_enum;
 
@@ -363,7 +365,7 @@ static bool assemble_special_purpose_register(string &s, vector<DWORD> &v, token
 
 static vector<DWORD> assembleOp(string s, bool special = false);
 
-static vector<DWORD> assemble_cbvox_operand(string &s, vector<DWORD> &v, token_operand *tOp, bool special, DWORD num)
+static void assemble_cbvox_operand(string &s, vector<DWORD> &v, token_operand *tOp, bool special, DWORD num)
 {
 	tOp->num_indices = 2;
 	if (s[0] == 'x') { // Indexable temp array
@@ -377,18 +379,13 @@ static vector<DWORD> assemble_cbvox_operand(string &s, vector<DWORD> &v, token_o
 		tOp->file = 1;
 		if (s.size() > 4 && s[1] == 'i' && s[2] == 'c' && s[3] == 'p')  { // Hull shader vicp
 			tOp->file = 0x19;
-			s.erase(s.begin());
-			s.erase(s.begin());
-			s.erase(s.begin());
+			s.erase(0, 3);
 		} else if (s.size() > 4 && s[1] == 'o' && s[2] == 'c' && s[3] == 'p') { // Hull shader vocp
 			tOp->file = 0x1A;
-			s.erase(s.begin());
-			s.erase(s.begin());
-			s.erase(s.begin());
+			s.erase(0, 3);
 		} else if (s[1] == 'p' && s[2] == 'c') { // Patch constant
 			tOp->file = 0x1B;
-			s.erase(s.begin());
-			s.erase(s.begin());
+			s.erase(0, 2);
 		}
 		s.erase(s.begin());
 		tOp->num_indices = 1;
@@ -413,7 +410,7 @@ static vector<DWORD> assemble_cbvox_operand(string &s, vector<DWORD> &v, token_o
 					int iAdd2 = atoi(sAdd.c_str());
 					if (iAdd2) tOp->index1_repr = 3;
 					string swizzle = s.substr(s.find("].") + 2);
-					handleSwizzle(swizzle, tOp);
+					handleSwizzle(swizzle.c_str(), tOp);
 					v.insert(v.begin(), tOp->op);
 					if (iAdd) v.push_back(iAdd);
 					v.push_back(reg[0]);
@@ -421,35 +418,32 @@ static vector<DWORD> assemble_cbvox_operand(string &s, vector<DWORD> &v, token_o
 					if (iAdd2) v.push_back(iAdd2);
 					v.push_back(reg2[0]);
 					v.push_back(reg2[1]);
-					return v;
+					return;
 				}
 				string swizzle = s.substr(s.find("].") + 2);
-				handleSwizzle(swizzle, tOp);
+				handleSwizzle(swizzle.c_str(), tOp);
 				v.insert(v.begin(), tOp->op);
 				if (iAdd) v.push_back(iAdd);
 				v.push_back(reg[0]);
 				v.push_back(reg[1]);
 				v.push_back(atoi(index1.c_str()));
-				return v;
+				return;
 			}
 			tOp->num_indices = 2;
 			string swizzle = s.substr(s.find('.') + 1);
-			handleSwizzle(swizzle, tOp, special);
+			handleSwizzle(swizzle.c_str(), tOp, special);
 			v.insert(v.begin(), tOp->op);
 			v.push_back(atoi(index0.c_str()));
 			v.push_back(atoi(index1.c_str()));
-			return v;
+			return;
 		}
 	} else if (s[0] == 'i') { // Immediate Constant Buffer
 		tOp->file = 9;
-		s.erase(s.begin());
-		s.erase(s.begin());
-		s.erase(s.begin());
+		s.erase(0, 3);
 		tOp->num_indices = 1;
 	} else { // Constant buffer
 		tOp->file = 8;
-		s.erase(s.begin());
-		s.erase(s.begin());
+		s.erase(0, 2);
 	}
 	string sNum;
 	bool hasIndex = false;
@@ -490,32 +484,31 @@ static vector<DWORD> assemble_cbvox_operand(string &s, vector<DWORD> &v, token_o
 			for (DWORD i = 0; i < reg.size(); i++) {
 				v.push_back(reg[i]);
 			}
-			handleSwizzle(s.substr(s.find("].") + 2), tOp, special);
+			handleSwizzle(s.c_str() + (s.find("].") + 2), tOp, special);
 
 			v.insert(v.begin(), tOp->op);
-			return v;
+			return;
 		}
 		DWORD idx = atoi(index.c_str());
 		num = atoi(sNum.c_str());
 		v.push_back(num);
 		v.push_back(idx);
 		if (s.find('.') < s.size()) {
-			handleSwizzle(s.substr(s.find('.') + 1), tOp, special);
+			handleSwizzle(s.c_str() + (s.find('.') + 1), tOp, special);
 		} else {
 			tOp->mode = 1; // Swizzle
 			tOp->sel = 0xE4;
 		}
 		v.insert(v.begin(), tOp->op);
-		return v;
+		return;
 	}
 	num = atoi(sNum.c_str());
 	v.push_back(num);
-	handleSwizzle(s.substr(s.find('.') + 1), tOp, special);
+	handleSwizzle(s.c_str() + (s.find('.') + 1), tOp, special);
 	v.insert(v.begin(), tOp->op);
-	return v;
 }
 
-static vector<DWORD> assemble_literal_operand(string &s, vector<DWORD> &v, token_operand *tOp)
+static void assemble_literal_operand(string &s, vector<DWORD> &v, token_operand *tOp)
 {
 	tOp->file = 4;
 	s.erase(s.begin());
@@ -546,10 +539,9 @@ static vector<DWORD> assemble_literal_operand(string &s, vector<DWORD> &v, token
 		v.push_back(strToDWORD(s));
 	}
 	v.insert(v.begin(), tOp->op);
-	return v;
 }
 
-static vector<DWORD> assemble_double_operand(string &s, vector<DWORD> &v, token_operand *tOp)
+static void assemble_double_operand(string &s, vector<DWORD> &v, token_operand *tOp)
 {
 	// Examples of double literals (from RE2):
 	//   d(0.000000l, 766800.000000l)
@@ -611,7 +603,6 @@ static vector<DWORD> assemble_double_operand(string &s, vector<DWORD> &v, token_
 	v.push_back(q1 >> 32);
 	v.push_back(q2 & 0xffffffff);
 	v.push_back(q2 >> 32);
-	return v;
 }
 
 static DWORD encode_min_precision_type(const char *type)
@@ -696,6 +687,11 @@ static vector<DWORD> assembleOp(string s, bool special)
 		v.push_back(num);
 		return v;
 	}
+	// Operand token, extended operand token and up to three indices of
+	// which one may be relative, or four literal components. Reserve
+	// enough up front that we don't reallocate as it grows:
+	v.reserve(8);
+
 	if (s[0] == '-') {
 		s.erase(s.begin());
 		tOp->extended = 1;
@@ -740,14 +736,19 @@ static vector<DWORD> assembleOp(string s, bool special)
 	 || s[0] == 'x'
 	 || s[0] == 'o'
 	 || s[0] == 'v') {
-		return assemble_cbvox_operand(s, v, tOp, special, num);
+		assemble_cbvox_operand(s, v, tOp, special, num);
+		return v;
 	}
 
-	if (s[0] == 'l')
-		return assemble_literal_operand(s, v, tOp);
+	if (s[0] == 'l') {
+		assemble_literal_operand(s, v, tOp);
+		return v;
+	}
 
-	if (s[0] == 'd')
-		return assemble_double_operand(s, v, tOp);
+	if (s[0] == 'd') {
+		assemble_double_operand(s, v, tOp);
+		return v;
+	}
 
 	if (s[0] == 'r') {
 		tOp->file = 0;
@@ -766,10 +767,10 @@ static vector<DWORD> assembleOp(string s, bool special)
 
 	s.erase(s.begin());
 	tOp->num_indices = 1;
-	num = atoi(s.substr(0, s.find('.')).c_str());
+	num = atoi(s.c_str()); // Stops at the swizzle
 	v.push_back(num);
 	if (s.find('.') < s.size()) {
-		handleSwizzle(s.substr(s.find('.') + 1), tOp, special);
+		handleSwizzle(s.c_str() + (s.find('.') + 1), tOp, special);
 	} else {
 		handleSwizzle("", tOp, special);
 	}
@@ -777,9 +778,10 @@ static vector<DWORD> assembleOp(string s, bool special)
 	return v;
 }
 
-static vector<string> strToWords(string s)
+static vector<string> strToWords(const string &s)
 {
 	vector<string> words;
+	words.reserve(8);
 	string::size_type start = 0;
 	while (s[start] == ' ') start++;
 	string::size_type end = start;
@@ -841,12 +843,10 @@ static vector<string> strToWords(string s)
 			words.push_back(s.substr(start, length));
 		}
 	}
-	for (size_t i = 0; i < words.size(); i++) {
-		string s2 = words[i];
+	for (string &word : words) {
 		// Fixed access before start of array -DarkStarSword
-		if (!s2.empty() && s2[s2.size() - 1] == ',')
-			s2.erase(--s2.end());
-		words[i] = s2;
+		if (!word.empty() && word.back() == ',')
+			word.pop_back();
 	}
 	return words;
 }
@@ -869,7 +869,103 @@ static unordered_map<string, vector<DWORD>> hackMap = {
 	{ "dcl_output oMask", { 0x02000065, 0x0000F000 } },
 };
 
-static unordered_map<string, vector<int>> ldMap = {
+// Every mnemonic the assembler understands is listed in a single table sorted
+// by name so that assembleIns() can find it with a binary search and switch on
+// how it is encoded, rather than testing the mnemonic against each of the
+// instructions in turn. Most instructions are encoded generically from their
+// operand count and opcode (ASM_INS), the load/sample family has _aoffimmi and
+// _indexable variants that add extended opcode tokens (ASM_LD) and the rest
+// (mostly declarations) have their own encoder in assembleIns().
+//
+// Shader model (ps_5_0, etc) and sync_* instructions are matched by prefix and
+// are not in the table.
+//
+// Opcodes not yet implemented:
+// TODO: call                             0x04
+// TODO: callc                            0x05
+// TODO: label                            0x2c
+// TODO: Custom data                      0x35
+//       dcl_immediateConstantBuffer, printf and errorf are implemented
+//       Other types from binary decompiler:
+//        - comment
+//        - debuginfo
+//        - opaque
+// TODO: interface_call                   0x78
+// TODO: dcl_function_body                0x90
+// TODO: dcl_function_table               0x91
+// TODO: dcl_interface                    0x92
+// TODO: dcl_hs_join_phase_instance_count 0x9a
+// TODO: debug_break                      0xd0
+enum asm_ins_encoding {
+	ASM_UNKNOWN,
+	ASM_INS,
+	ASM_LD,
+	ASM_DCL_INPUT,
+	ASM_DCL_OUTPUT,
+	ASM_DCL_RESOURCE_RAW,
+	ASM_DCL_RESOURCE_BUFFER,
+	ASM_DCL_RESOURCE_TEXTURE1D,
+	ASM_DCL_RESOURCE_TEXTURE1DARRAY,
+	ASM_DCL_UAV_TYPED_TEXTURE1D,
+	ASM_DCL_UAV_TYPED_TEXTURE1DARRAY,
+	ASM_DCL_RESOURCE_TEXTURE2D,
+	ASM_DCL_UAV_TYPED_BUFFER,
+	ASM_DCL_RESOURCE_TEXTURE3D,
+	ASM_DCL_UAV_TYPED_TEXTURE3D,
+	ASM_DCL_RESOURCE_TEXTURECUBE,
+	ASM_DCL_RESOURCE_TEXTURECUBEARRAY,
+	ASM_DCL_RESOURCE_TEXTURE2DARRAY,
+	ASM_DCL_UAV_TYPED_TEXTURE2D,
+	ASM_DCL_UAV_TYPED_TEXTURE2DARRAY,
+	ASM_DCL_RESOURCE_TEXTURE2DMS,
+	ASM_DCL_RESOURCE_TEXTURE2DMSARRAY,
+	ASM_DCL_INDEXRANGE,
+	ASM_DCL_TEMPS,
+	ASM_DCL_RESOURCE_STRUCTURED,
+	ASM_DCL_SAMPLER,
+	ASM_DCL_GLOBALFLAGS,
+	ASM_DCL_CONSTANTBUFFER,
+	ASM_DCL_OUTPUT_SGV,
+	ASM_DCL_OUTPUT_SIV,
+	ASM_DCL_INPUT_SIV,
+	ASM_DCL_INPUT_SGV,
+	ASM_DCL_INPUT_PS,
+	ASM_DCL_INPUT_PS_SGV,
+	ASM_DCL_INPUT_PS_SIV,
+	ASM_DCL_INDEXABLETEMP,
+	ASM_DCL_IMMEDIATECONSTANTBUFFER,
+	ASM_DCL_TESSELLATOR_PARTITIONING,
+	ASM_DCL_TESSELLATOR_OUTPUT_PRIMITIVE,
+	ASM_DCL_TESSELLATOR_DOMAIN,
+	ASM_DCL_STREAM,
+	ASM_EMIT_STREAM,
+	ASM_CUT_STREAM,
+	ASM_EMIT_THEN_CUT_STREAM,
+	ASM_DCL_OUTPUTTOPOLOGY,
+	ASM_DCL_OUTPUT_CONTROL_POINT_COUNT,
+	ASM_DCL_INPUT_CONTROL_POINT_COUNT,
+	ASM_DCL_MAXOUT,
+	ASM_DCL_INPUTPRIMITIVE,
+	ASM_DCL_HS_MAX_TESSFACTOR,
+	ASM_DCL_HS_FORK_PHASE_INSTANCE_COUNT,
+	ASM_SAMPLEPOS,
+	ASM_STORE_UAV_TYPED,
+	ASM_PRINTF,
+	ASM_ERRORF,
+	ASM_UNDECIPHERABLE,
+};
+
+struct asm_ins_desc {
+	const char *name;
+	asm_ins_encoding encoding;
+	int numOps;
+	int opcode;
+	// ASM_INS: Number of leading operands that are assembled as special
+	// (destination) operands. ASM_LD: 1 = _aoffimmi, 2 = _indexable
+	int extra;
+};
+
+static constexpr asm_ins_desc insTable[] = {
 	// Hint: Compiling for shader model 5 always uses _indexable variants,
 	//       so use shader model 4 to test vanilla and _aoffimmi (address
 	//       offset immediate) variants. resource_types.hlsl has test cases
@@ -880,300 +976,319 @@ static unordered_map<string, vector<int>> ldMap = {
 	//       shader model 5+ and compiling for that shader model always
 	//       seems to use the _indexable variants found here.
 	//               -DarkStarSword
-
-	{ "ld_aoffimmi",                    { 3, 0x2d, 1 } },
-	{ "ld_indexable",                   { 3, 0x2d, 2 } },
-	{ "ld_aoffimmi_indexable",          { 3, 0x2d, 3 } },
-
-	{ "ldms_aoffimmi",                  { 4, 0x2e, 1 } }, // Added and verified -DarkStarSword
-	{ "ldms_indexable",                 { 4, 0x2e, 2 } },
-	{ "ldms_aoffimmi_indexable",        { 4, 0x2e, 3 } },
-
-	// _aoffimmi doesn't make sense for resinfo. Be aware that there are
-	// _uint and _rcpfloat variants handled elsewhere in the code.
-	//   -DarkStarSword
-	{ "resinfo_indexable",              { 3, 0x3d, 2 } },
-
-	{ "sample_aoffimmi",                { 4, 0x45, 1 } },
-	{ "sample_indexable",               { 4, 0x45, 2 } },
-	{ "sample_aoffimmi_indexable",      { 4, 0x45, 3 } },
-
-	{ "sample_c_aoffimmi",              { 5, 0x46, 1 } },
-	{ "sample_c_indexable",             { 5, 0x46, 2 } },
-	{ "sample_c_aoffimmi_indexable",    { 5, 0x46, 3 } }, // Added and verified -DarkStarSword
-
-	{ "sample_c_lz_aoffimmi",           { 5, 0x47, 1 } },
-	{ "sample_c_lz_indexable",          { 5, 0x47, 2 } },
-	{ "sample_c_lz_aoffimmi_indexable", { 5, 0x47, 3 } },
-
-	{ "sample_l_aoffimmi",              { 5, 0x48, 1 } },
-	{ "sample_l_indexable",             { 5, 0x48, 2 } },
-	{ "sample_l_aoffimmi_indexable",    { 5, 0x48, 3 } },
-
-	{ "sample_d_aoffimmi",              { 6, 0x49, 1 } }, // Added and verified -DarkStarSword
-	{ "sample_d_indexable",             { 6, 0x49, 2 } },
-	{ "sample_d_aoffimmi_indexable",    { 6, 0x49, 3 } }, // Added and verified -DarkStarSword
-
-	{ "sample_b_aoffimmi",              { 5, 0x4a, 1 } }, // Added and verified -DarkStarSword
-	{ "sample_b_indexable",             { 5, 0x4a, 2 } },
-	{ "sample_b_aoffimmi_indexable",    { 5, 0x4a, 3 } }, // Added and verified -DarkStarSword
-
-	{ "gather4_aoffimmi",               { 4, 0x6d, 1 } }, // Unverified (not in SM4 so only indexable variants?)
-	{ "gather4_indexable",              { 4, 0x6d, 2 } },
-	{ "gather4_aoffimmi_indexable",     { 4, 0x6d, 3 } },
-
+	//
+	// Keep this sorted by name - checked at compile time below.
+	{ "abort",                            ASM_INS, 0, 0xcf, 1 }, // Debug layer instruction. Added and verified -DarkStarSword
+	{ "add",                              ASM_INS, 3, 0x00, 1 },
+	{ "and",                              ASM_INS, 3, 0x01, 1 },
+	{ "atomic_and",                       ASM_INS, 3, 0xa9, 0 },
+	{ "atomic_cmp_store",                 ASM_INS, 4, 0xac, 0 }, // Added and verified -DarkStarSword
+	{ "atomic_iadd",                      ASM_INS, 3, 0xad, 0 },
+	{ "atomic_imax",                      ASM_INS, 3, 0xae, 0 },
+	{ "atomic_imin",                      ASM_INS, 3, 0xaf, 0 },
+	{ "atomic_or",                        ASM_INS, 3, 0xaa, 0 },
+	{ "atomic_umax",                      ASM_INS, 3, 0xb0, 0 },
+	{ "atomic_umin",                      ASM_INS, 3, 0xb1, 0 },
+	{ "atomic_xor",                       ASM_INS, 3, 0xab, 0 }, // Added and verified -DarkStarSword
+	{ "bfi",                              ASM_INS, 5, 0x8c, 1 },
+	{ "bfrev",                            ASM_INS, 2, 0x8d, 1 },
+	{ "break",                            ASM_INS, 0, 0x02, 1 },
+	{ "breakc_nz",                        ASM_INS, 1, 0x03, 0 },
+	{ "breakc_z",                         ASM_INS, 1, 0x03, 0 },
+	{ "bufinfo",                          ASM_INS, 2, 0x79, 1 }, // Unverified (not in SM4 so only indexable variants?). See also ASM_LD variants.
 	// _aoffimmi doesn't make sense for bufinfo
-	{ "bufinfo_indexable",              { 2, 0x79, 2 } },
-
-	{ "gather4_c_aoffimmi",             { 5, 0x7e, 1 } }, // Unverified (not in SM4 so only indexable variants?)
-	{ "gather4_c_indexable",            { 5, 0x7e, 2 } },
-	{ "gather4_c_aoffimmi_indexable",   { 5, 0x7e, 3 } },
-
+	{ "bufinfo_indexable",                ASM_LD,  2, 0x79, 2 },
+	{ "case",                             ASM_INS, 1, 0x06, 1 },
+	{ "continue",                         ASM_INS, 0, 0x07, 1 },
+	{ "continuec_nz",                     ASM_INS, 1, 0x08, 0 },
+	{ "continuec_z",                      ASM_INS, 1, 0x08, 0 },
+	{ "countbits",                        ASM_INS, 2, 0x86, 1 },
+	{ "cut",                              ASM_INS, 0, 0x09, 1 },
+	{ "cut_stream",                       ASM_CUT_STREAM },
+	{ "dadd",                             ASM_INS, 3, 0xbf, 1 }, // Added and verified -DarkStarSword
+	{ "dcl_constantbuffer",               ASM_DCL_CONSTANTBUFFER },
+	{ "dcl_globalFlags",                  ASM_DCL_GLOBALFLAGS },
+	{ "dcl_gsinstances",                  ASM_INS, 1, 0xce, 1 }, // Added and verified -DarkStarSword
+	{ "dcl_hs_fork_phase_instance_count", ASM_DCL_HS_FORK_PHASE_INSTANCE_COUNT },
+	{ "dcl_hs_max_tessfactor",            ASM_DCL_HS_MAX_TESSFACTOR },
+	{ "dcl_immediateConstantBuffer",      ASM_DCL_IMMEDIATECONSTANTBUFFER },
+	{ "dcl_indexableTemp",                ASM_DCL_INDEXABLETEMP },
+	{ "dcl_indexrange",                   ASM_DCL_INDEXRANGE },
+	{ "dcl_input",                        ASM_DCL_INPUT },
+	{ "dcl_input_control_point_count",    ASM_DCL_INPUT_CONTROL_POINT_COUNT },
+	{ "dcl_input_ps",                     ASM_DCL_INPUT_PS },
+	{ "dcl_input_ps_sgv",                 ASM_DCL_INPUT_PS_SGV },
+	{ "dcl_input_ps_siv",                 ASM_DCL_INPUT_PS_SIV },
+	{ "dcl_input_sgv",                    ASM_DCL_INPUT_SGV },
+	{ "dcl_input_siv",                    ASM_DCL_INPUT_SIV },
+	{ "dcl_inputprimitive",               ASM_DCL_INPUTPRIMITIVE },
+	{ "dcl_maxout",                       ASM_DCL_MAXOUT },
+	{ "dcl_output",                       ASM_DCL_OUTPUT },
+	{ "dcl_output_control_point_count",   ASM_DCL_OUTPUT_CONTROL_POINT_COUNT },
+	{ "dcl_output_sgv",                   ASM_DCL_OUTPUT_SGV },
+	{ "dcl_output_siv",                   ASM_DCL_OUTPUT_SIV },
+	{ "dcl_outputtopology",               ASM_DCL_OUTPUTTOPOLOGY },
+	{ "dcl_resource_buffer",              ASM_DCL_RESOURCE_BUFFER },
+	{ "dcl_resource_raw",                 ASM_DCL_RESOURCE_RAW },
+	{ "dcl_resource_structured",          ASM_DCL_RESOURCE_STRUCTURED },
+	{ "dcl_resource_texture1d",           ASM_DCL_RESOURCE_TEXTURE1D },
+	{ "dcl_resource_texture1darray",      ASM_DCL_RESOURCE_TEXTURE1DARRAY },
+	{ "dcl_resource_texture2d",           ASM_DCL_RESOURCE_TEXTURE2D },
+	{ "dcl_resource_texture2darray",      ASM_DCL_RESOURCE_TEXTURE2DARRAY },
+	{ "dcl_resource_texture2dms",         ASM_DCL_RESOURCE_TEXTURE2DMS },
+	{ "dcl_resource_texture2dmsarray",    ASM_DCL_RESOURCE_TEXTURE2DMSARRAY },
+	{ "dcl_resource_texture3d",           ASM_DCL_RESOURCE_TEXTURE3D },
+	{ "dcl_resource_texturecube",         ASM_DCL_RESOURCE_TEXTURECUBE },
+	{ "dcl_resource_texturecubearray",    ASM_DCL_RESOURCE_TEXTURECUBEARRAY },
+	{ "dcl_sampler",                      ASM_DCL_SAMPLER },
+	{ "dcl_stream",                       ASM_DCL_STREAM },
+	{ "dcl_temps",                        ASM_DCL_TEMPS },
+	{ "dcl_tessellator_domain",           ASM_DCL_TESSELLATOR_DOMAIN },
+	{ "dcl_tessellator_output_primitive", ASM_DCL_TESSELLATOR_OUTPUT_PRIMITIVE },
+	{ "dcl_tessellator_partitioning",     ASM_DCL_TESSELLATOR_PARTITIONING },
+	{ "dcl_tgsm_raw",                     ASM_INS, 2, 0x9f, 0 },
+	{ "dcl_tgsm_structured",              ASM_INS, 3, 0xa0, 0 },
+	{ "dcl_thread_group",                 ASM_INS, 3, 0x9b, 1 },
+	{ "dcl_uav_raw",                      ASM_INS, 1, 0x9d, 0 }, // _glc variant handled elsewhere
+	{ "dcl_uav_structured",               ASM_INS, 2, 0x9e, 0 }, // _glc variant handled elsewhere
+	{ "dcl_uav_typed_buffer",             ASM_DCL_UAV_TYPED_BUFFER },
+	{ "dcl_uav_typed_texture1d",          ASM_DCL_UAV_TYPED_TEXTURE1D },
+	{ "dcl_uav_typed_texture1darray",     ASM_DCL_UAV_TYPED_TEXTURE1DARRAY },
+	{ "dcl_uav_typed_texture2d",          ASM_DCL_UAV_TYPED_TEXTURE2D },
+	{ "dcl_uav_typed_texture2darray",     ASM_DCL_UAV_TYPED_TEXTURE2DARRAY },
+	{ "dcl_uav_typed_texture3d",          ASM_DCL_UAV_TYPED_TEXTURE3D },
+	{ "ddiv",                             ASM_INS, 3, 0xd2, 1 }, // Added and verified -DarkStarSword
+	{ "default",                          ASM_INS, 0, 0x0a, 1 },
+	{ "deq",                              ASM_INS, 3, 0xc3, 1 }, // Added and verified -DarkStarSword
+	{ "deriv_rtx",                        ASM_INS, 2, 0x0b, 1 },
+	{ "deriv_rtx_coarse",                 ASM_INS, 2, 0x7a, 1 },
+	{ "deriv_rtx_fine",                   ASM_INS, 2, 0x7b, 1 },
+	{ "deriv_rty",                        ASM_INS, 2, 0x0c, 1 },
+	{ "deriv_rty_coarse",                 ASM_INS, 2, 0x7c, 1 },
+	{ "deriv_rty_fine",                   ASM_INS, 2, 0x7d, 1 },
+	{ "dfma",                             ASM_INS, 4, 0xd3, 1 }, // Added and verified -DarkStarSword
+	{ "dge",                              ASM_INS, 3, 0xc4, 1 }, // Added and verified -DarkStarSword
+	{ "discard_nz",                       ASM_INS, 1, 0x0d, 0 },
+	{ "discard_z",                        ASM_INS, 1, 0x0d, 0 },
+	{ "div",                              ASM_INS, 3, 0x0e, 1 },
+	{ "dlt",                              ASM_INS, 3, 0xc5, 1 }, // Added and verified -DarkStarSword
+	{ "dmax",                             ASM_INS, 3, 0xc0, 1 }, // Added and verified -DarkStarSword
+	{ "dmin",                             ASM_INS, 3, 0xc1, 1 }, // Added and verified -DarkStarSword
+	{ "dmov",                             ASM_INS, 2, 0xc7, 1 }, // Unverified
+	{ "dmovc",                            ASM_INS, 4, 0xc8, 1 }, // Added and verified -DarkStarSword
+	{ "dmul",                             ASM_INS, 3, 0xc2, 1 }, // Added and verified -DarkStarSword
+	{ "dne",                              ASM_INS, 3, 0xc6, 1 }, // Added and verified -DarkStarSword
+	{ "dp2",                              ASM_INS, 3, 0x0f, 1 },
+	{ "dp3",                              ASM_INS, 3, 0x10, 1 },
+	{ "dp4",                              ASM_INS, 3, 0x11, 1 },
+	{ "drcp",                             ASM_INS, 2, 0xd4, 1 }, // Added and verified -DarkStarSword
+	{ "dtof",                             ASM_INS, 2, 0xc9, 1 }, // Added and verified -DarkStarSword
+	{ "dtoi",                             ASM_INS, 2, 0xd6, 1 }, // Added and verified -DarkStarSword
+	{ "dtou",                             ASM_INS, 2, 0xd7, 1 }, // Added and verified -DarkStarSword
+	{ "else",                             ASM_INS, 0, 0x12, 1 },
+	{ "emit",                             ASM_INS, 0, 0x13, 1 },
+	{ "emit_stream",                      ASM_EMIT_STREAM },
+	{ "emit_then_cut",                    ASM_INS, 0, 0x14, 1 }, // Partially verified - assembled & disassembled OK, but did not check against compiled shader -DSS
+	{ "emit_then_cut_stream",             ASM_EMIT_THEN_CUT_STREAM },
+	{ "endif",                            ASM_INS, 0, 0x15, 1 },
+	{ "endloop",                          ASM_INS, 0, 0x16, 1 },
+	{ "endswitch",                        ASM_INS, 0, 0x17, 1 },
+	{ "eq",                               ASM_INS, 3, 0x18, 1 },
+	{ "errorf",                           ASM_ERRORF },
+	{ "eval_centroid",                    ASM_INS, 2, 0xcd, 1 }, // Added and verified -DarkStarSword
+	{ "eval_sample_index",                ASM_INS, 3, 0xcc, 1 },
+	{ "eval_snapped",                     ASM_INS, 3, 0xcb, 1 }, // Added and verified -DarkStarSword
+	{ "exp",                              ASM_INS, 2, 0x19, 1 },
+	{ "f16tof32",                         ASM_INS, 2, 0x83, 1 },
+	{ "f32tof16",                         ASM_INS, 2, 0x82, 1 },
+	{ "firstbit_hi",                      ASM_INS, 2, 0x87, 1 },
+	{ "firstbit_lo",                      ASM_INS, 2, 0x88, 1 },
+	{ "firstbit_shi",                     ASM_INS, 2, 0x89, 1 }, // Added and verified -DarkStarSword
+	{ "frc",                              ASM_INS, 2, 0x1a, 1 },
+	{ "ftod",                             ASM_INS, 2, 0xca, 1 }, // Added and verified -DarkStarSword
+	{ "ftoi",                             ASM_INS, 2, 0x1b, 1 },
+	{ "ftou",                             ASM_INS, 2, 0x1c, 1 },
+	{ "gather4",                          ASM_INS, 4, 0x6d, 1 }, // See also ASM_LD variants
+	{ "gather4_aoffimmi",                 ASM_LD,  4, 0x6d, 1 }, // Unverified (not in SM4 so only indexable variants?)
+	{ "gather4_aoffimmi_indexable",       ASM_LD,  4, 0x6d, 3 },
+	{ "gather4_c",                        ASM_INS, 5, 0x7e, 1 }, // Unverified (not in SM4 so only indexable variants?). See also ASM_LD variants.
+	{ "gather4_c_aoffimmi",               ASM_LD,  5, 0x7e, 1 }, // Unverified (not in SM4 so only indexable variants?)
+	{ "gather4_c_aoffimmi_indexable",     ASM_LD,  5, 0x7e, 3 },
+	{ "gather4_c_indexable",              ASM_LD,  5, 0x7e, 2 },
+	{ "gather4_indexable",                ASM_LD,  4, 0x6d, 2 },
+	{ "gather4_po",                       ASM_INS, 5, 0x7f, 1 }, // Unverified (not in SM4 so only indexable variants?). See also ASM_LD variants.
+	{ "gather4_po_c",                     ASM_INS, 6, 0x80, 1 }, // Unverified (not in SM4 so only indexable variants?). See also ASM_LD variants.
 	// gather4_po variants do not have an _aoffimmi variant by definition
 	// https://msdn.microsoft.com/en-us/library/windows/desktop/hh447084(v=vs.85).aspx
-	{ "gather4_po_indexable",           { 5, 0x7f, 2 } },
-	{ "gather4_po_c_indexable",         { 6, 0x80, 2 } },
-
+	{ "gather4_po_c_indexable",           ASM_LD,  6, 0x80, 2 },
+	{ "gather4_po_indexable",             ASM_LD,  5, 0x7f, 2 },
+	{ "ge",                               ASM_INS, 3, 0x1d, 1 },
+	{ "hs_control_point_phase",           ASM_INS, 0, 0x72, 1 },
+	{ "hs_decls",                         ASM_INS, 0, 0x71, 1 },
+	{ "hs_fork_phase",                    ASM_INS, 0, 0x73, 1 },
+	{ "hs_join_phase",                    ASM_INS, 0, 0x74, 1 },
+	{ "iadd",                             ASM_INS, 3, 0x1e, 1 },
+	{ "ibfe",                             ASM_INS, 4, 0x8b, 1 },
+	{ "ieq",                              ASM_INS, 3, 0x20, 1 },
+	{ "if_nz",                            ASM_INS, 1, 0x1f, 0 },
+	{ "if_z",                             ASM_INS, 1, 0x1f, 0 },
+	{ "ige",                              ASM_INS, 3, 0x21, 1 },
+	{ "ilt",                              ASM_INS, 3, 0x22, 1 },
+	{ "imad",                             ASM_INS, 4, 0x23, 1 },
+	{ "imax",                             ASM_INS, 3, 0x24, 1 },
+	{ "imin",                             ASM_INS, 3, 0x25, 1 },
+	{ "imm_atomic_alloc",                 ASM_INS, 2, 0xb2, 1 },
+	{ "imm_atomic_and",                   ASM_INS, 4, 0xb5, 1 },
+	{ "imm_atomic_cmp_exch",              ASM_INS, 5, 0xb9, 1 },
+	{ "imm_atomic_consume",               ASM_INS, 2, 0xb3, 1 },
+	{ "imm_atomic_exch",                  ASM_INS, 4, 0xb8, 1 },
+	{ "imm_atomic_iadd",                  ASM_INS, 4, 0xb4, 1 },
+	{ "imm_atomic_imax",                  ASM_INS, 4, 0xba, 1 }, // Added and verified -DarkStarSword
+	{ "imm_atomic_imin",                  ASM_INS, 4, 0xbb, 1 }, // Added and verified -DarkStarSword
+	{ "imm_atomic_or",                    ASM_INS, 4, 0xb6, 1 }, // Added and verified -DarkStarSword
+	{ "imm_atomic_umax",                  ASM_INS, 4, 0xbc, 1 }, // Added and verified -DarkStarSword
+	{ "imm_atomic_umin",                  ASM_INS, 4, 0xbd, 1 }, // Added and verified -DarkStarSword
+	{ "imm_atomic_xor",                   ASM_INS, 4, 0xb7, 1 }, // Added and verified -DarkStarSword
+	{ "imul",                             ASM_INS, 4, 0x26, 2 },
+	{ "ine",                              ASM_INS, 3, 0x27, 1 },
+	{ "ineg",                             ASM_INS, 2, 0x28, 1 },
+	{ "ishl",                             ASM_INS, 3, 0x29, 1 },
+	{ "ishr",                             ASM_INS, 3, 0x2a, 1 },
+	{ "itod",                             ASM_INS, 2, 0xd8, 1 }, // Added and verified -DarkStarSword
+	{ "itof",                             ASM_INS, 2, 0x2b, 1 },
+	{ "ld",                               ASM_INS, 3, 0x2d, 1 }, // See also ASM_LD variants
+	{ "ld_aoffimmi",                      ASM_LD,  3, 0x2d, 1 },
+	{ "ld_aoffimmi_indexable",            ASM_LD,  3, 0x2d, 3 },
+	{ "ld_indexable",                     ASM_LD,  3, 0x2d, 2 },
+	{ "ld_raw",                           ASM_INS, 3, 0xa5, 1 }, // See also ASM_LD variants
 	// RWTexture2D (etc), ByteAddressBuffer and StructuredBuffer have no
 	// variants of .Load that takes an offset, so there are no _aoffimmi
-	// variants for these:
-	{ "ld_uav_typed_indexable",         { 3, 0xa3, 2 } },
-	{ "ld_raw_indexable",               { 3, 0xa5, 2 } },
-	{ "ld_structured_indexable",        { 4, 0xa7, 2 } },
+	// variants of ld_raw, ld_structured or ld_uav_typed:
+	{ "ld_raw_indexable",                 ASM_LD,  3, 0xa5, 2 },
+	{ "ld_structured",                    ASM_INS, 4, 0xa7, 1 }, // See also ASM_LD variants
+	{ "ld_structured_indexable",          ASM_LD,  4, 0xa7, 2 },
+	{ "ld_uav_typed",                     ASM_INS, 3, 0xa3, 1 }, // Unverified (not in SM4 so only indexable variants?) See also ASM_LD variants.
+	{ "ld_uav_typed_indexable",           ASM_LD,  3, 0xa3, 2 },
+	{ "ldms",                             ASM_INS, 4, 0x2e, 1 }, // See also ASM_LD variants
+	{ "ldms_aoffimmi",                    ASM_LD,  4, 0x2e, 1 }, // Added and verified -DarkStarSword
+	{ "ldms_aoffimmi_indexable",          ASM_LD,  4, 0x2e, 3 },
+	{ "ldms_indexable",                   ASM_LD,  4, 0x2e, 2 },
+	{ "lod",                              ASM_INS, 4, 0x6c, 1 },
+	{ "log",                              ASM_INS, 2, 0x2f, 1 },
+	{ "loop",                             ASM_INS, 0, 0x30, 1 },
+	{ "lt",                               ASM_INS, 3, 0x31, 1 },
+	{ "mad",                              ASM_INS, 4, 0x32, 1 },
+	{ "max",                              ASM_INS, 3, 0x34, 1 },
+	{ "min",                              ASM_INS, 3, 0x33, 1 },
+	{ "mov",                              ASM_INS, 2, 0x36, 1 },
+	{ "movc",                             ASM_INS, 4, 0x37, 1 },
+	{ "msad",                             ASM_INS, 4, 0xd5, 1 }, // Added and verified -DarkStarSword
+	{ "mul",                              ASM_INS, 3, 0x38, 1 },
+	{ "ne",                               ASM_INS, 3, 0x39, 1 },
+	{ "nop",                              ASM_INS, 0, 0x3a, 1 }, // Added and verified -DarkStarSword
+	{ "not",                              ASM_INS, 2, 0x3b, 1 },
+	{ "or",                               ASM_INS, 3, 0x3c, 1 },
+	{ "printf",                           ASM_PRINTF },
+	{ "rcp",                              ASM_INS, 2, 0x81, 1 },
+	{ "resinfo",                          ASM_INS, 3, 0x3d, 1 }, // See also ASM_LD variants
+	// _aoffimmi doesn't make sense for resinfo. Be aware that there are
+	// _uint and _rcpfloat variants handled elsewhere in the code.
+	//   -DarkStarSword
+	{ "resinfo_indexable",                ASM_LD,  3, 0x3d, 2 },
+	{ "ret",                              ASM_INS, 0, 0x3e, 1 },
+	{ "retc_nz",                          ASM_INS, 1, 0x3f, 0 },
+	{ "retc_z",                           ASM_INS, 1, 0x3f, 0 },
+	{ "round_ne",                         ASM_INS, 2, 0x40, 1 },
+	{ "round_ni",                         ASM_INS, 2, 0x41, 1 },
+	{ "round_nz",                         ASM_INS, 2, 0x43, 1 },
+	{ "round_pi",                         ASM_INS, 2, 0x42, 1 },
+	{ "round_z",                          ASM_INS, 2, 0x43, 1 },
+	{ "rsq",                              ASM_INS, 2, 0x44, 1 },
+	{ "sample",                           ASM_INS, 4, 0x45, 1 }, // See also ASM_LD variants
+	{ "sample_aoffimmi",                  ASM_LD,  4, 0x45, 1 },
+	{ "sample_aoffimmi_indexable",        ASM_LD,  4, 0x45, 3 },
+	{ "sample_b",                         ASM_INS, 5, 0x4a, 1 }, // See also ASM_LD variants
+	{ "sample_b_aoffimmi",                ASM_LD,  5, 0x4a, 1 }, // Added and verified -DarkStarSword
+	{ "sample_b_aoffimmi_indexable",      ASM_LD,  5, 0x4a, 3 }, // Added and verified -DarkStarSword
+	{ "sample_b_indexable",               ASM_LD,  5, 0x4a, 2 },
+	{ "sample_c",                         ASM_INS, 5, 0x46, 1 }, // See also ASM_LD variants
+	{ "sample_c_aoffimmi",                ASM_LD,  5, 0x46, 1 },
+	{ "sample_c_aoffimmi_indexable",      ASM_LD,  5, 0x46, 3 }, // Added and verified -DarkStarSword
+	{ "sample_c_indexable",               ASM_LD,  5, 0x46, 2 },
+	{ "sample_c_lz",                      ASM_INS, 5, 0x47, 1 }, // See also ASM_LD variants
+	{ "sample_c_lz_aoffimmi",             ASM_LD,  5, 0x47, 1 },
+	{ "sample_c_lz_aoffimmi_indexable",   ASM_LD,  5, 0x47, 3 },
+	{ "sample_c_lz_indexable",            ASM_LD,  5, 0x47, 2 },
+	{ "sample_d",                         ASM_INS, 6, 0x49, 1 }, // See also ASM_LD variants
+	{ "sample_d_aoffimmi",                ASM_LD,  6, 0x49, 1 }, // Added and verified -DarkStarSword
+	{ "sample_d_aoffimmi_indexable",      ASM_LD,  6, 0x49, 3 }, // Added and verified -DarkStarSword
+	{ "sample_d_indexable",               ASM_LD,  6, 0x49, 2 },
+	{ "sample_indexable",                 ASM_LD,  4, 0x45, 2 },
+	{ "sample_l",                         ASM_INS, 5, 0x48, 1 }, // See also ASM_LD variants
+	{ "sample_l_aoffimmi",                ASM_LD,  5, 0x48, 1 },
+	{ "sample_l_aoffimmi_indexable",      ASM_LD,  5, 0x48, 3 },
+	{ "sample_l_indexable",               ASM_LD,  5, 0x48, 2 },
+	{ "sampled",                          ASM_INS, 6, 0x49, 1 }, // Hmmm, possible typo? -DSS
+	{ "sampleinfo",                       ASM_INS, 2, 0x6f, 1 },
+	{ "samplepos",                        ASM_SAMPLEPOS },
+	{ "sincos",                           ASM_INS, 3, 0x4d, 2 },
+	{ "sqrt",                             ASM_INS, 2, 0x4b, 1 },
+	{ "store_raw",                        ASM_INS, 3, 0xa6, 1 },
+	{ "store_structured",                 ASM_INS, 4, 0xa8, 1 },
+	{ "store_uav_typed",                  ASM_STORE_UAV_TYPED },
+	{ "swapc",                            ASM_INS, 5, 0x8e, 2 },
+	{ "switch",                           ASM_INS, 1, 0x4c, 0 },
+	{ "uaddc",                            ASM_INS, 4, 0x84, 1 }, // Partially verified - assembled & disassembled OK, but did not check against compiled shader -DSS
+	{ "ubfe",                             ASM_INS, 4, 0x8a, 1 },
+	{ "udiv",                             ASM_INS, 4, 0x4e, 2 },
+	{ "uge",                              ASM_INS, 3, 0x50, 1 },
+	{ "ult",                              ASM_INS, 3, 0x4f, 1 },
+	{ "umax",                             ASM_INS, 3, 0x53, 1 },
+	{ "umin",                             ASM_INS, 3, 0x54, 1 },
+	{ "umul",                             ASM_INS, 4, 0x51, 2 },
+	{ "undecipherable",                   ASM_UNDECIPHERABLE },
+	{ "ushr",                             ASM_INS, 3, 0x55, 1 },
+	{ "usubb",                            ASM_INS, 4, 0x85, 1 }, // Partially verified - assembled & disassembled OK, but did not check against compiled shader -DSS
+	{ "utod",                             ASM_INS, 2, 0xd9, 1 }, // Added and verified -DarkStarSword
+	{ "utof",                             ASM_INS, 2, 0x56, 1 },
+	{ "xor",                              ASM_INS, 3, 0x57, 1 },
 };
 
-static unordered_map<string, vector<int>> insMap = {
-	{ "add",                       { 3, 0x00    } },
-	{ "and",                       { 3, 0x01    } },
-	{ "break",                     { 0, 0x02    } },
-	{ "breakc_nz",                 { 1, 0x03, 0 } },
-	{ "breakc_z",                  { 1, 0x03, 0 } },
-	// TODO: call                     , 0x04
-	// TODO: callc                    , 0x05
-	{ "case",                      { 1, 0x06    } },
-	{ "continue",                  { 0, 0x07    } },
-	{ "continuec_nz",              { 1, 0x08, 0 } },
-	{ "continuec_z",               { 1, 0x08, 0 } },
-	{ "cut",                       { 0, 0x09    } },
-	{ "default",                   { 0, 0x0a    } },
-	{ "deriv_rtx",                 { 2, 0x0b    } },
-	{ "deriv_rty",                 { 2, 0x0c    } },
-	{ "discard_nz",                { 1, 0x0d, 0 } },
-	{ "discard_z",                 { 1, 0x0d, 0 } },
-	{ "div",                       { 3, 0x0e    } },
-	{ "dp2",                       { 3, 0x0f    } },
-	{ "dp3",                       { 3, 0x10    } },
-	{ "dp4",                       { 3, 0x11    } },
-	{ "else",                      { 0, 0x12    } },
-	{ "emit",                      { 0, 0x13    } },
-	{ "emit_then_cut",             { 0, 0x14    } }, // Partially verified - assembled & disassembled OK, but did not check against compiled shader -DSS
-	{ "endif",                     { 0, 0x15    } },
-	{ "endloop",                   { 0, 0x16    } },
-	{ "endswitch",                 { 0, 0x17    } },
-	{ "eq",                        { 3, 0x18    } },
-	{ "exp",                       { 2, 0x19    } },
-	{ "frc",                       { 2, 0x1a    } },
-	{ "ftoi",                      { 2, 0x1b    } },
-	{ "ftou",                      { 2, 0x1c    } },
-	{ "ge",                        { 3, 0x1d    } },
-	{ "iadd",                      { 3, 0x1e    } },
-	{ "if_nz",                     { 1, 0x1f, 0 } },
-	{ "if_z",                      { 1, 0x1f, 0 } },
-	{ "ieq",                       { 3, 0x20    } },
-	{ "ige",                       { 3, 0x21    } },
-	{ "ilt",                       { 3, 0x22    } },
-	{ "imad",                      { 4, 0x23    } },
-	{ "imax",                      { 3, 0x24    } },
-	{ "imin",                      { 3, 0x25    } },
-	{ "imul",                      { 4, 0x26, 2 } },
-	{ "ine",                       { 3, 0x27    } },
-	{ "ineg",                      { 2, 0x28    } },
-	{ "ishl",                      { 3, 0x29    } },
-	{ "ishr",                      { 3, 0x2a    } },
-	{ "itof",                      { 2, 0x2b    } },
-	// TODO: label                    , 0x2c
-	{ "ld",                        { 3, 0x2d    } }, // See also load table
-	{ "ldms",                      { 4, 0x2e    } }, // See also load table
-	{ "log",                       { 2, 0x2f    } },
-	{ "loop",                      { 0, 0x30    } },
-	{ "lt",                        { 3, 0x31    } },
-	{ "mad",                       { 4, 0x32    } },
-	{ "min",                       { 3, 0x33    } },
-	{ "max",                       { 3, 0x34    } },
-	// TODO: Custom data              , 0x35
-	//       dcl_immediateConstantBuffer implemented elsewhere
-	//       Other types from binary decompiler:
-	//        - comment
-	//        - debuginfo
-	//        - opaque
-	//        - shader message
-	{ "mov",                       { 2, 0x36    } },
-	{ "movc",                      { 4, 0x37    } },
-	{ "mul",                       { 3, 0x38    } },
-	{ "ne",                        { 3, 0x39    } },
-	{ "nop",                       { 0, 0x3a    } }, // Added and verified -DarkStarSword
-	{ "not",                       { 2, 0x3b    } },
-	{ "or",                        { 3, 0x3c    } },
-	{ "resinfo",                   { 3, 0x3d    } }, // See also load table
-	{ "ret",                       { 0, 0x3e    } },
-	{ "retc_nz",                   { 1, 0x3f, 0 } },
-	{ "retc_z",                    { 1, 0x3f, 0 } },
-	{ "round_ne",                  { 2, 0x40    } },
-	{ "round_ni",                  { 2, 0x41    } },
-	{ "round_pi",                  { 2, 0x42    } },
-	{ "round_nz",                  { 2, 0x43    } },
-	{ "round_z",                   { 2, 0x43    } },
-	{ "rsq",                       { 2, 0x44    } },
-	{ "sample",                    { 4, 0x45    } }, // See also load table
-	{ "sample_c",                  { 5, 0x46    } }, // See also load table
-	{ "sample_c_lz",               { 5, 0x47    } }, // See also load table
-	{ "sample_l",                  { 5, 0x48    } }, // See also load table
-	{ "sample_d",                  { 6, 0x49    } }, // See also load table
-	{ "sampled",                   { 6, 0x49    } }, // Hmmm, possible typo? -DSS
-	{ "sample_b",                  { 5, 0x4a    } }, // See also load table
-	{ "sqrt",                      { 2, 0x4b    } },
-	{ "switch",                    { 1, 0x4c, 0 } },
-	{ "sincos",                    { 3, 0x4d, 2 } },
-	{ "udiv",                      { 4, 0x4e, 2 } },
-	{ "ult",                       { 3, 0x4f    } },
-	{ "uge",                       { 3, 0x50    } },
-	{ "umul",                      { 4, 0x51, 2 } },
-	{ "umax",                      { 3, 0x53    } },
-	{ "umin",                      { 3, 0x54    } },
-	{ "ushr",                      { 3, 0x55    } },
-	{ "utof",                      { 2, 0x56    } },
-	{ "xor",                       { 3, 0x57    } },
-	// dcl_resource                     0x58 // Implemented elsewhere
-	// dcl_constantbuffer               0x59 // implemented elsewhere
-	// dcl_sampler                      0x5a // Implemented elsewhere
-	// dcl_indexrange                   0x5b // Implemented elsewhere
-	// dcl_outputtopology               0x5c // Implemented elsewhere
-	// dcl_inputprimitive               0x5d // Implemented elsewhere
-	// dcl_maxout                       0x5e // Implemented elsewhere
-	// dcl_input                        0x5f // Implemented elsewhere
-	// dcl_input_sgv                    0x60 // Implemented elsewhere
-	// dcl_input_siv                    0x61 // Implemented elsewhere
-	// dcl_input_ps                     0x62 // Implemented elsewhere
-	// dcl_input_ps_sgv                 0x63 // Implemented elsewhere
-	// dcl_input_ps_siv                 0x64 // Implemented elsewhere
-	// dcl_output                       0x65 // Implemented elsewhere
-	// dcl_output_sgv                   0x66 // Implemented elsewhere
-	// dcl_output_siv                   0x67 // Implemented elsewhere
-	// dcl_temps                        0x68 // Implemented elsewhere
-	// dcl_indexableTemp                0x69 // Implemented elsewhere
-	// dcl_globalFlags                  0x6a // Implemented elsewhere
-	// RESERVED_10                      0x6b
-	{ "lod",                       { 4, 0x6c    } },
-	{ "gather4",                   { 4, 0x6d    } }, // See also load table
-	//"samplepos",                 { 3, 0x6e    } }, // Implemented elsewhere
-	{ "sampleinfo",                { 2, 0x6f    } },
-	// RESERVED_10_1                    0x70
-	// hs_decls                         0x71 // Implemented elsewhere
-	// hs_control_point_phase           0x72 // Implemented elsewhere
-	// hs_fork_phase                    0x73 // Implemented elsewhere
-	// hs_join_phase                    0x74 // Implemented elsewhere
-	// emit_stream                      0x75 // Implemented elsewhere
-	// cut_stream                       0x76 // Implemented elsewhere
-	// emit_then_cut_stream             0x77 // Implemented elsewhere
-	// TODO: interface_call             0x78
-	{ "bufinfo",                   { 2, 0x79    } }, // Unverified (not in SM4 so only indexable variants?). See also load table.
-	{ "deriv_rtx_coarse",          { 2, 0x7a    } },
-	{ "deriv_rtx_fine",            { 2, 0x7b    } },
-	{ "deriv_rty_coarse",          { 2, 0x7c    } },
-	{ "deriv_rty_fine",            { 2, 0x7d    } },
-	{ "gather4_c",                 { 5, 0x7e    } }, // Unverified (not in SM4 so only indexable variants?). See also load table.
-	{ "gather4_po",                { 5, 0x7f    } }, // Unverified (not in SM4 so only indexable variants?). See also load table.
-	{ "gather4_po_c",              { 6, 0x80    } }, // Unverified (not in SM4 so only indexable variants?). See also load table.
-	{ "rcp",                       { 2, 0x81    } },
-	{ "f32tof16",                  { 2, 0x82    } },
-	{ "f16tof32",                  { 2, 0x83    } },
-	{ "uaddc",                     { 4, 0x84    } }, // Partially verified - assembled & disassembled OK, but did not check against compiled shader -DSS
-	{ "usubb",                     { 4, 0x85    } }, // Partially verified - assembled & disassembled OK, but did not check against compiled shader -DSS
-	{ "countbits",                 { 2, 0x86    } },
-	{ "firstbit_hi",               { 2, 0x87    } },
-	{ "firstbit_lo",               { 2, 0x88    } },
-	{ "firstbit_shi",              { 2, 0x89    } }, // Added and verified -DarkStarSword
-	{ "ubfe",                      { 4, 0x8a    } },
-	{ "ibfe",                      { 4, 0x8b    } },
-	{ "bfi",                       { 5, 0x8c    } },
-	{ "bfrev",                     { 2, 0x8d    } },
-	{ "swapc",                     { 5, 0x8e, 2 } },
-	// dcl_stream                       0x8f // Implemented elsewhere
-	// dcl_function_body                0x90 // TODO
-	// dcl_function_table               0x91 // TODO
-	// dcl_interface                    0x92 // TODO
-	// dcl_input_control_point_count    0x93 // Implemented elsewhere
-	// dcl_output_control_point_count   0x94 // Implemented elsewhere
-	// dcl_tessellator_domain           0x95 // Implemented elsewhere
-	// dcl_tessellator_partitioning     0x96 // Implemented elsewhere
-	// dcl_tessellator_output_primitive 0x97 // Implemented elsewhere
-	// dcl_hs_max_tessfactor            0x98 // Implemented elsewhere
-	// dcl_hs_fork_phase_instance_count 0x99 // Implemented elsewhere
-	// dcl_hs_join_phase_instance_count 0x9a // TODO
-	{ "dcl_thread_group",          { 3, 0x9b    } },
-	// dcl_uav_typed_*                  0x9c // Implemented elsewhere
-	{ "dcl_uav_raw",               { 1, 0x9d, 0 } }, // _glc variant handled elsewhere
-	{ "dcl_uav_structured",        { 2, 0x9e, 0 } }, // _glc variant handled elsewhere
-	{ "dcl_tgsm_raw",              { 2, 0x9f, 0 } },
-	{ "dcl_tgsm_structured",       { 3, 0xa0, 0 } },
-	// dcl_resource_raw                 0xa1 // Implemented elsewhere
-	// dcl_resource_structured          0xa2 // Implemented elsewhere
-	{ "ld_uav_typed",              { 3, 0xa3    } }, // Unverified (not in SM4 so only indexable variants?) See also load table.
-	// store_uav_typed                  0xa4 // Implemented elsewhere
-	{ "ld_raw",                    { 3, 0xa5    } }, // See also load table
-	{ "store_raw",                 { 3, 0xa6    } },
-	{ "ld_structured",             { 4, 0xa7    } }, // See also load table
-	{ "store_structured",          { 4, 0xa8    } },
-	{ "atomic_and",                { 3, 0xa9, 0 } },
-	{ "atomic_or",                 { 3, 0xaa, 0 } },
-	{ "atomic_xor",                { 3, 0xab, 0 } }, // Added and verified -DarkStarSword
-	{ "atomic_cmp_store",          { 4, 0xac, 0 } }, // Added and verified -DarkStarSword
-	{ "atomic_iadd",               { 3, 0xad, 0 } },
-	{ "atomic_imax",               { 3, 0xae, 0 } },
-	{ "atomic_imin",               { 3, 0xaf, 0 } },
-	{ "atomic_umax",               { 3, 0xb0, 0 } },
-	{ "atomic_umin",               { 3, 0xb1, 0 } },
-	{ "imm_atomic_alloc",          { 2, 0xb2    } },
-	{ "imm_atomic_consume",        { 2, 0xb3    } },
-	{ "imm_atomic_iadd",           { 4, 0xb4    } },
-	{ "imm_atomic_and",            { 4, 0xb5    } },
-	{ "imm_atomic_or",             { 4, 0xb6    } }, // Added and verified -DarkStarSword
-	{ "imm_atomic_xor",            { 4, 0xb7    } }, // Added and verified -DarkStarSword
-	{ "imm_atomic_exch",           { 4, 0xb8    } },
-	{ "imm_atomic_cmp_exch",       { 5, 0xb9    } },
-	{ "imm_atomic_imax",           { 4, 0xba    } }, // Added and verified -DarkStarSword
-	{ "imm_atomic_imin",           { 4, 0xbb    } }, // Added and verified -DarkStarSword
-	{ "imm_atomic_umax",           { 4, 0xbc    } }, // Added and verified -DarkStarSword
-	{ "imm_atomic_umin",           { 4, 0xbd    } }, // Added and verified -DarkStarSword
-	// sync_*                           0xbe // Implemented elsewhere
-	{ "dadd",                      { 3, 0xbf    } }, // Added and verified -DarkStarSword
-	{ "dmax",                      { 3, 0xc0    } }, // Added and verified -DarkStarSword
-	{ "dmin",                      { 3, 0xc1    } }, // Added and verified -DarkStarSword
-	{ "dmul",                      { 3, 0xc2    } }, // Added and verified -DarkStarSword
-	{ "deq",                       { 3, 0xc3    } }, // Added and verified -DarkStarSword
-	{ "dge",                       { 3, 0xc4    } }, // Added and verified -DarkStarSword
-	{ "dlt",                       { 3, 0xc5    } }, // Added and verified -DarkStarSword
-	{ "dne",                       { 3, 0xc6    } }, // Added and verified -DarkStarSword
-	{ "dmov",                      { 2, 0xc7    } }, // Unverified
-	{ "dmovc",                     { 4, 0xc8    } }, // Added and verified -DarkStarSword
-	{ "dtof",                      { 2, 0xc9    } }, // Added and verified -DarkStarSword
-	{ "ftod",                      { 2, 0xca    } }, // Added and verified -DarkStarSword
-	{ "eval_snapped",              { 3, 0xcb    } }, // Added and verified -DarkStarSword
-	{ "eval_sample_index",         { 3, 0xcc    } },
-	{ "eval_centroid",             { 2, 0xcd    } }, // Added and verified -DarkStarSword
-	{ "dcl_gsinstances",           { 1, 0xce    } }, // Added and verified -DarkStarSword
-	{ "abort",                     { 0, 0xcf    } }, // Debug layer instruction. Added and verified -DarkStarSword
-	// TODO: debug_break                0xd0
-	// RESERVED_11                      0xd1
-	{ "ddiv",                      { 3, 0xd2    } }, // Added and verified -DarkStarSword
-	{ "dfma",                      { 4, 0xd3    } }, // Added and verified -DarkStarSword
-	{ "drcp",                      { 2, 0xd4    } }, // Added and verified -DarkStarSword
-	{ "msad",                      { 4, 0xd5    } }, // Added and verified -DarkStarSword
-	{ "dtoi",                      { 2, 0xd6    } }, // Added and verified -DarkStarSword
-	{ "dtou",                      { 2, 0xd7    } }, // Added and verified -DarkStarSword
-	{ "itod",                      { 2, 0xd8    } }, // Added and verified -DarkStarSword
-	{ "utod",                      { 2, 0xd9    } }, // Added and verified -DarkStarSword
-};
+static constexpr int insNameCmp(const char *a, const char *b)
+{
+	while (*a && *a == *b) {
+		a++;
+		b++;
+	}
+	return (unsigned char)*a - (unsigned char)*b;
+}
+
+static constexpr bool insTableSorted()
+{
+	for (size_t i = 1; i < _countof(insTable); i++) {
+		if (insNameCmp(insTable[i - 1].name, insTable[i].name) >= 0)
+			return false;
+	}
+	return true;
+}
+static_assert(insTableSorted(), "insTable must be sorted by name with no duplicates");
+
+static const asm_ins_desc* find_ins_desc(const string &o)
+{
+	size_t lo = 0, hi = _countof(insTable);
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		int cmp = o.compare(insTable[mid].name);
+		if (!cmp)
+			return &insTable[mid];
+		if (cmp > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
 
 static void assembleResourceDeclarationType(string *type, vector<DWORD> *v)
 {
@@ -1479,11 +1594,11 @@ static vector<DWORD> assemble_undecipherable_custom_data(string &s, vector<DWORD
 static vector<DWORD> assembleIns(string s)
 {
 	unsigned msaa_samples = 0;
+	const asm_ins_desc *desc;
 
-	if (hackMap.find(s) != hackMap.end()) {
-		auto v = hackMap[s];
-		return v;
-	}
+	auto hack = hackMap.find(s);
+	if (hack != hackMap.end())
+		return hack->second;
 	DWORD op = 0;
 	shader_ins* ins = (shader_ins*)&op;
 	size_t pos = s.find("[precise");
@@ -1529,6 +1644,7 @@ static vector<DWORD> assembleIns(string s)
 		ins->_11_23 = 1;
 	}
 	vector<DWORD> v;
+	v.reserve(16); // Enough for all but the largest instructions
 	vector<string> w = strToWords(s);
 	string o = w[0];
 	if (o == "sampleinfo" && ins->_11_23 == 2)
@@ -1544,96 +1660,21 @@ static vector<DWORD> assembleIns(string s)
 	bool bGlc = o.find("_glc") < o.size(); // Globally coherent UAV declaration
 	if (bGlc) o = o.substr(0, o.find("_glc"));
 
-	if (o == "hs_decls") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x71;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "hs_fork_phase") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x73;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "hs_join_phase") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x74;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "hs_control_point_phase") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x72;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "ps_") {
-		check_num_ops(s, w, 0);
-		op = 0x00000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "vs_") {
-		check_num_ops(s, w, 0);
-		op = 0x10000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "gs_") {
-		check_num_ops(s, w, 0);
-		op = 0x20000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "hs_") {
-		check_num_ops(s, w, 0);
-		op = 0x30000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "ds_") {
-		check_num_ops(s, w, 0);
-		op = 0x40000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "cs_") {
-		check_num_ops(s, w, 0);
-		op = 0x50000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (w[0].substr(0, 4) == "sync") {
-		ins->opcode = 0xbe;
-		check_num_ops(s, w, 0);
-		ins->_11_23 = parseSyncFlags(&w[0]);
-		ins->length = 1;
-		v.push_back(op);
-	} else if (w[0] == "store_uav_typed") {
-		ins->opcode = 0x86;
-		int numOps = 3;
+	desc = find_ins_desc(o);
+
+	switch (desc ? desc->encoding : ASM_UNKNOWN) {
+	case ASM_INS: {
+		int numOps = desc->numOps;
 		check_num_ops(s, w, numOps);
-		if (w[1][0] == 'u') {
-			ins->opcode = 0xa4;
+		int numSpecial = desc->extra;
+		// Operands are appended after a placeholder for the opcode
+		// token, which is filled in once we know the length:
+		v.push_back(0);
+		for (int i = 0; i < numOps; i++) {
+			vector<DWORD> os = assembleOp(w[i + 1], i < numSpecial);
+			v.insert(v.end(), os.begin(), os.end());
 		}
-		vector<vector<DWORD>> Os;
-		int numSpecial = 1;
-		for (int i = 0; i < numOps; i++)
-			Os.push_back(assembleOp(w[i + 1], i < numSpecial));
-		ins->length = 1;
-		for (int i = 0; i < numOps; i++)
-			ins->length += (int)Os[i].size();
-		v.push_back(op);
-		for (int i = 0; i < numOps; i++)
-			v.insert(v.end(), Os[i].begin(), Os[i].end());
-	} else if (insMap.find(o) != insMap.end()) {
-		vector<int> vIns = insMap[o];
-		int numOps = vIns[0];
-		check_num_ops(s, w, numOps);
-		vector<vector<DWORD>> Os;
-		int numSpecial = 1;
-		if (vIns.size() > 2)
-			numSpecial = vIns[2];
-		for (int i = 0; i < numOps; i++)
-			Os.push_back(assembleOp(w[i + 1], i < numSpecial));
-		ins->opcode = vIns[1];
+		ins->opcode = desc->opcode;
 		if (bSat)
 			ins->_11_23 |= 0x04;
 		if (bNZ)
@@ -1642,34 +1683,32 @@ static vector<DWORD> assembleIns(string s)
 			ins->_11_23 |= 0x00;
 		if (bGlc)
 			ins->_11_23 |= 0x20;
-		ins->length = 1;
-		for (int i = 0; i < numOps; i++)
-			ins->length += (int)Os[i].size();
-		v.push_back(op);
-		for (int i = 0; i < numOps; i++)
-			v.insert(v.end(), Os[i].begin(), Os[i].end());
-	} else if (ldMap.find(o) != ldMap.end()) {
-		vector<int> vIns = ldMap[o];
-		int numOps = vIns[0];
+		ins->length = (DWORD)v.size();
+		v[0] = op;
+		break;
+	}
+	case ASM_LD: {
+		int numOps = desc->numOps;
 		vector<vector<DWORD>> Os;
-		int startPos = 1 + (vIns[2] & 3);
+		Os.reserve(numOps);
+		int startPos = 1 + (desc->extra & 3);
 		//startPos = w.size() - numOps;
 		check_num_ops(s, w, startPos + numOps - 1);
 		for (int i = 0; i < numOps; i++)
 			Os.push_back(assembleOp(w[i + startPos], i == 0));
-		ins->opcode = vIns[1];
-		ins->length = 1 + (vIns[2] & 3);
+		ins->opcode = desc->opcode;
+		ins->length = 1 + (desc->extra & 3);
 		ins->extended = 1;
 		for (int i = 0; i < numOps; i++)
 			ins->length += (int)Os[i].size();
 		v.push_back(op);
-		if (vIns[2] == 3)
+		if (desc->extra == 3)
 			v.push_back(parseAoffimmi(0x80000001, w[1]));
-		if (vIns[2] == 1)
+		if (desc->extra == 1)
 			v.push_back(parseAoffimmi(1, w[1]));
-		if (vIns[2] & 2) {
+		if (desc->extra & 2) {
 			int c = 1;
-			if (vIns[2] == 3)
+			if (desc->extra == 3)
 				c = 2;
 			if (w[c] == "(texture1d)")
 				v.push_back(0x80000082);
@@ -1720,7 +1759,9 @@ static vector<DWORD> assembleIns(string s)
 		}
 		for (int i = 0; i < numOps; i++)
 			v.insert(v.end(), Os[i].begin(), Os[i].end());
-	} else if (o == "dcl_input") {
+		break;
+	}
+	case ASM_DCL_INPUT: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1], 1);
 		ins->opcode = 0x5f;
@@ -1730,21 +1771,27 @@ static vector<DWORD> assembleIns(string s)
 			os[0] -= 1;
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_output") {
+		break;
+	}
+	case ASM_DCL_OUTPUT: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1], 1);
 		ins->opcode = 0x65;
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_resource_raw") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_RAW: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0xa1;
 		ins->length = 3;
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_resource_buffer") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_BUFFER: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1753,7 +1800,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture1d") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURE1D: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1762,7 +1811,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture1darray") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURE1DARRAY: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1771,7 +1822,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture1d") {
+		break;
+	}
+	case ASM_DCL_UAV_TYPED_TEXTURE1D: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x9c;
@@ -1782,7 +1835,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture1darray") {
+		break;
+	}
+	case ASM_DCL_UAV_TYPED_TEXTURE1DARRAY: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x9c;
@@ -1793,7 +1848,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture2d") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURE2D: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1802,7 +1859,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_buffer") {
+		break;
+	}
+	case ASM_DCL_UAV_TYPED_BUFFER: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x9c;
@@ -1813,7 +1872,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture3d") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURE3D: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1822,7 +1883,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture3d") {
+		break;
+	}
+	case ASM_DCL_UAV_TYPED_TEXTURE3D: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x9c;
@@ -1833,7 +1896,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texturecube") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURECUBE: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1842,7 +1907,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texturecubearray") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURECUBEARRAY: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1851,7 +1918,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture2darray") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURE2DARRAY: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x58;
@@ -1860,7 +1929,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture2d") {
+		break;
+	}
+	case ASM_DCL_UAV_TYPED_TEXTURE2D: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x9c;
@@ -1871,7 +1942,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture2darray") {
+		break;
+	}
+	case ASM_DCL_UAV_TYPED_TEXTURE2DARRAY: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[2]);
 		ins->opcode = 0x9c;
@@ -1882,7 +1955,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture2dms") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURE2DMS: {
 		check_num_ops(s, w, 3);
 		vector<DWORD> os = assembleOp(w[3]);
 		ins->opcode = 0x58;
@@ -1894,7 +1969,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[2], &v);
-	} else if (o == "dcl_resource_texture2dmsarray") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_TEXTURE2DMSARRAY: {
 		check_num_ops(s, w, 3);
 		vector<DWORD> os = assembleOp(w[3]);
 		ins->opcode = 0x58;
@@ -1906,7 +1983,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		assembleResourceDeclarationType(&w[2], &v);
-	} else if (o == "dcl_indexrange") {
+		break;
+	}
+	case ASM_DCL_INDEXRANGE: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[1], true);
 		ins->opcode = 0x5b;
@@ -1914,13 +1993,17 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		v.push_back(atoi(w[2].c_str()));
-	} else if (o == "dcl_temps") {
+		break;
+	}
+	case ASM_DCL_TEMPS: {
 		ins->opcode = 0x68;
 		ins->length = 2;
 		v.push_back(op);
 		check_num_ops(s, w, 1);
 		v.push_back(atoi(w[1].c_str()));
-	} else if (o == "dcl_resource_structured") {
+		break;
+	}
+	case ASM_DCL_RESOURCE_STRUCTURED: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0xa2;
@@ -1928,7 +2011,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
 		v.push_back(atoi(w[2].c_str()));
-	} else if (o == "dcl_sampler") {
+		break;
+	}
+	case ASM_DCL_SAMPLER: {
 		check_num_ops(s, w, 1, 2);
 		vector<DWORD> os = assembleOp(w[1]);
 		os[0] = 0x106000;
@@ -1943,7 +2028,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_globalFlags") {
+		break;
+	}
+	case ASM_DCL_GLOBALFLAGS: {
 		ins->opcode = 0x6a;
 		ins->length = 1;
 		ins->_11_23 = 0;
@@ -1977,7 +2064,9 @@ static vector<DWORD> assembleIns(string s)
 				ins->_11_23 |= 0x80;
 		}
 		v.push_back(op);
-	} else if (o == "dcl_constantbuffer") {
+		break;
+	}
+	case ASM_DCL_CONSTANTBUFFER: {
 		check_num_ops(s, w, 1, 2);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x59;
@@ -1990,7 +2079,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_output_sgv") {
+		break;
+	}
+	case ASM_DCL_OUTPUT_SGV: {
 		// Added and verified. Used when writing to SV_IsFrontFace in a
 		// geometry shader. -DarkStarSword
 		check_num_ops(s, w, 2);
@@ -2000,7 +2091,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_output_siv") {
+		break;
+	}
+	case ASM_DCL_OUTPUT_SIV: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[1], true);
 		ins->opcode = 0x67;
@@ -2008,7 +2101,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_siv") {
+		break;
+	}
+	case ASM_DCL_INPUT_SIV: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[1], true);
 		ins->opcode = 0x61;
@@ -2016,7 +2111,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_sgv") {
+		break;
+	}
+	case ASM_DCL_INPUT_SGV: {
 		check_num_ops(s, w, 2);
 		vector<DWORD> os = assembleOp(w[1], true);
 		ins->opcode = 0x60;
@@ -2024,7 +2121,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_ps") {
+		break;
+	}
+	case ASM_DCL_INPUT_PS: {
 		vector<DWORD> os;
 		ins->opcode = 0x62;
 		// Switched to use common interpolation mode parsing to catch
@@ -2034,7 +2133,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_ps_sgv") {
+		break;
+	}
+	case ASM_DCL_INPUT_PS_SGV: {
 		// Fixed for d3dcompiler_47 disassembly that includes an
 		// interpolationMode missing from d3dcompiler_46 disassembly
 		// e.g.
@@ -2050,7 +2151,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_ps_siv") {
+		break;
+	}
+	case ASM_DCL_INPUT_PS_SIV: {
 		vector<DWORD> os;
 		ins->opcode = 0x64;
 		// Switched to use common interpolation mode parsing (fixes
@@ -2064,7 +2167,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_indexableTemp") {
+		break;
+	}
+	case ASM_DCL_INDEXABLETEMP: {
 		check_num_ops(s, w, 2);
 		string s1 = w[1].erase(0, 1);
 		string s2 = s1.substr(0, s1.find('['));
@@ -2076,7 +2181,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(atoi(s2.c_str()));
 		v.push_back(atoi(s3.c_str()));
 		v.push_back(atoi(w[2].c_str()));
-	} else if (o == "dcl_immediateConstantBuffer") {
+		break;
+	}
+	case ASM_DCL_IMMEDIATECONSTANTBUFFER: {
 		vector<DWORD> os;
 		ins->opcode = 0x35;
 		ins->_11_23 = 3;
@@ -2105,7 +2212,9 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		v.push_back(length);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_tessellator_partitioning") {
+		break;
+	}
+	case ASM_DCL_TESSELLATOR_PARTITIONING: {
 		ins->opcode = 0x96;
 		ins->length = 1;
 		check_num_ops(s, w, 1);
@@ -2120,7 +2229,9 @@ static vector<DWORD> assembleIns(string s)
 		// Added pow2 -DarkStarSword
 		// https://msdn.microsoft.com/en-us/library/windows/desktop/ff471446(v=vs.85).aspx
 		v.push_back(op);
-	} else if (o == "dcl_tessellator_output_primitive") {
+		break;
+	}
+	case ASM_DCL_TESSELLATOR_OUTPUT_PRIMITIVE: {
 		ins->opcode = 0x97;
 		ins->length = 1;
 		check_num_ops(s, w, 1);
@@ -2135,7 +2246,9 @@ static vector<DWORD> assembleIns(string s)
 		// Added output_point -DarkStarSword
 		// https://msdn.microsoft.com/en-us/library/windows/desktop/ff471445(v=vs.85).aspx
 		v.push_back(op);
-	} else if (o == "dcl_tessellator_domain") {
+		break;
+	}
+	case ASM_DCL_TESSELLATOR_DOMAIN: {
 		ins->opcode = 0x95;
 		ins->length = 1;
 		check_num_ops(s, w, 1);
@@ -2146,28 +2259,36 @@ static vector<DWORD> assembleIns(string s)
 		else if (w[1] == "domain_quad")
 			ins->_11_23 = 3;
 		v.push_back(op);
-	} else if (o == "dcl_stream") {
+		break;
+	}
+	case ASM_DCL_STREAM: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x8f;
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "emit_stream") {
+		break;
+	}
+	case ASM_EMIT_STREAM: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x75;
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "cut_stream") {
+		break;
+	}
+	case ASM_CUT_STREAM: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x76;
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "emit_then_cut_stream") {
+		break;
+	}
+	case ASM_EMIT_THEN_CUT_STREAM: {
 		// Partially verified - assembled & disassembled OK, but did not
 		// check against compiled shader as fxc never generates this
 		//   -DarkStarSword
@@ -2177,7 +2298,9 @@ static vector<DWORD> assembleIns(string s)
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_outputtopology") {
+		break;
+	}
+	case ASM_DCL_OUTPUTTOPOLOGY: {
 		ins->opcode = 0x5c;
 		ins->length = 1;
 		check_num_ops(s, w, 1);
@@ -2190,28 +2313,36 @@ static vector<DWORD> assembleIns(string s)
 		// Added point list -DarkStarSword
 		// https://msdn.microsoft.com/en-us/library/windows/desktop/bb509661(v=vs.85).aspx
 		v.push_back(op);
-	} else if (o == "dcl_output_control_point_count") {
+		break;
+	}
+	case ASM_DCL_OUTPUT_CONTROL_POINT_COUNT: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x94;
 		ins->_11_23 = os[0];
 		ins->length = 1;
 		v.push_back(op);
-	} else if (o == "dcl_input_control_point_count") {
+		break;
+	}
+	case ASM_DCL_INPUT_CONTROL_POINT_COUNT: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x93;
 		ins->_11_23 = os[0];
 		ins->length = 1;
 		v.push_back(op);
-	} else if (o == "dcl_maxout") {
+		break;
+	}
+	case ASM_DCL_MAXOUT: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x5e;
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_inputprimitive") {
+		break;
+	}
+	case ASM_DCL_INPUTPRIMITIVE: {
 		ins->opcode = 0x5d;
 		ins->length = 1;
 		check_num_ops(s, w, 1);
@@ -2228,21 +2359,27 @@ static vector<DWORD> assembleIns(string s)
 		// Added "lineadj" -DarkStarSword
 		// https://msdn.microsoft.com/en-us/library/windows/desktop/bb509609(v=vs.85).aspx
 		v.push_back(op);
-	} else if (o == "dcl_hs_max_tessfactor") {
+		break;
+	}
+	case ASM_DCL_HS_MAX_TESSFACTOR: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x98;
 		ins->length = 1 + os.size() - 1;
 		v.push_back(op);
 		v.insert(v.end(), os.begin() + 1, os.end());
-	} else if (o == "dcl_hs_fork_phase_instance_count") {
+		break;
+	}
+	case ASM_DCL_HS_FORK_PHASE_INSTANCE_COUNT: {
 		check_num_ops(s, w, 1);
 		vector<DWORD> os = assembleOp(w[1]);
 		ins->opcode = 0x99;
 		ins->length = 1 + os.size();
 		v.push_back(op);
 		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "samplepos") {
+		break;
+	}
+	case ASM_SAMPLEPOS: {
 		// samplepos can either be used with a texture register, or the
 		// rasterizer. In the former case it has an extra 0 appended.
 		vector<vector<DWORD>> os;
@@ -2269,27 +2406,91 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		for (int i = 0; i < numOps; i++)
 			v.insert(v.end(), os[i].begin(), os[i].end());
-	} else if (o == "printf") {
+		break;
+	}
+	case ASM_STORE_UAV_TYPED: {
+		ins->opcode = 0x86;
+		int numOps = 3;
+		check_num_ops(s, w, numOps);
+		if (w[1][0] == 'u') {
+			ins->opcode = 0xa4;
+		}
+		vector<vector<DWORD>> Os;
+		int numSpecial = 1;
+		for (int i = 0; i < numOps; i++)
+			Os.push_back(assembleOp(w[i + 1], i < numSpecial));
+		ins->length = 1;
+		for (int i = 0; i < numOps; i++)
+			ins->length += (int)Os[i].size();
+		v.push_back(op);
+		for (int i = 0; i < numOps; i++)
+			v.insert(v.end(), Os[i].begin(), Os[i].end());
+		break;
+	}
+	case ASM_PRINTF:
 		return assemble_printf(s, v, w, false);
-	} else if (o == "errorf") {
+	case ASM_ERRORF:
 		return assemble_printf(s, v, w, true);
-	} else if (o == "undecipherable") {
+	case ASM_UNDECIPHERABLE:
 		return assemble_undecipherable_custom_data(s, v, w);
-	} else {
-		throw AssemblerParseError(s, "Unrecognised instruction");
+	default:
+		// Shader model and sync instructions are matched by prefix and
+		// are not in the opcode table:
+		if (!o.compare(0, 3, "ps_")) {
+			check_num_ops(s, w, 0);
+			op = 0x00000;
+			op |= 16 * atoi(o.substr(3, 1).c_str());
+			op |= atoi(o.substr(5, 1).c_str());
+			v.push_back(op);
+		} else if (!o.compare(0, 3, "vs_")) {
+			check_num_ops(s, w, 0);
+			op = 0x10000;
+			op |= 16 * atoi(o.substr(3, 1).c_str());
+			op |= atoi(o.substr(5, 1).c_str());
+			v.push_back(op);
+		} else if (!o.compare(0, 3, "gs_")) {
+			check_num_ops(s, w, 0);
+			op = 0x20000;
+			op |= 16 * atoi(o.substr(3, 1).c_str());
+			op |= atoi(o.substr(5, 1).c_str());
+			v.push_back(op);
+		} else if (!o.compare(0, 3, "hs_")) {
+			check_num_ops(s, w, 0);
+			op = 0x30000;
+			op |= 16 * atoi(o.substr(3, 1).c_str());
+			op |= atoi(o.substr(5, 1).c_str());
+			v.push_back(op);
+		} else if (!o.compare(0, 3, "ds_")) {
+			check_num_ops(s, w, 0);
+			op = 0x40000;
+			op |= 16 * atoi(o.substr(3, 1).c_str());
+			op |= atoi(o.substr(5, 1).c_str());
+			v.push_back(op);
+		} else if (!o.compare(0, 3, "cs_")) {
+			check_num_ops(s, w, 0);
+			op = 0x50000;
+			op |= 16 * atoi(o.substr(3, 1).c_str());
+			op |= atoi(o.substr(5, 1).c_str());
+			v.push_back(op);
+		} else if (!w[0].compare(0, 4, "sync")) {
+			ins->opcode = 0xbe;
+			check_num_ops(s, w, 0);
+			ins->_11_23 = parseSyncFlags(&w[0]);
+			ins->length = 1;
+			v.push_back(op);
+		} else {
+			throw AssemblerParseError(s, "Unrecognised instruction");
+		}
 	}
 
 	return v;
 }
 
-static string assembleAndCompare(string s, vector<DWORD> v)
+static string assembleAndCompare(string s, const vector<DWORD> &v)
 {
 	string s2;
-	int numSpaces = 0;
-	while (memcmp(s.c_str(), " ", 1) == 0) {
-		s.erase(s.begin());
-		numSpaces++;
-	}
+	size_t numSpaces = min(s.find_first_not_of(' '), s.size());
+	s.erase(0, numSpaces);
 	size_t lastLiteral = 0;
 	size_t lastEnd = 0;
 	vector<DWORD> v2;
@@ -2497,6 +2698,7 @@ static string assembleAndCompare(string s, vector<DWORD> v)
 				s2.append(s);
 				// codeBin[s2] = v;
 			} else {
+				lock_guard<mutex> lock(codeBinLock);
 				s2 = s;
 				s2.append(" orig");
 				codeBin[s2] = v;
@@ -2507,15 +2709,13 @@ static string assembleAndCompare(string s, vector<DWORD> v)
 		}
 	} else {
 		if (s != "undecipherable custom data") {
+			lock_guard<mutex> lock(codeBinLock);
 			s2 = "!missing ";
 			s2.append(s);
 			codeBin[s2] = v;
 		}
 	}
-	string ret = "";
-	for (int i = 0; i < numSpaces; i++) {
-		ret.append(" ");
-	}
+	string ret(numSpaces, ' ');
 	ret.append(sNew);
 	return ret;
 }
@@ -2526,27 +2726,27 @@ vector<string> stringToLines(const char* start, size_t size)
 	const char* pStart = start;
 	const char* pEnd = pStart;
 	const char* pRealEnd = pStart + size;
+	const char* pLineEnd;
+
+	// Disassembly averages somewhere around 40 characters per line:
+	lines.reserve(size / 32);
+
 	while (true) {
-		while (*pEnd != '\n' && pEnd < pRealEnd) {
+		while (pEnd < pRealEnd && *pEnd != '\n') {
 			pEnd++;
 		}
 		if (*pStart == 0) {
 			break;
 		}
-		string s(pStart, pEnd++);
-		pStart = pEnd;
-		lines.push_back(s);
-		if (pStart >= pRealEnd) {
-			break;
-		}
-	}
-	for (unsigned int i = 0; i < lines.size(); i++) {
-		string s = lines[i];
+
+		// Trim each line before copying it out of the buffer:
+		pLineEnd = pEnd;
+
 		// Bug fixed: This would not strip carriage returns from DOS
 		// style newlines if they were the only character on the line,
 		// corrupting the resulting shader binary. -DarkStarSword
-		if (s.size() >= 1 && s[s.size() - 1] == '\r')
-			s.erase(--s.end());
+		if (pLineEnd > pStart && pLineEnd[-1] == '\r')
+			pLineEnd--;
 
 		// Strip whitespace from the end of each line. This isn't
 		// strictly necessary, but the MS disassembler inserts an extra
@@ -2556,10 +2756,14 @@ vector<string> stringToLines(const char* start, size_t size)
 		// understand why the pattern isn't matching. By removing
 		// excess spaces from the end of each line now we can make this
 		// gotcha go away.
-		while (s.size() >= 1 && s[s.size() - 1] == ' ')
-			s.erase(--s.end());
+		while (pLineEnd > pStart && pLineEnd[-1] == ' ')
+			pLineEnd--;
 
-		lines[i] = s;
+		lines.emplace_back(pStart, pLineEnd);
+		pStart = ++pEnd;
+		if (pStart >= pRealEnd) {
+			break;
+		}
 	}
 	return lines;
 }
@@ -3049,11 +3253,10 @@ HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *commen
 			hexdump_instruction(s, v, lines, &i, &multiLines, line_byte_offset, hexdump);
 	}
 	ret->clear();
+	ret->reserve(asmSize + asmSize / 8);
 	for (size_t i = 0; i < lines.size(); i++) {
-		for (size_t j = 0; j < lines[i].size(); j++) {
-			ret->insert(ret->end(), lines[i][j]);
-		}
-		ret->insert(ret->end(), '\n');
+		ret->insert(ret->end(), lines[i].begin(), lines[i].end());
+		ret->push_back('\n');
 	}
 
 	pDissassembly->Release();
@@ -3268,11 +3471,16 @@ vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
 	bool multiLine = false;
 	string s2;
 	vector<DWORD> o;
+	// The original shader is usually a close match for the size of the
+	// new one, so use it to avoid growing the output several times:
+	o.reserve(((DWORD*)codeByteStart)[1] / 4);
 	for (DWORD i = 0; i < lines.size(); i++) {
 		try {
-			string s = lines[i];
+			// Each line is only needed once, so work on it in
+			// place and move it into assembleIns() rather than
+			// copying it:
+			string &s = lines[i];
 			preprocessLine(s);
-			vector<DWORD> v;
 			if (!codeStarted) {
 				if (s.size() > 0 && s[0] != ' ') {
 					codeStarted = true;
@@ -3294,7 +3502,7 @@ vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
 				s2.append("\n");
 				s2.append(s);
 			} else if (s.find_first_not_of(" ") != string::npos) {
-				vector<DWORD> ins = assembleIns(s);
+				vector<DWORD> ins = assembleIns(std::move(s));
 				o.insert(o.end(), ins.begin(), ins.end());
 			}
 		} catch (AssemblerParseError &e) {
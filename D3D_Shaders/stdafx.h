@@ -39,7 +39,7 @@ public:
 		msg += ", " + desc + ":\n\"" + context + "\"";
 	}
 
-	const char* what() const
+	const char* what() const throw()
 	{
 		return msg.c_str();
 	}
@@ -0,0 +1,639 @@
+#include "AsyncLog.h"
+
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#include <string>
+
+#include "log.h"
+
+// Each message in a ring is a header followed by the text, padded so that
+// the next header is aligned. A message never wraps around the end of the
+// ring - if it won't fit before the end, a padding record fills the rest and
+// the message goes at the start.
+struct RecordHeader {
+	uint32_t len;   // Of the text after the header
+	uint32_t flags;
+	uint64_t seq;
+};
+
+static const uint32_t RECORD_PADDING = 0x1;
+
+static size_t record_size(size_t len)
+{
+	return sizeof(RecordHeader) + ((len + sizeof(RecordHeader) - 1) & ~(sizeof(RecordHeader) - 1));
+}
+
+// Formatting straight into the ring is only attempted with at least this
+// much room before its end, since most messages are shorter:
+static const size_t DIRECT_FORMAT_MIN = 256;
+
+// The background thread writes to the FILE in chunks of up to this:
+static const size_t OUT_BUFFER_SIZE = 64 * 1024;
+
+// Wide messages longer than this are dropped, since vswprintf can't say how
+// much room a message needs and fails the same way on an encoding error:
+static const size_t MAX_WIDE_MESSAGE = 1024 * 1024;
+
+struct AsyncLog::Ring {
+	char *buf;
+	size_t size; // Power of two
+
+	// Written by the thread that owns the ring:
+	std::atomic<uint64_t> tail;
+	uint64_t cached_head;
+	uint64_t pending; // Where reserve() put the next header
+
+	char pad[64]; // Keep the two threads' fields on separate cache lines
+
+	// Written by whoever is draining the ring:
+	std::atomic<uint64_t> head;
+
+	// A thread that exits gives up its ring for the next new thread:
+	std::atomic<bool> owned;
+
+	Ring(size_t size) :
+		buf(new char[size]),
+		size(size),
+		tail(0),
+		cached_head(0),
+		pending(0),
+		head(0),
+		owned(true)
+	{}
+
+	~Ring()
+	{
+		delete [] buf;
+	}
+};
+
+struct AsyncLog::ThreadRing {
+	uint64_t log_id;
+	std::shared_ptr<Ring> ring;
+
+	ThreadRing() :
+		log_id(0)
+	{}
+
+	~ThreadRing()
+	{
+		release();
+	}
+
+	void release()
+	{
+		if (ring)
+			ring->owned.store(false, std::memory_order_release);
+		ring.reset();
+		log_id = 0;
+	}
+};
+
+static std::atomic<uint64_t> next_log_id(1);
+
+AsyncLog::AsyncLog(FILE *fp, size_t ring_size) :
+	fp(fp),
+	ring_size(4096),
+	id(next_log_id.fetch_add(1)),
+	next_seq(0),
+	rings_version(0),
+	drain_rings_version(0),
+	written_seq(0),
+	gap_pending(false),
+	stats(),
+	kicked(false),
+	flushed_seq(0),
+	flush_waiters(0),
+	waits(0),
+	stopping(false)
+{
+	while (this->ring_size < ring_size && this->ring_size <= SIZE_MAX / 2)
+		this->ring_size *= 2;
+
+	out.reserve(OUT_BUFFER_SIZE);
+	thread = std::thread(&AsyncLog::thread_main, this);
+}
+
+AsyncLog::~AsyncLog()
+{
+	{
+		std::lock_guard<std::mutex> guard(state_lock);
+		stopping = true;
+	}
+	drain_cv.notify_one();
+	thread.join();
+}
+
+AsyncLog::Ring* AsyncLog::get_ring()
+{
+	static thread_local ThreadRing thread_ring;
+	bool expected;
+
+	if (thread_ring.log_id == id)
+		return thread_ring.ring.get();
+
+	// First message from this thread, or the first since it last logged to
+	// a different AsyncLog (only the tests have more than one):
+	thread_ring.release();
+
+	std::lock_guard<std::mutex> guard(rings_lock);
+
+	for (std::shared_ptr<Ring> &ring : rings) {
+		expected = false;
+		if (!ring->owned.load(std::memory_order_relaxed) &&
+		    ring->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			thread_ring.ring = ring;
+			thread_ring.log_id = id;
+			return ring.get();
+		}
+	}
+
+	thread_ring.ring = std::make_shared<Ring>(ring_size);
+	thread_ring.log_id = id;
+	rings.push_back(thread_ring.ring);
+	rings_version.fetch_add(1, std::memory_order_release);
+
+	return thread_ring.ring.get();
+}
+
+void AsyncLog::kick()
+{
+	if (!kicked.load(std::memory_order_relaxed) && !kicked.exchange(true))
+		drain_cv.notify_one();
+}
+
+void AsyncLog::wait_for_space(Ring *ring, size_t need)
+{
+	uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+	ring->cached_head = ring->head.load(std::memory_order_acquire);
+	if (ring->size - (tail - ring->cached_head) >= need)
+		return;
+
+	std::unique_lock<std::mutex> guard(state_lock);
+	waits++;
+
+	while (true) {
+		ring->cached_head = ring->head.load(std::memory_order_acquire);
+		if (ring->size - (tail - ring->cached_head) >= need)
+			return;
+
+		kicked = true;
+		drain_cv.notify_one();
+		space_cv.wait_for(guard, std::chrono::milliseconds(1));
+	}
+}
+
+// Makes room for a message of len bytes in the thread's ring, waiting for the
+// background thread if it is full, and returns where to put the text
+char* AsyncLog::reserve(Ring *ring, size_t len)
+{
+	uint64_t pos = ring->tail.load(std::memory_order_relaxed);
+	size_t offset = pos & (ring->size - 1);
+	size_t to_end = ring->size - offset;
+	size_t need = record_size(len);
+	size_t padding = need > to_end ? to_end : 0;
+	RecordHeader *header;
+
+	if (ring->size - (pos - ring->cached_head) < padding + need)
+		wait_for_space(ring, padding + need);
+
+	if (padding) {
+		header = (RecordHeader*)(ring->buf + offset);
+		header->len = (uint32_t)(to_end - sizeof(RecordHeader));
+		header->flags = RECORD_PADDING;
+		header->seq = 0;
+		pos += to_end;
+		offset = 0;
+	}
+
+	ring->pending = pos;
+	return ring->buf + offset + sizeof(RecordHeader);
+}
+
+void AsyncLog::publish(Ring *ring, char *text, size_t len)
+{
+	RecordHeader *header = (RecordHeader*)(text - sizeof(RecordHeader));
+	uint64_t tail = ring->pending + record_size(len);
+
+	header->len = (uint32_t)len;
+	header->flags = 0;
+	// Taken as late as possible, since the background thread holds back
+	// every later message until this one is published:
+	header->seq = next_seq.fetch_add(1, std::memory_order_relaxed);
+	ring->tail.store(tail, std::memory_order_release);
+
+	// Start draining early once the ring is half full, rather than waiting
+	// for the next interval and perhaps making this thread wait:
+	if (tail - ring->cached_head > ring->size / 2) {
+		ring->cached_head = ring->head.load(std::memory_order_acquire);
+		if (tail - ring->cached_head > ring->size / 2)
+			kick();
+	}
+}
+
+void AsyncLog::vprint(const char *fmt, va_list ap)
+{
+	Ring *ring = get_ring();
+	size_t max_len = ring->size / 4;
+	uint64_t pos = ring->tail.load(std::memory_order_relaxed);
+	size_t offset = pos & (ring->size - 1);
+	size_t room = std::min(ring->size - offset, ring->size - (size_t)(pos - ring->cached_head));
+	char stack_buf[1024];
+	char *text;
+	va_list copy;
+	size_t cap;
+	int len;
+
+	// Most messages can be formatted straight into the ring:
+	if (room >= sizeof(RecordHeader) + DIRECT_FORMAT_MIN) {
+		text = ring->buf + offset + sizeof(RecordHeader);
+		cap = std::min(room - sizeof(RecordHeader), max_len);
+		va_copy(copy, ap);
+		len = vsnprintf(text, cap, fmt, copy);
+		va_end(copy);
+		if (len < 0)
+			return;
+		if ((size_t)len < cap) {
+			ring->pending = pos;
+			publish(ring, text, len);
+			return;
+		}
+	}
+
+	// Otherwise format it on the side and copy it in once there's room:
+	va_copy(copy, ap);
+	len = vsnprintf(stack_buf, sizeof(stack_buf), fmt, copy);
+	va_end(copy);
+	if (len < 0)
+		return;
+	if ((size_t)len < sizeof(stack_buf)) {
+		write(stack_buf, len);
+		return;
+	}
+
+	std::vector<char> heap_buf(len + 1);
+	va_copy(copy, ap);
+	len = vsnprintf(heap_buf.data(), heap_buf.size(), fmt, copy);
+	va_end(copy);
+	if (len > 0)
+		write(heap_buf.data(), std::min((size_t)len, heap_buf.size() - 1));
+}
+
+void AsyncLog::vwprint(const wchar_t *fmt, va_list ap)
+{
+	wchar_t stack_buf[512];
+	std::vector<wchar_t> heap_buf;
+	wchar_t *wide = stack_buf;
+	size_t cap = sizeof(stack_buf) / sizeof(stack_buf[0]);
+	mbstate_t state;
+	std::string text;
+	char mb[16];
+	va_list copy;
+	size_t i, n;
+	int len;
+
+	while (true) {
+		va_copy(copy, ap);
+		len = vswprintf(wide, cap, fmt, copy);
+		va_end(copy);
+		if (len >= 0)
+			break;
+		if (cap >= MAX_WIDE_MESSAGE)
+			return;
+		cap *= 4;
+		heap_buf.resize(cap);
+		wide = heap_buf.data();
+	}
+
+	memset(&state, 0, sizeof(state));
+	text.reserve(len);
+	for (i = 0; i < (size_t)len; i++) {
+		if (wide[i] < 0x80) {
+			text.push_back((char)wide[i]);
+			continue;
+		}
+		n = wcrtomb(mb, wide[i], &state);
+		if (n == (size_t)-1) {
+			text.push_back('?');
+			memset(&state, 0, sizeof(state));
+			continue;
+		}
+		text.append(mb, n);
+	}
+
+	write(text.data(), text.size());
+}
+
+void AsyncLog::write(const void *buf, size_t len)
+{
+	const char *src = (const char*)buf;
+	Ring *ring = get_ring();
+	size_t max_len = ring->size / 4;
+	size_t chunk;
+	char *text;
+
+	// Anything too large for one record is split over several, which can
+	// have other threads' messages written between them as anything
+	// logged without a trailing newline always could:
+	while (len) {
+		chunk = std::min(len, max_len);
+		text = reserve(ring, chunk);
+		memcpy(text, src, chunk);
+		publish(ring, text, chunk);
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+void AsyncLog::write_out(const char *buf, size_t len)
+{
+	if (out.size() + len > OUT_BUFFER_SIZE && !out.empty()) {
+		fwrite(out.data(), 1, out.size(), fp);
+		out.clear();
+	}
+	if (len >= OUT_BUFFER_SIZE)
+		fwrite(buf, 1, len, fp);
+	else
+		out.insert(out.end(), buf, buf + len);
+}
+
+// Skips any padding at the head of the ring, and returns the next message in
+// it, if any
+static RecordHeader* peek(char *buf, size_t size, std::atomic<uint64_t> *ring_head, uint64_t *head, uint64_t tail)
+{
+	RecordHeader *header;
+
+	while (*head != tail) {
+		header = (RecordHeader*)(buf + (*head & (size - 1)));
+		if (!(header->flags & RECORD_PADDING))
+			return header;
+		*head += sizeof(RecordHeader) + header->len;
+		ring_head->store(*head, std::memory_order_release);
+	}
+
+	return NULL;
+}
+
+// Writes out every message published in the rings, in the order they were
+// logged. Must be called with write_lock held. Returns true if it stopped at
+// a message that has taken its place in the order but not been published
+// yet, unless force is set, in which case it gives up on that message and
+// writes the rest.
+bool AsyncLog::drain(bool force)
+{
+	RecordHeader *header, *next_header;
+	Cursor *next;
+	bool stalled = false;
+	bool wrote = false;
+
+	if (drain_rings_version != rings_version.load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> guard(rings_lock);
+		drain_rings = rings;
+		drain_rings_version = rings_version.load(std::memory_order_relaxed);
+	}
+
+	cursors.clear();
+	for (std::shared_ptr<Ring> &ring : drain_rings) {
+		Cursor cursor = { ring.get(),
+			ring->head.load(std::memory_order_relaxed),
+			ring->tail.load(std::memory_order_acquire) };
+		if (cursor.head != cursor.tail)
+			cursors.push_back(cursor);
+	}
+
+	stats.passes++;
+
+	while (true) {
+		next = NULL;
+		next_header = NULL;
+		for (Cursor &cursor : cursors) {
+			header = peek(cursor.ring->buf, cursor.ring->size, &cursor.ring->head, &cursor.head, cursor.tail);
+			if (header && (!next_header || header->seq < next_header->seq)) {
+				next = &cursor;
+				next_header = header;
+			}
+		}
+		if (!next)
+			break;
+
+		if (next_header->seq > written_seq) {
+			// Another thread is in the middle of publishing the
+			// message before this one. Give it until the next pass,
+			// unless it has had long enough to have died trying:
+			if (!force) {
+				if (!gap_pending) {
+					gap_pending = true;
+					gap_since = std::chrono::steady_clock::now();
+					stalled = true;
+					break;
+				}
+				if (std::chrono::steady_clock::now() - gap_since < ASYNC_LOG_GAP_TIMEOUT) {
+					stalled = true;
+					break;
+				}
+			}
+			written_seq = next_header->seq;
+		}
+
+		if (next_header->seq < written_seq) {
+			stats.out_of_order++;
+		} else {
+			written_seq = next_header->seq + 1;
+			gap_pending = false;
+		}
+
+		if (fp) {
+			write_out((char*)(next_header + 1), next_header->len);
+			stats.messages++;
+			stats.bytes += next_header->len;
+			wrote = true;
+		} else {
+			stats.discarded++;
+		}
+
+		next->head += record_size(next_header->len);
+		next->ring->head.store(next->head, std::memory_order_release);
+	}
+
+	if (fp && !out.empty())
+		fwrite(out.data(), 1, out.size(), fp);
+	out.clear();
+	if (wrote)
+		fflush(fp);
+
+	return stalled;
+}
+
+void AsyncLog::thread_main()
+{
+	std::unique_lock<std::mutex> guard(state_lock);
+	uint64_t seq;
+	bool stalled = false;
+	bool stop;
+
+	while (true) {
+		// Check back soon if a message was held back or someone is
+		// waiting for one that hasn't been published yet:
+		if (!stopping && !kicked)
+			drain_cv.wait_for(guard, stalled || flush_waiters ? std::chrono::milliseconds(1) : ASYNC_LOG_INTERVAL);
+
+		stop = stopping;
+		kicked = false;
+		guard.unlock();
+
+		{
+			std::lock_guard<std::mutex> writing(write_lock);
+			stalled = drain(stop);
+			seq = written_seq;
+		}
+
+		guard.lock();
+		flushed_seq = seq;
+		space_cv.notify_all();
+		flushed_cv.notify_all();
+
+		if (stop)
+			return;
+	}
+}
+
+void AsyncLog::flush()
+{
+	std::unique_lock<std::mutex> guard(state_lock);
+	uint64_t target = next_seq.load(std::memory_order_acquire);
+
+	flush_waiters++;
+	kicked = true;
+	drain_cv.notify_one();
+	flushed_cv.wait_for(guard, ASYNC_LOG_GAP_TIMEOUT * 4, [&] { return flushed_seq >= target; });
+	flush_waiters--;
+}
+
+void AsyncLog::flush_later()
+{
+	kick();
+}
+
+bool AsyncLog::flush_now(std::chrono::milliseconds timeout, bool close)
+{
+	std::unique_lock<std::mutex> writing(write_lock, std::defer_lock);
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+
+	// If the background thread itself has crashed it won't be letting go
+	// of the lock, and won't be writing anything else either:
+	if (std::this_thread::get_id() != thread.get_id()) {
+		while (!writing.try_lock()) {
+			if (std::chrono::steady_clock::now() >= deadline)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	drain(true);
+	if (close)
+		fp = NULL;
+
+	return true;
+}
+
+AsyncLogStats AsyncLog::get_stats()
+{
+	AsyncLogStats ret;
+
+	{
+		std::lock_guard<std::mutex> writing(write_lock);
+		ret = stats;
+	}
+	{
+		std::lock_guard<std::mutex> guard(state_lock);
+		ret.waits = waits;
+	}
+	{
+		std::lock_guard<std::mutex> guard(rings_lock);
+		ret.rings = (uint32_t)rings.size();
+	}
+
+	return ret;
+}
+
+// The functions behind the log.h macros in the DirectX 11 build. 3DMigoto
+// only ever has the one log, which is never destroyed:
+
+bool gLogAsync;
+static AsyncLog *async_log;
+
+void StartAsyncLogging(FILE *fp)
+{
+	if (async_log)
+		return;
+
+	async_log = new AsyncLog(fp);
+	std::atomic_thread_fence(std::memory_order_release);
+	gLogAsync = true;
+	LogRedirect() = vAsyncLogInfo;
+}
+
+void AsyncLogInfo(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	async_log->vprint(fmt, ap);
+	va_end(ap);
+}
+
+void vAsyncLogInfo(const char *fmt, va_list va_args)
+{
+	async_log->vprint(fmt, va_args);
+}
+
+void AsyncLogInfoW(const wchar_t *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	async_log->vwprint(fmt, ap);
+	va_end(ap);
+}
+
+void vAsyncLogInfoW(const wchar_t *fmt, va_list va_args)
+{
+	async_log->vwprint(fmt, va_args);
+}
+
+void AsyncLogWrite(const void *buf, size_t size)
+{
+	async_log->write(buf, size);
+}
+
+void AsyncLogFlush()
+{
+	async_log->flush();
+}
+
+void AsyncLogFlushLater()
+{
+	async_log->flush_later();
+}
+
+void AsyncLogFlushAfterCrash()
+{
+	// Anything logged from here on, such as the crash handler's own
+	// messages, goes straight to the file, so that it gets there whatever
+	// state the rest of the process is in. Everything logged before is
+	// written out from this thread in case the background thread can't:
+	gLogAsync = false;
+	LogRedirect() = NULL;
+	async_log->flush_now(std::chrono::milliseconds(1000));
+}
+
+void AsyncLogClose()
+{
+	// Called from DllMain when the process exits, by which point the
+	// background thread has already been killed:
+	gLogAsync = false;
+	LogRedirect() = NULL;
+	async_log->flush_now(std::chrono::milliseconds(500), true);
+}
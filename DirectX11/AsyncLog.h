@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Background writer for the log file, used by the LogInfo and LogDebug macros
+// in log.h once [Logging] async has started it. Writing to LogFile directly
+// takes the CRT's lock on the FILE for every message, so threads logging at
+// the same time queue up behind each other, and whichever thread fills the
+// buffer waits for the disk. On top of that the swap chain used to flush the
+// file every frame, so with debug=1 a game could spend as long logging as it
+// did rendering.
+//
+// Instead, each thread that logs gets a ring buffer of its own, formats its
+// messages straight into it and publishes them with an atomic store, so it
+// never takes a lock or waits on another thread unless its ring fills up. A
+// background thread drains the rings into the FILE in the order the messages
+// were logged, which it knows from a sequence number each message takes as it
+// is published, and flushes the FILE after each pass, so the log is never
+// more than a fraction of a second behind.
+//
+// flush_now() writes out whatever the rings hold from the calling thread
+// instead of waiting for the background thread, for the crash handler and
+// DLL detach, where that thread may have crashed, been killed or be unable
+// to run.
+//
+// This depends on nothing from D3D so that TestAsyncLog can check and
+// benchmark it, along with the log.h macros, against writing to the file
+// directly.
+
+// Each thread's ring. A thread that fills it waits for the background thread
+// to make room, so this is how far a thread can get ahead of the disk:
+static const size_t ASYNC_LOG_RING_SIZE = 256 * 1024;
+
+// How often the background thread drains the rings when nobody asks it to
+static const std::chrono::milliseconds ASYNC_LOG_INTERVAL(50);
+
+// How long the background thread waits for a message that has taken its
+// sequence number but not been published yet before writing the ones after
+// it anyway. Only a thread that died in the middle of logging should take
+// anywhere near this long:
+static const std::chrono::milliseconds ASYNC_LOG_GAP_TIMEOUT(250);
+
+struct AsyncLogStats {
+	uint64_t messages;     // Written to the FILE
+	uint64_t bytes;
+	uint64_t passes;       // Times the rings have been drained
+	uint64_t waits;        // Times a thread found its ring full
+	uint64_t out_of_order; // Messages written after later ones, after a gap timed out
+	uint64_t discarded;    // Messages drained after the FILE was closed
+	uint32_t rings;
+};
+
+class AsyncLog {
+	struct Ring;
+	struct ThreadRing;
+
+	// Where the drain has got to in one ring:
+	struct Cursor {
+		Ring *ring;
+		uint64_t head;
+		uint64_t tail;
+	};
+
+	FILE *fp;
+	size_t ring_size;
+	uint64_t id; // Tells the rings a thread holds for different logs apart
+
+	std::atomic<uint64_t> next_seq;
+
+	std::mutex rings_lock;
+	std::vector<std::shared_ptr<Ring>> rings;
+	std::atomic<uint32_t> rings_version;
+
+	// Held while the rings are drained into the FILE, and protects
+	// everything down to stats:
+	std::mutex write_lock;
+	std::vector<std::shared_ptr<Ring>> drain_rings;
+	uint32_t drain_rings_version;
+	std::vector<Cursor> cursors;
+	std::vector<char> out;
+	uint64_t written_seq; // The next message in order
+	bool gap_pending;
+	std::chrono::steady_clock::time_point gap_since;
+	AsyncLogStats stats;
+
+	std::mutex state_lock;
+	std::condition_variable drain_cv;
+	std::condition_variable space_cv;
+	std::condition_variable flushed_cv;
+	std::atomic<bool> kicked;
+	uint64_t flushed_seq; // Every message before this has been written
+	unsigned flush_waiters;
+	uint64_t waits;
+	bool stopping;
+	std::thread thread;
+
+	Ring* get_ring();
+	char* reserve(Ring *ring, size_t len);
+	void publish(Ring *ring, char *payload, size_t len);
+	void wait_for_space(Ring *ring, size_t need);
+	void kick();
+	bool drain(bool force);
+	void write_out(const char *buf, size_t len);
+	void thread_main();
+
+public:
+	// 3DMigoto never destroys its log, as with ShaderCompileQueue.
+	// Destroying one writes out everything that was logged to it.
+	AsyncLog(FILE *fp, size_t ring_size = ASYNC_LOG_RING_SIZE);
+	~AsyncLog();
+
+	AsyncLog(const AsyncLog&) = delete;
+	AsyncLog& operator=(const AsyncLog&) = delete;
+
+	void vprint(const char *fmt, va_list ap);
+	// Converted to multibyte in the current locale as fwprintf would:
+	void vwprint(const wchar_t *fmt, va_list ap);
+	void write(const void *buf, size_t len);
+
+	// Waits until everything logged before the call has been written and
+	// the FILE flushed, or gives up after a second if a thread seems to
+	// have died while logging
+	void flush();
+	// Asks the background thread to drain the rings now, without waiting
+	// for it to do so
+	void flush_later();
+
+	// Drains the rings on the calling thread, for when the background
+	// thread may not be able to. Gives up and returns false if it can't
+	// take over writing to the FILE within timeout. With close, nothing is
+	// written to the FILE after this returns, so it can be closed.
+	bool flush_now(std::chrono::milliseconds timeout, bool close = false);
+
+	AsyncLogStats get_stats();
+};
@@ -3,6 +3,9 @@
 #include "lock.h"
 
 #include "CommandList.h"
+#include "CommandListCSE.h"
+#include "CommandListStaticIf.h"
+#include "CustomResourceKeep.h"
 
 #include <DDSTextureLoader.h>
 #include <WICTextureLoader.h>
@@ -143,6 +146,8 @@ static void _RunCommandList(CommandList *command_list, CommandListState *state,
 	for (i = command_list->commands.begin(); i < command_list->commands.end() && !state->aborted; i++) {
 		profile_command_list_cmd_start(i->get(), &profiling_state);
 		(*i)->run(state);
+		if ((*i)->invalidates_expression_cache)
+			state->expression_cache_generation++;
 		profile_command_list_cmd_end(i->get(), state, &profiling_state);
 	}
 
@@ -237,10 +242,231 @@ void RunViewCommandList(HackerDevice *mHackerDevice,
 		res->Release();
 }
 
+// Adapts CommandListCSE to our syntax trees
+struct CommandListCSETraits {
+	static bool is_operator(CommandListEvaluatable *node)
+	{
+		return !!dynamic_cast<CommandListOperator*>(node);
+	}
+
+	static std::shared_ptr<CommandListEvaluatable>* lhs(CommandListEvaluatable *node)
+	{
+		return &dynamic_cast<CommandListOperator*>(node)->lhs;
+	}
+
+	static std::shared_ptr<CommandListEvaluatable>* rhs(CommandListEvaluatable *node)
+	{
+		return &dynamic_cast<CommandListOperator*>(node)->rhs;
+	}
+
+	static wstring operator_key(CommandListEvaluatable *node)
+	{
+		// Pattern alone is ambiguous between unary and binary +/-,
+		// but the key of the lhs will disambiguate:
+		return dynamic_cast<CommandListOperator*>(node)->token;
+	}
+
+	static bool operand_key(CommandListEvaluatable *node, wstring *key)
+	{
+		CommandListOperand *operand = dynamic_cast<CommandListOperand*>(node);
+		wchar_t buf[64];
+
+		if (!operand)
+			return false;
+
+		switch (operand->type) {
+			case ParamOverrideType::VALUE:
+				// Binary representation so -0.0 != 0.0:
+				swprintf_s(buf, ARRAYSIZE(buf), L"%08x", *(uint32_t*)&operand->val);
+				break;
+			case ParamOverrideType::INI_PARAM:
+				swprintf_s(buf, ARRAYSIZE(buf), L"ini%i.%i", operand->param_idx,
+					operand->param_component == &DirectX::XMFLOAT4::x ? 0 :
+					operand->param_component == &DirectX::XMFLOAT4::y ? 1 :
+					operand->param_component == &DirectX::XMFLOAT4::z ? 2 : 3);
+				break;
+			case ParamOverrideType::VARIABLE:
+				swprintf_s(buf, ARRAYSIZE(buf), L"var%p", operand->var_ftarget);
+				break;
+			case ParamOverrideType::TEXTURE:
+				swprintf_s(buf, ARRAYSIZE(buf), L"tex%i.%c.%u.%p",
+					operand->texture_filter_target.type,
+					operand->texture_filter_target.shader_type,
+					operand->texture_filter_target.slot,
+					operand->texture_filter_target.custom_resource);
+				break;
+			case ParamOverrideType::SHADER:
+				swprintf_s(buf, ARRAYSIZE(buf), L"shader%c", operand->shader_filter_target);
+				break;
+			case ParamOverrideType::TIME:
+			case ParamOverrideType::RAW_SEPARATION:
+			case ParamOverrideType::EYE_SEPARATION:
+			case ParamOverrideType::CONVERGENCE:
+			case ParamOverrideType::STEREO_ACTIVE:
+			case ParamOverrideType::STEREO_AVAILABLE:
+				// These are read live every time they are used
+				// and may change in the middle of a command list
+				return false;
+			default:
+				swprintf_s(buf, ARRAYSIZE(buf), L"op%i.%u", operand->type, operand->scissor);
+				break;
+		}
+
+		*key = buf;
+		return true;
+	}
+
+	static bool worth_sharing(CommandListEvaluatable *node)
+	{
+		CommandListOperand *operand = dynamic_cast<CommandListOperand*>(node);
+
+		// Any operator, and the operands that have to look
+		// something up in the state every time they are used:
+		if (!operand)
+			return true;
+		return operand->type == ParamOverrideType::TEXTURE
+			|| operand->type == ParamOverrideType::SHADER;
+	}
+
+	static std::shared_ptr<CommandListEvaluatable> make_shared(
+			std::shared_ptr<CommandListEvaluatable> subtree, unsigned idx)
+	{
+		return std::make_shared<CommandListSubexpression>(subtree, idx);
+	}
+};
+
+static CommandListExpression* command_expression(CommandListCommand *command)
+{
+	AssignmentCommand *assignment = dynamic_cast<AssignmentCommand*>(command);
+	IfCommand *if_command = dynamic_cast<IfCommand*>(command);
+	PerDrawStereoOverrideCommand *stereo = dynamic_cast<PerDrawStereoOverrideCommand*>(command);
+
+	if (assignment)
+		return &assignment->expression;
+	if (if_command)
+		return &if_command->expression;
+	if (stereo && !stereo->staging_type)
+		return &stereo->expression;
+	return NULL;
+}
+
+static void find_subexpression_dependencies(CommandListEvaluatable *node,
+		std::unordered_set<float*> *variables, std::unordered_set<int> *params)
+{
+	CommandListOperator *op = dynamic_cast<CommandListOperator*>(node);
+	CommandListOperand *operand = dynamic_cast<CommandListOperand*>(node);
+
+	if (op) {
+		if (op->lhs)
+			find_subexpression_dependencies(op->lhs.get(), variables, params);
+		find_subexpression_dependencies(op->rhs.get(), variables, params);
+	} else if (operand) {
+		if (operand->type == ParamOverrideType::VARIABLE)
+			variables->insert(operand->var_ftarget);
+		else if (operand->type == ParamOverrideType::INI_PARAM)
+			params->insert(operand->param_idx);
+	}
+	// Nested CommandListSubexpressions are hoisted themselves, so no
+	// need to recurse into them here
+}
+
+// Finds any subexpressions that occur more than once over every expression in
+// every command list and replaces them with a shared node that only
+// evaluates them once per command list invocation.
+static void eliminate_common_subexpressions()
+{
+	CommandListCSE<CommandListEvaluatable, CommandListCSETraits> cse;
+	std::vector<CommandListExpression*> expressions;
+	std::unordered_set<CommandListCommand*> commands;
+	std::unordered_set<float*> variables;
+	std::unordered_set<int> params;
+	CommandListExpression *expression;
+	VariableAssignment *var_assignment;
+	ParamOverride *param_override;
+
+	for (CommandList *command_list : registered_command_lists) {
+		for (auto &command : command_list->commands) {
+			// If commands are in both the pre and post lists:
+			if (!commands.insert(command.get()).second)
+				continue;
+			expression = command_expression(command.get());
+			if (!expression)
+				continue;
+			expressions.push_back(expression);
+			cse.add(&expression->evaluatable);
+		}
+	}
+
+	cse.run();
+	if (cse.hoisted.empty())
+		return;
+
+	for (CommandListExpression *expression : expressions)
+		expression->compile();
+
+	// Assignments only need to invalidate the cache if they are to
+	// something that one of the subexpressions reads. Anything else that
+	// is not an if command may alter state that the texture filter and
+	// other operands depend on, so always invalidates it:
+	for (auto &subexpression : cse.hoisted)
+		find_subexpression_dependencies(subexpression.get(), &variables, &params);
+	for (CommandListCommand *command : commands) {
+		var_assignment = dynamic_cast<VariableAssignment*>(command);
+		param_override = dynamic_cast<ParamOverride*>(command);
+		if (var_assignment)
+			command->invalidates_expression_cache = !!variables.count(&var_assignment->var->fval);
+		else if (param_override)
+			command->invalidates_expression_cache = !!params.count(param_override->param_idx);
+	}
+
+	LogInfo("Eliminated %u expression nodes by sharing %u common subexpressions\n",
+			cse.eliminated, (unsigned)cse.hoisted.size());
+}
+
+struct CommandListStaticIfTraits {
+	static CommandList::Commands* commands(CommandList *command_list)
+	{
+		return &command_list->commands;
+	}
+
+	static bool post(CommandList *command_list)
+	{
+		return command_list->post;
+	}
+
+	static bool static_condition(CommandListCommand *command, float *val)
+	{
+		IfCommand *if_command = dynamic_cast<IfCommand*>(command);
+
+		if (!if_command || !if_command->pre_finalised || !if_command->post_finalised)
+			return false;
+
+		return if_command->expression.static_evaluate(val);
+	}
+
+	static CommandList* branch(CommandListCommand *command, bool post, bool taken)
+	{
+		IfCommand *if_command = static_cast<IfCommand*>(command);
+
+		if (taken)
+			return (post ? if_command->true_commands_post : if_command->true_commands_pre).get();
+		return (post ? if_command->false_commands_post : if_command->false_commands_pre).get();
+	}
+
+	static void inlined(CommandListCommand *command, bool post, bool taken)
+	{
+		LogInfo("Inlined %s branch of static %s %S\n",
+				taken ? "true" : "false",
+				post ? "post" : "pre",
+				command->ini_line.c_str());
+	}
+};
+
 void optimise_command_lists(HackerDevice *device)
 {
 	bool making_progress;
 	bool ignore_cto_pre, ignore_cto_post;
+	unsigned static_ifs_inlined = 0;
 	size_t i;
 	CommandList::Commands::iterator new_end;
 	DWORD start;
@@ -253,6 +479,8 @@ void optimise_command_lists(HackerDevice *device)
 			command_list->commands[i]->optimise(device);
 	}
 
+	eliminate_common_subexpressions();
+
 	do {
 		making_progress = false;
 		ignore_cto_pre = true;
@@ -294,6 +522,11 @@ void optimise_command_lists(HackerDevice *device)
 					making_progress = true;
 					continue;
 				}
+				if (inline_static_if<CommandList, CommandListStaticIfTraits>(command_list, i)) {
+					static_ifs_inlined++;
+					making_progress = true;
+					continue;
+				}
 				i++;
 			}
 		}
@@ -307,6 +540,8 @@ void optimise_command_lists(HackerDevice *device)
 
 	Profiling::update_cto_warning(!ignore_cto_post);
 
+	if (static_ifs_inlined)
+		LogInfo("Inlined %u static if / else if branches\n", static_ifs_inlined);
 	LogInfo("Command List Optimiser finished after %ums\n", GetTickCount() - start);
 	registered_command_lists.clear();
 	dynamically_allocated_command_lists.clear();
@@ -1760,6 +1995,7 @@ CustomShader::CustomShader() :
 	max_executions_per_frame(0),
 	frame_no(0),
 	executions_this_frame(0),
+	untracked_includes(false),
 	sampler_override(0),
 	sampler_state(nullptr),
 	compile_flags(D3DCompileFlags::OPTIMIZATION_LEVEL3)
@@ -1928,6 +2164,8 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 		wcscat(wpath, filename);
 		if (GetFileAttributes(wpath) != INVALID_FILE_ATTRIBUTES)
 			found = true;
+		else
+			source_files.push_back(wpath);
 	}
 	if (!found) {
 		if (!GetModuleFileName(migoto_handle, wpath, MAX_PATH)) {
@@ -1937,6 +2175,7 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 		wcsrchr(wpath, L'\\')[1] = 0;
 		wcscat(wpath, filename);
 	}
+	source_files.push_back(wpath);
 
 	f = CreateFile(wpath, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f == INVALID_HANDLE_VALUE) {
@@ -1987,6 +2226,9 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 		hr = D3DCompile(srcData.data(), srcDataSize, apath, macros,
 			G->recursive_include == -1 ? D3D_COMPILE_STANDARD_FILE_INCLUDE : &include_handler,
 			"main", shaderModel, (UINT)compile_flags, 0, ppBytecode, &pErrorMsgs);
+		source_files.insert(source_files.end(), include_handler.included.begin(), include_handler.included.end());
+		if (G->recursive_include == -1)
+			untracked_includes = true;
 	}
 
 	if (pErrorMsgs) {
@@ -2024,6 +2266,43 @@ err:
 	return true;
 }
 
+// Takes over everything that compile() and substantiate() made for a section
+// that has not changed since the last config load. The blend, depth/stencil,
+// rasterizer and sampler descriptions have been parsed again from the same
+// lines, so the states made from them are still good:
+void CustomShader::keep_compiled_shaders(CustomShader *previous)
+{
+	std::swap(vs_override, previous->vs_override);
+	std::swap(hs_override, previous->hs_override);
+	std::swap(ds_override, previous->ds_override);
+	std::swap(gs_override, previous->gs_override);
+	std::swap(ps_override, previous->ps_override);
+	std::swap(cs_override, previous->cs_override);
+
+	std::swap(vs, previous->vs);
+	std::swap(hs, previous->hs);
+	std::swap(ds, previous->ds);
+	std::swap(gs, previous->gs);
+	std::swap(ps, previous->ps);
+	std::swap(cs, previous->cs);
+
+	std::swap(vs_bytecode, previous->vs_bytecode);
+	std::swap(hs_bytecode, previous->hs_bytecode);
+	std::swap(ds_bytecode, previous->ds_bytecode);
+	std::swap(gs_bytecode, previous->gs_bytecode);
+	std::swap(ps_bytecode, previous->ps_bytecode);
+	std::swap(cs_bytecode, previous->cs_bytecode);
+
+	std::swap(blend_state, previous->blend_state);
+	std::swap(depth_stencil_state, previous->depth_stencil_state);
+	std::swap(rs_state, previous->rs_state);
+	std::swap(sampler_state, previous->sampler_state);
+
+	std::swap(substantiated, previous->substantiated);
+	std::swap(source_files, previous->source_files);
+	std::swap(untracked_includes, previous->untracked_includes);
+}
+
 void CustomShader::substantiate(ID3D11Device *mOrigDevice1)
 {
 	if (substantiated)
@@ -2622,8 +2901,10 @@ CommandListState::CommandListState() :
 	recursion(0),
 	extra_indent(0),
 	aborted(false),
-	scissor_valid(false)
+	scissor_valid(false),
+	expression_cache_generation(0)
 {
+	memset(expression_cache, 0, sizeof(expression_cache));
 	memset(&cursor_info, 0, sizeof(CURSORINFO));
 	memset(&cursor_info_ex, 0, sizeof(ICONINFO));
 	memset(&window_rect, 0, sizeof(RECT));
@@ -3182,6 +3463,24 @@ bool CommandListOperand::optimise(HackerDevice *device, std::shared_ptr<CommandL
 	return true;
 }
 
+bool CommandListOperand::compile(CommandListBytecode *bytecode)
+{
+	// Constants and variables are by far the most common operands and
+	// are loaded inline. Everything else needs the command list state
+	// and calls back into evaluate() from the bytecode interpreter.
+	switch (type) {
+		case ParamOverrideType::VALUE:
+			bytecode->push_value(val);
+			return true;
+		case ParamOverrideType::VARIABLE:
+			bytecode->push_load(var_ftarget);
+			return true;
+	}
+
+	bytecode->push_operand(static_cast<CommandListEvaluatable*>(this));
+	return true;
+}
+
 static const wchar_t *operator_tokens[] = {
 	// Three character tokens first:
 	L"===", L"!==",
@@ -3377,46 +3676,14 @@ public: \
 		) : CommandListOperator(lhs, t, rhs) \
 	{} \
 	static const wchar_t* pattern() { return L##operator_pattern; } \
-	float evaluate(float lhs, float rhs) override { return (fn); } \
+	static float apply(float lhs, float rhs) { return (fn); } \
+	float evaluate(float lhs, float rhs) override { return apply(lhs, rhs); } \
+	CommandListOperatorFn bytecode_fn() override { return apply; } \
 }; \
 static CommandListOperatorFactory<name##T> name;
 
-// Highest level of precedence, allows for negative numbers
-DEFINE_OPERATOR(unary_not_operator,     "!",  (!rhs));
-DEFINE_OPERATOR(unary_plus_operator,    "+",  (+rhs));
-DEFINE_OPERATOR(unary_negate_operator,  "-",  (-rhs));
-
-// High level of precedence, right-associative. Lower than unary operators, so
-// that 4**-2 works for square root
-DEFINE_OPERATOR(exponent_operator,      "**", (pow(lhs, rhs)));
-
-DEFINE_OPERATOR(multiplication_operator,"*",  (lhs * rhs));
-DEFINE_OPERATOR(division_operator,      "/",  (lhs / rhs));
-DEFINE_OPERATOR(floor_division_operator,"//", (floor(lhs / rhs)));
-DEFINE_OPERATOR(modulus_operator,       "%",  (fmod(lhs, rhs)));
-
-DEFINE_OPERATOR(addition_operator,      "+",  (lhs + rhs));
-DEFINE_OPERATOR(subtraction_operator,   "-",  (lhs - rhs));
-
-DEFINE_OPERATOR(less_operator,          "<",  (lhs < rhs));
-DEFINE_OPERATOR(less_equal_operator,    "<=", (lhs <= rhs));
-DEFINE_OPERATOR(greater_operator,       ">",  (lhs > rhs));
-DEFINE_OPERATOR(greater_equal_operator, ">=", (lhs >= rhs));
-
-// The triple equals operator tests for binary equivalence - in particular,
-// this allows us to test for negative zero, used in texture filtering to
-// signify that nothing is bound to a given slot. Negative zero cannot be
-// tested for using the regular equals operator, since -0.0 == +0.0. This
-// operator could also test for specific cases of NAN (though, without the
-// vs2015 toolchain "nan" won't parse as such).
-DEFINE_OPERATOR(equality_operator,      "==", (lhs == rhs));
-DEFINE_OPERATOR(inequality_operator,    "!=", (lhs != rhs));
-DEFINE_OPERATOR(identical_operator,     "===",(*(uint32_t*)&lhs == *(uint32_t*)&rhs));
-DEFINE_OPERATOR(not_identical_operator, "!==",(*(uint32_t*)&lhs != *(uint32_t*)&rhs));
-
-DEFINE_OPERATOR(and_operator,           "&&", (lhs && rhs));
-
-DEFINE_OPERATOR(or_operator,            "||", (lhs || rhs));
+#include "CommandListOperators.h"
+#undef DEFINE_OPERATOR
 
 // TODO: Ternary if operator
 
@@ -3570,6 +3837,7 @@ static void _log_token(CommandListToken *token)
 	CommandListOperator *op;
 	CommandListOperatorToken *op_tok;
 	CommandListOperand *operand;
+	CommandListSubexpression *subexpression;
 
 	if (!token)
 		return;
@@ -3581,6 +3849,7 @@ static void _log_token(CommandListToken *token)
 	op = dynamic_cast<CommandListOperator*>(token);
 	op_tok = dynamic_cast<CommandListOperatorToken*>(token);
 	operand = dynamic_cast<CommandListOperand*>(token);
+	subexpression = dynamic_cast<CommandListSubexpression*>(token);
 	if (inner) {
 		_log_syntax_tree(inner);
 	} else if (op) {
@@ -3600,6 +3869,10 @@ static void _log_token(CommandListToken *token)
 		LogInfoNoNL("OperatorToken \"%S\"", token->token.c_str());
 	} else if (operand) {
 		LogInfoNoNL("Operand \"%S\"", token->token.c_str());
+	} else if (subexpression) {
+		LogInfoNoNL("Subexpression %u[ ", subexpression->idx);
+		_log_token(dynamic_cast<CommandListToken*>(subexpression->inner.get()));
+		LogInfoNoNL(" ]");
 	} else {
 		LogInfoNoNL("Token \"%S\"", token->token.c_str());
 	}
@@ -3657,6 +3930,7 @@ bool CommandListExpression::parse(const wstring *expression, const wstring *ini_
 		transform_operators_recursive(&tree, or_operators, ARRAYSIZE(or_operators), false, false);
 
 		evaluatable = tree.finalise();
+		bytecode.clear();
 		log_syntax_tree(evaluatable, "Final syntax tree:\n");
 		return true;
 	} catch (const CommandListSyntaxError &e) {
@@ -3668,9 +3942,20 @@ bool CommandListExpression::parse(const wstring *expression, const wstring *ini_
 	}
 }
 
+static inline float run_bytecode(const CommandListBytecode &bytecode,
+		CommandListState *state, HackerDevice *device)
+{
+	return bytecode.run([state, device](void *operand) {
+		return ((CommandListEvaluatable*)operand)->evaluate(state, device);
+	});
+}
+
 float CommandListExpression::evaluate(CommandListState *state, HackerDevice *device)
 {
-	return evaluatable->evaluate(state, device);
+	if (bytecode.empty())
+		return evaluatable->evaluate(state, device);
+
+	return run_bytecode(bytecode, state, device);
 }
 
 bool CommandListExpression::static_evaluate(float *ret, HackerDevice *device)
@@ -3694,9 +3979,23 @@ bool CommandListExpression::optimise(HackerDevice *device)
 	if (replacement)
 		evaluatable = replacement;
 
+	compile();
+
 	return ret;
 }
 
+// Lowers whatever is left of the tree after static evaluation into bytecode.
+// The tree is kept since it owns the operands the bytecode refers to. Called
+// again if the command list optimiser modifies the tree.
+void CommandListExpression::compile()
+{
+	bytecode.clear();
+	if (!evaluatable->compile(&bytecode) || !bytecode.valid()) {
+		LogInfo("Expression too complex to compile, will evaluate syntax tree instead\n");
+		bytecode.clear();
+	}
+}
+
 // Finalises the syntax trees in the operator into evaluatable operands,
 // thereby making this operator also evaluatable.
 std::shared_ptr<CommandListEvaluatable> CommandListOperator::finalise()
@@ -3800,8 +4099,16 @@ CommandListSyntaxTree::Walk CommandListSyntaxTree::walk()
 
 float CommandListOperator::evaluate(CommandListState *state, HackerDevice *device)
 {
-	if (lhs) // Binary operator
-		return evaluate(lhs->evaluate(state, device), rhs->evaluate(state, device));
+	float lhs_val;
+
+	if (lhs) { // Binary operator
+		// Function arguments are evaluated in an unspecified order,
+		// so sequence the operands explicitly in case they have side
+		// effects (e.g. the texture filter updating its cache), left
+		// to right the same as the bytecode from compile():
+		lhs_val = lhs->evaluate(state, device);
+		return evaluate(lhs_val, rhs->evaluate(state, device));
+	}
 	return evaluate(std::numeric_limits<float>::quiet_NaN(), rhs->evaluate(state, device));
 }
 
@@ -3858,6 +4165,77 @@ bool CommandListOperator::optimise(HackerDevice *device, std::shared_ptr<Command
 	return true;
 }
 
+bool CommandListOperator::compile(CommandListBytecode *bytecode)
+{
+	// Left to right, same as evaluate(), in case any operands have side
+	// effects (e.g. the texture filter updating its cache):
+	if (lhs && !lhs->compile(bytecode))
+		return false;
+	if (!rhs->compile(bytecode))
+		return false;
+
+	bytecode->push_operator(bytecode_fn(), !lhs);
+	return true;
+}
+
+CommandListSubexpression::CommandListSubexpression(std::shared_ptr<CommandListEvaluatable> inner, unsigned idx) :
+	CommandListToken(0),
+	inner(inner),
+	idx(idx)
+{
+	CommandListToken *inner_token = dynamic_cast<CommandListToken*>(inner.get());
+
+	if (inner_token) {
+		token = inner_token->token;
+		token_pos = inner_token->token_pos;
+	}
+
+	if (!inner->compile(&bytecode) || !bytecode.valid())
+		bytecode.clear();
+}
+
+float CommandListSubexpression::evaluate(CommandListState *state, HackerDevice *device)
+{
+	CommandListExpressionCacheEntry *cache;
+	float ret;
+
+	if (state) {
+		cache = &state->expression_cache[idx % COMMAND_LIST_EXPRESSION_CACHE_SIZE];
+		if (cache->owner == this && cache->generation == state->expression_cache_generation)
+			return cache->val;
+	}
+
+	if (bytecode.empty())
+		ret = inner->evaluate(state, device);
+	else
+		ret = run_bytecode(bytecode, state, device);
+
+	if (state) {
+		cache->owner = this;
+		cache->generation = state->expression_cache_generation;
+		cache->val = ret;
+	}
+
+	return ret;
+}
+
+bool CommandListSubexpression::static_evaluate(float *ret, HackerDevice *device)
+{
+	return inner->static_evaluate(ret, device);
+}
+
+bool CommandListSubexpression::optimise(HackerDevice *device, std::shared_ptr<CommandListEvaluatable> *replacement)
+{
+	// Only created after the tree has already been optimised
+	return false;
+}
+
+bool CommandListSubexpression::compile(CommandListBytecode *bytecode)
+{
+	bytecode->push_operand(static_cast<CommandListEvaluatable*>(this));
+	return true;
+}
+
 CommandListSyntaxTree::Walk CommandListOperator::walk()
 {
 	Walk ret;
@@ -4285,6 +4663,8 @@ CustomResource::CustomResource() :
 	view(NULL),
 	is_null(true),
 	substantiated(false),
+	substantiated_resource(NULL),
+	dirty(false),
 	bind_flags((D3D11_BIND_FLAG)0),
 	misc_flags((D3D11_RESOURCE_MISC_FLAG)0),
 	stride(0),
@@ -4323,6 +4703,12 @@ CustomResource::~CustomResource()
 	free(initial_data);
 }
 
+// See CustomResourceKeep.h
+bool CustomResource::KeepSubstantiatedResource(CustomResource *previous)
+{
+	return keep_substantiated_resource(this, previous);
+}
+
 bool CustomResource::OverrideSurfaceCreationMode(StereoHandle mStereoHandle, NVAPI_STEREO_SURFACECREATEMODE *orig_mode)
 {
 
@@ -4413,6 +4799,8 @@ void CustomResource::Substantiate(ID3D11Device *mOrigDevice1, StereoHandle mSter
 		}
 	}
 
+	substantiated_resource = resource;
+
 	if (restore_create_mode)
 		Profiling::NvAPI_Stereo_SetSurfaceCreationMode(mStereoHandle, orig_mode);
 
@@ -5098,8 +5486,7 @@ void CustomResource::expire(ID3D11Device *mOrigDevice1, ID3D11DeviceContext *mOr
 	//       and update those. Not urgent as yet, but will be important if
 	//       we allow the === and !== operators to check if one custom
 	//       resource matches another.
-	// TODO: Track if resource is dirty (used as render/depth target/UAV,
-	//       ever assigned or copied to) and re-substantiate if clean.
+	// TODO: Re-substantiate instead of transferring if it is not dirty
 	// TODO: Use sharable resources to skip copy back to CPU (limited to 2D
 	//       non-mip-mapped resources)
 	// TODO: Option to skip inter-device copies instead of transfer
@@ -5549,6 +5936,10 @@ IfCommand::IfCommand(const wchar_t *section) :
 	has_nested_else_if(false),
 	section(section)
 {
+	// Evaluating the condition has no side effects, and any commands in
+	// the if / else blocks will invalidate the cache themselves:
+	invalidates_expression_cache = false;
+
 	true_commands_pre = std::make_shared<CommandList>();
 	true_commands_post = std::make_shared<CommandList>();
 	false_commands_pre = std::make_shared<CommandList>();
@@ -6120,6 +6511,7 @@ void ResourceCopyTarget::SetResource(
 		custom_resource->offset = offset;
 		custom_resource->format = format;
 		custom_resource->buf_size = buf_size;
+		custom_resource->dirty = true;
 
 
 		if (res == NULL && view == NULL) {
@@ -7623,9 +8015,11 @@ void ClearViewCommand::run(CommandListState *state)
 	if (!view)
 		view = create_best_view(resource, state, stride, offset, format, buf_src_size);
 
-	if (view)
+	if (view) {
 		clear_unknown_view(view, state);
-	else
+		if (target.type == ResourceCopyTargetType::CUSTOM_RESOURCE)
+			target.custom_resource->dirty = true;
+	} else
 		COMMAND_LIST_LOG(state, "  No view and unable to create view to clear resource\n");
 
 	if (resource)
@@ -7702,6 +8096,21 @@ void ResourceCopyOperation::run(CommandListState *state)
 		return;
 	}
 
+	// A custom resource bound by reference as an output may be written to
+	// by whatever is drawn next, and one referenced by another custom
+	// resource may be bound as an output through that:
+	if (src.type == ResourceCopyTargetType::CUSTOM_RESOURCE && !(options & ResourceCopyOptions::COPY_MASK)) {
+		switch (dst.type) {
+		case ResourceCopyTargetType::CUSTOM_RESOURCE:
+		case ResourceCopyTargetType::RENDER_TARGET:
+		case ResourceCopyTargetType::DEPTH_STENCIL_TARGET:
+		case ResourceCopyTargetType::UNORDERED_ACCESS_VIEW:
+		case ResourceCopyTargetType::STREAM_OUTPUT:
+			src.custom_resource->dirty = true;
+			break;
+		}
+	}
+
 	if (dst.type == ResourceCopyTargetType::CUSTOM_RESOURCE) {
 		// If we're copying to a custom resource, use the resource &
 		// view in the CustomResource directly as the cache instead of
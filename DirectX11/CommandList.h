@@ -11,6 +11,7 @@
 
 #include "DrawCallInfo.h"
 #include "ResourceHash.h"
+#include "CommandListBytecode.h"
 
 // Used to prevent typos leading to infinite recursion (or at least overflowing
 // the real stack) due to a section running itself or a circular reference. 64
@@ -25,6 +26,18 @@ class HackerDevice;
 class HackerContext;
 enum class FrameAnalysisOptions;
 class ResourceCopyTarget;
+class CommandListEvaluatable;
+
+// Number of common subexpressions that can be cached in each command list
+// invocation before they start evicting each other (which only costs a
+// re-evaluation). See CommandListSubexpression:
+#define COMMAND_LIST_EXPRESSION_CACHE_SIZE 32
+
+struct CommandListExpressionCacheEntry {
+	CommandListEvaluatable *owner;
+	unsigned generation;
+	float val;
+};
 
 class CommandListState {
 public:
@@ -71,6 +84,13 @@ public:
 	// Anything that needs to be updated at the end of the command list:
 	bool update_params;
 
+	// Values of common subexpressions already evaluated in this command
+	// list invocation. Bumping the generation invalidates all of them,
+	// which is done after running any command that could change what
+	// they depend on:
+	unsigned expression_cache_generation;
+	CommandListExpressionCacheEntry expression_cache[COMMAND_LIST_EXPRESSION_CACHE_SIZE];
+
 	CommandListState();
 	~CommandListState();
 };
@@ -85,6 +105,14 @@ public:
 	unsigned pre_executions;
 	unsigned post_executions;
 
+	// Cleared by the command list optimiser for commands that cannot
+	// change the value of any common subexpression (see
+	// CommandListSubexpression):
+	bool invalidates_expression_cache;
+
+	CommandListCommand() :
+		invalidates_expression_cache(true)
+	{}
 	virtual ~CommandListCommand() {};
 
 	virtual void run(CommandListState*) = 0;
@@ -328,10 +356,18 @@ public:
 	unsigned frame_no;
 	int executions_this_frame;
 
+	// Every file the shaders were compiled from, #includes and all, and
+	// any paths that were searched first without finding anything, so a
+	// config reload can tell if they need compiling again. The standard
+	// include handler doesn't tell us what it included:
+	std::vector<std::wstring> source_files;
+	bool untracked_includes;
+
 	CustomShader();
 	~CustomShader();
 
 	bool compile(char type, wchar_t *filename, const wstring *wname, const wstring *mod_namespace);
+	void keep_compiled_shaders(CustomShader *previous);
 	void substantiate(ID3D11Device *mOrigDevice);
 
 	void merge_blend_states(ID3D11BlendState *state, FLOAT blend_factor[4], UINT sample_mask, ID3D11Device *mOrigDevice);
@@ -511,6 +547,12 @@ public:
 	wstring filename;
 	bool substantiated;
 
+	// The resource Substantiate() created (not referenced, only compared),
+	// and whether anything else has written to or replaced it since, so
+	// that a config reload only keeps one that is still as it was loaded:
+	ID3D11Resource *substantiated_resource;
+	bool dirty;
+
 	// Used to override description when copying or synthesise resources
 	// from scratch:
 	CustomResourceType override_type;
@@ -545,6 +587,7 @@ public:
 	void OverrideTexDesc(D3D11_TEXTURE3D_DESC *desc);
 	void OverrideOutOfBandInfo(DXGI_FORMAT *format, UINT *stride);
 	void expire(ID3D11Device *mOrigDevice1, ID3D11DeviceContext *mOrigContext1);
+	bool KeepSubstantiatedResource(CustomResource *previous);
 
 private:
 	void LoadFromFile(ID3D11Device *mOrigDevice);
@@ -732,6 +775,9 @@ public:
 	virtual float evaluate(CommandListState *state, HackerDevice *device=NULL) = 0;
 	virtual bool static_evaluate(float *ret, HackerDevice *device=NULL) = 0;
 	virtual bool optimise(HackerDevice *device, std::shared_ptr<CommandListEvaluatable> *replacement) = 0;
+	// Appends this node to the flattened form of the expression in
+	// postfix order. Returns false if it cannot be represented there.
+	virtual bool compile(CommandListBytecode *bytecode) = 0;
 };
 
 // Indicates that this node can be used as an operand, checked when
@@ -813,10 +859,12 @@ public:
 	float evaluate(CommandListState *state, HackerDevice *device=NULL) override;
 	bool static_evaluate(float *ret, HackerDevice *device=NULL) override;
 	bool optimise(HackerDevice *device, std::shared_ptr<CommandListEvaluatable> *replacement) override;
+	bool compile(CommandListBytecode *bytecode) override;
 	Walk walk() override;
 
 	static const wchar_t* pattern() { return L"<IMPLEMENT ME>"; }
 	virtual float evaluate(float lhs, float rhs) = 0;
+	virtual CommandListOperatorFn bytecode_fn() = 0;
 };
 
 // Abstract base factory class for defining operators. Statically instantiate
@@ -994,16 +1042,43 @@ public:
 	float evaluate(CommandListState *state, HackerDevice *device=NULL) override;
 	bool static_evaluate(float *ret, HackerDevice *device=NULL) override;
 	bool optimise(HackerDevice *device, std::shared_ptr<CommandListEvaluatable> *replacement) override;
+	bool compile(CommandListBytecode *bytecode) override;
+};
+
+// A subexpression that occurs more than once across the command lists,
+// replaced with a single shared instance of this node by the command list
+// optimiser. It evaluates its contents at most once per command list
+// invocation, until a command that may have changed one of the operands runs
+// and bumps the state's expression_cache_generation.
+class CommandListSubexpression :
+	public CommandListToken,
+	public CommandListEvaluatable {
+public:
+	std::shared_ptr<CommandListEvaluatable> inner;
+	CommandListBytecode bytecode;
+	unsigned idx;
+
+	CommandListSubexpression(std::shared_ptr<CommandListEvaluatable> inner, unsigned idx);
+
+	float evaluate(CommandListState *state, HackerDevice *device=NULL) override;
+	bool static_evaluate(float *ret, HackerDevice *device=NULL) override;
+	bool optimise(HackerDevice *device, std::shared_ptr<CommandListEvaluatable> *replacement) override;
+	bool compile(CommandListBytecode *bytecode) override;
 };
 
 class CommandListExpression {
 public:
 	std::shared_ptr<CommandListEvaluatable> evaluatable;
+	// Filled out from the syntax tree by optimise(). If empty (not yet
+	// optimised, or the tree could not be compiled) the tree is evaluated
+	// directly instead.
+	CommandListBytecode bytecode;
 
 	bool parse(const wstring *expression, const wstring *ini_namespace, CommandListScope *scope);
 	float evaluate(CommandListState *state, HackerDevice *device=NULL);
 	bool static_evaluate(float *ret, HackerDevice *device=NULL);
 	bool optimise(HackerDevice *device);
+	void compile();
 };
 
 class AssignmentCommand : public CommandListCommand {
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+
+// Flattened form of a command list expression. Once an expression has been
+// optimised its syntax tree is lowered into a postfix program that is run by
+// a single loop over a small fixed size stack, instead of recursing through
+// the tree with a virtual call and a shared_ptr dereference per node. The
+// tree is kept around as the owner of the operands and so that anything that
+// cannot be lowered (or that is evaluated before optimisation) still works.
+//
+// This header deliberately depends on nothing from D3D or the rest of
+// 3DMigoto so that TestCommandList/expression_bench.cpp can exercise the same
+// interpreter and operator definitions outside of the game.
+
+// Deepest stack a program may need. Only expressions that nest deeply on the
+// right hand side (e.g. "a - (b - (c - ...)))") use more than a couple of
+// entries, so anything over this is simply left to the tree evaluator:
+#define COMMAND_LIST_BYTECODE_MAX_STACK 32
+
+// Operators generated by DEFINE_OPERATOR expose their body as a plain
+// function so that the bytecode can call it directly. Unary operators are
+// passed NAN as the lhs, the same as the tree evaluator does.
+typedef float (*CommandListOperatorFn)(float lhs, float rhs);
+
+enum class CommandListOpcode {
+	VALUE,    // Push a constant
+	LOAD,     // Push *ptr, used for variables
+	OPERAND,  // Push the result of a callback for any other operand type
+	UNARY,    // Replace the top of the stack with fn(NAN, top)
+	BINARY,   // Pop rhs and lhs, push fn(lhs, rhs)
+};
+
+struct CommandListInstruction {
+	CommandListOpcode op;
+	union {
+		float val;
+		const float *ptr;
+		void *operand;
+		CommandListOperatorFn fn;
+	};
+};
+
+class CommandListBytecode {
+public:
+	std::vector<CommandListInstruction> program;
+	unsigned stack_depth;
+	unsigned max_stack_depth;
+	bool underflow;
+
+	CommandListBytecode() :
+		stack_depth(0),
+		max_stack_depth(0),
+		underflow(false)
+	{}
+
+	void clear()
+	{
+		program.clear();
+		stack_depth = max_stack_depth = 0;
+		underflow = false;
+	}
+
+	bool empty() const
+	{
+		return program.empty();
+	}
+
+	// Emitters, called in postfix order by whatever walks the tree. They
+	// track the stack depth so that compile errors and over-deep programs
+	// can be detected by valid() before the program is ever run.
+	void push_value(float val)
+	{
+		CommandListInstruction i;
+		i.op = CommandListOpcode::VALUE;
+		i.val = val;
+		emit(i, 0);
+	}
+
+	void push_load(const float *ptr)
+	{
+		CommandListInstruction i;
+		i.op = CommandListOpcode::LOAD;
+		i.ptr = ptr;
+		emit(i, 0);
+	}
+
+	void push_operand(void *operand)
+	{
+		CommandListInstruction i;
+		i.op = CommandListOpcode::OPERAND;
+		i.operand = operand;
+		emit(i, 0);
+	}
+
+	void push_operator(CommandListOperatorFn fn, bool unary)
+	{
+		CommandListInstruction i;
+		i.op = unary ? CommandListOpcode::UNARY : CommandListOpcode::BINARY;
+		i.fn = fn;
+		emit(i, unary ? 1 : 2);
+	}
+
+	// A well formed program leaves exactly one value on the stack
+	bool valid() const
+	{
+		return !program.empty() && !underflow && stack_depth == 1
+			&& max_stack_depth <= COMMAND_LIST_BYTECODE_MAX_STACK;
+	}
+
+	// operand_fn is called as operand_fn(void *operand) for OPERAND
+	// instructions and must return the operand's current value. Templated
+	// rather than a function pointer so that the call can be inlined into
+	// the loop.
+	template <class OperandFn>
+	float run(OperandFn operand_fn) const
+	{
+		float stack[COMMAND_LIST_BYTECODE_MAX_STACK];
+		const CommandListInstruction *i = program.data();
+		const CommandListInstruction *end = i + program.size();
+		float *sp = stack;
+
+		for (; i < end; i++) {
+			switch (i->op) {
+				case CommandListOpcode::VALUE:
+					*sp++ = i->val;
+					break;
+				case CommandListOpcode::LOAD:
+					*sp++ = *i->ptr;
+					break;
+				case CommandListOpcode::OPERAND:
+					*sp++ = operand_fn(i->operand);
+					break;
+				case CommandListOpcode::UNARY:
+					sp[-1] = i->fn(std::numeric_limits<float>::quiet_NaN(), sp[-1]);
+					break;
+				case CommandListOpcode::BINARY:
+					sp--;
+					sp[-1] = i->fn(sp[-1], sp[0]);
+					break;
+			}
+		}
+
+		return stack[0];
+	}
+
+private:
+	// Every instruction pushes one result after popping its inputs
+	void emit(const CommandListInstruction &i, unsigned pops)
+	{
+		program.push_back(i);
+		if (stack_depth < pops) {
+			underflow = true;
+			stack_depth = pops;
+		}
+		stack_depth = stack_depth - pops + 1;
+		if (stack_depth > max_stack_depth)
+			max_stack_depth = stack_depth;
+	}
+};
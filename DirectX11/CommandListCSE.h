@@ -0,0 +1,186 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Common subexpression elimination across every expression in the command
+// lists. Mods frequently test the same thing in a long run of if / else if
+// blocks (rt_width / res_width, $var * 2, ps-t0 == 1, ...), so after static
+// evaluation any subexpression that still occurs more than once is replaced
+// by a single shared node, which evaluates its contents at most once per
+// command list invocation (see CommandListSubexpression for the caching and
+// when it is invalidated).
+//
+// Templated over the tree so that TestCommandList/command_list_cse_tests.cpp
+// can run the same pass over a stand-in tree built from ini excerpts. Traits
+// must provide:
+//
+//   static bool is_operator(Node*);
+//   static std::shared_ptr<Node>* lhs(Node*);  // NULL / empty for unary
+//   static std::shared_ptr<Node>* rhs(Node*);
+//   static std::wstring operator_key(Node*);
+//   static bool operand_key(Node*, std::wstring *key);
+//           // false if the operand must not be cached, e.g. because it
+//           // can change in the middle of a command list (time, etc.)
+//   static bool worth_sharing(Node*);
+//           // Operators, and any operands that are expensive to evaluate
+//   static std::shared_ptr<Node> make_shared(std::shared_ptr<Node> subtree, unsigned idx);
+template <class Node, class Traits>
+class CommandListCSE {
+	struct NodeInfo {
+		std::wstring key;
+		unsigned size;
+		bool cacheable;
+	};
+
+	std::vector<std::shared_ptr<Node>*> roots;
+	std::unordered_map<Node*, NodeInfo> info;
+	std::unordered_map<std::wstring, unsigned> counts;
+	std::unordered_map<std::wstring, std::shared_ptr<Node>> shared_nodes;
+	std::unordered_map<std::wstring, bool> seen;
+
+	NodeInfo* visit(Node *node)
+	{
+		std::shared_ptr<Node> *lhs, *rhs;
+		NodeInfo *lhs_info = NULL, *rhs_info;
+		NodeInfo *ret = &info[node];
+
+		if (Traits::is_operator(node)) {
+			lhs = Traits::lhs(node);
+			rhs = Traits::rhs(node);
+			if (lhs && *lhs)
+				lhs_info = visit(lhs->get());
+			rhs_info = visit(rhs->get());
+
+			ret->key = Traits::operator_key(node) + L"(" +
+				(lhs_info ? lhs_info->key : L"") + L"," +
+				rhs_info->key + L")";
+			ret->size = 1 + rhs_info->size + (lhs_info ? lhs_info->size : 0);
+			ret->cacheable = rhs_info->cacheable && (!lhs_info || lhs_info->cacheable);
+		} else {
+			ret->size = 1;
+			ret->cacheable = Traits::operand_key(node, &ret->key);
+		}
+
+		if (ret->cacheable && Traits::worth_sharing(node))
+			counts[ret->key]++;
+
+		return ret;
+	}
+
+	bool repeated(Node *node)
+	{
+		NodeInfo &i = info[node];
+
+		return i.cacheable && Traits::worth_sharing(node) && counts[i.key] > 1;
+	}
+
+	void forget(Node *node)
+	{
+		std::shared_ptr<Node> *lhs, *rhs;
+
+		if (repeated(node))
+			counts[info[node].key]--;
+
+		if (Traits::is_operator(node)) {
+			lhs = Traits::lhs(node);
+			rhs = Traits::rhs(node);
+			if (lhs && *lhs)
+				forget(lhs->get());
+			forget(rhs->get());
+		}
+	}
+
+	// Everything nested inside the second and subsequent occurrences of a
+	// repeated subexpression is about to be discarded, so must not count
+	// towards anything inside it being considered repeated:
+	void prune(Node *node)
+	{
+		std::shared_ptr<Node> *lhs, *rhs;
+
+		if (repeated(node)) {
+			if (seen[info[node].key]) {
+				// This occurrence is still used (via the
+				// shared node), only its contents are not:
+				counts[info[node].key]++;
+				forget(node);
+				return;
+			}
+			seen[info[node].key] = true;
+		}
+
+		if (Traits::is_operator(node)) {
+			lhs = Traits::lhs(node);
+			rhs = Traits::rhs(node);
+			if (lhs && *lhs)
+				prune(lhs->get());
+			prune(rhs->get());
+		}
+	}
+
+	void replace(std::shared_ptr<Node> *ptr)
+	{
+		std::shared_ptr<Node> *lhs, *rhs;
+		Node *node = ptr->get();
+
+		if (repeated(node)) {
+			NodeInfo &i = info[node];
+			auto existing = shared_nodes.find(i.key);
+			if (existing != shared_nodes.end()) {
+				eliminated += i.size;
+				*ptr = existing->second;
+				return;
+			}
+		}
+
+		if (Traits::is_operator(node)) {
+			lhs = Traits::lhs(node);
+			rhs = Traits::rhs(node);
+			if (lhs && *lhs)
+				replace(lhs);
+			replace(rhs);
+		}
+
+		if (repeated(node)) {
+			std::shared_ptr<Node> shared = Traits::make_shared(*ptr, (unsigned)hoisted.size());
+			shared_nodes[info[node].key] = shared;
+			hoisted.push_back(*ptr);
+			*ptr = shared;
+		}
+	}
+
+public:
+	// Subtrees that were replaced by a shared node, in the order they
+	// were assigned an index:
+	std::vector<std::shared_ptr<Node>> hoisted;
+	// Number of nodes that no longer need to be evaluated:
+	unsigned eliminated;
+
+	CommandListCSE() :
+		eliminated(0)
+	{}
+
+	// Roots are replaced in place when run() is called, so the pointers
+	// must remain valid until then:
+	void add(std::shared_ptr<Node> *root)
+	{
+		if (*root)
+			roots.push_back(root);
+	}
+
+	void run()
+	{
+		for (std::shared_ptr<Node> *root : roots)
+			visit(root->get());
+		for (std::shared_ptr<Node> *root : roots)
+			prune(root->get());
+		for (std::shared_ptr<Node> *root : roots)
+			replace(root);
+
+		info.clear();
+		counts.clear();
+		seen.clear();
+	}
+};
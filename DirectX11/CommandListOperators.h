@@ -0,0 +1,46 @@
+// Expression operator definitions. This file is deliberately included more
+// than once with different definitions of DEFINE_OPERATOR(name, pattern, fn):
+// CommandList.cpp turns each entry into a CommandListOperator subclass and
+// TestCommandList/expression_bench.cpp into its own stand-in, so that both
+// evaluate exactly the same operator bodies. fn is an expression in terms of
+// the floats lhs and rhs (lhs is NAN for unary operators).
+//
+// Precedence is determined by the lists of operator factories in
+// CommandList.cpp, not by the order in this file.
+
+// Highest level of precedence, allows for negative numbers
+DEFINE_OPERATOR(unary_not_operator,     "!",  (!rhs));
+DEFINE_OPERATOR(unary_plus_operator,    "+",  (+rhs));
+DEFINE_OPERATOR(unary_negate_operator,  "-",  (-rhs));
+
+// High level of precedence, right-associative. Lower than unary operators, so
+// that 4**-2 works for square root
+DEFINE_OPERATOR(exponent_operator,      "**", (pow(lhs, rhs)));
+
+DEFINE_OPERATOR(multiplication_operator,"*",  (lhs * rhs));
+DEFINE_OPERATOR(division_operator,      "/",  (lhs / rhs));
+DEFINE_OPERATOR(floor_division_operator,"//", (floor(lhs / rhs)));
+DEFINE_OPERATOR(modulus_operator,       "%",  (fmod(lhs, rhs)));
+
+DEFINE_OPERATOR(addition_operator,      "+",  (lhs + rhs));
+DEFINE_OPERATOR(subtraction_operator,   "-",  (lhs - rhs));
+
+DEFINE_OPERATOR(less_operator,          "<",  (lhs < rhs));
+DEFINE_OPERATOR(less_equal_operator,    "<=", (lhs <= rhs));
+DEFINE_OPERATOR(greater_operator,       ">",  (lhs > rhs));
+DEFINE_OPERATOR(greater_equal_operator, ">=", (lhs >= rhs));
+
+// The triple equals operator tests for binary equivalence - in particular,
+// this allows us to test for negative zero, used in texture filtering to
+// signify that nothing is bound to a given slot. Negative zero cannot be
+// tested for using the regular equals operator, since -0.0 == +0.0. This
+// operator could also test for specific cases of NAN (though, without the
+// vs2015 toolchain "nan" won't parse as such).
+DEFINE_OPERATOR(equality_operator,      "==", (lhs == rhs));
+DEFINE_OPERATOR(inequality_operator,    "!=", (lhs != rhs));
+DEFINE_OPERATOR(identical_operator,     "===",(*(uint32_t*)&lhs == *(uint32_t*)&rhs));
+DEFINE_OPERATOR(not_identical_operator, "!==",(*(uint32_t*)&lhs != *(uint32_t*)&rhs));
+
+DEFINE_OPERATOR(and_operator,           "&&", (lhs && rhs));
+
+DEFINE_OPERATOR(or_operator,            "||", (lhs || rhs));
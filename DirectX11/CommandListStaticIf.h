@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+
+// If an if / else if condition turned out to be static, replaces it in the
+// command list with the contents of whichever branch would always be taken.
+// An else if is nested in the false branch of the if before it, so inlining
+// that branch exposes the else if at the same position for the optimiser to
+// try next. Returns true if the command was replaced.
+//
+// Templated over the command lists so that
+// TestCommandList/command_list_cse_tests.cpp can run it on the stand-in
+// commands it builds from ini excerpts. Traits must provide:
+//
+//   static Commands* commands(List*);
+//           // A vector of std::shared_ptr<Command>
+//   static bool post(List*);
+//   static bool static_condition(Command*, float *val);
+//           // false unless the command is a finalised if / else if whose
+//           // condition is static
+//   static List* branch(Command*, bool post, bool taken);
+//   static void inlined(Command*, bool post, bool taken);
+//           // For logging
+template <class List, class Traits>
+bool inline_static_if(List *command_list, size_t i)
+{
+	auto *commands = Traits::commands(command_list);
+	bool post = Traits::post(command_list);
+	float static_val;
+	bool taken;
+
+	if (!Traits::static_condition((*commands)[i].get(), &static_val))
+		return false;
+
+	taken = !!static_val;
+	Traits::inlined((*commands)[i].get(), post, taken);
+
+	// The branch belongs to the if command, which must outlive the
+	// insertion:
+	auto keep_alive = (*commands)[i];
+	auto *branch = Traits::commands(Traits::branch(keep_alive.get(), post, taken));
+	commands->erase(commands->begin() + i);
+	commands->insert(commands->begin() + i, branch->begin(), branch->end());
+	return true;
+}
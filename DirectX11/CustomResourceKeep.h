@@ -0,0 +1,44 @@
+#pragma once
+
+#include <utility>
+
+// Takes over the resource a section that has not changed since the last config
+// load created, provided it was created with every bind and misc flag this
+// load has found it needs. Only resources loaded from a file or with initial
+// data are worth keeping - others are made on demand or copied into. Nor can
+// one be kept if it is no longer exactly what was loaded: anything a command
+// list assigned to it, set it to null, copied into it, cleared or bound as an
+// output would have left it dirty, and the resource must still be the same
+// object Substantiate() created. Returns true if the resource was kept.
+//
+// Templated over the custom resources so that TestIniReload/ini_reload_tests.cpp
+// can run it on stand-ins. Resource must have the members of CustomResource
+// used below.
+template <class Resource>
+bool keep_substantiated_resource(Resource *resource, Resource *previous)
+{
+	if (!previous->substantiated || resource->substantiated || resource->resource || resource->view)
+		return false;
+	if (resource->filename.empty() && !resource->initial_data)
+		return false;
+	if (previous->dirty || previous->resource != previous->substantiated_resource)
+		return false;
+	if ((previous->bind_flags & resource->bind_flags) != resource->bind_flags
+			|| (previous->misc_flags & resource->misc_flags) != resource->misc_flags)
+		return false;
+
+	std::swap(resource->resource, previous->resource);
+	std::swap(resource->view, previous->view);
+	std::swap(resource->device, previous->device);
+	resource->substantiated_resource = previous->substantiated_resource;
+	resource->is_null = previous->is_null;
+	resource->bind_flags = previous->bind_flags;
+	resource->misc_flags = previous->misc_flags;
+	resource->stride = previous->stride;
+	resource->offset = previous->offset;
+	resource->buf_size = previous->buf_size;
+	resource->format = previous->format;
+	resource->substantiated = true;
+
+	return true;
+}
@@ -183,7 +183,7 @@ void DestroyDLL()
 	{
 		LogInfo("Destroying DLL...\n");
 		SavePersistentSettings();
-		fclose(LogFile);
+		LogClose();
 	}
 }
 
@@ -0,0 +1,260 @@
+#include "DecompileCache.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+// The pack file starts with this header, followed by the records one after
+// another, each a RecordHeader followed by the shader model, HLSL and
+// assembly text (none of them nul terminated):
+static const char pack_magic[8] = { '3', 'D', 'M', 'D', 'E', 'C', 'M', 'P' };
+static const uint32_t pack_format = 1;
+
+struct PackHeader {
+	char magic[8];
+	uint32_t format;
+	uint32_t reserved;
+};
+
+static const uint32_t record_magic = 0x43444d33; // "3MDC"
+
+enum RecordFlags {
+	RECORD_PATCHED = 0x1,
+	RECORD_ERROR   = 0x2,
+};
+
+struct RecordHeader {
+	uint32_t magic;
+	uint32_t checksum; // crc32c of everything that follows, payload included
+	DecompileCacheKey key;
+	uint32_t flags;
+	uint32_t model_size;
+	uint32_t hlsl_size;
+	uint32_t asm_size;
+};
+
+static_assert(sizeof(DecompileCacheKey) == 24, "DecompileCacheKey is written to disk and must not have padding");
+static_assert(sizeof(RecordHeader) == 48, "RecordHeader is written to disk and must not have padding");
+
+// Nothing the decompiler produces comes close to this, so a record that
+// claims to be any larger is garbage:
+static const uint32_t max_payload = 64 * 1024 * 1024;
+
+static bool seek(FILE *fp, uint64_t offset)
+{
+#ifdef _WIN32
+	return !_fseeki64(fp, (__int64)offset, SEEK_SET);
+#else
+	return !fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static uint64_t file_size(FILE *fp)
+{
+#ifdef _WIN32
+	if (_fseeki64(fp, 0, SEEK_END))
+		return 0;
+	return (uint64_t)_ftelli64(fp);
+#else
+	if (fseeko(fp, 0, SEEK_END))
+		return 0;
+	return (uint64_t)ftello(fp);
+#endif
+}
+
+static uint32_t record_checksum(const RecordHeader &header, const std::string &model,
+		const std::string &hlsl, const std::string &asm_text)
+{
+	uint32_t crc;
+
+	crc = crc32c_append(0, (const uint8_t*)&header.key,
+			sizeof(header) - offsetof(RecordHeader, key));
+	crc = crc32c_append(crc, (const uint8_t*)model.data(), model.size());
+	crc = crc32c_append(crc, (const uint8_t*)hlsl.data(), hlsl.size());
+	crc = crc32c_append(crc, (const uint8_t*)asm_text.data(), asm_text.size());
+	return crc;
+}
+
+static bool read_string(FILE *fp, std::string *str, uint32_t size)
+{
+	str->resize(size);
+	return !size || fread(&(*str)[0], 1, size, fp) == size;
+}
+
+void decompile_cache_key(DecompileCacheKey *key, uint64_t shader_hash,
+		const void *bytecode, size_t size, uint32_t settings_hash,
+		uint32_t decompiler_version)
+{
+	key->shader_hash = shader_hash;
+	key->bytecode_crc = crc32c_append(0, (const uint8_t*)bytecode, size);
+	key->bytecode_size = (uint32_t)size;
+	key->settings_hash = settings_hash;
+	key->decompiler_version = decompiler_version;
+}
+
+DecompileCache::DecompileCache() :
+	fp(NULL),
+	end(0),
+	write_failed(false),
+	stats()
+{}
+
+DecompileCache::~DecompileCache()
+{
+	close();
+}
+
+// Only reads the record headers, skipping over the payloads, so that opening
+// a large cache does not mean reading the whole thing. The payload checksums
+// are verified as each record is looked up instead.
+bool DecompileCache::load()
+{
+	PackHeader pack;
+	RecordHeader header;
+	uint64_t size, offset, payload;
+
+	size = file_size(fp);
+	if (!size) {
+		memcpy(pack.magic, pack_magic, sizeof(pack_magic));
+		pack.format = pack_format;
+		pack.reserved = 0;
+		if (!seek(fp, 0) || fwrite(&pack, sizeof(pack), 1, fp) != 1 || fflush(fp))
+			return false;
+		end = sizeof(pack);
+		return true;
+	}
+
+	if (!seek(fp, 0) || fread(&pack, sizeof(pack), 1, fp) != 1)
+		return false;
+	if (memcmp(pack.magic, pack_magic, sizeof(pack_magic)) || pack.format != pack_format)
+		return false;
+
+	for (offset = sizeof(pack); offset + sizeof(header) <= size; offset += sizeof(header) + payload) {
+		if (!seek(fp, offset) || fread(&header, sizeof(header), 1, fp) != 1)
+			break;
+		if (header.magic != record_magic || header.model_size > max_payload
+				|| header.hlsl_size > max_payload || header.asm_size > max_payload)
+			break;
+		payload = (uint64_t)header.model_size + header.hlsl_size + header.asm_size;
+		if (offset + sizeof(header) + payload > size)
+			break;
+
+		index[header.key] = offset;
+		stats.loaded++;
+	}
+
+	end = offset;
+	stats.discarded = size - offset;
+	return true;
+}
+
+bool DecompileCache::open(FILE *fp)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (this->fp)
+		fclose(this->fp);
+	this->fp = fp;
+	index.clear();
+	stats = DecompileCacheStats();
+	write_failed = false;
+	end = 0;
+
+	if (!load()) {
+		fclose(fp);
+		this->fp = NULL;
+		index.clear();
+		stats = DecompileCacheStats();
+		return false;
+	}
+	return true;
+}
+
+void DecompileCache::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (fp)
+		fclose(fp);
+	fp = NULL;
+	index.clear();
+}
+
+bool DecompileCache::is_open()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return !!fp;
+}
+
+bool DecompileCache::lookup(const DecompileCacheKey &key, DecompileCacheEntry *entry)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	RecordHeader header;
+
+	auto i = index.find(key);
+	if (i == index.end()) {
+		stats.misses++;
+		return false;
+	}
+
+	if (!seek(fp, i->second) || fread(&header, sizeof(header), 1, fp) != 1
+			|| header.magic != record_magic || !(header.key == key)
+			|| !read_string(fp, &entry->shader_model, header.model_size)
+			|| !read_string(fp, &entry->hlsl, header.hlsl_size)
+			|| !read_string(fp, &entry->asm_text, header.asm_size)
+			|| record_checksum(header, entry->shader_model, entry->hlsl, entry->asm_text) != header.checksum) {
+		// Corrupt. Forget about it so that the next store replaces it:
+		index.erase(i);
+		stats.misses++;
+		return false;
+	}
+
+	entry->patched = !!(header.flags & RECORD_PATCHED);
+	entry->error = !!(header.flags & RECORD_ERROR);
+	stats.hits++;
+	return true;
+}
+
+bool DecompileCache::store(const DecompileCacheKey &key, const DecompileCacheEntry &entry)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	RecordHeader header;
+
+	if (!fp || write_failed)
+		return false;
+	if (entry.shader_model.size() > max_payload || entry.hlsl.size() > max_payload
+			|| entry.asm_text.size() > max_payload)
+		return false;
+
+	header.magic = record_magic;
+	header.key = key;
+	header.flags = (entry.patched ? RECORD_PATCHED : 0) | (entry.error ? RECORD_ERROR : 0);
+	header.model_size = (uint32_t)entry.shader_model.size();
+	header.hlsl_size = (uint32_t)entry.hlsl.size();
+	header.asm_size = (uint32_t)entry.asm_text.size();
+	header.checksum = record_checksum(header, entry.shader_model, entry.hlsl, entry.asm_text);
+
+	if (!seek(fp, end)
+			|| fwrite(&header, sizeof(header), 1, fp) != 1
+			|| fwrite(entry.shader_model.data(), 1, header.model_size, fp) != header.model_size
+			|| fwrite(entry.hlsl.data(), 1, header.hlsl_size, fp) != header.hlsl_size
+			|| fwrite(entry.asm_text.data(), 1, header.asm_size, fp) != header.asm_size
+			|| fflush(fp)) {
+		write_failed = true;
+		return false;
+	}
+
+	index[key] = end;
+	end += sizeof(header) + header.model_size + header.hlsl_size + header.asm_size;
+	stats.stores++;
+	return true;
+}
+
+DecompileCacheStats DecompileCache::get_stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
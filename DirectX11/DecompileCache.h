@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Keeps the output of the HLSL decompiler in a single append only pack file
+// in ShaderCache, so that a shader the game creates again (in this session or
+// any later one) does not have to be disassembled and decompiled a second
+// time. Titles that stream shaders in during gameplay would otherwise hitch
+// on every one of them for as long as export_hlsl or the auto fixes are on.
+//
+// Entries are looked up by the bytecode and everything else that decides
+// what the decompiler makes of it, so output from a different build of the
+// decompiler or different [Rendering] fix settings is simply never found.
+// Such stale entries stay in the file until it is deleted.
+//
+// Each record carries a checksum, and anything after the last intact record
+// (such as a record that was only half written when the game crashed) is
+// ignored when the file is opened and overwritten by the next one added.
+//
+// This depends on nothing from Windows so that TestDecompileCache can check
+// it. Opening the file is left to the caller for the same reason.
+
+struct DecompileCacheKey {
+	uint64_t shader_hash;        // 3DMigoto's hash of the bytecode
+	uint32_t bytecode_crc;       // crc32c of the bytecode, in case of collisions
+	uint32_t bytecode_size;
+	uint32_t settings_hash;      // DecompilerSettingsHash()
+	uint32_t decompiler_version; // DecompilerVersion()
+
+	bool operator==(const DecompileCacheKey &other) const
+	{
+		return !memcmp(this, &other, sizeof(*this));
+	}
+};
+
+// Fills in the bytecode fields of the key:
+void decompile_cache_key(DecompileCacheKey *key, uint64_t shader_hash,
+		const void *bytecode, size_t size, uint32_t settings_hash,
+		uint32_t decompiler_version);
+
+struct DecompileCacheEntry {
+	std::string hlsl;
+	std::string asm_text;     // The disassembly the HLSL was decompiled from
+	std::string shader_model;
+	bool patched;             // The decompiler applied one of its fixes
+	bool error;               // The decompiler failed, don't try it again
+
+	DecompileCacheEntry() :
+		patched(false),
+		error(false)
+	{}
+};
+
+struct DecompileCacheStats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t stores;
+	uint32_t loaded;         // Records found when the file was opened
+	uint64_t discarded;      // Bytes after the last intact record at open
+};
+
+class DecompileCache {
+	struct KeyHash {
+		size_t operator()(const DecompileCacheKey &key) const
+		{
+			return (size_t)(key.shader_hash ^ key.bytecode_crc ^
+					((uint64_t)key.settings_hash << 32) ^ key.decompiler_version);
+		}
+	};
+
+	std::mutex lock;
+	FILE *fp;
+	uint64_t end; // Where the next record will be written
+	bool write_failed;
+
+	// Offset of the newest record for each key:
+	std::unordered_map<DecompileCacheKey, uint64_t, KeyHash> index;
+
+	DecompileCacheStats stats;
+
+	bool load();
+
+public:
+	DecompileCache();
+	~DecompileCache();
+
+	// Takes ownership of a file opened for binary update ("r+b" or "w+b"),
+	// and indexes the records already in it. An empty file is given a
+	// header. Returns false and closes the file if it is not a pack file
+	// this version understands, in which case the caller may recreate it.
+	bool open(FILE *fp);
+	void close();
+	bool is_open();
+
+	// Returns false on a miss. Both count towards the stats.
+	bool lookup(const DecompileCacheKey &key, DecompileCacheEntry *entry);
+
+	// Appends the entry to the pack file. Returns false if it could not be
+	// written, after which no more will be.
+	bool store(const DecompileCacheKey &key, const DecompileCacheEntry &entry);
+
+	DecompileCacheStats get_stats();
+};
@@ -6,12 +6,17 @@
 #include "FrameAnalysis.h"
 #include "Globals.h"
 #include "input.h"
+#include "FrameAnalysisWriter.h"
+#include "FrameAnalysisText.h"
+#include "FrameAnalysisStore.h"
 
 #include <ScreenGrab.h>
 #include <wincodec.h>
 #include <Strsafe.h>
 #include <stdarg.h>
 #include <Shlwapi.h>
+#include <mutex>
+#include <memory>
 
 // For windows shortcuts:
 #include <shobjidl.h>
@@ -23,6 +28,20 @@
 #define SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE 0x2
 #endif
 
+// Buffer dumps are written by G->frame_analysis_writer's threads, which link
+// to the deduplicated files as well, so these are shared with them:
+template <typename DescType>
+static void DumpDesc(DescType *desc, const wchar_t *filename);
+static void link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename,
+		FrameAnalysisOptions analyse_options, bool wrote);
+static bool deduplicated_file_exists(const wchar_t *dedupe_filename,
+		FrameAnalysisOptions analyse_options);
+static bool store_deduplicated_file(const wchar_t *filename, const wchar_t *dedupe_filename,
+		bool wrote, const void *data = NULL, size_t size = 0);
+static void dedupe_buf_filename(const D3D11_BUFFER_DESC *orig_desc,
+		const void *data, const wchar_t *dedupe_dir,
+		wchar_t *dedupe_filename, size_t size);
+
 static unordered_map<ID3D11CommandList*, FrameAnalysisDeferredBuffersPtr> frame_analysis_deferred_buffer_lists;
 static unordered_map<ID3D11CommandList*, FrameAnalysisDeferredTex2DPtr> frame_analysis_deferred_tex2d_lists;
 
@@ -33,6 +52,7 @@ FrameAnalysisContext::FrameAnalysisContext(ID3D11Device1 *pDevice, ID3D11DeviceC
 	oneshot_analyse_options = FrameAnalysisOptions::INVALID;
 	oneshot_valid = false;
 	frame_analysis_log = NULL;
+	frame_analysis_log_binary = false;
 	draw_call = 0;
 	non_draw_call_dump_counter = 0;
 }
@@ -46,6 +66,7 @@ FrameAnalysisContext::~FrameAnalysisContext()
 void FrameAnalysisContext::vFrameAnalysisLog(char *fmt, va_list ap)
 {
 	wchar_t filename[MAX_PATH];
+	const wchar_t *ext;
 
 	LogDebugNoNL("FrameAnalysisContext(%s@%p)::", type_name(this), this);
 	vLogDebug(fmt, ap);
@@ -70,21 +91,36 @@ void FrameAnalysisContext::vFrameAnalysisLog(char *fmt, va_list ap)
 	// to log calls for deferred contexts here as well.
 
 	if (!frame_analysis_log) {
+		// The binary log is converted back to log.txt with
+		// fa_trace_convert, so it is named to match:
+		frame_analysis_log_binary = G->analyse_binary_log;
+		ext = frame_analysis_log_binary ? L"fatrace" : L"txt";
+
 		// Use the original context to check the type, otherwise we
 		// will recursively call ourselves:
 		if (GetPassThroughOrigContext1()->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE)
-			swprintf_s(filename, MAX_PATH, L"%ls\\log.txt", G->ANALYSIS_PATH);
+			swprintf_s(filename, MAX_PATH, L"%ls\\log.%ls", G->ANALYSIS_PATH, ext);
 		else
-			swprintf_s(filename, MAX_PATH, L"%ls\\log-0x%p.txt", G->ANALYSIS_PATH, this);
+			swprintf_s(filename, MAX_PATH, L"%ls\\log-0x%p.%ls", G->ANALYSIS_PATH, this, ext);
 
-		frame_analysis_log = _wfsopen(filename, L"w", _SH_DENYNO);
+		frame_analysis_log = _wfsopen(filename, frame_analysis_log_binary ? L"wb" : L"w", _SH_DENYNO);
 		if (!frame_analysis_log) {
 			LogInfoW(L"Error opening %s\n", filename);
 			return;
 		}
 		draw_call = 1;
 
-		fprintf(frame_analysis_log, "analyse_options: %08x\n", G->cur_analyse_options);
+		if (frame_analysis_log_binary)
+			frame_analysis_trace.begin(frame_analysis_log);
+
+		FrameAnalysisLogAppend("analyse_options: %08x\n", G->cur_analyse_options);
+	}
+
+	if (frame_analysis_log_binary) {
+		frame_analysis_trace.vcall(frame_analysis_log,
+				!!(G->def_analyse_options & FrameAnalysisOptions::HOLD),
+				G->analyse_frame_no, draw_call, fmt, ap);
+		return;
 	}
 
 	// We don't allow hold to be changed mid-frame due to potential
@@ -105,6 +141,21 @@ void FrameAnalysisContext::FrameAnalysisLog(char *fmt, ...)
 	va_end(ap);
 }
 
+// Continues the current line of the log, so unlike FrameAnalysisLog() this
+// does not write the draw call number first. Callers must check that the log
+// is open.
+void FrameAnalysisContext::FrameAnalysisLogAppend(char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (frame_analysis_log_binary)
+		frame_analysis_trace.vappend(frame_analysis_log, fmt, ap);
+	else
+		vfprintf(frame_analysis_log, fmt, ap);
+	va_end(ap);
+}
+
 #define FALogInfo(fmt, ...) { \
 	FrameAnalysisLog("3DMigoto " fmt, __VA_ARGS__); \
 } while (0)
@@ -114,13 +165,19 @@ void FrameAnalysisContext::FrameAnalysisLog(char *fmt, ...)
 	FrameAnalysisLog("3DMigoto " fmt, __VA_ARGS__); \
 } while (0)
 
+// For the writer threads, which can't use the frame analysis log as that
+// belongs to the context and is written from the game's render thread:
+#define FAWriterLogErr(fmt, ...) { \
+	LogInfo("Frame Analysis: " fmt, __VA_ARGS__); \
+} while (0)
 
-static void FrameAnalysisLogSlot(FILE *frame_analysis_log, int slot, char *slot_name)
+
+void FrameAnalysisContext::FrameAnalysisLogSlot(int slot, char *slot_name)
 {
 	if (slot_name)
-		fprintf(frame_analysis_log, "       %s:", slot_name);
+		FrameAnalysisLogAppend("       %s:", slot_name);
 	else if (slot != -1)
-		fprintf(frame_analysis_log, "       %u:", slot);
+		FrameAnalysisLogAppend("       %u:", slot);
 }
 
 template <class ID3D11Shader>
@@ -135,7 +192,7 @@ void FrameAnalysisContext::FrameAnalysisLogShaderHash(ID3D11Shader *shader)
 		return;
 
 	if (!shader) {
-		fprintf(frame_analysis_log, "\n");
+		FrameAnalysisLogAppend("\n");
 		return;
 	}
 
@@ -143,11 +200,11 @@ void FrameAnalysisContext::FrameAnalysisLogShaderHash(ID3D11Shader *shader)
 
 	hash = lookup_shader_hash(shader);
 	if (hash != end(G->mShaders))
-		fprintf(frame_analysis_log, " hash=%016llx", hash->second);
+		FrameAnalysisLogAppend(" hash=%016llx", hash->second);
 
 	LeaveCriticalSection(&G->mCriticalSection);
 
-	fprintf(frame_analysis_log, "\n");
+	FrameAnalysisLogAppend("\n");
 }
 
 void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource)
@@ -162,7 +219,7 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 		return;
 
 	if (!resource) {
-		fprintf(frame_analysis_log, "\n");
+		FrameAnalysisLogAppend("\n");
 		return;
 	}
 
@@ -173,21 +230,21 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 		hash = G->mResources.at(resource).hash;
 		orig_hash = G->mResources.at(resource).orig_hash;
 		if (hash)
-			fprintf(frame_analysis_log, " hash=%08x", hash);
+			FrameAnalysisLogAppend(" hash=%08x", hash);
 		if (orig_hash != hash)
-			fprintf(frame_analysis_log, " orig_hash=%08x", orig_hash);
+			FrameAnalysisLogAppend(" orig_hash=%08x", orig_hash);
 
 		info = &G->mResourceInfo.at(orig_hash);
 		if (info->hash_contaminated) {
-			fprintf(frame_analysis_log, " hash_contamination=");
+			FrameAnalysisLogAppend(" hash_contamination=");
 			if (!info->map_contamination.empty())
-				fprintf(frame_analysis_log, "Map,");
+				FrameAnalysisLogAppend("Map,");
 			if (!info->update_contamination.empty())
-				fprintf(frame_analysis_log, "UpdateSubresource,");
+				FrameAnalysisLogAppend("UpdateSubresource,");
 			if (!info->copy_contamination.empty())
-				fprintf(frame_analysis_log, "CopyResource,");
+				FrameAnalysisLogAppend("CopyResource,");
 			if (!info->region_contamination.empty())
-				fprintf(frame_analysis_log, "UpdateSubresourceRegion,");
+				FrameAnalysisLogAppend("UpdateSubresourceRegion,");
 		}
 	} catch (std::out_of_range) {
 	}
@@ -195,7 +252,7 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 	LeaveCriticalSection(&G->mResourcesLock);
 	LeaveCriticalSection(&G->mCriticalSection);
 
-	fprintf(frame_analysis_log, "\n");
+	FrameAnalysisLogAppend("\n");
 }
 
 void FrameAnalysisContext::FrameAnalysisLogResource(int slot, char *slot_name, ID3D11Resource *resource)
@@ -203,8 +260,8 @@ void FrameAnalysisContext::FrameAnalysisLogResource(int slot, char *slot_name, I
 	if (!resource || !G->analyse_frame || !frame_analysis_log)
 		return;
 
-	FrameAnalysisLogSlot(frame_analysis_log, slot, slot_name);
-	fprintf(frame_analysis_log, " resource=0x%p", resource);
+	FrameAnalysisLogSlot(slot, slot_name);
+	FrameAnalysisLogAppend(" resource=0x%p", resource);
 
 	FrameAnalysisLogResourceHash(resource);
 }
@@ -216,8 +273,8 @@ void FrameAnalysisContext::FrameAnalysisLogView(int slot, char *slot_name, ID3D1
 	if (!view || !G->analyse_frame || !frame_analysis_log)
 		return;
 
-	FrameAnalysisLogSlot(frame_analysis_log, slot, slot_name);
-	fprintf(frame_analysis_log, " view=0x%p", view);
+	FrameAnalysisLogSlot(slot, slot_name);
+	FrameAnalysisLogAppend(" view=0x%p", view);
 
 	view->GetResource(&resource);
 	if (!resource)
@@ -261,8 +318,8 @@ void FrameAnalysisContext::FrameAnalysisLogMiscArray(UINT start, UINT len, void
 	for (i = 0; i < len; i++) {
 		item = array[i];
 		if (item) {
-			FrameAnalysisLogSlot(frame_analysis_log, start + i, NULL);
-			fprintf(frame_analysis_log, " handle=0x%p\n", item);
+			FrameAnalysisLogSlot(start + i, NULL);
+			FrameAnalysisLogAppend(" handle=0x%p\n", item);
 		}
 	}
 }
@@ -288,7 +345,7 @@ void FrameAnalysisContext::FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async)
 		return;
 
 	if (!async) {
-		fprintf(frame_analysis_log, "\n");
+		FrameAnalysisLogAppend("\n");
 		return;
 	}
 
@@ -300,17 +357,17 @@ void FrameAnalysisContext::FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async)
 
 	switch (type) {
 		case AsyncQueryType::QUERY:
-			fprintf(frame_analysis_log, " type=query query=");
+			FrameAnalysisLogAppend(" type=query query=");
 			query = (ID3D11Query*)async;
 			query->GetDesc(&desc);
 			break;
 		case AsyncQueryType::PREDICATE:
-			fprintf(frame_analysis_log, " type=predicate query=");
+			FrameAnalysisLogAppend(" type=predicate query=");
 			predicate = (ID3D11Predicate*)async;
 			predicate->GetDesc(&desc);
 			break;
 		case AsyncQueryType::COUNTER:
-			fprintf(frame_analysis_log, " type=performance\n");
+			FrameAnalysisLogAppend(" type=performance\n");
 			// Don't care about this, and it's a different DESC
 			return;
 		default:
@@ -320,58 +377,58 @@ void FrameAnalysisContext::FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async)
 
 	switch (desc.Query) {
 		case D3D11_QUERY_EVENT:
-			fprintf(frame_analysis_log, "event");
+			FrameAnalysisLogAppend("event");
 			break;
 		case D3D11_QUERY_OCCLUSION:
-			fprintf(frame_analysis_log, "occlusion");
+			FrameAnalysisLogAppend("occlusion");
 			break;
 		case D3D11_QUERY_TIMESTAMP:
-			fprintf(frame_analysis_log, "timestamp");
+			FrameAnalysisLogAppend("timestamp");
 			break;
 		case D3D11_QUERY_TIMESTAMP_DISJOINT:
-			fprintf(frame_analysis_log, "timestamp_disjoint");
+			FrameAnalysisLogAppend("timestamp_disjoint");
 			break;
 		case D3D11_QUERY_PIPELINE_STATISTICS:
-			fprintf(frame_analysis_log, "pipeline_statistics");
+			FrameAnalysisLogAppend("pipeline_statistics");
 			break;
 		case D3D11_QUERY_OCCLUSION_PREDICATE:
-			fprintf(frame_analysis_log, "occlusion_predicate");
+			FrameAnalysisLogAppend("occlusion_predicate");
 			break;
 		case D3D11_QUERY_SO_STATISTICS:
-			fprintf(frame_analysis_log, "so_statistics");
+			FrameAnalysisLogAppend("so_statistics");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE:
-			fprintf(frame_analysis_log, "so_overflow_predicate");
+			FrameAnalysisLogAppend("so_overflow_predicate");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM0:
-			fprintf(frame_analysis_log, "so_statistics_stream0");
+			FrameAnalysisLogAppend("so_statistics_stream0");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM0:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream0");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream0");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM1:
-			fprintf(frame_analysis_log, "so_statistics_stream1");
+			FrameAnalysisLogAppend("so_statistics_stream1");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM1:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream1");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream1");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM2:
-			fprintf(frame_analysis_log, "so_statistics_stream2");
+			FrameAnalysisLogAppend("so_statistics_stream2");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM2:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream2");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream2");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM3:
-			fprintf(frame_analysis_log, "so_statistics_stream3");
+			FrameAnalysisLogAppend("so_statistics_stream3");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM3:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream3");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream3");
 			break;
 		default:
-			fprintf(frame_analysis_log, "?");
+			FrameAnalysisLogAppend("?");
 			break;
 	}
-	fprintf(frame_analysis_log, " MiscFlags=0x%x\n", desc.MiscFlags);
+	FrameAnalysisLogAppend(" MiscFlags=0x%x\n", desc.MiscFlags);
 }
 
 void FrameAnalysisContext::FrameAnalysisLogData(void *buf, UINT size)
@@ -382,6 +439,11 @@ void FrameAnalysisContext::FrameAnalysisLogData(void *buf, UINT size)
 	if (!buf || !size || !G->analyse_frame || !frame_analysis_log)
 		return;
 
+	if (frame_analysis_log_binary) {
+		frame_analysis_trace.data(frame_analysis_log, buf, size);
+		return;
+	}
+
 	fprintf(frame_analysis_log, "    data: ");
 	for (i = 0; i < size; i++, ptr++)
 		fprintf(frame_analysis_log, "%02x", *ptr);
@@ -415,6 +477,7 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 	wstring save_filename;
 	wchar_t *wic_ext = (stereo ? L".jps" : L".jpg");
 	size_t ext, save_ext;
+	bool wrote;
 
 	save_filename = dedupe_tex2d_filename(staging, orig_desc, dedupe_filename, MAX_PATH, filename.c_str(), format);
 
@@ -442,9 +505,10 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 		FALogInfo("Dumping Texture2D %S -> %S\n", filename.c_str(), save_filename.c_str());
 
 		hr = S_OK;
-		if (GetFileAttributes(save_filename.c_str()) == INVALID_FILE_ATTRIBUTES)
+		wrote = !deduplicated_file_exists(save_filename.c_str(), analyse_options);
+		if (wrote)
 			hr = DirectX::SaveWICTextureToFile(GetDumpingContext(), staging, GUID_ContainerFormatJpeg, save_filename.c_str());
-		link_deduplicated_files(filename.c_str(), save_filename.c_str());
+		link_deduplicated_files(filename.c_str(), save_filename.c_str(), analyse_options, wrote);
 	}
 
 
@@ -455,9 +519,10 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 		FALogInfo("Dumping Texture2D %S -> %S\n", filename.c_str(), save_filename.c_str());
 
 		hr = S_OK;
-		if (GetFileAttributes(save_filename.c_str()) == INVALID_FILE_ATTRIBUTES)
+		wrote = !deduplicated_file_exists(save_filename.c_str(), analyse_options);
+		if (wrote)
 			hr = DirectX::SaveDDSTextureToFile(GetDumpingContext(), staging, save_filename.c_str());
-		link_deduplicated_files(filename.c_str(), save_filename.c_str());
+		link_deduplicated_files(filename.c_str(), save_filename.c_str(), analyse_options, wrote);
 	}
 
 	if (FAILED(hr))
@@ -468,9 +533,10 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 		save_filename.replace(save_ext, wstring::npos, L".dsc");
 		FALogInfo("Dumping Texture2D %S -> %S\n", filename.c_str(), save_filename.c_str());
 
-		if (GetFileAttributes(save_filename.c_str()) == INVALID_FILE_ATTRIBUTES)
+		wrote = !deduplicated_file_exists(save_filename.c_str(), analyse_options);
+		if (wrote)
 			DumpDesc(orig_desc, save_filename.c_str());
-		link_deduplicated_files(filename.c_str(), save_filename.c_str());
+		link_deduplicated_files(filename.c_str(), save_filename.c_str(), analyse_options, wrote);
 	}
 
 	CoUninitialize();
@@ -755,7 +821,7 @@ void FrameAnalysisContext::dedupe_buf_filename_txt(const wchar_t *bin_filename,
  * try to use the reflection information in the shaders to add names and
  * correct types.
  */
-void FrameAnalysisContext::DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
+static void DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
 		UINT size, char type, int idx, UINT stride, UINT offset)
 {
 	FILE *fd = NULL;
@@ -766,7 +832,7 @@ void FrameAnalysisContext::DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESO
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr("Unable to create %S: %u\n", filename, err);
+		FAWriterLogErr("Unable to create %S: %u\n", filename, err);
 		return;
 	}
 
@@ -915,6 +981,7 @@ static void dump_ia_layout(FILE *fd, D3D11_INPUT_ELEMENT_DESC *layout_desc, size
 static void dump_vb_unknown_layout(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
 		UINT size, int slot, UINT offset, UINT first, UINT count, UINT stride)
 {
+	FrameAnalysisTextBuffer out(fd);
 	float *buff = (float*)map->pData;
 	uint32_t *buf32 = (uint32_t*)map->pData;
 	uint8_t *buf8 = (uint8_t*)map->pData;
@@ -926,17 +993,37 @@ static void dump_vb_unknown_layout(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
 		end = min(end, start + count);
 
 	for (vertex = start; vertex < end; vertex++) {
-		fprintf(fd, "\n");
+		out.append('\n');
 
 		for (j = 0; j < stride / 4; j++) {
 			buf_idx = vertex * stride / 4 + j;
-			fprintf(fd, "vb%i[%u]+%03u: 0x%08x %.9g\n", slot, vertex - start, j*4, buf32[buf_idx], buff[buf_idx]);
+			// vb%i[%u]+%03u: 0x%08x %.9g
+			out.append("vb", 2);
+			out.append_int(slot);
+			out.append('[');
+			out.append_uint(vertex - start);
+			out.append("]+", 2);
+			out.append_uint(j*4, 3);
+			out.append(": 0x", 4);
+			out.append_hex(buf32[buf_idx], 8);
+			out.append(' ');
+			out.append_float(buff[buf_idx]);
+			out.append('\n');
 		}
 
 		// In case we find one that is not a 32bit multiple finish off one byte at a time:
 		for (j = j * 4; j < stride; j++) {
 			buf_idx = vertex * stride + j;
-			fprintf(fd, "vb%i[%u]+%03u: 0x%02x\n", slot, vertex - start, j, buf8[buf_idx]);
+			// vb%i[%u]+%03u: 0x%02x
+			out.append("vb", 2);
+			out.append_int(slot);
+			out.append('[');
+			out.append_uint(vertex - start);
+			out.append("]+", 2);
+			out.append_uint(j, 3);
+			out.append(": 0x", 4);
+			out.append_hex(buf8[buf_idx], 2);
+			out.append('\n');
 		}
 	}
 }
@@ -1016,163 +1103,108 @@ static UINT dxgi_format_alignment(DXGI_FORMAT format)
 	return 0;
 }
 
-static float float16(uint16_t f16)
-{
-	// Shift sign and mantissa to new positions:
-	uint32_t f32 = ((f16 & 0x8000) << 16) | ((f16 & 0x3ff) << 13);
-	// Need to check special cases of the biased exponent:
-	int biased_exponent = (f16 & 0x7c00) >> 10;
-
-	if (biased_exponent == 0) {
-		// Zero / subnormal: New biased exponent remains zero
-	} else if (biased_exponent == 0x1f) {
-		// Infinity / NaN: New biased exponent is filled with 1s
-		f32 |= 0x7f800000;
-	} else {
-		// Normal number: Adjust the exponent bias:
-		biased_exponent = biased_exponent - 15 + 127;
-		f32 |= biased_exponent << 23;
-	}
-
-	return *(float*)&f32;
-}
-
-static float unorm24(uint32_t val)
+static FrameAnalysisTextFormat dxgi_text_format(DXGI_FORMAT format)
 {
-	return (float)val / (float)0xffffff;
-}
-
-static float unorm16(uint16_t val)
-{
-	return (float)val / (float)0xffff;
-}
-
-static float snorm16(int16_t val)
-{
-	return (float)val / (float)0x7fff;
-}
-
-static float unorm8(uint8_t val)
-{
-	return (float)val / (float)0xff;
-}
-
-static float snorm8(int8_t val)
-{
-	return (float)val / (float)0x7f;
-}
-
-static int fprint_dxgi_format(FILE *fd, DXGI_FORMAT format, uint8_t *buf)
-{
-	float *f = (float*)buf;
-	uint32_t *u32 = (uint32_t*)buf;
-	int32_t *s32 = (int32_t*)buf;
-	uint16_t *u16 = (uint16_t*)buf;
-	int16_t *s16 = (int16_t*)buf;
-	uint8_t *u8 = (uint8_t*)buf;
-	int8_t *s8 = (int8_t*)buf;
-	unsigned i;
-
 	switch (format) {
 		// --- 32-bit ---
 		case DXGI_FORMAT_R32G32B32A32_TYPELESS:
-			return fprintf(fd, "%08x, %08x, %08x, %08x", u32[0], u32[1], u32[2], u32[3]);
+			return {FrameAnalysisTextType::HEX32, 4};
 		case DXGI_FORMAT_R32G32B32_TYPELESS:
-			return fprintf(fd, "%08x, %08x, %08x", u32[0], u32[1], u32[2]);
+			return {FrameAnalysisTextType::HEX32, 3};
 		case DXGI_FORMAT_R32G32_TYPELESS:
-			return fprintf(fd, "%08x, %08x", u32[0], u32[1]);
+			return {FrameAnalysisTextType::HEX32, 2};
 		case DXGI_FORMAT_R32_TYPELESS:
-			return fprintf(fd, "%08x", u32[0]);
+			return {FrameAnalysisTextType::HEX32, 1};
 
 		case DXGI_FORMAT_R32G32B32A32_FLOAT:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", f[0], f[1], f[2], f[3]);
+			return {FrameAnalysisTextType::FLOAT32, 4};
 		case DXGI_FORMAT_R32G32B32_FLOAT:
-			return fprintf(fd, "%.9g, %.9g, %.9g", f[0], f[1], f[2]);
+			return {FrameAnalysisTextType::FLOAT32, 3};
 		case DXGI_FORMAT_R32G32_FLOAT:
-			return fprintf(fd, "%.9g, %.9g", f[0], f[1]);
+			return {FrameAnalysisTextType::FLOAT32, 2};
 		case DXGI_FORMAT_D32_FLOAT:
 		case DXGI_FORMAT_R32_FLOAT:
-			return fprintf(fd, "%.9g", f[0]);
+			return {FrameAnalysisTextType::FLOAT32, 1};
 
 		case DXGI_FORMAT_R32G32B32A32_UINT:
-			return fprintf(fd, "%u, %u, %u, %u", u32[0], u32[1], u32[2], u32[3]);
+			return {FrameAnalysisTextType::UINT32, 4};
 		case DXGI_FORMAT_R32G32B32_UINT:
-			return fprintf(fd, "%u, %u, %u", u32[0], u32[1], u32[2]);
+			return {FrameAnalysisTextType::UINT32, 3};
 		case DXGI_FORMAT_R32G32_UINT:
-			return fprintf(fd, "%u, %u", u32[0], u32[1]);
+			return {FrameAnalysisTextType::UINT32, 2};
 		case DXGI_FORMAT_R32_UINT:
-			return fprintf(fd, "%u", u32[0]);
+			return {FrameAnalysisTextType::UINT32, 1};
 
 		case DXGI_FORMAT_R32G32B32A32_SINT:
-			return fprintf(fd, "%d, %d, %d, %d", s32[0], s32[1], s32[2], s32[3]);
+			return {FrameAnalysisTextType::SINT32, 4};
 		case DXGI_FORMAT_R32G32B32_SINT:
-			return fprintf(fd, "%d, %d, %d", s32[0], s32[1], s32[2]);
+			return {FrameAnalysisTextType::SINT32, 3};
 		case DXGI_FORMAT_R32G32_SINT:
-			return fprintf(fd, "%d, %d", s32[0], s32[1]);
+			return {FrameAnalysisTextType::SINT32, 2};
 		case DXGI_FORMAT_R32_SINT:
-			return fprintf(fd, "%d", s32[0]);
+			return {FrameAnalysisTextType::SINT32, 1};
 
 		// --- 16-bit ---
 		case DXGI_FORMAT_R16G16B16A16_TYPELESS:
-			return fprintf(fd, "%04x, %04x, %04x, %04x", u16[0], u16[1], u16[2], u16[3]);
+			return {FrameAnalysisTextType::HEX16, 4};
 		case DXGI_FORMAT_R16G16_TYPELESS:
-			return fprintf(fd, "%04x, %04x", u16[0], u16[1]);
+			return {FrameAnalysisTextType::HEX16, 2};
 		case DXGI_FORMAT_R16_TYPELESS:
-			return fprintf(fd, "%04x", u16[0]);
+			return {FrameAnalysisTextType::HEX16, 1};
 
 		// %.9g is probably excessive, but I haven't calculated or
 		// verified the actual decimal precision needed to ensure
 		// 16-bit floats can be reproduced exactly, and I know that
 		// %.9g is enough for 32-bit floats so it is safer for now:
 		case DXGI_FORMAT_R16G16B16A16_FLOAT:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", float16(u16[0]), float16(u16[1]), float16(u16[2]), float16(u16[3]));
+			return {FrameAnalysisTextType::FLOAT16, 4};
 		case DXGI_FORMAT_R16G16_FLOAT:
-			return fprintf(fd, "%.9g, %.9g", float16(u16[0]), float16(u16[1]));
+			return {FrameAnalysisTextType::FLOAT16, 2};
 		case DXGI_FORMAT_R16_FLOAT:
-			return fprintf(fd, "%.9g", float16(u16[0]));
+			return {FrameAnalysisTextType::FLOAT16, 1};
 
 		// And of course, if we were to work out a better decimal
 		// precision value, remember that a 16-bit UNORM has 16 bits of
 		// precision, while a 16-bit FLOAT only has 11.
 		case DXGI_FORMAT_R16G16B16A16_UNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", unorm16(u16[0]), unorm16(u16[1]), unorm16(u16[2]), unorm16(u16[3]));
+			return {FrameAnalysisTextType::UNORM16, 4};
 		case DXGI_FORMAT_R16G16_UNORM:
-			return fprintf(fd, "%.9g, %.9g", unorm16(u16[0]), unorm16(u16[1]));
+			return {FrameAnalysisTextType::UNORM16, 2};
 		case DXGI_FORMAT_D16_UNORM:
 		case DXGI_FORMAT_R16_UNORM:
-			return fprintf(fd, "%.9g", unorm16(u16[0]));
+			return {FrameAnalysisTextType::UNORM16, 1};
 
 		case DXGI_FORMAT_R16G16B16A16_SNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", snorm16(s16[0]), snorm16(s16[1]), snorm16(s16[2]), snorm16(s16[3]));
+			return {FrameAnalysisTextType::SNORM16, 4};
 		case DXGI_FORMAT_R16G16_SNORM:
-			return fprintf(fd, "%.9g, %.9g", snorm16(s16[0]), snorm16(s16[1]));
+			return {FrameAnalysisTextType::SNORM16, 2};
 		case DXGI_FORMAT_R16_SNORM:
-			return fprintf(fd, "%.9g", snorm16(s16[0]));
+			return {FrameAnalysisTextType::SNORM16, 1};
 
 		case DXGI_FORMAT_R16G16B16A16_UINT:
-			return fprintf(fd, "%u, %u, %u, %u", u16[0], u16[1], u16[2], u16[3]);
+			return {FrameAnalysisTextType::UINT16, 4};
 		case DXGI_FORMAT_R16G16_UINT:
-			return fprintf(fd, "%u, %u", u16[0], u16[1]);
+			return {FrameAnalysisTextType::UINT16, 2};
 		case DXGI_FORMAT_R16_UINT:
-			return fprintf(fd, "%u", u16[0]);
+			return {FrameAnalysisTextType::UINT16, 1};
 
 		case DXGI_FORMAT_R16G16B16A16_SINT:
-			return fprintf(fd, "%d, %d, %d, %d", s16[0], s16[1], s16[2], s16[3]);
+			return {FrameAnalysisTextType::SINT16, 4};
 		case DXGI_FORMAT_R16G16_SINT:
-			return fprintf(fd, "%d, %d", s16[0], s16[1]);
+			return {FrameAnalysisTextType::SINT16, 2};
 		case DXGI_FORMAT_R16_SINT:
-			return fprintf(fd, "%d", s16[0]);
+			return {FrameAnalysisTextType::SINT16, 1};
 
 		// --- 8-bit ---
 		case DXGI_FORMAT_R8G8B8A8_TYPELESS:
 		case DXGI_FORMAT_B8G8R8A8_TYPELESS:
-			return fprintf(fd, "%02x, %02x, %02x, %02x", u8[0], u8[1], u8[2], u8[3]);
+			return {FrameAnalysisTextType::HEX8, 4};
 		case DXGI_FORMAT_B8G8R8X8_TYPELESS:
-			return fprintf(fd, "%02x, %02x, %02x", u8[0], u8[1], u8[2]);
+			return {FrameAnalysisTextType::HEX8, 3};
 		case DXGI_FORMAT_R8G8_TYPELESS:
-			return fprintf(fd, "%02x, %02x", u8[0], u8[1]);
+			return {FrameAnalysisTextType::HEX8, 2};
 		case DXGI_FORMAT_R8_TYPELESS:
-			return fprintf(fd, "%02x", u8[0]);
+			return {FrameAnalysisTextType::HEX8, 1};
 
 		case DXGI_FORMAT_R8G8B8A8_UNORM:
 		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: // XXX: Should we apply the SRGB formula?
@@ -1182,45 +1214,45 @@ static int fprint_dxgi_format(FILE *fd, DXGI_FORMAT format, uint8_t *buf)
 		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB: // XXX: Should we apply the SRGB formula?
 		case DXGI_FORMAT_R8G8_B8G8_UNORM:
 		case DXGI_FORMAT_G8R8_G8B8_UNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", unorm8(u8[0]), unorm8(u8[1]), unorm8(u8[2]), unorm8(u8[3]));
+			return {FrameAnalysisTextType::UNORM8, 4};
 		case DXGI_FORMAT_R8G8_UNORM:
-			return fprintf(fd, "%.9g, %.9g", unorm8(u8[0]), unorm8(u8[1]));
+			return {FrameAnalysisTextType::UNORM8, 2};
 		case DXGI_FORMAT_R8_UNORM:
-			return fprintf(fd, "%.9g", unorm8(u8[0]));
+			return {FrameAnalysisTextType::UNORM8, 1};
 
 		case DXGI_FORMAT_R8G8B8A8_SNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", snorm8(s8[0]), snorm8(s8[1]), snorm8(s8[2]), snorm8(s8[3]));
+			return {FrameAnalysisTextType::SNORM8, 4};
 		case DXGI_FORMAT_R8G8_SNORM:
-			return fprintf(fd, "%.9g, %.9g", snorm8(s8[0]), snorm8(s8[1]));
+			return {FrameAnalysisTextType::SNORM8, 2};
 		case DXGI_FORMAT_R8_SNORM:
 		case DXGI_FORMAT_A8_UNORM:
-			return fprintf(fd, "%.9g", snorm8(s8[0]));
+			return {FrameAnalysisTextType::SNORM8, 1};
 
 		case DXGI_FORMAT_R8G8B8A8_UINT:
-			return fprintf(fd, "%u, %u, %u, %u", u8[0], u8[1], u8[2], u8[3]);
+			return {FrameAnalysisTextType::UINT8, 4};
 		case DXGI_FORMAT_R8G8_UINT:
-			return fprintf(fd, "%u, %u", u8[0], u8[1]);
+			return {FrameAnalysisTextType::UINT8, 2};
 		case DXGI_FORMAT_R8_UINT:
-			return fprintf(fd, "%u", u8[0]);
+			return {FrameAnalysisTextType::UINT8, 1};
 
 		case DXGI_FORMAT_R8G8B8A8_SINT:
-			return fprintf(fd, "%d, %d, %d, %d", s8[0], s8[1], s8[2], s8[3]);
+			return {FrameAnalysisTextType::SINT8, 4};
 		case DXGI_FORMAT_R8G8_SINT:
-			return fprintf(fd, "%d, %d", s8[0], s8[1]);
+			return {FrameAnalysisTextType::SINT8, 2};
 		case DXGI_FORMAT_R8_SINT:
-			return fprintf(fd, "%d", s8[0]);
+			return {FrameAnalysisTextType::SINT8, 1};
 
 		case DXGI_FORMAT_R32G8X24_TYPELESS:
 		case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
 		case DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS:
 		case DXGI_FORMAT_X32_TYPELESS_G8X24_UINT:
-			return fprintf(fd, "%.9g, %d", f[0], u8[4]);
+			return {FrameAnalysisTextType::FLOAT32_UINT8, 2};
 
 		case DXGI_FORMAT_R24G8_TYPELESS:
 		case DXGI_FORMAT_D24_UNORM_S8_UINT:
 		case DXGI_FORMAT_R24_UNORM_X8_TYPELESS:
 		case DXGI_FORMAT_X24_TYPELESS_G8_UINT:
-			return fprintf(fd, "%.9g, %d", unorm24(u32[0] & 0xffffff), u8[3]);
+			return {FrameAnalysisTextType::UNORM24_UINT8, 2};
 
 		// TODO: Unusual field sizes:
 		// case DXGI_FORMAT_R10G10B10A2_TYPELESS:
@@ -1234,70 +1266,129 @@ static int fprint_dxgi_format(FILE *fd, DXGI_FORMAT format, uint8_t *buf)
 		// case DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM:
 	}
 
-	for (i = 0; i < dxgi_format_size(format); i++)
-		fprintf(fd, "%02x", buf[i]);
-	return i * 2;
+	return {FrameAnalysisTextType::RAW, dxgi_format_size(format)};
 }
 
+// The text written for one element of the input layout for every vertex or
+// instance, with the same warnings dump_vb_elem() used to write every time.
+struct VBElemText {
+	D3D11_INPUT_ELEMENT_DESC *desc;
+	FrameAnalysisTextFormat format;
+	UINT offset;
+	std::string before_index; // Any warnings, then vb%i[
+	std::string after_index;  // ]+%03u %s%u:
+	std::string after_value;  // The newline, then any warnings
+	size_t values_offset;
+};
 
-static void dump_vb_elem(FILE *fd, uint8_t *buf,
-		D3D11_INPUT_ELEMENT_DESC *layout_desc, size_t layout_elements,
-		int slot, UINT vb_idx, UINT elem, UINT stride)
+static void vb_elem_text(VBElemText *text, D3D11_INPUT_ELEMENT_DESC *desc, int slot, UINT stride)
 {
 	UINT offset = 0, alignment, size;
+	char buf[32];
 
-	if (layout_desc[elem].InputSlot != slot)
-		return;
+	text->desc = desc;
 
-	if (layout_desc[elem].AlignedByteOffset != D3D11_APPEND_ALIGNED_ELEMENT) {
-		offset = layout_desc[elem].AlignedByteOffset;
+	if (desc->AlignedByteOffset != D3D11_APPEND_ALIGNED_ELEMENT) {
+		offset = desc->AlignedByteOffset;
 	} else {
-		alignment = dxgi_format_alignment(layout_desc[elem].Format);
+		alignment = dxgi_format_alignment(desc->Format);
 		if (!alignment) {
-			fprintf(fd, "# WARNING: Unknown format alignment, vertex buffer may be decoded incorrectly\n");
+			text->before_index += "# WARNING: Unknown format alignment, vertex buffer may be decoded incorrectly\n";
 		} else if (offset % alignment) {
-			fprintf(fd, "# WARNING: Untested alignment code in use, please report incorrectly decoded vertex buffers\n");
+			text->before_index += "# WARNING: Untested alignment code in use, please report incorrectly decoded vertex buffers\n";
 			// XXX: Also, what if the entire vertex is misaligned in the buffer?
 			offset += alignment - (offset % alignment);
 		}
 	}
+	text->offset = offset;
+	text->format = dxgi_text_format(desc->Format);
+
+	StringCchPrintfA(buf, ARRAYSIZE(buf), "vb%i[", slot);
+	text->before_index += buf;
+	StringCchPrintfA(buf, ARRAYSIZE(buf), "]+%03u ", offset);
+	text->after_index = buf;
+	text->after_index += desc->SemanticName;
+	if (desc->SemanticIndex) {
+		StringCchPrintfA(buf, ARRAYSIZE(buf), "%u", desc->SemanticIndex);
+		text->after_index += buf;
+	}
+	text->after_index += ": ";
 
-	fprintf(fd, "vb%i[%u]+%03u %s", slot, vb_idx, offset, layout_desc[elem].SemanticName);
-	if (layout_desc[elem].SemanticIndex)
-		fprintf(fd, "%u", layout_desc[elem].SemanticIndex);
-	fprintf(fd, ": ");
-
-	fprint_dxgi_format(fd, layout_desc[elem].Format, buf + offset);
-	fprintf(fd, "\n");
-
-	size = dxgi_format_size(layout_desc[elem].Format);
+	text->after_value = "\n";
+	size = dxgi_format_size(desc->Format);
 	if (!size)
-		fprintf(fd, "# WARNING: Unknown format size, vertex buffer may be decoded incorrectly\n");
+		text->after_value += "# WARNING: Unknown format size, vertex buffer may be decoded incorrectly\n";
 	offset += size;
 	if (offset > stride)
-		fprintf(fd, "# WARNING: Offset exceeded stride, vertex buffer may be decoded incorrectly\n");
+		text->after_value += "# WARNING: Offset exceeded stride, vertex buffer may be decoded incorrectly\n";
 }
 
+// Returns how many values a batch of the elements decodes to
+static size_t vb_elems_text(std::vector<VBElemText> *elems,
+		D3D11_INPUT_ELEMENT_DESC *layout_desc, size_t layout_elements,
+		D3D11_INPUT_CLASSIFICATION slot_class, int slot, UINT stride, size_t batch)
+{
+	size_t elem, values = 0;
+
+	for (elem = 0; elem < layout_elements; elem++) {
+		if (layout_desc[elem].InputSlotClass != slot_class)
+			continue;
+		if (layout_desc[elem].InputSlot != slot)
+			continue;
+
+		elems->emplace_back();
+		vb_elem_text(&elems->back(), &layout_desc[elem], slot, stride);
+		elems->back().values_offset = values;
+		values += elems->back().format.components * batch;
+	}
+
+	return values;
+}
+
+static void dump_vb_elem(FrameAnalysisTextBuffer *out, VBElemText *elem, UINT vb_idx, const uint32_t *values)
+{
+	out->append(elem->before_index.data(), elem->before_index.size());
+	out->append_uint(vb_idx);
+	out->append(elem->after_index.data(), elem->after_index.size());
+	out->append_values(elem->format, values);
+	out->append(elem->after_value.data(), elem->after_value.size());
+}
+
+// Vertices are decoded this many at a time, one element at a time:
+static const UINT VB_TXT_BATCH = 1024;
+
 static void dump_vb_known_layout(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
 		D3D11_INPUT_ELEMENT_DESC *layout_desc, size_t layout_elements,
 		UINT size, int slot, UINT offset, UINT first, UINT count, UINT stride)
 {
-	UINT vertex, elem, start, end;
+	FrameAnalysisTextBuffer out(fd);
+	std::vector<VBElemText> elems;
+	std::vector<uint32_t> values;
+	UINT vertex, batch, n, start, end;
 
 	start = offset / stride + first;
 	end = size / stride;
 	if (count)
 		end = min(end, start + count);
 
-	for (vertex = start; vertex < end; vertex++) {
-		fprintf(fd, "\n");
-		for (elem = 0; elem < layout_elements; elem++) {
-			if (layout_desc[elem].InputSlotClass != D3D11_INPUT_PER_VERTEX_DATA)
-				continue;
-
-			dump_vb_elem(fd, (uint8_t*)map->pData + stride*vertex,
-					layout_desc, layout_elements, slot,
-					vertex - start, elem, stride);
+	values.resize(vb_elems_text(&elems, layout_desc, layout_elements,
+			D3D11_INPUT_PER_VERTEX_DATA, slot, stride, VB_TXT_BATCH));
+
+	for (batch = start; batch < end; batch += n) {
+		n = min(end - batch, VB_TXT_BATCH);
+
+		for (VBElemText &elem : elems) {
+			frame_analysis_text_decode(elem.format,
+					(uint8_t*)map->pData + stride*batch + elem.offset,
+					stride, n, values.data() + elem.values_offset);
+		}
+
+		for (vertex = batch; vertex < batch + n; vertex++) {
+			out.append('\n');
+			for (VBElemText &elem : elems) {
+				dump_vb_elem(&out, &elem, vertex - start, values.data() + elem.values_offset
+						+ (vertex - batch) * elem.format.components);
+			}
 		}
 	}
 }
@@ -1306,27 +1397,33 @@ static void dump_vb_instance_data(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
 		D3D11_INPUT_ELEMENT_DESC *layout_desc, size_t layout_elements,
 		UINT size, int slot, UINT offset, UINT first, UINT count, UINT stride)
 {
-	UINT instance, idx, elem, start, end;
+	FrameAnalysisTextBuffer out(fd);
+	std::vector<VBElemText> elems;
+	std::vector<uint32_t> values;
+	UINT instance, idx, start, end;
 
 	start = offset / stride + first;
 	end = size / stride;
 	if (count)
 		end = min(end, start + count);
 
-	for (instance = start; instance < end; instance++) {
-		fprintf(fd, "\n");
-		for (elem = 0; elem < layout_elements; elem++) {
-			if (layout_desc[elem].InputSlotClass != D3D11_INPUT_PER_INSTANCE_DATA)
-				continue;
+	// Each element can step through the instances at its own rate, so
+	// these are decoded one at a time:
+	values.resize(vb_elems_text(&elems, layout_desc, layout_elements,
+			D3D11_INPUT_PER_INSTANCE_DATA, slot, stride, 1));
 
-			if (layout_desc[elem].InstanceDataStepRate)
-				idx = (instance-start) / layout_desc[elem].InstanceDataStepRate + start;
+	for (instance = start; instance < end; instance++) {
+		out.append('\n');
+		for (VBElemText &elem : elems) {
+			if (elem.desc->InstanceDataStepRate)
+				idx = (instance-start) / elem.desc->InstanceDataStepRate + start;
 			else
 				idx = instance;
 
-			dump_vb_elem(fd, (uint8_t*)map->pData + stride*idx,
-					layout_desc, layout_elements, slot,
-					idx - start, elem, stride);
+			frame_analysis_text_decode(elem.format,
+					(uint8_t*)map->pData + stride*idx + elem.offset,
+					stride, 1, values.data() + elem.values_offset);
+			dump_vb_elem(&out, &elem, idx - start, values.data() + elem.values_offset);
 		}
 	}
 }
@@ -1336,7 +1433,7 @@ static void dump_vb_instance_data(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
  * FIXME: We should wrap the input layout object to get the correct format (and
  * other info like the semantic).
  */
-void FrameAnalysisContext::DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
+static void DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
 		UINT size, int slot, UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout,
 		D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info)
 {
@@ -1348,7 +1445,7 @@ void FrameAnalysisContext::DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr("Unable to create %S: %u\n", filename, err);
+		FAWriterLogErr("Unable to create %S: %u\n", filename, err);
 		return;
 	}
 
@@ -1371,7 +1468,7 @@ void FrameAnalysisContext::DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 		dump_ia_layout(fd, layout_desc, layout_elements, slot, &per_vert, &per_inst);
 	}
 	if (!stride) {
-		FALogErr("Cannot dump vertex buffer with stride=0\n");
+		FAWriterLogErr("Cannot dump vertex buffer with stride=0\n");
 		goto out_close;
 	}
 
@@ -1427,20 +1524,43 @@ void FrameAnalysisContext::dedupe_buf_filename_ib_txt(const wchar_t *bin_filenam
 		FALogErr("Failed to create index buffer filename\n");
 }
 
-void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
+static void dump_ib_indices(FILE *fd, FrameAnalysisTextFormat format,
+		void *buf, UINT start, UINT end, int grouping)
+{
+	FrameAnalysisTextBuffer out(fd);
+	uint32_t indices[VB_TXT_BATCH];
+	UINT batch, n, i;
+
+	for (batch = start; batch < end; batch += n) {
+		n = min(end - batch, VB_TXT_BATCH);
+		frame_analysis_text_decode(format, (uint8_t*)buf + batch * format.size(),
+				format.size(), n, indices);
+
+		for (i = batch; i < batch + n; i++) {
+			if ((i-start) % grouping == 0)
+				out.append('\n');
+			else
+				out.append(' ');
+			out.append_uint(indices[i - batch]);
+		}
+	}
+	out.append('\n');
+}
+
+static void DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
 		UINT size, DXGI_FORMAT format, UINT offset, UINT first, UINT count,
 		D3D11_PRIMITIVE_TOPOLOGY topology)
 {
 	FILE *fd = NULL;
 	uint16_t *buf16 = (uint16_t*)map->pData;
 	uint32_t *buf32 = (uint32_t*)map->pData;
-	UINT start, end, i;
+	UINT start, end;
 	errno_t err;
 	int grouping = 1;
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr("Unable to create %S: %u\n", filename, err);
+		FAWriterLogErr("Unable to create %S: %u\n", filename, err);
 		return;
 	}
 
@@ -1471,14 +1591,7 @@ void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 		if (count)
 			end = min(end, start + count);
 
-		for (i = start; i < end; i++) {
-			if ((i-start) % grouping == 0)
-				fprintf(fd, "\n");
-			else
-				fprintf(fd, " ");
-			fprintf(fd, "%u", buf16[i]);
-		}
-		fprintf(fd, "\n");
+		dump_ib_indices(fd, {FrameAnalysisTextType::UINT16, 1}, buf16, start, end, grouping);
 		break;
 	case DXGI_FORMAT_R32_UINT:
 		fprintf(fd, "format: DXGI_FORMAT_R32_UINT\n");
@@ -1488,14 +1601,7 @@ void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 		if (count)
 			end = min(end, start + count);
 
-		for (i = start; i < end; i++) {
-			if ((i-start) % grouping == 0)
-				fprintf(fd, "\n");
-			else
-				fprintf(fd, " ");
-			fprintf(fd, "%u", buf32[i]);
-		}
-		fprintf(fd, "\n");
+		dump_ib_indices(fd, {FrameAnalysisTextType::UINT32, 1}, buf32, start, end, grouping);
 		break;
 	default:
 		// Illegal format for an index buffer
@@ -1507,7 +1613,7 @@ void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 }
 
 template <typename DescType>
-void FrameAnalysisContext::DumpDesc(DescType *desc, const wchar_t *filename)
+static void DumpDesc(DescType *desc, const wchar_t *filename)
 {
 	FILE *fd = NULL;
 	char buf[256];
@@ -1517,7 +1623,7 @@ void FrameAnalysisContext::DumpDesc(DescType *desc, const wchar_t *filename)
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr("Unable to create %S: %u\n", filename, err);
+		FAWriterLogErr("Unable to create %S: %u\n", filename, err);
 		return;
 	}
 	fwrite(buf, 1, strlen(buf), fd);
@@ -1704,101 +1810,265 @@ void FrameAnalysisContext::determine_vb_count(UINT *count, ID3D11Buffer *staged_
 	GetDumpingContext()->Unmap(staged_ib_for_vb, 0);
 }
 
+// Everything a writer needs to write out a buffer that the render thread has
+// copied, as neither the context nor the staging resource go with it:
+struct FrameAnalysisBufferDump {
+	FrameAnalysisOptions analyse_options;
+	D3D11_BUFFER_DESC orig_desc;
+	wstring filename;
+	wstring dedupe_filename; // With a .XXX extension, replaced for each format
+	wstring txt_filename;
+	FrameAnalysisOptions buf_type_mask;
+	int idx;
+	DXGI_FORMAT ib_fmt;
+	UINT stride;
+	UINT offset;
+	UINT first;
+	UINT count;
+	Microsoft::WRL::ComPtr<ID3DBlob> layout;
+	D3D11_PRIMITIVE_TOPOLOGY topology;
+	DrawCallInfo call_info;
+	bool has_call_info;
+};
+
+// Writes a deduplicated file unless it already exists, which it may from an
+// earlier frame analysis sharing the deduped directory. If another writer is
+// already writing it this waits for them so the file is complete before it
+// is linked. Returns true if this was the writer that wrote it:
+static bool write_deduplicated_file(FrameAnalysisWriter *writer,
+		const wchar_t *dedupe_filename, FrameAnalysisOptions analyse_options,
+		std::function<void()> write)
+{
+	bool wrote = false;
+
+	writer->write_once(dedupe_filename, [&] {
+		if (!deduplicated_file_exists(dedupe_filename, analyse_options)) {
+			write();
+			wrote = true;
+		}
+	});
+
+	return wrote;
+}
+
+// Runs on a writer thread. The formatting and the disk I/O that
+// DumpBufferImmediateCtx used to do on the game's render thread are done here
+// from the copy it queued, under the deduplicated filenames it worked out:
+static void write_buffer_dump(FrameAnalysisWriter *writer,
+		FrameAnalysisBufferDump &dump, const FrameAnalysisBuffer &buffer)
+{
+	wchar_t bin_filename[MAX_PATH];
+	const wchar_t *txt_filename = dump.txt_filename.c_str();
+	D3D11_MAPPED_SUBRESOURCE map = {};
+	DrawCallInfo *call_info = dump.has_call_info ? &dump.call_info : NULL;
+	wstring filename = dump.filename;
+	UINT size = dump.orig_desc.ByteWidth;
+	FILE *fd = NULL;
+	wchar_t *bin_ext;
+	size_t ext;
+	errno_t err;
+	bool wrote;
+
+	// The text dumps read the copy as they did the mapped resource:
+	map.pData = (void*)buffer.data();
+
+	// Both have an extension, or this would not have been queued:
+	wcscpy_s(bin_filename, MAX_PATH, dump.dedupe_filename.c_str());
+	ext = filename.find_last_of(L'.');
+	bin_ext = wcsrchr(bin_filename, L'.');
+
+	if (dump.analyse_options & FrameAnalysisOptions::FMT_BUF_BIN) {
+		filename.replace(ext, wstring::npos, L".buf");
+		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".buf");
+
+		// The copy can go straight into the store without a trip
+		// through the deduped directory:
+		if (!(dump.analyse_options & FrameAnalysisOptions::STORE_DEDUPED)
+				|| !store_deduplicated_file(filename.c_str(), bin_filename, false, buffer.data(), size)) {
+			wrote = write_deduplicated_file(writer, bin_filename, dump.analyse_options, [&] {
+				err = wfopen_ensuring_access(&fd, bin_filename, L"wb");
+				if (!fd) {
+					FAWriterLogErr("Unable to create %S: %u\n", bin_filename, err);
+					return;
+				}
+				fwrite(buffer.data(), 1, size, fd);
+				fclose(fd);
+			});
+			link_deduplicated_files(filename.c_str(), bin_filename, dump.analyse_options, wrote);
+		}
+	}
+
+	if (dump.analyse_options & FrameAnalysisOptions::FMT_BUF_TXT) {
+		filename.replace(ext, wstring::npos, L".txt");
+
+		if (dump.buf_type_mask & FrameAnalysisOptions::DUMP_CB) {
+			wrote = write_deduplicated_file(writer, txt_filename, dump.analyse_options, [&] {
+				DumpBufferTxt(txt_filename, &map, size, 'c', dump.idx, dump.stride, dump.offset);
+			});
+		} else if (dump.buf_type_mask & FrameAnalysisOptions::DUMP_VB) {
+			wrote = write_deduplicated_file(writer, txt_filename, dump.analyse_options, [&] {
+				DumpVBTxt(txt_filename, &map, size, dump.idx, dump.stride, dump.offset,
+						dump.first, dump.count, dump.layout.Get(), dump.topology, call_info);
+			});
+		} else if (dump.buf_type_mask & FrameAnalysisOptions::DUMP_IB) {
+			wrote = write_deduplicated_file(writer, txt_filename, dump.analyse_options, [&] {
+				DumpIBTxt(txt_filename, &map, size, dump.ib_fmt, dump.offset,
+						dump.first, dump.count, dump.topology);
+			});
+		} else {
+			// We don't know what kind of buffer this is, so just
+			// use the generic dump routine:
+
+			wrote = write_deduplicated_file(writer, txt_filename, dump.analyse_options, [&] {
+				DumpBufferTxt(txt_filename, &map, size, '?', dump.idx, dump.stride, dump.offset);
+			});
+		}
+		link_deduplicated_files(filename.c_str(), txt_filename, dump.analyse_options, wrote);
+	}
+	// TODO: Dump UAV, RT and SRV buffers as text taking their format,
+	// offset, size, first entry and num entries into account.
+
+	if (dump.analyse_options & FrameAnalysisOptions::FMT_DESC) {
+		filename.replace(ext, wstring::npos, L".dsc");
+		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".dsc");
+
+		wrote = write_deduplicated_file(writer, bin_filename, dump.analyse_options, [&] {
+			DumpDesc(&dump.orig_desc, bin_filename);
+		});
+		link_deduplicated_files(filename.c_str(), bin_filename, dump.analyse_options, wrote);
+	}
+}
+
 void FrameAnalysisContext::DumpBufferImmediateCtx(ID3D11Buffer *staging, D3D11_BUFFER_DESC *orig_desc,
 		wstring filename, FrameAnalysisOptions buf_type_mask, int idx,
 		DXGI_FORMAT ib_fmt, UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout,
 		D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info,
 		ID3D11Buffer *staged_ib_for_vb, UINT ib_off_for_vb)
 {
-	wchar_t bin_filename[MAX_PATH], txt_filename[MAX_PATH];
+	FrameAnalysisWriter *writer = G->frame_analysis_writer;
+	FrameAnalysisBufferPtr buffer;
+	FrameAnalysisBufferDump dump;
 	D3D11_MAPPED_SUBRESOURCE map;
-	HRESULT hr;
-	FILE *fd = NULL;
+	wchar_t dedupe_dir[MAX_PATH];
+	wchar_t bin_filename[MAX_PATH], txt_filename[MAX_PATH];
+	wstring log_filename;
 	wchar_t *bin_ext;
 	size_t ext;
-	errno_t err;
+	HRESULT hr;
+
+	// Scanning the index buffer for the vertex count needs the dumping
+	// context, so that has to be done here:
+	if ((analyse_options & FrameAnalysisOptions::FMT_BUF_TXT)
+			&& !(buf_type_mask & FrameAnalysisOptions::DUMP_CB)
+			&& (buf_type_mask & FrameAnalysisOptions::DUMP_VB))
+		determine_vb_count(&count, staged_ib_for_vb, call_info, ib_off_for_vb, ib_fmt);
+
+	// Waits here if the writers have fallen too far behind, before the
+	// staging resource is mapped:
+	buffer = writer->get_buffer(orig_desc->ByteWidth);
 
 	hr = GetDumpingContext()->Map(staging, 0, D3D11_MAP_READ, 0, &map);
 	if (FAILED(hr)) {
 		FALogErr("DumpBuffer failed to map staging resource: 0x%x\n", hr);
 		return;
 	}
+	memcpy(buffer->data(), map.pData, orig_desc->ByteWidth);
+	GetDumpingContext()->Unmap(staging, 0);
 
-	dedupe_buf_filename(staging, orig_desc, &map, bin_filename, MAX_PATH);
+	// The deduplicated filenames depend on the contents, so are worked out
+	// here from the copy for the log to say which file each dump links to,
+	// leaving the writer to do everything else:
+	get_deduped_dir(dedupe_dir, MAX_PATH);
+	dedupe_buf_filename(orig_desc, buffer->data(), dedupe_dir, bin_filename, MAX_PATH);
 
 	ext = filename.find_last_of(L'.');
 	bin_ext = wcsrchr(bin_filename, L'.');
 	if (ext == wstring::npos || !bin_ext) {
 		FALogErr("DumpBuffer: Filename missing extension\n");
-		goto out_unmap;
+		return;
 	}
+	dump.dedupe_filename = bin_filename;
 
 	if (analyse_options & FrameAnalysisOptions::FMT_BUF_BIN) {
-		filename.replace(ext, wstring::npos, L".buf");
+		log_filename = filename;
+		log_filename.replace(ext, wstring::npos, L".buf");
 		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".buf");
-		FALogInfo("Dumping Buffer %S -> %S\n", filename.c_str(), bin_filename);
-
-		if (GetFileAttributes(bin_filename) == INVALID_FILE_ATTRIBUTES) {
-			err = wfopen_ensuring_access(&fd, bin_filename, L"wb");
-			if (!fd) {
-				FALogErr("Unable to create %S: %u\n", bin_filename, err);
-				goto out_unmap;
-			}
-			fwrite(map.pData, 1, orig_desc->ByteWidth, fd);
-			fclose(fd);
-		}
-		link_deduplicated_files(filename.c_str(), bin_filename);
+		FALogInfo("Dumping Buffer %S -> %S\n", log_filename.c_str(), bin_filename);
 	}
 
 	if (analyse_options & FrameAnalysisOptions::FMT_BUF_TXT) {
-		filename.replace(ext, wstring::npos, L".txt");
+		log_filename = filename;
+		log_filename.replace(ext, wstring::npos, L".txt");
 
-		if (buf_type_mask & FrameAnalysisOptions::DUMP_CB) {
+		if (buf_type_mask & FrameAnalysisOptions::DUMP_CB)
 			dedupe_buf_filename_txt(bin_filename, txt_filename, MAX_PATH, 'c', idx, stride, offset);
-			FALogInfo("Dumping Buffer %S -> %S\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpBufferTxt(txt_filename, &map, orig_desc->ByteWidth, 'c', idx, stride, offset);
-			}
-		} else if (buf_type_mask & FrameAnalysisOptions::DUMP_VB) {
-			determine_vb_count(&count, staged_ib_for_vb, call_info, ib_off_for_vb, ib_fmt);
+		else if (buf_type_mask & FrameAnalysisOptions::DUMP_VB)
 			dedupe_buf_filename_vb_txt(bin_filename, txt_filename, MAX_PATH, idx, stride, offset, first, count, layout, topology, call_info);
-			FALogInfo("Dumping Buffer %S -> %S\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpVBTxt(txt_filename, &map, orig_desc->ByteWidth, idx, stride, offset, first, count, layout, topology, call_info);
-			}
-		} else if (buf_type_mask & FrameAnalysisOptions::DUMP_IB) {
+		else if (buf_type_mask & FrameAnalysisOptions::DUMP_IB)
 			dedupe_buf_filename_ib_txt(bin_filename, txt_filename, MAX_PATH, ib_fmt, offset, first, count, topology);
-			FALogInfo("Dumping Buffer %S -> %S\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpIBTxt(txt_filename, &map, orig_desc->ByteWidth, ib_fmt, offset, first, count, topology);
-			}
-		} else {
-			// We don't know what kind of buffer this is, so just
-			// use the generic dump routine:
-
+		else
 			dedupe_buf_filename_txt(bin_filename, txt_filename, MAX_PATH, '?', idx, stride, offset);
-			FALogInfo("Dumping Buffer %S -> %S\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpBufferTxt(txt_filename, &map, orig_desc->ByteWidth, '?', idx, stride, offset);
-			}
-		}
-		link_deduplicated_files(filename.c_str(), txt_filename);
+		FALogInfo("Dumping Buffer %S -> %S\n", log_filename.c_str(), txt_filename);
+		dump.txt_filename = txt_filename;
 	}
-	// TODO: Dump UAV, RT and SRV buffers as text taking their format,
-	// offset, size, first entry and num entries into account.
 
 	if (analyse_options & FrameAnalysisOptions::FMT_DESC) {
-		filename.replace(ext, wstring::npos, L".dsc");
+		log_filename = filename;
+		log_filename.replace(ext, wstring::npos, L".dsc");
 		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".dsc");
-		FALogInfo("Dumping Buffer %S -> %S\n", filename.c_str(), bin_filename);
+		FALogInfo("Dumping Buffer %S -> %S\n", log_filename.c_str(), bin_filename);
+	}
+
+	dump.analyse_options = analyse_options;
+	dump.orig_desc = *orig_desc;
+	dump.filename = filename;
+	dump.buf_type_mask = buf_type_mask;
+	dump.idx = idx;
+	dump.ib_fmt = ib_fmt;
+	dump.stride = stride;
+	dump.offset = offset;
+	dump.first = first;
+	dump.count = count;
+	dump.layout = layout;
+	dump.topology = topology;
+	dump.call_info = call_info ? *call_info : DrawCallInfo();
+	dump.has_call_info = !!call_info;
+
+	writer->queue(std::move(buffer), [writer, dump](const FrameAnalysisBuffer &buffer) mutable {
+		write_buffer_dump(writer, dump, buffer);
+	});
+}
+
+void FrameAnalysisFinishWriting(bool aborted)
+{
+	FrameAnalysisWriter *writer = G->frame_analysis_writer;
+	FrameAnalysisWriterStats stats;
+	size_t dropped;
+
+	if (!writer)
+		return;
 
-		if (GetFileAttributes(bin_filename) == INVALID_FILE_ATTRIBUTES)
-			DumpDesc(orig_desc, bin_filename);
-		link_deduplicated_files(filename.c_str(), bin_filename);
+	if (aborted) {
+		dropped = writer->drain();
+		if (dropped)
+			LogInfo("Frame Analysis: Aborted, %Iu buffers were not written\n", dropped);
+	} else {
+		writer->wait_idle([](const FrameAnalysisWriterStats &stats) {
+			LogInfo("Frame Analysis: Writing buffers, %llu of %llu done\n",
+					stats.written + stats.dropped, stats.queued);
+		});
 	}
 
-out_unmap:
-	GetDumpingContext()->Unmap(staging, 0);
+	// Totals since the game started:
+	stats = writer->get_stats();
+	LogInfo("Frame Analysis: %llu buffers written, %llu already deduplicated, "
+			"%llu waits for writers, up to %llu MB staged\n",
+			stats.written, stats.deduplicated, stats.waits,
+			stats.max_staged_bytes / (1024 * 1024));
+
+	writer->forget_written();
+
+	close_dedupe_stores();
 }
 
 void FrameAnalysisContext::DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
@@ -2148,11 +2418,10 @@ err:
 	return traditional_filename;
 }
 
-void FrameAnalysisContext::dedupe_buf_filename(ID3D11Buffer *resource,
-		D3D11_BUFFER_DESC *orig_desc, D3D11_MAPPED_SUBRESOURCE *map,
+static void dedupe_buf_filename(const D3D11_BUFFER_DESC *orig_desc,
+		const void *data, const wchar_t *dedupe_dir,
 		wchar_t *dedupe_filename, size_t size)
 {
-	wchar_t dedupe_dir[MAX_PATH];
 	uint32_t hash;
 
 	// Many of the files dumped with frame analysis are identical, and this
@@ -2175,14 +2444,13 @@ void FrameAnalysisContext::dedupe_buf_filename(ID3D11Buffer *resource,
 	// doesn't match the description used to create it (e.g. unused fields
 	// for a given buffer type being zeroed out).
 
-	hash = crc32c_hw(0, map->pData, orig_desc->ByteWidth);
+	hash = crc32c_hw(0, data, orig_desc->ByteWidth);
 	hash = crc32c_hw(hash, orig_desc, sizeof(D3D11_BUFFER_DESC));
 
-	get_deduped_dir(dedupe_dir, MAX_PATH);
 	_snwprintf_s(dedupe_filename, size, size, L"%ls\\%08x.XXX", dedupe_dir, hash);
 }
 
-void FrameAnalysisContext::rotate_deduped_file(const wchar_t *dedupe_filename)
+static void rotate_deduped_file(const wchar_t *dedupe_filename)
 {
 	wchar_t rotated_filename[MAX_PATH];
 	unsigned rotate;
@@ -2211,7 +2479,7 @@ void FrameAnalysisContext::rotate_deduped_file(const wchar_t *dedupe_filename)
 			// xxxxxxx.1.xxx - max 1023 hard links
 			// xxxxxxx.2.xxx - max 1023 hard links
 			// etc.
-			FALogInfo("Max hard links exceeded, rotating deduped file: %S\n", rotated_filename);
+			LogInfo("Frame Analysis: Max hard links exceeded, rotating deduped file: %S\n", rotated_filename);
 			MoveFile(dedupe_filename, rotated_filename);
 			CopyFile(rotated_filename, dedupe_filename, TRUE);
 			return;
@@ -2219,7 +2487,7 @@ void FrameAnalysisContext::rotate_deduped_file(const wchar_t *dedupe_filename)
 	}
 }
 
-void FrameAnalysisContext::rotate_when_nearing_hard_link_limit(const wchar_t *dedupe_filename)
+static void rotate_when_nearing_hard_link_limit(const wchar_t *dedupe_filename)
 {
 	HANDLE f;
 	BY_HANDLE_FILE_INFORMATION info;
@@ -2275,8 +2543,208 @@ static bool create_shortcut(const wchar_t *filename, const wchar_t *dedupe_filen
 	return SUCCEEDED(hr);
 }
 
-void FrameAnalysisContext::link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename)
+// With store_dupes, each deduped directory has a store that the
+// deduplicated files are moved into, and the files that would have been
+// linked to them are listed in the frame analysis directory's manifest. These
+// are opened as they are first needed, and closed once the frame analysis
+// has finished writing:
+static std::mutex frame_analysis_stores_lock;
+static unordered_map<wstring, std::unique_ptr<FrameAnalysisStore>> frame_analysis_stores;
+static FrameAnalysisManifest frame_analysis_manifest;
+
+static FrameAnalysisStore* get_dedupe_store(const wchar_t *dedupe_filename)
+{
+	std::lock_guard<std::mutex> guard(frame_analysis_stores_lock);
+	const wchar_t *sep = wcsrchr(dedupe_filename, L'\\');
+	wstring dir(dedupe_filename, sep ? sep - dedupe_filename : 0);
+	std::unique_ptr<FrameAnalysisStore> &store = frame_analysis_stores[dir];
+
+	if (!store) {
+		store.reset(new FrameAnalysisStore());
+		if (!store->open((dir + L"\\" FRAME_ANALYSIS_STORE_NAME).c_str()))
+			FAWriterLogErr("Unable to open %S, linking files instead\n", store->get_path().c_str());
+		else
+			LogInfo("Frame Analysis: Storing deduplicated files in %S (store_dupes is experimental)\n",
+					store->get_path().c_str());
+	}
+
+	return store.get();
+}
+
+// The store key is the name of the file in the deduped directory, which
+// starts with the hash of its contents:
+static std::string dedupe_store_key(const wchar_t *dedupe_filename)
+{
+	const wchar_t *name = wcsrchr(dedupe_filename, L'\\');
+
+	name = name ? name + 1 : dedupe_filename;
+	return frame_analysis_store_utf8(name, wcslen(name));
+}
+
+// Paths in the manifest are relative to the frame analysis directory where
+// possible, so it can be moved or shared along with its deduped directory:
+static wstring analysis_relative_path(const wstring &path)
+{
+	size_t len = wcslen(G->ANALYSIS_PATH);
+
+	if (path.size() > len && path[len] == L'\\' && !_wcsnicmp(path.c_str(), G->ANALYSIS_PATH, len))
+		return path.substr(len + 1);
+	return path;
+}
+
+static bool deduplicated_file_exists(const wchar_t *dedupe_filename,
+		FrameAnalysisOptions analyse_options)
 {
+	if ((analyse_options & FrameAnalysisOptions::STORE_DEDUPED)
+			&& get_dedupe_store(dedupe_filename)->contains(dedupe_store_key(dedupe_filename)))
+		return true;
+
+	return GetFileAttributes(dedupe_filename) != INVALID_FILE_ATTRIBUTES;
+}
+
+static bool read_deduplicated_file(const wchar_t *dedupe_filename, std::vector<uint8_t> *data)
+{
+	FILE *fd = NULL;
+	long size;
+
+	if (_wfopen_s(&fd, dedupe_filename, L"rb") || !fd)
+		return false;
+
+	fseek(fd, 0, SEEK_END);
+	size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	data->resize(size > 0 ? size : 0);
+	if (size > 0 && fread(data->data(), 1, data->size(), fd) != data->size())
+		size = -1;
+	fclose(fd);
+
+	return size >= 0;
+}
+
+// Adds a deduplicated file to its store unless it is already there, from
+// data if the caller already has its contents, or otherwise from the file in
+// the deduped directory, which is then deleted if the caller wrote it. Files
+// left there by an earlier frame analysis without store_dupes may still be
+// linked to, so they are stored without removing them. Returns false if the
+// file could not be stored so the caller can link it instead.
+static bool store_deduplicated_file(const wchar_t *filename, const wchar_t *dedupe_filename,
+		bool wrote, const void *data, size_t size)
+{
+	FrameAnalysisStore *store = get_dedupe_store(dedupe_filename);
+	std::string key = dedupe_store_key(dedupe_filename);
+	std::vector<uint8_t> contents;
+	wchar_t manifest_path[MAX_PATH];
+	bool have_data;
+
+	if (!store->is_open())
+		return false;
+
+	{
+		std::lock_guard<std::mutex> guard(frame_analysis_stores_lock);
+		if (!frame_analysis_manifest.is_open()) {
+			_snwprintf_s(manifest_path, MAX_PATH, MAX_PATH, L"%ls\\" FRAME_ANALYSIS_MANIFEST_NAME, G->ANALYSIS_PATH);
+			if (!frame_analysis_manifest.open(manifest_path)) {
+				FAWriterLogErr("Unable to create %S, linking files instead\n", manifest_path);
+				return false;
+			}
+		}
+	}
+
+	if (!store->contains(key)) {
+		have_data = !!data;
+		if (!have_data && read_deduplicated_file(dedupe_filename, &contents)) {
+			data = contents.data();
+			size = contents.size();
+			have_data = true;
+		}
+		if (!have_data) {
+			// Another writer may have just stored and deleted it:
+			if (!store->contains(key))
+				return false;
+		} else if (!store->add(key, data, size)) {
+			FAWriterLogErr("Unable to add %S to %S, linking it instead\n",
+					dedupe_filename, store->get_path().c_str());
+			return false;
+		}
+	}
+
+	if (wrote)
+		DeleteFile(dedupe_filename);
+
+	frame_analysis_manifest.add(analysis_relative_path(store->get_path()), key,
+			analysis_relative_path(filename).c_str());
+
+	return true;
+}
+
+static void close_dedupe_stores()
+{
+	std::lock_guard<std::mutex> guard(frame_analysis_stores_lock);
+	FrameAnalysisStoreStats stats;
+
+	for (auto &i : frame_analysis_stores) {
+		if (!i.second->is_open())
+			continue;
+		stats = i.second->get_stats();
+		LogInfo("Frame Analysis: %u files added to %S, %u already there. "
+				"%u files, %llu MB compressed to %llu MB\n",
+				stats.added, i.second->get_path().c_str(), stats.duplicates, stats.blobs,
+				stats.raw_bytes / (1024 * 1024), stats.stored_bytes / (1024 * 1024));
+	}
+
+	frame_analysis_stores.clear();
+	frame_analysis_manifest.close();
+}
+
+// Copies a deduplicated file back out of its store, for when it could not be
+// stored from here but another writer has already moved it there, leaving
+// nothing in the deduped directory to link to:
+static bool extract_deduplicated_file(const wchar_t *filename, const wchar_t *dedupe_filename)
+{
+	FrameAnalysisStore *store = get_dedupe_store(dedupe_filename);
+	std::vector<uint8_t> contents;
+	FILE *fd = NULL;
+	errno_t err;
+
+	if (!store->is_open() || !store->read(dedupe_store_key(dedupe_filename), &contents)) {
+		FAWriterLogErr("%S is missing from the deduped directory and %S, unable to dump %S\n",
+				dedupe_filename, store->get_path().c_str(), filename);
+		return false;
+	}
+
+	err = wfopen_ensuring_access(&fd, filename, L"wb");
+	if (!fd) {
+		FAWriterLogErr("Unable to create %S: %u\n", filename, err);
+		return false;
+	}
+	fwrite(contents.data(), 1, contents.size(), fd);
+	fclose(fd);
+
+	return true;
+}
+
+// Rotating a deduplicated file moves it out of the way for a moment, so only
+// one thread can be linking to them at a time:
+static std::mutex link_deduplicated_files_lock;
+
+// wrote is set if the caller was the one to write dedupe_filename, rather
+// than finding it already there:
+static void link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename,
+		FrameAnalysisOptions analyse_options, bool wrote)
+{
+	if (analyse_options & FrameAnalysisOptions::STORE_DEDUPED) {
+		if (store_deduplicated_file(filename, dedupe_filename, wrote))
+			return;
+
+		// Linking now would leave a dangling link if another writer
+		// has stored and deleted the file since this one wrote it:
+		if (GetFileAttributes(dedupe_filename) == INVALID_FILE_ATTRIBUTES) {
+			extract_deduplicated_file(filename, dedupe_filename);
+			return;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(link_deduplicated_files_lock);
 	wchar_t relative_path[MAX_PATH] = {0};
 
 	// Bail if source didn't get created:
@@ -2294,7 +2762,7 @@ void FrameAnalysisContext::link_deduplicated_files(const wchar_t *filename, cons
 		}
 
 		// May fail if developer mode is not enabled on Windows 10:
-		FALogErr("Symlinking %S -> %S failed (0x%u), trying hard link\n",
+		FAWriterLogErr("Symlinking %S -> %S failed (0x%u), trying hard link\n",
 				filename, relative_path, GetLastError());
 	}
 
@@ -2320,7 +2788,7 @@ void FrameAnalysisContext::link_deduplicated_files(const wchar_t *filename, cons
 	if (MoveFile(dedupe_filename, filename))
 		return;
 
-	FALogErr("All attempts to link deduplicated file failed, giving up: %S -> %S\n",
+	FAWriterLogErr("All attempts to link deduplicated file failed, giving up: %S -> %S\n",
 			filename, dedupe_filename);
 }
 
@@ -2,6 +2,7 @@
 
 #include <d3d11_1.h>
 #include "HackerContext.h"
+#include "FrameAnalysisTrace.h"
 
 // {2AEE5B3A-68ED-44E9-AA4D-9EAA6315D72B}
 DEFINE_GUID(IID_FrameAnalysisContext,
@@ -89,6 +90,8 @@ typedef std::unique_ptr<FrameAnalysisDeferredTex2D> FrameAnalysisDeferredTex2DPt
 class FrameAnalysisContext : public HackerContext
 {
 private:
+	void FrameAnalysisLogAppend(char *fmt, ...);
+	void FrameAnalysisLogSlot(int slot, char *slot_name);
 	template <class ID3D11Shader>
 	void FrameAnalysisLogShaderHash(ID3D11Shader *shader);
 	void FrameAnalysisLogResourceHash(ID3D11Resource *resource);
@@ -100,6 +103,10 @@ private:
 	void FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async);
 	void FrameAnalysisLogData(void *buf, UINT size);
 	FILE *frame_analysis_log;
+	// With analyse_binary_log, the log is written to frame_analysis_log
+	// through this instead of with fprintf:
+	bool frame_analysis_log_binary;
+	FrameAnalysisTraceWriter frame_analysis_trace;
 	unsigned draw_call;
 	unsigned non_draw_call_dump_counter;
 
@@ -123,15 +130,6 @@ private:
 		D3D11_TEXTURE2D_DESC desc, bool stereo, bool msaa, DXGI_FORMAT format);
 
 	void DumpStereoResource(ID3D11Texture2D *resource, wchar_t *filename, DXGI_FORMAT format);
-	void DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
-			UINT size, char type, int idx, UINT stride, UINT offset);
-	void DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
-			UINT size, int idx, UINT stride, UINT offset,
-			UINT first, UINT count, ID3DBlob *layout,
-			D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info);
-	void DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
-			UINT size, DXGI_FORMAT ib_fmt, UINT offset,
-			UINT first, UINT count, D3D11_PRIMITIVE_TOPOLOGY topology);
 
 	void DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
 			FrameAnalysisOptions buf_type_mask, int idx, DXGI_FORMAT ib_fmt,
@@ -166,8 +164,6 @@ private:
 	void DumpRenderTargets();
 	void DumpDepthStencilTargets();
 	void DumpUAVs(bool compute);
-	template <typename DescType>
-	void DumpDesc(DescType *desc, const wchar_t *filename);
 
 	void dump_deferred_resources(ID3D11CommandList *command_list);
 	void finish_deferred_resources(ID3D11CommandList *command_list);
@@ -179,10 +175,6 @@ private:
 	const wchar_t* dedupe_tex2d_filename(ID3D11Texture2D *resource,
 			D3D11_TEXTURE2D_DESC *desc, wchar_t *dedupe_filename,
 			size_t size, const wchar_t *traditional_filename, DXGI_FORMAT format);
-	void dedupe_buf_filename(ID3D11Buffer *resource,
-			D3D11_BUFFER_DESC *orig_desc,
-			D3D11_MAPPED_SUBRESOURCE *map,
-			wchar_t *dedupe_filename, size_t size);
 	void dedupe_buf_filename_txt(const wchar_t *bin_filename,
 			wchar_t *txt_filename, size_t size, char type, int idx,
 			UINT stride, UINT offset);
@@ -193,9 +185,6 @@ private:
 	void dedupe_buf_filename_ib_txt(const wchar_t *bin_filename,
 			wchar_t *txt_filename, size_t size, DXGI_FORMAT ib_fmt,
 			UINT offset, UINT first, UINT count, D3D11_PRIMITIVE_TOPOLOGY topology);
-	void link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename);
-	void rotate_when_nearing_hard_link_limit(const wchar_t *dedupe_filename);
-	void rotate_deduped_file(const wchar_t *dedupe_filename);
 	void get_deduped_dir(wchar_t *path, size_t size);
 
 	void determine_vb_count(UINT *count, ID3D11Buffer *staged_ib_for_vb,
@@ -1286,3 +1275,8 @@ public:
 		_In_reads_opt_(NumRects)  const D3D11_RECT *pRects,
 		UINT NumRects);
 };
+
+// Called when a frame analysis ends to wait for G->frame_analysis_writer to
+// write out every buffer dumped during it, or to throw away those it hasn't
+// started on if it was aborted:
+void FrameAnalysisFinishWriting(bool aborted);
@@ -0,0 +1,831 @@
+#include "FrameAnalysisStore.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <intrin.h>
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#include <sys/types.h>
+#include <unistd.h>
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+#include "crc32c.h"
+
+// ----------------------------------------------------------------------------
+// LZ4 block format
+// ----------------------------------------------------------------------------
+
+// Limits from the block format specification: the last match has to start
+// at least 12 bytes before the end of the block, and the last 5 bytes are
+// always literals.
+#define LZ4_MIN_MATCH 4
+#define LZ4_MF_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 14
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, 4);
+	return val;
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, 8);
+	return val;
+}
+
+// Index of the lowest non-zero byte of a non-zero value
+static inline unsigned lowest_byte_set(uint64_t val)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long bit;
+
+	_BitScanForward64(&bit, val);
+	return bit / 8;
+#elif defined(_MSC_VER)
+	unsigned long bit;
+
+	if (_BitScanForward(&bit, (uint32_t)val))
+		return bit / 8;
+	_BitScanForward(&bit, (uint32_t)(val >> 32));
+	return 4 + bit / 8;
+#else
+	return __builtin_ctzll(val) / 8;
+#endif
+}
+
+// Number of bytes from a that match b, stopping at a_limit. Compares 8 bytes
+// at a time, which takes most of the time compressing long matches would
+// otherwise spend.
+static inline size_t lz4_count(const uint8_t *a, const uint8_t *b, const uint8_t *a_limit)
+{
+	const uint8_t *start = a;
+	uint64_t diff;
+
+	while (a + 8 <= a_limit) {
+		diff = read64(a) ^ read64(b);
+		if (diff)
+			return a - start + lowest_byte_set(diff);
+		a += 8;
+		b += 8;
+	}
+	while (a < a_limit && *a == *b) {
+		a++;
+		b++;
+	}
+	return a - start;
+}
+
+static inline uint32_t lz4_hash(uint32_t seq)
+{
+	return (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+size_t lz4_compress_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+// Writes a length that did not fit in its 4 bits of the token as a run of
+// 255s and the remainder:
+static inline uint8_t* lz4_write_length(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+static uint8_t* lz4_write_literals(uint8_t *op, const uint8_t *literals, size_t len)
+{
+	uint8_t *token = op++;
+
+	if (len >= 15) {
+		*token = 15 << 4;
+		op = lz4_write_length(op, len - 15);
+	} else {
+		*token = (uint8_t)(len << 4);
+	}
+	memcpy(op, literals, len);
+	return op + len;
+}
+
+size_t lz4_compress(const void *src_v, size_t size, void *dst_v, size_t capacity)
+{
+	const uint8_t *src = (const uint8_t*)src_v;
+	uint8_t *dst = (uint8_t*)dst_v;
+	uint8_t *op = dst, *dst_end = dst + capacity, *token;
+	uint32_t table[1 << LZ4_HASH_BITS] = {};
+	size_t ip, anchor = 0, ref, len, match_limit, lit;
+	unsigned misses = 0;
+	uint32_t h;
+
+	if (size > LZ4_MF_LIMIT) {
+		match_limit = size - LZ4_LAST_LITERALS;
+		ip = 1;
+		table[lz4_hash(read32(src))] = 0;
+
+		while (ip <= size - LZ4_MF_LIMIT) {
+			h = lz4_hash(read32(src + ip));
+			ref = table[h];
+			table[h] = (uint32_t)ip;
+
+			if (ip - ref > LZ4_MAX_OFFSET || ref >= ip || read32(src + ref) != read32(src + ip)) {
+				// Step further the longer it has been since the
+				// last match, so data that does not compress
+				// is skipped over quickly:
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			// Extend the match backwards into the literals, then
+			// forwards as far as it goes:
+			while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+				ip--;
+				ref--;
+			}
+			len = LZ4_MIN_MATCH + lz4_count(src + ip + LZ4_MIN_MATCH,
+					src + ref + LZ4_MIN_MATCH, src + match_limit);
+
+			lit = ip - anchor;
+			if ((size_t)(dst_end - op) < lit + lit / 255 + 8 + len / 255)
+				return 0;
+			token = op;
+			op = lz4_write_literals(op, src + anchor, lit);
+			*op++ = (uint8_t)(ip - ref);
+			*op++ = (uint8_t)((ip - ref) >> 8);
+			if (len - LZ4_MIN_MATCH >= 15) {
+				*token |= 15;
+				op = lz4_write_length(op, len - LZ4_MIN_MATCH - 15);
+			} else {
+				*token |= (uint8_t)(len - LZ4_MIN_MATCH);
+			}
+
+			ip += len;
+			anchor = ip;
+			if (ip <= size - LZ4_MF_LIMIT)
+				table[lz4_hash(read32(src + ip - 2))] = (uint32_t)(ip - 2);
+		}
+	}
+
+	lit = size - anchor;
+	if ((size_t)(dst_end - op) < lit + lit / 255 + 2)
+		return 0;
+	op = lz4_write_literals(op, src + anchor, lit);
+
+	return op - dst;
+}
+
+static inline bool lz4_read_length(const uint8_t *src, size_t size, size_t *ip, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= size)
+			return false;
+		b = src[(*ip)++];
+		*len += b;
+	} while (b == 255);
+
+	return true;
+}
+
+bool lz4_decompress(const void *src_v, size_t size, void *dst_v, size_t raw_size)
+{
+	const uint8_t *src = (const uint8_t*)src_v;
+	uint8_t *dst = (uint8_t*)dst_v;
+	size_t ip = 0, op = 0, lit, len, offset, i;
+	uint8_t token;
+
+	while (true) {
+		if (ip >= size)
+			return false;
+		token = src[ip++];
+
+		lit = token >> 4;
+		if (lit == 15 && !lz4_read_length(src, size, &ip, &lit))
+			return false;
+		if (lit > size - ip || lit > raw_size - op)
+			return false;
+		// Most sequences are short, and copying a fixed 16 bytes
+		// where there is room is much faster than an exact copy.
+		// Anything past the end is written over by what comes next:
+		if (lit <= 16 && size - ip >= 16 && raw_size - op >= 16)
+			memcpy(dst + op, src + ip, 16);
+		else
+			memcpy(dst + op, src + ip, lit);
+		ip += lit;
+		op += lit;
+
+		// The last sequence is only literals:
+		if (ip == size)
+			return op == raw_size;
+
+		if (size - ip < 2)
+			return false;
+		offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (!offset || offset > op)
+			return false;
+
+		len = token & 15;
+		if (len == 15 && !lz4_read_length(src, size, &ip, &len))
+			return false;
+		len += LZ4_MIN_MATCH;
+		if (len > raw_size - op)
+			return false;
+
+		if (offset >= 16 && len <= 16 && raw_size - op >= 16) {
+			memcpy(dst + op, dst + op - offset, 16);
+		} else if (offset >= len) {
+			memcpy(dst + op, dst + op - offset, len);
+		} else if (offset == 1) {
+			memset(dst + op, dst[op - 1], len);
+		} else {
+			// Overlapping, so copied in pieces no longer than the
+			// offset, each of which repeats what came before:
+			for (i = 0; i + offset <= len; i += offset)
+				memcpy(dst + op + i, dst + op - offset, offset);
+			memcpy(dst + op + i, dst + op - offset, len - i);
+		}
+		op += len;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Store file
+// ----------------------------------------------------------------------------
+
+// The store starts with this header, followed by the records one after
+// another, each a RecordHeader, the key, then the payload:
+static const char store_magic[8] = { '3', 'D', 'M', 'F', 'A', 'S', 'T', 'R' };
+static const uint32_t store_format = 1;
+
+struct StoreHeader {
+	char magic[8];
+	uint32_t format;
+	uint32_t reserved;
+};
+
+static const uint32_t record_magic = 0x42414633; // "3FAB"
+
+struct RecordHeader {
+	uint32_t magic;
+	uint32_t checksum; // crc32c of everything that follows, key and payload included
+	uint32_t raw_size;
+	uint32_t stored_size;
+	uint16_t key_len;
+	uint8_t method;
+	uint8_t reserved;
+};
+
+static_assert(sizeof(RecordHeader) == 20, "RecordHeader is written to disk and must not have padding");
+
+// Keys are file names, so a record that claims a longer one is garbage:
+static const uint16_t max_key_len = 1024;
+
+static uint64_t record_span(const RecordHeader &header)
+{
+	return sizeof(RecordHeader) + (uint64_t)header.key_len + header.stored_size;
+}
+
+static uint32_t record_checksum(const RecordHeader &header, const char *key, const void *payload)
+{
+	uint32_t crc;
+
+	crc = crc32c_append(0, (const uint8_t*)&header.raw_size,
+			sizeof(header) - offsetof(RecordHeader, raw_size));
+	crc = crc32c_append(crc, (const uint8_t*)key, header.key_len);
+	return crc32c_append(crc, (const uint8_t*)payload, header.stored_size);
+}
+
+static bool truncate_file(FILE *fp, uint64_t size)
+{
+	fflush(fp);
+#ifdef _WIN32
+	return !_chsize_s(_fileno(fp), size);
+#else
+	return !ftruncate(fileno(fp), (off_t)size);
+#endif
+}
+
+FrameAnalysisStore::FrameAnalysisStore() :
+	fp(NULL),
+	read_only(false),
+	end(0),
+	write_failed(false),
+	stats()
+{}
+
+FrameAnalysisStore::~FrameAnalysisStore()
+{
+	close();
+}
+
+// Builds the index from the record headers and keys without reading the
+// payloads, which are verified as each one is first read instead.
+bool FrameAnalysisStore::load()
+{
+	StoreHeader store;
+	RecordHeader header;
+	uint64_t size, offset, span;
+	std::string key;
+
+	fseek64(fp, 0, SEEK_END);
+	size = ftell64(fp);
+	fseek64(fp, 0, SEEK_SET);
+
+	if (size < sizeof(StoreHeader)
+			|| fread(&store, sizeof(store), 1, fp) != 1
+			|| memcmp(store.magic, store_magic, sizeof(store_magic))
+			|| store.format != store_format) {
+		// New, or not a store this version understands. Start over:
+		if (read_only)
+			return false;
+		memset(&store, 0, sizeof(store));
+		memcpy(store.magic, store_magic, sizeof(store_magic));
+		store.format = store_format;
+		if (!truncate_file(fp, 0) || fseek64(fp, 0, SEEK_SET)
+				|| fwrite(&store, sizeof(store), 1, fp) != 1
+				|| fflush(fp))
+			return false;
+		end = sizeof(store);
+		return true;
+	}
+
+	for (offset = sizeof(StoreHeader); offset + sizeof(RecordHeader) <= size; offset += span) {
+		if (fseek64(fp, offset, SEEK_SET) || fread(&header, sizeof(header), 1, fp) != 1)
+			break;
+		if (header.magic != record_magic || !header.key_len || header.key_len > max_key_len
+				|| header.method > (uint8_t)FrameAnalysisStoreMethod::LZ4)
+			break;
+		span = record_span(header);
+		if (offset + span > size)
+			break;
+		key.resize(header.key_len);
+		if (fread(&key[0], 1, header.key_len, fp) != header.key_len)
+			break;
+
+		// Only a damaged record that was added again can have a
+		// record for its key already:
+		auto i = index.find(key);
+		if (i != index.end()) {
+			stats.raw_bytes -= i->second.raw_size;
+			stats.stored_bytes -= sizeof(RecordHeader) + key.size() + i->second.stored_size;
+		} else
+			stats.blobs++;
+		Blob &blob = index[key];
+		blob.offset = offset;
+		blob.raw_size = header.raw_size;
+		blob.stored_size = header.stored_size;
+		blob.method = (FrameAnalysisStoreMethod)header.method;
+		blob.verified = false;
+		stats.raw_bytes += header.raw_size;
+		stats.stored_bytes += span;
+	}
+
+	end = offset;
+	stats.discarded = size - offset;
+
+	// Cut off anything after the last intact record, so that a record
+	// written over a longer torn one can't leave part of it behind to be
+	// mistaken for another record the next time:
+	if (stats.discarded && !read_only)
+		return truncate_file(fp, end);
+	return true;
+}
+
+bool FrameAnalysisStore::open(const wchar_t *path, bool read_only)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (fp)
+		fclose(fp);
+	index.clear();
+	stats = FrameAnalysisStoreStats();
+	write_failed = false;
+	end = 0;
+
+	this->path = path;
+	this->read_only = read_only;
+
+	fp = frame_analysis_store_fopen(this->path, read_only ? "rb" : "r+b");
+	if (!fp && !read_only)
+		fp = frame_analysis_store_fopen(this->path, "w+b");
+	if (!fp)
+		return false;
+
+	// Most records are small text files, so buffer them up rather than
+	// writing each one as it is added:
+	setvbuf(fp, NULL, _IOFBF, 256 * 1024);
+
+	if (!load()) {
+		fclose(fp);
+		fp = NULL;
+		index.clear();
+		stats = FrameAnalysisStoreStats();
+		return false;
+	}
+	return true;
+}
+
+void FrameAnalysisStore::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (fp)
+		fclose(fp);
+	fp = NULL;
+	index.clear();
+	end = 0;
+}
+
+bool FrameAnalysisStore::is_open()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return !!fp;
+}
+
+const std::wstring& FrameAnalysisStore::get_path()
+{
+	return path;
+}
+
+bool FrameAnalysisStore::contains(const std::string &key)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return index.count(key) != 0;
+}
+
+bool FrameAnalysisStore::add(const std::string &key, const void *data, size_t size)
+{
+	std::vector<uint8_t> compressed;
+	RecordHeader header = {};
+	const void *payload = data;
+	size_t compressed_size;
+
+	if (key.empty() || key.size() > max_key_len || size > UINT32_MAX)
+		return false;
+
+	if (contains(key)) {
+		std::lock_guard<std::mutex> guard(lock);
+		stats.duplicates++;
+		return true;
+	}
+
+	header.magic = record_magic;
+	header.raw_size = (uint32_t)size;
+	header.stored_size = (uint32_t)size;
+	header.key_len = (uint16_t)key.size();
+	header.method = (uint8_t)FrameAnalysisStoreMethod::STORED;
+
+	compressed.resize(lz4_compress_bound(size));
+	compressed_size = lz4_compress(data, size, compressed.data(), compressed.size());
+	if (compressed_size && compressed_size < size) {
+		header.stored_size = (uint32_t)compressed_size;
+		header.method = (uint8_t)FrameAnalysisStoreMethod::LZ4;
+		payload = compressed.data();
+	}
+	header.checksum = record_checksum(header, key.data(), payload);
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (!fp || read_only || write_failed)
+		return false;
+
+	// Another thread may have added it while this one was compressing:
+	if (index.count(key)) {
+		stats.duplicates++;
+		return true;
+	}
+
+	if (fseek64(fp, end, SEEK_SET)
+			|| fwrite(&header, sizeof(header), 1, fp) != 1
+			|| fwrite(key.data(), 1, key.size(), fp) != key.size()
+			|| fwrite(payload, 1, header.stored_size, fp) != header.stored_size) {
+		// Leave the rest of the file alone. The partial record will be
+		// cut off when it is next opened:
+		write_failed = true;
+		return false;
+	}
+
+	Blob &blob = index[key];
+	blob.offset = end;
+	blob.raw_size = header.raw_size;
+	blob.stored_size = header.stored_size;
+	blob.method = (FrameAnalysisStoreMethod)header.method;
+	blob.verified = true;
+
+	end += record_span(header);
+	stats.blobs++;
+	stats.added++;
+	stats.raw_bytes += header.raw_size;
+	stats.stored_bytes += record_span(header);
+
+	return true;
+}
+
+bool FrameAnalysisStore::read_blob(const Blob &blob, size_t key_len, std::vector<uint8_t> *data)
+{
+	data->resize(sizeof(RecordHeader) + key_len + blob.stored_size);
+	return !fseek64(fp, blob.offset, SEEK_SET)
+		&& fread(data->data(), 1, data->size(), fp) == data->size();
+}
+
+bool FrameAnalysisStore::read(const std::string &key, std::vector<uint8_t> *data)
+{
+	std::vector<uint8_t> record;
+	FrameAnalysisStoreMethod method;
+	RecordHeader header;
+	const uint8_t *payload;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		auto i = index.find(key);
+		if (!fp || i == index.end())
+			return false;
+		Blob &blob = i->second;
+
+		if (!read_blob(blob, key.size(), &record))
+			return false;
+		memcpy(&header, record.data(), sizeof(header));
+
+		if (!blob.verified) {
+			if (header.checksum != record_checksum(header, key.data(),
+					record.data() + sizeof(header) + key.size())) {
+				// Forget it, so that it will be added again
+				// the next time it is dumped:
+				stats.blobs--;
+				stats.raw_bytes -= blob.raw_size;
+				stats.stored_bytes -= record.size();
+				index.erase(i);
+				return false;
+			}
+			blob.verified = true;
+		}
+		method = blob.method;
+	}
+
+	payload = record.data() + sizeof(header) + key.size();
+	if (method == FrameAnalysisStoreMethod::STORED) {
+		data->assign(payload, payload + header.stored_size);
+		return true;
+	}
+
+	data->resize(header.raw_size);
+	return lz4_decompress(payload, header.stored_size, data->data(), header.raw_size);
+}
+
+void FrameAnalysisStore::flush()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (fp)
+		fflush(fp);
+}
+
+FrameAnalysisStoreStats FrameAnalysisStore::get_stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
+
+// ----------------------------------------------------------------------------
+// Manifest
+// ----------------------------------------------------------------------------
+
+static const char manifest_header[] = "3DMigoto frame analysis manifest 1";
+
+FrameAnalysisManifest::FrameAnalysisManifest() :
+	fp(NULL)
+{}
+
+FrameAnalysisManifest::~FrameAnalysisManifest()
+{
+	close();
+}
+
+bool FrameAnalysisManifest::open(const wchar_t *path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (fp)
+		fclose(fp);
+	cur_store.clear();
+
+	fp = frame_analysis_store_fopen(path, "ab");
+	if (!fp)
+		return false;
+
+	fseek64(fp, 0, SEEK_END);
+	if (!ftell64(fp))
+		fprintf(fp, "%s\n", manifest_header);
+	return true;
+}
+
+void FrameAnalysisManifest::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (fp)
+		fclose(fp);
+	fp = NULL;
+}
+
+bool FrameAnalysisManifest::is_open()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return !!fp;
+}
+
+void FrameAnalysisManifest::add(const std::wstring &store, const std::string &key, const wchar_t *name)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (!fp)
+		return;
+
+	if (store != cur_store) {
+		fprintf(fp, "store\t%s\n", frame_analysis_store_utf8(store.c_str(), store.size()).c_str());
+		cur_store = store;
+	}
+	fprintf(fp, "%s\t%s\n", key.c_str(), frame_analysis_store_utf8(name, wcslen(name)).c_str());
+}
+
+bool read_frame_analysis_manifest(const wchar_t *path,
+		std::vector<FrameAnalysisManifestEntry> *entries)
+{
+	std::vector<char> text;
+	std::wstring store;
+	const char *pos, *end, *eol, *tab, *line_end;
+	FrameAnalysisManifestEntry entry;
+	FILE *fp;
+	size_t n;
+
+	fp = frame_analysis_store_fopen(path, "rb");
+	if (!fp)
+		return false;
+	text.resize(64 * 1024);
+	n = 0;
+	while (true) {
+		n += fread(text.data() + n, 1, text.size() - n, fp);
+		if (n < text.size())
+			break;
+		text.resize(text.size() * 2);
+	}
+	fclose(fp);
+
+	pos = text.data();
+	end = pos + n;
+	if ((size_t)(end - pos) < sizeof(manifest_header) - 1
+			|| memcmp(pos, manifest_header, sizeof(manifest_header) - 1))
+		return false;
+
+	entries->clear();
+	for (; pos < end; pos = eol + 1) {
+		eol = (const char*)memchr(pos, '\n', end - pos);
+		if (!eol)
+			eol = end;
+		line_end = eol;
+		if (line_end > pos && line_end[-1] == '\r')
+			line_end--;
+
+		tab = (const char*)memchr(pos, '\t', line_end - pos);
+		if (!tab)
+			continue;
+
+		if (tab - pos == 5 && !memcmp(pos, "store", 5)) {
+			store = frame_analysis_store_widen(tab + 1, line_end - tab - 1);
+			continue;
+		}
+
+		entry.store = store;
+		entry.key.assign(pos, tab);
+		entry.name = frame_analysis_store_widen(tab + 1, line_end - tab - 1);
+		entries->push_back(entry);
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Paths
+// ----------------------------------------------------------------------------
+
+std::string frame_analysis_store_utf8(const wchar_t *str, size_t len)
+{
+	std::string ret;
+	uint32_t c;
+	size_t i;
+
+	ret.reserve(len);
+	for (i = 0; i < len; i++) {
+		c = (uint32_t)str[i];
+		if (sizeof(wchar_t) == 2 && c >= 0xd800 && c < 0xdc00 && i + 1 < len
+				&& (uint32_t)str[i + 1] >= 0xdc00 && (uint32_t)str[i + 1] < 0xe000) {
+			c = 0x10000 + ((c - 0xd800) << 10) + ((uint32_t)str[i + 1] - 0xdc00);
+			i++;
+		}
+
+		if (c < 0x80) {
+			ret += (char)c;
+		} else if (c < 0x800) {
+			ret += (char)(0xc0 | (c >> 6));
+			ret += (char)(0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			ret += (char)(0xe0 | (c >> 12));
+			ret += (char)(0x80 | ((c >> 6) & 0x3f));
+			ret += (char)(0x80 | (c & 0x3f));
+		} else {
+			ret += (char)(0xf0 | (c >> 18));
+			ret += (char)(0x80 | ((c >> 12) & 0x3f));
+			ret += (char)(0x80 | ((c >> 6) & 0x3f));
+			ret += (char)(0x80 | (c & 0x3f));
+		}
+	}
+
+	return ret;
+}
+
+std::wstring frame_analysis_store_widen(const char *str, size_t len)
+{
+	const uint8_t *s = (const uint8_t*)str;
+	std::wstring ret;
+	uint32_t c;
+	size_t i, n, j;
+
+	ret.reserve(len);
+	for (i = 0; i < len; i += n) {
+		c = s[i];
+		if (c < 0x80) {
+			n = 1;
+		} else if (c >= 0xc2 && c < 0xe0) {
+			n = 2;
+			c &= 0x1f;
+		} else if (c >= 0xe0 && c < 0xf0) {
+			n = 3;
+			c &= 0x0f;
+		} else if (c >= 0xf0 && c < 0xf5) {
+			n = 4;
+			c &= 0x07;
+		} else {
+			ret += (wchar_t)0xfffd;
+			n = 1;
+			continue;
+		}
+
+		if (i + n > len) {
+			ret += (wchar_t)0xfffd;
+			n = 1;
+			continue;
+		}
+		for (j = 1; j < n && (s[i + j] & 0xc0) == 0x80; j++)
+			c = (c << 6) | (s[i + j] & 0x3f);
+		if (j < n) {
+			ret += (wchar_t)0xfffd;
+			n = 1;
+			continue;
+		}
+
+		if (sizeof(wchar_t) == 2 && c >= 0x10000) {
+			ret += (wchar_t)(0xd800 + ((c - 0x10000) >> 10));
+			ret += (wchar_t)(0xdc00 + ((c - 0x10000) & 0x3ff));
+		} else {
+			ret += (wchar_t)c;
+		}
+	}
+
+	return ret;
+}
+
+FILE* frame_analysis_store_fopen(const std::wstring &path, const char *mode)
+{
+#ifdef _WIN32
+	wchar_t wmode[8];
+	size_t i;
+
+	for (i = 0; mode[i] && i < 7; i++)
+		wmode[i] = mode[i];
+	wmode[i] = 0;
+	return _wfopen(path.c_str(), wmode);
+#else
+	return fopen(frame_analysis_store_utf8(path.c_str(), path.size()).c_str(), mode);
+#endif
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A content addressed store for the deduplicated files of a frame analysis,
+// used in place of the deduped directory when analyse_options includes
+// store_dupes. A frame with a few thousand draw calls dumps tens of
+// thousands of files, nearly all of which are hard links (or shortcuts, or
+// symlinks) to a much smaller number of unique files. Creating the links
+// takes a large part of the time a frame analysis takes, NTFS only allows
+// 1023 links to each file, and the unique files are kept uncompressed.
+//
+// Instead, each unique file is compressed with LZ4 and appended to a single
+// store file, keyed by the name it would have had in the deduped directory,
+// which starts with the crc32c hash of its contents. Every dumped file is
+// then recorded as one line in a manifest in the frame analysis directory,
+// naming the file it would have been and the key of its contents in the
+// store. fa_store_extract recreates the files from the manifest on demand.
+//
+// Like ShaderCachePack, the index is built when the store is opened by
+// walking the record headers, each record has a checksum that is verified
+// the first time it is read, and a record cut short by a crash is cut off
+// the end of the file.
+//
+// This depends on nothing from D3D or the rest of 3DMigoto so that
+// TestFrameAnalysisStore can check and benchmark it.
+
+// LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+// with a greedy single probe match finder. The tree has no compression
+// library to link against, and this is all the store needs of one.
+size_t lz4_compress_bound(size_t size);
+// Returns the compressed size, or 0 if it would not fit in capacity
+size_t lz4_compress(const void *src, size_t size, void *dst, size_t capacity);
+// Returns false if src is not a block that decompresses to exactly raw_size
+// bytes. Never reads or writes out of bounds, however src is damaged.
+bool lz4_decompress(const void *src, size_t size, void *dst, size_t raw_size);
+
+enum class FrameAnalysisStoreMethod : uint8_t {
+	STORED = 0, // Did not get any smaller
+	LZ4 = 1,
+};
+
+struct FrameAnalysisStoreStats {
+	uint32_t blobs;
+	uint64_t raw_bytes;    // Of the blobs before compression
+	uint64_t stored_bytes; // Of the blobs in the file, with their headers
+	uint64_t discarded;    // Bytes after the last intact record at open
+	uint32_t added;
+	uint32_t duplicates;   // Adds of a key that was already stored
+};
+
+class FrameAnalysisStore {
+	struct Blob {
+		uint64_t offset;   // Of the record header
+		uint32_t raw_size;
+		uint32_t stored_size;
+		FrameAnalysisStoreMethod method;
+		bool verified;     // Checksum has been checked
+	};
+
+	std::mutex lock;
+	std::wstring path;
+	FILE *fp;
+	bool read_only;
+	uint64_t end; // Where the next record will be written
+	bool write_failed;
+
+	std::unordered_map<std::string, Blob> index;
+	FrameAnalysisStoreStats stats;
+
+	bool load();
+	bool read_blob(const Blob &blob, size_t key_len, std::vector<uint8_t> *data);
+
+public:
+	FrameAnalysisStore();
+	~FrameAnalysisStore();
+
+	// Opens the store, creating it if it does not exist or starting it
+	// over if it is not one this version understands, unless read_only.
+	bool open(const wchar_t *path, bool read_only = false);
+	void close();
+	bool is_open();
+	const std::wstring& get_path();
+
+	bool contains(const std::string &key);
+
+	// Compresses the data and appends it unless the key is already
+	// stored. The compression happens outside the lock, so this can be
+	// called from several threads at once. Returns true if the key is
+	// stored afterwards.
+	bool add(const std::string &key, const void *data, size_t size);
+
+	// Copies out the decompressed contents stored for key. Returns false
+	// if there are none, or they are damaged.
+	bool read(const std::string &key, std::vector<uint8_t> *data);
+
+	// Writes out anything still buffered, so the records added so far
+	// survive a crash.
+	void flush();
+
+	FrameAnalysisStoreStats get_stats();
+};
+
+// Name of the store in a deduped directory, and of the manifest in a frame
+// analysis directory:
+#define FRAME_ANALYSIS_STORE_NAME L"deduped.fastore"
+#define FRAME_ANALYSIS_MANIFEST_NAME L"manifest.txt"
+
+// The manifest is a UTF-8 text file. After a header line, a "store" line
+// names the store that the lines after it refer to, relative to the frame
+// analysis directory unless it is an absolute path. It is repeated when a
+// dump command switches to or from share_dupes. Every other line is the key
+// of a blob in that store and the name of the file that would have linked to
+// it, relative to the frame analysis directory, separated by a tab:
+//
+//   3DMigoto frame analysis manifest 1
+//   store	deduped\deduped.fastore
+//   8c2e01d7.buf	000001-vb0=1d3e05a4-vs=a1c3c2c1cf64c2d4-ps=e1b53da2f6ef0f4e.buf
+//
+// The lines are in the order the files were dumped, which keeps each draw
+// call's files together.
+struct FrameAnalysisManifestEntry {
+	std::wstring store;  // As it was written in the manifest
+	std::string key;
+	std::wstring name;
+};
+
+class FrameAnalysisManifest {
+	std::mutex lock;
+	FILE *fp;
+	std::wstring cur_store;
+
+public:
+	FrameAnalysisManifest();
+	~FrameAnalysisManifest();
+
+	// Appends to the manifest if it already exists, as a hold mode frame
+	// analysis does for each frame
+	bool open(const wchar_t *path);
+	void close();
+	bool is_open();
+
+	void add(const std::wstring &store, const std::string &key, const wchar_t *name);
+};
+
+bool read_frame_analysis_manifest(const wchar_t *path,
+		std::vector<FrameAnalysisManifestEntry> *entries);
+
+// Conversions between the wide paths the rest of 3DMigoto uses and the UTF-8
+// of the store keys and the manifest:
+std::string frame_analysis_store_utf8(const wchar_t *str, size_t len);
+std::wstring frame_analysis_store_widen(const char *str, size_t len);
+
+// Opens a file by its wide path on either platform
+FILE* frame_analysis_store_fopen(const std::wstring &path, const char *mode);
@@ -0,0 +1,570 @@
+#include "FrameAnalysisText.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAME_ANALYSIS_TEXT_SSE2
+#endif
+
+// --- Decoding ---
+
+// The scalar decoders are the ones fprint_dxgi_format() has always used,
+// and the SSE2 versions below must give exactly the same bits. In
+// particular a subnormal half float is given the same mantissa but a zero
+// exponent, so it comes out as a far smaller subnormal float than it should
+// be. That is kept so dumps can still be compared with older ones, which is
+// why this does not use F16C to convert them.
+static uint32_t float16(uint16_t f16)
+{
+	// Shift sign and mantissa to new positions:
+	uint32_t f32 = ((f16 & 0x8000) << 16) | ((f16 & 0x3ff) << 13);
+	// Need to check special cases of the biased exponent:
+	int biased_exponent = (f16 & 0x7c00) >> 10;
+
+	if (biased_exponent == 0) {
+		// Zero / subnormal: New biased exponent remains zero
+	} else if (biased_exponent == 0x1f) {
+		// Infinity / NaN: New biased exponent is filled with 1s
+		f32 |= 0x7f800000;
+	} else {
+		// Normal number: Adjust the exponent bias:
+		biased_exponent = biased_exponent - 15 + 127;
+		f32 |= biased_exponent << 23;
+	}
+
+	return f32;
+}
+
+static uint32_t float_bits(float val)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	return bits;
+}
+
+static float unorm24(uint32_t val)
+{
+	return (float)val / (float)0xffffff;
+}
+
+static float unorm16(uint16_t val)
+{
+	return (float)val / (float)0xffff;
+}
+
+static float snorm16(int16_t val)
+{
+	return (float)val / (float)0x7fff;
+}
+
+static float unorm8(uint8_t val)
+{
+	return (float)val / (float)0xff;
+}
+
+static float snorm8(int8_t val)
+{
+	return (float)val / (float)0x7f;
+}
+
+static size_t component_size(FrameAnalysisTextType type)
+{
+	switch (type) {
+		case FrameAnalysisTextType::HEX32:
+		case FrameAnalysisTextType::FLOAT32:
+		case FrameAnalysisTextType::UINT32:
+		case FrameAnalysisTextType::SINT32:
+			return 4;
+		case FrameAnalysisTextType::HEX16:
+		case FrameAnalysisTextType::FLOAT16:
+		case FrameAnalysisTextType::UNORM16:
+		case FrameAnalysisTextType::SNORM16:
+		case FrameAnalysisTextType::UINT16:
+		case FrameAnalysisTextType::SINT16:
+			return 2;
+		default:
+			return 1;
+	}
+}
+
+size_t FrameAnalysisTextFormat::size() const
+{
+	switch (type) {
+		case FrameAnalysisTextType::FLOAT32_UINT8:
+			return 5;
+		case FrameAnalysisTextType::UNORM24_UINT8:
+			return 4;
+		default:
+			return components * component_size(type);
+	}
+}
+
+// Decodes n components packed one after the other
+static void decode_packed(FrameAnalysisTextType type, const uint8_t *src, size_t n, uint32_t *out)
+{
+	size_t i = 0;
+
+#ifdef FRAME_ANALYSIS_TEXT_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	switch (type) {
+		case FrameAnalysisTextType::UNORM8:
+		case FrameAnalysisTextType::SNORM8:
+		{
+			bool snorm = (type == FrameAnalysisTextType::SNORM8);
+			__m128 div = _mm_set1_ps(snorm ? (float)0x7f : (float)0xff);
+
+			for (; i + 16 <= n; i += 16) {
+				__m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+				__m128i w[2], d[4];
+				int j;
+
+				if (snorm) {
+					w[0] = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+					w[1] = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+					for (j = 0; j < 2; j++) {
+						d[j*2] = _mm_srai_epi32(_mm_unpacklo_epi16(w[j], w[j]), 16);
+						d[j*2+1] = _mm_srai_epi32(_mm_unpackhi_epi16(w[j], w[j]), 16);
+					}
+				} else {
+					w[0] = _mm_unpacklo_epi8(b, zero);
+					w[1] = _mm_unpackhi_epi8(b, zero);
+					for (j = 0; j < 2; j++) {
+						d[j*2] = _mm_unpacklo_epi16(w[j], zero);
+						d[j*2+1] = _mm_unpackhi_epi16(w[j], zero);
+					}
+				}
+				for (j = 0; j < 4; j++)
+					_mm_storeu_ps((float*)(out + i + j*4), _mm_div_ps(_mm_cvtepi32_ps(d[j]), div));
+			}
+			break;
+		}
+
+		case FrameAnalysisTextType::UNORM16:
+		case FrameAnalysisTextType::SNORM16:
+		{
+			bool snorm = (type == FrameAnalysisTextType::SNORM16);
+			__m128 div = _mm_set1_ps(snorm ? (float)0x7fff : (float)0xffff);
+
+			for (; i + 8 <= n; i += 8) {
+				__m128i w = _mm_loadu_si128((const __m128i*)(src + i*2));
+				__m128i lo, hi;
+
+				if (snorm) {
+					lo = _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16);
+					hi = _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16);
+				} else {
+					lo = _mm_unpacklo_epi16(w, zero);
+					hi = _mm_unpackhi_epi16(w, zero);
+				}
+				_mm_storeu_ps((float*)(out + i), _mm_div_ps(_mm_cvtepi32_ps(lo), div));
+				_mm_storeu_ps((float*)(out + i + 4), _mm_div_ps(_mm_cvtepi32_ps(hi), div));
+			}
+			break;
+		}
+
+		case FrameAnalysisTextType::FLOAT16:
+		{
+			const __m128i sign_mask = _mm_set1_epi32(0x8000);
+			const __m128i mantissa_mask = _mm_set1_epi32(0x3ff);
+			const __m128i exponent_mask = _mm_set1_epi32(0x7c00);
+			const __m128i exponent_bias = _mm_set1_epi32((127 - 15) << 23);
+			const __m128i infinity = _mm_set1_epi32(0x7f800000);
+
+			for (; i + 8 <= n; i += 8) {
+				__m128i w = _mm_loadu_si128((const __m128i*)(src + i*2));
+				__m128i h[2] = {_mm_unpacklo_epi16(w, zero), _mm_unpackhi_epi16(w, zero)};
+				int j;
+
+				for (j = 0; j < 2; j++) {
+					__m128i exponent = _mm_and_si128(h[j], exponent_mask);
+					__m128i f32 = _mm_or_si128(
+						_mm_slli_epi32(_mm_and_si128(h[j], sign_mask), 16),
+						_mm_slli_epi32(_mm_and_si128(h[j], mantissa_mask), 13));
+					__m128i is_zero = _mm_cmpeq_epi32(exponent, zero);
+					__m128i is_max = _mm_cmpeq_epi32(exponent, exponent_mask);
+					__m128i normal = _mm_add_epi32(_mm_slli_epi32(exponent, 13), exponent_bias);
+
+					// Zero / subnormal keep a zero exponent,
+					// infinity / NaN get all 1s, and anything
+					// else has the bias adjusted:
+					exponent = _mm_or_si128(_mm_and_si128(is_max, infinity),
+						_mm_andnot_si128(_mm_or_si128(is_zero, is_max), normal));
+					_mm_storeu_si128((__m128i*)(out + i + j*4), _mm_or_si128(f32, exponent));
+				}
+			}
+			break;
+		}
+
+		default:
+			break;
+	}
+#endif
+
+	for (; i < n; i++) {
+		const uint8_t *p = src + i * component_size(type);
+		uint16_t u16;
+		int16_t s16;
+		uint32_t u32;
+
+		switch (type) {
+			case FrameAnalysisTextType::HEX32:
+			case FrameAnalysisTextType::FLOAT32:
+			case FrameAnalysisTextType::UINT32:
+			case FrameAnalysisTextType::SINT32:
+				memcpy(&u32, p, 4);
+				out[i] = u32;
+				break;
+			case FrameAnalysisTextType::HEX16:
+			case FrameAnalysisTextType::UINT16:
+				memcpy(&u16, p, 2);
+				out[i] = u16;
+				break;
+			case FrameAnalysisTextType::SINT16:
+				memcpy(&s16, p, 2);
+				out[i] = (uint32_t)(int32_t)s16;
+				break;
+			case FrameAnalysisTextType::FLOAT16:
+				memcpy(&u16, p, 2);
+				out[i] = float16(u16);
+				break;
+			case FrameAnalysisTextType::UNORM16:
+				memcpy(&u16, p, 2);
+				out[i] = float_bits(unorm16(u16));
+				break;
+			case FrameAnalysisTextType::SNORM16:
+				memcpy(&s16, p, 2);
+				out[i] = float_bits(snorm16(s16));
+				break;
+			case FrameAnalysisTextType::UNORM8:
+				out[i] = float_bits(unorm8(*p));
+				break;
+			case FrameAnalysisTextType::SNORM8:
+				out[i] = float_bits(snorm8((int8_t)*p));
+				break;
+			case FrameAnalysisTextType::SINT8:
+				out[i] = (uint32_t)(int32_t)(int8_t)*p;
+				break;
+			default:
+				out[i] = *p;
+				break;
+		}
+	}
+}
+
+// Elements are copied next to each other in batches of this many, so that
+// an interleaved vertex buffer can be decoded with the same loops as a packed
+// one:
+static const size_t DECODE_BATCH = 256;
+
+void frame_analysis_text_decode(FrameAnalysisTextFormat format,
+		const void *src, size_t stride, size_t count, uint32_t *values)
+{
+	const uint8_t *in = (const uint8_t*)src;
+	uint8_t packed[DECODE_BATCH * 16];
+	size_t size = format.size();
+	size_t i, j, n;
+	uint32_t u32;
+
+	switch (format.type) {
+		case FrameAnalysisTextType::FLOAT32_UINT8:
+			for (i = 0; i < count; i++, in += stride, values += 2) {
+				memcpy(&values[0], in, 4);
+				values[1] = in[4];
+			}
+			return;
+		case FrameAnalysisTextType::UNORM24_UINT8:
+			for (i = 0; i < count; i++, in += stride, values += 2) {
+				memcpy(&u32, in, 4);
+				values[0] = float_bits(unorm24(u32 & 0xffffff));
+				values[1] = in[3];
+			}
+			return;
+		default:
+			break;
+	}
+
+	if (stride == size || count == 1) {
+		decode_packed(format.type, in, count * format.components, values);
+		return;
+	}
+
+	// RAW formats can be any size, and are rarely worth batching:
+	if (size > 16) {
+		for (i = 0; i < count; i++, in += stride, values += format.components)
+			decode_packed(format.type, in, format.components, values);
+		return;
+	}
+
+	for (i = 0; i < count; i += n) {
+		n = (std::min)(count - i, DECODE_BATCH);
+		for (j = 0; j < n; j++)
+			memcpy(packed + j * size, in + (i + j) * stride, size);
+		decode_packed(format.type, packed, n * format.components, values + i * format.components);
+	}
+}
+
+// --- Float formatting ---
+
+static const double POW10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Powers of ten up to 1e22 are exact in a double, so each step here only
+// rounds once. A float needs at most three steps to reach 9 digits:
+static double scale_pow10(double val, int exp10)
+{
+	while (exp10 > 22) {
+		val *= 1e22;
+		exp10 -= 22;
+	}
+	while (exp10 < -22) {
+		val /= 1e22;
+		exp10 += 22;
+	}
+	if (exp10 >= 0)
+		return val * POW10[exp10];
+	return val / POW10[-exp10];
+}
+
+static size_t format_float_printf(char *out, float val)
+{
+	int len = snprintf(out, FRAME_ANALYSIS_TEXT_FLOAT_MAX, "%.9g", val);
+
+	return (size_t)(std::max)((std::min)(len, FRAME_ANALYSIS_TEXT_FLOAT_MAX - 1), 0);
+}
+
+size_t frame_analysis_format_float(char *out, float val)
+{
+	double v = val, scaled, whole, frac;
+	char digits[9], *pos = out;
+	uint32_t n;
+	int exp2, exp10, ndigits, i;
+
+	if (!isfinite(v))
+		return format_float_printf(out, val);
+
+	if (signbit(v)) {
+		*pos++ = '-';
+		v = -v;
+	}
+	if (v == 0) {
+		*pos++ = '0';
+		return pos - out;
+	}
+
+	// Scale to a 9 digit integer part. This estimate of the decimal
+	// exponent is either right or one too small. Every float is exact as a
+	// double, and each scaling step is out by at most half an ulp, so the
+	// scaled value is within about 4e-7 of the exact one:
+	frexp(v, &exp2);
+	exp10 = (int)floor((exp2 - 1) * 0.30102999566398120);
+	scaled = scale_pow10(v, 8 - exp10);
+	if (scaled >= 1e9) {
+		exp10++;
+		scaled = scale_pow10(v, 8 - exp10);
+	}
+
+	// Which is far too small to matter unless it is about half way
+	// between two integers, where printf would round the exact value,
+	// ties to even or otherwise depending on the runtime:
+	whole = floor(scaled);
+	frac = scaled - whole;
+	if (fabs(frac - 0.5) < 1e-5)
+		return format_float_printf(out, val);
+	n = (uint32_t)whole + (frac > 0.5);
+	if (n >= 1000000000) {
+		// Rounded up to the next power of ten
+		n /= 10;
+		exp10++;
+	} else if (n < 100000000) {
+		// Shouldn't happen, but printf is always right
+		return format_float_printf(out, val);
+	}
+
+	for (i = 8; i >= 0; i--, n /= 10)
+		digits[i] = '0' + n % 10;
+	for (ndigits = 9; ndigits > 1 && digits[ndigits - 1] == '0'; ndigits--);
+
+	// %g picks %e style when the exponent is less than -4 or at least
+	// the precision, and drops trailing zeroes either way:
+	if (exp10 < -4 || exp10 >= 9) {
+		*pos++ = digits[0];
+		if (ndigits > 1) {
+			*pos++ = '.';
+			memcpy(pos, digits + 1, ndigits - 1);
+			pos += ndigits - 1;
+		}
+		*pos++ = 'e';
+		*pos++ = exp10 < 0 ? '-' : '+';
+		exp10 = exp10 < 0 ? -exp10 : exp10;
+		if (exp10 >= 100)
+			*pos++ = '0' + exp10 / 100;
+		*pos++ = '0' + exp10 / 10 % 10;
+		*pos++ = '0' + exp10 % 10;
+	} else if (exp10 < 0) {
+		*pos++ = '0';
+		*pos++ = '.';
+		for (i = exp10 + 1; i < 0; i++)
+			*pos++ = '0';
+		memcpy(pos, digits, ndigits);
+		pos += ndigits;
+	} else {
+		memcpy(pos, digits, exp10 + 1);
+		pos += exp10 + 1;
+		if (ndigits > exp10 + 1) {
+			*pos++ = '.';
+			memcpy(pos, digits + exp10 + 1, ndigits - exp10 - 1);
+			pos += ndigits - exp10 - 1;
+		}
+	}
+
+	return pos - out;
+}
+
+// --- Output ---
+
+FrameAnalysisTextBuffer::FrameAnalysisTextBuffer(FILE *fp, size_t capacity) :
+	fp(fp)
+{
+	// Room for the longest single value appended at a time:
+	capacity = (std::max)(capacity, (size_t)FRAME_ANALYSIS_TEXT_FLOAT_MAX);
+	buf = pos = new char[capacity];
+	end = buf + capacity;
+}
+
+FrameAnalysisTextBuffer::~FrameAnalysisTextBuffer()
+{
+	flush();
+	delete [] buf;
+}
+
+void FrameAnalysisTextBuffer::flush()
+{
+	fwrite(buf, 1, pos - buf, fp);
+	pos = buf;
+}
+
+void FrameAnalysisTextBuffer::append(const char *str, size_t len)
+{
+	if (len > (size_t)(end - buf)) {
+		flush();
+		fwrite(str, 1, len, fp);
+		return;
+	}
+	memcpy(reserve(len), str, len);
+	pos += len;
+}
+
+void FrameAnalysisTextBuffer::append(const char *str)
+{
+	append(str, strlen(str));
+}
+
+void FrameAnalysisTextBuffer::append_uint(uint32_t val, unsigned min_digits)
+{
+	unsigned len = 1, i;
+	uint32_t tmp;
+	char *p;
+
+	for (tmp = val; tmp >= 10; tmp /= 10)
+		len++;
+	for (; min_digits > len && min_digits > FRAME_ANALYSIS_TEXT_FLOAT_MAX; min_digits--)
+		append('0');
+	len = (std::max)(len, min_digits);
+
+	p = reserve(len) + len;
+	pos = p;
+	for (i = 0; i < len; i++, val /= 10)
+		*--p = '0' + val % 10;
+}
+
+void FrameAnalysisTextBuffer::append_int(int32_t val)
+{
+	if (val < 0) {
+		append('-');
+		append_uint(0u - (uint32_t)val);
+		return;
+	}
+	append_uint((uint32_t)val);
+}
+
+void FrameAnalysisTextBuffer::append_hex(uint32_t val, unsigned digits)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *p = reserve(digits) + digits;
+
+	pos = p;
+	while (digits--) {
+		*--p = hex[val & 0xf];
+		val >>= 4;
+	}
+}
+
+void FrameAnalysisTextBuffer::append_float(float val)
+{
+	pos += frame_analysis_format_float(reserve(FRAME_ANALYSIS_TEXT_FLOAT_MAX), val);
+}
+
+void FrameAnalysisTextBuffer::append_float_bits(uint32_t bits)
+{
+	float val;
+
+	memcpy(&val, &bits, sizeof(val));
+	append_float(val);
+}
+
+void FrameAnalysisTextBuffer::append_values(FrameAnalysisTextFormat format, const uint32_t *values)
+{
+	unsigned i;
+
+	switch (format.type) {
+		case FrameAnalysisTextType::RAW:
+			for (i = 0; i < format.components; i++)
+				append_hex(values[i], 2);
+			return;
+		case FrameAnalysisTextType::FLOAT32_UINT8:
+		case FrameAnalysisTextType::UNORM24_UINT8:
+			append_float_bits(values[0]);
+			append(", ", 2);
+			append_int((int32_t)values[1]);
+			return;
+		default:
+			break;
+	}
+
+	for (i = 0; i < format.components; i++) {
+		if (i)
+			append(", ", 2);
+
+		switch (format.type) {
+			case FrameAnalysisTextType::HEX32:
+				append_hex(values[i], 8);
+				break;
+			case FrameAnalysisTextType::HEX16:
+				append_hex(values[i], 4);
+				break;
+			case FrameAnalysisTextType::HEX8:
+				append_hex(values[i], 2);
+				break;
+			case FrameAnalysisTextType::UINT32:
+			case FrameAnalysisTextType::UINT16:
+			case FrameAnalysisTextType::UINT8:
+				append_uint(values[i]);
+				break;
+			case FrameAnalysisTextType::SINT32:
+			case FrameAnalysisTextType::SINT16:
+			case FrameAnalysisTextType::SINT8:
+				append_int((int32_t)values[i]);
+				break;
+			default:
+				append_float_bits(values[i]);
+				break;
+		}
+	}
+}
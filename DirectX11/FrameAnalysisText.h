@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Text formatting for the vertex and index buffers frame analysis dumps as
+// .txt files. These used to be written with one fprintf per vertex element,
+// which made dumping a large mesh take many times longer than copying it.
+// Instead, each element of a batch of vertices is decoded in one pass, with
+// SSE2 for the 8 and 16 bit normalised and half float formats. The text is
+// then built up in a large buffer without going through printf, before being
+// written to the file in one go.
+//
+// The text is byte for byte the same as fprintf gave, including %.9g for
+// every float, and any quirks of the decoders it replaced.
+//
+// This depends on nothing from D3D or the rest of 3DMigoto so that
+// TestFrameAnalysisText can check it against fprintf. FrameAnalysis.cpp
+// decides which of these each DXGI_FORMAT is shown as.
+
+enum class FrameAnalysisTextType : uint8_t {
+	RAW,           // Each byte in hex with no separator, for unknown formats
+	HEX32,         // %08x
+	HEX16,         // %04x
+	HEX8,          // %02x
+	FLOAT32,       // %.9g
+	FLOAT16,       // %.9g
+	UNORM16,       // %.9g
+	SNORM16,       // %.9g
+	UNORM8,        // %.9g
+	SNORM8,        // %.9g
+	UINT32,        // %u
+	UINT16,        // %u
+	UINT8,         // %u
+	SINT32,        // %d
+	SINT16,        // %d
+	SINT8,         // %d
+	FLOAT32_UINT8, // "%.9g, %d" of a 32 bit float and the byte after it
+	UNORM24_UINT8, // "%.9g, %d" of the low 24 bits as UNORM and the top byte
+};
+
+struct FrameAnalysisTextFormat {
+	FrameAnalysisTextType type;
+
+	// Number of values shown for each element, or the number of bytes
+	// for RAW. Always 2 for the two depth/stencil types.
+	unsigned components;
+
+	// Bytes read from each element
+	size_t size() const;
+};
+
+// Decodes count elements, each stride bytes after the last, into
+// count * format.components values ready for append_values(). Floats are
+// decoded to the bits of a 32 bit float and integers are widened to 32 bits.
+void frame_analysis_text_decode(FrameAnalysisTextFormat format,
+		const void *src, size_t stride, size_t count, uint32_t *values);
+
+// Largest number of characters format_float() can write
+#define FRAME_ANALYSIS_TEXT_FLOAT_MAX 32
+
+// Writes what printf %.9g would for val without a terminator, and returns
+// the number of characters written. The rare values that land too close to
+// half way between two 9 digit decimals to be sure which way printf would
+// round them are handed to snprintf, as are infinities and NaNs.
+size_t frame_analysis_format_float(char *out, float val);
+
+// Collects text to be written to a stream, writing it out whenever it
+// fills up and when it is destroyed. Nothing else may write to the stream
+// while this is in use.
+class FrameAnalysisTextBuffer {
+	FILE *fp;
+	char *buf;
+	char *pos;
+	char *end;
+
+	char* reserve(size_t len)
+	{
+		if ((size_t)(end - pos) < len)
+			flush();
+		return pos;
+	}
+
+public:
+	FrameAnalysisTextBuffer(FILE *fp, size_t capacity = 256 * 1024);
+	~FrameAnalysisTextBuffer();
+
+	void flush();
+
+	void append(const char *str, size_t len);
+	void append(const char *str);
+	void append(char c)
+	{
+		*reserve(1) = c;
+		pos++;
+	}
+
+	// %u, %0<min_digits>u
+	void append_uint(uint32_t val, unsigned min_digits = 1);
+	// %d
+	void append_int(int32_t val);
+	// %0<digits>x of a value that fits in that many digits
+	void append_hex(uint32_t val, unsigned digits);
+	// %.9g
+	void append_float(float val);
+	void append_float_bits(uint32_t bits);
+
+	// One decoded element, formatted as the format's values separated by
+	// ", ", or as hex bytes for RAW
+	void append_values(FrameAnalysisTextFormat format, const uint32_t *values);
+};
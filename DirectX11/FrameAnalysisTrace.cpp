@@ -0,0 +1,860 @@
+#include "FrameAnalysisTrace.h"
+
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+
+#ifdef _MSC_VER
+static const uint8_t HOST_FLAGS = FRAME_ANALYSIS_TRACE_MSVC | FRAME_ANALYSIS_TRACE_CRLF;
+#elif defined(_WIN32)
+static const uint8_t HOST_FLAGS = FRAME_ANALYSIS_TRACE_CRLF;
+#else
+static const uint8_t HOST_FLAGS = 0;
+#endif
+
+static const size_t MAGIC_LEN = sizeof(FRAME_ANALYSIS_TRACE_MAGIC) - 1;
+static const size_t HEADER_LEN = MAGIC_LEN + 4;
+
+// Nothing 3DMigoto logs comes close to this. It only stops a corrupt trace
+// from having the renderer pad something out to gigabytes:
+static const int64_t MAX_FIELD_WIDTH = 65536;
+
+// ----------------------------------------------------------------------------
+// printf format string parsing, shared by the writer and reader so that they
+// always agree on which arguments a format string takes
+// ----------------------------------------------------------------------------
+
+enum class SpecLength {
+	NONE, HH, H, L, LL, LONG_DOUBLE, SIZE, INTMAX, I32, I64, WIDE
+};
+
+// What was passed for a conversion, and so how it is packed in the trace:
+enum class SpecArg {
+	NONE,     // %%, %n, or something we don't understand
+	INT,
+	UINT,
+	CHAR,
+	WCHAR,
+	DOUBLE,
+	POINTER,
+	STRING,
+	WSTRING,
+};
+
+struct Spec {
+	const char *start; // The '%'
+	const char *end;   // Just after the conversion
+	bool width_star;
+	bool precision_star;
+	int64_t width;     // Largest of the width and precision written in the
+	                   // format string, rather than passed for a *
+	SpecLength length;
+	char conversion;   // 0 if the format string ended part way through
+	SpecArg arg;
+};
+
+static SpecArg spec_arg(const Spec &spec)
+{
+	switch (spec.conversion) {
+		case 'd': case 'i':
+			return SpecArg::INT;
+		case 'u': case 'o': case 'x': case 'X':
+			return SpecArg::UINT;
+		case 'c':
+			if (spec.length == SpecLength::L || spec.length == SpecLength::WIDE)
+				return SpecArg::WCHAR;
+			return SpecArg::CHAR;
+		case 'C':
+			if (spec.length == SpecLength::H)
+				return SpecArg::CHAR;
+			return SpecArg::WCHAR;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			return SpecArg::DOUBLE;
+		case 'p':
+			return SpecArg::POINTER;
+		case 's':
+			if (spec.length == SpecLength::L || spec.length == SpecLength::WIDE)
+				return SpecArg::WSTRING;
+			return SpecArg::STRING;
+		case 'S':
+			// MSVC and glibc both take a wide string for %S in printf
+			if (spec.length == SpecLength::H)
+				return SpecArg::STRING;
+			return SpecArg::WSTRING;
+	}
+	return SpecArg::NONE;
+}
+
+// Parses the conversion specification starting at the '%' at p
+static Spec parse_spec(const char *p)
+{
+	Spec spec = {};
+
+	spec.start = p++;
+
+	while (*p && strchr("-+ #0", *p))
+		p++;
+
+	if (*p == '*') {
+		spec.width_star = true;
+		p++;
+	} else {
+		for (; *p >= '0' && *p <= '9'; p++)
+			spec.width = (std::min)(spec.width * 10 + *p - '0', MAX_FIELD_WIDTH + 1);
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec.precision_star = true;
+			p++;
+		} else {
+			int64_t precision = 0;
+			for (; *p >= '0' && *p <= '9'; p++)
+				precision = (std::min)(precision * 10 + *p - '0', MAX_FIELD_WIDTH + 1);
+			spec.width = (std::max)(spec.width, precision);
+		}
+	}
+
+	if (!strncmp(p, "hh", 2)) {
+		spec.length = SpecLength::HH;
+		p += 2;
+	} else if (!strncmp(p, "ll", 2)) {
+		spec.length = SpecLength::LL;
+		p += 2;
+	} else if (!strncmp(p, "I64", 3)) {
+		spec.length = SpecLength::I64;
+		p += 3;
+	} else if (!strncmp(p, "I32", 3)) {
+		spec.length = SpecLength::I32;
+		p += 3;
+	} else {
+		switch (*p) {
+			case 'h': spec.length = SpecLength::H; p++; break;
+			case 'l': spec.length = SpecLength::L; p++; break;
+			case 'L': spec.length = SpecLength::LONG_DOUBLE; p++; break;
+			case 'q': spec.length = SpecLength::LL; p++; break;
+			case 'j': spec.length = SpecLength::INTMAX; p++; break;
+			case 'z': case 't': case 'I': spec.length = SpecLength::SIZE; p++; break;
+			case 'w': spec.length = SpecLength::WIDE; p++; break;
+		}
+	}
+
+	spec.conversion = *p;
+	if (*p)
+		p++;
+	spec.end = p;
+	spec.arg = spec_arg(spec);
+
+	return spec;
+}
+
+// ----------------------------------------------------------------------------
+// Packing
+// ----------------------------------------------------------------------------
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t val)
+{
+	while (val >= 0x80) {
+		out.push_back((uint8_t)(val | 0x80));
+		val >>= 7;
+	}
+	out.push_back((uint8_t)val);
+}
+
+static void put_svarint(std::vector<uint8_t> &out, int64_t val)
+{
+	put_varint(out, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+static void put_double(std::vector<uint8_t> &out, double val)
+{
+	uint8_t bytes[sizeof(double)];
+
+	memcpy(bytes, &val, sizeof(double));
+	out.insert(out.end(), bytes, bytes + sizeof(double));
+}
+
+static bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t *val)
+{
+	unsigned shift;
+
+	*val = 0;
+	for (shift = 0; p < end && shift < 64; shift += 7) {
+		*val |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static bool get_svarint(const uint8_t *&p, const uint8_t *end, int64_t *val)
+{
+	uint64_t zigzag;
+
+	if (!get_varint(p, end, &zigzag))
+		return false;
+	*val = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+	return true;
+}
+
+static bool get_uint32(const uint8_t *&p, const uint8_t *end, uint32_t *val)
+{
+	uint64_t tmp;
+
+	if (!get_varint(p, end, &tmp) || tmp > UINT32_MAX)
+		return false;
+	*val = (uint32_t)tmp;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Writer
+// ----------------------------------------------------------------------------
+
+FrameAnalysisTraceWriter::FrameAnalysisTraceWriter() :
+	next_format_id(0)
+{}
+
+void FrameAnalysisTraceWriter::begin(FILE *fp)
+{
+	uint8_t header[HEADER_LEN];
+
+	memcpy(header, FRAME_ANALYSIS_TRACE_MAGIC, MAGIC_LEN);
+	header[MAGIC_LEN] = FRAME_ANALYSIS_TRACE_VERSION;
+	header[MAGIC_LEN + 1] = HOST_FLAGS;
+	header[MAGIC_LEN + 2] = sizeof(void*);
+	header[MAGIC_LEN + 3] = sizeof(wchar_t);
+	fwrite(header, 1, HEADER_LEN, fp);
+
+	formats.clear();
+	next_format_id = 0;
+}
+
+// Records are built after room for the longest length prefix, which is filled
+// in just before the record so the whole thing can be written at once:
+static const size_t RECORD_PREFIX = 10;
+
+static void begin_record(std::vector<uint8_t> &record, FrameAnalysisTraceRecord type)
+{
+	record.resize(RECORD_PREFIX);
+	record.push_back((uint8_t)type);
+}
+
+static void write_record(FILE *fp, std::vector<uint8_t> &record)
+{
+	uint8_t len[RECORD_PREFIX];
+	size_t n = 0;
+	size_t val = record.size() - RECORD_PREFIX;
+
+	while (val >= 0x80) {
+		len[n++] = (uint8_t)(val | 0x80);
+		val >>= 7;
+	}
+	len[n++] = (uint8_t)val;
+
+	memcpy(record.data() + RECORD_PREFIX - n, len, n);
+	fwrite(record.data() + RECORD_PREFIX - n, 1, record.size() - RECORD_PREFIX + n, fp);
+}
+
+// How to take each argument off the va_list, worked out once per format
+// string so that recording a message doesn't have to parse it again:
+enum class ArgCode : uint8_t {
+	INT, LONG, LONG_LONG, PTRDIFF, INTMAX,
+	UINT, ULONG, ULONG_LONG, SIZE, UINTMAX,
+	DOUBLE, LONG_DOUBLE, POINTER, STRING, WSTRING,
+	SKIP, // %n is never honoured, but its argument still has to be skipped
+};
+
+static void compile_args(const char *fmt, std::vector<uint8_t> *codes)
+{
+	const char *p;
+	Spec spec;
+
+	for (p = strchr(fmt, '%'); p; p = strchr(spec.end, '%')) {
+		spec = parse_spec(p);
+
+		if (spec.width_star)
+			codes->push_back((uint8_t)ArgCode::INT);
+		if (spec.precision_star)
+			codes->push_back((uint8_t)ArgCode::INT);
+
+		switch (spec.arg) {
+		case SpecArg::INT:
+			switch (spec.length) {
+				case SpecLength::L: codes->push_back((uint8_t)ArgCode::LONG); break;
+				case SpecLength::LL: case SpecLength::I64: codes->push_back((uint8_t)ArgCode::LONG_LONG); break;
+				case SpecLength::SIZE: codes->push_back((uint8_t)ArgCode::PTRDIFF); break;
+				case SpecLength::INTMAX: codes->push_back((uint8_t)ArgCode::INTMAX); break;
+				default: codes->push_back((uint8_t)ArgCode::INT); break;
+			}
+			break;
+		case SpecArg::UINT:
+			switch (spec.length) {
+				case SpecLength::L: codes->push_back((uint8_t)ArgCode::ULONG); break;
+				case SpecLength::LL: case SpecLength::I64: codes->push_back((uint8_t)ArgCode::ULONG_LONG); break;
+				case SpecLength::SIZE: codes->push_back((uint8_t)ArgCode::SIZE); break;
+				case SpecLength::INTMAX: codes->push_back((uint8_t)ArgCode::UINTMAX); break;
+				default: codes->push_back((uint8_t)ArgCode::UINT); break;
+			}
+			break;
+		case SpecArg::CHAR:
+		case SpecArg::WCHAR:
+			// char and wint_t are both promoted to int sized
+			codes->push_back((uint8_t)ArgCode::UINT);
+			break;
+		case SpecArg::DOUBLE:
+			if (spec.length == SpecLength::LONG_DOUBLE)
+				codes->push_back((uint8_t)ArgCode::LONG_DOUBLE);
+			else
+				codes->push_back((uint8_t)ArgCode::DOUBLE);
+			break;
+		case SpecArg::POINTER:
+			codes->push_back((uint8_t)ArgCode::POINTER);
+			break;
+		case SpecArg::STRING:
+			codes->push_back((uint8_t)ArgCode::STRING);
+			break;
+		case SpecArg::WSTRING:
+			codes->push_back((uint8_t)ArgCode::WSTRING);
+			break;
+		case SpecArg::NONE:
+			if (spec.conversion == 'n')
+				codes->push_back((uint8_t)ArgCode::SKIP);
+			break;
+		}
+	}
+}
+
+const FrameAnalysisTraceWriter::Format* FrameAnalysisTraceWriter::lookup_format(FILE *fp, const char *fmt)
+{
+	auto i = formats.find(fmt);
+	if (i != formats.end() && !strcmp(i->second.text.c_str(), fmt))
+		return &i->second;
+
+	Format &format = formats[fmt];
+	format.id = next_format_id++;
+	format.text = fmt;
+	format.arg_codes.clear();
+	compile_args(fmt, &format.arg_codes);
+
+	// Goes out before the record that uses it, so it can't use the
+	// record buffer the caller is filling in:
+	std::vector<uint8_t> def;
+	begin_record(def, FrameAnalysisTraceRecord::FORMAT);
+	put_varint(def, format.id);
+	def.insert(def.end(), format.text.begin(), format.text.end());
+	write_record(fp, def);
+
+	return &format;
+}
+
+// Packs the arguments of a format string in the order they were passed:
+static void put_args(std::vector<uint8_t> &out, const std::vector<uint8_t> &codes, va_list ap)
+{
+	const char *str;
+	const wchar_t *wstr;
+	size_t len;
+
+	for (uint8_t code : codes) {
+		switch ((ArgCode)code) {
+		case ArgCode::INT: put_svarint(out, va_arg(ap, int)); break;
+		case ArgCode::LONG: put_svarint(out, va_arg(ap, long)); break;
+		case ArgCode::LONG_LONG: put_svarint(out, va_arg(ap, long long)); break;
+		case ArgCode::PTRDIFF: put_svarint(out, va_arg(ap, ptrdiff_t)); break;
+		case ArgCode::INTMAX: put_svarint(out, va_arg(ap, intmax_t)); break;
+		case ArgCode::UINT: put_varint(out, va_arg(ap, unsigned)); break;
+		case ArgCode::ULONG: put_varint(out, va_arg(ap, unsigned long)); break;
+		case ArgCode::ULONG_LONG: put_varint(out, va_arg(ap, unsigned long long)); break;
+		case ArgCode::SIZE: put_varint(out, va_arg(ap, size_t)); break;
+		case ArgCode::UINTMAX: put_varint(out, va_arg(ap, uintmax_t)); break;
+		case ArgCode::DOUBLE: put_double(out, va_arg(ap, double)); break;
+		case ArgCode::LONG_DOUBLE: put_double(out, (double)va_arg(ap, long double)); break;
+		case ArgCode::POINTER: put_varint(out, (uintptr_t)va_arg(ap, void*)); break;
+		case ArgCode::SKIP: va_arg(ap, void*); break;
+		case ArgCode::STRING:
+			// Length + 1, or 0 for NULL:
+			str = va_arg(ap, const char*);
+			if (!str) {
+				put_varint(out, 0);
+				break;
+			}
+			len = strlen(str);
+			put_varint(out, len + 1);
+			out.insert(out.end(), str, str + len);
+			break;
+		case ArgCode::WSTRING:
+			wstr = va_arg(ap, const wchar_t*);
+			if (!wstr) {
+				put_varint(out, 0);
+				break;
+			}
+			put_varint(out, wcslen(wstr) + 1);
+			for (; *wstr; wstr++)
+				put_varint(out, (uint32_t)*wstr);
+			break;
+		}
+	}
+}
+
+void FrameAnalysisTraceWriter::vcall(FILE *fp, bool hold, uint32_t frame_no, uint32_t draw_call, const char *fmt, va_list ap)
+{
+	const Format *format = lookup_format(fp, fmt);
+
+	begin_record(record, FrameAnalysisTraceRecord::CALL);
+	record.push_back(hold);
+	if (hold)
+		put_varint(record, frame_no);
+	put_varint(record, draw_call);
+	put_varint(record, format->id);
+	put_args(record, format->arg_codes, ap);
+	write_record(fp, record);
+}
+
+void FrameAnalysisTraceWriter::vappend(FILE *fp, const char *fmt, va_list ap)
+{
+	const Format *format = lookup_format(fp, fmt);
+
+	begin_record(record, FrameAnalysisTraceRecord::APPEND);
+	put_varint(record, format->id);
+	put_args(record, format->arg_codes, ap);
+	write_record(fp, record);
+}
+
+void FrameAnalysisTraceWriter::data(FILE *fp, const void *buf, size_t size)
+{
+	begin_record(record, FrameAnalysisTraceRecord::DATA);
+	record.insert(record.end(), (const uint8_t*)buf, (const uint8_t*)buf + size);
+	write_record(fp, record);
+}
+
+// ----------------------------------------------------------------------------
+// Reader
+// ----------------------------------------------------------------------------
+
+std::string FrameAnalysisTraceEvent::call_name() const
+{
+	const char *p;
+
+	if (type != FrameAnalysisTraceRecord::CALL || !fmt)
+		return std::string();
+
+	for (p = fmt->c_str(); *p; p++) {
+		if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_'))
+			break;
+	}
+	return std::string(fmt->c_str(), p);
+}
+
+FrameAnalysisTraceReader::FrameAnalysisTraceReader() :
+	pos(NULL),
+	end(NULL),
+	flags(0),
+	pointer_size(0),
+	wchar_size(0),
+	truncated(false)
+{}
+
+bool FrameAnalysisTraceReader::open(const void *data, size_t size)
+{
+	pos = (const uint8_t*)data;
+	end = pos + size;
+	formats.clear();
+	error.clear();
+	truncated = false;
+
+	if (size < HEADER_LEN || memcmp(pos, FRAME_ANALYSIS_TRACE_MAGIC, MAGIC_LEN)) {
+		error = "Not a frame analysis trace";
+		return false;
+	}
+	if (pos[MAGIC_LEN] != FRAME_ANALYSIS_TRACE_VERSION) {
+		error = "Unsupported frame analysis trace version " + std::to_string(pos[MAGIC_LEN]);
+		return false;
+	}
+	flags = pos[MAGIC_LEN + 1];
+	pointer_size = pos[MAGIC_LEN + 2];
+	wchar_size = pos[MAGIC_LEN + 3];
+	pos += HEADER_LEN;
+
+	return true;
+}
+
+static bool get_args(const uint8_t *&p, const uint8_t *end, const std::string &fmt,
+		std::vector<FrameAnalysisTraceArg> &args)
+{
+	const char *f;
+	uint64_t len;
+	Spec spec;
+
+	args.clear();
+
+	for (f = strchr(fmt.c_str(), '%'); f; f = strchr(spec.end, '%')) {
+		spec = parse_spec(f);
+
+		if (spec.width > MAX_FIELD_WIDTH)
+			return false;
+
+		for (int star = spec.width_star + spec.precision_star; star; star--) {
+			args.emplace_back();
+			args.back().type = FrameAnalysisTraceArg::Type::INT;
+			if (!get_svarint(p, end, &args.back().i))
+				return false;
+			if (args.back().i > MAX_FIELD_WIDTH || args.back().i < -MAX_FIELD_WIDTH)
+				return false;
+		}
+
+		if (spec.arg == SpecArg::NONE)
+			continue;
+
+		args.emplace_back();
+		FrameAnalysisTraceArg &arg = args.back();
+
+		switch (spec.arg) {
+		case SpecArg::INT:
+			arg.type = FrameAnalysisTraceArg::Type::INT;
+			if (!get_svarint(p, end, &arg.i))
+				return false;
+			break;
+		case SpecArg::UINT:
+		case SpecArg::CHAR:
+		case SpecArg::WCHAR:
+			arg.type = FrameAnalysisTraceArg::Type::UINT;
+			if (!get_varint(p, end, &arg.u))
+				return false;
+			break;
+		case SpecArg::POINTER:
+			arg.type = FrameAnalysisTraceArg::Type::POINTER;
+			if (!get_varint(p, end, &arg.u))
+				return false;
+			break;
+		case SpecArg::DOUBLE:
+			arg.type = FrameAnalysisTraceArg::Type::DOUBLE;
+			if (end - p < (ptrdiff_t)sizeof(double))
+				return false;
+			memcpy(&arg.d, p, sizeof(double));
+			p += sizeof(double);
+			break;
+		case SpecArg::STRING:
+			arg.type = FrameAnalysisTraceArg::Type::STRING;
+			if (!get_varint(p, end, &len) || len > (uint64_t)(end - p) + 1)
+				return false;
+			arg.null = !len;
+			if (len) {
+				arg.str.assign((const char*)p, (size_t)len - 1);
+				p += len - 1;
+			}
+			break;
+		case SpecArg::WSTRING:
+			arg.type = FrameAnalysisTraceArg::Type::WSTRING;
+			if (!get_varint(p, end, &len) || len > (uint64_t)(end - p) + 1)
+				return false;
+			arg.null = !len;
+			for (; len > 1; len--) {
+				uint32_t unit;
+				if (!get_uint32(p, end, &unit))
+					return false;
+				arg.wstr.push_back(unit);
+			}
+			break;
+		case SpecArg::NONE:
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool FrameAnalysisTraceReader::next(FrameAnalysisTraceEvent &event)
+{
+	const uint8_t *body, *body_end;
+	uint64_t len;
+	uint32_t id;
+	uint8_t type;
+
+	while (pos < end) {
+		body = pos;
+		if (!get_varint(body, end, &len) || len > (uint64_t)(end - body)) {
+			truncated = true;
+			return false;
+		}
+		body_end = body + len;
+		pos = body_end;
+
+		if (!len) {
+			error = "Empty record";
+			return false;
+		}
+		type = *body++;
+
+		switch ((FrameAnalysisTraceRecord)type) {
+		case FrameAnalysisTraceRecord::FORMAT:
+			if (!get_uint32(body, body_end, &id) || id != formats.size()) {
+				error = "Format string out of sequence";
+				return false;
+			}
+			formats.emplace_back((const char*)body, body_end - body);
+			continue;
+
+		case FrameAnalysisTraceRecord::CALL:
+		case FrameAnalysisTraceRecord::APPEND:
+			event.type = (FrameAnalysisTraceRecord)type;
+			event.hold = false;
+			event.data.clear();
+			if (event.type == FrameAnalysisTraceRecord::CALL) {
+				if (body == body_end) {
+					error = "Corrupt call record";
+					return false;
+				}
+				event.hold = !!*body++;
+				if (event.hold && !get_uint32(body, body_end, &event.frame_no)) {
+					error = "Corrupt call record";
+					return false;
+				}
+				if (!get_uint32(body, body_end, &event.draw_call)) {
+					error = "Corrupt call record";
+					return false;
+				}
+			}
+			if (!get_uint32(body, body_end, &id) || id >= formats.size()) {
+				error = "Record uses an undefined format string";
+				return false;
+			}
+			event.fmt = &formats[id];
+			if (!get_args(body, body_end, formats[id], event.args) || body != body_end) {
+				error = "Arguments don't match the format string \"" + formats[id] + "\"";
+				return false;
+			}
+			return true;
+
+		case FrameAnalysisTraceRecord::DATA:
+			event.type = FrameAnalysisTraceRecord::DATA;
+			event.hold = false;
+			event.fmt = NULL;
+			event.args.clear();
+			event.data.assign(body, body_end);
+			return true;
+		}
+
+		// Skip record types from a newer version that this one doesn't
+		// know about, since they are all length prefixed
+	}
+
+	return false;
+}
+
+static void append_printf(std::string &out, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+	if ((size_t)len < sizeof(buf)) {
+		out.append(buf, len);
+		return;
+	}
+
+	std::vector<char> big(len + 1);
+	va_start(ap, fmt);
+	vsnprintf(big.data(), big.size(), fmt, ap);
+	va_end(ap);
+	out.append(big.data(), len);
+}
+
+// Whether this process's printf would format everything the same way as the
+// one that recorded the trace:
+bool FrameAnalysisTraceReader::native() const
+{
+	return (flags & FRAME_ANALYSIS_TRACE_MSVC) == (HOST_FLAGS & FRAME_ANALYSIS_TRACE_MSVC)
+		&& pointer_size == sizeof(void*)
+		&& wchar_size == sizeof(wchar_t);
+}
+
+// Wide strings formatted by a different C runtime are written the way that
+// the "C" locale the log is written in would - code units that fit in a byte
+// are written as that byte, and we write '?' for the rest that would have
+// made printf fail, which doesn't happen in practice as 3DMigoto only logs
+// names from the ini file that are almost always ASCII.
+static std::string narrow(const std::vector<uint32_t> &wstr)
+{
+	std::string ret;
+
+	for (uint32_t unit : wstr)
+		ret.push_back(unit < 0x100 ? (char)unit : '?');
+	return ret;
+}
+
+// Formats one argument the way the printf that recorded the trace would have.
+// spec is the conversion specification with its flags, width and precision
+// but without its length modifier or conversion.
+static void render_arg(std::string &out, const std::string &spec, const Spec &s,
+		const FrameAnalysisTraceArg &arg, bool native, uint8_t flags, uint8_t pointer_size)
+{
+	const char *length = "ll";
+	std::string text;
+	char hex[17];
+	bool msvc = !!(flags & FRAME_ANALYSIS_TRACE_MSVC);
+
+	if (s.length == SpecLength::HH)
+		length = "hh";
+	else if (s.length == SpecLength::H)
+		length = "h";
+
+	// h and hh still take an int, which printf then truncates:
+	switch (s.arg) {
+	case SpecArg::INT:
+		if (s.length == SpecLength::HH || s.length == SpecLength::H)
+			append_printf(out, (spec + length + s.conversion).c_str(), (int)arg.i);
+		else
+			append_printf(out, (spec + length + s.conversion).c_str(), (long long)arg.i);
+		return;
+	case SpecArg::UINT:
+		if (s.length == SpecLength::HH || s.length == SpecLength::H)
+			append_printf(out, (spec + length + s.conversion).c_str(), (unsigned)arg.u);
+		else
+			append_printf(out, (spec + length + s.conversion).c_str(), (unsigned long long)arg.u);
+		return;
+	case SpecArg::CHAR:
+		append_printf(out, (spec + "c").c_str(), (int)arg.u);
+		return;
+	case SpecArg::WCHAR:
+		if (native)
+			append_printf(out, (spec + "lc").c_str(), (wint_t)arg.u);
+		else
+			append_printf(out, (spec + "c").c_str(), arg.u < 0x100 ? (int)arg.u : '?');
+		return;
+	case SpecArg::DOUBLE:
+		append_printf(out, (spec + s.conversion).c_str(), arg.d);
+		return;
+	case SpecArg::POINTER:
+		if (native) {
+			append_printf(out, (spec + "p").c_str(), (void*)(uintptr_t)arg.u);
+			return;
+		}
+		if (msvc) {
+			// MSVC pads pointers to their full width in upper case
+			snprintf(hex, sizeof(hex), "%0*llX", (int)pointer_size * 2, (unsigned long long)arg.u);
+			text = hex;
+		} else if (arg.u) {
+			snprintf(hex, sizeof(hex), "%llx", (unsigned long long)arg.u);
+			text = std::string("0x") + hex;
+		} else {
+			text = "(nil)";
+		}
+		append_printf(out, (spec + "s").c_str(), text.c_str());
+		return;
+	case SpecArg::STRING:
+		if (arg.null && !native) {
+			// glibc prints nothing rather than part of "(null)"
+			size_t dot = spec.find('.');
+			if (!msvc && dot != std::string::npos && atoi(spec.c_str() + dot + 1) < 6)
+				text = "";
+			else
+				text = "(null)";
+			append_printf(out, (spec + "s").c_str(), text.c_str());
+			return;
+		}
+		append_printf(out, (spec + "s").c_str(), arg.null ? NULL : arg.str.c_str());
+		return;
+	case SpecArg::WSTRING:
+		if (native) {
+			std::wstring wstr(arg.wstr.begin(), arg.wstr.end());
+			append_printf(out, (spec + "ls").c_str(), arg.null ? NULL : wstr.c_str());
+			return;
+		}
+		append_printf(out, (spec + "s").c_str(), arg.null ? "(null)" : narrow(arg.wstr).c_str());
+		return;
+	case SpecArg::NONE:
+		return;
+	}
+}
+
+void FrameAnalysisTraceReader::render(std::string &out, const FrameAnalysisTraceEvent &event, bool as_written) const
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string text, spec;
+	const char *f, *p, *literal;
+	size_t i, a = 0;
+	int64_t val;
+	Spec s;
+
+	if (event.type == FrameAnalysisTraceRecord::DATA) {
+		text = "    data: ";
+		for (i = 0; i < event.data.size(); i++) {
+			text.push_back(digits[event.data[i] >> 4]);
+			text.push_back(digits[event.data[i] & 0xf]);
+		}
+		text += "\n";
+	} else {
+		if (event.type == FrameAnalysisTraceRecord::CALL) {
+			if (event.hold)
+				append_printf(text, "%u.", event.frame_no);
+			append_printf(text, "%06u ", event.draw_call);
+		}
+
+		literal = event.fmt->c_str();
+		for (f = strchr(literal, '%'); f; f = strchr(literal, '%')) {
+			text.append(literal, f);
+			s = parse_spec(f);
+			literal = s.end;
+
+			// Rebuild the flags, width and precision with any *
+			// replaced by the value that was passed for it:
+			p = s.start + 1;
+			spec = "%";
+			while (*p && strchr("-+ #0", *p))
+				spec += *p++;
+			if (s.width_star) {
+				val = event.args[a++].i;
+				if (val < 0) {
+					spec += '-';
+					val = -val;
+				}
+				spec += std::to_string(val);
+				p++;
+			} else {
+				while (*p >= '0' && *p <= '9')
+					spec += *p++;
+			}
+			if (*p == '.') {
+				p++;
+				if (s.precision_star) {
+					// A negative precision is as if it were left out
+					val = event.args[a++].i;
+					if (val >= 0)
+						spec += "." + std::to_string(val);
+				} else {
+					spec += '.';
+					while (*p >= '0' && *p <= '9')
+						spec += *p++;
+				}
+			}
+
+			if (s.conversion == '%')
+				text += '%';
+			else if (s.arg == SpecArg::NONE && s.conversion != 'n')
+				text.append(s.start, s.end);
+			else if (s.arg != SpecArg::NONE)
+				render_arg(text, spec, s, event.args[a++], native(), flags, pointer_size);
+		}
+		text.append(literal);
+	}
+
+	if (!as_written || !(flags & FRAME_ANALYSIS_TRACE_CRLF)) {
+		out += text;
+		return;
+	}
+
+	// The log was opened in text mode, so every newline was written as
+	// CRLF on Windows:
+	for (char c : text) {
+		if (c == '\n')
+			out += '\r';
+		out += c;
+	}
+}
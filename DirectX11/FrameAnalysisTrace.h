@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Binary form of the frame analysis log. Formatting every intercepted call
+// as text with fprintf can cost more than the game itself does, and over a
+// hold mode capture of many frames log.txt grows to gigabytes. With
+// [Hunting] analyse_binary_log the log is written as a stream of length
+// prefixed records instead, each holding the draw call number, an id for the
+// log message's format string and that message's arguments packed as they
+// were passed - handles, hashes, slots and all - without converting any of
+// them to text. Each format string is only written out once, the first time
+// it is used.
+//
+// fa_trace_convert renders a trace back into exactly the log.txt that would
+// have been written in its place, or into a filtered or JSON view of it.
+//
+// This depends on nothing from D3D or the rest of 3DMigoto so that the
+// converter and TestFrameAnalysisTrace can be built on their own.
+
+// Found at the start of every trace, followed by the rest of the header:
+#define FRAME_ANALYSIS_TRACE_MAGIC "3DMFATR"
+static const uint8_t FRAME_ANALYSIS_TRACE_VERSION = 1;
+
+// Header flags describing the C runtime that recorded the trace, which the
+// renderer needs to match to give the same text:
+static const uint8_t FRAME_ANALYSIS_TRACE_MSVC = 0x01; // MSVC printf %p and %S
+static const uint8_t FRAME_ANALYSIS_TRACE_CRLF = 0x02; // Log was opened in text mode on Windows
+
+enum class FrameAnalysisTraceRecord : uint8_t {
+	FORMAT = 1, // Defines a format string id
+	CALL   = 2, // Start of a line for an intercepted call, with the draw call prefix
+	APPEND = 3, // Appended to the current line without a prefix
+	DATA   = 4, // Hex dump of a block of memory
+};
+
+// Records the log messages of one frame analysis context. Each record is
+// written to the stream the caller passes in, so the context can keep
+// closing and reopening its log as it always has.
+class FrameAnalysisTraceWriter {
+	struct Format {
+		uint32_t id;
+		std::string text;
+		std::vector<uint8_t> arg_codes; // How to read each argument
+	};
+
+	// Keyed on the address of the format string, which is almost always
+	// a literal. Its contents are still compared on every use in case a
+	// caller reuses a buffer for a different format string:
+	std::unordered_map<const char*, Format> formats;
+	uint32_t next_format_id;
+	std::vector<uint8_t> record;
+
+	const Format* lookup_format(FILE *fp, const char *fmt);
+
+public:
+	FrameAnalysisTraceWriter();
+
+	// Writes the header to a newly opened stream and forgets every format
+	// string written to the last one
+	void begin(FILE *fp);
+
+	// Records a message at the start of a line. frame_no is only shown in
+	// the log in hold mode.
+	void vcall(FILE *fp, bool hold, uint32_t frame_no, uint32_t draw_call, const char *fmt, va_list ap);
+
+	// Records a message that continues the current line
+	void vappend(FILE *fp, const char *fmt, va_list ap);
+
+	// Records a block of memory to be shown as hex
+	void data(FILE *fp, const void *buf, size_t size);
+};
+
+struct FrameAnalysisTraceArg {
+	enum class Type {
+		INT,      // Any signed integer conversion, or a * width or precision
+		UINT,     // Any unsigned integer conversion, or %c
+		DOUBLE,
+		POINTER,
+		STRING,   // %s
+		WSTRING,  // %S and %ls, with each code unit in wstr
+	} type;
+	int64_t i;
+	uint64_t u;
+	double d;
+	bool null;
+	std::string str;
+	std::vector<uint32_t> wstr;
+};
+
+struct FrameAnalysisTraceEvent {
+	FrameAnalysisTraceRecord type;
+	bool hold;
+	uint32_t frame_no;
+	uint32_t draw_call;
+	const std::string *fmt;
+	std::vector<FrameAnalysisTraceArg> args;
+	std::vector<uint8_t> data;
+
+	// What the log line was for - the name of the intercepted call, or the
+	// first word of a 3DMigoto message. Empty for records other than CALL.
+	std::string call_name() const;
+};
+
+// Reads a trace from memory, one event at a time.
+class FrameAnalysisTraceReader {
+	const uint8_t *pos;
+	const uint8_t *end;
+	uint8_t flags;
+	uint8_t pointer_size;
+	uint8_t wchar_size;
+	std::deque<std::string> formats; // Never moved, events point into it
+	std::string error;
+	bool truncated;
+
+	bool native() const;
+
+public:
+	FrameAnalysisTraceReader();
+
+	// Checks the header. Returns false with the reason in get_error() if
+	// this isn't a trace this version understands.
+	bool open(const void *data, size_t size);
+
+	// Reads the next event, after any format strings it uses. Returns
+	// false at the end of the trace, or if it is corrupt, in which case
+	// get_error() says why. A trace cut short because the game exited
+	// before the last record was written ends cleanly, with truncated()
+	// set.
+	bool next(FrameAnalysisTraceEvent &event);
+
+	// Appends the text the event added to log.txt. as_written gives the
+	// newlines as they were written to the file, which were CRLF for a log
+	// written on Windows, rather than just '\n'.
+	void render(std::string &out, const FrameAnalysisTraceEvent &event, bool as_written = true) const;
+
+	const std::string& get_error() const { return error; }
+	bool was_truncated() const { return truncated; }
+	uint8_t get_flags() const { return flags; }
+};
@@ -0,0 +1,255 @@
+#include "FrameAnalysisWriter.h"
+
+#include <algorithm>
+
+// Buffers are allocated in powers of two so that the pool can reuse one for
+// the next resource of about the same size:
+static const size_t MIN_BUFFER_CAPACITY = 256;
+
+static size_t buffer_capacity(size_t len)
+{
+	size_t capacity = MIN_BUFFER_CAPACITY;
+
+	while (capacity < len && capacity <= SIZE_MAX / 2)
+		capacity *= 2;
+
+	return std::max(capacity, len);
+}
+
+FrameAnalysisBuffer::FrameAnalysisBuffer(FrameAnalysisWriter *writer, uint8_t *buf, size_t capacity, size_t len) :
+	writer(writer),
+	buf(buf),
+	capacity(capacity),
+	len(len)
+{}
+
+FrameAnalysisBuffer::~FrameAnalysisBuffer()
+{
+	writer->return_buffer(buf, capacity);
+}
+
+FrameAnalysisWriter::FrameAnalysisWriter(unsigned threads, size_t max_staged_bytes, size_t max_queued) :
+	max_staged_bytes(max_staged_bytes),
+	max_queued(max_queued),
+	running(0),
+	stopping(false),
+	stats(),
+	pool_bytes(0)
+{
+	unsigned i;
+
+	for (i = 0; i < threads; i++)
+		workers.emplace_back(&FrameAnalysisWriter::worker_main, this);
+}
+
+FrameAnalysisWriter::~FrameAnalysisWriter()
+{
+	wait_idle();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	work_cv.notify_all();
+
+	for (std::thread &worker : workers)
+		worker.join();
+
+	for (auto &i : pool)
+		delete [] i.second;
+}
+
+void FrameAnalysisWriter::worker_main()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (true) {
+		work_cv.wait(guard, [&] { return stopping || !jobs.empty(); });
+		if (stopping)
+			return;
+
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		running++;
+		space_cv.notify_all();
+
+		guard.unlock();
+		// An exception escaping a worker thread would take down the
+		// game, so anything the work throws just loses that dump:
+		try {
+			job.work(*job.buffer);
+		} catch (...) {
+		}
+		// Returning the buffer takes the lock:
+		job.buffer.reset();
+		guard.lock();
+
+		stats.written++;
+		if (--running == 0 && jobs.empty())
+			idle_cv.notify_all();
+	}
+}
+
+void FrameAnalysisWriter::return_buffer(uint8_t *buf, size_t capacity)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	stats.staged_bytes -= capacity;
+
+	// Keep at most as much in the pool as can be staged, so a frame that
+	// dumped a few huge resources doesn't hang on to them for good:
+	if (pool_bytes + capacity <= max_staged_bytes) {
+		pool.emplace(capacity, buf);
+		pool_bytes += capacity;
+		buf = NULL;
+	}
+
+	guard.unlock();
+	space_cv.notify_all();
+
+	delete [] buf;
+}
+
+FrameAnalysisBufferPtr FrameAnalysisWriter::get_buffer(size_t len)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	size_t capacity = buffer_capacity(len);
+	uint8_t *buf = NULL;
+
+	// Wait for the writers to catch up if they are too far behind. With
+	// no writers nothing is ever left staged to wait for:
+	auto full = [&] {
+		return (stats.staged_bytes && stats.staged_bytes + capacity > max_staged_bytes)
+			|| jobs.size() >= max_queued;
+	};
+	if (!workers.empty() && full()) {
+		stats.waits++;
+		space_cv.wait(guard, [&] { return !full(); });
+	}
+
+	auto i = pool.find(capacity);
+	if (i != pool.end()) {
+		buf = i->second;
+		pool.erase(i);
+		pool_bytes -= capacity;
+		stats.buffers_reused++;
+	} else {
+		stats.buffers_allocated++;
+	}
+
+	stats.staged_bytes += capacity;
+	stats.max_staged_bytes = std::max(stats.max_staged_bytes, stats.staged_bytes);
+
+	guard.unlock();
+
+	// Not zeroed - the caller is about to copy over it:
+	if (!buf)
+		buf = new uint8_t[capacity];
+
+	return FrameAnalysisBufferPtr(new FrameAnalysisBuffer(this, buf, capacity, len));
+}
+
+void FrameAnalysisWriter::queue(FrameAnalysisBufferPtr buffer, Work work)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	stats.queued++;
+
+	if (workers.empty()) {
+		guard.unlock();
+		try {
+			work(*buffer);
+		} catch (...) {
+		}
+		buffer.reset();
+		guard.lock();
+		stats.written++;
+		return;
+	}
+
+	jobs.push_back(Job{std::move(buffer), std::move(work)});
+
+	guard.unlock();
+	work_cv.notify_one();
+}
+
+bool FrameAnalysisWriter::write_once(const std::wstring &path, std::function<void()> write)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	auto i = written.find(path);
+	if (i != written.end()) {
+		stats.deduplicated++;
+		once_cv.wait(guard, [&] { return i->second.done; });
+		return false;
+	}
+	i = written.emplace(path, Once{false}).first;
+
+	guard.unlock();
+	try {
+		write();
+	} catch (...) {
+	}
+	guard.lock();
+
+	// std::map iterators stay valid while other paths are added:
+	i->second.done = true;
+	guard.unlock();
+	once_cv.notify_all();
+	return true;
+}
+
+void FrameAnalysisWriter::wait_idle(std::function<void(const FrameAnalysisWriterStats &stats)> progress,
+		std::chrono::milliseconds interval)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	FrameAnalysisWriterStats snapshot;
+
+	auto idle = [&] { return !running && jobs.empty(); };
+
+	if (!progress) {
+		idle_cv.wait(guard, idle);
+		return;
+	}
+
+	while (!idle_cv.wait_for(guard, interval, idle)) {
+		snapshot = stats;
+		guard.unlock();
+		progress(snapshot);
+		guard.lock();
+	}
+}
+
+size_t FrameAnalysisWriter::drain()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	std::deque<Job> dropped;
+	size_t ret;
+
+	dropped.swap(jobs);
+	ret = dropped.size();
+	stats.dropped += ret;
+
+	// Returning their buffers takes the lock:
+	guard.unlock();
+	dropped.clear();
+	space_cv.notify_all();
+	guard.lock();
+
+	idle_cv.wait(guard, [&] { return !running && jobs.empty(); });
+	return ret;
+}
+
+void FrameAnalysisWriter::forget_written()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	written.clear();
+}
+
+FrameAnalysisWriterStats FrameAnalysisWriter::get_stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
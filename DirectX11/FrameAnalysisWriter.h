@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Worker pool that writes frame analysis dumps, so that the game's render
+// thread only has to copy each mapped staging resource into a CPU buffer and
+// hash it for deduplication, instead of formatting it as text and writing it
+// to disk itself. A dump of a whole frame can write tens of thousands of
+// files, and doing all of that on the render thread can stall a game for long
+// enough that the driver gives up on it.
+//
+// The copies come from a pool of buffers that are reused from one dump to the
+// next. Everything the render thread has copied and the writers have not yet
+// finished with counts against a limit, and get_buffer() waits for the
+// writers to catch up once the limit is reached, so a frame with far more to
+// dump than the disk can keep up with slows down instead of using all the
+// memory in the system.
+//
+// This depends on nothing from D3D or the rest of 3DMigoto so that
+// TestFrameAnalysisWriter can check and benchmark it with a synthetic dump
+// workload.
+
+// Limit for [Hunting] analyse_writer_threads. Formatting text is CPU bound
+// and the rest is waiting on the disk, so more than this does not help:
+static const int MAX_FRAME_ANALYSIS_WRITER_THREADS = 16;
+
+// Backpressure limits - the most memory the copies waiting to be written can
+// use, and the most dumps that can be waiting:
+static const size_t FRAME_ANALYSIS_WRITER_MAX_STAGED_BYTES = 256 * 1024 * 1024;
+static const size_t FRAME_ANALYSIS_WRITER_MAX_QUEUED = 4096;
+
+struct FrameAnalysisWriterStats {
+	uint64_t queued;           // Dumps ever queued
+	uint64_t written;          // Dumps the writers have finished
+	uint64_t dropped;          // Dumps drain() threw away
+	uint64_t staged_bytes;     // Held in buffers that have not been returned
+	uint64_t max_staged_bytes; // Most that were ever held at once
+	uint64_t waits;            // Times get_buffer() waited for the writers
+	uint64_t buffers_reused;   // Buffers that came from the pool...
+	uint64_t buffers_allocated;// ...and those that didn't
+	uint64_t deduplicated;     // write_once() calls that found it already written
+};
+
+class FrameAnalysisWriter;
+
+// A CPU copy of a mapped resource. Goes back to the pool it came from when
+// it is destroyed.
+class FrameAnalysisBuffer {
+	friend class FrameAnalysisWriter;
+
+	FrameAnalysisWriter *writer;
+	uint8_t *buf;
+	size_t capacity;
+	size_t len;
+
+	FrameAnalysisBuffer(FrameAnalysisWriter *writer, uint8_t *buf, size_t capacity, size_t len);
+
+public:
+	~FrameAnalysisBuffer();
+
+	FrameAnalysisBuffer(const FrameAnalysisBuffer&) = delete;
+	FrameAnalysisBuffer& operator=(const FrameAnalysisBuffer&) = delete;
+
+	uint8_t* data() { return buf; }
+	const uint8_t* data() const { return buf; }
+	size_t size() const { return len; }
+};
+
+typedef std::unique_ptr<FrameAnalysisBuffer> FrameAnalysisBufferPtr;
+
+class FrameAnalysisWriter {
+	friend class FrameAnalysisBuffer;
+
+public:
+	typedef std::function<void(const FrameAnalysisBuffer &buffer)> Work;
+
+private:
+	struct Job {
+		FrameAnalysisBufferPtr buffer;
+		Work work;
+	};
+
+	// Written by the first caller of write_once(), others wait on it:
+	struct Once {
+		bool done;
+	};
+
+	size_t max_staged_bytes;
+	size_t max_queued;
+
+	std::mutex lock;
+	std::condition_variable work_cv;
+	std::condition_variable space_cv;
+	std::condition_variable idle_cv;
+	std::condition_variable once_cv;
+	std::deque<Job> jobs;
+	unsigned running;
+	bool stopping;
+	FrameAnalysisWriterStats stats;
+
+	// Buffers waiting to be reused, by capacity:
+	std::multimap<size_t, uint8_t*> pool;
+	size_t pool_bytes;
+
+	std::map<std::wstring, Once> written;
+
+	std::vector<std::thread> workers;
+
+	void worker_main();
+	void return_buffer(uint8_t *buf, size_t capacity);
+
+public:
+	// With no threads every dump is written on the calling thread as it is
+	// queued, as frame analysis always used to. 3DMigoto never destroys its
+	// writer, as with ShaderCompileQueue. Destroying one waits for anything
+	// already queued to be written.
+	FrameAnalysisWriter(unsigned threads, size_t max_staged_bytes, size_t max_queued);
+	~FrameAnalysisWriter();
+
+	// A buffer of len bytes to copy a mapped resource into. Waits for the
+	// writers if that would take the copies they haven't finished with over
+	// the limits, unless there are none, so a single resource larger than
+	// the limit can still be dumped. A thread must queue or destroy the
+	// buffer it has before asking for another.
+	FrameAnalysisBufferPtr get_buffer(size_t len);
+
+	// Hands the buffer to a writer to call work with it
+	void queue(FrameAnalysisBufferPtr buffer, Work work);
+
+	// Calls write the first time it is called with a path, so that two
+	// dumps with the same contents don't both write the same deduplicated
+	// file. Anyone else calling it with the same path while that is in
+	// progress waits for it to finish, so they can link to the file as soon
+	// as this returns. Returns whether write was called.
+	bool write_once(const std::wstring &path, std::function<void()> write);
+
+	// Waits for every queued dump to be written. progress is called about
+	// every interval while it waits.
+	void wait_idle(std::function<void(const FrameAnalysisWriterStats &stats)> progress = nullptr,
+			std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+	// Drops every dump that has not been started, and waits for the rest.
+	// Returns the number dropped.
+	size_t drain();
+
+	// Forgets which files write_once() has written, for the next frame
+	// analysis. Only call this once the writer is idle.
+	void forget_written();
+
+	FrameAnalysisWriterStats get_stats();
+};
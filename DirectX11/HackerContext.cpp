@@ -555,16 +555,20 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 	// Remember that we have analysed this one so we don't check it again
 	// (until config reload) regardless of whether we patch it or not:
 	orig_info->deferred_replacement_processed = true;
+	Profiling::shaderregex_overhead.count++;
 
 	switch (load_shader_regex_cache(hash, shader_type, &patched_bytecode, &tagline)) {
 	case ShaderRegexCache::NO_MATCH:
 		LogInfo("%S %016I64x has cached ShaderRegex miss\n", shader_type, hash);
+		Profiling::shaderregex_overhead.hits++;
 		goto out_drop;
 	case ShaderRegexCache::MATCH:
 		LogInfo("Loaded %S %016I64x command list from ShaderRegex cache\n", shader_type, hash);
+		Profiling::shaderregex_overhead.hits++;
 		goto out_drop;
 	case ShaderRegexCache::PATCH:
 		LogInfo("Loaded %S %016I64x bytecode from ShaderRegex cache\n", shader_type, hash);
+		Profiling::shaderregex_overhead.hits++;
 		break;
 	case ShaderRegexCache::NO_CACHE:
 		LogInfo("Performing deferred shader analysis on %S %016I64x...\n", shader_type, hash);
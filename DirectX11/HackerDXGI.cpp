@@ -70,6 +70,7 @@
 #include "IniHandler.h"
 #include "CommandList.h"
 #include "profiling.h"
+#include "FrameAnalysis.h"
 #include "cursor.h" // For InstallHookLate
 
 
@@ -229,8 +230,9 @@ void HackerSwapChain::RunFrameActions()
 	LogDebug("Running frame actions.  Device: %p\n", mHackerDevice);
 
 	// Regardless of log settings, since this runs every frame, let's flush the log
-	// so that the most lost will be one frame worth.  Tradeoff of performance to accuracy
-	if (LogFile) fflush(LogFile);
+	// so that the most lost will be one frame worth.  Tradeoff of performance to accuracy.
+	// With async logging this only wakes the background thread to do it.
+	LogFlushLater();
 
 	// Run the command list here, before drawing the overlay so that a
 	// custom shader on the present call won't remove the overlay. Also,
@@ -251,6 +253,7 @@ void HackerSwapChain::RunFrameActions()
 			G->analyse_frame_no++;
 		} else {
 			G->analyse_frame = false;
+			FrameAnalysisFinishWriting(false);
 			if (G->DumpUsage)
 				DumpUsage(G->ANALYSIS_PATH);
 			LogOverlay(LOG_INFO, "Frame analysis saved to %S\n", G->ANALYSIS_PATH);
@@ -266,6 +269,11 @@ void HackerSwapChain::RunFrameActions()
 	// that purpose rather than breaking the existing behaviour.
 	bool newEvent = DispatchInputEvents(mHackerDevice);
 
+	// Swap in any shaders that have finished compiling in the background
+	// since the last frame:
+	if (G->shader_compile_queue)
+		InstallBackgroundCompiledShaders();
+
 	CurrentTransition.UpdatePresets(mHackerDevice);
 	CurrentTransition.UpdateTransitions(mHackerDevice);
 
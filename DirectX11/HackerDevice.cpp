@@ -18,6 +18,7 @@
 
 #include <D3Dcompiler.h>
 #include <codecvt>
+#include <memory>
 
 #include "nvapi.h"
 #include "log.h"
@@ -32,6 +33,7 @@
 #include "D3D_Shaders\stdafx.h"
 #include "ResourceHash.h"
 #include "ShaderRegex.h"
+#include "ShaderDirectoryIndex.h"
 #include "CommandList.h"
 #include "Hunting.h"
 
@@ -745,11 +747,15 @@ static bool LoadBinaryShaders(__in UINT64 hash, const wchar_t *pShaderType,
 {
 	wchar_t path[MAX_PATH];
 
-	swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_replace.bin", G->SHADER_PATH, hash, pShaderType);
-	if (LoadCachedShader(path, pShaderType, pCode, pCodeSize, pShaderModel, pTimeStamp))
-		return true;
+	if (ShaderFileMayExist(G->SHADER_PATH, hash, pShaderType, ShaderFileVariant::REPLACE_BIN)) {
+		swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_replace.bin", G->SHADER_PATH, hash, pShaderType);
+		if (LoadCachedShader(path, pShaderType, pCode, pCodeSize, pShaderModel, pTimeStamp))
+			return true;
+	}
 
 	// If we can't find an HLSL compiled version, look for ASM assembled one.
+	if (!ShaderFileMayExist(G->SHADER_PATH, hash, pShaderType, ShaderFileVariant::ASM_BIN))
+		return false;
 	swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls.bin", G->SHADER_PATH, hash, pShaderType);
 	return LoadCachedShader(path, pShaderType, pCode, pCodeSize, pShaderModel, pTimeStamp);
 }
@@ -766,6 +772,9 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 	HANDLE f;
 	string shaderModel;
 
+	if (!ShaderFileMayExist(G->SHADER_PATH, hash, pShaderType, ShaderFileVariant::REPLACE_TXT))
+		return false;
+
 	swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_replace.txt", G->SHADER_PATH, hash, pShaderType);
 	f = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f != INVALID_HANDLE_VALUE)
@@ -843,7 +852,7 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 				LPVOID errMsg = errorMsgs->GetBufferPointer();
 				SIZE_T errSize = errorMsgs->GetBufferSize();
 				LogInfo("--------------------------------------------- BEGIN ---------------------------------------------\n");
-				fwrite(errMsg, 1, errSize - 1, LogFile);
+				LogWrite(errMsg, errSize - 1);
 				LogInfo("---------------------------------------------- END ----------------------------------------------\n");
 				errorMsgs->Release();
 			}
@@ -863,6 +872,7 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 					// Set the last modified timestamp on the cached shader to match the
 					// .txt file it is created from, so we can later check its validity:
 					set_file_last_write_time(path, &ftWrite);
+					ShaderIndexFileWritten(path);
 				} else
 					LogInfo("    error writing compiled shader to %S\n", path);
 			}
@@ -897,6 +907,9 @@ static bool ReplaceASMShader(__in UINT64 hash, const wchar_t *pShaderType, const
 	HANDLE f;
 	string shaderModel;
 
+	if (!ShaderFileMayExist(G->SHADER_PATH, hash, pShaderType, ShaderFileVariant::ASM_TXT))
+		return false;
+
 	swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls.txt", G->SHADER_PATH, hash, pShaderType);
 	f = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f != INVALID_HANDLE_VALUE)
@@ -960,6 +973,7 @@ static bool ReplaceASMShader(__in UINT64 hash, const wchar_t *pShaderType, const
 							// Set the last modified timestamp on the cached shader to match the
 							// .txt file it is created from, so we can later check its validity:
 							set_file_last_write_time(path, &ftWrite);
+							ShaderIndexFileWritten(path);
 						}
 						else
 						{
@@ -1001,11 +1015,18 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 		const char *overrideShaderModel)
 {
 	wchar_t val[MAX_PATH];
+	const wchar_t *export_dir;
 	string asmText;
+	string decompiledCode;
 	FILE *fw = NULL;
 	string shaderModel = "";
 	bool patched = false;
 	bool errorOccurred = false;
+	DecompileCacheKey cacheKey;
+	DecompileCacheEntry cached;
+	DecompileCacheStats cacheStats;
+	bool useCache = G->decompile_cache.is_open();
+	bool fromCache = false;
 	HRESULT hr;
 
 	if (!G->EXPORT_HLSL && !G->decompiler_settings.fixSvPosition && !G->decompiler_settings.recompileVs)
@@ -1013,42 +1034,77 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 
 	// Skip?
 	swprintf_s(val, MAX_PATH, L"%ls\\%016llx-%ls_bad.txt", G->SHADER_PATH, hash, shaderType);
-	if (GetFileAttributes(val) != INVALID_FILE_ATTRIBUTES) {
+	if (ShaderFileMayExist(G->SHADER_PATH, hash, shaderType, ShaderFileVariant::BAD_TXT)
+			&& GetFileAttributes(val) != INVALID_FILE_ATTRIBUTES) {
 		LogInfo("    skipping shader marked bad. %S\n", val);
 		return NULL;
 	}
 
 	// Store HLSL export files in ShaderCache, auto-Fixed shaders in ShaderFixes
-	if (G->EXPORT_HLSL >= 1)
-		swprintf_s(val, MAX_PATH, L"%ls\\%016llx-%ls_replace.txt", G->SHADER_CACHE_PATH, hash, shaderType);
-	else
-		swprintf_s(val, MAX_PATH, L"%ls\\%016llx-%ls_replace.txt", G->SHADER_PATH, hash, shaderType);
+	export_dir = G->EXPORT_HLSL >= 1 ? G->SHADER_CACHE_PATH : G->SHADER_PATH;
+	swprintf_s(val, MAX_PATH, L"%ls\\%016llx-%ls_replace.txt", export_dir, hash, shaderType);
 
 	// If we can open the file already, it exists, and thus we should skip doing this slow operation again.
-	if (GetFileAttributes(val) != INVALID_FILE_ATTRIBUTES)
+	if (ShaderFileMayExist(export_dir, hash, shaderType, ShaderFileVariant::REPLACE_TXT)
+			&& GetFileAttributes(val) != INVALID_FILE_ATTRIBUTES)
 		return NULL;
 
-	// Disassemble old shader for fixing.
-	asmText = BinaryToAsmText(pShaderBytecode, BytecodeLength, false);
-	if (asmText.empty()) {
-		LogInfo("    disassembly of original shader failed.\n");
-		return NULL;
+	// Shaders decompiled before, in this session or an earlier one:
+	if (useCache) {
+		decompile_cache_key(&cacheKey, hash, pShaderBytecode, BytecodeLength,
+				DecompilerSettingsHash(G->decompiler_settings), DecompilerVersion());
+		fromCache = G->decompile_cache.lookup(cacheKey, &cached);
+		cacheStats = G->decompile_cache.get_stats();
+		LogInfo("    decompiler cache %s (%u hits, %u misses).\n", fromCache ? "hit" : "miss",
+				cacheStats.hits, cacheStats.misses);
 	}
 
-	// Decompile code.
-	LogInfo("    creating HLSL representation.\n");
+	if (fromCache) {
+		if (cached.error) {
+			LogInfo("    error while decompiling (cached).\n");
+			return NULL;
+		}
+		asmText.swap(cached.asm_text);
+		decompiledCode.swap(cached.hlsl);
+		shaderModel.swap(cached.shader_model);
+		patched = cached.patched;
+	} else {
+		// Disassemble old shader for fixing.
+		asmText = BinaryToAsmText(pShaderBytecode, BytecodeLength, false);
+		if (asmText.empty()) {
+			LogInfo("    disassembly of original shader failed.\n");
+			return NULL;
+		}
 
-	ParseParameters p;
-	p.bytecode = pShaderBytecode;
-	p.decompiled = asmText.c_str();
-	p.decompiledSize = asmText.size();
-	p.ZeroOutput = false;
-	p.G = &G->decompiler_settings;
-	const string decompiledCode = DecompileBinaryHLSL(p, patched, shaderModel, errorOccurred);
-	if (!decompiledCode.size() || errorOccurred)
-	{
-		LogInfo("    error while decompiling.\n");
-		return NULL;
+		// Decompile code.
+		LogInfo("    creating HLSL representation.\n");
+
+		ParseParameters p;
+		p.bytecode = pShaderBytecode;
+		p.decompiled = asmText.c_str();
+		p.decompiledSize = asmText.size();
+		p.ZeroOutput = false;
+		p.G = &G->decompiler_settings;
+		decompiledCode = DecompileBinaryHLSL(p, patched, shaderModel, errorOccurred);
+
+		// Failures are cached too, so they are not retried every time:
+		if (useCache) {
+			cached.error = !decompiledCode.size() || errorOccurred;
+			if (!cached.error) {
+				cached.hlsl = decompiledCode;
+				cached.asm_text = asmText;
+				cached.shader_model = shaderModel;
+				cached.patched = patched;
+			}
+			if (!G->decompile_cache.store(cacheKey, cached))
+				LogInfo("    unable to add shader to the decompiler cache.\n");
+		}
+
+		if (!decompiledCode.size() || errorOccurred)
+		{
+			LogInfo("    error while decompiling.\n");
+			return NULL;
+		}
 	}
 
 	if ((G->EXPORT_HLSL >= 1) || (G->EXPORT_FIXED && patched))
@@ -1110,9 +1166,9 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 		LPVOID errMsg = pErrorMsgs->GetBufferPointer();
 		SIZE_T errSize = pErrorMsgs->GetBufferSize();
 		LogInfo("--------------------------------------------- BEGIN ---------------------------------------------\n");
-		fwrite(errMsg, 1, errSize - 1, LogFile);
+		LogWrite(errMsg, errSize - 1);
 		LogInfo("------------------------------------------- HLSL code -------------------------------------------\n");
-		fwrite(decompiledCode.c_str(), 1, decompiledCode.size(), LogFile);
+		LogWrite(decompiledCode.c_str(), decompiledCode.size());
 		LogInfo("\n---------------------------------------------- END ----------------------------------------------\n");
 
 		// And write the errors to the HLSL file as comments too, as a more convenient spot to see them.
@@ -1163,11 +1219,157 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 		timeStamp = ftWrite;
 
 		fclose(fw);
+		ShaderIndexFileWritten(val);
 	}
 
 	return !!pCode;
 }
 
+// Load an HLSL or ASM replacement from ShaderFixes and compile or assemble
+// it. Nothing here touches our shader maps, so this may run on one of the
+// ShaderCompileQueue workers as well as in CreateXXXShader.
+
+static char* CompileShaderFromShaderFixes(UINT64 hash, const wchar_t *shaderType, const void *pShaderBytecode,
+	SIZE_T BytecodeLength, SIZE_T &pCodeSize, string &foundShaderModel, FILETIME &timeStamp,
+	wstring &headerLine, const char *overrideShaderModel)
+{
+	char *pCode = NULL;
+
+	// Load previously created HLSL shaders, but only from ShaderFixes.
+	if (ReplaceHLSLShader(hash, shaderType, pShaderBytecode, BytecodeLength, overrideShaderModel,
+				pCode, pCodeSize, foundShaderModel, timeStamp, headerLine)) {
+		return pCode;
+	}
+
+	// If still not found, look for replacement ASM text shaders.
+	if (ReplaceASMShader(hash, shaderType, pShaderBytecode, BytecodeLength,
+				pCode, pCodeSize, foundShaderModel, timeStamp, headerLine)) {
+		return pCode;
+	}
+
+	return NULL;
+}
+
+// Everything _ReplaceShaderFromShaderFixes does once there is no .bin to
+// load: the above, or failing that decompiling the original shader for
+// export_hlsl and the auto fixes. This doesn't touch the shader maps either,
+// so a background compile falls back to the same things as CreateXXXShader.
+
+static char* CompileOrDecompileShader(UINT64 hash, const wchar_t *shaderType, const void *pShaderBytecode,
+	SIZE_T BytecodeLength, SIZE_T &pCodeSize, string &foundShaderModel, FILETIME &timeStamp,
+	wstring &headerLine, const char *overrideShaderModel)
+{
+	char *pCode = NULL;
+
+	pCode = CompileShaderFromShaderFixes(hash, shaderType, pShaderBytecode, BytecodeLength,
+			pCodeSize, foundShaderModel, timeStamp, headerLine, overrideShaderModel);
+	if (pCode)
+		return pCode;
+
+	if (DecompileAndPossiblyPatchShader(hash, shaderType, pShaderBytecode, BytecodeLength,
+				pCode, pCodeSize, foundShaderModel, timeStamp, headerLine,
+				shaderType, foundShaderModel, timeStamp, overrideShaderModel)) {
+		return pCode;
+	}
+
+	return NULL;
+}
+
+// Only shaders that definitely have an HLSL or ASM replacement are worth
+// sending to the background - the index only rules files out, and anything
+// without one still has to go through the decompiler on the calling thread:
+static bool ShaderFixesNeedsCompiling(UINT64 hash, const wchar_t *shaderType)
+{
+	wchar_t path[MAX_PATH];
+
+	if (ShaderFileMayExist(G->SHADER_PATH, hash, shaderType, ShaderFileVariant::REPLACE_TXT)) {
+		swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_replace.txt", G->SHADER_PATH, hash, shaderType);
+		if (GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES)
+			return true;
+	}
+
+	if (ShaderFileMayExist(G->SHADER_PATH, hash, shaderType, ShaderFileVariant::ASM_TXT)) {
+		swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls.txt", G->SHADER_PATH, hash, shaderType);
+		if (GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES)
+			return true;
+	}
+
+	return false;
+}
+
+// Everything a ShaderCompileQueue worker needs to replace a shader. The
+// references are held for as long as the job is, and dropped when it has
+// either run or been cancelled. The device is not referenced, since that
+// would keep it alive after the game has released it - HackerDevice::Release
+// drains the queue instead.
+struct BackgroundShaderCompile {
+	UINT64 hash;
+	wstring shaderType;
+	string overrideShaderModel;
+	ID3D11DeviceChild *original; // Only used to find its mReloadedShaders entry, not referenced
+	ID3DBlob *byteCode;          // Same blob as its mReloadedShaders entry
+	ID3D11ClassLinkage *linkage;
+	ID3D11Device1 *device;
+
+	~BackgroundShaderCompile()
+	{
+		byteCode->Release();
+		if (linkage)
+			linkage->Release();
+	}
+};
+
+// Runs on a ShaderCompileQueue worker. The game has been using the original
+// shader since it created it. Whether or not this manages to compile a
+// replacement, the result is left for InstallBackgroundCompiledShaders() to
+// deal with on the present thread, from where the replacement is bound the
+// next time the game sets the shader.
+template <class ID3D11Shader,
+	 HRESULT (__stdcall ID3D11Device::*OrigCreateShader)(THIS_
+			 __in const void *pShaderBytecode,
+			 __in SIZE_T BytecodeLength,
+			 __in_opt ID3D11ClassLinkage *pClassLinkage,
+			 __out_opt ID3D11Shader **ppShader)
+	 >
+static bool CompileShaderInBackground(BackgroundShaderCompile *job)
+{
+	CompletedShaderCompile completed;
+	ID3D11Shader *replacement = NULL;
+	SIZE_T replaceShaderSize;
+	char *replaceShader;
+	HRESULT hr;
+
+	completed.hash = job->hash;
+	completed.shaderType = job->shaderType;
+	completed.original = job->original;
+	completed.byteCode = job->byteCode;
+	completed.replacement = NULL;
+	completed.timeStamp = { 0 };
+
+	replaceShader = CompileOrDecompileShader(job->hash, job->shaderType.c_str(),
+			job->byteCode->GetBufferPointer(), job->byteCode->GetBufferSize(),
+			replaceShaderSize, completed.shaderModel, completed.timeStamp, completed.infoText,
+			job->overrideShaderModel.empty() ? NULL : job->overrideShaderModel.c_str());
+	if (replaceShader) {
+		hr = (job->device->*OrigCreateShader)(replaceShader, replaceShaderSize, job->linkage, &replacement);
+		delete [] replaceShader;
+		if (SUCCEEDED(hr))
+			completed.replacement = replacement;
+		else
+			LogInfo("    error creating background compiled %016llx-%ls\n", job->hash, job->shaderType.c_str());
+	} else {
+		LogInfo("    background compile of %016llx-%ls failed, keeping original shader\n",
+				job->hash, job->shaderType.c_str());
+	}
+
+	job->byteCode->AddRef();
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+		G->mCompletedShaderCompiles.push_back(completed);
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	return !!replacement;
+}
+
 // Fairly bold new strategy here for ReplaceShader. 
 // This is called at launch to replace any shaders that we might want patched to fix problems.
 // It would previously use both ShaderCache, and ShaderFixes both to fix shaders, but this is
@@ -1206,9 +1408,14 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 // the string read from the first line of the HLSL file.  This the logical place for
 // it because the file is already open and read into memory.
 
+//
+// If compileDeferred is passed in and the replacement would have to be
+// compiled from HLSL or assembled from ASM, this sets it and returns NULL
+// instead, so the caller can queue that to run in the background.
+
 char* HackerDevice::_ReplaceShaderFromShaderFixes(UINT64 hash, const wchar_t *shaderType, const void *pShaderBytecode,
 	SIZE_T BytecodeLength, SIZE_T &pCodeSize, string &foundShaderModel, FILETIME &timeStamp,
-	wstring &headerLine, const char *overrideShaderModel)
+	wstring &headerLine, const char *overrideShaderModel, bool *compileDeferred)
 {
 	foundShaderModel = "";
 	timeStamp = { 0 };
@@ -1232,25 +1439,15 @@ char* HackerDevice::_ReplaceShaderFromShaderFixes(UINT64 hash, const wchar_t *sh
 	if (LoadBinaryShaders(hash, shaderType, pCode, pCodeSize, foundShaderModel, timeStamp))
 		return pCode;
 
-	// Load previously created HLSL shaders, but only from ShaderFixes.
-	if (ReplaceHLSLShader(hash, shaderType, pShaderBytecode, BytecodeLength, overrideShaderModel,
-				pCode, pCodeSize, foundShaderModel, timeStamp, headerLine)) {
-		return pCode;
-	}
-
-	// If still not found, look for replacement ASM text shaders.
-	if (ReplaceASMShader(hash, shaderType, pShaderBytecode, BytecodeLength,
-				pCode, pCodeSize, foundShaderModel, timeStamp, headerLine)) {
-		return pCode;
-	}
-
-	if (DecompileAndPossiblyPatchShader(hash, shaderType, pShaderBytecode, BytecodeLength,
-				pCode, pCodeSize, foundShaderModel, timeStamp, headerLine,
-				shaderType, foundShaderModel, timeStamp, overrideShaderModel)) {
-		return pCode;
+	// Anything that needs compiling can be left to a background worker
+	// if the caller can handle that:
+	if (compileDeferred && ShaderFixesNeedsCompiling(hash, shaderType)) {
+		*compileDeferred = true;
+		return NULL;
 	}
 
-	return NULL;
+	return CompileOrDecompileShader(hash, shaderType, pShaderBytecode, BytecodeLength,
+			pCodeSize, foundShaderModel, timeStamp, headerLine, overrideShaderModel);
 }
 
 // This function handles shaders replaced from ShaderFixes at load time with or
@@ -1289,9 +1486,28 @@ HRESULT HackerDevice::ReplaceShaderFromShaderFixes(UINT64 hash,
 			overrideShaderModel = override->second.model;
 	}
 
+	// A worker creates the replacement on the device from its own thread,
+	// which a device created with D3D11_CREATE_DEVICE_SINGLETHREADED does
+	// not allow, so those are always compiled here instead. This asks the
+	// device we wrap, so it sees the game's flags whether we are wrapping
+	// or hooking it:
+	bool compileDeferred = false;
+	bool canDefer = G->async_shader_compile &&
+		!(mOrigDevice1->GetCreationFlags() & D3D11_CREATE_DEVICE_SINGLETHREADED);
 	char *replaceShader = _ReplaceShaderFromShaderFixes(hash, shaderType,
 			pShaderBytecode, BytecodeLength, replaceShaderSize,
-			shaderModel, ftWrite, headerLine, overrideShaderModel);
+			shaderModel, ftWrite, headerLine, overrideShaderModel,
+			canDefer ? &compileDeferred : NULL);
+	if (compileDeferred) {
+		hr = ReplaceShaderInBackground<ID3D11Shader, OrigCreateShader>
+			(hash, pShaderBytecode, BytecodeLength, pClassLinkage,
+			 ppShader, shaderType, overrideShaderModel);
+		if (hr != S_FALSE)
+			return hr;
+		replaceShader = CompileOrDecompileShader(hash, shaderType,
+				pShaderBytecode, BytecodeLength, replaceShaderSize,
+				shaderModel, ftWrite, headerLine, overrideShaderModel);
+	}
 	if (!replaceShader)
 		return E_FAIL;
 
@@ -1334,6 +1550,81 @@ out_delete:
 	return hr;
 }
 
+// This function handles shaders from ShaderFixes that have to be compiled or
+// assembled, when async_shader_compile is on. The game is given its original
+// shader straight away, registered for reloading so that SetShader will bind
+// the replacement in its place once a worker has compiled it. If the queue
+// is full this returns S_FALSE without having created anything, and the
+// caller compiles the shader itself as it would without the queue.
+template <class ID3D11Shader,
+	 HRESULT (__stdcall ID3D11Device::*OrigCreateShader)(THIS_
+			 __in const void *pShaderBytecode,
+			 __in SIZE_T BytecodeLength,
+			 __in_opt ID3D11ClassLinkage *pClassLinkage,
+			 __out_opt ID3D11Shader **ppShader)
+	 >
+HRESULT HackerDevice::ReplaceShaderInBackground(UINT64 hash,
+		const void *pShaderBytecode, SIZE_T BytecodeLength,
+		ID3D11ClassLinkage *pClassLinkage, ID3D11Shader **ppShader,
+		wchar_t *shaderType, const char *overrideShaderModel)
+{
+	std::shared_ptr<BackgroundShaderCompile> job;
+	ID3DBlob *blob;
+	HRESULT hr;
+
+	hr = D3DCreateBlob(BytecodeLength, &blob);
+	if (FAILED(hr))
+		return hr;
+	memcpy(blob->GetBufferPointer(), pShaderBytecode, BytecodeLength);
+
+	*ppShader = NULL; // Appease the static analysis gods
+	hr = (mOrigDevice1->*OrigCreateShader)(pShaderBytecode, BytecodeLength, pClassLinkage, ppShader);
+	if (FAILED(hr)) {
+		blob->Release();
+		return hr;
+	}
+	CleanupShaderMaps(*ppShader);
+
+	job = std::make_shared<BackgroundShaderCompile>();
+	job->hash = hash;
+	job->shaderType = shaderType;
+	if (overrideShaderModel)
+		job->overrideShaderModel = overrideShaderModel;
+	job->original = *ppShader;
+	job->byteCode = blob;
+	job->linkage = pClassLinkage;
+	job->device = mOrigDevice1;
+	blob->AddRef();
+	if (pClassLinkage)
+		pClassLinkage->AddRef();
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+		RegisterForReload(*ppShader, hash, shaderType, "bin", pClassLinkage, blob, {0}, L"", false);
+
+		// The game is holding the original, so that is also what
+		// marking_mode=original and the filters need to switch back to:
+		if (NeedOriginalShader(hash) && lookup_original_shader(*ppShader) == end(G->mOriginalShaders)) {
+			(*ppShader)->AddRef();
+			G->mOriginalShaders[*ppShader] = *ppShader;
+		}
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	if (G->shader_compile_queue->submit((uint64_t)*ppShader, [job] {
+			return CompileShaderInBackground<ID3D11Shader, OrigCreateShader>(job.get());
+		})) {
+		LogInfo("    queued for background compile\n");
+		return S_OK;
+	}
+
+	// Queue is full. Throw the original away again so the game gets the
+	// replacement from the caller, the same as without the queue:
+	LogInfo("    background compile queue is full, compiling now\n");
+	CleanupShaderMaps(*ppShader);
+	(*ppShader)->Release();
+	*ppShader = NULL;
+	return S_FALSE;
+}
+
 // This function handles shaders that were *NOT* replaced from ShaderFixes
 //
 // When hunting is disabled we don't save off the original shader unless we
@@ -1442,6 +1733,12 @@ void CleanupShaderMaps(ID3D11DeviceChild *handle)
 	if (!handle)
 		return;
 
+	// A background compile still queued for the old shader must not be
+	// swapped in over the new one. One that is already running checks for
+	// itself that its mReloadedShaders entry is still the same:
+	if (G->shader_compile_queue)
+		G->shader_compile_queue->cancel((uint64_t)handle);
+
 	EnterCriticalSectionPretty(&G->mCriticalSection);
 
 	{
@@ -1478,6 +1775,55 @@ void CleanupShaderMaps(ID3D11DeviceChild *handle)
 	LeaveCriticalSection(&G->mCriticalSection);
 }
 
+void InstallBackgroundCompiledShaders()
+{
+	std::vector<CompletedShaderCompile> completed;
+	ShaderReloadMap::iterator i;
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+
+	if (G->mCompletedShaderCompiles.empty()) {
+		LeaveCriticalSection(&G->mCriticalSection);
+		return;
+	}
+	completed.swap(G->mCompletedShaderCompiles);
+
+	for (CompletedShaderCompile &c : completed) {
+		// The queue no longer needs to know about the compile, whatever
+		// happens to its result:
+		G->shader_compile_queue->finish((uint64_t)c.original);
+
+		// Left until now since it changes the maps as well:
+		CleanupShaderMaps(c.replacement);
+
+		// The game may have released the original and had its handle
+		// reused for another shader while we were compiling, in which
+		// case the entry we registered is gone along with its bytecode:
+		i = lookup_reloaded_shader(c.original);
+		if (i == G->mReloadedShaders.end() || i->second.byteCode != c.byteCode) {
+			LogInfo("%016llx-%ls was released before its background compile finished\n",
+					c.hash, c.shaderType.c_str());
+			if (c.replacement)
+				c.replacement->Release();
+		} else if (c.replacement) {
+			if (i->second.replacement)
+				i->second.replacement->Release();
+			i->second.replacement = c.replacement;
+			i->second.shaderModel = c.shaderModel;
+			i->second.timeStamp = c.timeStamp;
+			i->second.infoText = c.infoText;
+			LogInfo("%016llx-%ls replaced after background compile\n", c.hash, c.shaderType.c_str());
+		} else {
+			// Same as ProcessShaderNotFoundInShaderFixes would have
+			// registered it without the queue:
+			i->second.deferred_replacement_candidate = G->hunting || !shader_regex_groups.empty();
+		}
+		c.byteCode->Release();
+	}
+
+	LeaveCriticalSection(&G->mCriticalSection);
+}
+
 // Keep the original shader around if it may be needed by a filter in a
 // [ShaderOverride] section, or if hunting is enabled and either the
 // marking_mode=original, or reload_config support is enabled
@@ -1529,6 +1875,21 @@ STDMETHODIMP_(ULONG) HackerDevice::AddRef(THIS)
 
 STDMETHODIMP_(ULONG) HackerDevice::Release(THIS)
 {
+	// Background compiles use the device without holding a reference to
+	// it, so before the last one goes anything still queued is cancelled,
+	// and we wait for any that are running. That cancels compiles for any
+	// other device as well, which keep their original shaders until the
+	// next reload, but a second device is usually a throwaway one
+	// the game created to check what the hardware supports.
+	if (G->shader_compile_queue) {
+		mOrigDevice1->AddRef();
+		if (mOrigDevice1->Release() == 1) {
+			size_t cancelled = G->shader_compile_queue->drain();
+			if (cancelled)
+				LogInfo("HackerDevice::Release cancelled %Iu background shader compiles\n", cancelled);
+		}
+	}
+
 	ULONG ulRef = mOrigDevice1->Release();
 	LogDebug("HackerDevice::Release counter=%d, this=%p\n", ulRef, this);
 
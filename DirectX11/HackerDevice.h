@@ -57,7 +57,7 @@ private:
 	// Utility routines
 	char *_ReplaceShaderFromShaderFixes(UINT64 hash, const wchar_t *shaderType, const void *pShaderBytecode,
 		SIZE_T BytecodeLength, SIZE_T &pCodeSize, string &foundShaderModel, FILETIME &timeStamp,
-		wstring &headerLine, const char *overrideShaderModel);
+		wstring &headerLine, const char *overrideShaderModel, bool *compileDeferred);
 
 	template <class ID3D11Shader,
 		 HRESULT (__stdcall ID3D11Device::*OrigCreateShader)(THIS_
@@ -79,6 +79,17 @@ private:
 	HRESULT ProcessShaderNotFoundInShaderFixes(UINT64 hash, const void *pShaderBytecode, SIZE_T BytecodeLength,
 			ID3D11ClassLinkage *pClassLinkage, ID3D11Shader **ppShader, wchar_t *shaderType);
 
+	template <class ID3D11Shader,
+		 HRESULT (__stdcall ID3D11Device::*OrigCreateShader)(THIS_
+				 __in const void *pShaderBytecode,
+				 __in SIZE_T BytecodeLength,
+				 __in_opt ID3D11ClassLinkage *pClassLinkage,
+				 __out_opt ID3D11Shader **ppShader)
+		 >
+	HRESULT ReplaceShaderInBackground(UINT64 hash, const void *pShaderBytecode, SIZE_T BytecodeLength,
+		ID3D11ClassLinkage *pClassLinkage, ID3D11Shader **ppShader, wchar_t *shaderType,
+		const char *overrideShaderModel);
+
 	bool NeedOriginalShader(UINT64 hash);
 
 	template <class ID3D11Shader,
@@ -20,6 +20,7 @@
 #include "profiling.h"
 #include "FrameAnalysis.h"
 #include "ShaderRegex.h"
+#include "ShaderDirectoryIndex.h"
 
 // bo3b: For this routine, we have a lot of warnings in x64, from converting a size_t result into the needed
 //  DWORD type for the Write calls.  These are writing 256 byte strings, so there is never a chance that it 
@@ -564,6 +565,7 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 	*pBytes = size;
 	*ppData = buf;
 	push_dir(apath.c_str());
+	included.push_back(wpath);
 	LogDebug("       -> %p\n", buf);
 
 	return S_OK;
@@ -600,6 +602,11 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 
 	WarnIfConflictingShaderExists(fullName);
 
+	// The index already knows the time stamp of everything in
+	// ShaderFixes, so most unchanged files need not be opened at all:
+	if (ShaderIndexFileUnchanged(fullName, timeStamp))
+		return false;
+
 	HANDLE f = CreateFile(fullName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f == INVALID_HANDLE_VALUE)
 	{
@@ -672,7 +679,7 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 				// If there are only warnings they go to the
 				// log file, because it's too noisy to send all
 				// these to the overlay.
-				fwrite(errMsg, 1, errSize - 1, LogFile);
+				LogWrite(errMsg, errSize - 1);
 			}
 			LogInfo("---------------------------------------------- END ----------------------------------------------\n");
 			if (errText)
@@ -1250,6 +1257,14 @@ static void ReloadFixes(HackerDevice *device, void *private_data)
 {
 	LogInfo("> reloading *_replace.txt fixes from ShaderFixes\n");
 
+	// Anything still waiting on a background compile is picked up by the
+	// reload below since it has no timestamp yet, and a compile finishing
+	// part way through would race with it, so settle the queue first:
+	if (G->shader_compile_queue) {
+		G->shader_compile_queue->drain();
+		InstallBackgroundCompiledShaders();
+	}
+
 	if (G->SHADER_PATH[0])
 	{
 		bool success = true;
@@ -1317,9 +1332,10 @@ static void EnableFix(HackerDevice *device, void *private_data)
 	G->fix_enabled = true;
 }
 
-static void _AnalyseFrameStop()
+static void _AnalyseFrameStop(bool aborted)
 {
 	G->analyse_frame = false;
+	FrameAnalysisFinishWriting(aborted);
 	if (G->DumpUsage) {
 		EnterCriticalSectionPretty(&G->mCriticalSection);
 			DumpUsage(G->ANALYSIS_PATH);
@@ -1346,7 +1362,7 @@ static void AnalyseFrame(HackerDevice *device, void *private_data)
 		// already in progress, abort:
 		device->GetHackerContext()->FrameAnalysisLog("----- Frame analysis aborted -----\n");
 		LogOverlay(LOG_NOTICE, "Frame analysis aborted\n");
-		return _AnalyseFrameStop();
+		return _AnalyseFrameStop(true);
 	}
 
 	if (G->hunting != HUNTING_MODE_ENABLED)
@@ -1373,6 +1389,15 @@ static void AnalyseFrame(HackerDevice *device, void *private_data)
 
 	wcscpy(G->ANALYSIS_PATH, path);
 
+	// The writer threads can't be stopped once started, so the thread
+	// count is whatever it was for the first frame analysis:
+	if (!G->frame_analysis_writer) {
+		G->frame_analysis_writer = new FrameAnalysisWriter(
+				max(0, min(G->analyse_writer_threads, MAX_FRAME_ANALYSIS_WRITER_THREADS)),
+				FRAME_ANALYSIS_WRITER_MAX_STAGED_BYTES,
+				FRAME_ANALYSIS_WRITER_MAX_QUEUED);
+	}
+
 	G->cur_analyse_options = G->def_analyse_options;
 	G->frame_analysis_seen_rts.clear();
 	G->analyse_frame_no = 1;
@@ -1393,7 +1418,7 @@ static void AnalyseFrameStop(HackerDevice *device, void *private_data)
 		// right at a glance.
 		LogOverlay(LOG_NOTICE, "Frame analysis hold mode ended after %i complete frames\n",
 				G->analyse_frame_no - 1);
-		_AnalyseFrameStop();
+		_AnalyseFrameStop(false);
 	}
 }
 
@@ -2090,6 +2115,8 @@ void ParseHuntingSection()
 			(FrameAnalysisOptionNames, buf, NULL);
 	} else
 		G->def_analyse_options = FrameAnalysisOptions::INVALID;
+	G->analyse_writer_threads = GetIniInt(L"Hunting", L"analyse_writer_threads", 4, NULL);
+	G->analyse_binary_log = GetIniBool(L"Hunting", L"analyse_binary_log", false, NULL);
 
 	// Quick hacks to see if DX11 features that we only have limited support for are responsible for anything important:
 	RegisterIniKeyBinding(L"Hunting", L"kill_deferred", DisableDeferred, EnableDeferred, noRepeat, NULL);
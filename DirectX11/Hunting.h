@@ -11,6 +11,10 @@ class MigotoIncludeHandler : public ID3DInclude
 
 	void push_dir(const char *path);
 public:
+	// Every file that was included, for anything that needs to know when
+	// to compile the shader again:
+	std::vector<std::wstring> included;
+
 	MigotoIncludeHandler(const char *path);
 
 	STDMETHOD(Open)(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes);
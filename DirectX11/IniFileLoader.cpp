@@ -0,0 +1,183 @@
+#include "IniFileLoader.h"
+
+#include <map>
+
+#include "IniReload.h"
+
+IniFileLoader::IniFileLoader(unsigned threads, ReadFile read_file, ListDirectory list_directory) :
+	read_file(read_file),
+	list_directory(list_directory),
+	stopping(false)
+{
+	unsigned i;
+
+	for (i = 0; i < threads; i++)
+		workers.emplace_back(&IniFileLoader::worker_main, this);
+}
+
+IniFileLoader::~IniFileLoader()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		jobs.clear();
+		stopping = true;
+	}
+	work_cv.notify_all();
+
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+void IniFileLoader::worker_main()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (true) {
+		work_cv.wait(guard, [&] { return stopping || !jobs.empty(); });
+		if (stopping)
+			return;
+
+		std::function<void()> job = std::move(jobs.front());
+		jobs.pop_front();
+
+		guard.unlock();
+		job();
+		guard.lock();
+	}
+}
+
+void IniFileLoader::run(std::function<void()> job)
+{
+	if (workers.empty()) {
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		jobs.push_back(std::move(job));
+	}
+	work_cv.notify_one();
+}
+
+void IniFileLoader::load(File *file)
+{
+	IniFileFragment &fragment = file->fragment;
+
+	// An exception escaping a worker would take down the game, so
+	// anything reading the file throws just counts as not opening it:
+	try {
+		fragment.opened = read_file(fragment.path, &fragment.buffer);
+		if (fragment.opened) {
+			fragment.hash = ini_reload_hash(0, fragment.buffer->data(), fragment.buffer->size());
+			tokenise_ini(fragment.buffer->data(), fragment.buffer->size(), &fragment.tokens);
+		}
+	} catch (...) {
+		fragment.opened = false;
+		fragment.tokens.clear();
+		fragment.buffer.reset();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		file->ready = true;
+	}
+	done_cv.notify_all();
+}
+
+void IniFileLoader::queue_file(const std::wstring &path)
+{
+	std::shared_ptr<File> file = std::make_shared<File>();
+
+	file->fragment.path = path;
+	file->fragment.opened = false;
+	file->fragment.hash = 0;
+	file->ready = false;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		files.push_back(file);
+	}
+
+	run([this, file] { load(file.get()); });
+}
+
+bool IniFileLoader::next_file(IniFileFragment *fragment)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	if (files.empty())
+		return false;
+
+	std::shared_ptr<File> file = files.front();
+	files.pop_front();
+
+	done_cv.wait(guard, [&] { return file->ready; });
+	*fragment = std::move(file->fragment);
+	return true;
+}
+
+struct IniFileLoader::Walk {
+	std::map<std::wstring, IniDirectoryListing> listings;
+	unsigned outstanding;
+};
+
+void IniFileLoader::list(std::shared_ptr<Walk> walk, const std::wstring &rel_path)
+{
+	IniDirectoryListing listing;
+
+	listing.rel_path = rel_path;
+	listing.found = false;
+	try {
+		list_directory(&listing);
+	} catch (...) {
+		listing = IniDirectoryListing();
+		listing.rel_path = rel_path;
+		listing.found = false;
+	}
+
+	// Counted before this directory is marked done, so walk() can't see
+	// outstanding hit 0 while there are still subdirectories to list:
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		walk->outstanding += (unsigned)listing.directories.size();
+	}
+	for (const std::wstring &directory : listing.directories) {
+		std::wstring path = rel_path + L"\\" + directory;
+		run([this, walk, path] { list(walk, path); });
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		walk->listings[rel_path] = std::move(listing);
+		walk->outstanding--;
+	}
+	done_cv.notify_all();
+}
+
+static void collect_listings(std::map<std::wstring, IniDirectoryListing> *all,
+		const std::wstring &rel_path, std::vector<IniDirectoryListing> *listings)
+{
+	IniDirectoryListing &listing = all->at(rel_path);
+	std::vector<std::wstring> directories = listing.directories;
+
+	listings->push_back(std::move(listing));
+
+	for (const std::wstring &directory : directories)
+		collect_listings(all, rel_path + L"\\" + directory, listings);
+}
+
+void IniFileLoader::walk(const std::wstring &rel_path, std::vector<IniDirectoryListing> *listings)
+{
+	std::shared_ptr<Walk> walk = std::make_shared<Walk>();
+
+	walk->outstanding = 1;
+	run([this, walk, rel_path] { list(walk, rel_path); });
+
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		done_cv.wait(guard, [&] { return !walk->outstanding; });
+	}
+
+	collect_listings(&walk->listings, rel_path, listings);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IniTokenizer.h"
+
+// Reads and tokenises the ini files pulled in by [Include] on worker threads,
+// so that a Mods directory with hundreds or thousands of ini files is not
+// read one file at a time on the thread loading the config.
+//
+// Only the parts of loading that do not depend on anything else happen on
+// the workers - listing directories, mapping each file and splitting it into
+// lines. The files are handed back in the same order they were queued, and
+// the caller adds them to ini_sections one after another in that order just
+// as it always has, so namespaces, include conditions, duplicate section and
+// key warnings, and which of two conflicting mods wins are all unchanged.
+//
+// This depends on nothing from Windows so that TestIniFileLoader can check
+// it. Reading files and listing directories is left to the caller for the
+// same reason.
+
+// Worker limit. These are mostly waiting on the disk, but there is no
+// point having more of them than the disk can keep busy:
+static const unsigned MAX_INI_LOADER_THREADS = 8;
+
+struct IniFileFragment {
+	std::wstring path;
+	bool opened;
+	uint32_t hash;     // ini_reload_hash() of the contents
+
+	// The tokens are views into the buffer, which is only kept until
+	// they have been parsed:
+	std::shared_ptr<IniFileBuffer> buffer;
+	std::vector<IniToken> tokens;
+};
+
+// One directory from a recursive include. Filled out by the caller's
+// list_directory, which decides what counts as an ini file, what is
+// excluded, and the order (case insensitive) they will be loaded in:
+struct IniDirectoryListing {
+	std::wstring rel_path;
+	bool found;
+	std::vector<std::wstring> ini_files;
+	std::vector<std::wstring> directories;
+
+	// Only so the caller can log them in order afterwards:
+	std::vector<std::wstring> excluded;
+	std::vector<std::wstring> others;
+};
+
+class IniFileLoader {
+public:
+	typedef std::function<bool(const std::wstring &path, std::shared_ptr<IniFileBuffer> *buffer)> ReadFile;
+	typedef std::function<void(IniDirectoryListing *listing)> ListDirectory;
+
+private:
+	struct File {
+		IniFileFragment fragment;
+		bool ready;
+	};
+
+	ReadFile read_file;
+	ListDirectory list_directory;
+
+	std::mutex lock;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	std::deque<std::function<void()>> jobs;
+	bool stopping;
+
+	// In the order they were queued, waiting for next_file() to take them:
+	std::deque<std::shared_ptr<File>> files;
+
+	std::vector<std::thread> workers;
+
+	void worker_main();
+	void run(std::function<void()> job);
+	void load(File *file);
+
+	struct Walk;
+	void list(std::shared_ptr<Walk> walk, const std::wstring &rel_path);
+
+public:
+	// With no threads everything is done on the calling thread as it is
+	// queued. Destroying the loader waits for whatever the workers are
+	// doing.
+	IniFileLoader(unsigned threads, ReadFile read_file, ListDirectory list_directory);
+	~IniFileLoader();
+
+	// Starts reading and tokenising a file
+	void queue_file(const std::wstring &path);
+
+	// Returns the next file in the order they were queued, waiting for it
+	// if necessary. Returns false when there are none left.
+	bool next_file(IniFileFragment *fragment);
+
+	// Lists rel_path and every directory below it, and returns them in the
+	// order ParseIniFilesRecursive has always visited them - each
+	// directory's ini files, then each of its subdirectories in turn.
+	void walk(const std::wstring &rel_path, std::vector<IniDirectoryListing> *listings);
+};
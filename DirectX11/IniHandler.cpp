@@ -16,6 +16,10 @@
 #include "Hunting.h"
 #include "nvprofile.h"
 #include "ShaderRegex.h"
+#include "ShaderDirectoryIndex.h"
+#include "IniReload.h"
+#include "IniFileLoader.h"
+#include "IniKeys.h"
 #include "cursor.h"
 
 #define INI_FILENAME L"d3dx.ini"
@@ -169,33 +173,16 @@ struct WStringInsensitiveLess {
 	}
 };
 
+// Every section and key name seen in this load, interned so that looking one
+// up hashes it in place instead of making a lower case copy (IniKeys.h):
+static IniKeyTable ini_section_names;
+static IniKeyTable ini_key_names;
 
-// Case insensitive version of the wstring hashing and equality functions for
-// case insensitive maps that we can use to look up ini sections and keys:
-struct WStringInsensitiveHash {
-	size_t operator()(const wstring &s) const
-	{
-		std::wstring l;
-		std::hash<std::wstring> whash;
-
-		l.resize(s.size());
-		std::transform(s.begin(), s.end(), l.begin(), ::towlower);
-		return whash(l);
-	}
-};
-struct WStringInsensitiveEquality {
-	size_t operator()(const wstring &x, const wstring &y) const
-	{
-		return _wcsicmp(x.c_str(), y.c_str()) == 0;
-	}
-};
-
-// Unsorted maps for fast case insensitive key lookups by name
-typedef std::unordered_map<wstring, wstring, WStringInsensitiveHash, WStringInsensitiveEquality> IniSectionMap;
-typedef std::unordered_set<wstring, WStringInsensitiveHash, WStringInsensitiveEquality> IniSectionSet;
+// Unsorted map for fast key lookups by interned name
+typedef std::unordered_map<IniKey, wstring> IniKeyMap;
 
 struct IniSection {
-	IniSectionMap kv_map;
+	IniKeyMap kv_map;
 	IniSectionVector kv_vec;
 
 	// Stores the ini namespace/path that this section came from. ini_path
@@ -207,27 +194,43 @@ struct IniSection {
 	wstring ini_path;
 };
 
-// std::map is used so this is sorted for iterating over a prefix:
-typedef std::map<wstring, IniSection, WStringInsensitiveLess> IniSections;
+// Sorted for iterating over a prefix, and indexed for looking up by name:
+typedef IniNameMap<IniSection> IniSections;
 
-IniSections ini_sections;
+IniSections ini_sections(&ini_section_names);
 
-// Returns an iterator to the first element in a set that does not begin with
-// prefix in a case insensitive way. Combined with set::lower_bound, this can
-// be used to iterate over all elements in the sections set that begin with a
-// given prefix.
-static IniSections::iterator prefix_upper_bound(IniSections &sections, wstring &prefix)
+static void LogIniNameStats()
 {
-	IniSections::iterator i;
+	IniKeyStats sections = ini_section_names.get_stats();
+	IniKeyStats keys = ini_key_names.get_stats();
 
-	for (i = sections.lower_bound(prefix); i != sections.end(); i++) {
-		if (_wcsnicmp(i->first.c_str(), prefix.c_str(), prefix.length()) > 0)
-			return i;
-	}
+	LogInfo("Ini names: %zu sections, %zu keys, %llu lookups (%llu not found), %llu names compared\n",
+			ini_section_names.size(), ini_key_names.size(),
+			sections.lookups + keys.lookups, sections.misses + keys.misses,
+			sections.probes + keys.probes);
+}
 
-	return sections.end();
+// Last write time and size, folded together. 0 if the file is missing:
+static uint64_t stamp_file(const wstring &path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	uint64_t mtime, size;
+
+	if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes))
+		return 0;
+
+	mtime = (uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32 | attributes.ftLastWriteTime.dwLowDateTime;
+	size = (uint64_t)attributes.nFileSizeHigh << 32 | attributes.nFileSizeLow;
+	return mtime ^ (size * 0x9e3779b97f4a7c15ull);
 }
 
+// What the last config load was built from, so that a reload can keep the
+// custom shaders and resources from any section that has not changed. The
+// objects from the last load are moved here while the new ones are parsed:
+static IniReloadTracker ini_reload(stamp_file);
+static CustomShaders previous_custom_shaders;
+static CustomResources previous_custom_resources;
+
 // We now emit a single warning tone after the config file is [re]loaded to get
 // the shaderhackers attention if something needs to be addressed, since their
 // eyes may be focussed elsewhere and may miss the notification message[s].
@@ -282,11 +285,12 @@ wstring get_namespaced_var_name_lower(const wstring var, const wstring *ini_name
 
 static bool _get_section_namespace(IniSections *custom_ini_sections, const wchar_t *section, wstring *ret)
 {
-	try {
-		*ret = custom_ini_sections->at(wstring(section)).ini_namespace;
-	} catch (std::out_of_range) {
+	IniSections::iterator i = custom_ini_sections->find(section);
+
+	if (i == custom_ini_sections->end())
 		return false;
-	}
+
+	*ret = i->second.ini_namespace;
 	return (!ret->empty());
 }
 
@@ -297,13 +301,12 @@ bool get_section_namespace(const wchar_t *section, wstring *ret)
 
 static bool _get_section_path(IniSections *custom_ini_sections, const wchar_t *section, wstring *ret)
 {
+	IniSections::iterator i = custom_ini_sections->find(section);
 	IniSection *entry;
 
-	try {
-		entry = &custom_ini_sections->at(wstring(section));
-	} catch (std::out_of_range) {
+	if (i == custom_ini_sections->end())
 		return false;
-	}
+	entry = &i->second;
 
 	if (entry->ini_path.empty())
 		*ret = entry->ini_namespace;
@@ -356,7 +359,7 @@ static void ParseIniSectionLine(wstring *wline, wstring *section,
 {
 	bool allow_duplicate_sections = false;
 	size_t first, last;
-	bool inserted;
+	std::pair<IniSections::iterator, bool> inserted;
 	bool namespaced_section = false;
 
 	*warn_duplicates = 1;
@@ -401,8 +404,8 @@ static void ParseIniSectionLine(wstring *wline, wstring *section,
 	// key matches, which would have to be handled elsewhere.  For now,
 	// continue warning about duplicate sections and match the old
 	// behaviour.
-	inserted = ini_sections.emplace(*section, IniSection{}).second;
-	if (!inserted && !allow_duplicate_sections) {
+	inserted = ini_sections.emplace(*section);
+	if (!inserted.second && !allow_duplicate_sections) {
 		IniWarning("WARNING: Duplicate section found in d3dx.ini: [%S]\n",
 				section->c_str());
 		section->clear();
@@ -410,15 +413,15 @@ static void ParseIniSectionLine(wstring *wline, wstring *section,
 		return;
 	}
 
-	*section_vector = &ini_sections[*section].kv_vec;
+	*section_vector = &inserted.first->second.kv_vec;
 
 	// Record the namespace so we can use it later when looking up any
 	// referenced sections. Only for namespaced sections, not global
 	// sections:
 	if (namespaced_section) {
-		ini_sections[*section].ini_namespace = *ini_namespace;
+		inserted.first->second.ini_namespace = *ini_namespace;
 		if (*ini_path != *ini_namespace)
-			ini_sections[*section].ini_path = *ini_path;
+			inserted.first->second.ini_path = *ini_path;
 	}
 
 	// Sections that utilise a command list are allowed to have duplicate
@@ -461,28 +464,22 @@ bool check_include_condition(wstring *val, const wstring *ini_namespace)
 	return !!ret;
 }
 
-static bool ParseIniPreamble(wstring *wline, wstring *ini_namespace)
+static bool ParseIniPreamble(const IniToken *token, wstring *ini_namespace)
 {
-	size_t first, last, delim;
-	wstring key, val;
+	wstring line, val;
 
-	LogInfo("      %S\n", wline->c_str());
+	ini_assign(token->line, &line);
+	LogInfo("      %S\n", line.c_str());
 
 	// Key / Val pair
-	delim = wline->find(L"=");
-	if (delim != wline->npos) {
-		// Strip whitespace around delimiter:
-		last = wline->find_last_not_of(L" \t", delim - 1);
-		key = wline->substr(0, last + 1);
-		first = wline->find_first_not_of(L" \t", delim + 1);
-		if (first != wline->npos)
-			val = wline->substr(first);
-
-		if (!_wcsicmp(key.c_str(), L"condition")) {
+	if (token->equals) {
+		if (ini_view_equals(token->key, "condition")) {
+			ini_assign(token->val, &val);
 			return check_include_condition(&val, ini_namespace);
 		}
 
-		if (!_wcsicmp(key.c_str(), L"namespace")) {
+		if (ini_view_equals(token->key, "namespace")) {
+			ini_assign(token->val, &val);
 			LogInfo("        Renaming namespace \"%S\" -> \"%S\"\n", ini_namespace->c_str(), val.c_str());
 			*ini_namespace = val;
 			return true;
@@ -490,38 +487,52 @@ static bool ParseIniPreamble(wstring *wline, wstring *ini_namespace)
 	}
 
 	IniWarning("WARNING: d3dx.ini entry outside of section: %S\n",
-			wline->c_str());
+			line.c_str());
 	return true;
 }
 
-static void ParseIniKeyValLine(wstring *wline, wstring *section,
+static void ParseIniKeyValLine(const IniToken *token, wstring *section,
 		int warn_duplicates, bool warn_lines_without_equals,
 		IniSectionVector *section_vector, const wstring *ini_namespace)
 {
-	size_t first, last, delim;
-	wstring key, val;
+	wstring line;
 	bool inserted;
 
 	if (section->empty() || section_vector == NULL) {
+		ini_assign(token->line, &line);
 		IniWarning("WARNING: d3dx.ini entry outside of section: %S\n",
-				wline->c_str());
+				line.c_str());
 		return;
 	}
 
-	// Key / Val pair
-	delim = wline->find(L"=");
-	if (delim != wline->npos) {
-		// Strip whitespace around delimiter:
-		last = wline->find_last_not_of(L" \t", delim - 1);
-		key = wline->substr(0, last + 1);
-		first = wline->find_first_not_of(L" \t", delim + 1);
-		if (first != wline->npos)
-			val = wline->substr(first);
+	if (!token->equals && warn_lines_without_equals) {
+		// No = on line, don't store in key lookup maps to match the
+		// behaviour of GetPrivateProfileString, and this section
+		// type doesn't want any lines like this for its own parser:
+		ini_assign(token->line, &line);
+		IniWarning("WARNING: Malformed line in d3dx.ini: [%S] \"%S\"\n",
+				section->c_str(), line.c_str());
+		return;
+	}
+
+	// This is the only copy of the line we keep, so it is widened
+	// straight into the section vector and the key lookup map copies the
+	// value from there:
+	section_vector->emplace_back(*ini_namespace);
+	IniLine &entry = section_vector->back();
+	ini_widen(token->key, &entry.first);
+	ini_widen(token->val, &entry.second);
+	ini_widen(token->line, &entry.raw_line);
+
+	// Key / Val pair, already split by IniTokenizer:
+	if (token->equals) {
+		const wstring &key = entry.first;
+		const wstring &val = entry.second;
 
 		if (warn_duplicates == 2) {
 			// Recursively loaded config files are permitted to
 			// override values from the main d3dx.ini:
-			ini_sections.at(*section).kv_map[key] = val;
+			ini_sections.at(*section).kv_map[ini_key_names.intern(key)] = val;
 		} else {
 			// We use "at" on the sections to access an existing
 			// section (alternatively we could use the [] operator
@@ -530,32 +541,18 @@ static void ParseIniKeyValLine(wstring *wline, wstring *section,
 			// first item with a given key is inserted to match the
 			// behaviour of GetPrivateProfileString for duplicate
 			// keys within a single section:
-			inserted = ini_sections.at(*section).kv_map.emplace(key, val).second;
+			inserted = ini_sections.at(*section).kv_map.emplace(ini_key_names.intern(key), val).second;
 			if ((warn_duplicates == 1) && !inserted && !whitelisted_duplicate_key(section->c_str(), key.c_str())) {
 				IniWarning("WARNING: Duplicate key found in d3dx.ini: [%S] %S\n",
 						section->c_str(), key.c_str());
 			}
 		}
-	} else {
-		// No = on line, don't store in key lookup maps to
-		// match the behaviour of GetPrivateProfileString, but
-		// we will store it in the section vector structure for the
-		// profile parser to process.
-		if (warn_lines_without_equals) {
-			IniWarning("WARNING: Malformed line in d3dx.ini: [%S] \"%S\"\n",
-					section->c_str(), wline->c_str());
-			return;
-		}
 	}
-
-	section_vector->emplace_back(key, val, *wline, *ini_namespace);
 }
 
-static void ParseIniStream(istream *stream, const wstring *_ini_namespace)
+static void ParseIniTokens(const vector<IniToken> &tokens, const wstring *_ini_namespace)
 {
-	string aline;
-	wstring wline, section, ini_path;
-	size_t first, last;
+	wstring section, ini_path, line;
 	IniSectionVector *section_vector = NULL;
 	int warn_duplicates = 1;
 	bool warn_lines_without_equals = true;
@@ -569,39 +566,14 @@ static void ParseIniStream(istream *stream, const wstring *_ini_namespace)
 		ini_namespace = L"";
 	ini_path = ini_namespace;
 
-	while (std::getline(*stream, aline)) {
-		// Convert to wstring for compatibility with GetPrivateProfile*
-		// APIs. If we assume the d3dx.ini is always ASCII we could
-		// drop this, but that would require us to change a great many
-		// types throughout 3DMigoto, so leave that for another day.
-		wline = wstring(aline.begin(), aline.end());
-
-		// Strip preceding and trailing whitespace:
-		first = wline.find_first_not_of(L" \t");
-		last = wline.find_last_not_of(L" \t");
-
-		if (first == wline.npos)
-			continue;
-
-		wline = wline.substr(first, last - first + 1);
-
-		// Comments are lines that start with a semicolon as the first
-		// non-whitespace character that we want to skip over (note
-		// that a semicolon appearing in the middle of a line is *NOT*
-		// a comment in an ini file. It might be tempting to treat them
-		// as comments since a lot of people do seem to try to do that,
-		// but there may be cases where a semicolon is part of valid
-		// syntax and I am hesitant to change that underlying handling
-		// here, at least not without auditing most of the d3dx.ini
-		// files already in the wild. Let's at least try not to add any
-		// new syntax that includes semicolons anyway!)
-		if (wline[0] == L';')
-			continue;
-
+	// Blank lines and comments have already been dropped, and whitespace
+	// stripped from the start and end of each line by IniTokenizer:
+	for (const IniToken &token : tokens) {
 		// Section?
-		if (wline[0] == L'[') {
+		if (token.section) {
 			preamble = false;
-			ParseIniSectionLine(&wline, &section, &warn_duplicates,
+			ini_assign(token.line, &line);
+			ParseIniSectionLine(&line, &section, &warn_duplicates,
 					    &warn_lines_without_equals,
 					    &section_vector, &ini_namespace,
 					    &ini_path);
@@ -609,12 +581,12 @@ static void ParseIniStream(istream *stream, const wstring *_ini_namespace)
 		}
 
 		if (preamble) {
-			if (!ParseIniPreamble(&wline, &ini_namespace))
+			if (!ParseIniPreamble(&token, &ini_namespace))
 				return;
 			continue;
 		}
 
-		ParseIniKeyValLine(&wline, &section, warn_duplicates,
+		ParseIniKeyValLine(&token, &section, warn_duplicates,
 				   warn_lines_without_equals, section_vector,
 				   &ini_namespace);
 	}
@@ -622,9 +594,10 @@ static void ParseIniStream(istream *stream, const wstring *_ini_namespace)
 
 static void ParseIniExcerpt(const char *excerpt)
 {
-	std::istringstream stream(excerpt);
+	vector<IniToken> tokens;
 
-	ParseIniStream(&stream, NULL);
+	tokenise_ini(excerpt, strlen(excerpt), &tokens);
+	ParseIniTokens(tokens, NULL);
 }
 
 // Parse the ini file into data structures. We used to use the
@@ -645,20 +618,44 @@ static void ParseIniExcerpt(const char *excerpt)
 //
 // NOTE: If adding any debugging / logging into this routine and expect to see
 // it, make sure you delay calling it until after the log file has been opened!
-static void ParseNamespacedIniFile(const wchar_t *ini, const wstring *ini_namespace)
+static void ParseIniFragment(IniFileFragment *fragment, const wstring *ini_namespace)
 {
-	ifstream f(ini, ios::in, _SH_DENYNO);
-	if (!f) {
-		LogOverlay(LOG_WARNING, "  Error opening %S\n", ini);
+	if (!fragment->opened) {
+		LogOverlay(LOG_WARNING, "  Error opening %S\n", fragment->path.c_str());
 		return;
 	}
 
-	ParseIniStream(&f, ini_namespace);
+	if (ini_reload.add_file(fragment->path, fragment->hash))
+		LogDebug("    %S is new or changed\n", fragment->path.c_str());
+
+	ParseIniTokens(fragment->tokens, ini_namespace);
+
+	// Everything we keep has been copied out of the mapped file by now,
+	// so let go of it before the user tries to save it again:
+	fragment->tokens.clear();
+	fragment->buffer.reset();
+}
+
+static void ParseNamespacedIniFile(const wchar_t *ini, const wstring *ini_namespace)
+{
+	IniFileFragment fragment;
+
+	fragment.path = ini;
+	fragment.opened = map_ini_file(fragment.path, &fragment.buffer);
+	if (fragment.opened) {
+		fragment.hash = ini_reload_hash(0, fragment.buffer->data(), fragment.buffer->size());
+		tokenise_ini(fragment.buffer->data(), fragment.buffer->size(), &fragment.tokens);
+	}
+
+	ParseIniFragment(&fragment, ini_namespace);
 }
 
 static void ParseIniFile(const wchar_t *ini)
 {
+	ini_reload.begin();
 	ini_sections.clear();
+	ini_section_names.clear();
+	ini_key_names.clear();
 
 	return ParseNamespacedIniFile(ini, NULL);
 }
@@ -760,15 +757,16 @@ static bool matches_globbing_vector(wchar_t *filename, vector<pcre2_code*> &patt
 	return false;
 }
 
-static void ParseIniFilesRecursive(wchar_t *migoto_path, const wstring &rel_path, vector<pcre2_code*> &exclude)
+// Called from the IniFileLoader workers, so must not log anything. What
+// was excluded or skipped is logged by QueueIniFilesRecursive:
+static void ListIniDirectory(const wchar_t *migoto_path, vector<pcre2_code*> &exclude, IniDirectoryListing *listing)
 {
 	std::set<wstring, WStringInsensitiveLess> ini_files, directories;
 	WIN32_FIND_DATA find_data;
 	HANDLE hFind;
-	wstring search_path, ini_path, ini_namespace;
+	wstring search_path;
 
-	search_path = wstring(migoto_path) + rel_path + L"\\*";
-	LogInfo("    Searching \"%S\"\n", search_path.c_str());
+	search_path = wstring(migoto_path) + listing->rel_path + L"\\*";
 
 	// We want to make sure the order will be consistent in case of any
 	// interactions between mods, so we read the entire directory, sort it
@@ -776,14 +774,13 @@ static void ParseIniFilesRecursive(wchar_t *migoto_path, const wstring &rel_path
 	// directories in the same order every time
 
 	hFind = FindFirstFile(search_path.c_str(), &find_data);
-	if (hFind == INVALID_HANDLE_VALUE) {
-		LogInfo("    Recursive include path \"%S\" not found\n", search_path.c_str());
+	if (hFind == INVALID_HANDLE_VALUE)
 		return;
-	}
+	listing->found = true;
 
 	do {
 		if (matches_globbing_vector(find_data.cFileName, exclude)) {
-			LogInfo("    Excluding \"%S\"\n", find_data.cFileName);
+			listing->excluded.push_back(find_data.cFileName);
 			continue;
 		}
 
@@ -793,41 +790,87 @@ static void ParseIniFilesRecursive(wchar_t *migoto_path, const wstring &rel_path
 		} else if (!wcscmp(find_data.cFileName + wcslen(find_data.cFileName) - 4, L".ini")) {
 			ini_files.insert(wstring(find_data.cFileName));
 		} else {
-			LogDebug("    Not a directory or ini file: \"%S\"\n", find_data.cFileName);
+			listing->others.push_back(find_data.cFileName);
 		}
 	} while (FindNextFile(hFind, &find_data));
 
 	FindClose(hFind);
 
-	for (wstring i: ini_files) {
-		ini_namespace = rel_path + wstring(L"\\") + i;
-		ini_path = wstring(migoto_path) + ini_namespace;
-		LogInfo("    Processing \"%S\"\n", ini_path.c_str());
-		ParseNamespacedIniFile(ini_path.c_str(), &ini_namespace);
-	}
+	listing->ini_files.assign(ini_files.begin(), ini_files.end());
+	listing->directories.assign(directories.begin(), directories.end());
+}
 
-	for (wstring i: directories) {
-		ini_namespace = rel_path + wstring(L"\\") + i;
-		ParseIniFilesRecursive(migoto_path, ini_namespace, exclude);
+// Lists the whole tree on the loader's workers, then queues the ini files in
+// the same order this has always parsed them in. The namespace of each file
+// queued is appended to ini_namespaces to parse it with later:
+static void QueueIniFilesRecursive(IniFileLoader *loader, wchar_t *migoto_path,
+		const wstring &rel_path, vector<wstring> *ini_namespaces)
+{
+	vector<IniDirectoryListing> listings;
+	wstring search_path, ini_path, ini_namespace;
+
+	loader->walk(rel_path, &listings);
+
+	for (IniDirectoryListing &listing : listings) {
+		search_path = wstring(migoto_path) + listing.rel_path + L"\\*";
+		LogInfo("    Searching \"%S\"\n", search_path.c_str());
+
+		if (!listing.found) {
+			LogInfo("    Recursive include path \"%S\" not found\n", search_path.c_str());
+			continue;
+		}
+
+		for (wstring &i : listing.excluded)
+			LogInfo("    Excluding \"%S\"\n", i.c_str());
+		for (wstring &i : listing.others)
+			LogDebug("    Not a directory or ini file: \"%S\"\n", i.c_str());
+
+		for (wstring &i : listing.ini_files) {
+			ini_namespace = listing.rel_path + wstring(L"\\") + i;
+			ini_path = wstring(migoto_path) + ini_namespace;
+			LogInfo("    Processing \"%S\"\n", ini_path.c_str());
+			loader->queue_file(ini_path);
+			ini_namespaces->push_back(ini_namespace);
+		}
 	}
 }
 
+// Returns NULL if the section or key is not in the ini. Most of the settings
+// looked up are not there, so this neither allocates nor throws:
+static wstring* FindIniValue(const wchar_t *section, const wchar_t *key)
+{
+	IniSections::iterator i;
+	IniKeyMap::iterator j;
+	IniKey name;
+
+	i = ini_sections.find(section);
+	if (i == ini_sections.end())
+		return NULL;
+
+	name = ini_key_names.find(key);
+	if (name == INI_KEY_NONE)
+		return NULL;
+
+	j = i->second.kv_map.find(name);
+	if (j == i->second.kv_map.end())
+		return NULL;
+
+	return &j->second;
+}
+
 static bool IniHasKey(const wchar_t *section, const wchar_t *key)
 {
-	try {
-		return !!ini_sections.at(section).kv_map.count(key);
-	} catch (std::out_of_range) {
-		return false;
-	}
+	return !!FindIniValue(section, key);
 }
 
 static void _GetIniSection(IniSections *custom_ini_sections, IniSectionVector **key_vals, const wchar_t *section)
 {
 	static IniSectionVector empty_section_vector;
+	IniSections::iterator i = custom_ini_sections->find(section);
 
-	try {
-		*key_vals = &custom_ini_sections->at(section).kv_vec;
-	} catch (std::out_of_range) {
+	if (i != custom_ini_sections->end()) {
+		*key_vals = &i->second.kv_vec;
+	} else {
 		LogDebug("WARNING: GetIniSection() called on a section not in the ini_sections map: %S\n", section);
 		*key_vals = &empty_section_vector;
 	}
@@ -847,28 +890,28 @@ void GetIniSection(IniSectionVector **key_vals, const wchar_t *section)
 int GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def,
 		 wchar_t *ret, unsigned size)
 {
+	wstring *val = FindIniValue(section, key);
 	int rc;
 
-	try {
-		wstring &val = ini_sections.at(section).kv_map.at(key);
+	if (val) {
 		// Note that we now use wcsncpy_s here with _TRUNCATE rather
 		// than wcscpy_s, because it turns out the later may just kill
 		// us immediately on overflow depending on the invalid
 		// parameter handler (refer to issue #84), and this way we more
 		// closely match the behaviour of GetPrivateProfileString.
-		if (wcsncpy_s(ret, size, val.c_str(), _TRUNCATE)) {
+		if (wcsncpy_s(ret, size, val->c_str(), _TRUNCATE)) {
 			// Funky return code of GetPrivateProfileString Not
 			// sure if we depend on this - if we don't I'd like a
 			// nicer return code or to raise an exception.
 			IniWarning("WARNING: [%S] \"%S=%S\" too long\n",
-					section, key, val.c_str());
+					section, key, val->c_str());
 			rc = size - 1;
 		} else {
 			// I'd also rather not have to calculate the string
 			// length if we don't use it
 			rc = (int)wcslen(ret);
 		}
-	} catch (std::out_of_range) {
+	} else {
 		if (def) {
 			if (wcscpy_s(ret, size, def)) {
 				// If someone passed in a default value that is
@@ -894,28 +937,24 @@ int GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def,
 // returns wide characters would be counter-productive to that goal.
 bool GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def, std::string *ret)
 {
-	std::wstring wret;
-	bool found = false;
+	wstring *val;
 
 	if (!ret) {
 		LogInfo("BUG: Misuse of GetIniString()\n");
 		DoubleBeepExit();
 	}
 
-	try {
-		wret = ini_sections.at(section).kv_map.at(key);
-		found = true;
-	} catch (std::out_of_range) {
-		if (def)
-			wret = def;
-		else
-			wret = L"";
-	}
-
 	// TODO: Get rid of all the wide character strings that the old ini
 	// parsing API forced on us so we don't need this re-conversion:
-	*ret = std::string(wret.begin(), wret.end());
-	return found;
+	val = FindIniValue(section, key);
+	if (val)
+		ret->assign(val->begin(), val->end());
+	else if (def)
+		ret->assign(def, def + wcslen(def));
+	else
+		ret->clear();
+
+	return !!val;
 }
 
 // For sections that allow the same key to be used multiple times with
@@ -1249,7 +1288,7 @@ static void GetUserConfigPath(const wchar_t *migoto_path)
 
 static void ParseIncludedIniFiles()
 {
-	IniSections include_sections;
+	IniSections include_sections(&ini_section_names);
 	IniSections::iterator lower, upper, i;
 	const wchar_t *section_id;
 	IniSectionVector *section = NULL;
@@ -1259,6 +1298,9 @@ static void ParseIncludedIniFiles()
 	wstring namespace_path, rel_path, ini_path;
 	wchar_t migoto_path[MAX_PATH];
 	vector<pcre2_code*> exclude;
+	vector<wstring> ini_namespaces;
+	IniFileFragment fragment;
+	unsigned threads;
 	DWORD attrib;
 
 	GetModuleFileName(migoto_handle, migoto_path, MAX_PATH);
@@ -1272,6 +1314,13 @@ static void ParseIncludedIniFiles()
 	// recursively included files to modify the exclude mid-recursion:
 	exclude = globbing_vector_to_regex(GetIniStringMultipleKeys(L"Include", L"exclude_recursive"));
 
+	// Mods directories can have thousands of ini files, so these are read
+	// and tokenised on worker threads, but still added to ini_sections
+	// one at a time in the order they are listed here:
+	threads = min(std::thread::hardware_concurrency(), MAX_INI_LOADER_THREADS);
+	IniFileLoader loader(threads, map_ini_file, [&](IniDirectoryListing *listing) {
+			ListIniDirectory(migoto_path, exclude, listing); });
+
 	do {
 		// To safely allow included files to include more files, we
 		// transfer the includes we currently know about into a
@@ -1280,11 +1329,12 @@ static void ParseIncludedIniFiles()
 		// included files anything new in the ini_sections data
 		// will be included from one of the newly parsed files. We
 		// repeat this process until no more include files appear.
-		lower = ini_sections.lower_bound(wstring(L"Include"));
-		upper = prefix_upper_bound(ini_sections, wstring(L"Include"));
+		lower = ini_sections.prefix_lower_bound(L"Include");
+		upper = ini_sections.prefix_upper_bound(L"Include");
 		include_sections.clear();
 		include_sections.insert(lower, upper);
 		ini_sections.erase(lower, upper);
+		ini_namespaces.clear();
 
 		for (i = include_sections.begin(); i != include_sections.end(); i++) {
 			section_id = i->first.c_str();
@@ -1310,9 +1360,10 @@ static void ParseIncludedIniFiles()
 
 				if (!wcscmp(key->c_str(), L"include")) {
 					ini_path = wstring(migoto_path) + rel_path;
-					ParseNamespacedIniFile(ini_path.c_str(), &rel_path);
+					loader.queue_file(ini_path);
+					ini_namespaces.push_back(rel_path);
 				} else if (!wcscmp(key->c_str(), L"include_recursive")) {
-					ParseIniFilesRecursive(migoto_path, rel_path, exclude);
+					QueueIniFilesRecursive(&loader, migoto_path, rel_path, &ini_namespaces);
 				} else if (!wcscmp(key->c_str(), L"exclude_recursive")) {
 					// Handled above
 				} else if (!wcscmp(key->c_str(), L"user_config")) {
@@ -1322,6 +1373,13 @@ static void ParseIncludedIniFiles()
 				}
 			}
 		}
+
+		// Parse everything queued above, in the same order. Any
+		// [Include] sections they have are picked up next time round:
+		for (wstring &ini_namespace : ini_namespaces) {
+			loader.next_file(&fragment);
+			ParseIniFragment(&fragment, &ini_namespace);
+		}
 	} while (!include_sections.empty());
 
 	free_globbing_vector(exclude);
@@ -1342,8 +1400,8 @@ static void RegisterPresetKeyBindings()
 	vector<wstring> keys;
 	vector<wstring> back;
 
-	lower = ini_sections.lower_bound(wstring(L"Key"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"Key"));
+	lower = ini_sections.prefix_lower_bound(L"Key");
+	upper = ini_sections.prefix_upper_bound(L"Key");
 
 	for (i = lower; i != upper; i++) {
 		const wchar_t *id = i->first.c_str();
@@ -1386,8 +1444,8 @@ static void EnumeratePresetOverrideSections()
 
 	presetOverrides.clear();
 
-	lower = ini_sections.lower_bound(wstring(L"Preset"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"Preset"));
+	lower = ini_sections.prefix_lower_bound(L"Preset");
+	upper = ini_sections.prefix_upper_bound(L"Preset");
 
 	for (i = lower; i != upper; i++) {
 		const wchar_t *id = i->first.c_str();
@@ -1734,6 +1792,27 @@ static void ParseResourceInitialData(CustomResource *custom_resource, const wcha
 	}
 }
 
+// Hash of everything in a section that the objects built from it depend on,
+// for IniReloadTracker to compare with the last load:
+static uint32_t fingerprint_ini_section(const wstring &section)
+{
+	IniSections::iterator i;
+	uint32_t crc = 0;
+
+	i = ini_sections.find(section);
+	if (i == ini_sections.end())
+		return 0;
+
+	crc = ini_reload_hash(crc, i->second.ini_namespace);
+	crc = ini_reload_hash(crc, i->second.ini_path);
+	for (IniLine &line : i->second.kv_vec) {
+		crc = ini_reload_hash(crc, line.raw_line);
+		crc = ini_reload_hash(crc, line.ini_namespace);
+	}
+
+	return crc;
+}
+
 static void ParseResourceSections()
 {
 	IniSections::iterator lower, upper, i;
@@ -1743,10 +1822,12 @@ static void ParseResourceSections()
 	wstring namespace_path;
 	bool found;
 
-	customResources.clear();
+	// Kept until the end of LoadConfigFile() in case any are unchanged:
+	previous_custom_resources.clear();
+	previous_custom_resources.swap(customResources);
 
-	lower = ini_sections.lower_bound(wstring(L"Resource"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"Resource"));
+	lower = ini_sections.prefix_lower_bound(L"Resource");
+	upper = ini_sections.prefix_upper_bound(L"Resource");
 	for (i = lower; i != upper; i++) {
 		LogInfoW(L"[%s]\n", i->first.c_str());
 
@@ -1761,6 +1842,7 @@ static void ParseResourceSections()
 		// default constructor will be used:
 		custom_resource = &customResources[resource_id];
 		custom_resource->name = i->first;
+		ini_reload.add_section(resource_id, fingerprint_ini_section(i->first));
 
 		custom_resource->max_copies_per_frame =
 			GetIniInt(i->first.c_str(), L"max_copies_per_frame", 0, NULL);
@@ -1778,6 +1860,8 @@ static void ParseResourceSections()
 				wcscat(path, setting);
 				if (GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES)
 					found = true;
+				else
+					ini_reload.add_dependency(resource_id, path);
 			}
 			if (!found) {
 				GetModuleFileName(migoto_handle, path, MAX_PATH);
@@ -1785,6 +1869,7 @@ static void ParseResourceSections()
 				wcscat(path, setting);
 			}
 			custom_resource->filename = path;
+			ini_reload.add_dependency(resource_id, path);
 		}
 
 		custom_resource->override_type = GetIniEnumClass(i->first.c_str(), L"type", CustomResourceType::INVALID, NULL, CustomResourceTypeNames);
@@ -1826,6 +1911,32 @@ static void ParseResourceSections()
 	}
 }
 
+// Called once every command list has been parsed, since they can add bind
+// flags the resource will need, and an old resource made without them can't
+// be kept:
+static void KeepUnchangedCustomResources()
+{
+	CustomResources::iterator i, previous;
+	bool keep;
+
+	for (i = customResources.begin(); i != customResources.end(); i++) {
+		// Only resources loaded from somewhere are expensive to make:
+		if (i->second.filename.empty() && !i->second.initial_data)
+			continue;
+
+		previous = previous_custom_resources.find(i->first);
+		keep = previous != previous_custom_resources.end()
+			&& ini_reload.unchanged(i->first)
+			&& i->second.KeepSubstantiatedResource(&previous->second);
+		if (keep)
+			LogInfoW(L"[%s] unchanged, keeping resource\n", i->second.name.c_str());
+		ini_reload.note_kept(keep);
+	}
+
+	previous_custom_resources.clear();
+	previous_custom_shaders.clear();
+}
+
 static bool ParseCommandListLine(const wchar_t *ini_section,
 		const wchar_t *lhs, wstring *rhs, wstring *raw_line,
 		CommandList *command_list,
@@ -1876,7 +1987,7 @@ static void ParseCommandList(const wchar_t *id,
 	wstring *key, *val, *raw_line;
 	const wchar_t *key_ptr;
 	CommandList *command_list, *explicit_command_list;
-	IniSectionSet whitelisted_keys;
+	std::unordered_set<wstring> whitelisted_keys;
 	CommandListScope scope;
 	int i;
 
@@ -1927,10 +2038,10 @@ static void ParseCommandList(const wchar_t *id,
 				// allowed duplicate keys *except for these
 				// whitelisted entries*, so check for
 				// duplicates here:
-				if (whitelisted_keys.count(key->c_str())) {
+				if (whitelisted_keys.count(*key)) {
 					IniWarningW(L"WARNING: Duplicate non-command list key found in " INI_FILENAME L": [%ls] %ls\n", id, key->c_str());
 				}
-				whitelisted_keys.insert(key->c_str());
+				whitelisted_keys.insert(*key);
 
 				continue;
 			}
@@ -2253,8 +2364,8 @@ static void ParseShaderOverrideSections()
 
 	G->mShaderOverrideMap.clear();
 
-	lower = ini_sections.lower_bound(wstring(L"ShaderOverride"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"ShaderOverride"));
+	lower = ini_sections.prefix_lower_bound(L"ShaderOverride");
+	upper = ini_sections.prefix_upper_bound(L"ShaderOverride");
 	for (i = lower; i != upper; i++) {
 		id = i->first.c_str();
 
@@ -2534,8 +2645,8 @@ static void ParseShaderRegexSections()
 	hash = crc32c_hw(hash, &G->disassemble_undecipherable_custom_data, sizeof(G->disassemble_undecipherable_custom_data));
 	hash = crc32c_hw(hash, &G->patch_cb_offsets, sizeof(G->patch_cb_offsets));
 
-	lower = ini_sections.lower_bound(wstring(L"ShaderRegex"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"ShaderRegex"));
+	lower = ini_sections.prefix_lower_bound(L"ShaderRegex");
+	upper = ini_sections.prefix_upper_bound(L"ShaderRegex");
 	for (i = lower; i != upper; i++) {
 		section_id = &i->first;
 		LogInfo("[%S]\n", section_id->c_str());
@@ -2606,6 +2717,8 @@ static void ParseShaderRegexSections()
 	LogInfo("ShaderRegex hash: %08x\n", shader_regex_hash);
 	for (j = shader_regex_groups.begin(); j != shader_regex_groups.end(); j++)
 		shader_regex_group_index.push_back(&j->second);
+
+	build_shader_regex_prefilter();
 }
 
 // For fuzzy matching instead of using hash. Using terms consistent
@@ -3095,8 +3208,8 @@ static void ParseTextureOverrideSections()
 	G->mTextureOverrideMap.clear();
 	G->mFuzzyTextureOverrides.clear();
 
-	lower = ini_sections.lower_bound(wstring(L"TextureOverride"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"TextureOverride"));
+	lower = ini_sections.prefix_lower_bound(L"TextureOverride");
+	upper = ini_sections.prefix_upper_bound(L"TextureOverride");
 
 	for (i = lower; i != upper; i++) {
 		id = i->first.c_str();
@@ -3797,24 +3910,27 @@ static void EnumerateCustomShaderSections()
 {
 	IniSections::iterator lower, upper;
 
-	customShaders.clear();
+	// Kept until the end of LoadConfigFile() in case any are unchanged:
+	previous_custom_shaders.clear();
+	previous_custom_shaders.swap(customShaders);
 
-	lower = ini_sections.lower_bound(wstring(L"BuiltInCustomShader"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"BuiltInCustomShader"));
+	lower = ini_sections.prefix_lower_bound(L"BuiltInCustomShader");
+	upper = ini_sections.prefix_upper_bound(L"BuiltInCustomShader");
 	_EnumerateCustomShaderSections(lower, upper);
 
-	lower = ini_sections.lower_bound(wstring(L"CustomShader"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"CustomShader"));
+	lower = ini_sections.prefix_lower_bound(L"CustomShader");
+	upper = ini_sections.prefix_upper_bound(L"CustomShader");
 	_EnumerateCustomShaderSections(lower, upper);
 }
 static void ParseCustomShaderSections()
 {
-	CustomShaders::iterator i;
+	CustomShaders::iterator i, previous;
 	const wstring *shader_id;
 	CustomShader *custom_shader;
 	wchar_t setting[MAX_PATH];
-	bool failed;
+	bool failed, keep;
 	wstring namespace_path;
+	uint32_t fingerprint;
 
 	for (i = customShaders.begin(); i != customShaders.end(); i++) {
 		shader_id = &i->first;
@@ -3826,6 +3942,16 @@ static void ParseCustomShaderSections()
 
 		failed = false;
 
+		// The shaders can be kept from the last load if nothing that
+		// went into compiling them has changed - the section, the
+		// files, and how #includes are searched for:
+		fingerprint = fingerprint_ini_section(*shader_id);
+		fingerprint = ini_reload_hash(fingerprint, &G->recursive_include, sizeof(G->recursive_include));
+		ini_reload.add_section(*shader_id, fingerprint);
+		previous = previous_custom_shaders.find(*shader_id);
+		keep = previous != previous_custom_shaders.end() && ini_reload.unchanged(*shader_id);
+		ini_reload.note_kept(keep);
+
 		// Flags is currently just applied to every shader in the chain
 		// because it's so rarely needed and it doesn't really matter.
 		// We can add vs_flags and so on later if we really need to.
@@ -3836,18 +3962,30 @@ static void ParseCustomShaderSections()
 
 		get_namespaced_section_path(i->first.c_str(), &namespace_path);
 
-		if (GetIniString(shader_id->c_str(), L"vs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('v', setting, shader_id, &namespace_path);
-		if (GetIniString(shader_id->c_str(), L"hs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('h', setting, shader_id, &namespace_path);
-		if (GetIniString(shader_id->c_str(), L"ds", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('d', setting, shader_id, &namespace_path);
-		if (GetIniString(shader_id->c_str(), L"gs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('g', setting, shader_id, &namespace_path);
-		if (GetIniString(shader_id->c_str(), L"ps", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('p', setting, shader_id, &namespace_path);
-		if (GetIniString(shader_id->c_str(), L"cs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('c', setting, shader_id, &namespace_path);
+		if (keep) {
+			LogInfo("  unchanged, keeping compiled shaders\n");
+			custom_shader->keep_compiled_shaders(&previous->second);
+		} else {
+			if (GetIniString(shader_id->c_str(), L"vs", 0, setting, MAX_PATH))
+				failed |= custom_shader->compile('v', setting, shader_id, &namespace_path);
+			if (GetIniString(shader_id->c_str(), L"hs", 0, setting, MAX_PATH))
+				failed |= custom_shader->compile('h', setting, shader_id, &namespace_path);
+			if (GetIniString(shader_id->c_str(), L"ds", 0, setting, MAX_PATH))
+				failed |= custom_shader->compile('d', setting, shader_id, &namespace_path);
+			if (GetIniString(shader_id->c_str(), L"gs", 0, setting, MAX_PATH))
+				failed |= custom_shader->compile('g', setting, shader_id, &namespace_path);
+			if (GetIniString(shader_id->c_str(), L"ps", 0, setting, MAX_PATH))
+				failed |= custom_shader->compile('p', setting, shader_id, &namespace_path);
+			if (GetIniString(shader_id->c_str(), L"cs", 0, setting, MAX_PATH))
+				failed |= custom_shader->compile('c', setting, shader_id, &namespace_path);
+		}
+
+		if (failed || custom_shader->untracked_includes)
+			ini_reload.forget(*shader_id);
+		else {
+			for (const wstring &path : custom_shader->source_files)
+				ini_reload.add_dependency(*shader_id, path);
+		}
 
 		if (failed) {
 			// Don't want to allow a shader to be run if it had an
@@ -3899,12 +4037,12 @@ static void EnumerateExplicitCommandListSections()
 
 	explicitCommandListSections.clear();
 
-	lower = ini_sections.lower_bound(wstring(L"BuiltInCommandList"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"BuiltInCommandList"));
+	lower = ini_sections.prefix_lower_bound(L"BuiltInCommandList");
+	upper = ini_sections.prefix_upper_bound(L"BuiltInCommandList");
 	_EnumerateExplicitCommandListSections(lower, upper);
 
-	lower = ini_sections.lower_bound(wstring(L"CommandList"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"CommandList"));
+	lower = ini_sections.prefix_lower_bound(L"CommandList");
+	upper = ini_sections.prefix_upper_bound(L"CommandList");
 	_EnumerateExplicitCommandListSections(lower, upper);
 }
 
@@ -4031,6 +4169,157 @@ static void warn_of_conflicting_d3dx(wchar_t *dll_ini_path)
 			"Using this configuration: %S\n", dll_ini_path);
 }
 
+// Opens the cache of decompiled shaders in ShaderCache, or closes it if it
+// has been turned off. It stays open over a config reload unless the
+// directory has changed:
+static void UpdateDecompileCache(bool enabled)
+{
+	DecompileCacheStats stats;
+	wchar_t path[MAX_PATH];
+	FILE *fp;
+
+	if (!enabled || !G->SHADER_CACHE_PATH[0]) {
+		G->decompile_cache.close();
+		G->decompile_cache_path.clear();
+		return;
+	}
+
+	swprintf_s(path, MAX_PATH, L"%ls\\decompiler_cache.bin", G->SHADER_CACHE_PATH);
+	if (G->decompile_cache_path == path && G->decompile_cache.is_open())
+		return;
+	G->decompile_cache.close();
+	G->decompile_cache_path = path;
+
+	// Deny writes so that a second instance of the game can't append to
+	// it at the same time:
+	fp = _wfsopen(path, L"r+b", _SH_DENYWR);
+	if (fp && !G->decompile_cache.open(fp))
+		LogInfo("  Discarding decompiler cache from an incompatible version: %S\n", path);
+
+	if (!G->decompile_cache.is_open()) {
+		fp = _wfsopen(path, L"w+b", _SH_DENYWR);
+		if (!fp || !G->decompile_cache.open(fp)) {
+			LogOverlay(LOG_NOTICE, "Unable to open decompiler cache %S\n", path);
+			return;
+		}
+	}
+
+	stats = G->decompile_cache.get_stats();
+	LogInfo("  Decompiler cache %S: %u shaders", path, stats.loaded);
+	if (stats.discarded)
+		LogInfo(", %llu bytes of incomplete records ignored", stats.discarded);
+	LogInfo("\n");
+}
+
+// Reads a whole file from the layout the ShaderRegex cache had before it was
+// moved into the shader cache pack:
+static bool ReadLegacyCacheFile(const wchar_t *path, std::vector<uint8_t> *buf)
+{
+	DWORD size, read;
+	HANDLE f;
+	bool ok;
+
+	f = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+
+	size = GetFileSize(f, 0);
+	ok = size != INVALID_FILE_SIZE;
+	if (ok) {
+		buf->resize(size);
+		ok = !size || (ReadFile(f, buf->data(), size, &read, NULL) && read == size);
+	}
+	CloseHandle(f);
+	return ok;
+}
+
+// Moves the _regex.dat and _regex.bin files that older versions cached each
+// ShaderRegex result in into the pack, deleting them as it goes so that this
+// only has to be done once:
+static void ConvertLegacyShaderRegexCache()
+{
+	std::vector<uint8_t> dat, bin;
+	WIN32_FIND_DATA find_data;
+	wchar_t dat_path[MAX_PATH], bin_path[MAX_PATH];
+	unsigned converted = 0;
+	uint64_t hash;
+	uint32_t type;
+	HANDLE hFind;
+	size_t len;
+	bool is_bin, has_bin;
+
+	swprintf_s(dat_path, MAX_PATH, L"%ls\\*_regex.dat", G->SHADER_CACHE_PATH);
+	hFind = FindFirstFile(dat_path, &find_data);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+
+	do {
+		len = wcslen(find_data.cFileName);
+		if (!parse_legacy_shader_regex_cache_name(find_data.cFileName, len, &hash, &type, &is_bin) || is_bin)
+			continue;
+
+		swprintf_s(dat_path, MAX_PATH, L"%ls\\%ls", G->SHADER_CACHE_PATH, find_data.cFileName);
+		wcscpy_s(bin_path, MAX_PATH, dat_path);
+		wcscpy_s(bin_path + wcslen(bin_path) - 3, 4, L"bin");
+
+		if (!ReadLegacyCacheFile(dat_path, &dat))
+			continue;
+		has_bin = ReadLegacyCacheFile(bin_path, &bin);
+		if (!convert_legacy_shader_regex_cache(&G->shader_cache_pack, hash, type, dat, has_bin ? &bin : NULL))
+			continue;
+
+		DeleteFile(dat_path);
+		if (has_bin)
+			DeleteFile(bin_path);
+		converted++;
+	} while (FindNextFile(hFind, &find_data));
+
+	FindClose(hFind);
+
+	if (converted)
+		LogInfo("  Moved %u ShaderRegex cache files into the shader cache\n", converted);
+}
+
+// Opens the pack in ShaderCache that ShaderRegex results are cached in, or
+// closes it if cache_shaders has been turned off. Called after the
+// ShaderRegex sections have been parsed, since results from any other
+// version of them will never be used again and can be compacted away:
+static void UpdateShaderCachePack()
+{
+	ShaderCachePackStats stats;
+	wchar_t path[MAX_PATH];
+
+	if (!G->CACHE_SHADERS || !G->SHADER_CACHE_PATH[0]) {
+		G->shader_cache_pack.close();
+		return;
+	}
+
+	swprintf_s(path, MAX_PATH, L"%ls\\shader_cache.pack", G->SHADER_CACHE_PATH);
+	if (G->shader_cache_pack.get_path() != path || !G->shader_cache_pack.is_open()) {
+		G->shader_cache_pack.close();
+		if (!G->shader_cache_pack.open(path)) {
+			LogOverlay(LOG_NOTICE, "Unable to open shader cache %S\n", path);
+			return;
+		}
+		ConvertLegacyShaderRegexCache();
+	}
+
+	if (G->shader_cache_pack.compact([](const ShaderCacheKey &key, uint32_t tag) {
+				return key.kind != ShaderCacheKind::REGEX || tag == shader_regex_hash;
+			}))
+		LogInfo("  Compacted shader cache\n");
+	if (!G->shader_cache_pack.is_open()) {
+		LogOverlay(LOG_NOTICE, "Unable to reopen shader cache %S after compacting it\n", path);
+		return;
+	}
+
+	stats = G->shader_cache_pack.get_stats();
+	LogInfo("  Shader cache %S: %u records, %llu KB", path, stats.records, stats.live_bytes / 1024);
+	if (stats.discarded)
+		LogInfo(", %llu bytes of incomplete records ignored", stats.discarded);
+	LogInfo("\n");
+}
+
 void LoadConfigFile()
 {
 	wchar_t iniFile[MAX_PATH], logFilename[MAX_PATH];
@@ -4083,6 +4372,12 @@ void LoadConfigFile()
 		LogInfo("    unbuffered return: %d\n", unbuffered);
 	}
 
+	// Hand log messages to a background thread to write out, so that
+	// threads logging at the same time don't wait on each other or on the
+	// disk. Only takes effect at launch:
+	if (GetIniBool(L"Logging", L"async", false, NULL) && LogFile)
+		StartAsyncLogging(LogFile);
+
 	// Set the CPU affinity based upon d3dx.ini setting.  Useful for debugging and shader hunting in AC3.
 	if (GetIniBool(L"Logging", L"force_cpu_affinity", false, NULL))
 	{
@@ -4204,6 +4499,10 @@ void LoadConfigFile()
 		CreateDirectoryEnsuringAccess(G->SHADER_CACHE_PATH);
 	}
 
+	// Index the shader files in both so that creating shaders doesn't
+	// need to look for each file they could be using individually:
+	UpdateShaderIndexes(G->SHADER_PATH, G->SHADER_CACHE_PATH);
+
 	G->CACHE_SHADERS = GetIniBool(L"Rendering", L"cache_shaders", false, NULL);
 	G->SCISSOR_DISABLE = GetIniBool(L"Rendering", L"rasterizer_disable_scissor", false, NULL);
 	G->track_texture_updates = GetIniBoolOrInt(L"Rendering", L"track_texture_updates", 0, NULL);
@@ -4212,6 +4511,17 @@ void LoadConfigFile()
 	G->patch_cb_offsets = GetIniBool(L"Rendering", L"patch_assembly_cb_offsets", false, NULL);
 	G->recursive_include = GetIniBoolOrInt(L"Rendering", L"recursive_include", false, NULL);
 
+	// The worker threads can't be stopped once started, so turning this
+	// off on a config reload only stops new shaders being queued, and the
+	// thread count is whatever it was first turned on with:
+	int async_compile_threads = GetIniInt(L"Rendering", L"async_shader_compile", 0, NULL);
+	G->async_shader_compile = async_compile_threads > 0;
+	if (G->async_shader_compile && !G->shader_compile_queue) {
+		G->shader_compile_queue = new ShaderCompileQueue(
+				min(async_compile_threads, MAX_ASYNC_SHADER_COMPILE_THREADS),
+				MAX_ASYNC_SHADER_COMPILE_QUEUED);
+	}
+
 	G->EXPORT_FIXED = GetIniBool(L"Rendering", L"export_fixed", false, NULL);
 	G->EXPORT_SHADERS = GetIniBool(L"Rendering", L"export_shaders", false, NULL);
 	G->EXPORT_HLSL = GetIniInt(L"Rendering", L"export_hlsl", 0, NULL);
@@ -4235,6 +4545,7 @@ void LoadConfigFile()
 	// Automatic section
 	G->decompiler_settings.fixSvPosition = GetIniBool(L"Rendering", L"fix_sv_position", false, NULL);
 	G->decompiler_settings.recompileVs = GetIniBool(L"Rendering", L"recompile_all_vs", false, NULL);
+	G->decompiler_settings.binaryFrontEnd = GetIniBool(L"Rendering", L"decompiler_binary_front_end", false, NULL);
 	if (GetIniStringAndLog(L"Rendering", L"fix_ZRepair_DepthTexture1", 0, setting, MAX_PATH))
 	{
 		char buf[MAX_PATH];
@@ -4321,6 +4632,10 @@ void LoadConfigFile()
 	if (GetIniStringAndLog(L"Rendering", L"fix_MatrixOperand1Multiplier", 0, setting, MAX_PATH))
 		G->decompiler_settings.MatrixPos_MUL1 = readStringParameter(setting);
 
+	// Keep decompiled shaders between sessions. After the decompiler
+	// settings, since they are part of what the output is cached under:
+	UpdateDecompileCache(GetIniBool(L"Rendering", L"decompiler_cache", false, NULL));
+
 	// [Hunting]
 	ParseHuntingSection();
 
@@ -4366,6 +4681,7 @@ void LoadConfigFile()
 
 	ParseShaderOverrideSections();
 	ParseShaderRegexSections();
+	UpdateShaderCachePack();
 	ParseTextureOverrideSections();
 
 	LogInfo("[Present]\n");
@@ -4393,9 +4709,12 @@ void LoadConfigFile()
 	G->post_clear_uav_float_command_list.clear();
 	ParseCommandList(L"ClearUnorderedAccessViewFloat", &G->clear_uav_float_command_list, &G->post_clear_uav_float_command_list, NULL);
 
+	KeepUnchangedCustomResources();
+
 	LogInfo("[Profile]\n");
 	ParseDriverProfile();
 
+	LogIniNameStats();
 	LogInfo("\n");
 
 	if (G->hide_cursor || G->SCREEN_UPSCALING)
@@ -4515,6 +4834,8 @@ static void MarkAllShadersDeferredUnprocessed()
 void ReloadConfig(HackerDevice *device)
 {
 	HackerContext *mHackerContext = device->GetHackerContext();
+	IniReloadStats stats;
+	DWORD start = GetTickCount();
 
 	if (G->gWipeUserConfig)
 		WipeUserConfig();
@@ -4561,6 +4882,12 @@ void ReloadConfig(HackerDevice *device)
 
 	LeaveCriticalSection(&G->mCriticalSection);
 
+	stats = ini_reload.get_stats();
+	LogInfo("Config reloaded after %ums: %u of %u ini files changed, %u removed, "
+			"kept %u of %u custom shaders and resources\n",
+			GetTickCount() - start, stats.files_changed, stats.files, stats.files_removed,
+			stats.kept, stats.kept + stats.rebuilt);
+
 	// Execute the [Constants] command list in the immediate context to
 	// initialise iniParams and perform any other custom initialisation the
 	// user may have defined:
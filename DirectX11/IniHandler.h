@@ -23,10 +23,9 @@ struct IniLine {
 	// to resolve references within the namespace:
 	wstring ini_namespace;
 
-	IniLine(wstring &key, wstring &val, wstring &line, const wstring &ini_namespace) :
-		first(key),
-		second(val),
-		raw_line(line),
+	// The rest are widened in place by the parser, straight from the
+	// mapped ini file:
+	IniLine(const wstring &ini_namespace) :
 		ini_namespace(ini_namespace)
 	{}
 };
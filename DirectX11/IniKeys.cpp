@@ -0,0 +1,147 @@
+#include "IniKeys.h"
+
+uint32_t ini_fold_hash(const wchar_t *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	// FNV-1a over whole characters - the names are short enough that
+	// hashing them a byte at a time would cost more than it gains:
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (uint32_t)ini_fold(name[i])) * 16777619u;
+
+	return hash;
+}
+
+int ini_fold_compare(const wchar_t *a, size_t a_len, const wchar_t *b, size_t b_len)
+{
+	size_t i, len = std::min(a_len, b_len);
+	uint32_t fa, fb;
+
+	// Compared as unsigned, as _wcsicmp does with the 16 bit wchar_t on
+	// Windows, so bytes widened from the ini file sort the same way here:
+	for (i = 0; i < len; i++) {
+		fa = (uint32_t)ini_fold(a[i]);
+		fb = (uint32_t)ini_fold(b[i]);
+		if (fa != fb)
+			return fa < fb ? -1 : 1;
+	}
+
+	if (a_len == b_len)
+		return 0;
+	return a_len < b_len ? -1 : 1;
+}
+
+IniKeyTable::IniKeyTable() :
+	stats()
+{}
+
+// Returns the slot the name is in, or the empty slot it would go in:
+size_t IniKeyTable::probe(const wchar_t *name, size_t len, uint32_t hash) const
+{
+	size_t mask = slots.size() - 1;
+	size_t i, j;
+
+	stats.lookups++;
+
+	for (i = hash & mask; slots[i] != INI_KEY_NONE; i = (i + 1) & mask) {
+		const Entry &entry = entries[slots[i]];
+
+		stats.probes++;
+		if (entry.hash != hash || entry.folded.size() != len)
+			continue;
+
+		for (j = 0; j < len; j++) {
+			if (entry.folded[j] != ini_fold(name[j]))
+				break;
+		}
+		if (j == len)
+			return i;
+	}
+
+	stats.misses++;
+	return i;
+}
+
+void IniKeyTable::grow()
+{
+	size_t size = std::max(slots.size() * 2, (size_t)64);
+	size_t mask = size - 1;
+	size_t i;
+	IniKey key;
+
+	slots.assign(size, INI_KEY_NONE);
+
+	// Every name is different and its hash is already known, so these
+	// only need an empty slot:
+	for (key = 0; key < entries.size(); key++) {
+		for (i = entries[key].hash & mask; slots[i] != INI_KEY_NONE; i = (i + 1) & mask) {}
+		slots[i] = key;
+	}
+}
+
+IniKey IniKeyTable::intern(const wchar_t *name, size_t len)
+{
+	uint32_t hash = ini_fold_hash(name, len);
+	size_t i;
+
+	// Kept at most 3/4 full so the probe sequences stay short:
+	if ((entries.size() + 1) * 4 > slots.size() * 3)
+		grow();
+
+	i = probe(name, len, hash);
+	if (slots[i] != INI_KEY_NONE)
+		return slots[i];
+
+	entries.push_back(Entry{std::wstring(name, len), hash});
+	for (wchar_t &c : entries.back().folded)
+		c = ini_fold(c);
+
+	slots[i] = (IniKey)(entries.size() - 1);
+	return slots[i];
+}
+
+IniKey IniKeyTable::intern(const std::wstring &name)
+{
+	return intern(name.data(), name.size());
+}
+
+IniKey IniKeyTable::find(const wchar_t *name, size_t len) const
+{
+	if (slots.empty())
+		return INI_KEY_NONE;
+
+	return slots[probe(name, len, ini_fold_hash(name, len))];
+}
+
+IniKey IniKeyTable::find(const wchar_t *name) const
+{
+	return find(name, wcslen(name));
+}
+
+IniKey IniKeyTable::find(const std::wstring &name) const
+{
+	return find(name.data(), name.size());
+}
+
+const std::wstring& IniKeyTable::folded(IniKey key) const
+{
+	return entries.at(key).folded;
+}
+
+size_t IniKeyTable::size() const
+{
+	return entries.size();
+}
+
+void IniKeyTable::clear()
+{
+	entries.clear();
+	slots.clear();
+	stats = IniKeyStats();
+}
+
+IniKeyStats IniKeyTable::get_stats() const
+{
+	return stats;
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Case insensitive names for the ini parser. Section and key names are
+// interned once, as they are parsed, into an IniKeyTable that keeps each one
+// case folded along with its hash. Looking a name up afterwards hashes the
+// caller's wchar_t* in place and compares it with the folded copy, so the
+// GetIniXXX() calls made for every possible setting of every section don't
+// allocate a lower case copy of each name, or a wstring to look it up with.
+//
+// Names fold the same way _wcsicmp does in the C locale 3DMigoto runs in:
+// only A-Z. The sections keep the order _wcsicmp gave them, so anything
+// iterating over them (e.g. all the [ShaderOverride*] sections) does so in
+// the same order as before.
+//
+// This depends on nothing from Windows so that TestIniKeys can check it.
+
+static inline wchar_t ini_fold(wchar_t c)
+{
+	if (c >= L'A' && c <= L'Z')
+		return c - L'A' + L'a';
+	return c;
+}
+
+uint32_t ini_fold_hash(const wchar_t *name, size_t len);
+
+// <0, 0 or >0, as _wcsicmp:
+int ini_fold_compare(const wchar_t *a, size_t a_len, const wchar_t *b, size_t b_len);
+
+// Index of a name in its IniKeyTable
+typedef uint32_t IniKey;
+static const IniKey INI_KEY_NONE = 0xffffffff;
+
+struct IniKeyStats {
+	uint64_t lookups;
+	uint64_t probes;   // Names compared over all lookups
+	uint64_t misses;
+};
+
+// Open addressed, so a lookup is one hash of the name and (usually) one
+// comparison with a folded name that has the same hash. Not thread safe -
+// only the thread loading the config uses it.
+class IniKeyTable {
+	struct Entry {
+		std::wstring folded;
+		uint32_t hash;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<IniKey> slots;
+	mutable IniKeyStats stats;
+
+	size_t probe(const wchar_t *name, size_t len, uint32_t hash) const;
+	void grow();
+
+public:
+	IniKeyTable();
+
+	// Adds the name if it has not been seen before in any case
+	IniKey intern(const wchar_t *name, size_t len);
+	IniKey intern(const std::wstring &name);
+
+	// Never allocates. INI_KEY_NONE if the name was never interned.
+	IniKey find(const wchar_t *name, size_t len) const;
+	IniKey find(const wchar_t *name) const;
+	IniKey find(const std::wstring &name) const;
+
+	const std::wstring& folded(IniKey key) const;
+	size_t size() const;
+
+	// Forgets every name, so only call this along with clearing anything
+	// holding an IniKey
+	void clear();
+
+	IniKeyStats get_stats() const;
+};
+
+// Everything that starts with a prefix, to find the bounds of e.g. all
+// [ShaderOverride*] sections with lower_bound() and upper_bound():
+struct IniPrefix {
+	const wchar_t *prefix;
+	size_t len;
+};
+
+// Sorts names as _wcsicmp would. Transparent, so maps using it can be
+// searched with an IniPrefix:
+struct IniKeyLess {
+	typedef void is_transparent;
+
+	bool operator()(const std::wstring &a, const std::wstring &b) const
+	{
+		return ini_fold_compare(a.data(), a.size(), b.data(), b.size()) < 0;
+	}
+	// std::min is parenthesised so the min macro from windows.h can't
+	// expand over it in files that include both:
+	bool operator()(const std::wstring &a, const IniPrefix &b) const
+	{
+		return ini_fold_compare(a.data(), (std::min)(a.size(), b.len), b.prefix, b.len) < 0;
+	}
+	bool operator()(const IniPrefix &a, const std::wstring &b) const
+	{
+		return ini_fold_compare(a.prefix, a.len, b.data(), (std::min)(b.size(), a.len)) < 0;
+	}
+};
+
+// A std::map of names to T sorted with IniKeyLess, plus an index by IniKey
+// so finding a name is a hash lookup instead of walking down the tree with
+// a case insensitive comparison at each step. Only the parts of std::map the
+// ini parser uses are here, and at() still throws std::out_of_range, though
+// hot paths should use find() to avoid the cost of the exception.
+template <typename T>
+class IniNameMap {
+public:
+	typedef std::map<std::wstring, T, IniKeyLess> Sorted;
+	typedef typename Sorted::iterator iterator;
+
+private:
+	IniKeyTable *names;
+	Sorted sorted;
+
+	// By IniKey, end() for names this map does not have:
+	std::vector<iterator> index;
+
+	void set_index(const std::wstring &name, iterator i)
+	{
+		IniKey key = names->intern(name);
+
+		if (key >= index.size())
+			index.resize(names->size(), sorted.end());
+		index[key] = i;
+	}
+
+public:
+	IniNameMap(IniKeyTable *names) :
+		names(names)
+	{}
+
+	// Holds iterators into itself:
+	IniNameMap(const IniNameMap&) = delete;
+	IniNameMap& operator=(const IniNameMap&) = delete;
+
+	iterator begin() { return sorted.begin(); }
+	iterator end() { return sorted.end(); }
+	bool empty() const { return sorted.empty(); }
+	size_t size() const { return sorted.size(); }
+
+	iterator find(const wchar_t *name, size_t len)
+	{
+		IniKey key = names->find(name, len);
+
+		if (key >= index.size())
+			return sorted.end();
+		return index[key];
+	}
+	iterator find(const wchar_t *name)
+	{
+		return find(name, wcslen(name));
+	}
+	iterator find(const std::wstring &name)
+	{
+		return find(name.data(), name.size());
+	}
+
+	T& at(const wchar_t *name)
+	{
+		iterator i = find(name);
+
+		if (i == sorted.end())
+			throw std::out_of_range("IniNameMap::at");
+		return i->second;
+	}
+	T& at(const std::wstring &name)
+	{
+		return at(name.c_str());
+	}
+
+	std::pair<iterator, bool> emplace(const std::wstring &name)
+	{
+		std::pair<iterator, bool> ret = sorted.emplace(name, T());
+
+		if (ret.second)
+			set_index(name, ret.first);
+		return ret;
+	}
+
+	// Copies anything from another map with the same IniKeyTable that this
+	// one does not already have, like std::map::insert:
+	void insert(iterator first, iterator last)
+	{
+		for (; first != last; first++) {
+			std::pair<iterator, bool> i = emplace(first->first);
+			if (i.second)
+				i.first->second = first->second;
+		}
+	}
+
+	void erase(iterator first, iterator last)
+	{
+		IniKey key;
+
+		for (iterator i = first; i != last; i++) {
+			key = names->find(i->first);
+			if (key < index.size())
+				index[key] = sorted.end();
+		}
+		sorted.erase(first, last);
+	}
+
+	void clear()
+	{
+		sorted.clear();
+		index.clear();
+	}
+
+	iterator prefix_lower_bound(const wchar_t *prefix)
+	{
+		return sorted.lower_bound(IniPrefix{prefix, wcslen(prefix)});
+	}
+
+	// The first name after prefix_lower_bound() that does not start with
+	// the prefix, found with a binary search instead of walking through
+	// every match:
+	iterator prefix_upper_bound(const wchar_t *prefix)
+	{
+		return sorted.upper_bound(IniPrefix{prefix, wcslen(prefix)});
+	}
+};
@@ -0,0 +1,108 @@
+#include "IniReload.h"
+
+#include "crc32c.h"
+
+uint32_t ini_reload_hash(uint32_t crc, const void *data, size_t size)
+{
+	return crc32c_append(crc, (const uint8_t*)data, size);
+}
+
+uint32_t ini_reload_hash(uint32_t crc, const std::wstring &str)
+{
+	// Including the terminator keeps "ab" + "c" apart from "a" + "bc":
+	return ini_reload_hash(crc, str.c_str(), (str.size() + 1) * sizeof(wchar_t));
+}
+
+IniReloadTracker::IniReloadTracker(std::function<uint64_t(const std::wstring &path)> stamp_file) :
+	stamp_file(stamp_file),
+	stats()
+{}
+
+void IniReloadTracker::begin()
+{
+	prev_files.swap(files);
+	prev_sections.swap(sections);
+	files.clear();
+	sections.clear();
+	stats = IniReloadStats();
+}
+
+bool IniReloadTracker::add_file(const std::wstring &path, const void *data, size_t size)
+{
+	return add_file(path, ini_reload_hash(0, data, size));
+}
+
+bool IniReloadTracker::add_file(const std::wstring &path, uint32_t hash)
+{
+	bool changed;
+
+	auto prev = prev_files.find(path);
+	changed = prev == prev_files.end() || prev->second != hash;
+
+	if (files.emplace(path, hash).second) {
+		stats.files++;
+		stats.files_changed += changed;
+	}
+
+	return changed;
+}
+
+void IniReloadTracker::add_section(const std::wstring &name, uint32_t fingerprint)
+{
+	Section &section = sections[name];
+
+	section.fingerprint = fingerprint;
+	section.dependencies.clear();
+	stats.sections++;
+}
+
+void IniReloadTracker::add_dependency(const std::wstring &name, const std::wstring &path)
+{
+	auto i = sections.find(name);
+	if (i == sections.end())
+		return;
+
+	i->second.dependencies.emplace_back(path, stamp_file(path));
+}
+
+void IniReloadTracker::forget(const std::wstring &name)
+{
+	sections.erase(name);
+}
+
+bool IniReloadTracker::unchanged(const std::wstring &name) const
+{
+	auto cur = sections.find(name);
+	auto prev = prev_sections.find(name);
+
+	if (cur == sections.end() || prev == prev_sections.end())
+		return false;
+	if (cur->second.fingerprint != prev->second.fingerprint)
+		return false;
+
+	for (auto &dependency : prev->second.dependencies) {
+		if (stamp_file(dependency.first) != dependency.second)
+			return false;
+	}
+
+	return true;
+}
+
+void IniReloadTracker::note_kept(bool kept)
+{
+	if (kept)
+		stats.kept++;
+	else
+		stats.rebuilt++;
+}
+
+IniReloadStats IniReloadTracker::get_stats() const
+{
+	IniReloadStats ret = stats;
+
+	// Anything in the previous load that has not turned up in this one:
+	for (auto &file : prev_files)
+		ret.files_removed += !files.count(file.first);
+
+	return ret;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Remembers what the previous config load was built from, so that a reload
+// (F10) can keep the expensive things it built last time - compiled custom
+// shaders and custom resources loaded from disk - for any section that is
+// exactly as it was, instead of throwing them away and building them again.
+//
+// A section counts as unchanged when its fingerprint (a hash of its lines,
+// and the namespace each came from, worked out by the caller) is the same as
+// last time, and every file it was built from still has the same stamp (last
+// write time and size, or 0 if it does not exist). Cheap things such as
+// command lists are still rebuilt every time, since they refer to the
+// objects from all the other sections.
+//
+// The contents of each ini file are hashed as well, so a reload can report
+// how many of them actually changed.
+//
+// This depends on nothing from Windows so that TestIniReload can check it.
+// Stamping files is left to the caller for the same reason.
+
+struct IniReloadStats {
+	uint32_t files;
+	uint32_t files_changed; // New since the previous load, or different contents
+	uint32_t files_removed;
+	uint32_t sections;      // Sections of the kinds that can be kept
+	uint32_t kept;          // Objects kept from the previous load
+	uint32_t rebuilt;
+};
+
+class IniReloadTracker {
+	typedef std::vector<std::pair<std::wstring, uint64_t>> Dependencies;
+
+	struct Section {
+		uint32_t fingerprint;
+		Dependencies dependencies;
+	};
+
+	std::unordered_map<std::wstring, uint32_t> files, prev_files;
+	std::unordered_map<std::wstring, Section> sections, prev_sections;
+	std::function<uint64_t(const std::wstring &path)> stamp_file;
+	IniReloadStats stats;
+
+public:
+	IniReloadTracker(std::function<uint64_t(const std::wstring &path)> stamp_file);
+
+	// Starts recording a new load. Everything recorded since the last
+	// call becomes what the new load is compared against.
+	void begin();
+
+	// Records an ini file and its contents, or the ini_reload_hash() of
+	// them. Returns true if it is new or its contents differ from the
+	// previous load.
+	bool add_file(const std::wstring &path, const void *data, size_t size);
+	bool add_file(const std::wstring &path, uint32_t hash);
+
+	// Section names are case sensitive here, so the caller should use the
+	// same (lower) case every time.
+	void add_section(const std::wstring &name, uint32_t fingerprint);
+	void add_dependency(const std::wstring &name, const std::wstring &path);
+
+	// Drops a section from the current load so that it will not count as
+	// unchanged next time (e.g. because it failed to build).
+	void forget(const std::wstring &name);
+
+	// True if the section was in the previous load with the same
+	// fingerprint, and nothing it depended on then has changed since.
+	bool unchanged(const std::wstring &name) const;
+
+	void note_kept(bool kept);
+	IniReloadStats get_stats() const;
+};
+
+// For the caller to build section fingerprints with:
+uint32_t ini_reload_hash(uint32_t crc, const std::wstring &str);
+uint32_t ini_reload_hash(uint32_t crc, const void *data, size_t size);
@@ -0,0 +1,343 @@
+#include "IniTokenizer.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+class IniMappedFile : public IniFileBuffer {
+	const char *map;
+	size_t map_size;
+
+public:
+	IniMappedFile(const char *map, size_t map_size) :
+		map(map),
+		map_size(map_size)
+	{}
+	~IniMappedFile()
+	{
+		UnmapViewOfFile(map);
+	}
+
+	const char* data() const override { return map; }
+	size_t size() const override { return map_size; }
+};
+
+bool map_ini_file(const std::wstring &path, std::shared_ptr<IniFileBuffer> *buffer)
+{
+	HANDLE file, mapping;
+	LARGE_INTEGER size;
+	const char *map;
+
+	file = CreateFileW(path.c_str(), GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	if (!GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart > SIZE_MAX) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// CreateFileMapping() refuses to map an empty file:
+	if (!size.QuadPart) {
+		CloseHandle(file);
+		*buffer = std::make_shared<IniStringBuffer>(std::string());
+		return true;
+	}
+
+	// The view keeps the mapping and the file open until it is unmapped:
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+	map = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size.QuadPart);
+	CloseHandle(mapping);
+	if (!map)
+		return false;
+
+	*buffer = std::make_shared<IniMappedFile>(map, (size_t)size.QuadPart);
+	return true;
+}
+
+#else
+
+class IniMappedFile : public IniFileBuffer {
+	const char *map;
+	size_t map_size;
+
+public:
+	IniMappedFile(const char *map, size_t map_size) :
+		map(map),
+		map_size(map_size)
+	{}
+	~IniMappedFile()
+	{
+		munmap((void*)map, map_size);
+	}
+
+	const char* data() const override { return map; }
+	size_t size() const override { return map_size; }
+};
+
+static std::string narrow_path(const std::wstring &path)
+{
+	std::string ret(path.size() * MB_CUR_MAX + 1, '\0');
+	size_t len = wcstombs(&ret[0], path.c_str(), ret.size());
+
+	if (len == (size_t)-1)
+		return std::string();
+	ret.resize(len);
+	return ret;
+}
+
+bool map_ini_file(const std::wstring &path, std::shared_ptr<IniFileBuffer> *buffer)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = ::open(narrow_path(path).c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) || (uint64_t)st.st_size > SIZE_MAX) {
+		::close(fd);
+		return false;
+	}
+
+	if (!st.st_size) {
+		::close(fd);
+		*buffer = std::make_shared<IniStringBuffer>(std::string());
+		return true;
+	}
+
+	addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED)
+		return false;
+
+	*buffer = std::make_shared<IniMappedFile>((const char*)addr, (size_t)st.st_size);
+	return true;
+}
+
+#endif
+
+// Returns the length of the valid UTF-8 sequence at p and the code point it
+// encodes, or 0 if there isn't one. Overlong encodings, surrogates and
+// anything past U+10FFFF are not valid:
+static size_t utf8_sequence(const unsigned char *p, const unsigned char *end, uint32_t *cp)
+{
+	uint32_t min;
+	size_t len, i;
+
+	if (p[0] < 0xc2 || p[0] > 0xf4)
+		return 0;
+
+	if (p[0] < 0xe0) {
+		len = 2;
+		min = 0x80;
+		*cp = p[0] & 0x1f;
+	} else if (p[0] < 0xf0) {
+		len = 3;
+		min = 0x800;
+		*cp = p[0] & 0x0f;
+	} else {
+		len = 4;
+		min = 0x10000;
+		*cp = p[0] & 0x07;
+	}
+
+	if ((size_t)(end - p) < len)
+		return 0;
+
+	for (i = 1; i < len; i++) {
+		if ((p[i] & 0xc0) != 0x80)
+			return 0;
+		*cp = (*cp << 6) | (p[i] & 0x3f);
+	}
+
+	if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp <= 0xdfff))
+		return 0;
+
+	return len;
+}
+
+void ini_widen(IniView view, std::wstring *str)
+{
+	const unsigned char *p = (const unsigned char*)view.data;
+	const unsigned char *end = p + view.len;
+	const unsigned char *run;
+	uint32_t cp;
+	size_t len;
+
+	// Never more wchar_ts than bytes:
+	str->reserve(str->size() + view.len);
+
+	while (p < end) {
+		// Copy runs of ASCII in one go:
+		for (run = p; p < end && *p < 0x80; p++) {}
+		str->append(run, p);
+		if (p == end)
+			break;
+
+		len = utf8_sequence(p, end, &cp);
+		if (!len) {
+			// Not UTF-8, widen it as a char as we always did:
+			str->push_back((wchar_t)(char)*p);
+			p++;
+			continue;
+		}
+		p += len;
+
+		if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+			cp -= 0x10000;
+			str->push_back((wchar_t)(0xd800 | (cp >> 10)));
+			str->push_back((wchar_t)(0xdc00 | (cp & 0x3ff)));
+		} else {
+			str->push_back((wchar_t)cp);
+		}
+	}
+}
+
+void ini_assign(IniView view, std::wstring *str)
+{
+	str->clear();
+	ini_widen(view, str);
+}
+
+bool ini_view_equals(IniView view, const char *ascii)
+{
+	size_t i;
+	char a, b;
+
+	// Anything that is not ASCII in the view can't widen to ASCII, so
+	// the lengths have to match as they are:
+	for (i = 0; i < view.len; i++) {
+		a = view.data[i];
+		b = ascii[i];
+		if (!b)
+			return false;
+		if (a >= 'A' && a <= 'Z')
+			a = a - 'A' + 'a';
+		if (b >= 'A' && b <= 'Z')
+			b = b - 'A' + 'a';
+		if (a != b)
+			return false;
+	}
+
+	return !ascii[i];
+}
+
+static inline bool ini_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+IniTokenizer::IniTokenizer(const char *data, size_t size) :
+	pos(data),
+	end(data + size)
+{
+	const char *eof;
+
+	if (!size)
+		return;
+
+	// In text mode the C runtime stops reading at a Ctrl+Z:
+	eof = (const char*)memchr(data, 0x1a, size);
+	if (eof)
+		end = eof;
+
+	if (end - pos >= 3 && !memcmp(pos, "\xef\xbb\xbf", 3))
+		pos += 3;
+}
+
+bool IniTokenizer::next(IniToken *token)
+{
+	const char *line_end, *first, *last, *delim, *key_end, *val;
+
+	while (pos < end) {
+		line_end = (const char*)memchr(pos, '\n', end - pos);
+		if (!line_end)
+			line_end = end;
+
+		first = pos;
+		last = line_end;
+		pos = line_end < end ? line_end + 1 : end;
+
+		// Text mode turns CRLF into LF, but leaves any other CR alone:
+		if (line_end < end && last > first && last[-1] == '\r')
+			last--;
+
+		// Strip preceding and trailing whitespace:
+		while (first < last && ini_space(*first))
+			first++;
+		if (first == last)
+			continue;
+		while (ini_space(last[-1]))
+			last--;
+
+		// Comments are lines that start with a semicolon as the first
+		// non-whitespace character that we want to skip over (note
+		// that a semicolon appearing in the middle of a line is *NOT*
+		// a comment in an ini file. It might be tempting to treat them
+		// as comments since a lot of people do seem to try to do that,
+		// but there may be cases where a semicolon is part of valid
+		// syntax and I am hesitant to change that underlying handling
+		// here, at least not without auditing most of the d3dx.ini
+		// files already in the wild. Let's at least try not to add any
+		// new syntax that includes semicolons anyway!)
+		if (*first == ';')
+			continue;
+
+		token->line = IniView{first, (size_t)(last - first)};
+		token->section = *first == '[';
+		token->equals = false;
+		token->key = IniView{first, 0};
+		token->val = IniView{first, 0};
+
+		if (token->section)
+			return true;
+
+		// Key / Val pair
+		delim = (const char*)memchr(first, '=', last - first);
+		if (delim) {
+			token->equals = true;
+
+			// Strip whitespace around delimiter. A line starting
+			// with = has always used the whole line as its key:
+			if (delim == first) {
+				key_end = last;
+			} else {
+				for (key_end = delim; ini_space(key_end[-1]); key_end--) {}
+			}
+			token->key = IniView{first, (size_t)(key_end - first)};
+
+			for (val = delim + 1; val < last && ini_space(*val); val++) {}
+			token->val = IniView{val, (size_t)(last - val)};
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+void tokenise_ini(const char *data, size_t size, std::vector<IniToken> *tokens)
+{
+	IniTokenizer tokenizer(data, size);
+	IniToken token;
+
+	while (tokenizer.next(&token))
+		tokens->push_back(token);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Splits ini files into lines without copying them. The file is mapped into
+// memory and each token is a view of the bytes it came from, so blank lines,
+// comments and the whitespace around everything are skipped without ever
+// being converted to a wstring. Only what the parser actually keeps (section
+// names, keys, values and raw lines) is widened, once, straight into
+// wherever it is stored.
+//
+// Files are decoded as UTF-8 when they are valid UTF-8. Any byte that is not
+// part of a valid sequence is widened the way it always was (as a signed
+// char), so ini files saved in some other code page come out exactly as they
+// did before, and a UTF-8 byte order mark is skipped. The mapped bytes are
+// raw, so the translation the C runtime used to make when the file was read
+// in text mode is made here instead: a CR immediately before a LF is dropped
+// and a Ctrl+Z ends the file.
+//
+// This depends on nothing from Windows so that TestIniTokenizer can check
+// it.
+
+// A run of bytes in a buffer that outlives it
+struct IniView {
+	const char *data;
+	size_t len;
+};
+
+// Whatever owns the bytes of an ini file while its tokens are in use
+class IniFileBuffer {
+public:
+	virtual ~IniFileBuffer() {}
+	virtual const char* data() const = 0;
+	virtual size_t size() const = 0;
+};
+
+class IniStringBuffer : public IniFileBuffer {
+	std::string contents;
+
+public:
+	IniStringBuffer(std::string contents) :
+		contents(std::move(contents))
+	{}
+
+	const char* data() const override { return contents.data(); }
+	size_t size() const override { return contents.size(); }
+};
+
+// Maps the file read only. The file is left open for other processes to
+// read and write, as the ifstream reading it used to, but the mapping
+// should be released as soon as the tokens are parsed - while it is held an
+// editor on Windows can't truncate the file to save it. Returns false if
+// the file could not be opened. Empty files get an empty buffer.
+bool map_ini_file(const std::wstring &path, std::shared_ptr<IniFileBuffer> *buffer);
+
+// Appends the view decoded as above to a wstring
+void ini_widen(IniView view, std::wstring *str);
+void ini_assign(IniView view, std::wstring *str);
+
+// Compares a view to an ASCII string with the case of A-Z folded, as
+// _wcsicmp would once the view was widened:
+bool ini_view_equals(IniView view, const char *ascii);
+
+// One line of an ini file. Blank lines and comments are already dropped,
+// and the whitespace at the start and end of the line is stripped:
+struct IniToken {
+	IniView line;
+	bool section;      // Starts with [
+	bool equals;       // Has an = sign, i.e. key and val were split out
+
+	// Whitespace stripped around the first = sign. Empty if there is no
+	// = sign:
+	IniView key;
+	IniView val;
+};
+
+// Yields the tokens one at a time, so a caller that does not need them all
+// at once doesn't need anywhere to keep them:
+class IniTokenizer {
+	const char *pos;
+	const char *end;
+
+public:
+	IniTokenizer(const char *data, size_t size);
+
+	bool next(IniToken *token);
+};
+
+void tokenise_ini(const char *data, size_t size, std::vector<IniToken> *tokens);
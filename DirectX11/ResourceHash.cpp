@@ -6,6 +6,7 @@
 #include "globals.h"
 #include "profiling.h"
 #include "overlay.h"
+#include "TextureHash.h"
 
 // DirectXTK headers fail to include their own pre-requisits. We just want
 // GetSurfaceInfo from LoaderHelpers
@@ -614,6 +615,19 @@ static size_t Texture3DLength(
 	return padded_width * padded_height * mip_depth / 16 * block_size;
 }
 
+// Large textures are hashed in parallel on the texture hash pool, with the
+// same result as hashing them serially with crc32c_hw()
+static uint32_t hash_texture_data(uint32_t hash, const TextureHashStream &stream)
+{
+	if (!TextureHashPool::get()->hash(&hash, stream)) {
+		// Fatal error, but catch it and return null for hash.
+		LogInfo("   ******* Exception caught while calculating texture hash ******\n");
+		return 0;
+	}
+
+	return hash;
+}
+
 static uint32_t hash_tex2d_data(uint32_t hash, const void *data, size_t length,
 		const D3D11_TEXTURE2D_DESC *pDesc, bool zero_padding,
 		bool skip_padding, UINT mapped_row_pitch)
@@ -651,34 +665,12 @@ static uint32_t hash_tex2d_data(uint32_t hash, const void *data, size_t length,
 	// padding replaced with zeroes rather than skipped.
 
 	if (!zero_padding && !skip_padding)
-		return crc32c_hw(hash, data, length);
+		return hash_texture_data(hash, TextureHashStream::contiguous(data, length));
 
 	DirectX::LoaderHelpers::GetSurfaceInfo(pDesc->Width, pDesc->Height, pDesc->Format, &slice_pitch, &row_pitch, &row_count);
 
-	uint8_t *sptr = (uint8_t*)data;
-	size_t msize = min(row_pitch, mapped_row_pitch);
-
-	signed padding = (signed)mapped_row_pitch - (signed)row_pitch;
-	uint8_t *zeroes = NULL;
-	if (zero_padding && padding > 0) {
-		zeroes = new uint8_t[padding];
-		memset(zeroes, 0, padding);
-	}
-
-	signed remaining = (signed)length;
-	for (size_t h = 0; h < row_count && remaining > 0; h++) {
-		hash = crc32c_hw(hash, sptr, min(msize, (unsigned)remaining));
-		sptr += mapped_row_pitch;
-		remaining -= (signed)msize;
-
-		if (zeroes && remaining > 0) {
-			hash = crc32c_hw(hash, zeroes, min(padding, remaining));
-			remaining -= padding;
-		}
-	}
-
-	delete [] zeroes;
-	return hash;
+	return hash_texture_data(hash, TextureHashStream::rows(data, length,
+			row_pitch, row_count, mapped_row_pitch, zero_padding));
 }
 
 uint32_t CalcTexture2DDataHash(
@@ -911,7 +903,7 @@ uint32_t CalcTexture3DDataHash(
 		if (length_v12 < length) {
 			LogDebug("  Using 3DMigoto v1.2.1 compatible Texture3D CRC calculation\n");
 		}
-		return crc32c_hw(hash, pInitialData[0].pSysMem, length_v12);
+		return hash_texture_data(hash, TextureHashStream::contiguous(pInitialData[0].pSysMem, length_v12));
 	}
 
 	// If we are here it means the old length had overflowed the buffer,
@@ -925,7 +917,7 @@ uint32_t CalcTexture3DDataHash(
 
 	LogDebug("  Using 3DMigoto v1.2.9+ Texture3D CRC calculation\n");
 
-	hash = crc32c_hw(hash, pInitialData[0].pSysMem, length);
+	hash = hash_texture_data(hash, TextureHashStream::contiguous(pInitialData[0].pSysMem, length));
 
 	return hash;
 }
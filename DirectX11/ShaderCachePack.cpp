@@ -0,0 +1,632 @@
+#include "ShaderCachePack.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "crc32c.h"
+#include "ShaderIndex.h"
+
+// The pack starts with this header, followed by the records one after
+// another, each a RecordHeader followed by its payload, padded so that the
+// next header is 8 byte aligned in the mapping:
+static const char pack_magic[8] = { '3', 'D', 'M', 'S', 'C', 'P', 'A', 'K' };
+static const uint32_t pack_format = 1;
+
+struct PackHeader {
+	char magic[8];
+	uint32_t format;
+	uint32_t reserved;
+};
+
+static const uint32_t record_magic = 0x43534d33; // "3MSC"
+
+struct RecordHeader {
+	uint32_t magic;
+	uint32_t checksum; // crc32c of everything that follows, payload included
+	ShaderCacheKey key;
+	uint32_t tag;
+	uint32_t size;
+};
+
+static_assert(sizeof(ShaderCacheKey) == 16, "ShaderCacheKey is written to disk and must not have padding");
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader is written to disk and must not have padding");
+
+// Patched shaders are at most a few hundred KB, so a record that claims to
+// be any larger than this is garbage:
+static const uint32_t max_payload = 64 * 1024 * 1024;
+
+static uint64_t record_span(uint32_t size)
+{
+	return (sizeof(RecordHeader) + (uint64_t)size + 7) & ~7ull;
+}
+
+static uint32_t record_checksum(const RecordHeader &header, const void *payload)
+{
+	uint32_t crc;
+
+	crc = crc32c_append(0, (const uint8_t*)&header.key,
+			sizeof(header) - offsetof(RecordHeader, key));
+	return crc32c_append(crc, (const uint8_t*)payload, header.size);
+}
+
+// Lays out a complete record in buf so that it can go to the file with a
+// single write:
+static void build_record(std::vector<uint8_t> *buf, const ShaderCacheKey &key,
+		uint32_t tag, const void *data, size_t size)
+{
+	RecordHeader header;
+
+	header.magic = record_magic;
+	header.key = key;
+	header.tag = tag;
+	header.size = (uint32_t)size;
+	header.checksum = record_checksum(header, data);
+
+	buf->assign((size_t)record_span(header.size), 0);
+	memcpy(buf->data(), &header, sizeof(header));
+	if (size)
+		memcpy(buf->data() + sizeof(header), data, size);
+}
+
+static void init_pack_header(PackHeader *pack)
+{
+	memcpy(pack->magic, pack_magic, sizeof(pack_magic));
+	pack->format = pack_format;
+	pack->reserved = 0;
+}
+
+#ifdef _WIN32
+
+bool ShaderCachePack::open_file()
+{
+	// Other processes may read the pack (e.g. to convert or inspect it),
+	// but not write to it while we have it open:
+	file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+			NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	return file != INVALID_HANDLE_VALUE;
+}
+
+void ShaderCachePack::close_file()
+{
+	unmap_file();
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+}
+
+bool ShaderCachePack::map_file(uint64_t size)
+{
+	unmap_file();
+	if (!size)
+		return true;
+
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY,
+			(DWORD)(size >> 32), (DWORD)size, NULL);
+	if (!mapping)
+		return false;
+	map = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size);
+	if (!map) {
+		CloseHandle(mapping);
+		mapping = NULL;
+		return false;
+	}
+	map_size = size;
+	return true;
+}
+
+void ShaderCachePack::unmap_file()
+{
+	if (map)
+		UnmapViewOfFile(map);
+	if (mapping)
+		CloseHandle(mapping);
+	map = NULL;
+	mapping = NULL;
+	map_size = 0;
+}
+
+bool ShaderCachePack::write_at(uint64_t offset, const void *data, size_t size)
+{
+	OVERLAPPED overlapped = {};
+	DWORD written;
+
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	return WriteFile(file, data, (DWORD)size, &written, &overlapped) && written == size;
+}
+
+bool ShaderCachePack::file_is_open()
+{
+	return file != INVALID_HANDLE_VALUE;
+}
+
+uint64_t ShaderCachePack::file_size()
+{
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(file, &size))
+		return 0;
+	return (uint64_t)size.QuadPart;
+}
+
+bool ShaderCachePack::truncate_file(uint64_t size)
+{
+	LARGE_INTEGER offset;
+
+	offset.QuadPart = (LONGLONG)size;
+	return SetFilePointerEx(file, offset, NULL, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+static FILE* create_temp_file(const std::wstring &path)
+{
+	FILE *fp = NULL;
+
+	_wfopen_s(&fp, path.c_str(), L"wb");
+	return fp;
+}
+
+static bool replace_file(const std::wstring &from, const std::wstring &to)
+{
+	return !!MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+static void remove_file(const std::wstring &path)
+{
+	DeleteFileW(path.c_str());
+}
+
+#else
+
+static std::string narrow_path(const std::wstring &path)
+{
+	std::string ret(path.size() * MB_CUR_MAX + 1, '\0');
+	size_t len = wcstombs(&ret[0], path.c_str(), ret.size());
+
+	if (len == (size_t)-1)
+		return std::string();
+	ret.resize(len);
+	return ret;
+}
+
+bool ShaderCachePack::open_file()
+{
+	fd = ::open(narrow_path(path).c_str(), O_RDWR | O_CREAT, 0644);
+	return fd >= 0;
+}
+
+void ShaderCachePack::close_file()
+{
+	unmap_file();
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+}
+
+bool ShaderCachePack::map_file(uint64_t size)
+{
+	void *addr;
+
+	unmap_file();
+	if (!size)
+		return true;
+
+	addr = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		return false;
+	map = (const uint8_t*)addr;
+	map_size = size;
+	return true;
+}
+
+void ShaderCachePack::unmap_file()
+{
+	if (map)
+		munmap((void*)map, (size_t)map_size);
+	map = NULL;
+	map_size = 0;
+}
+
+bool ShaderCachePack::write_at(uint64_t offset, const void *data, size_t size)
+{
+	return pwrite(fd, data, size, (off_t)offset) == (ssize_t)size;
+}
+
+bool ShaderCachePack::file_is_open()
+{
+	return fd >= 0;
+}
+
+uint64_t ShaderCachePack::file_size()
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return 0;
+	return (uint64_t)st.st_size;
+}
+
+bool ShaderCachePack::truncate_file(uint64_t size)
+{
+	return !ftruncate(fd, (off_t)size);
+}
+
+static FILE* create_temp_file(const std::wstring &path)
+{
+	return fopen(narrow_path(path).c_str(), "wb");
+}
+
+static bool replace_file(const std::wstring &from, const std::wstring &to)
+{
+	return !rename(narrow_path(from).c_str(), narrow_path(to).c_str());
+}
+
+static void remove_file(const std::wstring &path)
+{
+	remove(narrow_path(path).c_str());
+}
+
+#endif
+
+ShaderCachePack::ShaderCachePack() :
+#ifdef _WIN32
+	file(INVALID_HANDLE_VALUE),
+	mapping(NULL),
+#else
+	fd(-1),
+#endif
+	map(NULL),
+	map_size(0),
+	end(0),
+	write_failed(false),
+	stats()
+{}
+
+ShaderCachePack::~ShaderCachePack()
+{
+	close();
+}
+
+// Builds the index from the record headers in the mapping without touching
+// the payloads, so opening a large pack does not mean reading all of it.
+// The payload checksums are verified as each record is looked up instead.
+bool ShaderCachePack::load()
+{
+	const RecordHeader *header;
+	PackHeader pack;
+	uint64_t size, offset, span;
+
+	size = file_size();
+	if (size >= sizeof(PackHeader)) {
+		if (!map_file(size))
+			return false;
+		if (memcmp(map, pack_magic, sizeof(pack_magic))
+				|| ((const PackHeader*)map)->format != pack_format)
+			size = 0;
+	}
+
+	if (size < sizeof(PackHeader)) {
+		// New, or not a pack this version understands. Start over:
+		unmap_file();
+		init_pack_header(&pack);
+		if (!truncate_file(0) || !write_at(0, &pack, sizeof(pack)))
+			return false;
+		end = sizeof(pack);
+		return map_file(end);
+	}
+
+	for (offset = sizeof(PackHeader); offset + sizeof(RecordHeader) <= size; offset += span) {
+		header = (const RecordHeader*)(map + offset);
+		if (header->magic != record_magic || header->size > max_payload)
+			break;
+		span = record_span(header->size);
+		if (offset + span > size)
+			break;
+
+		// Offsets are never 0, so this is only set if a record for the
+		// key came earlier:
+		Record &record = index[header->key];
+		if (record.offset) {
+			stats.dead_bytes += record_span(record.size);
+			stats.live_bytes -= record_span(record.size);
+		} else
+			stats.records++;
+		record.offset = offset + sizeof(RecordHeader);
+		record.size = header->size;
+		record.tag = header->tag;
+		record.verified = false;
+		stats.live_bytes += span;
+	}
+
+	end = offset;
+	stats.discarded = size - offset;
+
+	// Cut off anything after the last intact record, so that a record
+	// written over a longer torn one can't leave part of it behind to be
+	// mistaken for another record the next time:
+	if (stats.discarded) {
+		unmap_file();
+		if (!truncate_file(end))
+			return false;
+		return map_file(end);
+	}
+	return true;
+}
+
+bool ShaderCachePack::open_locked()
+{
+	close_file();
+	index.clear();
+	stats = ShaderCachePackStats();
+	write_failed = false;
+	end = 0;
+
+	if (!open_file())
+		return false;
+	if (!load()) {
+		close_file();
+		index.clear();
+		stats = ShaderCachePackStats();
+		return false;
+	}
+	return true;
+}
+
+bool ShaderCachePack::open(const wchar_t *path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	this->path = path;
+	return open_locked();
+}
+
+void ShaderCachePack::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	close_file();
+	index.clear();
+	end = 0;
+}
+
+bool ShaderCachePack::is_open()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return file_is_open();
+}
+
+const std::wstring& ShaderCachePack::get_path()
+{
+	return path;
+}
+
+bool ShaderCachePack::lookup(const ShaderCacheKey &key, uint32_t *tag, std::vector<uint8_t> *data)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	const RecordHeader *header;
+
+	auto i = index.find(key);
+	if (i == index.end()) {
+		stats.misses++;
+		return false;
+	}
+	Record &record = i->second;
+
+	// Records stored since the file was last mapped are past the end of
+	// the mapping, which only needs to grow to reach them once:
+	if (record.offset + record.size > map_size && !map_file(end)) {
+		stats.misses++;
+		return false;
+	}
+
+	header = (const RecordHeader*)(map + record.offset - sizeof(RecordHeader));
+	if (!record.verified) {
+		if (header->magic != record_magic || !(header->key == key)
+				|| header->size != record.size
+				|| record_checksum(*header, header + 1) != header->checksum) {
+			// Corrupt. Forget about it so that the next store replaces it:
+			stats.dead_bytes += record_span(record.size);
+			stats.live_bytes -= record_span(record.size);
+			stats.records--;
+			stats.misses++;
+			index.erase(i);
+			return false;
+		}
+		record.verified = true;
+	}
+
+	data->assign((const uint8_t*)(header + 1), (const uint8_t*)(header + 1) + record.size);
+	*tag = record.tag;
+	stats.hits++;
+	return true;
+}
+
+bool ShaderCachePack::store(const ShaderCacheKey &key, uint32_t tag, const void *data, size_t size)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<uint8_t> buf;
+
+	if (!file_is_open() || write_failed || size > max_payload)
+		return false;
+
+	build_record(&buf, key, tag, data, size);
+	if (!write_at(end, buf.data(), buf.size())) {
+		// Whatever part of it made it to disk is cut off when the pack
+		// is next opened:
+		write_failed = true;
+		return false;
+	}
+
+	auto i = index.find(key);
+	if (i != index.end()) {
+		stats.dead_bytes += record_span(i->second.size);
+		stats.live_bytes -= record_span(i->second.size);
+	} else
+		stats.records++;
+
+	Record &record = index[key];
+	record.offset = end + sizeof(RecordHeader);
+	record.size = (uint32_t)size;
+	record.tag = tag;
+	record.verified = true;
+
+	end += buf.size();
+	stats.live_bytes += buf.size();
+	stats.stores++;
+	return true;
+}
+
+bool ShaderCachePack::compact(const std::function<bool(const ShaderCacheKey &key, uint32_t tag)> &keep, bool force)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<const Record*> live;
+	const RecordHeader *header;
+	std::wstring tmp_path;
+	uint64_t live_bytes = 0, total;
+	PackHeader pack;
+	FILE *fp;
+	bool ok;
+
+	if (!file_is_open())
+		return false;
+
+	for (auto &i : index) {
+		if (keep(i.first, i.second.tag)) {
+			live.push_back(&i.second);
+			live_bytes += record_span(i.second.size);
+		}
+	}
+
+	total = end - sizeof(PackHeader);
+	if (live_bytes == total)
+		return false;
+	if (!force && (total - live_bytes) * 2 < total)
+		return false;
+	if (map_size < end && !map_file(end))
+		return false;
+
+	// Keep the records in the order they were written, which is roughly
+	// the order the game creates its shaders in:
+	std::sort(live.begin(), live.end(), [](const Record *a, const Record *b) {
+		return a->offset < b->offset;
+	});
+
+	tmp_path = path + L".tmp";
+	fp = create_temp_file(tmp_path);
+	if (!fp)
+		return false;
+
+	init_pack_header(&pack);
+	ok = fwrite(&pack, sizeof(pack), 1, fp) == 1;
+	for (const Record *record : live) {
+		if (!ok)
+			break;
+		header = (const RecordHeader*)(map + record->offset - sizeof(RecordHeader));
+		if (!record->verified && (header->magic != record_magic
+				|| record_checksum(*header, header + 1) != header->checksum))
+			continue;
+		ok = fwrite(header, 1, (size_t)record_span(record->size), fp) == record_span(record->size);
+	}
+	ok = !fclose(fp) && ok;
+
+	// The pack can't be replaced while we have it open on Windows:
+	close_file();
+	if (!ok || !replace_file(tmp_path, path)) {
+		remove_file(tmp_path);
+		ok = false;
+	}
+
+	// Whether or not it was replaced, the pack has to be opened again. If
+	// that fails it is left closed with nothing in the index, which the
+	// caller can tell from is_open():
+	if (!open_locked())
+		return false;
+	return ok;
+}
+
+ShaderCachePackStats ShaderCachePack::get_stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
+
+static wchar_t ascii_lower(wchar_t c)
+{
+	if (c >= L'A' && c <= L'Z')
+		return c - L'A' + L'a';
+	return c;
+}
+
+bool parse_legacy_shader_regex_cache_name(const wchar_t *name, size_t len,
+		uint64_t *hash, uint32_t *type, bool *is_bin)
+{
+	static const wchar_t dat_suffix[] = L"_regex.dat";
+	static const wchar_t bin_suffix[] = L"_regex.bin";
+	static const size_t suffix_len = sizeof(dat_suffix) / sizeof(wchar_t) - 1;
+	bool dat = true, bin = true;
+	uint64_t h = 0;
+	wchar_t c;
+	size_t i;
+
+	// 16 hex digits, a dash and a two letter type, then the suffix
+	if (len != 19 + suffix_len || name[16] != L'-')
+		return false;
+
+	for (i = 0; i < 16; i++) {
+		c = ascii_lower(name[i]);
+		if (c >= L'0' && c <= L'9')
+			h = (h << 4) | (c - L'0');
+		else if (c >= L'a' && c <= L'f')
+			h = (h << 4) | (c - L'a' + 10);
+		else
+			return false;
+	}
+
+	*type = shader_index_type(name + 17, 2);
+	if (!*type)
+		return false;
+
+	for (i = 0; i < suffix_len; i++) {
+		c = ascii_lower(name[19 + i]);
+		dat = dat && c == dat_suffix[i];
+		bin = bin && c == bin_suffix[i];
+	}
+	if (!dat && !bin)
+		return false;
+
+	*hash = h;
+	*is_bin = bin;
+	return true;
+}
+
+bool convert_legacy_shader_regex_cache(ShaderCachePack *pack, uint64_t hash, uint32_t type,
+		const std::vector<uint8_t> &dat, const std::vector<uint8_t> *bin)
+{
+	ShaderRegexCacheHeader header;
+	std::vector<uint8_t> payload;
+	ShaderCacheKey key = { hash, type, ShaderCacheKind::REGEX };
+
+	if (dat.size() < sizeof(header))
+		return false;
+	memcpy(&header, dat.data(), sizeof(header));
+	if (header.version != SHADER_REGEX_CACHE_VERSION
+			|| dat.size() != sizeof(header) + (uint64_t)header.num_matches * sizeof(uint32_t))
+		return false;
+	if (header.patched && (!bin || bin->empty()))
+		return false;
+
+	payload = dat;
+	if (header.patched)
+		payload.insert(payload.end(), bin->begin(), bin->end());
+
+	return pack->store(key, header.shader_regex_hash, payload.data(), payload.size());
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// A single indexed pack file in ShaderCache holding the artifacts that
+// 3DMigoto caches for each shader the game creates, in place of the separate
+// files it used to write for every one of them. A game that has been played
+// through can create tens of thousands of shaders, and with several files
+// each the ShaderCache directory ends up with so many that opening and
+// reading them one at a time dominates the start up time.
+//
+// The file is memory mapped, and the index is built when it is opened by
+// walking the record headers in the mapping, without reading any payloads.
+// New records are appended with a single write, each with a checksum that is
+// verified the first time it is read, so a record cut short by a crash is
+// simply ignored and written over. A newer record for the same key replaces
+// the older one, which is left behind as dead space until compact() rewrites
+// the file with only the live records and renames it over the original.
+//
+// This depends on nothing from D3D or the rest of 3DMigoto so that
+// TestShaderCachePack can check and benchmark it.
+
+enum class ShaderCacheKind : uint32_t {
+	// ShaderRegex results: a ShaderRegexCacheHeader, the ids of the groups
+	// that matched, then the patched bytecode if there is any. The tag is
+	// the shader_regex_hash of the config the results came from.
+	REGEX = 1,
+};
+
+struct ShaderCacheKey {
+	uint64_t hash;         // Shader hash
+	uint32_t type;         // From shader_index_type()
+	ShaderCacheKind kind;
+
+	bool operator==(const ShaderCacheKey &other) const
+	{
+		return hash == other.hash && type == other.type && kind == other.kind;
+	}
+};
+
+// Layout of the ShaderRegex cache, which was previously split between a
+// <hash>-<type>_regex.dat file holding this header and the match ids, and a
+// _regex.bin file holding the patched bytecode:
+#define SHADER_REGEX_CACHE_VERSION 1
+struct ShaderRegexCacheHeader {
+	uint32_t version;
+	uint32_t shader_regex_hash;
+	uint32_t patched;
+	uint32_t num_matches;
+};
+
+struct ShaderCachePackStats {
+	uint32_t records;        // Live records
+	uint64_t live_bytes;
+	uint64_t dead_bytes;     // Replaced and corrupt records
+	uint64_t discarded;      // Bytes after the last intact record at open
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t stores;
+};
+
+class ShaderCachePack {
+	struct KeyHash {
+		size_t operator()(const ShaderCacheKey &key) const
+		{
+			return (size_t)(key.hash ^ ((uint64_t)key.type << 40) ^ (uint64_t)key.kind);
+		}
+	};
+
+	struct Record {
+		uint64_t offset; // Of the payload
+		uint32_t size;
+		uint32_t tag;
+		bool verified;   // Checksum has been checked
+	};
+
+	std::mutex lock;
+	std::wstring path;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const uint8_t *map;
+	uint64_t map_size;
+	uint64_t end; // Where the next record will be written
+	bool write_failed;
+
+	std::unordered_map<ShaderCacheKey, Record, KeyHash> index;
+	ShaderCachePackStats stats;
+
+	bool open_file();
+	void close_file();
+	bool file_is_open();
+	uint64_t file_size();
+	bool truncate_file(uint64_t size);
+	bool map_file(uint64_t size);
+	void unmap_file();
+	bool write_at(uint64_t offset, const void *data, size_t size);
+	bool load();
+	bool open_locked();
+
+public:
+	ShaderCachePack();
+	~ShaderCachePack();
+
+	// Opens the pack, creating it if it does not exist or starting it over
+	// if it is not one this version understands. Any other process is kept
+	// from writing to it while it is open.
+	bool open(const wchar_t *path);
+	void close();
+	bool is_open();
+	const std::wstring& get_path();
+
+	// Copies out the payload of the newest intact record for the key, and
+	// returns its tag. Returns false if there is none.
+	bool lookup(const ShaderCacheKey &key, uint32_t *tag, std::vector<uint8_t> *data);
+
+	// Appends a record, replacing any earlier one for the same key.
+	bool store(const ShaderCacheKey &key, uint32_t tag, const void *data, size_t size);
+
+	// Rewrites the pack with only the live records that keep() approves of,
+	// if that would at least halve its size or force is set, and renames it
+	// over the original. Returns true if it did. The pack is left closed if
+	// it could not be opened again afterwards.
+	bool compact(const std::function<bool(const ShaderCacheKey &key, uint32_t tag)> &keep, bool force = false);
+
+	ShaderCachePackStats get_stats();
+};
+
+// Parses the name of a file from the old ShaderRegex cache layout, e.g.
+// 0123456789abcdef-ps_regex.dat. Returns false for anything else.
+bool parse_legacy_shader_regex_cache_name(const wchar_t *name, size_t len,
+		uint64_t *hash, uint32_t *type, bool *is_bin);
+
+// Adds a ShaderRegex cache from the old layout to the pack, from the
+// contents of its _regex.dat file and its _regex.bin if it had one. Returns
+// false without adding anything if the .dat is not one this version wrote,
+// or claims to be patched but there is no .bin.
+bool convert_legacy_shader_regex_cache(ShaderCachePack *pack, uint64_t hash, uint32_t type,
+		const std::vector<uint8_t> &dat, const std::vector<uint8_t> *bin);
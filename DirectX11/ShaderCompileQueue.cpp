@@ -0,0 +1,180 @@
+#include "ShaderCompileQueue.h"
+
+#include <algorithm>
+
+ShaderCompileQueue::ShaderCompileQueue(unsigned threads, size_t max_queued) :
+	max_queued(max_queued),
+	running(0),
+	stopping(false),
+	stats()
+{
+	unsigned i;
+
+	for (i = 0; i < threads; i++)
+		workers.emplace_back(&ShaderCompileQueue::worker_main, this);
+}
+
+ShaderCompileQueue::~ShaderCompileQueue()
+{
+	drain();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	work_cv.notify_all();
+
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+void ShaderCompileQueue::worker_main()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	bool ok;
+
+	while (true) {
+		work_cv.wait(guard, [&] { return stopping || !queue.empty(); });
+		if (stopping)
+			return;
+
+		Job job = std::move(queue.front());
+		queue.pop_front();
+		states[job.key] = ShaderCompileState::RUNNING;
+		running++;
+
+		guard.unlock();
+		// An exception escaping a worker thread would take down the
+		// game, so anything the compiler throws just fails the job:
+		try {
+			ok = job.work();
+		} catch (...) {
+			ok = false;
+		}
+		// Whatever the work holds on to is released before we take the
+		// lock back, so that its destructors never run under it:
+		job.work = nullptr;
+		guard.lock();
+
+		// Nobody is going to ask about a failed job, so it is forgotten
+		// straight away. A finished one is kept until the caller has
+		// dealt with its result and calls finish():
+		if (ok) {
+			states[job.key] = ShaderCompileState::DONE;
+			stats.done++;
+		} else {
+			states.erase(job.key);
+			stats.failed++;
+		}
+
+		if (--running == 0 && queue.empty())
+			idle_cv.notify_all();
+	}
+}
+
+bool ShaderCompileQueue::submit(uint64_t key, std::function<bool()> work)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	if (workers.empty() || queue.size() >= max_queued) {
+		stats.rejected++;
+		return false;
+	}
+
+	auto i = states.find(key);
+	if (i != states.end() && (i->second == ShaderCompileState::QUEUED
+			|| i->second == ShaderCompileState::RUNNING)) {
+		stats.rejected++;
+		return false;
+	}
+
+	queue.push_back(Job{key, std::move(work)});
+	states[key] = ShaderCompileState::QUEUED;
+	stats.submitted++;
+	stats.max_queued = std::max(stats.max_queued, (uint32_t)queue.size());
+
+	guard.unlock();
+	work_cv.notify_one();
+	return true;
+}
+
+ShaderCompileState ShaderCompileQueue::cancel(uint64_t key)
+{
+	Job cancelled; // Destroyed after the guard, outside the lock
+	std::lock_guard<std::mutex> guard(lock);
+	ShaderCompileState state;
+
+	auto i = states.find(key);
+	if (i == states.end())
+		return ShaderCompileState::NONE;
+	state = i->second;
+
+	if (state == ShaderCompileState::RUNNING)
+		return state;
+
+	if (state == ShaderCompileState::QUEUED) {
+		auto job = std::find_if(queue.begin(), queue.end(),
+				[&](const Job &job) { return job.key == key; });
+		cancelled = std::move(*job);
+		queue.erase(job);
+		stats.cancelled++;
+		if (!running && queue.empty())
+			idle_cv.notify_all();
+	}
+
+	states.erase(i);
+	return state;
+}
+
+ShaderCompileState ShaderCompileQueue::finish(uint64_t key)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	ShaderCompileState state;
+
+	auto i = states.find(key);
+	if (i == states.end())
+		return ShaderCompileState::NONE;
+	state = i->second;
+
+	if (state == ShaderCompileState::DONE)
+		states.erase(i);
+	return state;
+}
+
+ShaderCompileState ShaderCompileQueue::state(uint64_t key)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto i = states.find(key);
+	if (i == states.end())
+		return ShaderCompileState::NONE;
+	return i->second;
+}
+
+size_t ShaderCompileQueue::drain()
+{
+	std::deque<Job> cancelled; // Destroyed after the guard, outside the lock
+	std::unique_lock<std::mutex> guard(lock);
+
+	for (Job &job : queue)
+		states.erase(job.key);
+	cancelled.swap(queue);
+	stats.cancelled += (uint32_t)cancelled.size();
+
+	idle_cv.wait(guard, [&] { return !running; });
+	return cancelled.size();
+}
+
+void ShaderCompileQueue::wait_idle()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	idle_cv.wait(guard, [&] { return !running && queue.empty(); });
+}
+
+ShaderCompileStats ShaderCompileQueue::get_stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Worker pool that compiles replacement shaders from ShaderFixes in the
+// background, so that CreateXXXShader can give the game its original shader
+// straight away instead of stalling the game's loading thread on D3DCompile.
+// The work function the caller queues is responsible for handing the
+// replacement over once it is ready - the game keeps using the original shader
+// until then.
+//
+// Each job is tracked by a key (the original shader's handle) and goes
+// through these states:
+//
+//   QUEUED -> RUNNING -> DONE -> (forgotten) once the caller calls finish()
+//      |         |
+//      |         +-------> (forgotten) if it fails
+//      +----> (forgotten) if cancelled before it starts
+//
+// so that the states of shaders the game creates over a long session don't
+// pile up. The work function is always destroyed outside the lock, since it
+// may hold references that call back into D3D as they are released.
+//
+// The queue is bounded. Once it is full submit() turns work away and the
+// caller compiles the shader itself as it always used to, so a game that
+// creates thousands of shaders at once can't build up a backlog that would
+// keep the originals on screen for minutes.
+//
+// This depends on nothing from D3D or the rest of 3DMigoto so that
+// TestShaderCompileQueue can check it with a mock compiler.
+
+// Limits for [Rendering] async_shader_compile. D3DCompile is CPU bound, so
+// more threads than that only fight over cores the game wants as well:
+static const int MAX_ASYNC_SHADER_COMPILE_THREADS = 16;
+static const int MAX_ASYNC_SHADER_COMPILE_QUEUED = 256;
+
+enum class ShaderCompileState {
+	NONE,     // Never queued, cancelled, failed or finished
+	QUEUED,
+	RUNNING,
+	DONE,
+};
+
+struct ShaderCompileStats {
+	uint32_t submitted;
+	uint32_t rejected;   // Turned away because the queue was full
+	uint32_t done;
+	uint32_t failed;     // The work returned false or threw
+	uint32_t cancelled;
+	uint32_t max_queued; // Most jobs that were ever waiting at once
+};
+
+class ShaderCompileQueue {
+	struct Job {
+		uint64_t key;
+		std::function<bool()> work;
+	};
+
+	std::mutex lock;
+	std::condition_variable work_cv;
+	std::condition_variable idle_cv;
+	std::deque<Job> queue;
+	std::unordered_map<uint64_t, ShaderCompileState> states;
+	size_t max_queued;
+	unsigned running;
+	bool stopping;
+	ShaderCompileStats stats;
+
+	std::vector<std::thread> workers;
+
+	void worker_main();
+
+public:
+	// 3DMigoto never destroys its queue, as with TextureHashPool, since the
+	// workers can't be joined while the DLL is being unloaded. Destroying
+	// one cancels anything still queued and waits for the running jobs.
+	ShaderCompileQueue(unsigned threads, size_t max_queued);
+	~ShaderCompileQueue();
+
+	// Queues work to run on a worker. Returns false without queuing it if
+	// the queue is full, or a job with the same key is still queued or
+	// running, in which case the caller should do the work itself.
+	bool submit(uint64_t key, std::function<bool()> work);
+
+	// Drops the job if it has not started and forgets about the key, so
+	// that it can be submitted again (e.g. when a shader handle is reused).
+	// A running job can't be stopped, so its key is only forgotten once it
+	// has failed, or has finished and is cancelled again or finished with.
+	// Returns the state it was in.
+	ShaderCompileState cancel(uint64_t key);
+
+	// Forgets a job once its result has been dealt with, if it is DONE.
+	// Returns the state it was in.
+	ShaderCompileState finish(uint64_t key);
+
+	ShaderCompileState state(uint64_t key);
+
+	// Cancels every job that has not started, and waits for the running
+	// ones to finish. Returns the number cancelled.
+	size_t drain();
+
+	// Waits for every queued and running job to finish
+	void wait_idle();
+
+	ShaderCompileStats get_stats();
+};
@@ -0,0 +1,384 @@
+#include "ShaderDirectoryIndex.h"
+
+#include <string>
+
+#include "lock.h"
+#include "log.h"
+
+// Big enough that a fix being unzipped into ShaderFixes or a full export
+// to ShaderCache rarely overflows it. If it does we just rescan.
+#define SHADER_INDEX_NOTIFY_BUFFER (64 * 1024)
+
+static CRITICAL_SECTION shader_index_lock;
+
+class ShaderDirectoryIndex
+{
+	// Lookups, the watcher thread and ShaderIndexFileWritten() all go
+	// through shader_index_lock to access these:
+	ShaderIndexTable table;
+	bool current;
+
+	HANDLE dir_handle;
+	HANDLE stop_event;
+	HANDLE thread;
+	OVERLAPPED overlapped;
+	DWORD *notify_buffer; // Must be DWORD aligned
+
+	bool scan();
+	void apply_changes();
+	void update_file(const wchar_t *name, size_t len);
+	static DWORD WINAPI watcher_main(LPVOID param);
+
+public:
+	std::wstring dir;
+
+	ShaderDirectoryIndex(const wchar_t *dir);
+	~ShaderDirectoryIndex();
+	bool start();
+
+	// Must be called with shader_index_lock held
+	bool may_exist(UINT64 hash, uint32_t type, ShaderFileVariant variant);
+	bool unchanged(UINT64 hash, uint32_t type, ShaderFileVariant variant, uint64_t timestamp);
+	void add_file(const wchar_t *name, size_t len, uint64_t timestamp);
+};
+
+// [0] is ShaderFixes, [1] is ShaderCache (if it is a different directory)
+static ShaderDirectoryIndex *shader_indexes[2];
+
+static uint64_t filetime_to_u64(const FILETIME &ft)
+{
+	return ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+ShaderDirectoryIndex::ShaderDirectoryIndex(const wchar_t *dir) :
+	current(false),
+	dir_handle(INVALID_HANDLE_VALUE),
+	stop_event(NULL),
+	thread(NULL),
+	notify_buffer(NULL),
+	dir(dir)
+{
+	memset(&overlapped, 0, sizeof(overlapped));
+}
+
+bool ShaderDirectoryIndex::start()
+{
+	dir_handle = CreateFile(dir.c_str(), FILE_LIST_DIRECTORY,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+			OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (dir_handle == INVALID_HANDLE_VALUE) {
+		LogInfo("Shader index: Unable to open %S: %u\n", dir.c_str(), GetLastError());
+		return false;
+	}
+
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	notify_buffer = new DWORD[SHADER_INDEX_NOTIFY_BUFFER / sizeof(DWORD)];
+	if (!overlapped.hEvent || !stop_event)
+		return false;
+
+	thread = CreateThread(NULL, 0, watcher_main, this, 0, NULL);
+	return !!thread;
+}
+
+ShaderDirectoryIndex::~ShaderDirectoryIndex()
+{
+	if (thread) {
+		SetEvent(stop_event);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+	if (stop_event)
+		CloseHandle(stop_event);
+	if (overlapped.hEvent)
+		CloseHandle(overlapped.hEvent);
+	if (dir_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(dir_handle);
+	delete [] notify_buffer;
+}
+
+// Lists the whole directory into a new table, which is swapped in once it
+// is complete so lookups never see a half built index. Large fetch and
+// basic info (no 8.3 names) makes this a handful of syscalls for thousands
+// of files on NTFS. If the directory cannot be listed the index is left
+// untrusted and false is returned so the watcher can try again.
+bool ShaderDirectoryIndex::scan()
+{
+	ShaderIndexTable new_table;
+	WIN32_FIND_DATA find_data;
+	std::wstring search_path = dir + L"\\*";
+	HANDLE find;
+	LARGE_INTEGER start, end, freq;
+
+	QueryPerformanceCounter(&start);
+
+	find = FindFirstFileEx(search_path.c_str(), FindExInfoBasic, &find_data,
+			FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (find == INVALID_HANDLE_VALUE) {
+		LogInfo("Shader index: Unable to list %S: %u\n", dir.c_str(), GetLastError());
+		return false;
+	}
+	do {
+		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		new_table.add_file(find_data.cFileName, wcslen(find_data.cFileName),
+				filetime_to_u64(find_data.ftLastWriteTime));
+	} while (FindNextFile(find, &find_data));
+	FindClose(find);
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&freq);
+
+	EnterCriticalSectionPretty(&shader_index_lock);
+	table.swap(new_table);
+	current = true;
+	LogInfo("Shader index: %Iu shaders in %S, indexed in %.1fms\n", table.size(),
+			dir.c_str(), (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart);
+	LeaveCriticalSection(&shader_index_lock);
+	return true;
+}
+
+// Called for a file the watcher was told about, or that we just wrote.
+// Looks at the file itself rather than trusting the notification, since by
+// the time we see a notification the file may already be gone again.
+void ShaderDirectoryIndex::update_file(const wchar_t *name, size_t len)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	ShaderFileVariant variant;
+	uint64_t hash;
+	uint32_t type;
+	std::wstring path;
+
+	if (!parse_shader_file_name(name, len, &hash, &type, &variant))
+		return;
+
+	path = dir + L"\\" + std::wstring(name, len);
+	if (GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes)
+			&& !(attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		EnterCriticalSectionPretty(&shader_index_lock);
+		table.add_file(name, len, filetime_to_u64(attributes.ftLastWriteTime));
+		LeaveCriticalSection(&shader_index_lock);
+	} else {
+		EnterCriticalSectionPretty(&shader_index_lock);
+		table.remove_file(name, len);
+		LeaveCriticalSection(&shader_index_lock);
+	}
+}
+
+void ShaderDirectoryIndex::apply_changes()
+{
+	FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION*)notify_buffer;
+
+	while (true) {
+		// Every action is handled the same way - whatever happened to
+		// the name, the file's current state is what goes in the index:
+		update_file(info->FileName, info->FileNameLength / sizeof(wchar_t));
+
+		if (!info->NextEntryOffset)
+			break;
+		info = (FILE_NOTIFY_INFORMATION*)((char*)info + info->NextEntryOffset);
+	}
+}
+
+DWORD WINAPI ShaderDirectoryIndex::watcher_main(LPVOID param)
+{
+	ShaderDirectoryIndex *index = (ShaderDirectoryIndex*)param;
+	HANDLE handles[] = { index->overlapped.hEvent, index->stop_event };
+	bool rescan = true;
+	DWORD bytes;
+
+	while (true) {
+		// The watch is always armed before listing the directory, so
+		// that nothing created while the listing is in progress can be
+		// missed - at worst it is indexed twice:
+		ResetEvent(index->overlapped.hEvent);
+		if (!ReadDirectoryChangesW(index->dir_handle, index->notify_buffer,
+				SHADER_INDEX_NOTIFY_BUFFER, FALSE,
+				FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+				NULL, &index->overlapped, NULL)) {
+			LogInfo("Shader index: Unable to watch %S for changes: %u\n",
+					index->dir.c_str(), GetLastError());
+			EnterCriticalSectionPretty(&shader_index_lock);
+			index->current = false;
+			LeaveCriticalSection(&shader_index_lock);
+			return 0;
+		}
+
+		// A failed listing is retried after the next change:
+		if (rescan)
+			rescan = !index->scan();
+
+		if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+			CancelIo(index->dir_handle);
+			GetOverlappedResult(index->dir_handle, &index->overlapped, &bytes, TRUE);
+			return 0;
+		}
+
+		if (!GetOverlappedResult(index->dir_handle, &index->overlapped, &bytes, FALSE) || !bytes) {
+			// More changes than fit in the buffer. Stop trusting the
+			// index until we have listed the directory again:
+			LogInfo("Shader index: Lost track of changes in %S, rescanning\n", index->dir.c_str());
+			EnterCriticalSectionPretty(&shader_index_lock);
+			index->current = false;
+			LeaveCriticalSection(&shader_index_lock);
+			rescan = true;
+			continue;
+		}
+
+		index->apply_changes();
+	}
+}
+
+bool ShaderDirectoryIndex::may_exist(UINT64 hash, uint32_t type, ShaderFileVariant variant)
+{
+	const ShaderIndexEntry *entry;
+
+	if (!current)
+		return true;
+
+	entry = table.lookup(hash, type);
+	return entry && entry->has(variant);
+}
+
+bool ShaderDirectoryIndex::unchanged(UINT64 hash, uint32_t type, ShaderFileVariant variant, uint64_t timestamp)
+{
+	const ShaderIndexEntry *entry;
+
+	if (!current)
+		return false;
+
+	entry = table.lookup(hash, type);
+	return entry && entry->has(variant) && entry->timestamps[(int)variant] == timestamp;
+}
+
+void ShaderDirectoryIndex::add_file(const wchar_t *name, size_t len, uint64_t timestamp)
+{
+	table.add_file(name, len, timestamp);
+}
+
+// Must be called with shader_index_lock held
+static ShaderDirectoryIndex* find_shader_index(const wchar_t *dir, size_t len)
+{
+	for (ShaderDirectoryIndex *index : shader_indexes) {
+		if (index && index->dir.size() == len && !_wcsnicmp(index->dir.c_str(), dir, len))
+			return index;
+	}
+
+	return NULL;
+}
+
+void UpdateShaderIndexes(const wchar_t *shader_path, const wchar_t *cache_path)
+{
+	static bool lock_initialised = false;
+	const wchar_t *dirs[2] = { shader_path, cache_path };
+	ShaderDirectoryIndex *old_indexes[2] = {};
+	ShaderDirectoryIndex *index;
+	bool wanted[2];
+	int i;
+
+	// First call is from LoadConfigFile() during startup, before anything
+	// could be creating shaders on another thread:
+	if (!lock_initialised) {
+		InitializeCriticalSectionPretty(&shader_index_lock);
+		lock_initialised = true;
+	}
+
+	wanted[0] = !!dirs[0][0];
+	wanted[1] = dirs[1][0] && _wcsicmp(dirs[0], dirs[1]);
+
+	EnterCriticalSectionPretty(&shader_index_lock);
+	for (i = 0; i < 2; i++) {
+		if (shader_indexes[i] && (!wanted[i] || _wcsicmp(shader_indexes[i]->dir.c_str(), dirs[i]))) {
+			old_indexes[i] = shader_indexes[i];
+			shader_indexes[i] = NULL;
+		}
+	}
+	LeaveCriticalSection(&shader_index_lock);
+
+	// Not holding the lock, since the watcher may need it to finish up:
+	for (i = 0; i < 2; i++)
+		delete old_indexes[i];
+
+	for (i = 0; i < 2; i++) {
+		if (!wanted[i] || shader_indexes[i])
+			continue;
+
+		index = new ShaderDirectoryIndex(dirs[i]);
+		if (!index->start()) {
+			LogInfo("Shader index: Not indexing %S, shader files will be looked up individually\n", dirs[i]);
+			delete index;
+			continue;
+		}
+
+		EnterCriticalSectionPretty(&shader_index_lock);
+		shader_indexes[i] = index;
+		LeaveCriticalSection(&shader_index_lock);
+	}
+}
+
+bool ShaderFileMayExist(const wchar_t *dir, UINT64 hash, const wchar_t *shader_type,
+		ShaderFileVariant variant)
+{
+	ShaderDirectoryIndex *index;
+	uint32_t type;
+	bool ret = true;
+
+	type = shader_index_type(shader_type, wcslen(shader_type));
+	if (!type)
+		return true;
+
+	EnterCriticalSectionPretty(&shader_index_lock);
+	index = find_shader_index(dir, wcslen(dir));
+	if (index)
+		ret = index->may_exist(hash, type, variant);
+	LeaveCriticalSection(&shader_index_lock);
+
+	return ret;
+}
+
+bool ShaderIndexFileUnchanged(const wchar_t *path, const FILETIME *timestamp)
+{
+	ShaderDirectoryIndex *index;
+	ShaderFileVariant variant;
+	const wchar_t *name;
+	uint64_t hash;
+	uint32_t type;
+	bool ret = false;
+
+	name = wcsrchr(path, L'\\');
+	if (!name)
+		return false;
+	name++;
+
+	if (!parse_shader_file_name(name, wcslen(name), &hash, &type, &variant))
+		return false;
+
+	EnterCriticalSectionPretty(&shader_index_lock);
+	index = find_shader_index(path, name - path - 1);
+	if (index)
+		ret = index->unchanged(hash, type, variant, filetime_to_u64(*timestamp));
+	LeaveCriticalSection(&shader_index_lock);
+
+	return ret;
+}
+
+void ShaderIndexFileWritten(const wchar_t *path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	ShaderDirectoryIndex *index;
+	const wchar_t *name;
+
+	name = wcsrchr(path, L'\\');
+	if (!name)
+		return;
+	name++;
+
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attributes))
+		return;
+
+	EnterCriticalSectionPretty(&shader_index_lock);
+	index = find_shader_index(path, name - path - 1);
+	if (index)
+		index->add_file(name, wcslen(name), filetime_to_u64(attributes.ftLastWriteTime));
+	LeaveCriticalSection(&shader_index_lock);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <windows.h>
+
+#include "ShaderIndex.h"
+
+// Keeps a ShaderIndexTable for each of ShaderFixes and ShaderCache, built
+// from one directory listing on a background thread and then kept current
+// with ReadDirectoryChangesW, so that shader creation can rule out file
+// names with a hash table lookup instead of a CreateFile/GetFileAttributes
+// for each of them.
+//
+// Until the first listing is complete, after the change notifications
+// overflow, or if the directory cannot be watched at all (e.g. some network
+// shares), the index is not trusted and every lookup says the file may
+// exist, so callers go on to probe the filesystem exactly as they used to.
+
+// Called from LoadConfigFile() on startup and every config reload. Keeps
+// the existing indexes if the directories have not changed.
+void UpdateShaderIndexes(const wchar_t *shader_path, const wchar_t *cache_path);
+
+// Returns false only if the directory is indexed and the index is certain
+// that the file does not exist.
+bool ShaderFileMayExist(const wchar_t *dir, UINT64 hash, const wchar_t *shader_type,
+		ShaderFileVariant variant);
+
+// Returns true only if the directory is indexed and the index has the file
+// with this last write time, so that a reload can tell it has not been
+// edited since it was loaded without opening it.
+bool ShaderIndexFileUnchanged(const wchar_t *path, const FILETIME *timestamp);
+
+// Adds a file 3DMigoto just wrote to the index straight away, rather than
+// waiting for the change notification to arrive, in case the game creates
+// the same shader again in the meantime.
+void ShaderIndexFileWritten(const wchar_t *path);
@@ -0,0 +1,208 @@
+#include "ShaderIndex.h"
+
+#include <utility>
+
+// Index starts with room for this many shaders and doubles when it is more
+// than half full. Most fixes ship a few hundred shaders, ShaderCache for a
+// game that has been dumped can have tens of thousands.
+#define SHADER_INDEX_MIN_SLOTS 256
+
+static const struct {
+	const wchar_t *suffix;
+	size_t len;
+	ShaderFileVariant variant;
+} shader_file_suffixes[] = {
+	{ L"_replace.txt", 12, ShaderFileVariant::REPLACE_TXT },
+	{ L"_replace.bin", 12, ShaderFileVariant::REPLACE_BIN },
+	{ L".txt",          4, ShaderFileVariant::ASM_TXT },
+	{ L".bin",          4, ShaderFileVariant::ASM_BIN },
+	{ L"_bad.txt",      8, ShaderFileVariant::BAD_TXT },
+};
+
+static wchar_t ascii_lower(wchar_t c)
+{
+	if (c >= L'A' && c <= L'Z')
+		return c - L'A' + L'a';
+	return c;
+}
+
+uint32_t shader_index_type(const wchar_t *type, size_t len)
+{
+	wchar_t c0, c1;
+
+	if (len != 2)
+		return 0;
+
+	c0 = ascii_lower(type[0]);
+	c1 = ascii_lower(type[1]);
+	if (c0 < L'a' || c0 > L'z' || c1 < L'a' || c1 > L'z')
+		return 0;
+
+	return (uint32_t)c0 | ((uint32_t)c1 << 8);
+}
+
+bool parse_shader_file_name(const wchar_t *name, size_t len,
+		uint64_t *hash, uint32_t *type, ShaderFileVariant *variant)
+{
+	const wchar_t *suffix;
+	size_t suffix_len, i, j;
+	uint64_t h = 0;
+	wchar_t c;
+
+	// 16 hex digits, a dash and a two letter type, then the suffix
+	if (len < 19 || name[16] != L'-')
+		return false;
+
+	for (i = 0; i < 16; i++) {
+		c = ascii_lower(name[i]);
+		if (c >= L'0' && c <= L'9')
+			h = (h << 4) | (c - L'0');
+		else if (c >= L'a' && c <= L'f')
+			h = (h << 4) | (c - L'a' + 10);
+		else
+			return false;
+	}
+
+	*type = shader_index_type(name + 17, 2);
+	if (!*type)
+		return false;
+
+	suffix = name + 19;
+	suffix_len = len - 19;
+	for (auto &s : shader_file_suffixes) {
+		if (suffix_len != s.len)
+			continue;
+		for (j = 0; j < suffix_len; j++) {
+			if (ascii_lower(suffix[j]) != s.suffix[j])
+				break;
+		}
+		if (j == suffix_len) {
+			*hash = h;
+			*variant = s.variant;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+ShaderIndexTable::ShaderIndexTable() :
+	used(0)
+{
+}
+
+void ShaderIndexTable::clear()
+{
+	slots.clear();
+	used = 0;
+}
+
+void ShaderIndexTable::swap(ShaderIndexTable &other)
+{
+	slots.swap(other.slots);
+	std::swap(used, other.used);
+}
+
+// Shader hashes are already well distributed, but mix them anyway since
+// some games reuse the low bits of otherwise similar shaders:
+size_t ShaderIndexTable::slot_for(uint64_t hash, uint32_t type) const
+{
+	uint64_t h = (hash ^ type) * 0x9e3779b97f4a7c15ULL;
+
+	return (size_t)(h >> 32) & (slots.size() - 1);
+}
+
+void ShaderIndexTable::grow()
+{
+	std::vector<ShaderIndexEntry> old;
+	size_t i;
+
+	old.swap(slots);
+	slots.resize(old.empty() ? SHADER_INDEX_MIN_SLOTS : old.size() * 2);
+
+	for (ShaderIndexEntry &entry : old) {
+		if (!entry.type)
+			continue;
+		for (i = slot_for(entry.hash, entry.type); slots[i].type; i = (i + 1) & (slots.size() - 1));
+		slots[i] = entry;
+	}
+}
+
+ShaderIndexEntry* ShaderIndexTable::insert(uint64_t hash, uint32_t type)
+{
+	size_t i;
+
+	if ((used + 1) * 2 > slots.size())
+		grow();
+
+	for (i = slot_for(hash, type); slots[i].type; i = (i + 1) & (slots.size() - 1)) {
+		if (slots[i].hash == hash && slots[i].type == type)
+			return &slots[i];
+	}
+
+	slots[i].hash = hash;
+	slots[i].type = type;
+	used++;
+	return &slots[i];
+}
+
+const ShaderIndexEntry* ShaderIndexTable::lookup(uint64_t hash, uint32_t type) const
+{
+	size_t i;
+
+	if (slots.empty())
+		return NULL;
+
+	for (i = slot_for(hash, type); slots[i].type; i = (i + 1) & (slots.size() - 1)) {
+		if (slots[i].hash == hash && slots[i].type == type)
+			return &slots[i];
+	}
+
+	return NULL;
+}
+
+bool ShaderIndexTable::add_file(const wchar_t *name, size_t len, uint64_t timestamp)
+{
+	ShaderFileVariant variant;
+	ShaderIndexEntry *entry;
+	uint64_t hash;
+	uint32_t type;
+
+	if (!parse_shader_file_name(name, len, &hash, &type, &variant))
+		return false;
+
+	entry = insert(hash, type);
+	entry->variants |= 1u << (int)variant;
+	entry->timestamps[(int)variant] = timestamp;
+	return true;
+}
+
+bool ShaderIndexTable::remove_file(const wchar_t *name, size_t len)
+{
+	ShaderFileVariant variant;
+	ShaderIndexEntry *entry;
+	uint64_t hash;
+	uint32_t type;
+
+	if (!parse_shader_file_name(name, len, &hash, &type, &variant))
+		return false;
+
+	entry = const_cast<ShaderIndexEntry*>(lookup(hash, type));
+	if (entry) {
+		entry->variants &= ~(1u << (int)variant);
+		entry->timestamps[(int)variant] = 0;
+	}
+	return true;
+}
+
+size_t ShaderIndexTable::size() const
+{
+	size_t count = 0;
+
+	for (const ShaderIndexEntry &entry : slots) {
+		if (entry.variants)
+			count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// In memory index of the shader files in a ShaderFixes or ShaderCache
+// directory, keyed by shader hash and type, so that creating a shader does
+// not have to probe the filesystem for every file name it might be using.
+// This is only the table - ShaderDirectoryIndex.cpp fills it in from the
+// directory listing and keeps it up to date as files come and go. It
+// depends on nothing from Windows so that TestShaderIndex can check it.
+
+// Every file name that shader creation looks for, e.g. for a vertex shader
+// with hash 0123456789abcdef:
+enum class ShaderFileVariant {
+	REPLACE_TXT, // 0123456789abcdef-vs_replace.txt (HLSL)
+	REPLACE_BIN, // 0123456789abcdef-vs_replace.bin (compiled HLSL)
+	ASM_TXT,     // 0123456789abcdef-vs.txt         (assembly)
+	ASM_BIN,     // 0123456789abcdef-vs.bin         (assembled or original binary)
+	BAD_TXT,     // 0123456789abcdef-vs_bad.txt     (decompiler skip marker)
+
+	COUNT
+};
+
+struct ShaderIndexEntry {
+	uint64_t hash;
+	uint32_t type;     // Packed by shader_index_type(), 0 if the slot is empty
+	uint32_t variants; // Bitmask of (1 << ShaderFileVariant) that exist
+
+	// Last write time of each variant that exists, in FILETIME units
+	uint64_t timestamps[(int)ShaderFileVariant::COUNT];
+
+	bool has(ShaderFileVariant variant) const
+	{
+		return !!(variants & (1u << (int)variant));
+	}
+};
+
+// Packs a two letter shader type such as L"vs" into the key used by the
+// index, case insensitively as the filesystem would match it. Returns 0 if
+// it is not a shader type that could appear in a file name.
+uint32_t shader_index_type(const wchar_t *type, size_t len);
+
+// Splits a file name (no directory) into the shader it belongs to and which
+// variant it is. Hex digits and extensions are matched case insensitively.
+// Returns false for anything else, such as the numbered duplicates that
+// export_binary writes to ShaderCache, or the .bak files left by uninstalls.
+bool parse_shader_file_name(const wchar_t *name, size_t len,
+		uint64_t *hash, uint32_t *type, ShaderFileVariant *variant);
+
+// Open addressed hash table with linear probing, kept in one flat array.
+// Entries are never removed - a shader whose files are all deleted just has
+// no variants left - so lookups never need tombstones.
+class ShaderIndexTable {
+	std::vector<ShaderIndexEntry> slots;
+	size_t used;
+
+	size_t slot_for(uint64_t hash, uint32_t type) const;
+	ShaderIndexEntry* insert(uint64_t hash, uint32_t type);
+	void grow();
+
+public:
+	ShaderIndexTable();
+
+	void clear();
+	void swap(ShaderIndexTable &other);
+
+	// Records a file from a directory listing or change notification.
+	// Returns false and does nothing if it is not a shader file name.
+	bool add_file(const wchar_t *name, size_t len, uint64_t timestamp);
+	bool remove_file(const wchar_t *name, size_t len);
+
+	// Returns NULL if no file has ever been seen for this shader
+	const ShaderIndexEntry* lookup(uint64_t hash, uint32_t type) const;
+
+	// Number of shaders with at least one file in the index
+	size_t size() const;
+};
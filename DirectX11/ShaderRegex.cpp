@@ -1,7 +1,10 @@
 #include "ShaderRegex.h"
+#include "ShaderRegexPrefilter.h"
+#include "ShaderIndex.h"
 #include "CommandList.h"
 #include "globals.h" // For ShaderOverride FIXME: This should be in a separate header
 #include "log.h"
+#include "profiling.h"
 
 #include <algorithm>
 #include <iterator>
@@ -10,6 +13,8 @@ ShaderRegexGroups shader_regex_groups;
 std::vector<ShaderRegexGroup*> shader_regex_group_index;
 uint32_t shader_regex_hash;
 
+static ShaderRegexPrefilter shader_regex_prefilter;
+
 static void log_pcre2_error_nonl(int err, char *fmt, ...)
 {
 	PCRE2_UCHAR buf[120]; // doco says "120 code units is ample"
@@ -175,6 +180,14 @@ bool ShaderRegexPattern::compile(std::string *pattern)
 	for (i = 0; i < name_table_count; i++)
 		named_capture_groups.insert(std::string((char*)(name_table + name_table_entry_size*i + 2)));
 
+	// If the literals can't be worked out this is left empty and the
+	// prefilter will just pass every shader through to pcre2:
+	if (shader_regex_required_literals(*pattern, &required_literals)) {
+		for (std::string &literal : required_literals)
+			LogInfo("  Prefilter literal: \"%s\"\n", literal.c_str());
+	} else
+		LogInfo("  Unable to prefilter this pattern\n");
+
 	return true;
 }
 
@@ -466,61 +479,58 @@ bool unlink_shader_regex_command_lists_and_filter_index(UINT64 shader_hash)
 	return ret;
 }
 
-#define SHADER_REGEX_CACHE_VERSION 1
-struct ShaderRegexCacheHeader {
-	uint32_t version;
-	uint32_t shader_regex_hash;
-	uint32_t patched;
-	uint32_t num_matches;
-};
+static ShaderCacheKey shader_regex_cache_key(UINT64 hash, const wchar_t *shader_type)
+{
+	ShaderCacheKey key;
+
+	key.hash = hash;
+	key.type = shader_index_type(shader_type, wcslen(shader_type));
+	key.kind = ShaderCacheKind::REGEX;
+	return key;
+}
 
 ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode, std::wstring *tagline)
 {
-	ShaderRegexCache ret = ShaderRegexCache::NO_CACHE;
-	HANDLE meta_f = INVALID_HANDLE_VALUE;
-	HANDLE bin_f = INVALID_HANDLE_VALUE;
+	ShaderCacheKey key = shader_regex_cache_key(hash, shader_type);
 	ShaderRegexCacheHeader *header;
 	ShaderRegexGroup *group;
-	wchar_t path[MAX_PATH];
+	vector<uint8_t> data;
 	uint32_t *match_ids;
-	DWORD size, size2;
-	byte *buf = NULL;
-	size_t suffix;
-	uint32_t i;
+	uint32_t tag, i;
+	size_t meta_size;
 
-	suffix = swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_regex.", G->SHADER_CACHE_PATH, hash, shader_type);
-	wcscpy_s(path+suffix, MAX_PATH-suffix, L"dat");
-	meta_f = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (meta_f == INVALID_HANDLE_VALUE)
-		return ret;
+	if (!G->shader_cache_pack.lookup(key, &tag, &data))
+		return ShaderRegexCache::NO_CACHE;
 
-	size = GetFileSize(meta_f, 0);
-	if (size < sizeof(ShaderRegexCacheHeader))
-		goto out;
+	if (tag != shader_regex_hash || data.size() < sizeof(ShaderRegexCacheHeader))
+		return ShaderRegexCache::NO_CACHE;
 
-	buf = new byte[size];
-
-	if (!ReadFile(meta_f, buf, size, &size2, NULL) || size != size2)
-		goto out;
-
-	header = (ShaderRegexCacheHeader*)buf;
-	match_ids = (uint32_t*)(buf + sizeof(ShaderRegexCacheHeader));
+	header = (ShaderRegexCacheHeader*)data.data();
+	match_ids = (uint32_t*)(data.data() + sizeof(ShaderRegexCacheHeader));
 
 	if (header->version != SHADER_REGEX_CACHE_VERSION
 	 || header->shader_regex_hash != shader_regex_hash)
-		goto out;
+		return ShaderRegexCache::NO_CACHE;
 
-	if (size != sizeof(ShaderRegexCacheHeader) + header->num_matches * sizeof(uint32_t))
-		goto out;
+	// The patched bytecode follows the match ids, and is only missing if
+	// assembling it failed after the matches were cached:
+	meta_size = sizeof(ShaderRegexCacheHeader) + header->num_matches * sizeof(uint32_t);
+	if (data.size() < meta_size || (data.size() > meta_size) != !!header->patched)
+		return ShaderRegexCache::NO_CACHE;
 
 	// num_matches may be 0, which means the ShaderRegex didn't match the
 	// shader, but we cache it anyway to skip processing the shader again.
 	// We don't really need any special handling for this case, since
 	// returning MATCH will already skip that handling in the caller, but
 	// we return a special value so the caller can log it appropriately.
-	if (header->num_matches == 0) {
-		ret = ShaderRegexCache::NO_MATCH;
-		goto out;
+	if (header->num_matches == 0)
+		return ShaderRegexCache::NO_MATCH;
+
+	// Check every id before linking any of them, so a bad record can't
+	// leave the shader half linked:
+	for (i = 0; i < header->num_matches; i++) {
+		if (match_ids[i] >= shader_regex_group_index.size())
+			return ShaderRegexCache::NO_CACHE;
 	}
 
 	for (i = 0; i < header->num_matches; i++) {
@@ -528,8 +538,6 @@ ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type
 		// already matched the map should be identical to when the
 		// cache was made, so we can use that to find the matching
 		// groups without having to do an expensive lookup by name:
-		if (match_ids[i] >= shader_regex_group_index.size())
-			goto out;
 		group = shader_regex_group_index[match_ids[i]];
 
 		LogInfo("ShaderRegexCache: %S %016I64x matches [%S]\n", shader_type, hash, group->ini_section.c_str());
@@ -541,72 +549,48 @@ ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type
 	}
 
 	if (header->patched) {
-		wcscpy_s(path+suffix, MAX_PATH-suffix, L"bin");
-		bin_f = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-		if (bin_f == INVALID_HANDLE_VALUE)
-			goto out;
-		size = GetFileSize(bin_f, 0);
-		bytecode->resize(size);
-		if (!size || !ReadFile(bin_f, bytecode->data(), size, &size2, NULL) || size != size2)
-			goto out;
-		ret = ShaderRegexCache::PATCH;
-	} else
-		ret = ShaderRegexCache::MATCH;
-
-out:
-	if (buf)
-		delete [] buf;
-	if (bin_f != INVALID_HANDLE_VALUE)
-		CloseHandle(bin_f);
-	if (meta_f != INVALID_HANDLE_VALUE)
-		CloseHandle(meta_f);
-	return ret;
+		bytecode->assign(data.begin() + meta_size, data.end());
+		return ShaderRegexCache::PATCH;
+	}
+	return ShaderRegexCache::MATCH;
 }
 
 static void save_shader_regex_cache_meta(UINT64 hash, const wchar_t *shader_type, vector<uint32_t> *match_ids,
 		bool patched, std::string *asm_text, std::wstring *tagline)
 {
+	ShaderCacheKey key = shader_regex_cache_key(hash, shader_type);
 	ShaderRegexCacheHeader header;
 	wchar_t path[MAX_PATH];
+	vector<uint8_t> meta;
 	FILE *f = NULL;
-	size_t suffix;
 
 	if (!G->SHADER_CACHE_PATH[0] || (!G->CACHE_SHADERS && !G->EXPORT_FIXED))
 		return;
 
-	suffix = swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_regex.", G->SHADER_CACHE_PATH, hash, shader_type);
-
 	if (G->CACHE_SHADERS) {
 		// TODO: When we have a condition field in ShaderRegex: The evaluations
 		// of *all* valid conditions (not just those matched) must qualify the
-		// cache, either by encoding them in the filename or extending the
+		// cache, either by encoding them in the key or extending the
 		// metadata format.
 
-		// Make sure there isn't an old stale .bin file *before* writing the
-		// new metadata to make sure it can't be loaded by mistake. If we can't
-		// remove it (e.g. another thread is currently reading it or permission
-		// issues) it's better not to update the cache at all:
-		wcscpy_s(path+suffix, MAX_PATH-suffix, L"bin");
-		if (!DeleteFile(path) && GetLastError() != ERROR_FILE_NOT_FOUND)
-			return;
-
-		wcscpy_s(path+suffix, MAX_PATH-suffix, L"dat");
-		wfopen_ensuring_access(&f, path, L"wb");
-		if (!f)
-			return;
-
+		// This replaces any earlier record for the shader, patched
+		// bytecode and all, so there is no stale .bin to remove first
+		// like there was when these were separate files. If the shader
+		// was patched, save_shader_regex_cache_bin will replace it
+		// again with the bytecode appended:
 		header.version = SHADER_REGEX_CACHE_VERSION;
 		header.shader_regex_hash = shader_regex_hash;
 		header.patched = patched;
 		header.num_matches = (uint32_t)match_ids->size();
-		fwrite(&header, 1, sizeof(ShaderRegexCacheHeader), f);
-		fwrite(match_ids->data(), sizeof(uint32_t), match_ids->size(), f);
-
-		fclose(f);
+		meta.resize(sizeof(ShaderRegexCacheHeader) + match_ids->size() * sizeof(uint32_t));
+		memcpy(meta.data(), &header, sizeof(ShaderRegexCacheHeader));
+		if (!match_ids->empty())
+			memcpy(meta.data() + sizeof(ShaderRegexCacheHeader), match_ids->data(), match_ids->size() * sizeof(uint32_t));
+		G->shader_cache_pack.store(key, shader_regex_hash, meta.data(), meta.size());
 	}
 
 	if (G->EXPORT_FIXED) {
-		wcscpy_s(path+suffix, MAX_PATH-suffix, L"txt");
+		swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_regex.txt", G->SHADER_CACHE_PATH, hash, shader_type);
 		if (patched) {
 			wfopen_ensuring_access(&f, path, L"wb");
 			if (!f) {
@@ -628,19 +612,78 @@ static void save_shader_regex_cache_meta(UINT64 hash, const wchar_t *shader_type
 
 void save_shader_regex_cache_bin(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode)
 {
-	wchar_t path[MAX_PATH];
-	FILE *f = NULL;
+	ShaderCacheKey key = shader_regex_cache_key(hash, shader_type);
+	ShaderRegexCacheHeader *header;
+	vector<uint8_t> data;
+	uint32_t tag;
 
-	if (!G->CACHE_SHADERS || !G->SHADER_CACHE_PATH[0])
+	if (!G->CACHE_SHADERS)
 		return;
 
-	swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_regex.bin", G->SHADER_CACHE_PATH, hash, shader_type);
-
-	wfopen_ensuring_access(&f, path, L"wb");
-	if (!f)
+	// Appended to the matches that save_shader_regex_cache_meta stored
+	// when the patch was applied:
+	if (!G->shader_cache_pack.lookup(key, &tag, &data) || tag != shader_regex_hash
+			|| data.size() < sizeof(ShaderRegexCacheHeader))
+		return;
+	header = (ShaderRegexCacheHeader*)data.data();
+	if (data.size() != sizeof(ShaderRegexCacheHeader) + header->num_matches * sizeof(uint32_t)
+			|| !header->patched)
 		return;
-	fwrite(bytecode->data(), 1, bytecode->size(), f);
-	fclose(f);
+
+	data.insert(data.end(), bytecode->begin(), bytecode->end());
+	G->shader_cache_pack.store(key, tag, data.data(), data.size());
+}
+
+// Called after parsing the ShaderRegex sections to gather the literals of
+// every pattern into a single automaton, so that each shader only has to be
+// scanned once to find out which groups could possibly match it.
+void build_shader_regex_prefilter()
+{
+	ShaderRegexGroups::iterator i;
+	ShaderRegexPatterns::iterator j;
+	ShaderRegexGroup *group;
+
+	shader_regex_prefilter.clear();
+
+	for (i = shader_regex_groups.begin(); i != shader_regex_groups.end(); i++) {
+		group = &i->second;
+		group->prefilter_literals.clear();
+		group->has_replace = false;
+
+		// Patterns after a replace are matched against the already
+		// patched assembly, which may contain literals that the
+		// shader did not, so only the patterns up to and including
+		// the first replace can be checked in advance:
+		for (j = group->patterns.begin(); j != group->patterns.end(); j++) {
+			if (!group->has_replace) {
+				for (std::string &literal : j->second.required_literals)
+					group->prefilter_literals.push_back(shader_regex_prefilter.add_literal(literal));
+			}
+			group->has_replace = group->has_replace || j->second.do_replace;
+		}
+	}
+
+	shader_regex_prefilter.build();
+	LogInfo("ShaderRegex prefilter: %Iu literals\n", shader_regex_prefilter.size());
+}
+
+static bool prefilter_shader_regex_group(ShaderRegexGroup *group, std::string *asm_text,
+		vector<uint8_t> *found, bool *rescan)
+{
+	if (group->prefilter_literals.empty())
+		return true;
+
+	if (*rescan) {
+		shader_regex_prefilter.scan(asm_text->c_str(), asm_text->length(), found);
+		*rescan = false;
+	}
+
+	for (uint32_t id : group->prefilter_literals) {
+		if (!(*found)[id])
+			return false;
+	}
+
+	return true;
 }
 
 bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type, std::string *shader_model, UINT64 hash, std::wstring *tagline)
@@ -650,6 +693,8 @@ bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type
 	bool patched = false;
 	bool match, patch;
 	vector<uint32_t> match_ids;
+	vector<uint8_t> prefilter_found;
+	bool prefilter_rescan = true;
 	uint32_t j;
 
 	if (*shader_model == std::string("bin")) {
@@ -668,7 +713,19 @@ bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type
 		if (!group->shader_models.count(*shader_model))
 			continue;
 
+		if (!prefilter_shader_regex_group(group, asm_text, &prefilter_found, &prefilter_rescan)) {
+			Profiling::shaderregex_groups_prefiltered++;
+			continue;
+		}
+		Profiling::shaderregex_groups_checked++;
+
 		group->apply_regex_patterns(asm_text, &match, &patch);
+
+		// A replace can change the assembly even if a later pattern in
+		// the group then fails to match:
+		if (patch || group->has_replace)
+			prefilter_rescan = true;
+
 		if (!match)
 			continue;
 
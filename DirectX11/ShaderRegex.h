@@ -20,6 +20,7 @@ bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type
 ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode, std::wstring *tagline);
 void save_shader_regex_cache_bin(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode);
 bool unlink_shader_regex_command_lists_and_filter_index(UINT64 shader_hash);
+void build_shader_regex_prefilter();
 
 typedef std::set<std::string> ShaderRegexTemps;
 typedef std::set<std::string> ShaderRegexModels;
@@ -37,6 +38,10 @@ public:
 	// to convert byte offsets to constant buffer indexes and vice versa
 	std::set<std::string> named_capture_groups;
 
+	// Lower case literal strings that the pattern cannot match without,
+	// used to rule out shaders before running the full regex:
+	std::vector<std::string> required_literals;
+
 	ShaderRegexPattern();
 	~ShaderRegexPattern();
 
@@ -62,6 +67,12 @@ public:
 	ShaderRegexTemps temp_regs;
 	float filter_index;
 
+	// Ids in the prefilter of the literals that must all be in the shader
+	// for this group to match, and whether running the group can change
+	// the assembly (and so which literals are in it) for the next group:
+	std::vector<uint32_t> prefilter_literals;
+	bool has_replace;
+
 	CommandList command_list;
 	CommandList post_command_list;
 	std::shared_ptr<RunLinkedCommandList> link;
@@ -71,7 +82,8 @@ public:
 	void link_command_lists_and_filter_index(UINT64 shader_hash);
 
 	ShaderRegexGroup() :
-		filter_index(FLT_MAX)
+		filter_index(FLT_MAX),
+		has_replace(false)
 	{}
 };
 
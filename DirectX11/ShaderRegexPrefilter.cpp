@@ -0,0 +1,558 @@
+#include "ShaderRegexPrefilter.h"
+
+#include <string.h>
+
+#include <deque>
+
+// Result of parsing one sequence of the pattern, i.e. the whole pattern or
+// the body of a group:
+enum class LiteralParse {
+	OK,
+	ALTERNATION, // Contains a | at this level, so no literal is required
+	GIVE_UP,     // Something we don't understand - trust nothing
+};
+
+// What a group contributes to the literals of the sequence it is in:
+enum class LiteralGroup {
+	BODY,    // Capturing, non-capturing, named, atomic, etc - parse the body
+	OPAQUE,  // Lookarounds, comments, option settings, backreferences, etc
+	GIVE_UP,
+};
+
+static char ascii_lower(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+	return c;
+}
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static bool is_alnum(char c)
+{
+	return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Comments are skipped entirely by PCRE2, so a quantifier after one applies
+// to whatever came before it:
+static size_t skip_comments(const std::string &pattern, size_t pos, size_t end)
+{
+	size_t i;
+
+	while (!pattern.compare(pos, 3, "(?#")) {
+		i = pattern.find(')', pos);
+		if (i >= end)
+			break;
+		pos = i + 1;
+	}
+
+	return pos;
+}
+
+// Skips over a quantifier at pos, along with any lazy or possessive suffix,
+// and returns the minimum number of times the preceding item must match.
+// Returns 1 and leaves pos alone if there is no quantifier. A { that does not
+// start a valid quantifier is a literal in PCRE2, so it is left alone too.
+static unsigned skip_quantifier(const std::string &pattern, size_t *pos, size_t end, bool *quantified)
+{
+	unsigned min = 1;
+	size_t i = skip_comments(pattern, *pos, end);
+
+	*quantified = false;
+	if (i >= end)
+		return 1;
+
+	switch (pattern[i]) {
+		case '?':
+		case '*':
+			min = 0;
+			i++;
+			break;
+		case '+':
+			i++;
+			break;
+		case '{':
+			if (++i >= end || !is_digit(pattern[i]))
+				return 1;
+			for (min = 0; i < end && is_digit(pattern[i]); i++)
+				min = min < 100000 ? min * 10 + (pattern[i] - '0') : min;
+			if (i < end && pattern[i] == ',') {
+				for (i++; i < end && is_digit(pattern[i]); i++);
+			}
+			if (i >= end || pattern[i] != '}')
+				return 1;
+			i++;
+			break;
+		default:
+			return 1;
+	}
+
+	i = skip_comments(pattern, i, end);
+	if (i < end && (pattern[i] == '?' || pattern[i] == '+'))
+		i++;
+
+	*quantified = true;
+	*pos = i;
+	return min;
+}
+
+// Returns the position just past the ] that closes the character class
+// starting at pos, or npos if we can't tell where that is. POSIX classes
+// such as [:alpha:] are recognised the same way PCRE2 does it.
+static size_t skip_class(const std::string &pattern, size_t pos, size_t end)
+{
+	size_t i = pos + 1, j;
+	char terminator;
+
+	if (i < end && pattern[i] == '^')
+		i++;
+	if (i < end && pattern[i] == ']')
+		i++;
+
+	while (i < end) {
+		switch (pattern[i]) {
+			case ']':
+				return i + 1;
+			case '\\':
+				if (i + 1 >= end || pattern[i + 1] == 'Q' || pattern[i + 1] == 'E')
+					return std::string::npos;
+				i += 2;
+				continue;
+			case '[':
+				if (i + 1 >= end || !strchr(":.=", pattern[i + 1]))
+					break;
+				terminator = pattern[i + 1];
+				for (j = i + 2; j + 1 < end; j++) {
+					if (pattern[j] == '\\' && (pattern[j + 1] == ']' || pattern[j + 1] == '\\'))
+						j++;
+					else if ((pattern[j] == '[' && pattern[j + 1] == terminator) || pattern[j] == ']')
+						break;
+					else if (pattern[j] == terminator && pattern[j + 1] == ']') {
+						i = j + 2;
+						goto next;
+					}
+				}
+				break;
+		}
+		i++;
+next:;
+	}
+
+	return std::string::npos;
+}
+
+// Returns the position of the ) that closes the group starting at pos, or
+// npos if it is unbalanced or uses \Q...\E quoting, which we don't follow.
+static size_t find_group_end(const std::string &pattern, size_t pos, size_t end)
+{
+	unsigned depth = 0;
+	size_t i = pos;
+
+	while (i < end) {
+		switch (pattern[i]) {
+			case '\\':
+				if (i + 1 >= end || pattern[i + 1] == 'Q' || pattern[i + 1] == 'E')
+					return std::string::npos;
+				i += 2;
+				continue;
+			case '[':
+				i = skip_class(pattern, i, end);
+				if (i == std::string::npos)
+					return i;
+				continue;
+			case '(':
+				// Comments end at the first ) regardless of anything else
+				if (!pattern.compare(i, 3, "(?#")) {
+					i = pattern.find(')', i);
+					if (i >= end)
+						return std::string::npos;
+					if (!depth)
+						return i;
+					break;
+				}
+				depth++;
+				break;
+			case ')':
+				if (!--depth)
+					return i;
+				break;
+		}
+		i++;
+	}
+
+	return std::string::npos;
+}
+
+// Works out what kind of group starts at pos and where its body begins:
+static LiteralGroup classify_group(const std::string &pattern, size_t pos, size_t group_end, size_t *body)
+{
+	size_t i = pos + 1;
+	bool has_options = false;
+
+	if (i >= group_end)
+		return LiteralGroup::OPAQUE;
+	if (pattern[i] == '*')
+		return LiteralGroup::GIVE_UP; // Verbs such as (*UTF) or (*FAIL)
+	if (pattern[i] != '?') {
+		*body = i;
+		return LiteralGroup::BODY;
+	}
+
+	if (++i >= group_end)
+		return LiteralGroup::GIVE_UP;
+
+	switch (pattern[i]) {
+		case ':':
+		case '>':
+		case '|':
+			*body = i + 1;
+			return LiteralGroup::BODY;
+		case '=':
+		case '!':
+		case '#':
+		case '(':
+		case '&':
+		case 'R':
+		case 'C':
+		case '+':
+			return LiteralGroup::OPAQUE;
+		case '<':
+			if (i + 1 < group_end && (pattern[i + 1] == '=' || pattern[i + 1] == '!'))
+				return LiteralGroup::OPAQUE;
+			*body = pattern.find('>', i);
+			if (*body >= group_end)
+				return LiteralGroup::GIVE_UP;
+			(*body)++;
+			return LiteralGroup::BODY;
+		case '\'':
+			*body = pattern.find('\'', i + 1);
+			if (*body >= group_end)
+				return LiteralGroup::GIVE_UP;
+			(*body)++;
+			return LiteralGroup::BODY;
+		case 'P':
+			if (i + 1 < group_end && pattern[i + 1] == '<') {
+				*body = pattern.find('>', i);
+				if (*body >= group_end)
+					return LiteralGroup::GIVE_UP;
+				(*body)++;
+				return LiteralGroup::BODY;
+			}
+			return LiteralGroup::OPAQUE; // (?P=name) and (?P>name)
+	}
+
+	if (is_digit(pattern[i]) || (pattern[i] == '-' && i + 1 < group_end && is_digit(pattern[i + 1])))
+		return LiteralGroup::OPAQUE; // Subroutine calls, e.g. (?1) or (?-1)
+
+	// Anything else should be option settings, e.g. (?i) or (?-i:...).
+	// Extended mode changes the meaning of whitespace and # in the rest of
+	// the pattern, so we don't even try:
+	for (; i < group_end; i++) {
+		if (pattern[i] == ':') {
+			*body = i + 1;
+			return LiteralGroup::BODY;
+		}
+		if (pattern[i] == 'x')
+			return LiteralGroup::GIVE_UP;
+		if (!is_alnum(pattern[i]) && pattern[i] != '-' && pattern[i] != '^')
+			return LiteralGroup::GIVE_UP;
+		has_options = true;
+	}
+
+	return has_options ? LiteralGroup::OPAQUE : LiteralGroup::GIVE_UP;
+}
+
+static void flush_run(std::string *run, std::vector<std::string> *literals)
+{
+	if (run->size() >= SHADER_REGEX_MIN_LITERAL)
+		literals->push_back(*run);
+	run->clear();
+}
+
+static LiteralParse parse_sequence(const std::string &pattern, size_t pos, size_t end,
+		std::vector<std::string> *literals)
+{
+	std::vector<std::string> group_literals;
+	LiteralParse result;
+	LiteralGroup group;
+	size_t group_end, body;
+	std::string run;
+	bool quantified;
+	unsigned min;
+	char c;
+
+	while (pos < end) {
+		c = pattern[pos];
+
+		switch (c) {
+			case '|':
+				return LiteralParse::ALTERNATION;
+			case ')':
+			case '*':
+			case '+':
+			case '?':
+				// Unbalanced, or a quantifier with nothing to repeat
+				return LiteralParse::GIVE_UP;
+			case '(':
+				flush_run(&run, literals);
+				group_end = find_group_end(pattern, pos, end);
+				if (group_end == std::string::npos)
+					return LiteralParse::GIVE_UP;
+				group = classify_group(pattern, pos, group_end, &body);
+				if (group == LiteralGroup::GIVE_UP)
+					return LiteralParse::GIVE_UP;
+				pos = group_end + 1;
+				min = skip_quantifier(pattern, &pos, end, &quantified);
+				if (group == LiteralGroup::OPAQUE || !min)
+					continue;
+
+				// Only take the literals from the body if it does not
+				// have a choice of alternatives:
+				group_literals.clear();
+				result = parse_sequence(pattern, body, group_end, &group_literals);
+				if (result == LiteralParse::GIVE_UP)
+					return result;
+				if (result == LiteralParse::OK)
+					literals->insert(literals->end(), group_literals.begin(), group_literals.end());
+				continue;
+			case '[':
+				flush_run(&run, literals);
+				pos = skip_class(pattern, pos, end);
+				if (pos == std::string::npos)
+					return LiteralParse::GIVE_UP;
+				skip_quantifier(pattern, &pos, end, &quantified);
+				continue;
+			case '.':
+			case '^':
+			case '$':
+				flush_run(&run, literals);
+				pos++;
+				skip_quantifier(pattern, &pos, end, &quantified);
+				continue;
+			case '\\':
+				if (pos + 1 >= end)
+					return LiteralParse::GIVE_UP;
+				c = pattern[pos + 1];
+				pos += 2;
+				if (!is_alnum(c))
+					break; // Escaped punctuation is a literal
+				switch (c) {
+					case 'n': c = '\n'; break;
+					case 'r': c = '\r'; break;
+					case 't': c = '\t'; break;
+					case 'f': c = '\f'; break;
+					case 'a': c = '\a'; break;
+					case 'e': c = '\x1b'; break;
+					default:
+						// Character types and assertions just end the
+						// run. Anything else (\x, \p, \g, \k, \Q,
+						// octal, backreferences...) takes arguments
+						// that we would have to parse correctly:
+						if (!strchr("dDsSwWhHvVRXbBAzZGKC", c))
+							return LiteralParse::GIVE_UP;
+						flush_run(&run, literals);
+						skip_quantifier(pattern, &pos, end, &quantified);
+						continue;
+				}
+				break;
+			case '{':
+				skip_quantifier(pattern, &pos, end, &quantified);
+				if (quantified)
+					return LiteralParse::GIVE_UP;
+				pos++; // Not a quantifier, so a literal {
+				break;
+			default:
+				pos++;
+				break;
+		}
+
+		// c is a literal character, which may be quantified:
+		c = ascii_lower(c);
+		min = skip_quantifier(pattern, &pos, end, &quantified);
+		if (!quantified) {
+			run.push_back(c);
+		} else if (!min) {
+			flush_run(&run, literals);
+		} else {
+			// At least one copy of c ends this run, and the last copy
+			// starts the next:
+			run.push_back(c);
+			flush_run(&run, literals);
+			run.push_back(c);
+		}
+	}
+
+	flush_run(&run, literals);
+	return LiteralParse::OK;
+}
+
+// Extended mode can be turned on part way through, even inside a group that
+// parse_sequence() would otherwise skip over without looking, and its #
+// comments can then hide a ) that would throw off find_group_end(). Look for
+// it anywhere in the pattern before we start:
+static bool uses_extended_mode(const std::string &pattern)
+{
+	size_t pos, i;
+
+	for (pos = pattern.find("(?"); pos != std::string::npos; pos = pattern.find("(?", pos + 2)) {
+		for (i = pos + 2; i < pattern.size() && (is_alnum(pattern[i]) || pattern[i] == '-' || pattern[i] == '^'); i++) {
+			if (pattern[i] == 'x')
+				return true;
+		}
+	}
+
+	return false;
+}
+
+bool shader_regex_required_literals(const std::string &pattern, std::vector<std::string> *literals)
+{
+	std::vector<std::string> found;
+
+	if (uses_extended_mode(pattern))
+		return false;
+
+	if (parse_sequence(pattern, 0, pattern.size(), &found) != LiteralParse::OK)
+		return false;
+
+	literals->insert(literals->end(), found.begin(), found.end());
+	return true;
+}
+
+ShaderRegexPrefilter::ShaderRegexPrefilter()
+{
+	clear();
+}
+
+void ShaderRegexPrefilter::clear()
+{
+	memset(byte_class, 0, sizeof(byte_class));
+	num_classes = 1;
+	transitions.clear();
+	output_start.clear();
+	output_ids.clear();
+	literals.clear();
+	literal_ids.clear();
+}
+
+uint32_t ShaderRegexPrefilter::add_literal(const std::string &literal)
+{
+	auto inserted = literal_ids.emplace(literal, (uint32_t)literals.size());
+
+	if (inserted.second)
+		literals.push_back(literal);
+
+	return inserted.first->second;
+}
+
+void ShaderRegexPrefilter::build()
+{
+	std::vector<std::vector<uint32_t>> state_outputs;
+	std::vector<uint32_t> trie, fail;
+	std::deque<uint32_t> queue;
+	uint32_t state, next, cls, id, i;
+	unsigned char c;
+
+	// Assign a class to each distinct byte, with the upper case letters
+	// sharing the class of their lower case equivalent:
+	memset(byte_class, 0, sizeof(byte_class));
+	num_classes = 1;
+	for (const std::string &literal : literals) {
+		for (char ch : literal) {
+			c = (unsigned char)ch;
+			if (byte_class[c])
+				continue;
+			byte_class[c] = (uint8_t)num_classes;
+			if (c >= 'a' && c <= 'z')
+				byte_class[c - 'a' + 'A'] = (uint8_t)num_classes;
+			num_classes++;
+		}
+	}
+
+	// Build the trie, where 0 is the root and also means no edge, since
+	// nothing ever points back to the root in a trie:
+	trie.assign(num_classes, 0);
+	state_outputs.resize(1);
+	for (id = 0; id < literals.size(); id++) {
+		state = 0;
+		for (char ch : literals[id]) {
+			cls = byte_class[(unsigned char)ch];
+			next = trie[state * num_classes + cls];
+			if (!next) {
+				next = (uint32_t)state_outputs.size();
+				trie[state * num_classes + cls] = next;
+				trie.resize(trie.size() + num_classes, 0);
+				state_outputs.emplace_back();
+			}
+			state = next;
+		}
+		state_outputs[state].push_back(id);
+	}
+
+	// Breadth first from the root, turning the trie into a DFA by filling
+	// in each missing edge with the edge from the failure state, which is
+	// always shallower so has already been completed:
+	transitions = trie;
+	fail.assign(state_outputs.size(), 0);
+	for (cls = 0; cls < num_classes; cls++) {
+		next = transitions[cls];
+		if (next)
+			queue.push_back(next);
+	}
+	while (!queue.empty()) {
+		state = queue.front();
+		queue.pop_front();
+
+		const std::vector<uint32_t> &inherited = state_outputs[fail[state]];
+		state_outputs[state].insert(state_outputs[state].end(), inherited.begin(), inherited.end());
+
+		for (cls = 0; cls < num_classes; cls++) {
+			next = trie[state * num_classes + cls];
+			if (next) {
+				fail[next] = transitions[fail[state] * num_classes + cls];
+				queue.push_back(next);
+			} else {
+				transitions[state * num_classes + cls] = transitions[fail[state] * num_classes + cls];
+			}
+		}
+	}
+
+	output_start.resize(state_outputs.size() + 1);
+	output_ids.clear();
+	for (i = 0; i < state_outputs.size(); i++) {
+		output_start[i] = (uint32_t)output_ids.size();
+		output_ids.insert(output_ids.end(), state_outputs[i].begin(), state_outputs[i].end());
+	}
+	output_start[i] = (uint32_t)output_ids.size();
+}
+
+size_t ShaderRegexPrefilter::scan(const char *text, size_t length, std::vector<uint8_t> *found) const
+{
+	const uint32_t *table = transitions.data();
+	size_t remaining = literals.size();
+	uint32_t state = 0, i;
+	size_t pos;
+
+	found->assign(literals.size(), 0);
+	if (!remaining)
+		return 0;
+
+	for (pos = 0; pos < length; pos++) {
+		state = table[state * num_classes + byte_class[(unsigned char)text[pos]]];
+		if (output_start[state] == output_start[state + 1])
+			continue;
+
+		for (i = output_start[state]; i < output_start[state + 1]; i++) {
+			if (!(*found)[output_ids[i]]) {
+				(*found)[output_ids[i]] = 1;
+				remaining--;
+			}
+		}
+		if (!remaining)
+			break;
+	}
+
+	return literals.size() - remaining;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Cheap first pass for ShaderRegex: works out which literal strings each
+// pattern cannot match without, then looks for all of them in the assembly
+// with a single pass of an Aho-Corasick automaton. A ShaderRegex group with a
+// literal that is not in the shader cannot match it, so it never needs to be
+// handed to PCRE2, which otherwise has to run every pattern of every group
+// over the full text of every shader the game creates.
+//
+// This depends on nothing from PCRE2, D3D or the rest of 3DMigoto so that
+// TestShaderRegex can check it against PCRE2 on Linux.
+
+// Literal runs shorter than this are not worth looking for - they are found
+// in just about every shader:
+#define SHADER_REGEX_MIN_LITERAL 3
+
+// Appends the literal substrings that any match of the pattern must contain,
+// folded to lower case since ShaderRegex patterns are always compiled with
+// PCRE2_CASELESS. This only understands the subset of the syntax that people
+// actually write in ShaderRegex sections, and will happily miss a literal it
+// is not sure about. Returns false and adds nothing for patterns that it
+// cannot reason about at all, such as those with a top level alternation or
+// extended mode, which then always go to PCRE2.
+bool shader_regex_required_literals(const std::string &pattern, std::vector<std::string> *literals);
+
+class ShaderRegexPrefilter {
+	// DFA built from the trie of literals with the failure links already
+	// followed, so each byte of the text costs exactly one table lookup.
+	// Bytes are first mapped to a class so that the table only has a column
+	// for each distinct (case folded) byte used in the literals, plus one
+	// shared by everything else:
+	uint8_t byte_class[256];
+	uint32_t num_classes;
+	std::vector<uint32_t> transitions;
+
+	// Literals that end at each state (including those found by following
+	// its failure links) are output_ids[output_start[state]] up to
+	// output_ids[output_start[state + 1]]:
+	std::vector<uint32_t> output_start;
+	std::vector<uint32_t> output_ids;
+
+	std::vector<std::string> literals;
+	std::map<std::string, uint32_t> literal_ids;
+
+public:
+	ShaderRegexPrefilter();
+
+	void clear();
+
+	// Returns the id of the literal, which is the index scan() will use for
+	// it. Adding the same literal twice returns the same id. Literals must
+	// already be lower case, as from shader_regex_required_literals().
+	uint32_t add_literal(const std::string &literal);
+
+	// Must be called after the last add_literal() and before scan():
+	void build();
+
+	size_t size() const { return literals.size(); }
+
+	// Sets found[id] to 1 for each literal that occurs in the text
+	// (case insensitively) and 0 for the rest. Returns the number found.
+	size_t scan(const char *text, size_t length, std::vector<uint8_t> *found) const;
+};
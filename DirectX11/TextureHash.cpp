@@ -0,0 +1,230 @@
+#include "TextureHash.h"
+
+#include <algorithm>
+
+#include "crc32c.h"
+
+TextureHashStream TextureHashStream::contiguous(const void *data, size_t length)
+{
+	TextureHashStream stream;
+
+	stream.data = (const uint8_t*)data;
+	stream.length = length;
+	stream.row_bytes = length;
+	stream.row_pitch = length;
+	stream.zero_padding = 0;
+
+	return stream;
+}
+
+TextureHashStream TextureHashStream::rows(const void *data, size_t length,
+		size_t row_pitch, size_t row_count,
+		size_t mapped_row_pitch, bool zero_padding)
+{
+	TextureHashStream stream;
+	signed padding = (signed)mapped_row_pitch - (signed)row_pitch;
+	signed remaining = (signed)length;
+
+	stream.data = (const uint8_t*)data;
+	stream.row_bytes = std::min(row_pitch, mapped_row_pitch);
+	stream.row_pitch = mapped_row_pitch;
+	stream.zero_padding = (zero_padding && padding > 0) ? padding : 0;
+
+	// The length was always treated as signed, and hashing stopped at
+	// whichever came first of the end of the last row (including its
+	// padding) and the length:
+	if (remaining > 0)
+		stream.length = std::min((size_t)remaining, row_count * (stream.row_bytes + stream.zero_padding));
+	else
+		stream.length = 0;
+
+	return stream;
+}
+
+static uint32_t append_zeroes(uint32_t hash, size_t length)
+{
+	static const uint8_t zeroes[4096] = {};
+	size_t n;
+
+	for (; length; length -= n) {
+		n = std::min(length, sizeof(zeroes));
+		hash = crc32c_append(hash, zeroes, n);
+	}
+
+	return hash;
+}
+
+// Hashes bytes [start, end) of the stream
+static uint32_t hash_range(uint32_t hash, const TextureHashStream &stream, size_t start, size_t end)
+{
+	size_t stride = stream.row_bytes + stream.zero_padding;
+	size_t row, offset, n;
+
+	if (start >= end || !stride)
+		return hash;
+
+	row = start / stride;
+	offset = start % stride;
+
+	while (start < end) {
+		if (offset < stream.row_bytes) {
+			n = std::min(stream.row_bytes - offset, end - start);
+			hash = crc32c_append(hash, stream.data + row * stream.row_pitch + offset, n);
+		} else {
+			n = std::min(stride - offset, end - start);
+			hash = append_zeroes(hash, n);
+		}
+
+		start += n;
+		offset += n;
+		if (offset == stride) {
+			row++;
+			offset = 0;
+		}
+	}
+
+	return hash;
+}
+
+uint32_t texture_hash_serial(uint32_t hash, const TextureHashStream &stream)
+{
+	return hash_range(hash, stream, 0, stream.length);
+}
+
+struct TextureHashJob {
+	const TextureHashStream *stream;
+	size_t block_size;
+	unsigned num_blocks;
+
+	std::atomic<unsigned> next_block;
+	std::atomic<bool> failed;
+
+	uint32_t crcs[TEXTURE_HASH_MAX_BLOCKS];
+
+	// Hashes blocks until there are none left to claim. Each block starts
+	// from a CRC of 0 so that it can be combined with the others later.
+	// Access violations reading the data are caught the same as in
+	// crc32c_hw(), since an exception escaping a worker thread would take
+	// down the game.
+	void run()
+	{
+		unsigned block;
+		size_t start, end;
+
+		while ((block = next_block++) < num_blocks) {
+			start = block * block_size;
+			end = std::min(start + block_size, stream->length);
+			try {
+				crcs[block] = hash_range(0, *stream, start, end);
+			} catch (...) {
+				failed = true;
+			}
+		}
+	}
+};
+
+TextureHashPool::TextureHashPool(unsigned threads) :
+	job(NULL),
+	job_generation(0),
+	job_refs(0)
+{
+	unsigned i;
+
+	for (i = 1; i < threads; i++) {
+		workers.emplace_back(&TextureHashPool::worker_main, this);
+		workers.back().detach();
+	}
+}
+
+void TextureHashPool::worker_main()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	unsigned generation = job_generation;
+	TextureHashJob *current;
+
+	while (true) {
+		work_cv.wait(guard, [&] { return job && job_generation != generation; });
+		generation = job_generation;
+		current = job;
+		job_refs++;
+
+		guard.unlock();
+		current->run();
+		guard.lock();
+
+		// The job is on the submitter's stack, so it must not return
+		// until every worker that picked it up has finished with it:
+		if (--job_refs == 0)
+			done_cv.notify_one();
+	}
+}
+
+// Must be called with submit_lock held
+bool TextureHashPool::hash_parallel(uint32_t *hash, const TextureHashStream &stream)
+{
+	TextureHashJob job_data;
+	uint32_t result = *hash;
+	size_t start, length;
+	unsigned i;
+
+	job_data.stream = &stream;
+	job_data.block_size = std::max((size_t)TEXTURE_HASH_BLOCK_MIN,
+			(stream.length + TEXTURE_HASH_MAX_BLOCKS - 1) / TEXTURE_HASH_MAX_BLOCKS);
+	job_data.num_blocks = (unsigned)((stream.length + job_data.block_size - 1) / job_data.block_size);
+	job_data.next_block = 0;
+	job_data.failed = false;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		job = &job_data;
+		job_generation++;
+	}
+	work_cv.notify_all();
+
+	job_data.run();
+
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		job = NULL;
+		done_cv.wait(guard, [&] { return job_refs == 0; });
+	}
+
+	if (job_data.failed)
+		return false;
+
+	for (i = 0; i < job_data.num_blocks; i++) {
+		start = i * job_data.block_size;
+		length = std::min(job_data.block_size, stream.length - start);
+		result = crc32c_combine(result, job_data.crcs[i], length);
+	}
+
+	*hash = result;
+	return true;
+}
+
+bool TextureHashPool::hash(uint32_t *hash, const TextureHashStream &stream)
+{
+	if (!workers.empty() && stream.length >= TEXTURE_HASH_PARALLEL_MIN) {
+		std::unique_lock<std::mutex> submit(submit_lock, std::try_to_lock);
+		if (submit.owns_lock())
+			return hash_parallel(hash, stream);
+	}
+
+	try {
+		*hash = texture_hash_serial(*hash, stream);
+	} catch (...) {
+		return false;
+	}
+	return true;
+}
+
+TextureHashPool* TextureHashPool::get()
+{
+	// Never destroyed, as the workers cannot be joined while the DLL is
+	// being unloaded. Leave a core for the game's own loading threads, and
+	// don't bother going too wide since memory bandwidth runs out first:
+	static TextureHashPool *pool = new TextureHashPool(
+			std::min(std::max(std::thread::hardware_concurrency(), 2u) - 1, 8u));
+
+	return pool;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Hashing engine for texture initial data. Large textures are split into
+// blocks that are hashed on a small pool of worker threads (with the calling
+// thread joining in), then the CRCs of the blocks are merged with
+// crc32c_combine(), which gives exactly the same hash as feeding the whole
+// texture through crc32c_append() one row at a time. Nothing is allocated
+// per texture - the job lives on the caller's stack and the pitch padding is
+// hashed from a static block of zeroes.
+//
+// This depends on nothing from D3D or the rest of 3DMigoto so that
+// TestResourceHash/texture_hash_bench.cpp can check and benchmark it against
+// the serial code it replaces.
+
+// The bytes to hash, described as a sequence of rows so that any padding at
+// the end of each row in memory can be skipped, or replaced by zeroes. A
+// plain buffer is a single row.
+struct TextureHashStream {
+	const uint8_t *data;
+	size_t length;       // Total bytes to hash, may end part way through a row
+	size_t row_bytes;    // Bytes hashed from each row
+	size_t row_pitch;    // Distance between rows in data
+	size_t zero_padding; // Zeroes hashed after each row
+
+	static TextureHashStream contiguous(const void *data, size_t length);
+
+	// Same layout hash_tex2d_data() has always used: row_pitch and
+	// row_count are what DirectXTK calculates for the format, and length
+	// caps the hash part way through a row if it is shorter.
+	static TextureHashStream rows(const void *data, size_t length,
+			size_t row_pitch, size_t row_count,
+			size_t mapped_row_pitch, bool zero_padding);
+};
+
+// Textures smaller than this are hashed on the calling thread, since waking
+// the workers would take longer than hashing them:
+#define TEXTURE_HASH_PARALLEL_MIN (1024 * 1024)
+#define TEXTURE_HASH_BLOCK_MIN (256 * 1024)
+#define TEXTURE_HASH_MAX_BLOCKS 64
+
+struct TextureHashJob;
+
+class TextureHashPool {
+	// Held by whichever thread has a job in flight. Other threads that
+	// want to hash a texture at the same time just do so serially.
+	std::mutex submit_lock;
+
+	// Protects job and job_refs, and wakes the workers and submitter
+	std::mutex lock;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	TextureHashJob *job;
+	unsigned job_generation;
+	unsigned job_refs;
+
+	std::vector<std::thread> workers;
+
+	void worker_main();
+	bool hash_parallel(uint32_t *hash, const TextureHashStream &stream);
+
+public:
+	// Starts threads - 1 worker threads, since the caller also helps.
+	// Workers are detached and run until the process exits.
+	TextureHashPool(unsigned threads);
+
+	// Returns false if an exception was raised while reading the data, in
+	// which case *hash is not updated.
+	bool hash(uint32_t *hash, const TextureHashStream &stream);
+
+	// The pool shared by all resource hashing, started on first use
+	static TextureHashPool* get();
+};
+
+// Hashes the stream on the calling thread. This is also the fallback for
+// small textures and while the pool is busy with another one.
+uint32_t texture_hash_serial(uint32_t hash, const TextureHashStream &stream);
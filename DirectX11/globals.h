@@ -13,6 +13,10 @@
 #include "DirectXMath.h"
 #include "util.h"
 #include "DecompileHLSL.h"
+#include "DecompileCache.h"
+#include "ShaderCachePack.h"
+#include "ShaderCompileQueue.h"
+#include "FrameAnalysisWriter.h"
 
 #include "ResourceHash.h"
 #include "CommandList.h"
@@ -134,6 +138,26 @@ typedef std::unordered_map<ID3D11DeviceChild *, ID3D11DeviceChild *> ShaderRepla
 // Key is shader, value is hash key.
 typedef std::unordered_map<ID3D11DeviceChild *, UINT64> ShaderMap;
 
+// A shader compiled by a ShaderCompileQueue worker, waiting to be swapped in
+// to mReloadedShaders by InstallBackgroundCompiledShaders(). SetShader reads
+// that map without taking the lock, so the workers can't change it
+// themselves. replacement is NULL if the shader failed to compile.
+struct CompletedShaderCompile
+{
+	UINT64 hash;
+	std::wstring shaderType;
+	ID3D11DeviceChild* original;
+	ID3DBlob* byteCode; // Referenced, to tell its entry apart from one for a reused handle
+	ID3D11DeviceChild* replacement;
+	std::string shaderModel;
+	FILETIME timeStamp;
+	std::wstring infoText;
+};
+
+// Called from the present thread, like ReloadFixes, to swap in the shaders
+// the background compiles have finished:
+void InstallBackgroundCompiledShaders();
+
 enum class FrameAnalysisOptions {
 	INVALID         = 0,
 
@@ -185,6 +209,7 @@ enum class FrameAnalysisOptions {
 	DEFRD_CTX_DELAY = 0x00800000,
 	DEFRD_CTX_MASK  = 0x00c00000,
 	SYMLINK         = 0x01000000,
+	STORE_DEDUPED   = 0x02000000,
 	DEPRECATED      = (signed)0x80000000,
 };
 SENSIBLE_ENUM(FrameAnalysisOptions);
@@ -227,6 +252,7 @@ static EnumName_t<wchar_t *, FrameAnalysisOptions> FrameAnalysisOptionNames[] =
 	{L"deferred_ctx_accurate", FrameAnalysisOptions::DEFRD_CTX_DELAY},
 	{L"share_dupes", FrameAnalysisOptions::SHARE_DEDUPED},
 	{L"symlink", FrameAnalysisOptions::SYMLINK},
+	{L"store_dupes", FrameAnalysisOptions::STORE_DEDUPED},
 
 	// Legacy combo options:
 	{L"dump_rt_jps", FrameAnalysisOptions::DUMP_RT_JPS},
@@ -458,6 +484,9 @@ struct Globals
 	wchar_t ANALYSIS_PATH[MAX_PATH];
 	FrameAnalysisOptions def_analyse_options, cur_analyse_options;
 	std::unordered_set<void*> frame_analysis_seen_rts;
+	int analyse_writer_threads;
+	FrameAnalysisWriter *frame_analysis_writer; // Created once and never freed, like TextureHashPool
+	bool analyse_binary_log;
 
 	ShaderHashType shader_hash_type;
 	int texture_hash_version;
@@ -470,6 +499,11 @@ struct Globals
 	int recursive_include;
 	uint32_t ZBufferHashToInject;
 	DecompilerSettings decompiler_settings;
+	DecompileCache decompile_cache;
+	std::wstring decompile_cache_path;
+	ShaderCachePack shader_cache_pack;
+	bool async_shader_compile;
+	ShaderCompileQueue *shader_compile_queue; // Created once and never freed, like TextureHashPool
 	bool DumpUsage;
 	bool ENABLE_TUNE;
 	float gTuneValue[4], gTuneStep;
@@ -529,6 +563,7 @@ struct Globals
 	ShaderMap mShaders;										// All shaders ever registered with CreateXXXShader
 	ShaderReloadMap mReloadedShaders;						// Shaders that were reloaded live from ShaderFixes
 	ShaderReplacementMap mOriginalShaders;					// When MarkingMode=Original, switch to original. Also used for show_original and shader reversion
+	std::vector<CompletedShaderCompile> mCompletedShaderCompiles;	// Background compiles waiting to be installed
 
 	std::set<UINT64> mVisitedComputeShaders;
 	UINT64 mSelectedComputeShader;
@@ -640,6 +675,9 @@ struct Globals
 		analyse_frame_no(0),
 		def_analyse_options(FrameAnalysisOptions::INVALID),
 		cur_analyse_options(FrameAnalysisOptions::INVALID),
+		analyse_writer_threads(4),
+		frame_analysis_writer(NULL),
+		analyse_binary_log(false),
 
 		shader_hash_type(ShaderHashType::FNV),
 		texture_hash_version(0),
@@ -648,6 +686,8 @@ struct Globals
 		EXPORT_FIXED(false),
 		EXPORT_BINARY(false),
 		CACHE_SHADERS(false),
+		async_shader_compile(false),
+		shader_compile_queue(NULL),
 		DumpUsage(false),
 		ENABLE_TUNE(false),
 		gTuneStep(0.001f),
@@ -176,8 +176,7 @@ static void log_held_locks(LockStack &held_locks, std::vector<LockStack> &other_
 
 	// Just in case we are about to deadlock for real, flush the log file
 	// to make sure we know what happened:
-	if (LogFile)
-		fflush(LogFile);
+	LogFlush();
 }
 
 // Should be called with the graph lock held
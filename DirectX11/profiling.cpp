@@ -48,6 +48,8 @@ namespace Profiling {
 	unsigned skipped_draw_calls;
 	unsigned max_executions_per_frame_exceeded;
 	unsigned iniparams_updates;
+	unsigned shaderregex_groups_checked;
+	unsigned shaderregex_groups_prefiltered;
 }
 
 static LARGE_INTEGER profiling_start_time;
@@ -181,7 +183,8 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 			    L"   Map/Unmap overhead: %7.2fus/frame ~%ffps\n"
 			    L"track_texture_updates: %7.2fus/frame ~%ffps\n"
 			    L"  dump_usage overhead: %7.2fus/frame ~%ffps\n"
-			    L" ShaderRegex overhead: %7.2fus/frame ~%ffps\n"
+			    L" ShaderRegex overhead: %7.2fus/frame ~%ffps (%u/%u cache hits)\n"
+			    L"   ShaderRegex groups: %4u run through pcre2, %u ruled out by prefilter\n"
 			    L"Mouse cursor overhead: %7.2fus/frame ~%ffps\n"
 			    L"       NvAPI overhead: %7.2fus/frame ~%ffps\n"
 			    ,
@@ -208,6 +211,10 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 
 			    (float)shaderregex_overhead.QuadPart / frames,
 			    60.0 * shaderregex_overhead.QuadPart / collection_duration.QuadPart,
+			    Profiling::shaderregex_overhead.hits,
+			    Profiling::shaderregex_overhead.count,
+			    Profiling::shaderregex_groups_checked,
+			    Profiling::shaderregex_groups_prefiltered,
 
 			    (float)cursor_overhead.QuadPart / frames,
 			    60.0 * cursor_overhead.QuadPart / collection_duration.QuadPart,
@@ -477,6 +484,8 @@ void Profiling::clear()
 	skipped_draw_calls = 0;
 	max_executions_per_frame_exceeded = 0;
 	iniparams_updates = 0;
+	shaderregex_groups_checked = 0;
+	shaderregex_groups_prefiltered = 0;
 
 	start_frame_no = G->frame_no;
 	QueryPerformanceCounter(&profiling_start_time);
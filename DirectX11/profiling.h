@@ -99,6 +99,8 @@ namespace Profiling {
 	extern unsigned skipped_draw_calls;
 	extern unsigned max_executions_per_frame_exceeded;
 	extern unsigned iniparams_updates;
+	extern unsigned shaderregex_groups_checked;
+	extern unsigned shaderregex_groups_prefiltered;
 
 	// NvAPI profiling:
 
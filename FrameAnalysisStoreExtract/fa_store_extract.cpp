@@ -0,0 +1,335 @@
+// Recreates the files of a frame analysis that was dumped with store_dupes,
+// from the manifest.txt in its directory and the deduped.fastore it refers
+// to, laid out as they would have been had the files been linked.
+//
+//   fa_store_extract FrameAnalysis-2018-01-01-000000
+//   fa_store_extract --draw 100-200 --match ps-t0 -o textures FrameAnalysis-2018-01-01-000000
+//   fa_store_extract --list FrameAnalysis-2018-01-01-000000\manifest.txt
+
+#include "FrameAnalysisStore.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#define PATH_SEP L'\\'
+#else
+#include <sys/stat.h>
+#define PATH_SEP L'/'
+#endif
+
+static struct {
+	const char *input;
+	const char *output;
+	bool list;
+	bool force;
+	bool filter_draw;
+	unsigned long first_draw, last_draw;
+	std::vector<std::string> matches;
+} args;
+
+static void PrintHelp(int argc, char *argv[])
+{
+	printf("usage: %s [options] { FrameAnalysis-DIR | manifest.txt }\n\n", argv[0]);
+
+	printf("  -o, --output DIR\n");
+	printf("\t\t\tCreate the files under DIR instead of the frame analysis directory\n");
+
+	printf("  --list\n");
+	printf("\t\t\tList the files and their keys in the store instead of creating them\n");
+
+	printf("  --draw N[-M]\n");
+	printf("\t\t\tOnly include files from draw call N, or N through M\n");
+
+	printf("  --match TEXT\n");
+	printf("\t\t\tOnly include files whose names contain TEXT.\n");
+	printf("\t\t\tMay be given more than once\n");
+
+	printf("  -f, --force\n");
+	printf("\t\t\tOverwrite files that already exist\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	int i;
+	char *end;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+			if (++i >= argc)
+				PrintHelp(argc, argv);
+			args.output = argv[i];
+			continue;
+		}
+		if (!strcmp(argv[i], "--list")) {
+			args.list = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--force")) {
+			args.force = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "--draw")) {
+			if (++i >= argc)
+				PrintHelp(argc, argv);
+			args.filter_draw = true;
+			args.first_draw = args.last_draw = strtoul(argv[i], &end, 10);
+			if (*end == '-')
+				args.last_draw = strtoul(end + 1, &end, 10);
+			if (*end)
+				PrintHelp(argc, argv);
+			continue;
+		}
+		if (!strcmp(argv[i], "--match")) {
+			if (++i >= argc)
+				PrintHelp(argc, argv);
+			args.matches.push_back(argv[i]);
+			continue;
+		}
+		if (argv[i][0] == '-' || args.input)
+			PrintHelp(argc, argv);
+		args.input = argv[i];
+	}
+
+	if (!args.input)
+		PrintHelp(argc, argv);
+}
+
+static std::wstring widen_arg(const char *arg)
+{
+#ifdef _WIN32
+	std::wstring ret(MultiByteToWideChar(CP_ACP, 0, arg, -1, NULL, 0), L'\0');
+	MultiByteToWideChar(CP_ACP, 0, arg, -1, &ret[0], (int)ret.size());
+	ret.resize(wcslen(ret.c_str()));
+	return ret;
+#else
+	return frame_analysis_store_widen(arg, strlen(arg));
+#endif
+}
+
+static std::string printable(const std::wstring &path)
+{
+	return frame_analysis_store_utf8(path.c_str(), path.size());
+}
+
+// The manifest is written with Windows separators:
+static std::wstring native_path(std::wstring path)
+{
+	for (wchar_t &c : path) {
+		if (c == L'\\' || c == L'/')
+			c = PATH_SEP;
+	}
+	return path;
+}
+
+static bool is_absolute(const std::wstring &path)
+{
+	return (!path.empty() && (path[0] == L'\\' || path[0] == L'/'))
+		|| (path.size() >= 2 && path[1] == L':');
+}
+
+static std::wstring join(const std::wstring &dir, const std::wstring &name)
+{
+	if (dir.empty())
+		return name;
+	if (dir.back() == PATH_SEP)
+		return dir + name;
+	return dir + PATH_SEP + name;
+}
+
+static bool is_directory(const std::wstring &path)
+{
+#ifdef _WIN32
+	DWORD attrib = GetFileAttributesW(path.c_str());
+	return attrib != INVALID_FILE_ATTRIBUTES && (attrib & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return !stat(printable(path).c_str(), &st) && S_ISDIR(st.st_mode);
+#endif
+}
+
+static bool make_directory(const std::wstring &path)
+{
+#ifdef _WIN32
+	return !_wmkdir(path.c_str()) || errno == EEXIST;
+#else
+	return !mkdir(printable(path).c_str(), 0755) || errno == EEXIST;
+#endif
+}
+
+// Creates the directories leading up to a file, as deferred contexts dump
+// into a subdirectory of their own:
+static bool make_parent_directories(const std::wstring &path)
+{
+	size_t pos;
+
+	for (pos = path.find(PATH_SEP, 1); pos != std::wstring::npos; pos = path.find(PATH_SEP, pos + 1)) {
+		if (pos == 2 && path[1] == L':')
+			continue;
+		if (!make_directory(path.substr(0, pos)))
+			return false;
+	}
+	return true;
+}
+
+static bool file_exists(const std::wstring &path)
+{
+	FILE *fp = frame_analysis_store_fopen(path, "rb");
+
+	if (!fp)
+		return false;
+	fclose(fp);
+	return true;
+}
+
+// Files are named 000123-..., or N.000123-... in hold mode, unless
+// filename_reg moved the draw call to the end as ...-000123.ext
+static bool draw_call_of(const std::wstring &name, unsigned long *draw)
+{
+	size_t base = name.find_last_of(L"\\/");
+	const wchar_t *pos, *dot, *dash;
+	wchar_t *end;
+
+	pos = name.c_str() + (base == std::wstring::npos ? 0 : base + 1);
+	if (iswdigit(*pos)) {
+		*draw = wcstoul(pos, &end, 10);
+		if (*end == L'.' && iswdigit(end[1]))
+			*draw = wcstoul(end + 1, &end, 10);
+		return *end == L'-';
+	}
+
+	dot = wcsrchr(pos, L'.');
+	dash = wcsrchr(pos, L'-');
+	if (!dot || !dash || dash > dot)
+		return false;
+	pos = dash + 1;
+	*draw = wcstoul(pos, &end, 10);
+	if (*end == L'.' && end < dot) {
+		pos = end + 1;
+		*draw = wcstoul(pos, &end, 10);
+	}
+	return end == dot && end > pos;
+}
+
+static bool include(const FrameAnalysisManifestEntry &entry)
+{
+	unsigned long draw;
+	std::string name;
+
+	if (args.filter_draw) {
+		if (!draw_call_of(entry.name, &draw) || draw < args.first_draw || draw > args.last_draw)
+			return false;
+	}
+	if (args.matches.empty())
+		return true;
+
+	name = printable(entry.name);
+	for (const std::string &want : args.matches) {
+		if (name.find(want) != std::string::npos)
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	std::unordered_map<std::wstring, std::unique_ptr<FrameAnalysisStore>> stores;
+	std::vector<FrameAnalysisManifestEntry> entries;
+	std::wstring input, manifest, analysis_dir, output_dir, path, last_key_store;
+	std::string last_key;
+	std::vector<uint8_t> data;
+	size_t sep, written = 0, skipped = 0, failed = 0;
+	FILE *fp;
+
+	parse_args(argc, argv);
+
+	input = native_path(widen_arg(args.input));
+	if (is_directory(input)) {
+		analysis_dir = input;
+		manifest = join(input, FRAME_ANALYSIS_MANIFEST_NAME);
+	} else {
+		manifest = input;
+		sep = input.rfind(PATH_SEP);
+		analysis_dir = sep == std::wstring::npos ? L"." : input.substr(0, sep);
+	}
+	output_dir = args.output ? native_path(widen_arg(args.output)) : analysis_dir;
+
+	if (!read_frame_analysis_manifest(manifest.c_str(), &entries)) {
+		fprintf(stderr, "Unable to read %s\n", printable(manifest).c_str());
+		return EXIT_FAILURE;
+	}
+
+	for (const FrameAnalysisManifestEntry &entry : entries) {
+		if (!include(entry))
+			continue;
+
+		if (args.list) {
+			printf("%s\t%s\n", entry.key.c_str(), printable(entry.name).c_str());
+			continue;
+		}
+
+		path = join(output_dir, native_path(entry.name));
+		if (!args.force && file_exists(path)) {
+			skipped++;
+			continue;
+		}
+
+		// Consecutive files are often the same blob, such as a
+		// constant buffer bound to every draw call:
+		if (entry.key != last_key || entry.store != last_key_store) {
+			last_key.clear();
+			std::unique_ptr<FrameAnalysisStore> &store = stores[entry.store];
+			if (!store) {
+				store.reset(new FrameAnalysisStore());
+				std::wstring store_path = native_path(entry.store);
+				if (!is_absolute(store_path))
+					store_path = join(analysis_dir, store_path);
+				if (!store->open(store_path.c_str(), true))
+					fprintf(stderr, "Unable to open %s\n", printable(store_path).c_str());
+			}
+			if (!store->read(entry.key, &data)) {
+				fprintf(stderr, "%s: %s is missing or damaged in %s\n",
+						printable(entry.name).c_str(), entry.key.c_str(),
+						printable(store->get_path()).c_str());
+				failed++;
+				continue;
+			}
+			last_key = entry.key;
+			last_key_store = entry.store;
+		}
+
+		make_parent_directories(path);
+		fp = frame_analysis_store_fopen(path, "wb");
+		if (!fp || fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+			fprintf(stderr, "Unable to write %s\n", printable(path).c_str());
+			if (fp)
+				fclose(fp);
+			failed++;
+			continue;
+		}
+		fclose(fp);
+		written++;
+	}
+
+	if (!args.list) {
+		printf("%zu files written", written);
+		if (skipped)
+			printf(", %zu already existed", skipped);
+		if (failed)
+			printf(", %zu failed", failed);
+		printf("\n");
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
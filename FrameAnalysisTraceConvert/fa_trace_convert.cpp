@@ -0,0 +1,350 @@
+// Converts the binary frame analysis log that [Hunting] analyse_binary_log
+// writes (log.fatrace) back into the log.txt that would have been written in
+// its place, byte for byte, or into a filtered or JSON view of it.
+//
+//   fa_trace_convert log.fatrace > log.txt
+//   fa_trace_convert --draw 100-200 --call Draw log.fatrace
+//   fa_trace_convert --json log.fatrace > log.json
+
+#include "FrameAnalysisTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static struct {
+	const char *trace;
+	const char *output;
+	bool json;
+	bool filter_draw;
+	uint32_t first_draw, last_draw;
+	bool filter_frame;
+	uint32_t frame;
+	std::vector<std::string> calls;
+} args;
+
+static void PrintHelp(int argc, char *argv[])
+{
+	printf("usage: %s [options] log.fatrace\n\n", argv[0]);
+
+	printf("  -o, --output FILE\n");
+	printf("\t\t\tWrite to FILE instead of standard output\n");
+
+	printf("  --json\n");
+	printf("\t\t\tWrite one JSON object per record with its arguments\n");
+
+	printf("  --draw N[-M]\n");
+	printf("\t\t\tOnly include draw call N, or N through M\n");
+
+	printf("  --frame N\n");
+	printf("\t\t\tOnly include frame N of a hold mode capture\n");
+
+	printf("  --call NAME\n");
+	printf("\t\t\tOnly include lines for calls whose name contains NAME.\n");
+	printf("\t\t\tMay be given more than once\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	int i;
+	char *end;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+			if (++i >= argc)
+				PrintHelp(argc, argv);
+			args.output = argv[i];
+			continue;
+		}
+		if (!strcmp(argv[i], "--json")) {
+			args.json = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "--draw")) {
+			if (++i >= argc)
+				PrintHelp(argc, argv);
+			args.filter_draw = true;
+			args.first_draw = args.last_draw = strtoul(argv[i], &end, 10);
+			if (*end == '-')
+				args.last_draw = strtoul(end + 1, &end, 10);
+			if (*end)
+				PrintHelp(argc, argv);
+			continue;
+		}
+		if (!strcmp(argv[i], "--frame")) {
+			if (++i >= argc)
+				PrintHelp(argc, argv);
+			args.filter_frame = true;
+			args.frame = strtoul(argv[i], &end, 10);
+			if (*end)
+				PrintHelp(argc, argv);
+			continue;
+		}
+		if (!strcmp(argv[i], "--call")) {
+			if (++i >= argc)
+				PrintHelp(argc, argv);
+			args.calls.push_back(argv[i]);
+			continue;
+		}
+		if (argv[i][0] == '-' || args.trace)
+			PrintHelp(argc, argv);
+		args.trace = argv[i];
+	}
+
+	if (!args.trace)
+		PrintHelp(argc, argv);
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> *data)
+{
+	FILE *fp;
+	size_t n;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+
+	data->clear();
+	data->resize(1024 * 1024);
+	n = 0;
+	while (true) {
+		n += fread(data->data() + n, 1, data->size() - n, fp);
+		if (n < data->size())
+			break;
+		data->resize(data->size() * 2);
+	}
+	data->resize(n);
+
+	fclose(fp);
+	return true;
+}
+
+// Records after a call continue its line, so they are included or left out
+// along with it:
+static bool include(const FrameAnalysisTraceEvent &call)
+{
+	std::string name;
+
+	if (args.filter_frame && (!call.hold || call.frame_no != args.frame))
+		return false;
+	if (args.filter_draw && (call.draw_call < args.first_draw || call.draw_call > args.last_draw))
+		return false;
+	if (args.calls.empty())
+		return true;
+
+	name = call.call_name();
+	for (const std::string &want : args.calls) {
+		if (name.find(want) != std::string::npos)
+			return true;
+	}
+	return false;
+}
+
+static void json_string(std::string &out, const std::string &str)
+{
+	char buf[8];
+
+	out += '"';
+	for (unsigned char c : str) {
+		switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (c < 0x20) {
+					snprintf(buf, sizeof(buf), "\\u%04x", c);
+					out += buf;
+				} else {
+					out += c;
+				}
+		}
+	}
+	out += '"';
+}
+
+// Wide strings are UTF-16 from Windows, or UTF-32 from anywhere else
+static std::string utf8(const std::vector<uint32_t> &wstr)
+{
+	std::string ret;
+	uint32_t c;
+	size_t i;
+
+	for (i = 0; i < wstr.size(); i++) {
+		c = wstr[i];
+		if (c >= 0xd800 && c < 0xdc00 && i + 1 < wstr.size() && wstr[i + 1] >= 0xdc00 && wstr[i + 1] < 0xe000)
+			c = 0x10000 + ((c - 0xd800) << 10) + (wstr[++i] - 0xdc00);
+		if ((c >= 0xd800 && c < 0xe000) || c > 0x10ffff)
+			c = 0xfffd;
+
+		if (c < 0x80) {
+			ret += (char)c;
+		} else if (c < 0x800) {
+			ret += (char)(0xc0 | (c >> 6));
+			ret += (char)(0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			ret += (char)(0xe0 | (c >> 12));
+			ret += (char)(0x80 | ((c >> 6) & 0x3f));
+			ret += (char)(0x80 | (c & 0x3f));
+		} else {
+			ret += (char)(0xf0 | (c >> 18));
+			ret += (char)(0x80 | ((c >> 12) & 0x3f));
+			ret += (char)(0x80 | ((c >> 6) & 0x3f));
+			ret += (char)(0x80 | (c & 0x3f));
+		}
+	}
+	return ret;
+}
+
+static void json_event(std::string &out, const FrameAnalysisTraceReader &reader,
+		const FrameAnalysisTraceEvent &event, const FrameAnalysisTraceEvent &call)
+{
+	static const char *types[] = {"", "format", "call", "append", "data"};
+	std::string text;
+	char buf[32];
+	bool first = true;
+
+	out += "{\"type\":\"";
+	out += types[(int)event.type];
+	out += '"';
+	if (call.hold)
+		out += ",\"frame\":" + std::to_string(call.frame_no);
+	out += ",\"draw\":" + std::to_string(call.draw_call);
+	out += ",\"call\":";
+	json_string(out, call.call_name());
+
+	if (event.fmt) {
+		out += ",\"format\":";
+		json_string(out, *event.fmt);
+		out += ",\"args\":[";
+		for (const FrameAnalysisTraceArg &arg : event.args) {
+			if (!first)
+				out += ',';
+			first = false;
+
+			switch (arg.type) {
+			case FrameAnalysisTraceArg::Type::INT:
+				out += std::to_string(arg.i);
+				break;
+			case FrameAnalysisTraceArg::Type::UINT:
+				out += std::to_string(arg.u);
+				break;
+			case FrameAnalysisTraceArg::Type::DOUBLE:
+				if (isfinite(arg.d)) {
+					snprintf(buf, sizeof(buf), "%.17g", arg.d);
+					out += buf;
+				} else {
+					out += "null";
+				}
+				break;
+			case FrameAnalysisTraceArg::Type::POINTER:
+				snprintf(buf, sizeof(buf), "\"0x%llx\"", (unsigned long long)arg.u);
+				out += buf;
+				break;
+			case FrameAnalysisTraceArg::Type::STRING:
+				if (arg.null)
+					out += "null";
+				else
+					json_string(out, arg.str);
+				break;
+			case FrameAnalysisTraceArg::Type::WSTRING:
+				if (arg.null)
+					out += "null";
+				else
+					json_string(out, utf8(arg.wstr));
+				break;
+			}
+		}
+		out += ']';
+	}
+
+	reader.render(text, event, false);
+	out += ",\"text\":";
+	json_string(out, text);
+	out += "}\n";
+}
+
+int main(int argc, char *argv[])
+{
+	FrameAnalysisTraceReader reader;
+	FrameAnalysisTraceEvent event = {}, call = {};
+	std::vector<uint8_t> trace;
+	std::string out;
+	bool included;
+	FILE *fp = stdout;
+
+	parse_args(argc, argv);
+
+	if (!read_file(args.trace, &trace)) {
+		fprintf(stderr, "Unable to open %s\n", args.trace);
+		return EXIT_FAILURE;
+	}
+	if (!reader.open(trace.data(), trace.size())) {
+		fprintf(stderr, "%s: %s\n", args.trace, reader.get_error().c_str());
+		return EXIT_FAILURE;
+	}
+
+	if (args.output) {
+		fp = fopen(args.output, "wb");
+		if (!fp) {
+			fprintf(stderr, "Unable to create %s\n", args.output);
+			return EXIT_FAILURE;
+		}
+	} else {
+#ifdef _WIN32
+		// The renderer already gives us the CRLFs the log had
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	}
+
+	// Anything before the first call, such as the analyse_options line,
+	// is only included when nothing is being filtered out:
+	included = !args.filter_draw && !args.filter_frame && args.calls.empty();
+
+	while (reader.next(event)) {
+		if (event.type == FrameAnalysisTraceRecord::CALL) {
+			call.hold = event.hold;
+			call.frame_no = event.frame_no;
+			call.draw_call = event.draw_call;
+			call.fmt = event.fmt;
+			call.type = event.type;
+			included = include(call);
+		}
+		if (!included)
+			continue;
+
+		if (args.json)
+			json_event(out, reader, event, call);
+		else
+			reader.render(out, event);
+
+		if (out.size() >= 1024 * 1024) {
+			fwrite(out.data(), 1, out.size(), fp);
+			out.clear();
+		}
+	}
+	fwrite(out.data(), 1, out.size(), fp);
+
+	if (fp != stdout)
+		fclose(fp);
+
+	if (!reader.get_error().empty()) {
+		fprintf(stderr, "%s: %s\n", args.trace, reader.get_error().c_str());
+		return EXIT_FAILURE;
+	}
+	if (reader.was_truncated())
+		fprintf(stderr, "%s: The trace was cut short, the last record is incomplete\n", args.trace);
+
+	return EXIT_SUCCESS;
+}
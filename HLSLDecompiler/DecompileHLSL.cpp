@@ -23,11 +23,15 @@
 #include <vector>
 #include <set>
 #include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <chrono>
 
 #include "DecompileHLSL.h"
+#include "SymbolTable.h"
 
-#include "BinaryDecompiler\internal_includes\structs.h"
-#include "BinaryDecompiler\internal_includes\decode.h"
+#include "BinaryDecompiler/internal_includes/structs.h"
+#include "BinaryDecompiler/internal_includes/decode.h"
 
 #include <excpt.h>
 
@@ -102,8 +106,13 @@ struct BufferEntry
 	string Name;
 };
 // Key is register << 16 + offset
-typedef map<int, BufferEntry> CBufferData;
-typedef map<string, string> StringStringMap;
+typedef SymbolTable<int, BufferEntry> CBufferData;
+typedef SymbolTable<string, string> StringStringMap;
+typedef SymbolTable<string, int> StringIntMap;
+typedef SymbolTable<string, DataType> StringDataTypeMap;
+typedef SymbolTable<int, string> IntStringMap;
+typedef SymbolTable<int, int> IntIntMap;
+typedef SymbolSet<string> StringSet;
 
 //dx9
 struct ConstantValue
@@ -128,6 +137,555 @@ static string swizCount(char *operand)
 	return (count == 1) ? "" : to_string(count);
 }
 
+// Binary front end. Rather than reading each instruction back out of the
+// disassembly with sscanf, format its statement and operands straight from
+// the instruction BinaryDecompiler already decoded, split up exactly the way
+// ReadStatement would have found them in the disassembler's output, so that
+// the rest of the decompiler can't tell the difference. Anything we are not
+// certain the disassembler would write the same way is refused, and the
+// caller falls back to reading that line of text instead.
+
+// How the disassembler writes the immediate source operands of an opcode:
+enum ImmediateFormat
+{
+	IMM_FLOAT,	// l(1.000000, 0.500000, 0.000000, 0.000000)
+	IMM_INT,	// l(-1), l(0x7ef311c3)
+	IMM_UINT,	// l(16), l(0x0000ffff)
+	IMM_TYPELESS,	// l(0,0,0,1.000000), guessed from the bit pattern
+};
+
+#define BINARY_OPCODE(opcode, name, format, operands) \
+	case opcode: *immFormat = format; *numOperands = operands; return name
+
+// Returns NULL for opcodes the binary front end does not handle, which
+// includes any we have not seen disassembled to check that the decoder gets
+// their operands right - it decodes imul with one destination too few, for
+// one. The operand count is what the disassembler shows, which is not always
+// what the decoder stores in ui32NumOperands: it decodes a second, bogus
+// operand for if_nz.
+static const char* BinaryOpcodeName(OPCODE_TYPE opcode, ImmediateFormat *immFormat, uint32_t *numOperands)
+{
+	switch (opcode)
+	{
+		BINARY_OPCODE(OPCODE_ADD, "add", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_AND, "and", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_BREAK, "break", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_BREAKC, "breakc", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_CASE, "case", IMM_UINT, 1);
+		BINARY_OPCODE(OPCODE_CONTINUE, "continue", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_CONTINUEC, "continuec", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_CUT, "cut", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_DEFAULT, "default", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_DERIV_RTX, "deriv_rtx", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_DERIV_RTY, "deriv_rty", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_DISCARD, "discard", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_DIV, "div", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_DP2, "dp2", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_DP3, "dp3", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_DP4, "dp4", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_ELSE, "else", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_EMIT, "emit", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_EMITTHENCUT, "emit_then_cut", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_ENDIF, "endif", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_ENDLOOP, "endloop", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_ENDSWITCH, "endswitch", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_EQ, "eq", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_EXP, "exp", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_FRC, "frc", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_FTOI, "ftoi", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_FTOU, "ftou", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_GE, "ge", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_IADD, "iadd", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_IF, "if", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_IEQ, "ieq", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_IGE, "ige", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_ILT, "ilt", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_IMAD, "imad", IMM_INT, 4);
+		BINARY_OPCODE(OPCODE_IMAX, "imax", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_IMIN, "imin", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_INE, "ine", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_INEG, "ineg", IMM_INT, 2);
+		BINARY_OPCODE(OPCODE_ISHL, "ishl", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_ISHR, "ishr", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_ITOF, "itof", IMM_INT, 2);
+		BINARY_OPCODE(OPCODE_LD, "ld", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_LD_MS, "ldms", IMM_UINT, 4);
+		BINARY_OPCODE(OPCODE_LOG, "log", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_LOOP, "loop", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_LT, "lt", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_MAD, "mad", IMM_FLOAT, 4);
+		BINARY_OPCODE(OPCODE_MIN, "min", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_MAX, "max", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_MOV, "mov", IMM_TYPELESS, 2);
+		BINARY_OPCODE(OPCODE_MOVC, "movc", IMM_TYPELESS, 4);
+		BINARY_OPCODE(OPCODE_MUL, "mul", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_NE, "ne", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_NOP, "nop", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_NOT, "not", IMM_UINT, 2);
+		BINARY_OPCODE(OPCODE_OR, "or", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_RESINFO, "resinfo", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_RET, "ret", IMM_TYPELESS, 0);
+		BINARY_OPCODE(OPCODE_RETC, "retc", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_ROUND_NE, "round_ne", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_ROUND_NI, "round_ni", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_ROUND_PI, "round_pi", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_ROUND_Z, "round_z", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_RSQ, "rsq", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_SAMPLE, "sample", IMM_FLOAT, 4);
+		BINARY_OPCODE(OPCODE_SAMPLE_C_LZ, "sample_c_lz", IMM_FLOAT, 5);
+		BINARY_OPCODE(OPCODE_SAMPLE_L, "sample_l", IMM_FLOAT, 5);
+		BINARY_OPCODE(OPCODE_SAMPLE_D, "sample_d", IMM_FLOAT, 6);
+		BINARY_OPCODE(OPCODE_SAMPLE_B, "sample_b", IMM_FLOAT, 5);
+		BINARY_OPCODE(OPCODE_SQRT, "sqrt", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_SWITCH, "switch", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_SINCOS, "sincos", IMM_FLOAT, 3);
+		BINARY_OPCODE(OPCODE_UDIV, "udiv", IMM_UINT, 4);
+		BINARY_OPCODE(OPCODE_ULT, "ult", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_UGE, "uge", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_UMIN, "umin", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_USHR, "ushr", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_UTOF, "utof", IMM_UINT, 2);
+		BINARY_OPCODE(OPCODE_XOR, "xor", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_LOD, "lod", IMM_FLOAT, 4);
+		BINARY_OPCODE(OPCODE_GATHER4, "gather4", IMM_FLOAT, 4);
+		BINARY_OPCODE(OPCODE_SAMPLE_POS, "samplepos", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_EMIT_STREAM, "emit_stream", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_CUT_STREAM, "cut_stream", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_EMITTHENCUT_STREAM, "emit_then_cut_stream", IMM_TYPELESS, 1);
+		BINARY_OPCODE(OPCODE_DERIV_RTX_COARSE, "deriv_rtx_coarse", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_DERIV_RTX_FINE, "deriv_rtx_fine", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_DERIV_RTY_COARSE, "deriv_rty_coarse", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_DERIV_RTY_FINE, "deriv_rty_fine", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_GATHER4_C, "gather4_c", IMM_FLOAT, 5);
+		BINARY_OPCODE(OPCODE_RCP, "rcp", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_F32TOF16, "f32tof16", IMM_FLOAT, 2);
+		BINARY_OPCODE(OPCODE_F16TOF32, "f16tof32", IMM_UINT, 2);
+		BINARY_OPCODE(OPCODE_COUNTBITS, "countbits", IMM_UINT, 2);
+		BINARY_OPCODE(OPCODE_FIRSTBIT_LO, "firstbit_lo", IMM_UINT, 2);
+		BINARY_OPCODE(OPCODE_UBFE, "ubfe", IMM_UINT, 4);
+		BINARY_OPCODE(OPCODE_BFI, "bfi", IMM_UINT, 5);
+		BINARY_OPCODE(OPCODE_SWAPC, "swapc", IMM_TYPELESS, 5);
+		BINARY_OPCODE(OPCODE_STORE_UAV_TYPED, "store_uav_typed", IMM_TYPELESS, 3);
+		BINARY_OPCODE(OPCODE_LD_RAW, "ld_raw", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_STORE_RAW, "store_raw", IMM_TYPELESS, 3);
+		BINARY_OPCODE(OPCODE_LD_STRUCTURED, "ld_structured", IMM_UINT, 4);
+		BINARY_OPCODE(OPCODE_STORE_STRUCTURED, "store_structured", IMM_TYPELESS, 4);
+		BINARY_OPCODE(OPCODE_ATOMIC_IADD, "atomic_iadd", IMM_INT, 3);
+		BINARY_OPCODE(OPCODE_ATOMIC_UMAX, "atomic_umax", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_ATOMIC_UMIN, "atomic_umin", IMM_UINT, 3);
+		BINARY_OPCODE(OPCODE_IMM_ATOMIC_IADD, "imm_atomic_iadd", IMM_INT, 4);
+		BINARY_OPCODE(OPCODE_SYNC, "sync", IMM_TYPELESS, 0);
+		default:
+			return NULL;
+	}
+}
+
+#undef BINARY_OPCODE
+
+static const char* BinaryResourceDimension(RESOURCE_DIMENSION dim)
+{
+	switch (dim)
+	{
+		case RESOURCE_DIMENSION_BUFFER: return "buffer";
+		case RESOURCE_DIMENSION_TEXTURE1D: return "texture1d";
+		case RESOURCE_DIMENSION_TEXTURE2D: return "texture2d";
+		case RESOURCE_DIMENSION_TEXTURE2DMS: return "texture2dms";
+		case RESOURCE_DIMENSION_TEXTURE3D: return "texture3d";
+		case RESOURCE_DIMENSION_TEXTURECUBE: return "texturecube";
+		case RESOURCE_DIMENSION_TEXTURE1DARRAY: return "texture1darray";
+		case RESOURCE_DIMENSION_TEXTURE2DARRAY: return "texture2darray";
+		case RESOURCE_DIMENSION_TEXTURE2DMSARRAY: return "texture2dmsarray";
+		case RESOURCE_DIMENSION_TEXTURECUBEARRAY: return "texturecubearray";
+		case RESOURCE_DIMENSION_RAW_BUFFER: return "raw_buffer";
+		default: return NULL;
+	}
+}
+
+static const char* BinaryReturnType(RESOURCE_RETURN_TYPE type)
+{
+	switch (type)
+	{
+		case RETURN_TYPE_UNORM: return "unorm";
+		case RETURN_TYPE_SNORM: return "snorm";
+		case RETURN_TYPE_SINT: return "sint";
+		case RETURN_TYPE_UINT: return "uint";
+		case RETURN_TYPE_FLOAT: return "float";
+		case RETURN_TYPE_MIXED: return "mixed";
+		case RETURN_TYPE_DOUBLE: return "double";
+		case RETURN_TYPE_CONTINUED: return "continued";
+		default: return NULL;
+	}
+}
+
+// Append to a fixed size line buffer, failing rather than truncating. Most
+// of a line is register names and small numbers, which are not worth a trip
+// through printf:
+static bool BinaryString(char **pos, char *end, const char *str)
+{
+	while (*str)
+	{
+		if (*pos >= end)
+			return false;
+		*(*pos)++ = *str++;
+	}
+	**pos = 0;
+	return true;
+}
+
+static bool BinaryNumber(char **pos, char *end, uint32_t value)
+{
+	char digits[10];
+	int i = 0;
+
+	do
+	{
+		digits[i++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	if (end - *pos <= i)
+		return false;
+	while (i)
+		*(*pos)++ = digits[--i];
+	**pos = 0;
+	return true;
+}
+
+static bool BinaryAppend(char **pos, char *end, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(*pos, end - *pos, fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || len >= end - *pos)
+		return false;
+	*pos += len;
+	return true;
+}
+
+// Older disassemblers write float literals with %f, newer ones add as many
+// digits as it takes to get the same float back. We only write those that
+// come out the same either way - %f without losing anything - and leave the
+// rest to the text. The CRT also rounds anything with more than 17
+// significant digits differently to glibc, and INF / NAN are spelled
+// differently by every CRT, so we refuse those as well. Integers switch to
+// hex somewhere above 1023 and at or below 0xffff - exactly where has not
+// been seen in any shader, so that range is refused too. Typeless operands
+// get whichever of the two the bit pattern looks more like.
+static bool BinaryImmediate(uint32_t bits, ImmediateFormat immFormat, char **pos, char *end)
+{
+	uint32_t exponent = (bits >> 23) & 0xff;
+	char buf[32];
+	float value;
+
+	memcpy(&value, &bits, sizeof(float));
+
+	switch (immFormat)
+	{
+		case IMM_TYPELESS:
+			if (bits == 0x80000000)
+				return BinaryString(pos, end, "-0.000000");
+			if (exponent == 0 || exponent == 0xff)
+			{
+				if ((int32_t)bits < -1023 || (int32_t)bits > 1023)
+					return false;
+				return BinaryAppend(pos, end, "%d", (int32_t)bits);
+			}
+			// Fall through
+		case IMM_FLOAT:
+			if (exponent == 0xff || fabsf(value) >= 1e17f)
+				return false;
+			// Whole numbers are by far the most common, and always exact:
+			if (value == truncf(value) && fabsf(value) < 16777216.0f)
+			{
+				if (signbit(value) && !BinaryString(pos, end, "-"))
+					return false;
+				return BinaryNumber(pos, end, (uint32_t)fabsf(value)) && BinaryString(pos, end, ".000000");
+			}
+			snprintf(buf, sizeof(buf), "%f", value);
+			if (strtof(buf, NULL) != value)
+				return false;
+			return BinaryString(pos, end, buf);
+		case IMM_INT:
+			if ((int32_t)bits >= -1023 && (int32_t)bits <= 1023)
+				return BinaryAppend(pos, end, "%d", (int32_t)bits);
+			if ((int32_t)bits < 0xffff)
+				return false;
+			return BinaryAppend(pos, end, "0x%08x", bits);
+		case IMM_UINT:
+			if (bits <= 1023)
+				return BinaryNumber(pos, end, bits);
+			if (bits < 0xffff)
+				return false;
+			return BinaryAppend(pos, end, "0x%08x", bits);
+	}
+	return false;
+}
+
+static bool BinaryOperand(const Operand *operand, ImmediateFormat immFormat, char **pos, char *end);
+
+// Writes one dimension of an operand's index, e.g. the 4 or r0.x + 4 in
+// cb0[4] or cb0[r0.x + 4]. A relative index alone is still written with
+// the + 0:
+static bool BinaryIndex(const Operand *operand, int dim, char **pos, char *end)
+{
+	switch (operand->eIndexRep[dim])
+	{
+		case OPERAND_INDEX_IMMEDIATE32:
+			return BinaryNumber(pos, end, operand->aui32ArraySizes[dim]);
+		case OPERAND_INDEX_IMMEDIATE32_PLUS_RELATIVE:
+			if (!operand->psSubOperand[dim] || !BinaryOperand(operand->psSubOperand[dim], IMM_UINT, pos, end))
+				return false;
+			return BinaryString(pos, end, " + ") && BinaryNumber(pos, end, operand->aui32ArraySizes[dim]);
+		case OPERAND_INDEX_RELATIVE:
+			if (!operand->psSubOperand[dim] || !BinaryOperand(operand->psSubOperand[dim], IMM_UINT, pos, end))
+				return false;
+			return BinaryString(pos, end, " + 0");
+		default:
+			return false;
+	}
+}
+
+static bool BinaryOperand(const Operand *operand, ImmediateFormat immFormat, char **pos, char *end)
+{
+	static const char components[] = "xyzw";
+	const uint32_t *imm = (const uint32_t*)operand->afImmediates;
+	const char *prefix = NULL;
+	int i;
+
+	if (operand->eMinPrecision != OPERAND_MIN_PRECISION_DEFAULT)
+		return false;
+
+	switch (operand->eModifier)
+	{
+		case OPERAND_MODIFIER_NONE: break;
+		case OPERAND_MODIFIER_NEG: *(*pos)++ = '-'; break;
+		case OPERAND_MODIFIER_ABS: *(*pos)++ = '|'; break;
+		case OPERAND_MODIFIER_ABSNEG: *(*pos)++ = '-'; *(*pos)++ = '|'; break;
+		default: return false;
+	}
+
+	switch (operand->eType)
+	{
+		case OPERAND_TYPE_TEMP: prefix = "r"; break;
+		case OPERAND_TYPE_INPUT:
+			// Geometry shader inputs are indexed by vertex, e.g. v[0][2]:
+			if (operand->iIndexDims != 2)
+			{
+				prefix = "v";
+				break;
+			}
+			if (!BinaryString(pos, end, "v[") || !BinaryIndex(operand, 0, pos, end) || !BinaryString(pos, end, "][") ||
+			    !BinaryIndex(operand, 1, pos, end) || !BinaryString(pos, end, "]"))
+				return false;
+			break;
+		case OPERAND_TYPE_OUTPUT: prefix = "o"; break;
+		case OPERAND_TYPE_SAMPLER: prefix = "s"; break;
+		case OPERAND_TYPE_RESOURCE: prefix = "t"; break;
+		case OPERAND_TYPE_UNORDERED_ACCESS_VIEW: prefix = "u"; break;
+		case OPERAND_TYPE_THREAD_GROUP_SHARED_MEMORY: prefix = "g"; break;
+		case OPERAND_TYPE_STREAM: prefix = "m"; break;
+		case OPERAND_TYPE_INDEXABLE_TEMP:
+			if (operand->iIndexDims != 2 || operand->eIndexRep[0] != OPERAND_INDEX_IMMEDIATE32)
+				return false;
+			if (!BinaryString(pos, end, "x") || !BinaryNumber(pos, end, operand->aui32ArraySizes[0]) || !BinaryString(pos, end, "[") ||
+			    !BinaryIndex(operand, 1, pos, end) || !BinaryString(pos, end, "]"))
+				return false;
+			break;
+		case OPERAND_TYPE_CONSTANT_BUFFER:
+			if (operand->iIndexDims != 2 || operand->eIndexRep[0] != OPERAND_INDEX_IMMEDIATE32)
+				return false;
+			if (!BinaryString(pos, end, "cb") || !BinaryNumber(pos, end, operand->aui32ArraySizes[0]) || !BinaryString(pos, end, "[") ||
+			    !BinaryIndex(operand, 1, pos, end) || !BinaryString(pos, end, "]"))
+				return false;
+			break;
+		case OPERAND_TYPE_IMMEDIATE_CONSTANT_BUFFER:
+			if (operand->iIndexDims != 1)
+				return false;
+			if (!BinaryString(pos, end, "icb[") || !BinaryIndex(operand, 0, pos, end) || !BinaryString(pos, end, "]"))
+				return false;
+			break;
+		case OPERAND_TYPE_IMMEDIATE32:
+			if (operand->iNumComponents != 1 && operand->iNumComponents != 4)
+				return false;
+			if (!BinaryString(pos, end, "l("))
+				return false;
+			for (i = 0; i < operand->iNumComponents; i++)
+			{
+				if (i && !BinaryString(pos, end, immFormat == IMM_TYPELESS ? "," : ", "))
+					return false;
+				if (!BinaryImmediate(imm[i], immFormat, pos, end))
+					return false;
+			}
+			// The value is the whole operand, no swizzle follows:
+			return BinaryString(pos, end, ")");
+		case OPERAND_TYPE_NULL:
+			return BinaryString(pos, end, "null");
+		case OPERAND_TYPE_INPUT_PRIMITIVEID:
+			return BinaryString(pos, end, "vPrim");
+		case OPERAND_TYPE_OUTPUT_DEPTH:
+			return BinaryString(pos, end, "oDepth");
+		case OPERAND_TYPE_INPUT_THREAD_ID: prefix = "vThreadID"; break;
+		case OPERAND_TYPE_INPUT_THREAD_GROUP_ID: prefix = "vThreadGroupID"; break;
+		case OPERAND_TYPE_INPUT_THREAD_ID_IN_GROUP: prefix = "vThreadIDInGroup"; break;
+		case OPERAND_TYPE_INPUT_THREAD_ID_IN_GROUP_FLATTENED: prefix = "vThreadIDInGroupFlattened"; break;
+		case OPERAND_TYPE_INPUT_GS_INSTANCE_ID: prefix = "vGSInstanceID"; break;
+		case OPERAND_TYPE_INPUT_COVERAGE_MASK: prefix = "vCoverage"; break;
+		case OPERAND_TYPE_OUTPUT_COVERAGE_MASK: prefix = "oMask"; break;
+		default:
+			return false;
+	}
+
+	if (prefix)
+	{
+		if (operand->iIndexDims == 0)
+		{
+			if (!BinaryString(pos, end, prefix))
+				return false;
+		}
+		else
+		{
+			if (operand->iIndexDims != 1 || operand->eIndexRep[0] != OPERAND_INDEX_IMMEDIATE32)
+				return false;
+			if (!BinaryString(pos, end, prefix) || !BinaryNumber(pos, end, operand->ui32RegisterNumber))
+				return false;
+		}
+	}
+
+	if (operand->iNumComponents == 4)
+	{
+		if (!BinaryString(pos, end, "."))
+			return false;
+		switch (operand->eSelMode)
+		{
+			case OPERAND_4_COMPONENT_MASK_MODE:
+				if (!operand->ui32CompMask)
+					return false;
+				for (i = 0; i < 4; i++)
+				{
+					if (operand->ui32CompMask & (1 << i))
+						*(*pos)++ = components[i];
+				}
+				break;
+			case OPERAND_4_COMPONENT_SWIZZLE_MODE:
+				for (i = 0; i < 4; i++)
+					*(*pos)++ = components[operand->aui32Swizzle[i] & 3];
+				break;
+			case OPERAND_4_COMPONENT_SELECT_1_MODE:
+				*(*pos)++ = components[operand->aui32Swizzle[0] & 3];
+				break;
+			default:
+				return false;
+		}
+		**pos = 0;
+	}
+
+	if (operand->eModifier == OPERAND_MODIFIER_ABS || operand->eModifier == OPERAND_MODIFIER_ABSNEG)
+		return BinaryString(pos, end, "|");
+	return true;
+}
+
+// Writes the instruction as the disassembler would, e.g.
+// sample_l_indexable(texture2d)(float,float,float,float) r0.xyzw, v1.xyxx, t0.xyzw, s0, l(0.000000)
+static bool BinaryInstruction(const Instruction *instr, char *line, size_t size)
+{
+	char *pos = line, *end = line + size - 8; // Room for the odd unchecked character
+	ImmediateFormat immFormat;
+	uint32_t numOperands, i;
+	const char *name;
+
+	name = BinaryOpcodeName(instr->eOpcode, &immFormat, &numOperands);
+	if (!name || instr->ui32NumOperands < numOperands)
+		return false;
+
+	if (!BinaryString(&pos, end, name))
+		return false;
+	if (instr->bSaturate && !BinaryString(&pos, end, "_sat"))
+		return false;
+
+	if (instr->eOpcode == OPCODE_SYNC)
+	{
+		if (instr->ui32SyncFlags & SYNC_UNORDERED_ACCESS_VIEW_MEMORY_GLOBAL)
+			BinaryString(&pos, end, "_uglobal");
+		else if (instr->ui32SyncFlags & SYNC_UNORDERED_ACCESS_VIEW_MEMORY_GROUP)
+			BinaryString(&pos, end, "_ugroup");
+		if (instr->ui32SyncFlags & SYNC_THREAD_GROUP_SHARED_MEMORY)
+			BinaryString(&pos, end, "_g");
+		if (instr->ui32SyncFlags & SYNC_THREADS_IN_GROUP)
+			BinaryString(&pos, end, "_t");
+	}
+
+	switch (instr->eOpcode)
+	{
+		case OPCODE_IF:
+		case OPCODE_BREAKC:
+		case OPCODE_CONTINUEC:
+		case OPCODE_RETC:
+		case OPCODE_DISCARD:
+			if (!BinaryString(&pos, end, instr->eBooleanTestType == INSTRUCTION_TEST_NONZERO ? "_nz" : "_z"))
+				return false;
+			break;
+		default:
+			break;
+	}
+
+	// Shader model 5 resource access, e.g.
+	// sample_aoffimmi_indexable(-1,0,0)(texture2d)(float,float,float,float)
+	if (instr->bAddressOffset && !BinaryString(&pos, end, "_aoffimmi"))
+		return false;
+	if (instr->eResDim != RESOURCE_DIMENSION_UNKNOWN && !BinaryString(&pos, end, "_indexable"))
+		return false;
+	if (instr->bAddressOffset)
+	{
+		// 4 bit two's complement:
+		if (!BinaryAppend(&pos, end, "(%d,%d,%d)",
+				((int)instr->iUAddrOffset << 28) >> 28,
+				((int)instr->iVAddrOffset << 28) >> 28,
+				((int)instr->iWAddrOffset << 28) >> 28))
+			return false;
+	}
+	if (instr->eResDim == RESOURCE_DIMENSION_STRUCTURED_BUFFER)
+	{
+		if (!BinaryAppend(&pos, end, "(structured_buffer, stride=%u)", instr->ui32ResDimStructureStride))
+			return false;
+	}
+	else if (instr->eResDim != RESOURCE_DIMENSION_UNKNOWN)
+	{
+		name = BinaryResourceDimension(instr->eResDim);
+		if (!name || !BinaryAppend(&pos, end, "(%s)", name))
+			return false;
+	}
+	if (instr->xType)
+	{
+		const char *x = BinaryReturnType(instr->xType), *y = BinaryReturnType(instr->yType);
+		const char *z = BinaryReturnType(instr->zType), *w = BinaryReturnType(instr->wType);
+		if (!x || !y || !z || !w || !BinaryAppend(&pos, end, "(%s,%s,%s,%s)", x, y, z, w))
+			return false;
+	}
+
+	if (instr->eOpcode == OPCODE_RESINFO)
+	{
+		if (instr->eResInfoReturnType == RESINFO_INSTRUCTION_RETURN_UINT)
+			BinaryString(&pos, end, "_uint");
+		else if (instr->eResInfoReturnType == RESINFO_INSTRUCTION_RETURN_RCPFLOAT)
+			BinaryString(&pos, end, "_rcpfloat");
+	}
+
+	for (i = 0; i < numOperands; i++)
+	{
+		if (!BinaryString(&pos, end, i ? ", " : " "))
+			return false;
+		if (!BinaryOperand(&instr->asOperands[i], immFormat, &pos, end))
+			return false;
+	}
+
+	*pos = 0;
+	return true;
+}
+
 class Decompiler
 {
 public:
@@ -136,34 +694,34 @@ public:
 	CBufferData mCBufferData;
 
 	// Resources.
-	map<string, int> mCBufferNames;
+	StringIntMap mCBufferNames;
 
-	map<int, string> mSamplerNames;
-	map<int, int>    mSamplerNamesArraySize;
-	map<int, string> mSamplerComparisonNames;
-	map<int, int>    mSamplerComparisonNamesArraySize;
+	IntStringMap mSamplerNames;
+	IntIntMap    mSamplerNamesArraySize;
+	IntStringMap mSamplerComparisonNames;
+	IntIntMap    mSamplerComparisonNamesArraySize;
 
-	map<int, string> mTextureNames;
-	map<int, int>    mTextureNamesArraySize;
-	map<int, string> mTextureType;
+	IntStringMap mTextureNames;
+	IntIntMap    mTextureNamesArraySize;
+	IntStringMap mTextureType;
 
-	map<int, string> mUAVNames;
-	map<int, int>    mUAVNamesArraySize;
-	map<int, string> mUAVType;
+	IntStringMap mUAVNames;
+	IntIntMap    mUAVNamesArraySize;
+	IntStringMap mUAVType;
 
-	map<string, string> mStructuredBufferTypes;
-	set<string> mStructuredBufferUsedNames;
+	StringStringMap mStructuredBufferTypes;
+	StringSet mStructuredBufferUsedNames;
 
 	//dx9
-	map<int, string> mUniformNames;
-	map<int, string> mBoolUniformNames;
-	map<int, ConstantValue> mConstantValues;
-	map<int, string> mInputNames;
+	IntStringMap mUniformNames;
+	IntStringMap mBoolUniformNames;
+	SymbolTable<int, ConstantValue> mConstantValues;
+	IntStringMap mInputNames;
 	//dx9
 
 	// Output register tracking.
-	map<string, string> mOutputRegisterValues;
-	map<string, DataType> mOutputRegisterType;
+	StringStringMap mOutputRegisterValues;
+	StringDataTypeMap mOutputRegisterType;
 	string mShaderType;
 	string mSV_Position;
 	bool mUsesProjection;
@@ -172,7 +730,7 @@ public:
 	StringStringMap mCorrectedIndexRegisters;
 	StringStringMap mRemappedOutputRegisters;
 	vector<pair<string, string> > mRemappedInputRegisters;
-	set<string> mBooleanRegisters;
+	StringSet mBooleanRegisters;
 
 	DecompilerSettings *G;
 
@@ -298,9 +856,9 @@ public:
 	// This does also unfortunately create warnings for the TEXCOORD outputs, but
 	// I was unable to find any other way to avoid the fxc packing optimization.
 
-	bool SkipPacking(const char *c, map<string, DataType> inUse)
+	bool SkipPacking(const char *c, const StringDataTypeMap &inUse)
 	{
-		char name[256], mask[16], sysvalue[16], format[16];
+		char name[256], mask[16], sysvalue[16], format[16], registerName[32];
 		int index, reg1, reg2; format[0] = 0; mask[0] = 0;
 		size_t pos = 0;
 
@@ -314,9 +872,11 @@ public:
 
 		// Any v* register already active needs to be skipped, to allow the 
 		// normal packing to succeed.  input:v1.xy + w1.zw. or output:o1.xy + p1.zw
-		if (inUse.find(string("v" + to_string(reg1))) != inUse.end())
+		sprintf(registerName, "v%d", reg1);
+		if (inUse.count(registerName))
 			return false;
-		if (inUse.find(string("o" + to_string(reg1))) != inUse.end())
+		sprintf(registerName, "o%d", reg1);
+		if (inUse.count(registerName))
 			return false;
 
 		// skip pointer in order to parse next line
@@ -364,7 +924,7 @@ public:
 	{
 		string interpolation = "";
 
-		for each(Declaration declaration in shader->asPhase[MAIN_PHASE].ppsDecl[0])
+		for (Declaration &declaration : shader->asPhase[MAIN_PHASE].ppsDecl[0])
 		{
 			if (declaration.eOpcode == OPCODE_DCL_INPUT_PS)
 			{
@@ -422,7 +982,7 @@ public:
 	void ParseInputSignature(Shader *shader, const char *c, size_t size)
 	{
 		// DataType is not used here, just a convenience for calling SkipPacking.
-		map<string, DataType> usedInputRegisters;
+		StringDataTypeMap usedInputRegisters;
 
 		mRemappedInputRegisters.clear();
 		// Write header.  Extra space handles odd case for no input and no output sections.
@@ -473,7 +1033,7 @@ public:
 			char registerName[32];
 			sprintf(registerName, "v%d", slot);
 			string regNameStr = registerName;
-			map<string, DataType>::iterator i = usedInputRegisters.find(regNameStr);
+			StringDataTypeMap::iterator i = usedInputRegisters.find(regNameStr);
 			if (i != usedInputRegisters.end())
 			{
 				sprintf(registerName, "w%d.", slot);
@@ -565,7 +1125,7 @@ public:
 				char registerName[32];
 				sprintf(registerName, "o%d", slot);
 				string regNameStr = registerName;
-				map<string, DataType>::iterator i = mOutputRegisterType.find(regNameStr);
+				StringDataTypeMap::iterator i = mOutputRegisterType.find(regNameStr);
 				if (i != mOutputRegisterType.end())
 				{
 					sprintf(registerName, "p%d.", slot);
@@ -647,7 +1207,7 @@ public:
 			NextLine(c, pos, size);
 		}
 		// Read list.
-		set<string> outputRegister;
+		StringSet outputRegister;
 		while (pos < size)
 		{
 			char name[256], mask[16], format[16], format2[16];
@@ -662,16 +1222,11 @@ public:
 				char registerName[32];
 				sprintf(registerName, "o%d", slot);
 				string regNameStr = registerName;
-				set<string>::iterator i = outputRegister.find(regNameStr);
-				if (i != outputRegister.end())
+				if (!outputRegister.insert(regNameStr))
 				{
 					sprintf(registerName, "p%d", slot);
 					regNameStr = registerName;
 				}
-				else
-				{
-					outputRegister.insert(regNameStr);
-				}
 				// Write.
 				char buffer[256];
 				sprintf(buffer, "  %s = 0;\n", regNameStr.c_str());
@@ -927,9 +1482,9 @@ public:
 				char *escapePos = strchr(name, '['); if (escapePos) *escapePos = '_';
 				escapePos = strchr(name, ']'); if (escapePos) *escapePos = '_';
 				string baseName = string(name);
-				map<int, string> *mNames = &mTextureNames;
-				map<int, int>    *mNamesArraySize = &mTextureNamesArraySize;
-				map<int, string> *mType = &mTextureType;
+				IntStringMap *mNames = &mTextureNames;
+				IntIntMap    *mNamesArraySize = &mTextureNamesArraySize;
+				IntStringMap *mType = &mTextureType;
 				std::string rw;
 
 				if (!strcmp(type, "UAV")) {
@@ -1001,7 +1556,7 @@ public:
 		_snprintf_s(buffer, 256, 256, "\n");
 		mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
 
-		for (map<int, string>::iterator i = mSamplerNames.begin(); i != mSamplerNames.end(); ++i)
+		for (IntStringMap::iterator i = mSamplerNames.begin(); i != mSamplerNames.end(); ++i)
 		{
 			if (mSamplerNamesArraySize[i->first] == 1)
 			{
@@ -1027,7 +1582,7 @@ public:
 				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
 			}
 		}
-		for (map<int, string>::iterator i = mSamplerComparisonNames.begin(); i != mSamplerComparisonNames.end(); ++i)
+		for (IntStringMap::iterator i = mSamplerComparisonNames.begin(); i != mSamplerComparisonNames.end(); ++i)
 		{
 			if (mSamplerComparisonNamesArraySize[i->first] == 1)
 			{
@@ -1053,7 +1608,7 @@ public:
 				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
 			}
 		}
-		for (map<int, string>::iterator i = mTextureNames.begin(); i != mTextureNames.end(); ++i)
+		for (IntStringMap::iterator i = mTextureNames.begin(); i != mTextureNames.end(); ++i)
 		{
 			if (mTextureNamesArraySize[i->first] == 1)
 			{
@@ -1067,7 +1622,7 @@ public:
 				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
 			}
 		}
-		for (map<int, string>::iterator i = mUAVNames.begin(); i != mUAVNames.end(); ++i)
+		for (IntStringMap::iterator i = mUAVNames.begin(); i != mUAVNames.end(); ++i)
 		{
 			if (mUAVNamesArraySize[i->first] == 1)
 			{
@@ -1160,7 +1715,7 @@ public:
 			NextLine(c, pos, size);
 			NextLine(c, pos, size);
 			// Map buffer name to register.
-			map<string, int>::iterator i = mCBufferNames.find(name);
+			StringIntMap::iterator i = mCBufferNames.find(name);
 			if (i == mCBufferNames.end())
 			{
 				logDecompileError("Buffer not found in resource declaration: " + string(name));
@@ -1712,7 +2267,7 @@ public:
 				continue;
 			}
 			mStructuredBufferTypes[bind_name] = type_name;
-			if (!mStructuredBufferUsedNames.insert(type_name).second) {
+			if (!mStructuredBufferUsedNames.insert(type_name)) {
 				// The same type name has been used previously.
 				// Assuming the contents is going to be the same
 				// and skipping redefining it.
@@ -1805,12 +2360,12 @@ public:
 		{
 			// Only integer values?
 			bool isInt = true;
-			for (int i = 0; idx[i] >= 0 && i < 4; ++i)
+			for (int i = 0; i < 4 && idx[i] >= 0; ++i)
 				isInt = isInt && (is_hex[idx[i]] || (floor(args[idx[i]]) == args[idx[i]]));
 			if (isInt && useInt)
 			{
 				sprintf_s(right2, opcodeSize, "int%Id(", pos);
-				for (int i = 0; idx[i] >= 0 && i < 4; ++i) {
+				for (int i = 0; i < 4 && idx[i] >= 0; ++i) {
 					if (is_hex[idx[i]])
 						sprintf_s(right2 + strlen(right2), opcodeSize - strlen(right2), "0x%x,", hex_args[idx[i]]);
 					else
@@ -1822,7 +2377,7 @@ public:
 			else
 			{
 				sprintf_s(right2, opcodeSize, "float%Id(", pos);
-				for (int i = 0; idx[i] >= 0 && i < 4; ++i)
+				for (int i = 0; i < 4 && idx[i] >= 0; ++i)
 					sprintf_s(right2 + strlen(right2), opcodeSize - strlen(right2), "%.9g,", args[idx[i]]);
 				right2[strlen(right2) - 1] = 0;
 				strcat_s(right2, opcodeSize, ")");
@@ -1907,7 +2462,7 @@ public:
 				strcpy(right2, right);
 			else
 			{
-				for (int i = 0; idx[i] >= 0 && i < 4; ++i)
+				for (int i = 0; i < 4 && idx[i] >= 0; ++i)
 					right2[pos++] = strPos[idx[i]];
 				right2[pos] = 0;
 			}
@@ -1937,7 +2492,7 @@ public:
 
 			int index = atoi(&buff[1]);
 
-			std::map<int, string>::iterator it = mUniformNames.find(index);
+			IntStringMap::iterator it = mUniformNames.find(index);
 			if (it != mUniformNames.end())
 			{
 				string temp = right;
@@ -1945,7 +2500,7 @@ public:
 				strcpy_s(buff, opcodeSize, temp.c_str());
 			}
 
-			std::map<int, ConstantValue>::iterator cit = mConstantValues.find(index);
+			SymbolTable<int, ConstantValue>::iterator cit = mConstantValues.find(index);
 			if (cit != mConstantValues.end())
 			{
 
@@ -2013,7 +2568,7 @@ public:
 				strcpy(right2, right);
 			else
 			{
-				for (int i = 0; idx[i] >= 0 && i < 4; ++i)
+				for (int i = 0; i < 4 && idx[i] >= 0; ++i)
 					right2[pos++] = strPos[idx[i]];
 				right2[pos] = 0;
 			}
@@ -2298,98 +2853,153 @@ public:
 			strcpy(op1, op2); strcpy(op2, op3); strcpy(op3, op4); strcpy(op4, op5); strcpy(op5, op6); strcpy(op6, op7); strcpy(op7, op8); strcpy(op8, op9); strcpy(op9, op10); strcpy(op10, op11); strcpy(op11, op12);
 		}
 
-		// Was previously a subroutine to CollectBrackets, but generated a lot of warnings, so putting it inline allows
-		// the automatic CRT_SECURE macros to find the sizes.
-		//  CollectBrackets(op1, op2, op3, op4, op5, op6, op7, op8, op9, op10, op11, op12, op13, op14, op15);
+		CollectBrackets();
+		return numRead;
+	}
+
+	// Merges the operands that the disassembler wrote with spaces in them back
+	// into one, e.g. l(1.000000, 0, 0, 0) and cb0[r0.x + 4].xyzw. Shared with
+	// the binary front end, which splits its operands up the same way.
+	// Was previously a subroutine taking the opN arrays as pointers, but
+	// generated a lot of warnings, so working on the members directly allows
+	// the automatic CRT_SECURE macros to find the sizes.
+	void CollectBrackets()
+	{
+		if (!strncmp(op1, "l(", 2) && op1[strlen(op1) - 1] != ')' && op1[strlen(op1) - 2] != ')')
 		{
-			if (!strncmp(op1, "l(", 2) && op1[strlen(op1) - 1] != ')' && op1[strlen(op1) - 2] != ')')
-			{
-				strcat(op1, " "); strcat(op1, op2);
-				strcat(op1, " "); strcat(op1, op3);
-				strcat(op1, " "); strcat(op1, op4);
-				strcpy(op2, op5); strcpy(op3, op6); strcpy(op4, op7); strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12); strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
-				op13[0] = 0; op14[0] = 0; op15[0] = 0;
-			}
-			if (!strncmp(op2, "l(", 2) && op2[strlen(op2) - 1] != ')' && op2[strlen(op2) - 2] != ')')
-			{
-				strcat(op2, " "); strcat(op2, op3);
-				strcat(op2, " "); strcat(op2, op4);
-				strcat(op2, " "); strcat(op2, op5);
-				strcpy(op3, op6); strcpy(op4, op7); strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
-				op13[0] = 0; op14[0] = 0; op15[0] = 0;
-			}
-			if (!strncmp(op3, "l(", 2) && op3[strlen(op3) - 1] != ')' && op3[strlen(op3) - 2] != ')')
-			{
-				strcat(op3, " "); strcat(op3, op4);
-				strcat(op3, " "); strcat(op3, op5);
-				strcat(op3, " "); strcat(op3, op6);
-				strcpy(op4, op7); strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
-				op13[0] = 0; op14[0] = 0; op15[0] = 0;
-			}
-			if (!strncmp(op4, "l(", 2) && op4[strlen(op4) - 1] != ')' && op4[strlen(op4) - 2] != ')')
-			{
-				strcat(op4, " "); strcat(op4, op5);
-				strcat(op4, " "); strcat(op4, op6);
-				strcat(op4, " "); strcat(op4, op7);
-				strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
-				op13[0] = 0; op14[0] = 0; op15[0] = 0;
-			}
-			if (!strncmp(op5, "l(", 2) && op5[strlen(op5) - 1] != ')' && op5[strlen(op5) - 2] != ')')
-			{
-				strcat(op5, " "); strcat(op5, op6);
-				strcat(op5, " "); strcat(op5, op7);
-				strcat(op5, " "); strcat(op5, op8);
-				strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
-				op13[0] = 0; op14[0] = 0; op15[0] = 0;
-			}
-			if (!strncmp(op6, "l(", 2) && op6[strlen(op6) - 1] != ')' && op6[strlen(op6) - 2] != ')')
-			{
-				strcat(op6, " "); strcat(op6, op7);
-				strcat(op6, " "); strcat(op6, op8);
-				strcat(op6, " "); strcat(op6, op9);
-				strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
-				op13[0] = 0; op14[0] = 0; op15[0] = 0;
-			}
-			if (!strncmp(op7, "l(", 2) && op7[strlen(op7) - 1] != ')' && op7[strlen(op7) - 2] != ')')
-			{
-				strcat(op7, " "); strcat(op7, op8);
-				strcat(op7, " "); strcat(op7, op9);
-				strcat(op7, " "); strcat(op7, op10);
-				strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
-				op13[0] = 0; op14[0] = 0; op15[0] = 0;
-			}
-			while (!strcmp(op2, "+"))
-			{
-				strcat(op1, op2); strcat(op1, op3);
-				strcpy(op2, op4); strcpy(op3, op5); strcpy(op4, op6); strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
-				op14[0] = 0; op15[0] = 0;
-			}
-			while (!strcmp(op3, "+"))
-			{
-				strcat(op2, op3); strcat(op2, op4);
-				strcpy(op3, op5); strcpy(op4, op6); strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12);  strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
-				op14[0] = 0; op15[0] = 0;
-			}
-			while (!strcmp(op4, "+"))
-			{
-				strcat(op3, op4); strcat(op3, op5);
-				strcpy(op4, op6); strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
-				op14[0] = 0; op15[0] = 0;
-			}
-			while (!strcmp(op5, "+"))
-			{
-				strcat(op4, op5); strcat(op4, op6);
-				strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
-				op14[0] = 0; op15[0] = 0;
-			}
-			while (!strcmp(op6, "+"))
+			strcat(op1, " "); strcat(op1, op2);
+			strcat(op1, " "); strcat(op1, op3);
+			strcat(op1, " "); strcat(op1, op4);
+			strcpy(op2, op5); strcpy(op3, op6); strcpy(op4, op7); strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12); strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
+			op13[0] = 0; op14[0] = 0; op15[0] = 0;
+		}
+		if (!strncmp(op2, "l(", 2) && op2[strlen(op2) - 1] != ')' && op2[strlen(op2) - 2] != ')')
+		{
+			strcat(op2, " "); strcat(op2, op3);
+			strcat(op2, " "); strcat(op2, op4);
+			strcat(op2, " "); strcat(op2, op5);
+			strcpy(op3, op6); strcpy(op4, op7); strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
+			op13[0] = 0; op14[0] = 0; op15[0] = 0;
+		}
+		if (!strncmp(op3, "l(", 2) && op3[strlen(op3) - 1] != ')' && op3[strlen(op3) - 2] != ')')
+		{
+			strcat(op3, " "); strcat(op3, op4);
+			strcat(op3, " "); strcat(op3, op5);
+			strcat(op3, " "); strcat(op3, op6);
+			strcpy(op4, op7); strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
+			op13[0] = 0; op14[0] = 0; op15[0] = 0;
+		}
+		if (!strncmp(op4, "l(", 2) && op4[strlen(op4) - 1] != ')' && op4[strlen(op4) - 2] != ')')
+		{
+			strcat(op4, " "); strcat(op4, op5);
+			strcat(op4, " "); strcat(op4, op6);
+			strcat(op4, " "); strcat(op4, op7);
+			strcpy(op5, op8); strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
+			op13[0] = 0; op14[0] = 0; op15[0] = 0;
+		}
+		if (!strncmp(op5, "l(", 2) && op5[strlen(op5) - 1] != ')' && op5[strlen(op5) - 2] != ')')
+		{
+			strcat(op5, " "); strcat(op5, op6);
+			strcat(op5, " "); strcat(op5, op7);
+			strcat(op5, " "); strcat(op5, op8);
+			strcpy(op6, op9); strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
+			op13[0] = 0; op14[0] = 0; op15[0] = 0;
+		}
+		if (!strncmp(op6, "l(", 2) && op6[strlen(op6) - 1] != ')' && op6[strlen(op6) - 2] != ')')
+		{
+			strcat(op6, " "); strcat(op6, op7);
+			strcat(op6, " "); strcat(op6, op8);
+			strcat(op6, " "); strcat(op6, op9);
+			strcpy(op7, op10); strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
+			op13[0] = 0; op14[0] = 0; op15[0] = 0;
+		}
+		if (!strncmp(op7, "l(", 2) && op7[strlen(op7) - 1] != ')' && op7[strlen(op7) - 2] != ')')
+		{
+			strcat(op7, " "); strcat(op7, op8);
+			strcat(op7, " "); strcat(op7, op9);
+			strcat(op7, " "); strcat(op7, op10);
+			strcpy(op8, op11); strcpy(op9, op12);  strcpy(op10, op13); strcpy(op11, op14); strcpy(op12, op15);
+			op13[0] = 0; op14[0] = 0; op15[0] = 0;
+		}
+		while (!strcmp(op2, "+"))
+		{
+			strcat(op1, op2); strcat(op1, op3);
+			strcpy(op2, op4); strcpy(op3, op5); strcpy(op4, op6); strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
+			op14[0] = 0; op15[0] = 0;
+		}
+		while (!strcmp(op3, "+"))
+		{
+			strcat(op2, op3); strcat(op2, op4);
+			strcpy(op3, op5); strcpy(op4, op6); strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12);  strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
+			op14[0] = 0; op15[0] = 0;
+		}
+		while (!strcmp(op4, "+"))
+		{
+			strcat(op3, op4); strcat(op3, op5);
+			strcpy(op4, op6); strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
+			op14[0] = 0; op15[0] = 0;
+		}
+		while (!strcmp(op5, "+"))
+		{
+			strcat(op4, op5); strcat(op4, op6);
+			strcpy(op5, op7); strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
+			op14[0] = 0; op15[0] = 0;
+		}
+		while (!strcmp(op6, "+"))
+		{
+			strcat(op5, op6); strcat(op5, op7);
+			strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
+			op14[0] = 0; op15[0] = 0;
+		}
+	}
+
+	// Binary front end equivalent of ReadStatement, filling in the statement
+	// and operands from the decoded instruction instead of the line of
+	// disassembly at pos. Returns false if the instruction is not one that
+	// BinaryInstruction is sure about, or if it does not match the statement
+	// on the line it is paired with, in which case ReadStatement must be used.
+	bool FormatStatement(const char *pos, const Instruction *instr)
+	{
+		char *tokens[] = { statement, op1, op2, op3, op4, op5, op6, op7, op8, op9, op10, op11, op12, op13, op14, op15 };
+		size_t sizes[] = { sizeof(statement), opcodeSize, opcodeSize, opcodeSize, opcodeSize, opcodeSize, opcodeSize,
+			opcodeSize, opcodeSize, opcodeSize, opcodeSize, opcodeSize, opcodeSize, opcodeSize, opcodeSize, opcodeSize };
+		char lineBuffer[256];
+		char *token, *next;
+		size_t i, len;
+
+		if (!instr || !BinaryInstruction(instr, lineBuffer, sizeof(lineBuffer)))
+			return false;
+		// ReadStatement only ever looks at the first 255 characters:
+		if (strlen(lineBuffer) >= 255)
+			return false;
+
+		// Sanity check that we are still paired up with the right line:
+		while (*pos == ' ' || *pos == '\t')
+			pos++;
+		len = strcspn(lineBuffer, " ");
+		if (strncmp(pos, lineBuffer, len) || (pos[len] != ' ' && pos[len] != '\n' && pos[len] != '\r' && pos[len] != 0))
+			return false;
+
+		for (i = 0, token = lineBuffer; i < UCOUNTOF(tokens); i++)
+		{
+			if (!token)
 			{
-				strcat(op5, op6); strcat(op5, op7);
-				strcpy(op6, op8); strcpy(op7, op9); strcpy(op8, op10); strcpy(op9, op11); strcpy(op10, op12); strcpy(op11, op13); strcpy(op12, op14); strcpy(op13, op15);
-				op14[0] = 0; op15[0] = 0;
+				tokens[i][0] = 0;
+				continue;
 			}
+			next = strchr(token, ' ');
+			if (next)
+				*next++ = 0;
+			if (strlen(token) >= sizes[i])
+				return false;
+			strcpy_s(tokens[i], sizes[i], token);
+			token = next;
 		}
-		return numRead;
+		if (token)
+			return false;
+
+		CollectBrackets();
+		return true;
 	}
 
 	string replaceInt(string input)
@@ -2772,43 +3382,66 @@ public:
 	//  is intended to fix the problems we see where the assembly is using the -1 numerically
 	//  and not as a boolean.  The helper is now just a macro "#define cmp -" to negate.
 
+	// The boolean registers are tracked per component, e.g. r0.x and r0.y
+	// for r0.xy. Splits an operand into the register name and its swizzle,
+	// leaving room after the name to append each component in turn:
+	static bool splitBoolean(const char *arg, char *reg, size_t size, const char **components)
+	{
+		const char *op = (arg[0] == '-') ? arg + 1 : arg;
+		const char *dot = strchr(op, '.');
+		size_t len = dot ? dot - op : strlen(op);
+
+		if (len + 3 > size)
+			return false;
+		memcpy(reg, op, len);
+		reg[len] = 0;
+		*components = dot ? dot + 1 : NULL;
+		return true;
+	}
+
 	void addBoolean(char *arg)
 	{
-		string op = (arg[0] == '-') ? arg + 1 : arg;
-		size_t dotspot = op.find('.');
-		if (dotspot == string::npos)
+		char reg[opcodeSize];
+		const char *components;
+
+		if (!splitBoolean(arg, reg, sizeof(reg), &components))
+			return;
+		if (!components)
 		{
-			mBooleanRegisters.insert(op);
+			mBooleanRegisters.insert(reg);
 			return;
 		}
 
-		string reg = op.substr(0, dotspot);
-		for (size_t i = dotspot + 1; i < op.length(); i++)
+		size_t len = strlen(reg);
+		reg[len] = '.';
+		reg[len + 2] = 0;
+		for (; *components; components++)
 		{
-			mBooleanRegisters.insert(reg + '.' + op[i]);
+			reg[len + 1] = *components;
+			mBooleanRegisters.insert(reg);
 		}
 	}
 
 	bool isBoolean(char *arg)
 	{
+		char reg[opcodeSize];
+		const char *components;
+
 		if (mBooleanRegisters.empty())
 			return false;
 
-		string op = (arg[0] == '-') ? arg + 1 : arg;
-		size_t dotspot = op.find('.');
-		string operand;
-
-		if (dotspot == string::npos)
-		{
-			set<string>::iterator i = mBooleanRegisters.find(op);
-			return i != mBooleanRegisters.end();
-		}
+		if (!splitBoolean(arg, reg, sizeof(reg), &components))
+			return false;
+		if (!components)
+			return mBooleanRegisters.count(reg) != 0;
 
-		string reg = op.substr(0, dotspot);
-		for (size_t i = dotspot + 1; i < op.length(); i++)
+		size_t len = strlen(reg);
+		reg[len] = '.';
+		reg[len + 2] = 0;
+		for (; *components; components++)
 		{
-			set<string>::iterator j = mBooleanRegisters.find(reg + '.' + op[i]);
-			if (j != mBooleanRegisters.end())
+			reg[len + 1] = *components;
+			if (mBooleanRegisters.count(reg))
 				return true;									// Any single component found qualifies
 		}
 
@@ -2817,21 +3450,27 @@ public:
 
 	void removeBoolean(char *arg)
 	{
+		char reg[opcodeSize];
+		const char *components;
+
 		if (mBooleanRegisters.empty())
 			return;
 
-		string op = arg[0] == '-' ? arg + 1 : arg;
-		size_t dotspot = op.find('.');
-		if (dotspot == string::npos)
+		if (!splitBoolean(arg, reg, sizeof(reg), &components))
+			return;
+		if (!components)
 		{
-			mBooleanRegisters.erase(op);
+			mBooleanRegisters.erase(reg);
 			return;
 		}
 
-		string reg = op.substr(0, dotspot);
-		for (size_t i = dotspot + 1; i < op.length(); i++)
+		size_t len = strlen(reg);
+		reg[len] = '.';
+		reg[len + 2] = 0;
+		for (; *components; components++)
 		{
-			mBooleanRegisters.erase(reg + '.' + op[i]);
+			reg[len + 1] = *components;
+			mBooleanRegisters.erase(reg);
 		}
 	}
 
@@ -2942,19 +3581,19 @@ public:
 			// Process copies of SV_Position.
 			if (!isMono && G->fixSvPosition && mUsesProjection && !mSV_Position.empty())
 			{
-				map<string, string>::iterator positionValue = mOutputRegisterValues.find(mSV_Position);
+				StringStringMap::iterator positionValue = mOutputRegisterValues.find(mSV_Position);
 				if (positionValue != mOutputRegisterValues.end())
 				{
 					size_t dotPos = positionValue->second.rfind('.');
 					string rvalue = positionValue->second;
 					if (dotPos > 0) rvalue = positionValue->second.substr(0, dotPos);
 					// Search for same value on other outputs.
-					for (map<string, string>::iterator i = mOutputRegisterValues.begin(); i != mOutputRegisterValues.end(); ++i)
+					for (StringStringMap::iterator i = mOutputRegisterValues.begin(); i != mOutputRegisterValues.end(); ++i)
 					{
 						// Ignore main output register
 						if (!i->first.compare(mSV_Position)) continue;
 						// Check for float 4 type.
-						map<string, DataType>::iterator dataType = mOutputRegisterType.find(i->first);
+						StringDataTypeMap::iterator dataType = mOutputRegisterType.find(i->first);
 						if (dataType == mOutputRegisterType.end() || dataType->second != DT_float4)
 							continue;
 						dotPos = i->second.rfind('.');
@@ -3000,7 +3639,7 @@ public:
 		{
 			// Search for depth texture.
 			bool wposAvailable = false;
-			map<int, string>::iterator depthTexture;
+			IntStringMap::iterator depthTexture;
 			for (depthTexture = mTextureNames.begin(); depthTexture != mTextureNames.end(); ++depthTexture)
 			{
 				if (depthTexture->second == G->ZRepair_DepthTexture1)
@@ -3156,7 +3795,7 @@ public:
 			// Search for position texture.
 			if (!wposAvailable)
 			{
-				map<int, string>::iterator positionTexture;
+				IntStringMap::iterator positionTexture;
 				for (positionTexture = mTextureNames.begin(); positionTexture != mTextureNames.end(); ++positionTexture)
 				{
 					if (positionTexture->second == G->ZRepair_PositionTexture)
@@ -3685,7 +4324,7 @@ public:
 
 		if (group != (ResourceGroup)-1 && GetResourceFromBindingPoint(group, texture->ui32RegisterNumber, shader->sInfo, &bindInfo))
 		{
-			map<string, string>::iterator struct_type_i;
+			StringStringMap::iterator struct_type_i;
 
 			struct_type_i = mStructuredBufferTypes.find(bindInfo->Name);
 			if (struct_type_i == mStructuredBufferTypes.end()) {
@@ -3695,7 +4334,7 @@ public:
 				return false;
 			}
 
-			if (mStructuredBufferUsedNames.find(struct_type_i->second) != mStructuredBufferUsedNames.end())
+			if (mStructuredBufferUsedNames.count(struct_type_i->second))
 			{
 				int swiz_offset = 0;
 
@@ -4069,6 +4708,11 @@ public:
 		vector<Instruction> *instructions = &shader->asPhase[MAIN_PHASE].ppsInst[0];
 		size_t inst_count = instructions->size();
 
+		// Hull shaders have their phases' instructions split up in a way
+		// that does not line up one to one with the disassembly, so they
+		// always read the text:
+		bool binaryFrontEnd = G->binaryFrontEnd && !shader->dx9Shader && shader->eShaderType != HULL_SHADER;
+
 		while (pos < size && iNr < inst_count)
 		{
 			Instruction *instr = &(*instructions)[iNr];
@@ -4095,8 +4739,10 @@ public:
 				NextLine(c, pos, size);
 				continue;
 			}
-			// Read statement.
-			if (ReadStatement(c + pos) < 1)
+			// Read statement. Declarations are not in the instruction list,
+			// so there's no point asking the binary front end about those.
+			bool formatted = binaryFrontEnd && strncmp(c + pos, "dcl_", 4) && FormatStatement(c + pos, instr);
+			if (!formatted && ReadStatement(c + pos) < 1)
 			{
 				logDecompileError("Error parsing statement: " + string(c + pos, 80));
 				return;
@@ -4293,7 +4939,7 @@ public:
 					}
 					if (!strcmp(op2, "mode_default"))
 					{
-						map<int, string>::iterator i = mSamplerNames.find(bufIndex);
+						IntStringMap::iterator i = mSamplerNames.find(bufIndex);
 						if (i == mSamplerNames.end())
 						{
 							sprintf(buffer, "s%d_s", bufIndex);
@@ -4305,7 +4951,7 @@ public:
 					}
 					else if (!strcmp(op2, "mode_comparison"))
 					{
-						map<int, string>::iterator i = mSamplerComparisonNames.find(bufIndex);
+						IntStringMap::iterator i = mSamplerComparisonNames.find(bufIndex);
 						if (i == mSamplerComparisonNames.end())
 						{
 							sprintf(buffer, "s%d_s", bufIndex);
@@ -4341,7 +4987,7 @@ public:
 						return;
 					}
 					// Create if not existing.  e.g. if no ResourceBinding section in ASM.
-					map<int, string>::iterator i = mTextureNames.find(bufIndex);
+					IntStringMap::iterator i = mTextureNames.find(bufIndex);
 					if (i == mTextureNames.end())
 					{
 						CreateRawFormat("Texture2D", bufIndex);
@@ -4359,7 +5005,7 @@ public:
 						return;
 					}
 					// Create if not existing.   e.g. if no ResourceBinding section in ASM.
-					map<int, string>::iterator i = mTextureNames.find(bufIndex);
+					IntStringMap::iterator i = mTextureNames.find(bufIndex);
 					if (i == mTextureNames.end())
 					{
 						CreateRawFormat("Texture2DArray", bufIndex);
@@ -4383,7 +5029,7 @@ public:
 						return;
 					}
 					// Create if not existing.   e.g. if no ResourceBinding section in ASM.  Might need <f,x> variant for texturetype.
-					map<int, string>::iterator i = mTextureNames.find(bufIndex);
+					IntStringMap::iterator i = mTextureNames.find(bufIndex);
 					if (i == mTextureNames.end())
 					{
 						sprintf(buffer, "t%d", bufIndex);
@@ -4414,7 +5060,7 @@ public:
 						return;
 					}
 					// Create if not existing.  e.g. if no ResourceBinding section in ASM.
-					map<int, string>::iterator i = mTextureNames.find(bufIndex);
+					IntStringMap::iterator i = mTextureNames.find(bufIndex);
 					if (i == mTextureNames.end())
 					{
 						CreateRawFormat("Texture3D", bufIndex);
@@ -4432,7 +5078,7 @@ public:
 						return;
 					}
 					// Create if not existing.  e.g. if no ResourceBinding section in ASM.
-					map<int, string>::iterator i = mTextureNames.find(bufIndex);
+					IntStringMap::iterator i = mTextureNames.find(bufIndex);
 					if (i == mTextureNames.end())
 					{
 						CreateRawFormat("TextureCube", bufIndex);
@@ -4450,7 +5096,7 @@ public:
 						return;
 					}
 					// Create if not existing.  e.g. if no ResourceBinding section in ASM.
-					map<int, string>::iterator i = mTextureNames.find(bufIndex);
+					IntStringMap::iterator i = mTextureNames.find(bufIndex);
 					if (i == mTextureNames.end())
 					{
 						CreateRawFormat("TextureCubeArray", bufIndex);
@@ -4468,7 +5114,7 @@ public:
 						return;
 					}
 					// Create if not existing.  e.g. if no ResourceBinding section in ASM.
-					map<int, string>::iterator i = mTextureNames.find(bufIndex);
+					IntStringMap::iterator i = mTextureNames.find(bufIndex);
 					if (i == mTextureNames.end())
 					{
 						CreateRawFormat("Buffer", bufIndex);
@@ -6412,10 +7058,8 @@ public:
 						Operand texture = instr->asOperands[2];
 						RESINFO_RETURN_TYPE returnType = instr->eResInfoReturnType;
 						int texReg = texture.ui32RegisterNumber;
-						ResourceBinding bindInfo;
+						ResourceBinding bindInfo = {};
 						ResourceBinding *bindInfoPtr = &bindInfo;
-
-						memset(&bindInfo, 0, sizeof(bindInfo));
 						int bindstate = GetResourceFromBindingPoint(RGROUP_TEXTURE, texReg, shader->sInfo, &bindInfoPtr);
 						bool bindStripped = (bindstate == 0);
 
@@ -6770,8 +7414,56 @@ public:
 	}
 };
 
-const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred)
+const char *DecompilerPhaseNames[NUM_DECOMPILER_PHASES] = {
+	"decode",
+	"resources",
+	"signatures",
+	"code",
+	"header",
+};
+
+// Adds the time from one call to next() to the next onto the phase that was
+// running, or does nothing at all if there are no timings to add to:
+class DecompilerPhaseTimer
+{
+	DecompilerTimings *timings;
+	int phase;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	DecompilerPhaseTimer(DecompilerTimings *timings) :
+		timings(timings),
+		phase(-1)
+	{}
+
+	~DecompilerPhaseTimer()
+	{
+		stop();
+	}
+
+	void next(DecompilerPhase next_phase)
+	{
+		if (!timings)
+			return;
+		stop();
+		phase = next_phase;
+		start = std::chrono::steady_clock::now();
+	}
+
+	void stop()
+	{
+		if (phase < 0)
+			return;
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		timings->ms[phase] += elapsed.count();
+		phase = -1;
+	}
+};
+
+const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred,
+	DecompilerTimings *timings)
 {
+	DecompilerPhaseTimer timer(timings);
 	Decompiler d;
 
 	d.mCodeStartPos = 0;
@@ -6794,9 +7486,11 @@ const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::st
 	// The termination handler approach does not catch those errors either.
 	try
 	{
+		timer.next(DECOMPILER_PHASE_DECODE);
 		Shader *shader = DecodeDXBC((uint32_t*)params.bytecode);
 		if (!shader) return string();
 
+		timer.next(DECOMPILER_PHASE_RESOURCES);
 		if (shader->dx9Shader)
 		{
 			d.ReadResourceBindingsDX9(params.decompiled, params.decompiledSize);
@@ -6810,8 +7504,10 @@ const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::st
 		d.ParseBufferDefinitions(shader, params.decompiled, params.decompiledSize);
 		d.WriteResourceDefinitions();
 		d.WriteAddOnDeclarations();
+		timer.next(DECOMPILER_PHASE_SIGNATURES);
 		d.ParseInputSignature(shader, params.decompiled, params.decompiledSize);
 		d.ParseOutputSignature(params.decompiled, params.decompiledSize);
+		timer.next(DECOMPILER_PHASE_CODE);
 		if (!params.ZeroOutput)
 		{
 			d.ParseCode(shader, params.decompiled, params.decompiledSize);
@@ -6822,7 +7518,9 @@ const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::st
 			d.WriteZeroOutputSignature(params.decompiled, params.decompiledSize);
 		}
 		d.mOutput.push_back('}');
+		timer.next(DECOMPILER_PHASE_HEADER);
 		d.WriteHeaderDeclarations();
+		timer.stop();
 
 		shaderModel = d.mShaderType;
 		errorOccurred = d.mErrorOccurred;
@@ -6840,3 +7538,68 @@ const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::st
 		return string();
 	}
 }
+
+uint32_t DecompilerVersion()
+{
+	return (VERSION_MAJOR << 24) | (VERSION_MINOR << 16) | (VERSION_REVISION << 8) | DECOMPILER_REVISION;
+}
+
+// FNV-1a, run over each setting in turn. Strings are hashed along with their
+// terminator so that moving characters from one to the next changes the hash:
+static void HashSetting(uint32_t *hash, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char*)data;
+
+	for (size_t i = 0; i < size; i++)
+		*hash = (*hash ^ p[i]) * 16777619u;
+}
+
+static void HashSetting(uint32_t *hash, const string &value)
+{
+	HashSetting(hash, value.c_str(), value.size() + 1);
+}
+
+static void HashSetting(uint32_t *hash, const vector<string> &values)
+{
+	uint32_t count = (uint32_t)values.size();
+
+	HashSetting(hash, &count, sizeof(count));
+	for (const string &value : values)
+		HashSetting(hash, value);
+}
+
+uint32_t DecompilerSettingsHash(const DecompilerSettings &settings)
+{
+	uint32_t hash = 2166136261u;
+	unsigned char flags[] = {
+		settings.fixSvPosition,
+		settings.recompileVs,
+		settings.binaryFrontEnd,
+		settings.ZRepair_DepthBuffer,
+		(unsigned char)settings.ZRepair_DepthTextureReg1,
+		(unsigned char)settings.ZRepair_DepthTextureReg2,
+	};
+
+	HashSetting(&hash, &settings.StereoParamsReg, sizeof(settings.StereoParamsReg));
+	HashSetting(&hash, &settings.IniParamsReg, sizeof(settings.IniParamsReg));
+	HashSetting(&hash, flags, sizeof(flags));
+	HashSetting(&hash, settings.ZRepair_DepthTexture1);
+	HashSetting(&hash, settings.ZRepair_DepthTexture2);
+	HashSetting(&hash, settings.ZRepair_Dependencies1);
+	HashSetting(&hash, settings.ZRepair_Dependencies2);
+	HashSetting(&hash, settings.ZRepair_ZPosCalc1);
+	HashSetting(&hash, settings.ZRepair_ZPosCalc2);
+	HashSetting(&hash, settings.ZRepair_PositionTexture);
+	HashSetting(&hash, settings.InvTransforms);
+	HashSetting(&hash, settings.ZRepair_WorldPosCalc);
+	HashSetting(&hash, settings.BackProject_Vector1);
+	HashSetting(&hash, settings.BackProject_Vector2);
+	HashSetting(&hash, settings.ObjectPos_ID1);
+	HashSetting(&hash, settings.ObjectPos_ID2);
+	HashSetting(&hash, settings.ObjectPos_MUL1);
+	HashSetting(&hash, settings.ObjectPos_MUL2);
+	HashSetting(&hash, settings.MatrixPos_ID1);
+	HashSetting(&hash, settings.MatrixPos_MUL1);
+
+	return hash;
+}
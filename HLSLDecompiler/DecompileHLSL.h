@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -19,6 +20,10 @@ struct DecompilerSettings
 
 	bool fixSvPosition;
 	bool recompileVs;
+	// Read each instruction straight from the decoded bytecode rather than
+	// parsing it back out of the disassembly, falling back to the text for
+	// anything it is unsure about. Generated HLSL is meant to be identical.
+	bool binaryFrontEnd;
 	char ZRepair_DepthTextureReg1, ZRepair_DepthTextureReg2;
 	std::string ZRepair_DepthTexture1, ZRepair_DepthTexture2;
 	std::vector<std::string> ZRepair_Dependencies1, ZRepair_Dependencies2;
@@ -36,6 +41,7 @@ struct DecompilerSettings
 		IniParamsReg(-1),
 		fixSvPosition(false),
 		recompileVs(false),
+		binaryFrontEnd(false),
 		ZRepair_DepthTextureReg1('\0'),
 		ZRepair_DepthTextureReg2('\0'),
 		ZRepair_DepthBuffer(false)
@@ -57,4 +63,37 @@ struct ParseParameters
 	DecompilerSettings *G;
 };
 
-const std::string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred);
+// Phases of DecompileBinaryHLSL, which adds the time it spends in each to the
+// DecompilerTimings it is passed, if any:
+enum DecompilerPhase
+{
+	DECOMPILER_PHASE_DECODE,	// DecodeDXBC
+	DECOMPILER_PHASE_RESOURCES,	// Structures, resource bindings and constant buffers
+	DECOMPILER_PHASE_SIGNATURES,	// Input and output signatures
+	DECOMPILER_PHASE_CODE,		// Instructions
+	DECOMPILER_PHASE_HEADER,	// Declarations inserted ahead of the code
+	NUM_DECOMPILER_PHASES
+};
+
+extern const char *DecompilerPhaseNames[NUM_DECOMPILER_PHASES];
+
+struct DecompilerTimings
+{
+	double ms[NUM_DECOMPILER_PHASES];
+
+	DecompilerTimings() : ms() {}
+};
+
+const std::string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred,
+	DecompilerTimings *timings = NULL);
+
+// Bump this for any change to the decompiler that changes its output, so that
+// output cached by an older build is not reused. The 3DMigoto version the
+// output is stamped with is folded into DecompilerVersion() as well, so this
+// only needs to change between releases.
+#define DECOMPILER_REVISION 1
+
+uint32_t DecompilerVersion();
+
+// Hash of every setting that can change the decompiler's output:
+uint32_t DecompilerSettingsHash(const DecompilerSettings &settings);
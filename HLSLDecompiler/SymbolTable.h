@@ -0,0 +1,336 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Flat, open addressed replacements for the std::map and std::set symbol
+// tables the decompiler keeps for registers, resources and constant buffer
+// entries. They are looked up for nearly every operand of every instruction,
+// and a std::map walks a tree of separately allocated nodes comparing whole
+// strings at every level to do that.
+//
+// Entries are kept together in one vector with a parallel vector of their
+// hashes, and the slots only hold indices into those, so growing the table
+// never has to hash a key again and a probe only compares keys whose hashes
+// already match. String keys can be looked up with a plain char* so that a
+// register name pulled out of a statement need not be copied into a
+// std::string first.
+//
+// Iterating one visits the entries in key order, just as the std::map did,
+// since that decides the order of declarations in the generated HLSL. The
+// entries are only sorted when begin() is called after something was added
+// out of order, which in practice is once, after the table has been filled.
+//
+// Unlike a std::map, adding to the table invalidates iterators and
+// references to entries, as does iterating it while it is unsorted.
+
+template <typename Key> struct SymbolKey;
+
+template <> struct SymbolKey<int>
+{
+	static uint32_t hash(int key)
+	{
+		return (uint32_t)(((uint64_t)(uint32_t)key * 0x9e3779b97f4a7c15ULL) >> 32);
+	}
+	static bool equal(int a, int b)
+	{
+		return a == b;
+	}
+};
+
+template <> struct SymbolKey<std::string>
+{
+	// FNV-1a. Register names are short, so this costs less than a strlen
+	// and a stronger hash would not buy anything:
+	static uint32_t hash(const char *key, size_t len)
+	{
+		uint32_t h = 2166136261u;
+		for (size_t i = 0; i < len; i++)
+			h = (h ^ (uint8_t)key[i]) * 16777619u;
+		return h;
+	}
+	static uint32_t hash(const std::string &key)
+	{
+		return hash(key.data(), key.size());
+	}
+	static uint32_t hash(const char *key)
+	{
+		return hash(key, strlen(key));
+	}
+	static bool equal(const std::string &a, const std::string &b)
+	{
+		return a == b;
+	}
+	static bool equal(const std::string &a, const char *b)
+	{
+		return !strcmp(a.c_str(), b);
+	}
+};
+
+template <typename Key, typename Value>
+class SymbolTable
+{
+public:
+	typedef std::pair<Key, Value> value_type;
+	typedef value_type* iterator;
+	typedef const value_type* const_iterator;
+
+private:
+	// Mutable so that begin() can sort a const table:
+	mutable std::vector<value_type> entries;
+	mutable std::vector<uint32_t> hashes;
+	mutable std::vector<uint32_t> slots; // Index into entries + 1, 0 if empty
+	mutable bool sorted;
+
+	size_t mask() const
+	{
+		return slots.size() - 1;
+	}
+
+	void link(uint32_t index) const
+	{
+		size_t slot;
+
+		for (slot = hashes[index] & mask(); slots[slot]; slot = (slot + 1) & mask());
+		slots[slot] = index + 1;
+	}
+
+	void rehash(size_t size) const
+	{
+		slots.assign(size, 0);
+		for (uint32_t i = 0; i < entries.size(); i++)
+			link(i);
+	}
+
+	template <typename K>
+	size_t find_slot(const K &key, uint32_t hash) const
+	{
+		size_t slot;
+		uint32_t index;
+
+		for (slot = hash & mask(); slots[slot]; slot = (slot + 1) & mask()) {
+			index = slots[slot] - 1;
+			if (hashes[index] == hash && SymbolKey<Key>::equal(entries[index].first, key))
+				return slot;
+		}
+		return SIZE_MAX;
+	}
+
+	void sort() const
+	{
+		std::vector<uint32_t> order(entries.size());
+		std::vector<value_type> sorted_entries;
+		std::vector<uint32_t> sorted_hashes;
+		uint32_t i;
+
+		for (i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+			return entries[a].first < entries[b].first;
+		});
+
+		sorted_entries.reserve(entries.size());
+		sorted_hashes.reserve(entries.size());
+		for (i = 0; i < order.size(); i++) {
+			sorted_entries.push_back(std::move(entries[order[i]]));
+			sorted_hashes.push_back(hashes[order[i]]);
+		}
+		entries.swap(sorted_entries);
+		hashes.swap(sorted_hashes);
+		rehash(slots.size());
+		sorted = true;
+	}
+
+	iterator add(Key &&key, uint32_t hash)
+	{
+		if (!entries.empty() && !(entries.back().first < key))
+			sorted = false;
+
+		entries.push_back(value_type(std::move(key), Value()));
+		hashes.push_back(hash);
+
+		// Keep the slots at most half full:
+		if (entries.size() * 2 > slots.size())
+			rehash(std::max<size_t>(slots.size() * 2, 16));
+		else
+			link((uint32_t)entries.size() - 1);
+
+		return &entries.back();
+	}
+
+public:
+	SymbolTable() :
+		sorted(true)
+	{}
+
+	iterator begin()
+	{
+		if (!sorted)
+			sort();
+		return entries.data();
+	}
+	iterator end()
+	{
+		return entries.data() + entries.size();
+	}
+	const_iterator begin() const
+	{
+		if (!sorted)
+			sort();
+		return entries.data();
+	}
+	const_iterator end() const
+	{
+		return entries.data() + entries.size();
+	}
+
+	size_t size() const
+	{
+		return entries.size();
+	}
+	bool empty() const
+	{
+		return entries.empty();
+	}
+
+	void clear()
+	{
+		entries.clear();
+		hashes.clear();
+		slots.clear();
+		sorted = true;
+	}
+
+	template <typename K>
+	iterator find(const K &key)
+	{
+		size_t slot;
+
+		if (entries.empty())
+			return end();
+		slot = find_slot(key, SymbolKey<Key>::hash(key));
+		if (slot == SIZE_MAX)
+			return end();
+		return &entries[slots[slot] - 1];
+	}
+
+	template <typename K>
+	const_iterator find(const K &key) const
+	{
+		return const_cast<SymbolTable*>(this)->find(key);
+	}
+
+	template <typename K>
+	size_t count(const K &key) const
+	{
+		return find(key) != end();
+	}
+
+	template <typename K>
+	Value& operator[](const K &key)
+	{
+		uint32_t hash = SymbolKey<Key>::hash(key);
+		size_t slot = entries.empty() ? SIZE_MAX : find_slot(key, hash);
+
+		if (slot != SIZE_MAX)
+			return entries[slots[slot] - 1].second;
+		return add(Key(key), hash)->second;
+	}
+
+	// Returns true if the key was added, false if it was already present:
+	template <typename K>
+	bool insert(const K &key, const Value &value)
+	{
+		uint32_t hash = SymbolKey<Key>::hash(key);
+
+		if (!entries.empty() && find_slot(key, hash) != SIZE_MAX)
+			return false;
+		add(Key(key), hash)->second = value;
+		return true;
+	}
+
+	template <typename K>
+	size_t erase(const K &key)
+	{
+		size_t slot, next, home;
+		uint32_t index, last;
+
+		if (entries.empty())
+			return 0;
+		slot = find_slot(key, SymbolKey<Key>::hash(key));
+		if (slot == SIZE_MAX)
+			return 0;
+		index = slots[slot] - 1;
+
+		// Backward shift deletion, so lookups never need tombstones. Each
+		// entry after the hole moves into it unless its home slot lies
+		// cyclically between the hole and where it is now:
+		slots[slot] = 0;
+		for (next = (slot + 1) & mask(); slots[next]; next = (next + 1) & mask()) {
+			home = hashes[slots[next] - 1] & mask();
+			if (((next - home) & mask()) >= ((next - slot) & mask())) {
+				slots[slot] = slots[next];
+				slots[next] = 0;
+				slot = next;
+			}
+		}
+
+		// Fill the gap in entries with the last one, and point its slot
+		// at where it went:
+		last = (uint32_t)entries.size() - 1;
+		if (index != last) {
+			for (slot = hashes[last] & mask(); slots[slot] != last + 1; slot = (slot + 1) & mask());
+			slots[slot] = index + 1;
+			entries[index] = std::move(entries[last]);
+			hashes[index] = hashes[last];
+			sorted = false;
+		}
+		entries.pop_back();
+		hashes.pop_back();
+		return 1;
+	}
+};
+
+// Set counterpart of SymbolTable, for the decompiler's sets of names:
+template <typename Key>
+class SymbolSet
+{
+	SymbolTable<Key, bool> table;
+
+public:
+	// Returns true if the key was added, false if it was already present:
+	template <typename K>
+	bool insert(const K &key)
+	{
+		return table.insert(key, true);
+	}
+
+	template <typename K>
+	size_t count(const K &key) const
+	{
+		return table.count(key);
+	}
+
+	template <typename K>
+	size_t erase(const K &key)
+	{
+		return table.erase(key);
+	}
+
+	size_t size() const
+	{
+		return table.size();
+	}
+	bool empty() const
+	{
+		return table.empty();
+	}
+	void clear()
+	{
+		table.clear();
+	}
+};
@@ -4,6 +4,9 @@
 #include "stdafx.h"
 
 #include <iostream>     // console output
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #include <D3Dcompiler.h>
 #include "DecompileHLSL.h"
@@ -68,6 +71,15 @@ static void PrintHelp(int argc, char *argv[])
 	LogInfo("  -S, --stop-on-failure\n");
 	LogInfo("\t\t\tStop processing files if an error occurs\n");
 
+	LogInfo("  -j, --jobs N\n");
+	LogInfo("\t\t\tProcess N files in parallel (0 = one per CPU) and print a summary\n");
+
+	LogInfo("  --report FILE\n");
+	LogInfo("\t\t\tWrite the status, per-stage timings and errors of every file to FILE\n");
+
+	LogInfo("  --benchmark N\n");
+	LogInfo("\t\t\tAssemble each file N times in memory and print a summary of the timings\n");
+
 	LogInfo("  -v, --verbose\n");
 	LogInfo("\t\t\tVerbose debugging output\n");
 
@@ -96,6 +108,9 @@ static struct {
 	bool validate;
 	bool lenient;
 	bool stop;
+	int jobs;
+	std::string report;
+	int benchmark;
 } args;
 
 void parse_args(int argc, char *argv[])
@@ -180,6 +195,26 @@ void parse_args(int argc, char *argv[])
 				args.stop = true;
 				continue;
 			}
+			if (!strcmp(arg, "-j") || !strcmp(arg, "--jobs")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.jobs = atoi(argv[i]);
+				if (args.jobs <= 0)
+					args.jobs = (int)max(thread::hardware_concurrency(), 1u);
+				continue;
+			}
+			if (!strcmp(arg, "--report")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.report = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.benchmark = atoi(argv[i]);
+				continue;
+			}
 			if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
 				gLogDebug = true;
 				continue;
@@ -526,60 +561,150 @@ static int WriteOutput(string const *in_filename, char const *extension, string
 	return EXIT_SUCCESS;
 }
 
-static int process(string const *filename)
+// Stages we time individually for the summary report. These are accumulated,
+// so e.g. "disassemble" includes both the MS and Flugan disassemblers if both
+// were requested:
+enum Stage {
+	STAGE_READ,
+	STAGE_DISASSEMBLE,
+	STAGE_ASSEMBLE,
+	STAGE_DECOMPILE,
+	STAGE_VALIDATE,
+	STAGE_WRITE,
+	NUM_STAGES
+};
+static const char *stage_names[NUM_STAGES] = {
+	"read",
+	"disassemble",
+	"assemble",
+	"decompile",
+	"validate",
+	"write",
+};
+
+// Outcome of processing a single file. Each worker thread only ever writes to
+// the entry for the file it is processing, and the summary is generated from
+// these in the order the files were given on the command line so that the
+// report does not depend on how the files were scheduled.
+struct FileResult {
+	bool processed;
+	int rc;
+	double stage_ms[NUM_STAGES];
+	double total_ms;
+	string error;
+
+	FileResult() :
+		processed(false),
+		rc(EXIT_SUCCESS),
+		stage_ms(),
+		total_ms(0)
+	{}
+};
+
+class StageTimer {
+	FileResult *result;
+	Stage stage;
+	chrono::steady_clock::time_point start;
+public:
+	StageTimer(FileResult *result, Stage stage) :
+		result(result),
+		stage(stage),
+		start(chrono::steady_clock::now())
+	{}
+
+	~StageTimer()
+	{
+		chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+		result->stage_ms[stage] += elapsed.count();
+	}
+};
+
+static int fail(FileResult *result, Stage stage, const char *msg)
+{
+	// Only record the first error, since anything after that is likely
+	// to just be fallout from it:
+	if (result->error.empty())
+		result->error = string(stage_names[stage]) + ": " + msg;
+	return EXIT_FAILURE;
+}
+
+static int process(string const *filename, FileResult *result)
 {
 	HRESULT hret;
 	string output;
 	vector<char> srcData;
 	string model;
 
-	if (ReadInput(&srcData, filename))
-		return EXIT_FAILURE;
+	{
+		StageTimer timer(result, STAGE_READ);
+		if (ReadInput(&srcData, filename))
+			return fail(result, STAGE_READ, "unable to read input file");
+	}
 
 	if (args.disassemble_ms) {
 		LogInfo("Disassembling (MS) %s...\n", filename->c_str());
-		hret = DisassembleMS(srcData.data(), srcData.size(), &output);
-		if (FAILED(hret))
-			return EXIT_FAILURE;
+		{
+			StageTimer timer(result, STAGE_DISASSEMBLE);
+			hret = DisassembleMS(srcData.data(), srcData.size(), &output);
+			if (FAILED(hret))
+				return fail(result, STAGE_DISASSEMBLE, "MS disassembly failed");
+		}
 
 		if (args.validate) {
+			StageTimer timer(result, STAGE_VALIDATE);
 			if (validate_assembly(&output, &srcData))
-				return EXIT_FAILURE;
+				return fail(result, STAGE_VALIDATE, "assembly verification failed");
 		}
 
+		StageTimer timer(result, STAGE_WRITE);
 		if (WriteOutput(filename, ".msasm", &output))
-			return EXIT_FAILURE;
+			return fail(result, STAGE_WRITE, "unable to write .msasm");
 	}
 
 	if (args.disassemble_flugan || args.disassemble_hexdump || args.disassemble_46) {
 		LogInfo("Disassembling (Flugan) %s...\n", filename->c_str());
-		hret = DisassembleFlugan(srcData.data(), srcData.size(), &output, args.disassemble_hexdump, args.disassemble_46);
-		if (FAILED(hret))
-			return EXIT_FAILURE;
+		{
+			StageTimer timer(result, STAGE_DISASSEMBLE);
+			hret = DisassembleFlugan(srcData.data(), srcData.size(), &output, args.disassemble_hexdump, args.disassemble_46);
+			if (FAILED(hret))
+				return fail(result, STAGE_DISASSEMBLE, "Flugan disassembly failed");
+		}
 
 		if (args.validate) {
+			StageTimer timer(result, STAGE_VALIDATE);
 			if (validate_assembly(&output, &srcData))
-				return EXIT_FAILURE;
+				return fail(result, STAGE_VALIDATE, "assembly verification failed");
 			// TODO: Validate signature parsing instead of binary identical files
 		}
 
+		StageTimer timer(result, STAGE_WRITE);
 		if (WriteOutput(filename, ".asm", &output))
-			return EXIT_FAILURE;
+			return fail(result, STAGE_WRITE, "unable to write .asm");
 
 	}
 
 	if (args.assemble) {
 		LogInfo("Assembling %s...\n", filename->c_str());
 		vector<byte> new_bytecode;
-		if (args.reflection_reference.empty()) {
-			hret = AssembleFluganWithSignatureParsing(&srcData, &new_bytecode);
-			if (FAILED(hret))
-				return EXIT_FAILURE;
-		} else {
-			vector<byte> refData;
+		vector<byte> refData;
+		if (!args.reflection_reference.empty()) {
+			StageTimer timer(result, STAGE_READ);
 			if (ReadInput(&refData, &args.reflection_reference))
-				return EXIT_FAILURE;
-			new_bytecode = AssembleFluganWithOptionalSignatureParsing(&srcData, false, &refData);
+				return fail(result, STAGE_READ, "unable to read reflection reference");
+		}
+		{
+			// --benchmark repeats only the in-memory assembly so
+			// that file I/O does not drown out the assembler itself
+			StageTimer timer(result, STAGE_ASSEMBLE);
+			for (int rep = 0; rep < max(args.benchmark, 1); rep++) {
+				if (args.reflection_reference.empty()) {
+					hret = AssembleFluganWithSignatureParsing(&srcData, &new_bytecode);
+					if (FAILED(hret))
+						return fail(result, STAGE_ASSEMBLE, "assembly failed");
+				} else {
+					new_bytecode = AssembleFluganWithOptionalSignatureParsing(&srcData, false, &refData);
+				}
+			}
 		}
 
 		// TODO:
@@ -587,30 +712,150 @@ static int process(string const *filename)
 		// disassemble again and perform fuzzy compare
 
 		output = string(new_bytecode.begin(), new_bytecode.end());
+		StageTimer timer(result, STAGE_WRITE);
 		if (WriteOutput(filename, ".shdr", &output))
-			return EXIT_FAILURE;
+			return fail(result, STAGE_WRITE, "unable to write .shdr");
 
 	}
 
 	if (args.decompile) {
 		LogInfo("Decompiling %s...\n", filename->c_str());
-		hret = Decompile(srcData.data(), srcData.size(), &output, &model);
-		if (FAILED(hret))
-			return EXIT_FAILURE;
+		{
+			StageTimer timer(result, STAGE_DECOMPILE);
+			hret = Decompile(srcData.data(), srcData.size(), &output, &model);
+			if (FAILED(hret))
+				return fail(result, STAGE_DECOMPILE, "error while decompiling");
+		}
 
 		if (args.validate) {
+			StageTimer timer(result, STAGE_VALIDATE);
 			if (validate_hlsl(&output, &model))
-				return EXIT_FAILURE;
+				return fail(result, STAGE_VALIDATE, "decompiler validation failed");
 		}
 
+		StageTimer timer(result, STAGE_WRITE);
 		if (WriteOutput(filename, ".hlsl", &output))
-			return EXIT_FAILURE;
+			return fail(result, STAGE_WRITE, "unable to write .hlsl");
 
 	}
 
 	return EXIT_SUCCESS;
 }
 
+static void process_file(string const *filename, FileResult *result)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	try {
+		result->rc = process(filename, result);
+	} catch (const exception & e) {
+		LogInfo("\n*** UNHANDLED EXCEPTION: %s\n", e.what());
+		result->error = string("unhandled exception: ") + e.what();
+		result->rc = EXIT_FAILURE;
+	}
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	result->total_ms = elapsed.count();
+	result->processed = true;
+}
+
+// Batch mode: Spreads the files over a pool of worker threads. Each worker
+// claims the next unprocessed file from a shared counter, so large and small
+// shaders naturally balance out between the threads without needing to know
+// the cost of each file up front. The per-file log messages from different
+// workers will be interleaved - use the summary or --report to find out
+// which files failed and why.
+static void process_parallel(vector<FileResult> *results, int jobs)
+{
+	atomic<size_t> next(0);
+	atomic<bool> stop(false);
+	vector<thread> workers;
+
+	auto worker = [&]() {
+		size_t i;
+
+		while (!stop && (i = next++) < args.files.size()) {
+			process_file(&args.files[i], &(*results)[i]);
+			if ((*results)[i].rc && args.stop)
+				stop = true;
+		}
+	};
+
+	for (int i = 0; i < jobs; i++)
+		workers.emplace_back(worker);
+	for (thread &t : workers)
+		t.join();
+}
+
+static void write_report(vector<FileResult> *results)
+{
+	FILE *fp;
+	unsigned stage;
+
+	fopen_s(&fp, args.report.c_str(), "w");
+	if (!fp) {
+		LogInfo("Unable to write report to %s\n", args.report.c_str());
+		return;
+	}
+
+	fprintf(fp, "file\tstatus\ttotal_ms");
+	for (stage = 0; stage < NUM_STAGES; stage++)
+		fprintf(fp, "\t%s_ms", stage_names[stage]);
+	fprintf(fp, "\terror\n");
+
+	for (size_t i = 0; i < args.files.size(); i++) {
+		FileResult *result = &(*results)[i];
+
+		fprintf(fp, "%s\t%s\t%.3f", args.files[i].c_str(),
+			!result->processed ? "SKIPPED" : result->rc ? "FAIL" : "OK",
+			result->total_ms);
+		for (stage = 0; stage < NUM_STAGES; stage++)
+			fprintf(fp, "\t%.3f", result->stage_ms[stage]);
+		fprintf(fp, "\t%s\n", result->error.c_str());
+	}
+
+	fclose(fp);
+}
+
+static void print_summary(vector<FileResult> *results, int jobs, double wall_ms)
+{
+	double stage_totals[NUM_STAGES] = {};
+	double total_ms = 0;
+	size_t succeeded = 0, failed = 0, skipped = 0;
+	unsigned stage;
+
+	for (FileResult &result : *results) {
+		if (!result.processed) {
+			skipped++;
+			continue;
+		}
+		if (result.rc)
+			failed++;
+		else
+			succeeded++;
+		total_ms += result.total_ms;
+		for (stage = 0; stage < NUM_STAGES; stage++)
+			stage_totals[stage] += result.stage_ms[stage];
+	}
+
+	LogInfo("\n=== Summary: %Iu files, %Iu succeeded, %Iu failed, %Iu skipped ===\n",
+			results->size(), succeeded, failed, skipped);
+	LogInfo("  %i jobs, %.3fs wall time, %.3fs cumulative processing time\n",
+			jobs, wall_ms / 1000.0, total_ms / 1000.0);
+	for (stage = 0; stage < NUM_STAGES; stage++) {
+		if (stage_totals[stage] > 0)
+			LogInfo("  %-12s %10.3fs\n", stage_names[stage], stage_totals[stage] / 1000.0);
+	}
+
+	if (failed) {
+		LogInfo("Failed files:\n");
+		for (size_t i = 0; i < args.files.size(); i++) {
+			if ((*results)[i].processed && (*results)[i].rc)
+				LogInfo("  %s: %s\n", args.files[i].c_str(), (*results)[i].error.c_str());
+		}
+	}
+}
+
 
 //-----------------------------------------------------------------------------
 // Console App Entry-Point.
@@ -621,21 +866,31 @@ int main(int argc, char *argv[])
 
 	parse_args(argc, argv);
 
-	for (string const &filename : args.files) {
-		try {
-			rc = process(&filename) || rc;
-		} catch (const exception & e) {
-			LogInfo("\n*** UNHANDLED EXCEPTION: %s\n", e.what());
-			rc = EXIT_FAILURE;
-		}
+	vector<FileResult> results(args.files.size());
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-		if (rc && args.stop)
-			return rc;
+	if (args.jobs) {
+		process_parallel(&results, args.jobs);
+	} else {
+		for (size_t i = 0; i < args.files.size(); i++) {
+			process_file(&args.files[i], &results[i]);
+			if (results[i].rc && args.stop)
+				break;
+		}
 	}
 
+	chrono::duration<double, milli> wall = chrono::steady_clock::now() - start;
+
+	for (FileResult &result : results)
+		rc = result.rc || rc;
+
+	if (args.jobs || args.benchmark)
+		print_summary(&results, max(args.jobs, 1), wall.count());
+	if (!args.report.empty())
+		write_report(&results);
+
 	if (rc)
 		LogInfo("\n*** At least one error occurred during run ***\n");
 
 	return rc;
 }
-
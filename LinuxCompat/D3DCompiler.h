@@ -0,0 +1,34 @@
+#pragma once
+
+// Stand in for the Windows SDK's D3DCompiler.h, just enough for the portable
+// parts of the shader toolchain to compile natively on Linux. There is no
+// d3dcompiler_47.dll here, so D3DDisassemble() always fails and anything that
+// relies on Microsoft's disassembler (Flugan's disassembler() and friends)
+// will report an error rather than produce output. The assembler, signature
+// parser, BinaryDecompiler and HLSL decompiler don't need it.
+
+#include "msvc_compat.h"
+
+struct ID3DBlob
+{
+	virtual void *GetBufferPointer() = 0;
+	virtual SIZE_T GetBufferSize() = 0;
+	virtual unsigned long Release() = 0;
+};
+typedef ID3DBlob ID3D10Blob;
+
+#define D3D_DISASM_ENABLE_COLOR_CODE            0x00000001
+#define D3D_DISASM_ENABLE_DEFAULT_VALUE_PRINTS  0x00000002
+#define D3D_DISASM_ENABLE_INSTRUCTION_NUMBERING 0x00000004
+#define D3D_DISASM_ENABLE_INSTRUCTION_CYCLE     0x00000008
+#define D3D_DISASM_DISABLE_DEBUG_INFO           0x00000010
+#define D3D_DISASM_ENABLE_INSTRUCTION_OFFSET    0x00000020
+#define D3D_DISASM_INSTRUCTION_ONLY             0x00000040
+#define D3D_DISASM_PRINT_HEX_LITERALS           0x00000080
+
+static inline HRESULT D3DDisassemble(const void *pSrcData, SIZE_T SrcDataSize,
+		UINT Flags, const char *szComments, ID3DBlob **ppDisassembly)
+{
+	*ppDisassembly = nullptr;
+	return E_NOTIMPL;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// Empty placeholder for the Windows SDK header of the same name - nothing
+// from it is used by the parts of the shader toolchain built on Linux.
@@ -0,0 +1,337 @@
+#pragma once
+
+// Minimal MSVC CRT compatibility shims so that the portable parts of the
+// shader toolchain (BinaryDecompiler, the HLSL decompiler and Flugan's
+// assembler) can be built natively on Linux. This is force included by the
+// CMake build and is never used by the Visual Studio projects.
+//
+// Windows is LLP64, so "long" is 32 bits there and the shaders tools freely
+// use %lx & friends with 32 bit integers. To match that, the printf and scanf
+// shims below rewrite the format strings to drop the 'l' length modifier on
+// integer conversions, and translate the MS specific %I, %I32 and %I64
+// modifiers to their standard equivalents.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <string>
+
+typedef uint32_t DWORD;
+typedef uint8_t BYTE;
+typedef uint8_t byte;
+typedef int32_t HRESULT;
+typedef unsigned int UINT;
+typedef int BOOL;
+typedef size_t SIZE_T;
+typedef void *LPVOID;
+typedef int errno_t;
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000E)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+
+#ifndef _countof
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(a) _countof(a)
+#endif
+
+#define _TRUNCATE ((size_t)-1)
+
+static inline unsigned int _rotl(unsigned int v, int s)
+{
+	s &= 31;
+	return s ? (v << s) | (v >> (32 - s)) : v;
+}
+
+static inline unsigned int _rotr(unsigned int v, int s)
+{
+	s &= 31;
+	return s ? (v >> s) | (v << (32 - s)) : v;
+}
+
+namespace msvc_compat {
+
+// Rewrites a single conversion specification's length modifier from LLP64
+// to LP64 conventions. 'p' points just past the '%' and any flags, width
+// and precision have already been copied to 'out'. Returns the number of
+// characters consumed from the length modifier.
+static inline size_t translate_length(const char *p, std::string &out)
+{
+	if (p[0] == 'I' && p[1] == '6' && p[2] == '4') {
+		out += "ll";
+		return 3;
+	}
+	if (p[0] == 'I' && p[1] == '3' && p[2] == '2')
+		return 3;
+	if (p[0] == 'I') {
+		out += 'z';
+		return 1;
+	}
+	if (p[0] == 'l' && p[1] != 'l' && strchr("diouxXn", p[1]))
+		return 1;
+	return 0;
+}
+
+static inline std::string translate_printf_format(const char *fmt)
+{
+	std::string out;
+	const char *p = fmt;
+
+	while (*p) {
+		out += *p;
+		if (*p++ != '%')
+			continue;
+		if (*p == '%') {
+			out += *p++;
+			continue;
+		}
+		while (*p && strchr("-+ #0123456789.*", *p))
+			out += *p++;
+		p += translate_length(p, out);
+	}
+	return out;
+}
+
+static inline int vsnprintf_llp64(char *buf, size_t size, const char *fmt, va_list ap)
+{
+	std::string f = translate_printf_format(fmt);
+	return vsnprintf(buf, size, f.c_str(), ap);
+}
+
+// sscanf_s differs from sscanf in that %s, %c and %[ take an additional
+// unsigned buffer size argument after the pointer. We can't remove
+// arguments from a va_list, so instead we process the format one
+// conversion at a time and hand each of them to the standard sscanf along
+// with a %n to find out how far it got.
+static inline int vsscanf_s(const char *input, const char *fmt, va_list ap)
+{
+	const char *in = input;
+	const char *p = fmt;
+	int assigned = 0;
+	bool matched_any = false;
+
+	while (*p) {
+		std::string seg;
+		bool suppress = false, sized = false, count = false;
+		std::string width;
+
+		// Copy literal text up to and including the next conversion:
+		while (*p && *p != '%')
+			seg += *p++;
+		if (!*p) {
+			// Trailing literal text - doesn't affect the result
+			break;
+		}
+		seg += *p++;
+		if (*p == '%') {
+			seg += *p++;
+			int n = -1;
+			seg += "%n";
+			sscanf(in, seg.c_str(), &n);
+			if (n < 0)
+				break;
+			in += n;
+			continue;
+		}
+		if (*p == '*') {
+			suppress = true;
+			seg += *p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			width += *p++;
+		std::string len;
+		p += translate_length(p, len);
+		while (*p && strchr("hlLjzt", *p))
+			len += *p++;
+
+		char conv = *p;
+		std::string spec;
+		if (conv == '[') {
+			spec += *p++;
+			if (*p == '^')
+				spec += *p++;
+			if (*p == ']')
+				spec += *p++;
+			while (*p && *p != ']')
+				spec += *p++;
+			if (*p)
+				spec += *p++;
+		} else if (conv) {
+			spec += *p++;
+		}
+		sized = (conv == 's' || conv == 'c' || conv == '[');
+		count = (conv == 'n');
+
+		if (count) {
+			if (!suppress)
+				*va_arg(ap, int*) = (int)(in - input);
+			continue;
+		}
+
+		void *dest = NULL;
+		unsigned size = 0;
+		if (!suppress) {
+			dest = va_arg(ap, void*);
+			if (sized)
+				size = va_arg(ap, unsigned);
+		}
+		if (sized && !suppress && width.empty()) {
+			if (!size)
+				break;
+			width = std::to_string(conv == 'c' ? 1 : size - 1);
+		}
+
+		seg += width + len + spec + "%n";
+		int n = -1;
+		int ret;
+		if (suppress)
+			ret = sscanf(in, seg.c_str(), &n);
+		else
+			ret = sscanf(in, seg.c_str(), dest, &n);
+		if (ret == EOF && !matched_any && !assigned)
+			return EOF;
+		if (n < 0)
+			break;
+		matched_any = true;
+		if (!suppress)
+			assigned++;
+		in += n;
+	}
+
+	return assigned;
+}
+
+} // namespace msvc_compat
+
+static inline int sscanf_s(const char *input, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = msvc_compat::vsscanf_s(input, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+static inline int vsprintf_s(char *buf, size_t size, const char *fmt, va_list ap)
+{
+	return msvc_compat::vsnprintf_llp64(buf, size, fmt, ap);
+}
+
+static inline int sprintf_s(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = msvc_compat::vsnprintf_llp64(buf, size, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+template <size_t N>
+static inline int sprintf_s(char (&buf)[N], const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = msvc_compat::vsnprintf_llp64(buf, N, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+static inline int _vsnprintf_s(char *buf, size_t size, size_t count, const char *fmt, va_list ap)
+{
+	if (count != _TRUNCATE && count < size)
+		size = count + 1;
+	int ret = msvc_compat::vsnprintf_llp64(buf, size, fmt, ap);
+	if (ret >= (int)size)
+		return -1;
+	return ret;
+}
+
+static inline int _snprintf_s(char *buf, size_t size, size_t count, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = _vsnprintf_s(buf, size, count, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+template <size_t N>
+static inline int _snprintf_s(char (&buf)[N], size_t count, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = _vsnprintf_s(buf, N, count, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+static inline errno_t strncpy_s(char *dst, size_t size, const char *src, size_t count)
+{
+	if (!size)
+		return EINVAL;
+	size_t n = strnlen(src, count == _TRUNCATE ? size - 1 : count);
+	if (n >= size)
+		n = size - 1;
+	memcpy(dst, src, n);
+	dst[n] = '\0';
+	return 0;
+}
+
+static inline errno_t strcpy_s(char *dst, size_t size, const char *src)
+{
+	return strncpy_s(dst, size, src, _TRUNCATE);
+}
+
+template <size_t N>
+static inline errno_t strcpy_s(char (&dst)[N], const char *src)
+{
+	return strcpy_s(dst, N, src);
+}
+
+static inline errno_t strcat_s(char *dst, size_t size, const char *src)
+{
+	size_t len = strnlen(dst, size);
+	if (len >= size)
+		return EINVAL;
+	return strcpy_s(dst + len, size - len, src);
+}
+
+template <size_t N>
+static inline errno_t strcat_s(char (&dst)[N], const char *src)
+{
+	return strcat_s(dst, N, src);
+}
+
+static inline errno_t fopen_s(FILE **fp, const char *filename, const char *mode)
+{
+	*fp = fopen(filename, mode);
+	return *fp ? 0 : errno;
+}
+
+static inline errno_t localtime_s(struct tm *result, const time_t *t)
+{
+	return localtime_r(t, result) ? 0 : EINVAL;
+}
+
+static inline errno_t asctime_s(char *buf, size_t size, const struct tm *t)
+{
+	char tmp[26];
+	if (!asctime_r(t, tmp))
+		return EINVAL;
+	return strcpy_s(buf, size, tmp);
+}
+
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
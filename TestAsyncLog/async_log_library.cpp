@@ -0,0 +1,16 @@
+// async_log_library.cpp : Logs through log.h the way the decompiler and
+// assembler libraries do, which are built without MIGOTO_DX, so that
+// async_log_tests can check their messages go through the background log
+// along with the DirectX 11 DLL's own.
+
+#undef MIGOTO_DX
+
+#include <stdio.h>
+
+#include "log.h"
+
+void LogFromLibrary(const char *what)
+{
+	LogInfo("library %s\n", what);
+	LogDebug("library debug %s\n", what);
+}
@@ -0,0 +1,684 @@
+// async_log_tests.cpp : Checks and benchmarks the background log writer in
+// DirectX11/AsyncLog.cpp, and the log.h macros that use it.
+//
+// Random messages are logged through rings small enough that they wrap, pad
+// and fill up, and are checked to come out exactly as fprintf wrote them.
+// Several threads then log at once while passing a token around, to check
+// that every message comes out once, in the order each thread logged them,
+// and in the order the token says they were logged in across threads.
+// flush(), flush_later(), flush_now() and the reuse of rings when threads
+// exit are checked next, then the log.h macros before and after the
+// background thread is started and after a crash, both from here and from
+// async_log_library.cpp, which is built the way the decompilers are.
+//
+// Finally the macros are timed from several threads at once writing straight
+// to the file with the old per frame fflush, unbuffered, and through the
+// background thread, for both throughput and how long each call takes.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncLog.h"
+#include "log.h"
+
+using namespace std;
+
+FILE *LogFile;
+bool gLogDebug;
+
+// async_log_library.cpp
+void LogFromLibrary(const char *what);
+
+static struct {
+	int messages = 20000;
+	int threads = 4;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the background log writer, then times the log macros with and without it.\n\n");
+
+	printf("  -n, --messages N\n");
+	printf("\t\t\tNumber of messages each thread logs (default 20000)\n");
+
+	printf("  --threads N\n");
+	printf("\t\t\tNumber of threads to log from at once in the checks (default 4)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random messages (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--messages")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.messages = max(atoi(argv[i]), 100);
+			continue;
+		}
+		if (!strcmp(arg, "--threads")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.threads = max(atoi(argv[i]), 2);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+// Only call once nothing else is writing to the file
+static string read_back(FILE *fp)
+{
+	string ret;
+
+	fflush(fp);
+	ret.resize(ftell(fp));
+	rewind(fp);
+	if (fread(&ret[0], 1, ret.size(), fp) != ret.size())
+		ret.clear();
+	fseek(fp, 0, SEEK_END);
+	return ret;
+}
+
+static void compare(const char *step, const string &got, const string &expected)
+{
+	size_t i;
+
+	if (got == expected)
+		return;
+
+	for (i = 0; i < min(got.size(), expected.size()); i++) {
+		if (got[i] != expected[i])
+			break;
+	}
+	report_mismatch("%s: wrote %zu bytes, expected %zu, first difference at %zu", step,
+			got.size(), expected.size(), i);
+}
+
+static void log_printf(AsyncLog *log, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	log->vprint(fmt, ap);
+	va_end(ap);
+}
+
+static void log_both(AsyncLog *log, FILE *ref, const char *fmt, ...)
+{
+	va_list ap, ref_ap;
+
+	va_start(ap, fmt);
+	va_copy(ref_ap, ap);
+	log->vprint(fmt, ap);
+	vfprintf(ref, fmt, ref_ap);
+	va_end(ref_ap);
+	va_end(ap);
+}
+
+static void log_wide(AsyncLog *log, const wchar_t *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	log->vwprint(fmt, ap);
+	va_end(ap);
+}
+
+static string random_text(size_t len)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789 =-_.:%\t";
+	string ret(len, ' ');
+
+	for (char &c : ret)
+		c = chars[rng() % (sizeof(chars) - 1)];
+	if (len)
+		ret[len - 1] = '\n';
+	return ret;
+}
+
+static size_t random_length(size_t ring_size)
+{
+	switch (rng() % 8) {
+	case 0:
+		return 0;
+	case 1:
+		// Longer than one record can hold:
+		return ring_size / 4 + rng() % (ring_size * 2);
+	case 2:
+		// Longer than the stack buffer:
+		return 1000 + rng() % 2000;
+	default:
+		return rng() % 200;
+	}
+}
+
+static void check_messages(size_t ring_size)
+{
+	FILE *fp = tmpfile(), *ref = tmpfile();
+	string text, step = "messages with " + to_string(ring_size) + " byte rings";
+	int i, n;
+
+	{
+		AsyncLog log(fp, ring_size);
+
+		for (i = 0; i < 2000; i++) {
+			switch (rng() % 5) {
+			case 0:
+				text = random_text(random_length(ring_size));
+				log_both(&log, ref, "%s", text.c_str());
+				break;
+			case 1:
+				log_both(&log, ref, "  %S matched resource with hash=%08x %s\n",
+						L"TextureOverrideSomething", (unsigned)rng(), "Width:1920 Height:1080");
+				break;
+			case 2:
+				log_both(&log, ref, "%06u HackerContext::DrawIndexed(%p) IndexCount = %d, %f%c",
+						i, (void*)(uintptr_t)rng(), (int)rng(), rng() / 7.0, i % 3 ? '\n' : ' ');
+				break;
+			case 3:
+				text = random_text(random_length(ring_size));
+				log.write(text.data(), text.size());
+				fwrite(text.data(), 1, text.size(), ref);
+				break;
+			case 4:
+				// Anything outside ASCII can't be represented in the
+				// C locale, which fwprintf would also have failed at:
+				n = (int)(rng() % 1000);
+				log_wide(&log, L"wide %d %ls\n", n, L"café");
+				fprintf(ref, "wide %d caf?\n", n);
+				break;
+			}
+		}
+	}
+
+	compare(step.c_str(), read_back(fp), read_back(ref));
+
+	fclose(fp);
+	fclose(ref);
+}
+
+// Each thread logs its own numbered lines, and whichever thread holds the
+// token logs it and passes it on, so the tokens must come out in order even
+// though each is logged by a different thread from the last.
+static void check_threads(size_t ring_size)
+{
+	FILE *fp = tmpfile();
+	vector<thread> threads;
+	atomic<int> token(0);
+	vector<int> next_line(args.threads);
+	string text, step = "threads with " + to_string(ring_size) + " byte rings";
+	int tokens = args.messages / 10, next_token = 0, t, n, lines = 0;
+	size_t pos, end;
+	AsyncLogStats stats;
+
+	{
+		AsyncLog log(fp, ring_size);
+
+		for (t = 0; t < args.threads; t++) {
+			threads.emplace_back([&log, &token, tokens, t]() {
+				int i = 0, cur;
+
+				while (i < args.messages || token.load() < tokens) {
+					if (i < args.messages)
+						log_printf(&log, "thread %d line %d\n", t, i++);
+					cur = token.load(memory_order_acquire);
+					if (cur < tokens && cur % args.threads == t) {
+						log_printf(&log, "token %d\n", cur);
+						token.store(cur + 1, memory_order_release);
+					} else if (i >= args.messages) {
+						this_thread::yield();
+					}
+				}
+			});
+		}
+		for (thread &thread : threads)
+			thread.join();
+
+		log.flush();
+		stats = log.get_stats();
+	}
+
+	text = read_back(fp);
+	fclose(fp);
+
+	for (pos = 0; pos < text.size(); pos = end + 1) {
+		end = text.find('\n', pos);
+		if (end == string::npos) {
+			report_mismatch("%s: last line is incomplete", step.c_str());
+			break;
+		}
+		if (sscanf(text.c_str() + pos, "thread %d line %d\n", &t, &n) == 2) {
+			if (t < 0 || t >= args.threads || n != next_line[t]) {
+				report_mismatch("%s: thread %d line %d came out of order", step.c_str(), t, n);
+				return;
+			}
+			next_line[t]++;
+			lines++;
+		} else if (sscanf(text.c_str() + pos, "token %d\n", &n) == 1) {
+			if (n != next_token) {
+				report_mismatch("%s: token %d came out after token %d", step.c_str(), n, next_token - 1);
+				return;
+			}
+			next_token++;
+		} else {
+			report_mismatch("%s: garbled line at offset %zu", step.c_str(), pos);
+			return;
+		}
+	}
+
+	if (lines != args.threads * args.messages || next_token != tokens)
+		report_mismatch("%s: %d lines and %d tokens came out, expected %d and %d", step.c_str(),
+				lines, next_token, args.threads * args.messages, tokens);
+	if (stats.out_of_order)
+		report_mismatch("%s: %llu messages out of order", step.c_str(), (unsigned long long)stats.out_of_order);
+	if (stats.rings != (uint32_t)args.threads)
+		report_mismatch("%s: %u rings for %d threads", step.c_str(), stats.rings, args.threads);
+	if (args.verbose)
+		printf("%s: %llu passes, %llu waits\n", step.c_str(),
+				(unsigned long long)stats.passes, (unsigned long long)stats.waits);
+}
+
+static bool wait_for_messages(AsyncLog *log, uint64_t messages, chrono::milliseconds timeout)
+{
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + timeout;
+
+	while (log->get_stats().messages < messages) {
+		if (chrono::steady_clock::now() > deadline)
+			return false;
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+	return true;
+}
+
+static void check_flush()
+{
+	FILE *fp = tmpfile();
+	AsyncLogStats stats;
+	string expected;
+	int i;
+
+	{
+		AsyncLog log(fp);
+
+		log_printf(&log, "before flush\n");
+		log.flush();
+		expected = "before flush\n";
+		compare("flush", read_back(fp), expected);
+
+		// Nobody asks, but the background thread should get to it:
+		log_printf(&log, "on its own\n");
+		if (!wait_for_messages(&log, 2, ASYNC_LOG_INTERVAL * 20))
+			report_mismatch("flush: message not written after %d ms", (int)(ASYNC_LOG_INTERVAL * 20).count());
+		log_printf(&log, "flush later\n");
+		log.flush_later();
+		if (!wait_for_messages(&log, 3, ASYNC_LOG_INTERVAL * 20))
+			report_mismatch("flush_later: message not written after %d ms", (int)(ASYNC_LOG_INTERVAL * 20).count());
+		expected += "on its own\nflush later\n";
+		compare("flush_later", read_back(fp), expected);
+
+		for (i = 0; i < 1000; i++)
+			log_printf(&log, "flush_now %d\n", i);
+		if (!log.flush_now(chrono::milliseconds(1000)))
+			report_mismatch("flush_now: couldn't take over writing");
+		for (i = 0; i < 1000; i++)
+			expected += "flush_now " + to_string(i) + "\n";
+		compare("flush_now", read_back(fp), expected);
+
+		// Once closed, nothing else may be written:
+		log_printf(&log, "closing\n");
+		log.flush_now(chrono::milliseconds(1000), true);
+		expected += "closing\n";
+		for (i = 0; i < 100; i++)
+			log_printf(&log, "after close %d\n", i);
+		log.flush();
+		compare("flush_now close", read_back(fp), expected);
+
+		stats = log.get_stats();
+		if (stats.discarded != 100)
+			report_mismatch("flush_now close: %llu messages discarded, expected 100",
+					(unsigned long long)stats.discarded);
+	}
+
+	fclose(fp);
+}
+
+// Threads that have exited give their rings to the next ones
+static void check_ring_reuse()
+{
+	FILE *fp = tmpfile();
+	AsyncLogStats stats;
+	string expected;
+	int i;
+
+	{
+		AsyncLog log(fp);
+
+		for (i = 0; i < 50; i++) {
+			thread([&log, i]() {
+				log_printf(&log, "short lived thread %d\n", i);
+			}).join();
+			expected += "short lived thread " + to_string(i) + "\n";
+		}
+		log.flush();
+		stats = log.get_stats();
+	}
+
+	compare("ring reuse", read_back(fp), expected);
+	if (stats.rings != 1)
+		report_mismatch("ring reuse: %u rings for one thread at a time", stats.rings);
+
+	fclose(fp);
+}
+
+static void check_macros_va(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vLogInfo(fmt, ap);
+	va_end(ap);
+}
+
+// Starts the one async log the process can have, which the benchmark carries
+// on using afterwards
+static FILE* check_macros()
+{
+	FILE *fp = tmpfile();
+	string expected;
+	int evaluated = 0;
+
+	LogFile = fp;
+	gLogDebug = true;
+
+	LogInfo("direct %d\n", 1);
+	LogFromLibrary("direct");
+	StartAsyncLogging(fp);
+	if (!gLogAsync)
+		report_mismatch("macros: StartAsyncLogging did not switch the macros over");
+	LogInfo("async %d %s\n", 2, "two");
+	// Written straight to the file, this would come out before the line
+	// above, which is still waiting for the background thread:
+	LogFromLibrary("async");
+	LogDebug("debug %d\n", 3);
+	LogWrite("raw\n", 4);
+	LogInfoW(L"wide %d\n", 5);
+	check_macros_va("va %s\n", "six");
+	LogInfoNoNL("no newline ");
+	LogInfo("%s\n", "seven");
+
+	gLogDebug = false;
+	LogDebug("skipped %d\n", ++evaluated);
+	if (evaluated)
+		report_mismatch("macros: LogDebug evaluated its arguments with debug off");
+
+	LogFlush();
+	expected = "direct 1\nlibrary direct\nlibrary debug direct\nasync 2 two\n"
+		"library async\nlibrary debug async\ndebug 3\nraw\nwide 5\nva six\nno newline seven\n";
+	compare("macros", read_back(fp), expected);
+
+	LogInfo("before crash\n");
+	LogFlushAfterCrash();
+	if (gLogAsync)
+		report_mismatch("macros: still logging in the background after a crash");
+	LogInfo("crash handler\n");
+	gLogDebug = true;
+	LogFromLibrary("crash");
+	gLogDebug = false;
+	LogFlush();
+	expected += "before crash\ncrash handler\nlibrary crash\nlibrary debug crash\n";
+	compare("macros after crash", read_back(fp), expected);
+
+	gLogAsync = true;
+	return fp;
+}
+
+// --- Benchmark ---
+
+enum class Mode {
+	DIRECT,     // The macros as they were, with the per frame fflush
+	UNBUFFERED, // [Logging] unbuffered=1
+	ASYNC,
+};
+
+static const char *mode_names[] = { "direct", "unbuffered", "async" };
+
+// Draw calls per frame, only the first thread presents:
+static const int BENCH_FRAME_MESSAGES = 500;
+
+struct BenchResult {
+	double ms;
+	double drain_ms;
+	vector<uint32_t> latency_ns;
+	vector<uint32_t> frame_ns;
+};
+
+static BenchResult bench_run(Mode mode, FILE *async_fp, int threads, int messages)
+{
+	vector<vector<uint32_t>> latency(threads);
+	vector<thread> workers;
+	atomic<int> ready(0);
+	atomic<bool> go(false);
+	chrono::steady_clock::time_point start, end;
+	BenchResult ret;
+	FILE *fp = NULL;
+	int t;
+
+	if (mode == Mode::ASYNC) {
+		LogFile = async_fp;
+		gLogAsync = true;
+	} else {
+		fp = tmpfile();
+		if (mode == Mode::UNBUFFERED)
+			setvbuf(fp, NULL, _IONBF, 0);
+		LogFile = fp;
+		gLogAsync = false;
+	}
+	gLogDebug = true;
+
+	for (t = 0; t < threads; t++) {
+		latency[t].reserve(messages);
+		workers.emplace_back([&, t]() {
+			chrono::steady_clock::time_point before, after;
+			int i;
+
+			ready++;
+			while (!go.load())
+				this_thread::yield();
+
+			for (i = 0; i < messages; i++) {
+				before = chrono::steady_clock::now();
+				LogDebug("HackerContext::DrawIndexed(%p) called with IndexCount = %d, StartIndexLocation = %d, BaseVertexLocation = %d\n",
+						(void*)&latency, i, t * 3, -i);
+				after = chrono::steady_clock::now();
+				latency[t].push_back((uint32_t)chrono::duration_cast<chrono::nanoseconds>(after - before).count());
+
+				if (t == 0 && i % BENCH_FRAME_MESSAGES == BENCH_FRAME_MESSAGES - 1) {
+					LogFlushLater();
+					before = chrono::steady_clock::now();
+					ret.frame_ns.push_back((uint32_t)chrono::duration_cast<chrono::nanoseconds>(before - after).count());
+				}
+			}
+		});
+	}
+
+	while (ready.load() < threads)
+		this_thread::yield();
+	start = chrono::steady_clock::now();
+	go = true;
+	for (thread &worker : workers)
+		worker.join();
+	end = chrono::steady_clock::now();
+	ret.ms = chrono::duration<double, milli>(end - start).count();
+
+	// How long until it is all in the file:
+	LogFlush();
+	ret.drain_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - end).count();
+
+	for (auto &thread_latency : latency)
+		ret.latency_ns.insert(ret.latency_ns.end(), thread_latency.begin(), thread_latency.end());
+	sort(ret.latency_ns.begin(), ret.latency_ns.end());
+
+	if (fp)
+		fclose(fp);
+	LogFile = async_fp;
+	return ret;
+}
+
+static double percentile(const vector<uint32_t> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[min(sorted.size() - 1, (size_t)(sorted.size() * p))];
+}
+
+static double average(const vector<uint32_t> &vals)
+{
+	double total = 0;
+
+	for (uint32_t val : vals)
+		total += val;
+	return vals.empty() ? 0 : total / vals.size();
+}
+
+static void bench_disabled()
+{
+	chrono::steady_clock::time_point start;
+	const int calls = 10000000;
+	double ns;
+	int i;
+
+	gLogDebug = false;
+	start = chrono::steady_clock::now();
+	for (i = 0; i < calls; i++) {
+		LogDebug("HackerContext::DrawIndexed(%p) called with IndexCount = %d\n", (void*)&start, i);
+		// Keep the loop from being optimised out:
+		__asm__ __volatile__("" ::: "memory");
+	}
+	ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / calls;
+	printf("  LogDebug with debug=0: %.2f ns per call\n", ns);
+	gLogDebug = true;
+}
+
+static void benchmark(FILE *async_fp)
+{
+	int thread_counts[] = { 1, 2, 4, 8 };
+	Mode modes[] = { Mode::DIRECT, Mode::UNBUFFERED, Mode::ASYNC };
+	BenchResult result;
+	double base_ms;
+
+	printf("\nLogging %d messages per thread, presenting every %d on the first:\n",
+			args.messages, BENCH_FRAME_MESSAGES);
+	bench_disabled();
+	printf("  threads  mode          Mmsg/s   speedup   p50 ns   p99 ns  p99.9 ns    max us  present us  drain ms\n");
+
+	for (int threads : thread_counts) {
+		base_ms = 0;
+		for (Mode mode : modes) {
+			result = bench_run(mode, async_fp, threads, args.messages);
+			if (mode == Mode::DIRECT)
+				base_ms = result.ms;
+			printf("  %7d  %-10s %9.2f %8.2fx %8.0f %8.0f %9.0f %9.1f %11.1f %9.2f\n",
+					threads, mode_names[(int)mode],
+					threads * (double)args.messages / result.ms / 1000.0,
+					base_ms / result.ms,
+					percentile(result.latency_ns, 0.5),
+					percentile(result.latency_ns, 0.99),
+					percentile(result.latency_ns, 0.999),
+					result.latency_ns.empty() ? 0 : result.latency_ns.back() / 1000.0,
+					average(result.frame_ns) / 1000.0,
+					result.drain_ms);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *async_fp;
+
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_messages(4096);
+	check_messages(ASYNC_LOG_RING_SIZE);
+	check_threads(4096);
+	check_threads(ASYNC_LOG_RING_SIZE);
+	check_flush();
+	check_ring_reuse();
+	async_fp = check_macros();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark(async_fp);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1063 @@
+// command_list_cse_tests.cpp : Runs the command list common subexpression
+// elimination pass (DirectX11/CommandListCSE.h) and the static if inlining
+// (DirectX11/CommandListStaticIf.h) over ini excerpts.
+//
+// Like expression_bench.cpp this can't use the real command list code, so
+// it parses a subset of the command list syntax into a stand-in that mirrors
+// the DirectX11 one - the same operators, precedence, static evaluation of
+// constant subexpressions, per-invocation cache and cache invalidation rules
+// - and runs it through the real passes:
+//
+//   [Section]          Each section is a separate command list invocation
+//   if / else if / elif / else / endif
+//   $var = expression  Variable assignment
+//   x1 = expression    Ini param assignment
+//   anything = else    Any other command. These always invalidate the cache
+//                      and are simulated by changing every state operand, so
+//                      that a stale cached value would be noticed
+//
+// Operands can be numbers, $variables, ini params (x, y1, ...), texture
+// filters (ps-t0, ...), rt_width, rt_height, res_width, res_height and time
+// (which must never be cached).
+//
+// Each excerpt is checked against the counts in its "; expect-eliminated = N",
+// "; expect-shared = N" and "; expect-inlined = N" comments, then run both
+// with and without the passes over a number of random starting values of the variables, ini params
+// and state operands. Every variable and ini param must end up bit for bit
+// identical.
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "CommandListBytecode.h"
+#include "CommandListCSE.h"
+#include "CommandListStaticIf.h"
+
+using namespace std;
+
+static struct {
+	vector<string> paths;
+	int runs = 50;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION] PATH...\n\n", argv0);
+	printf("Runs the command list common subexpression elimination pass over ini\n");
+	printf("excerpts. Directories are searched for *.ini files.\n\n");
+
+	printf("  --runs N\n");
+	printf("\t\t\tCompare N runs with random starting values per excerpt (default 50)\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint the counts for every excerpt\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strncmp(arg, "-", 1)) {
+			if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+				PrintHelp(argv[0]); // Does not return
+			}
+			if (!strcmp(arg, "--runs")) {
+				if (++i >= argc)
+					PrintHelp(argv[0]);
+				args.runs = max(atoi(argv[i]), 1);
+				continue;
+			}
+			if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+				args.verbose = true;
+				continue;
+			}
+			printf("Unrecognised argument: %s\n", arg);
+			PrintHelp(argv[0]); // Does not return
+		}
+		args.paths.push_back(arg);
+	}
+
+	if (args.paths.empty())
+		PrintHelp(argv[0]); // Does not return
+}
+
+class ParseError : public exception
+{
+public:
+	string msg;
+
+	ParseError(string msg) : msg(msg) {}
+	const char* what() const throw() override { return msg.c_str(); }
+};
+
+// ---------------------------------------------------------------------------
+// Stand-in for CommandListState
+// ---------------------------------------------------------------------------
+
+#define COMMAND_LIST_EXPRESSION_CACHE_SIZE 32
+
+class Node;
+
+struct CacheEntry {
+	Node *owner;
+	unsigned generation;
+	float val;
+};
+
+struct State {
+	unsigned expression_cache_generation;
+	CacheEntry expression_cache[COMMAND_LIST_EXPRESSION_CACHE_SIZE];
+
+	State() :
+		expression_cache_generation(0)
+	{
+		memset(expression_cache, 0, sizeof(expression_cache));
+	}
+};
+
+// Everything an expression can read. Filled with random values at the start
+// of each run, the state operands are changed again by every "other" command:
+struct World {
+	map<string, float> variables;
+	map<string, float> params;
+	map<string, float> state_operands;
+	mt19937 rng;
+	float time;
+	unsigned state_changes;
+};
+static World world;
+
+static float random_value()
+{
+	static const float special[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 2.0f, 0.5f, 1920.0f, 1080.0f,
+		numeric_limits<float>::infinity(), numeric_limits<float>::quiet_NaN(),
+	};
+
+	if (world.rng() % 2)
+		return special[world.rng() % (sizeof(special) / sizeof(special[0]))];
+	return uniform_real_distribution<float>(-10.0f, 10.0f)(world.rng);
+}
+
+static void change_state_operands()
+{
+	for (auto &kv : world.state_operands)
+		kv.second = random_value();
+	world.state_changes++;
+}
+
+// ---------------------------------------------------------------------------
+// Stand-in for the syntax tree
+// ---------------------------------------------------------------------------
+
+class Node {
+public:
+	virtual ~Node() {}
+
+	virtual float evaluate(State *state) = 0;
+	virtual bool static_evaluate(float *ret) = 0;
+	virtual bool compile(CommandListBytecode *bytecode) = 0;
+};
+
+static float run_bytecode(const CommandListBytecode &bytecode, State *state)
+{
+	return bytecode.run([state](void *operand) {
+		return ((Node*)operand)->evaluate(state);
+	});
+}
+
+enum class OperandType {
+	VALUE,
+	VARIABLE,
+	INI_PARAM,
+	STATE,   // rt_width, texture filters, etc.
+	TIME,
+};
+
+class Operand : public Node {
+public:
+	OperandType type;
+	string name;
+	float val;
+	float *ptr;
+
+	Operand(OperandType type, string name, float val=0, float *ptr=NULL) :
+		type(type), name(name), val(val), ptr(ptr)
+	{}
+
+	float evaluate(State *state) override
+	{
+		switch (type) {
+			case OperandType::VALUE:
+				return val;
+			case OperandType::VARIABLE:
+			case OperandType::INI_PARAM:
+			case OperandType::STATE:
+				return *ptr;
+			case OperandType::TIME:
+				// Advances every time it is read, so caching
+				// it would be noticed:
+				return world.time += 1.0f;
+		}
+		return 0;
+	}
+
+	bool static_evaluate(float *ret) override
+	{
+		if (type != OperandType::VALUE)
+			return false;
+		*ret = val;
+		return true;
+	}
+
+	bool compile(CommandListBytecode *bytecode) override
+	{
+		switch (type) {
+			case OperandType::VALUE:
+				bytecode->push_value(val);
+				return true;
+			case OperandType::VARIABLE:
+				bytecode->push_load(ptr);
+				return true;
+			default:
+				bytecode->push_operand(static_cast<Node*>(this));
+				return true;
+		}
+	}
+};
+
+class Operator : public Node {
+public:
+	shared_ptr<Node> lhs;
+	shared_ptr<Node> rhs;
+
+	float evaluate(State *state) override
+	{
+		float lhs_val;
+
+		if (lhs) { // Binary operator
+			// Left to right, as CommandListOperator::evaluate():
+			lhs_val = lhs->evaluate(state);
+			return evaluate(lhs_val, rhs->evaluate(state));
+		}
+		return evaluate(numeric_limits<float>::quiet_NaN(), rhs->evaluate(state));
+	}
+
+	bool static_evaluate(float *ret) override
+	{
+		float lhs_static = numeric_limits<float>::quiet_NaN(), rhs_static;
+
+		if (!rhs->static_evaluate(&rhs_static))
+			return false;
+		if (lhs && !lhs->static_evaluate(&lhs_static))
+			return false;
+		*ret = evaluate(lhs_static, rhs_static);
+		return true;
+	}
+
+	bool compile(CommandListBytecode *bytecode) override
+	{
+		if (lhs && !lhs->compile(bytecode))
+			return false;
+		if (!rhs->compile(bytecode))
+			return false;
+		bytecode->push_operator(bytecode_fn(), !lhs);
+		return true;
+	}
+
+	virtual float evaluate(float lhs, float rhs) = 0;
+	virtual CommandListOperatorFn bytecode_fn() = 0;
+	virtual const char* pattern() = 0;
+};
+
+class Subexpression : public Node {
+public:
+	shared_ptr<Node> inner;
+	CommandListBytecode bytecode;
+	unsigned idx;
+
+	Subexpression(shared_ptr<Node> inner, unsigned idx) :
+		inner(inner), idx(idx)
+	{
+		if (!inner->compile(&bytecode) || !bytecode.valid())
+			bytecode.clear();
+	}
+
+	float evaluate(State *state) override
+	{
+		CacheEntry *cache = &state->expression_cache[idx % COMMAND_LIST_EXPRESSION_CACHE_SIZE];
+		float ret;
+
+		if (cache->owner == this && cache->generation == state->expression_cache_generation)
+			return cache->val;
+
+		if (bytecode.empty())
+			ret = inner->evaluate(state);
+		else
+			ret = run_bytecode(bytecode, state);
+
+		cache->owner = this;
+		cache->generation = state->expression_cache_generation;
+		cache->val = ret;
+		return ret;
+	}
+
+	bool static_evaluate(float *ret) override
+	{
+		return inner->static_evaluate(ret);
+	}
+
+	bool compile(CommandListBytecode *bytecode) override
+	{
+		bytecode->push_operand(static_cast<Node*>(this));
+		return true;
+	}
+};
+
+struct OperatorDef {
+	string pattern;
+	bool unary;
+	shared_ptr<Operator> (*create)();
+};
+static vector<OperatorDef> operator_defs;
+
+#define DEFINE_OPERATOR(name, operator_pattern, fn) \
+class name##T : public Operator { \
+public: \
+	static float apply(float lhs, float rhs) { return (fn); } \
+	float evaluate(float lhs, float rhs) override { return apply(lhs, rhs); } \
+	CommandListOperatorFn bytecode_fn() override { return apply; } \
+	const char* pattern() override { return operator_pattern; } \
+	static shared_ptr<Operator> create() { return make_shared<name##T>(); } \
+}; \
+static struct name##Registration { \
+	name##Registration() { \
+		operator_defs.push_back({operator_pattern, !strncmp(#name, "unary_", 6), name##T::create}); \
+	} \
+} name##_registration;
+
+#include "CommandListOperators.h"
+#undef DEFINE_OPERATOR
+
+// Same as CommandListCSETraits in CommandList.cpp, with the texture filters
+// and rt_width, etc. all being STATE operands:
+struct StandInCSETraits {
+	static bool is_operator(Node *node)
+	{
+		return !!dynamic_cast<Operator*>(node);
+	}
+
+	static shared_ptr<Node>* lhs(Node *node)
+	{
+		return &dynamic_cast<Operator*>(node)->lhs;
+	}
+
+	static shared_ptr<Node>* rhs(Node *node)
+	{
+		return &dynamic_cast<Operator*>(node)->rhs;
+	}
+
+	static wstring operator_key(Node *node)
+	{
+		const char *pattern = dynamic_cast<Operator*>(node)->pattern();
+		return wstring(pattern, pattern + strlen(pattern));
+	}
+
+	static bool operand_key(Node *node, wstring *key)
+	{
+		Operand *operand = dynamic_cast<Operand*>(node);
+		wchar_t buf[64];
+
+		if (!operand || operand->type == OperandType::TIME)
+			return false;
+
+		if (operand->type == OperandType::VALUE) {
+			uint32_t bits;
+			memcpy(&bits, &operand->val, sizeof(bits));
+			swprintf(buf, 64, L"%08x", bits);
+		} else {
+			swprintf(buf, 64, L"%i.%p", (int)operand->type, operand->ptr);
+		}
+		*key = buf;
+		return true;
+	}
+
+	static bool worth_sharing(Node *node)
+	{
+		Operand *operand = dynamic_cast<Operand*>(node);
+
+		if (!operand)
+			return true;
+		return operand->type == OperandType::STATE && operand->name.find("-t") != string::npos;
+	}
+
+	static shared_ptr<Node> make_shared(shared_ptr<Node> subtree, unsigned idx)
+	{
+		return std::make_shared<Subexpression>(subtree, idx);
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Stand-in for the commands
+// ---------------------------------------------------------------------------
+
+enum class CommandType {
+	IF,
+	VARIABLE_ASSIGNMENT,
+	PARAM_OVERRIDE,
+	OTHER,
+};
+
+struct Expression {
+	shared_ptr<Node> evaluatable;
+	CommandListBytecode bytecode;
+
+	float evaluate(State *state)
+	{
+		if (bytecode.empty())
+			return evaluatable->evaluate(state);
+		return run_bytecode(bytecode, state);
+	}
+
+	void compile()
+	{
+		bytecode.clear();
+		if (!evaluatable->compile(&bytecode) || !bytecode.valid())
+			bytecode.clear();
+	}
+};
+
+struct Command;
+typedef vector<shared_ptr<Command>> CommandList;
+
+struct Command {
+	CommandType type;
+	Expression expression;
+	float *target;
+	CommandList true_commands;
+	CommandList false_commands;
+	bool invalidates_expression_cache;
+
+	Command(CommandType type) :
+		type(type),
+		target(NULL),
+		invalidates_expression_cache(type != CommandType::IF)
+	{}
+};
+
+static void run_command_list(CommandList *commands, State *state)
+{
+	for (auto &command : *commands) {
+		switch (command->type) {
+			case CommandType::IF:
+				if (command->expression.evaluate(state))
+					run_command_list(&command->true_commands, state);
+				else
+					run_command_list(&command->false_commands, state);
+				break;
+			case CommandType::VARIABLE_ASSIGNMENT:
+			case CommandType::PARAM_OVERRIDE:
+				*command->target = command->expression.evaluate(state);
+				break;
+			case CommandType::OTHER:
+				change_state_operands();
+				break;
+		}
+		if (command->invalidates_expression_cache)
+			state->expression_cache_generation++;
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Parser
+// ---------------------------------------------------------------------------
+
+struct Excerpt {
+	string path;
+	vector<CommandList> sections;
+	long expect_eliminated = -1;
+	long expect_shared = -1;
+	long expect_inlined = -1;
+};
+
+class ExpressionParser {
+	const string &text;
+	size_t pos;
+
+	void skip_space()
+	{
+		while (pos < text.size() && isspace((unsigned char)text[pos]))
+			pos++;
+	}
+
+	// Longest operator pattern at the current position, same as
+	// the ordering of operator_tokens in CommandList.cpp:
+	string peek_operator()
+	{
+		static const char *tokens[] = {
+			"===", "!==",
+			"==", "!=", "//", "<=", ">=", "&&", "||", "**",
+			"(", ")", "!", "*", "/", "%", "+", "-", "<", ">",
+		};
+
+		skip_space();
+		for (const char *token : tokens) {
+			if (!text.compare(pos, strlen(token), token))
+				return token;
+		}
+		return "";
+	}
+
+	shared_ptr<Node> create(const string &pattern, bool unary, shared_ptr<Node> lhs, shared_ptr<Node> rhs)
+	{
+		shared_ptr<Operator> op;
+		float static_val;
+
+		for (OperatorDef &def : operator_defs) {
+			if (def.pattern == pattern && def.unary == unary) {
+				op = def.create();
+				op->lhs = lhs;
+				op->rhs = rhs;
+				// Static evaluation, as CommandListOperator::optimise():
+				if (op->static_evaluate(&static_val))
+					return make_shared<Operand>(OperandType::VALUE, "", static_val);
+				return op;
+			}
+		}
+		throw ParseError("Unknown operator " + pattern);
+	}
+
+	shared_ptr<Node> parse_operand()
+	{
+		size_t start;
+		string name;
+		float *ptr;
+
+		skip_space();
+		start = pos;
+		while (pos < text.size() && (isalnum((unsigned char)text[pos]) ||
+				strchr("$_.", text[pos]) ||
+				// Texture filters, e.g. ps-t0:
+				(text[pos] == '-' && pos == start + 2 && pos + 1 < text.size()
+				 && text[pos + 1] == 't' && isalpha((unsigned char)text[start]))))
+			pos++;
+		name = text.substr(start, pos - start);
+		if (name.empty())
+			throw ParseError("Expected operand at: " + text.substr(start));
+
+		if (isdigit((unsigned char)name[0]) || name[0] == '.')
+			return make_shared<Operand>(OperandType::VALUE, name, strtof(name.c_str(), NULL));
+		if (name == "time")
+			return make_shared<Operand>(OperandType::TIME, name);
+		if (name[0] == '$') {
+			ptr = &world.variables[name];
+			return make_shared<Operand>(OperandType::VARIABLE, name, 0, ptr);
+		}
+		if (strchr("xyzw", name[0]) && name.find_first_not_of("0123456789", 1) == string::npos) {
+			ptr = &world.params[name];
+			return make_shared<Operand>(OperandType::INI_PARAM, name, 0, ptr);
+		}
+		ptr = &world.state_operands[name];
+		return make_shared<Operand>(OperandType::STATE, name, 0, ptr);
+	}
+
+	shared_ptr<Node> parse_primary()
+	{
+		shared_ptr<Node> ret;
+
+		if (peek_operator() == "(") {
+			pos++;
+			ret = parse_binary(0);
+			if (peek_operator() != ")")
+				throw ParseError("Unmatched (");
+			pos++;
+			return ret;
+		}
+		return parse_operand();
+	}
+
+	shared_ptr<Node> parse_unary()
+	{
+		string op = peek_operator();
+
+		if (op == "!" || op == "-" || op == "+") {
+			pos += op.size();
+			return create(op, true, nullptr, parse_unary());
+		}
+		return parse_primary();
+	}
+
+	// Right associative, binds tighter than everything but unary
+	shared_ptr<Node> parse_exponent()
+	{
+		shared_ptr<Node> lhs = parse_unary();
+
+		if (peek_operator() == "**") {
+			pos += 2;
+			return create("**", false, lhs, parse_exponent());
+		}
+		return lhs;
+	}
+
+	static int precedence(const string &op)
+	{
+		if (op == "*" || op == "/" || op == "//" || op == "%")
+			return 5;
+		if (op == "+" || op == "-")
+			return 4;
+		if (op == "<" || op == "<=" || op == ">" || op == ">=")
+			return 3;
+		if (op == "==" || op == "!=" || op == "===" || op == "!==")
+			return 2;
+		if (op == "&&")
+			return 1;
+		if (op == "||")
+			return 0;
+		return -1;
+	}
+
+	// Left associative binary operators
+	shared_ptr<Node> parse_binary(int min_precedence)
+	{
+		shared_ptr<Node> lhs = parse_exponent();
+		string op;
+		int p;
+
+		while (true) {
+			op = peek_operator();
+			p = precedence(op);
+			if (p < min_precedence)
+				return lhs;
+			pos += op.size();
+			lhs = create(op, false, lhs, parse_binary(p + 1));
+		}
+	}
+
+public:
+	ExpressionParser(const string &text) : text(text), pos(0) {}
+
+	shared_ptr<Node> parse()
+	{
+		shared_ptr<Node> ret = parse_binary(0);
+
+		skip_space();
+		if (pos != text.size())
+			throw ParseError("Unexpected: " + text.substr(pos));
+		return ret;
+	}
+};
+
+static string trim(const string &s)
+{
+	size_t start = s.find_first_not_of(" \t\r\n");
+	size_t end = s.find_last_not_of(" \t\r\n");
+
+	if (start == string::npos)
+		return "";
+	return s.substr(start, end - start + 1);
+}
+
+static bool starts_with(const string &s, const char *prefix)
+{
+	return !s.compare(0, strlen(prefix), prefix);
+}
+
+static void parse_excerpt(const string &path, Excerpt *excerpt)
+{
+	// Innermost if first. else if pushes another level that shares the
+	// same endif, as the has_nested_else_if IfCommands do:
+	struct Level {
+		Command *command;
+		bool in_else;
+		bool nested_else_if;
+	};
+	vector<Level> levels;
+	CommandList *current = NULL;
+	char buf[1024];
+	string line, key, val;
+	size_t eq;
+	FILE *fp;
+
+	fp = fopen(path.c_str(), "r");
+	if (!fp)
+		throw ParseError("Unable to open " + path);
+
+	auto current_list = [&]() -> CommandList* {
+		if (levels.empty())
+			return current;
+		if (levels.back().in_else)
+			return &levels.back().command->false_commands;
+		return &levels.back().command->true_commands;
+	};
+	auto add_if = [&](const string &condition, bool nested_else_if) {
+		shared_ptr<Command> command = make_shared<Command>(CommandType::IF);
+		CommandList *list = current_list();
+		if (!list)
+			throw ParseError("Command outside of a section: " + line);
+		command->expression.evaluatable = ExpressionParser(condition).parse();
+		list->push_back(command);
+		levels.push_back({command.get(), false, nested_else_if});
+	};
+
+	excerpt->path = path;
+	while (fgets(buf, sizeof(buf), fp)) {
+		line = trim(buf);
+		if (line.empty())
+			continue;
+		if (line[0] == ';') {
+			if (sscanf(line.c_str(), "; expect-eliminated = %ld", &excerpt->expect_eliminated) == 1)
+				continue;
+			if (sscanf(line.c_str(), "; expect-shared = %ld", &excerpt->expect_shared) == 1)
+				continue;
+			sscanf(line.c_str(), "; expect-inlined = %ld", &excerpt->expect_inlined);
+			continue;
+		}
+		if (line[0] == '[') {
+			if (!levels.empty())
+				throw ParseError("Missing endif before " + line);
+			excerpt->sections.emplace_back();
+			current = &excerpt->sections.back();
+			continue;
+		}
+
+		if (starts_with(line, "if ")) {
+			add_if(line.substr(3), false);
+		} else if (starts_with(line, "else if ") || starts_with(line, "elif ")) {
+			if (levels.empty() || levels.back().in_else)
+				throw ParseError("Unexpected " + line);
+			levels.back().in_else = true;
+			add_if(line.substr(line[1] == 'l' && line[2] == 'i' ? 5 : 8), true);
+		} else if (line == "else") {
+			if (levels.empty() || levels.back().in_else)
+				throw ParseError("Unexpected else");
+			levels.back().in_else = true;
+		} else if (line == "endif") {
+			if (levels.empty())
+				throw ParseError("Unexpected endif");
+			while (levels.back().nested_else_if)
+				levels.pop_back();
+			levels.pop_back();
+		} else {
+			eq = line.find('=');
+			if (eq == string::npos || !current_list())
+				throw ParseError("Unrecognised line: " + line);
+			key = trim(line.substr(0, eq));
+			val = trim(line.substr(eq + 1));
+			shared_ptr<Command> command;
+			if (key[0] == '$') {
+				command = make_shared<Command>(CommandType::VARIABLE_ASSIGNMENT);
+				command->target = &world.variables[key];
+			} else if (strchr("xyzw", key[0]) && key.find_first_not_of("0123456789", 1) == string::npos) {
+				command = make_shared<Command>(CommandType::PARAM_OVERRIDE);
+				command->target = &world.params[key];
+			} else {
+				command = make_shared<Command>(CommandType::OTHER);
+			}
+			if (command->type != CommandType::OTHER)
+				command->expression.evaluatable = ExpressionParser(val).parse();
+			current_list()->push_back(command);
+		}
+	}
+	fclose(fp);
+
+	if (!levels.empty())
+		throw ParseError("Missing endif at end of file");
+}
+
+// ---------------------------------------------------------------------------
+// The passes themselves, mirroring eliminate_common_subexpressions() and
+// optimise_command_lists()
+// ---------------------------------------------------------------------------
+
+// Every if block has its own command list, which is registered for the
+// optimiser along with the section's:
+static void collect_commands(CommandList *commands, vector<shared_ptr<Command>> *ret,
+		vector<CommandList*> *lists)
+{
+	lists->push_back(commands);
+	for (auto &command : *commands) {
+		ret->push_back(command);
+		collect_commands(&command->true_commands, ret, lists);
+		collect_commands(&command->false_commands, ret, lists);
+	}
+}
+
+// The stand-in commands only have the pre list, which is also why they are
+// always finalised:
+struct StandInStaticIfTraits {
+	static CommandList* commands(CommandList *command_list)
+	{
+		return command_list;
+	}
+
+	static bool post(CommandList *command_list)
+	{
+		return false;
+	}
+
+	static bool static_condition(Command *command, float *val)
+	{
+		if (command->type != CommandType::IF)
+			return false;
+
+		return command->expression.evaluatable->static_evaluate(val);
+	}
+
+	static CommandList* branch(Command *command, bool post, bool taken)
+	{
+		return taken ? &command->true_commands : &command->false_commands;
+	}
+
+	static void inlined(Command *command, bool post, bool taken)
+	{
+	}
+};
+
+static void find_dependencies(Node *node, unordered_set<float*> *deps)
+{
+	Operator *op = dynamic_cast<Operator*>(node);
+	Operand *operand = dynamic_cast<Operand*>(node);
+
+	if (op) {
+		if (op->lhs)
+			find_dependencies(op->lhs.get(), deps);
+		find_dependencies(op->rhs.get(), deps);
+	} else if (operand && operand->ptr) {
+		deps->insert(operand->ptr);
+	}
+}
+
+// Inlined if commands are counted once for each command list they are
+// inlined into, which for a nested if may be both its own block and the
+// section the block around it was inlined into.
+static void optimise(Excerpt *excerpt, unsigned *eliminated, unsigned *shared, unsigned *inlined)
+{
+	CommandListCSE<Node, StandInCSETraits> cse;
+	unordered_set<float*> deps;
+	// Keeps the lists of inlined if commands alive, as
+	// dynamically_allocated_command_lists does:
+	vector<shared_ptr<Command>> commands;
+	vector<CommandList*> lists;
+	bool making_progress;
+	size_t i;
+
+	for (CommandList &section : excerpt->sections)
+		collect_commands(&section, &commands, &lists);
+
+	for (auto &command : commands) {
+		if (command->expression.evaluatable)
+			cse.add(&command->expression.evaluatable);
+	}
+	cse.run();
+
+	for (auto &command : commands) {
+		if (command->expression.evaluatable)
+			command->expression.compile();
+	}
+
+	for (auto &subexpression : cse.hoisted)
+		find_dependencies(subexpression.get(), &deps);
+	for (auto &command : commands) {
+		if (command->type == CommandType::VARIABLE_ASSIGNMENT ||
+		    command->type == CommandType::PARAM_OVERRIDE)
+			command->invalidates_expression_cache = !!deps.count(command->target);
+	}
+
+	*eliminated = cse.eliminated;
+	*shared = (unsigned)cse.hoisted.size();
+
+	*inlined = 0;
+	do {
+		making_progress = false;
+		for (CommandList *list : lists) {
+			for (i = 0; i < list->size(); ) {
+				if (inline_static_if<CommandList, StandInStaticIfTraits>(list, i)) {
+					(*inlined)++;
+					making_progress = true;
+					continue;
+				}
+				i++;
+			}
+		}
+	} while (making_progress);
+}
+
+static bool contains_static_if(CommandList *commands)
+{
+	float val;
+
+	for (auto &command : *commands) {
+		if (StandInStaticIfTraits::static_condition(command.get(), &val))
+			return true;
+		if (contains_static_if(&command->true_commands) || contains_static_if(&command->false_commands))
+			return true;
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+// Driver
+// ---------------------------------------------------------------------------
+
+typedef map<string, uint32_t> Results;
+
+static uint32_t float_bits(float f)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static Results run_excerpt(Excerpt *excerpt, unsigned seed)
+{
+	Results results;
+
+	world.rng.seed(seed);
+	for (auto &kv : world.variables)
+		kv.second = random_value();
+	for (auto &kv : world.params)
+		kv.second = random_value();
+	for (auto &kv : world.state_operands)
+		kv.second = random_value();
+	world.time = 0;
+	world.state_changes = 0;
+
+	for (CommandList &section : excerpt->sections) {
+		State state;
+		run_command_list(&section, &state);
+	}
+
+	for (auto &kv : world.variables)
+		results[kv.first] = float_bits(kv.second);
+	for (auto &kv : world.params)
+		results[kv.first] = float_bits(kv.second);
+	results["<state changes>"] = world.state_changes;
+	results["<time>"] = float_bits(world.time);
+	return results;
+}
+
+static bool test_excerpt(const string &path)
+{
+	Excerpt reference, optimised;
+	unsigned eliminated, shared, inlined;
+	bool ok = true;
+	int run;
+
+	try {
+		world = World();
+		parse_excerpt(path, &reference);
+		parse_excerpt(path, &optimised);
+	} catch (const ParseError &e) {
+		printf("FAIL  %s: %s\n", path.c_str(), e.what());
+		return false;
+	}
+
+	optimise(&optimised, &eliminated, &shared, &inlined);
+
+	if (optimised.expect_eliminated >= 0 && optimised.expect_eliminated != (long)eliminated) {
+		printf("FAIL  %s: eliminated %u nodes, expected %li\n",
+				path.c_str(), eliminated, optimised.expect_eliminated);
+		ok = false;
+	}
+	if (optimised.expect_shared >= 0 && optimised.expect_shared != (long)shared) {
+		printf("FAIL  %s: shared %u subexpressions, expected %li\n",
+				path.c_str(), shared, optimised.expect_shared);
+		ok = false;
+	}
+	if (optimised.expect_inlined >= 0 && optimised.expect_inlined != (long)inlined) {
+		printf("FAIL  %s: inlined %u static ifs, expected %li\n",
+				path.c_str(), inlined, optimised.expect_inlined);
+		ok = false;
+	}
+	for (CommandList &section : optimised.sections) {
+		if (contains_static_if(&section)) {
+			printf("FAIL  %s: static if left after inlining\n", path.c_str());
+			ok = false;
+			break;
+		}
+	}
+
+	for (run = 0; run < args.runs && ok; run++) {
+		Results expected = run_excerpt(&reference, run);
+		Results actual = run_excerpt(&optimised, run);
+		for (auto &kv : expected) {
+			if (actual[kv.first] != kv.second) {
+				printf("FAIL  %s: run %i: %s = 0x%08x, expected 0x%08x\n",
+						path.c_str(), run, kv.first.c_str(),
+						actual[kv.first], kv.second);
+				ok = false;
+			}
+		}
+	}
+
+	if (ok && args.verbose)
+		printf("PASS  %s: eliminated %u nodes, shared %u subexpressions, inlined %u static ifs\n",
+				path.c_str(), eliminated, shared, inlined);
+	return ok;
+}
+
+static void find_excerpts(const string &path, vector<string> *results)
+{
+	struct stat st;
+	struct dirent *ent;
+	vector<string> entries;
+	DIR *dir;
+
+	if (stat(path.c_str(), &st) || !S_ISDIR(st.st_mode)) {
+		results->push_back(path);
+		return;
+	}
+
+	dir = opendir(path.c_str());
+	if (!dir)
+		return;
+	while ((ent = readdir(dir))) {
+		string name = ent->d_name;
+		if (name.size() > 4 && !name.compare(name.size() - 4, 4, ".ini"))
+			entries.push_back(path + "/" + name);
+	}
+	closedir(dir);
+
+	sort(entries.begin(), entries.end());
+	results->insert(results->end(), entries.begin(), entries.end());
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> excerpts;
+	size_t failed = 0;
+
+	parse_args(argc, argv);
+
+	for (string &path : args.paths)
+		find_excerpts(path, &excerpts);
+
+	for (string &path : excerpts) {
+		if (!test_excerpt(path))
+			failed++;
+	}
+
+	printf("%zu excerpts, %zu failed\n", excerpts.size(), failed);
+	return failed || excerpts.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
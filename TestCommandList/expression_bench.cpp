@@ -0,0 +1,452 @@
+// expression_bench.cpp : Checks and benchmarks the bytecode evaluator for
+// command list expressions against the syntax tree evaluator it replaces.
+//
+// The command list code itself can only be built as part of the DirectX11
+// DLL, so this builds a stand-in for the syntax tree that has the same shape
+// as the real one (a virtual evaluate() per node, operands and operators
+// owned through shared_ptrs, and a virtual call for the operator body) from
+// the real operator definitions in DirectX11/CommandListOperators.h, and
+// lowers it with the real interpreter from DirectX11/CommandListBytecode.h.
+//
+// A large corpus of random expressions over constants (including -0.0, inf
+// and NAN to exercise === and !==), variables and operands that have to be
+// called back to is evaluated both ways against a series of random variable
+// values. Any result that is not bit for bit identical, or that calls back to
+// the operands in a different order (which matters for operands with side
+// effects, such as the texture filter updating its cache), fails the run,
+// then the two evaluators are timed against each other.
+
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CommandListBytecode.h"
+
+using namespace std;
+
+static struct {
+	size_t expressions = 100000;
+	size_t variable_sets = 16;
+	int max_depth = 6;
+	int repeat = 10;
+	unsigned seed = 1;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Compares the bytecode and syntax tree evaluators for command list expressions\n");
+	printf("over a randomly generated corpus, failing if their results ever differ.\n\n");
+
+	printf("  -n, --expressions N\n");
+	printf("\t\t\tNumber of random expressions to generate (default 100000)\n");
+
+	printf("  --variable-sets N\n");
+	printf("\t\t\tEvaluate every expression against N sets of variable values (default 16)\n");
+
+	printf("  --max-depth N\n");
+	printf("\t\t\tMaximum nesting depth of the generated expressions (default 6)\n");
+
+	printf("  -r, --repeat N\n");
+	printf("\t\t\tTime N passes over the corpus with each evaluator (default 10)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the expression generator (default 1)\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every expression that does not match\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--expressions")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.expressions = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--variable-sets")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.variable_sets = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--max-depth")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.max_depth = max(atoi(argv[i]), 0);
+			continue;
+		}
+		if (!strcmp(arg, "-r") || !strcmp(arg, "--repeat")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.repeat = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+// Stand-ins for the command list variables and for the operands that need
+// the command list state (rt_width, cursor_x, etc), which the bytecode calls
+// back to CommandListOperand::evaluate() for:
+#define NUM_VARIABLES 8
+#define NUM_STATE_OPERANDS 4
+static float variables[NUM_VARIABLES];
+static float state_operands[NUM_STATE_OPERANDS];
+
+// Every operand called back to while checking, in the order they were:
+static vector<const void*> evaluation_order;
+static bool record_evaluation_order;
+
+class Evaluatable {
+public:
+	virtual ~Evaluatable() {}
+
+	virtual float evaluate() = 0;
+	virtual void compile(CommandListBytecode *bytecode) = 0;
+	virtual string str() = 0;
+};
+
+enum class OperandType {
+	VALUE,
+	VARIABLE,
+	STATE,
+};
+
+class Operand : public Evaluatable {
+public:
+	OperandType type;
+	float val;
+	int idx;
+
+	Operand(OperandType type, float val, int idx) :
+		type(type), val(val), idx(idx)
+	{}
+
+	float evaluate() override
+	{
+		switch (type) {
+			case OperandType::VALUE:
+				return val;
+			case OperandType::VARIABLE:
+				return variables[idx];
+			case OperandType::STATE:
+				if (record_evaluation_order)
+					evaluation_order.push_back(this);
+				return state_operands[idx];
+		}
+		return 0;
+	}
+
+	void compile(CommandListBytecode *bytecode) override
+	{
+		switch (type) {
+			case OperandType::VALUE:
+				bytecode->push_value(val);
+				break;
+			case OperandType::VARIABLE:
+				bytecode->push_load(&variables[idx]);
+				break;
+			case OperandType::STATE:
+				bytecode->push_operand(this);
+				break;
+		}
+	}
+
+	string str() override
+	{
+		char buf[32];
+
+		switch (type) {
+			case OperandType::VALUE:
+				snprintf(buf, sizeof(buf), "%g", val);
+				break;
+			case OperandType::VARIABLE:
+				snprintf(buf, sizeof(buf), "$var%i", idx);
+				break;
+			case OperandType::STATE:
+				snprintf(buf, sizeof(buf), "state%i", idx);
+				break;
+		}
+		return buf;
+	}
+};
+
+class Operator : public Evaluatable {
+public:
+	shared_ptr<Evaluatable> lhs;
+	shared_ptr<Evaluatable> rhs;
+
+	float evaluate() override
+	{
+		float lhs_val;
+
+		if (lhs) { // Binary operator
+			// Left to right, as CommandListOperator::evaluate():
+			lhs_val = lhs->evaluate();
+			return evaluate(lhs_val, rhs->evaluate());
+		}
+		return evaluate(numeric_limits<float>::quiet_NaN(), rhs->evaluate());
+	}
+
+	void compile(CommandListBytecode *bytecode) override
+	{
+		if (lhs)
+			lhs->compile(bytecode);
+		rhs->compile(bytecode);
+		bytecode->push_operator(bytecode_fn(), !lhs);
+	}
+
+	string str() override
+	{
+		if (lhs)
+			return "(" + lhs->str() + " " + pattern() + " " + rhs->str() + ")";
+		return string(pattern()) + rhs->str();
+	}
+
+	virtual float evaluate(float lhs, float rhs) = 0;
+	virtual CommandListOperatorFn bytecode_fn() = 0;
+	virtual const char* pattern() = 0;
+};
+
+struct OperatorDef {
+	const char *name;
+	bool unary;
+	shared_ptr<Operator> (*create)();
+};
+static vector<OperatorDef> operator_defs;
+
+// Registers each operator from the shared definitions with the generator.
+// Unary operators are identified by name since which list an operator is in
+// (and therefore its precedence and arity) lives in CommandList.cpp:
+#define DEFINE_OPERATOR(name, operator_pattern, fn) \
+class name##T : public Operator { \
+public: \
+	static float apply(float lhs, float rhs) { return (fn); } \
+	float evaluate(float lhs, float rhs) override { return apply(lhs, rhs); } \
+	CommandListOperatorFn bytecode_fn() override { return apply; } \
+	const char* pattern() override { return operator_pattern; } \
+	static shared_ptr<Operator> create() { return make_shared<name##T>(); } \
+}; \
+static struct name##Registration { \
+	name##Registration() { \
+		operator_defs.push_back({#name, !strncmp(#name, "unary_", 6), name##T::create}); \
+	} \
+} name##_registration;
+
+#include "CommandListOperators.h"
+#undef DEFINE_OPERATOR
+
+static mt19937 rng;
+
+// Biased towards the values that actually show up in d3dx.ini files and the
+// edge cases that distinguish == from ===:
+static float random_value()
+{
+	static const float special[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 2.0f, 3.0f, 1920.0f, 1080.0f,
+		numeric_limits<float>::infinity(), -numeric_limits<float>::infinity(),
+		numeric_limits<float>::quiet_NaN(), FLT_MAX,
+	};
+
+	if (rng() % 2)
+		return special[rng() % (sizeof(special) / sizeof(special[0]))];
+	return uniform_real_distribution<float>(-100.0f, 100.0f)(rng);
+}
+
+static shared_ptr<Evaluatable> random_operand()
+{
+	switch (rng() % 3) {
+		case 0:
+			return make_shared<Operand>(OperandType::VALUE, random_value(), 0);
+		case 1:
+			return make_shared<Operand>(OperandType::VARIABLE, 0.0f, (int)(rng() % NUM_VARIABLES));
+		default:
+			return make_shared<Operand>(OperandType::STATE, 0.0f, (int)(rng() % NUM_STATE_OPERANDS));
+	}
+}
+
+static shared_ptr<Evaluatable> random_expression(int depth)
+{
+	shared_ptr<Operator> op;
+
+	if (depth <= 0 || rng() % 4 == 0)
+		return random_operand();
+
+	const OperatorDef &def = operator_defs[rng() % operator_defs.size()];
+	op = def.create();
+	if (!def.unary)
+		op->lhs = random_expression(depth - 1);
+	op->rhs = random_expression(depth - 1);
+	return op;
+}
+
+static void randomise_variables()
+{
+	int i;
+
+	for (i = 0; i < NUM_VARIABLES; i++)
+		variables[i] = random_value();
+	for (i = 0; i < NUM_STATE_OPERANDS; i++)
+		state_operands[i] = random_value();
+}
+
+static float run_bytecode(const CommandListBytecode &bytecode)
+{
+	return bytecode.run([](void *operand) {
+		return ((Operand*)operand)->Operand::evaluate();
+	});
+}
+
+static uint32_t float_bits(float f)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+struct Expression {
+	shared_ptr<Evaluatable> tree;
+	CommandListBytecode bytecode;
+};
+
+int main(int argc, char *argv[])
+{
+	vector<Expression> corpus;
+	vector<vector<float>> variable_sets;
+	vector<const void*> tree_order;
+	size_t i, v, mismatches = 0, order_mismatches = 0, too_deep = 0, nodes = 0;
+	volatile float sink = 0;
+	int r;
+
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	corpus.resize(args.expressions);
+	for (Expression &expression : corpus) {
+		expression.tree = random_expression(args.max_depth);
+		expression.tree->compile(&expression.bytecode);
+		if (!expression.bytecode.valid()) {
+			// Same as CommandListExpression::optimise(), which
+			// falls back to the tree for these:
+			expression.bytecode.clear();
+			too_deep++;
+		}
+		nodes += expression.bytecode.program.size();
+	}
+
+	for (v = 0; v < args.variable_sets; v++) {
+		randomise_variables();
+		variable_sets.emplace_back(variables, variables + NUM_VARIABLES);
+		variable_sets.back().insert(variable_sets.back().end(),
+				state_operands, state_operands + NUM_STATE_OPERANDS);
+	}
+
+	record_evaluation_order = true;
+	for (v = 0; v < args.variable_sets; v++) {
+		memcpy(variables, variable_sets[v].data(), sizeof(variables));
+		memcpy(state_operands, variable_sets[v].data() + NUM_VARIABLES, sizeof(state_operands));
+		for (i = 0; i < corpus.size(); i++) {
+			if (corpus[i].bytecode.empty())
+				continue;
+			evaluation_order.clear();
+			float tree = corpus[i].tree->evaluate();
+			tree_order.swap(evaluation_order);
+			evaluation_order.clear();
+			float bytecode = run_bytecode(corpus[i].bytecode);
+			if (tree_order != evaluation_order) {
+				order_mismatches++;
+				if (args.verbose) {
+					printf("ORDER MISMATCH %s\n",
+							corpus[i].tree->str().c_str());
+				}
+			}
+			if (float_bits(tree) != float_bits(bytecode)) {
+				mismatches++;
+				if (args.verbose) {
+					printf("MISMATCH %s: tree %g (0x%08x), bytecode %g (0x%08x)\n",
+							corpus[i].tree->str().c_str(),
+							tree, float_bits(tree),
+							bytecode, float_bits(bytecode));
+				}
+			}
+		}
+	}
+
+	printf("%zu expressions (%zu instructions, %zu left to the tree), %zu operators, %zu variable sets\n",
+			corpus.size(), nodes, too_deep, operator_defs.size(), args.variable_sets);
+	if (mismatches) {
+		printf("FAIL: %zu evaluations differ between the tree and bytecode\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	if (order_mismatches) {
+		printf("FAIL: %zu evaluations call back to operands in a different order between the tree and bytecode\n",
+				order_mismatches);
+		return EXIT_FAILURE;
+	}
+	record_evaluation_order = false;
+
+	chrono::duration<double, milli> tree_ms(0), bytecode_ms(0);
+	for (r = 0; r < args.repeat; r++) {
+		for (v = 0; v < args.variable_sets; v++) {
+			memcpy(variables, variable_sets[v].data(), sizeof(variables));
+			memcpy(state_operands, variable_sets[v].data() + NUM_VARIABLES, sizeof(state_operands));
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (Expression &expression : corpus)
+				sink = sink + expression.tree->evaluate();
+			chrono::steady_clock::time_point mid = chrono::steady_clock::now();
+			for (Expression &expression : corpus) {
+				if (expression.bytecode.empty())
+					sink = sink + expression.tree->evaluate();
+				else
+					sink = sink + run_bytecode(expression.bytecode);
+			}
+			chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+			tree_ms += mid - start;
+			bytecode_ms += end - mid;
+		}
+	}
+
+	double evaluations = (double)corpus.size() * args.variable_sets * args.repeat;
+	printf("  %-10s %10.3fms %8.1fns/expression\n", "tree",
+			tree_ms.count(), tree_ms.count() * 1e6 / evaluations);
+	printf("  %-10s %10.3fms %8.1fns/expression\n", "bytecode",
+			bytecode_ms.count(), bytecode_ms.count() * 1e6 / evaluations);
+	printf("  speedup    %10.2fx\n", tree_ms.count() / bytecode_ms.count());
+
+	return EXIT_SUCCESS;
+}
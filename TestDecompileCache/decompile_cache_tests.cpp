@@ -0,0 +1,370 @@
+// decompile_cache_tests.cpp : Checks and benchmarks the pack file that
+// DirectX11/DecompileCache.cpp keeps decompiled shaders in.
+//
+// Random entries are stored, then looked up again both from the same
+// instance and after reopening the file, as the next session would. The file
+// is then damaged the ways a crash or a bad disk would - cut off part way
+// through the last record, or with a byte flipped inside one - and the cache
+// must lose only the damaged record and keep working. Finally the time to
+// open a large cache and look up everything in it is measured.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "DecompileCache.h"
+
+using namespace std;
+
+static struct {
+	string path = "decompile_cache_tests.bin";
+	int entries = 500;
+	int benchmark_entries = 5000;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the decompiler cache pack file, then times opening and reading one.\n\n");
+
+	printf("  --file PATH\n");
+	printf("\t\t\tScratch pack file to use (default decompile_cache_tests.bin)\n");
+
+	printf("  -n, --entries N\n");
+	printf("\t\t\tNumber of entries to check with (default 500)\n");
+
+	printf("  --benchmark-entries N\n");
+	printf("\t\t\tNumber of entries to benchmark with (default 5000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random entries (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "--file")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.path = argv[i];
+			continue;
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--entries")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.entries = max(atoi(argv[i]), 2);
+			continue;
+		}
+		if (!strcmp(arg, "--benchmark-entries")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.benchmark_entries = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+struct TestEntry {
+	DecompileCacheKey key;
+	DecompileCacheEntry entry;
+};
+
+static string random_text(size_t max_len)
+{
+	string text(rng() % max_len, ' ');
+
+	for (char &c : text)
+		c = (char)(' ' + rng() % 95);
+	return text;
+}
+
+// Mostly distinct shaders, with some that differ only in the settings or
+// decompiler version so those are shown to be part of the key:
+static vector<TestEntry> random_entries(int count, size_t max_len)
+{
+	vector<TestEntry> entries(count);
+	char bytecode[64];
+	int i;
+
+	for (i = 0; i < count; i++) {
+		TestEntry &e = entries[i];
+		if (i && rng() % 4 == 0) {
+			e.key = entries[i - 1].key;
+			if (rng() % 2)
+				e.key.settings_hash++;
+			else
+				e.key.decompiler_version++;
+		} else {
+			for (char &b : bytecode)
+				b = (char)rng();
+			decompile_cache_key(&e.key, ((uint64_t)rng() << 32) | rng(),
+					bytecode, sizeof(bytecode), rng(), rng());
+		}
+		e.entry.error = rng() % 10 == 0;
+		if (!e.entry.error) {
+			e.entry.hlsl = random_text(max_len);
+			e.entry.asm_text = random_text(max_len);
+			e.entry.shader_model = "ps_5_0";
+			e.entry.patched = !!(rng() % 2);
+		}
+	}
+
+	return entries;
+}
+
+static FILE* open_pack(const char *mode)
+{
+	FILE *fp = fopen(args.path.c_str(), mode);
+
+	if (!fp) {
+		printf("Unable to open %s\n", args.path.c_str());
+		exit(EXIT_FAILURE);
+	}
+	return fp;
+}
+
+static bool reopen(DecompileCache *cache)
+{
+	return cache->open(open_pack("r+b"));
+}
+
+static void check_lookup(const char *step, DecompileCache *cache, const TestEntry &e, bool expect_hit)
+{
+	DecompileCacheEntry found;
+	bool hit = cache->lookup(e.key, &found);
+
+	if (hit != expect_hit) {
+		report_mismatch("%s: %016llx %s", step, (unsigned long long)e.key.shader_hash,
+				hit ? "found when it should not be" : "not found");
+		return;
+	}
+	if (hit && (found.hlsl != e.entry.hlsl || found.asm_text != e.entry.asm_text
+			|| found.shader_model != e.entry.shader_model
+			|| found.patched != e.entry.patched || found.error != e.entry.error))
+		report_mismatch("%s: %016llx came back different", step, (unsigned long long)e.key.shader_hash);
+}
+
+static void check_all(const char *step, DecompileCache *cache, const vector<TestEntry> &entries, bool expect_hit = true)
+{
+	for (const TestEntry &e : entries)
+		check_lookup(step, cache, e, expect_hit);
+}
+
+static long file_length()
+{
+	FILE *fp = open_pack("rb");
+	long size;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fclose(fp);
+	return size;
+}
+
+static void check_stats(const char *step, DecompileCache *cache, size_t loaded, bool discarded)
+{
+	DecompileCacheStats stats = cache->get_stats();
+
+	if (stats.loaded != loaded || !!stats.discarded != discarded)
+		report_mismatch("%s: found %u records with %llu bytes discarded, expected %zu records%s",
+				step, stats.loaded, (unsigned long long)stats.discarded,
+				loaded, discarded ? " and some discarded" : "");
+}
+
+static void check_cache()
+{
+	vector<TestEntry> entries = random_entries(args.entries, 4096);
+	TestEntry last = entries.back();
+	DecompileCache cache;
+	DecompileCacheStats stats;
+	long size_before_last, size;
+	FILE *fp;
+
+	if (!cache.open(open_pack("w+b")))
+		report_mismatch("unable to start an empty pack file");
+	check_all("empty", &cache, entries, false);
+	for (TestEntry &e : entries) {
+		size_before_last = file_length();
+		if (!cache.store(e.key, e.entry))
+			report_mismatch("store failed");
+	}
+	check_all("same session", &cache, entries);
+
+	stats = cache.get_stats();
+	if (stats.stores != entries.size() || stats.hits != entries.size() || stats.misses != entries.size())
+		report_mismatch("counted %u stores, %u hits, %u misses", stats.stores, stats.hits, stats.misses);
+
+	// Next session:
+	if (!reopen(&cache))
+		report_mismatch("unable to reopen pack file");
+	check_stats("next session", &cache, entries.size(), false);
+	check_all("next session", &cache, entries);
+	cache.close();
+
+	// Crash part way through writing the last record:
+	size = file_length();
+	if (truncate(args.path.c_str(), size_before_last + 1 + rng() % (size - size_before_last - 1)))
+		report_mismatch("unable to truncate pack file");
+	reopen(&cache);
+	entries.pop_back();
+	check_stats("torn record", &cache, entries.size(), true);
+	check_all("torn record", &cache, entries);
+	check_lookup("torn record", &cache, last, false);
+
+	// The next record goes over the torn one:
+	cache.store(last.key, last.entry);
+	reopen(&cache);
+	entries.push_back(last);
+	check_stats("after torn record", &cache, entries.size(), false);
+	check_all("after torn record", &cache, entries);
+
+	// A newer record for a key takes the place of the older one:
+	entries[0].entry.hlsl = "replaced";
+	entries[0].entry.error = false;
+	cache.store(entries[0].key, entries[0].entry);
+	check_lookup("replaced", &cache, entries[0], true);
+	reopen(&cache);
+	check_lookup("replaced after reopening", &cache, entries[0], true);
+	cache.close();
+
+	// Flip a byte of that newest record. The checksum catches it on lookup,
+	// and storing it again gives a good copy:
+	fp = open_pack("r+b");
+	fseek(fp, -1, SEEK_END);
+	size = fgetc(fp);
+	fseek(fp, -1, SEEK_END);
+	fputc((int)size ^ 0x55, fp);
+	fclose(fp);
+	reopen(&cache);
+	check_lookup("corrupt record", &cache, entries[0], false);
+	cache.store(entries[0].key, entries[0].entry);
+	check_lookup("corrupt record stored again", &cache, entries[0], true);
+	reopen(&cache);
+	check_lookup("corrupt record stored again and reopened", &cache, entries[0], true);
+	check_all("corrupt record stored again and reopened", &cache, entries);
+	cache.close();
+
+	// Anything that is not a pack file of this version is refused, so the
+	// caller can start a new one:
+	fp = open_pack("r+b");
+	fputc('X', fp);
+	fclose(fp);
+	if (reopen(&cache) || cache.is_open())
+		report_mismatch("opened a pack file with a bad header");
+
+	remove(args.path.c_str());
+}
+
+static void benchmark()
+{
+	vector<TestEntry> entries = random_entries(args.benchmark_entries, 16384);
+	DecompileCache cache;
+	DecompileCacheEntry found;
+	size_t bytes = 0, hits = 0;
+
+	for (TestEntry &e : entries)
+		bytes += e.entry.hlsl.size() + e.entry.asm_text.size();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	cache.open(open_pack("w+b"));
+	for (TestEntry &e : entries)
+		cache.store(e.key, e.entry);
+	cache.close();
+	chrono::duration<double, milli> store_ms = chrono::steady_clock::now() - start;
+
+	start = chrono::steady_clock::now();
+	reopen(&cache);
+	chrono::duration<double, milli> open_ms = chrono::steady_clock::now() - start;
+
+	start = chrono::steady_clock::now();
+	for (TestEntry &e : entries)
+		hits += cache.lookup(e.key, &found);
+	chrono::duration<double, milli> lookup_ms = chrono::steady_clock::now() - start;
+	cache.close();
+	remove(args.path.c_str());
+
+	printf("%zu entries, %.1f MB of text:\n", entries.size(), bytes / 1048576.0);
+	printf("  store all     %10.3fms\n", store_ms.count());
+	printf("  open          %10.3fms\n", open_ms.count());
+	printf("  look up all   %10.3fms  (%zu hits, %.1fus each)\n", lookup_ms.count(), hits,
+			lookup_ms.count() * 1000.0 / entries.size());
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_cache();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,926 @@
+// frame_analysis_store_tests.cpp : Checks and benchmarks the store that
+// DirectX11/FrameAnalysisStore.cpp keeps deduplicated frame analysis dumps in
+// with store_dupes, and the manifest listing the files that refer to them.
+//
+// The LZ4 coder must give back exactly what it was given for random,
+// repetitive and text data of every small size, decode hand built blocks the
+// way the block format specifies, and reject damaged blocks without going out
+// of bounds. Blobs are added to the store from several threads at once, with
+// each key stored only once, then read back both from the same instance and
+// after reopening the store. It is then damaged the ways a crash or a bad
+// disk would - cut off part way through the last record, or with a byte
+// flipped inside one - and must lose only the damaged record, which can then
+// be added again. The manifest must read back every entry it was given,
+// names outside ASCII included, across the appends of a hold mode analysis.
+//
+// The benchmark dumps a synthetic frame of a few thousand draw calls each
+// referring to shared constant, vertex and index buffers and textures, both
+// as deduplicated files hard linked into the frame analysis directory as
+// link_deduplicated_files does, and into the store and manifest. It reports
+// the time and disk space each takes, and the time to extract the frame
+// from the store again.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FrameAnalysisStore.h"
+
+using namespace std;
+
+static struct {
+	string path = "frame_analysis_store_tests.fastore";
+	string dir = "frame_analysis_store_tests.dir";
+	int blobs = 500;
+	int draws = 3000;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the frame analysis dump store, then compares dumping a synthetic frame\n");
+	printf("into it against hard linking deduplicated files.\n\n");
+
+	printf("  --file PATH\n");
+	printf("\t\t\tScratch store file to use (default frame_analysis_store_tests.fastore)\n");
+
+	printf("  --dir PATH\n");
+	printf("\t\t\tScratch directory for the benchmark (default frame_analysis_store_tests.dir)\n");
+
+	printf("  -n, --blobs N\n");
+	printf("\t\t\tNumber of blobs to check with (default 500)\n");
+
+	printf("  --draws N\n");
+	printf("\t\t\tNumber of draw calls in the benchmark frame (default 3000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random data (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "--file")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.path = argv[i];
+			continue;
+		}
+		if (!strcmp(arg, "--dir")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.dir = argv[i];
+			continue;
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--blobs")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.blobs = max(atoi(argv[i]), 4);
+			continue;
+		}
+		if (!strcmp(arg, "--draws")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.draws = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static wstring widen(const string &str)
+{
+	return wstring(str.begin(), str.end());
+}
+
+// ----------------------------------------------------------------------------
+// Data that looks like what frame analysis dumps
+// ----------------------------------------------------------------------------
+
+static vector<uint8_t> random_bytes(size_t len)
+{
+	vector<uint8_t> bytes(len);
+
+	for (uint8_t &b : bytes)
+		b = (uint8_t)rng();
+	return bytes;
+}
+
+// Mostly zero with a few float4s filled in, like a constant buffer:
+static vector<uint8_t> constant_buffer(size_t len)
+{
+	vector<uint8_t> bytes(len);
+	float val;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		if (rng() % 3)
+			continue;
+		for (int j = 0; j < 4; j++) {
+			val = (float)(rng() % 2000) / 100.0f - 10.0f;
+			memcpy(&bytes[i + j * 4], &val, 4);
+		}
+	}
+	return bytes;
+}
+
+// Positions on a grid with normals and texture coordinates:
+static vector<uint8_t> vertex_buffer(size_t vertices)
+{
+	vector<float> floats;
+	float base = (float)(rng() % 100);
+	size_t i;
+
+	for (i = 0; i < vertices; i++) {
+		floats.push_back(base + (float)(i % 64));
+		floats.push_back(base + (float)(i / 64));
+		floats.push_back((float)(rng() % 16) / 4.0f);
+		floats.push_back(0.0f);
+		floats.push_back(1.0f);
+		floats.push_back(0.0f);
+		floats.push_back((float)(i % 64) / 64.0f);
+		floats.push_back((float)(i / 64) / 64.0f);
+	}
+	vector<uint8_t> bytes(floats.size() * 4);
+	memcpy(bytes.data(), floats.data(), bytes.size());
+	return bytes;
+}
+
+static vector<uint8_t> index_buffer(size_t indices)
+{
+	vector<uint8_t> bytes(indices * 2);
+	uint16_t idx;
+	size_t i;
+
+	for (i = 0; i < indices; i++) {
+		idx = (uint16_t)(i / 6 * 4 + "\0\1\2\2\1\3"[i % 6]);
+		memcpy(&bytes[i * 2], &idx, 2);
+	}
+	return bytes;
+}
+
+// A smooth gradient with a little noise, in a DDS sized RGBA8 texture:
+static vector<uint8_t> texture(unsigned width, unsigned height)
+{
+	vector<uint8_t> bytes(128 + width * height * 4);
+	unsigned x, y, r = rng() % 256, g = rng() % 256, noise = rng() % 4;
+
+	memcpy(bytes.data(), "DDS ", 4);
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			uint8_t *p = &bytes[128 + (y * width + x) * 4];
+			p[0] = (uint8_t)(r + x * 255 / width + (noise ? rng() % noise : 0));
+			p[1] = (uint8_t)(g + y * 255 / height);
+			p[2] = (uint8_t)((x ^ y) & 0x10 ? 0x80 : 0x40);
+			p[3] = 0xff;
+		}
+	}
+	return bytes;
+}
+
+// A .txt dump of a buffer, as FrameAnalysisText would format it:
+static vector<uint8_t> text_dump(const vector<uint8_t> &buf)
+{
+	string text;
+	char line[128];
+	float val;
+	size_t i;
+
+	for (i = 0; i + 16 <= buf.size() && text.size() < 256 * 1024; i += 16) {
+		text += "vb0[" + to_string(i / 16) + "]+000 ";
+		for (int j = 0; j < 4; j++) {
+			memcpy(&val, &buf[i + j * 4], 4);
+			snprintf(line, sizeof(line), "%s%.9g", j ? ", " : "", val);
+			text += line;
+		}
+		text += "\n";
+	}
+	return vector<uint8_t>(text.begin(), text.end());
+}
+
+// ----------------------------------------------------------------------------
+// LZ4
+// ----------------------------------------------------------------------------
+
+static void check_round_trip(const char *kind, const vector<uint8_t> &data)
+{
+	vector<uint8_t> compressed(lz4_compress_bound(data.size()));
+	vector<uint8_t> out(data.size() + 1);
+	size_t size;
+
+	size = lz4_compress(data.data(), data.size(), compressed.data(), compressed.size());
+	if (!size) {
+		report_mismatch("lz4: %s of %zu bytes did not fit in the bound", kind, data.size());
+		return;
+	}
+	compressed.resize(size);
+	if (!lz4_decompress(compressed.data(), size, out.data(), data.size())
+			|| memcmp(out.data(), data.data(), data.size())) {
+		report_mismatch("lz4: %s of %zu bytes came back different", kind, data.size());
+		return;
+	}
+
+	// Wrong sizes are rejected rather than padded or cut short:
+	if (lz4_decompress(compressed.data(), size, out.data(), data.size() + 1))
+		report_mismatch("lz4: %s of %zu bytes decompressed to one byte more", kind, data.size());
+	if (data.size() && lz4_decompress(compressed.data(), size, out.data(), data.size() - 1))
+		report_mismatch("lz4: %s of %zu bytes decompressed to one byte less", kind, data.size());
+
+	// Too small a buffer fails instead of writing past it:
+	if (size > 1) {
+		vector<uint8_t> small(size - 1);
+		if (lz4_compress(data.data(), data.size(), small.data(), small.size()))
+			report_mismatch("lz4: %s of %zu bytes compressed into less room than it needs", kind, data.size());
+	}
+}
+
+static void check_lz4()
+{
+	vector<uint8_t> data, compressed, out;
+	size_t len, size, i;
+
+	// Every small size, where the end of block rules matter most:
+	for (len = 0; len < 64; len++) {
+		check_round_trip("random", random_bytes(len));
+		check_round_trip("zeros", vector<uint8_t>(len));
+		data.resize(len);
+		for (i = 0; i < len; i++)
+			data[i] = "abcab"[i % 5];
+		check_round_trip("repeating", data);
+	}
+
+	for (i = 0; i < 50; i++) {
+		len = rng() % 300000;
+		check_round_trip("random", random_bytes(len));
+		check_round_trip("constant buffer", constant_buffer(len));
+		check_round_trip("vertex buffer", vertex_buffer(len / 32));
+		check_round_trip("index buffer", index_buffer(len / 2));
+		check_round_trip("text", text_dump(vertex_buffer(len / 32)));
+	}
+	// Runs and literals long enough for several length bytes, and matches
+	// as far back as the window goes:
+	check_round_trip("zeros", vector<uint8_t>(1000000));
+	data = random_bytes(70000);
+	data.insert(data.end(), data.begin(), data.end());
+	check_round_trip("repeated random", data);
+	check_round_trip("texture", texture(512, 512));
+
+	// Built by hand from the block format specification: three literals
+	// and a match of 8 from 3 back, then the last five literals:
+	static const uint8_t block[] = { 0x34, 'a', 'b', 'c', 3, 0, 0x50, 'c', 'a', 'b', 'c', 'a' };
+	out.resize(16);
+	if (!lz4_decompress(block, sizeof(block), out.data(), out.size())
+			|| memcmp(out.data(), "abcabcabcabcabca", 16))
+		report_mismatch("lz4: hand built block decoded wrong");
+
+	// Literal and match lengths that continue into extra bytes:
+	static const uint8_t long_block[] = { 0xff, 3, 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+		'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 1, 0, 255, 1, 0x00 };
+	out.resize(18 + 4 + 15 + 256);
+	if (!lz4_decompress(long_block, sizeof(long_block), out.data(), out.size())
+			|| count(out.begin(), out.end(), 'x') != (ptrdiff_t)out.size())
+		report_mismatch("lz4: block with long lengths decoded wrong");
+
+	// Damaged blocks either fail or decode to something of the right
+	// size, never past the end of either buffer:
+	data = text_dump(vertex_buffer(2000));
+	compressed.resize(lz4_compress_bound(data.size()));
+	size = lz4_compress(data.data(), data.size(), compressed.data(), compressed.size());
+	compressed.resize(size);
+	out.resize(data.size());
+	for (i = 0; i < 2000; i++) {
+		vector<uint8_t> damaged = compressed;
+		damaged[rng() % damaged.size()] ^= (uint8_t)(1 + rng() % 255);
+		if (rng() % 4 == 0)
+			damaged.resize(rng() % damaged.size());
+		lz4_decompress(damaged.data(), damaged.size(), out.data(), out.size());
+	}
+	for (i = 0; i < 2000; i++) {
+		vector<uint8_t> junk = random_bytes(rng() % 256);
+		lz4_decompress(junk.data(), junk.size(), out.data(), rng() % 1024);
+	}
+	static const uint8_t bad_offsets[][8] = {
+		{ 0x14, 'a', 0, 0, 0x10, 'a' },    // Offset 0
+		{ 0x14, 'a', 2, 0, 0x10, 'a' },    // Before the start
+		{ 0x1f, 'a', 1, 0 },               // Ends short of the size asked for
+		{ 0xf0 },                          // Literals run out of input
+	};
+	for (auto &bad : bad_offsets) {
+		if (lz4_decompress(bad, 6, out.data(), 64))
+			report_mismatch("lz4: accepted a block with a bad offset or length");
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Store
+// ----------------------------------------------------------------------------
+
+struct TestBlob {
+	string key;
+	vector<uint8_t> data;
+};
+
+static const char *extensions[] = { ".buf", ".dsc", "-R8G8B8A8_UNORM.dds", "-vb0-stride=32-offset=0.txt" };
+
+static vector<TestBlob> random_blobs(int count)
+{
+	vector<TestBlob> blobs(count);
+	char key[64];
+	int i;
+
+	for (i = 0; i < count; i++) {
+		snprintf(key, sizeof(key), "%08x%s", (unsigned)rng(), extensions[rng() % 4]);
+		blobs[i].key = key;
+		switch (rng() % 4) {
+		case 0: blobs[i].data = random_bytes(rng() % 4096); break;
+		case 1: blobs[i].data = constant_buffer(rng() % 65536); break;
+		case 2: blobs[i].data = text_dump(vertex_buffer(rng() % 512)); break;
+		case 3: blobs[i].data = texture(16 + rng() % 64, 16 + rng() % 64); break;
+		}
+	}
+	return blobs;
+}
+
+static void check_read(const char *step, FrameAnalysisStore *store, const TestBlob &b, bool expect_hit)
+{
+	vector<uint8_t> found;
+	bool hit = store->read(b.key, &found);
+
+	if (hit != expect_hit) {
+		report_mismatch("%s: %s %s", step, b.key.c_str(),
+				hit ? "found when it should not be" : "not found");
+		return;
+	}
+	if (hit && found != b.data)
+		report_mismatch("%s: %s came back different", step, b.key.c_str());
+	if (store->contains(b.key) != expect_hit)
+		report_mismatch("%s: contains() disagrees with read() for %s", step, b.key.c_str());
+}
+
+static void check_all(const char *step, FrameAnalysisStore *store, const vector<TestBlob> &blobs, bool expect_hit = true)
+{
+	for (const TestBlob &b : blobs)
+		check_read(step, store, b, expect_hit);
+}
+
+static void check_stats(const char *step, FrameAnalysisStore *store, size_t blobs, bool discarded)
+{
+	FrameAnalysisStoreStats stats = store->get_stats();
+
+	if (stats.blobs != blobs || !!stats.discarded != discarded)
+		report_mismatch("%s: found %u blobs with %llu bytes discarded, expected %zu blobs%s",
+				step, stats.blobs, (unsigned long long)stats.discarded,
+				blobs, discarded ? " and some discarded" : "");
+}
+
+static off_t file_length(const string &path)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st))
+		return -1;
+	return st.st_size;
+}
+
+static bool reopen(FrameAnalysisStore *store, bool read_only = false)
+{
+	store->close();
+	return store->open(widen(args.path).c_str(), read_only);
+}
+
+static void flip_byte(off_t offset)
+{
+	FILE *fp = fopen(args.path.c_str(), "r+b");
+	int c;
+
+	fseek(fp, offset, SEEK_SET);
+	c = fgetc(fp);
+	fseek(fp, offset, SEEK_SET);
+	fputc(c ^ 0x55, fp);
+	fclose(fp);
+}
+
+static void check_store()
+{
+	vector<TestBlob> blobs = random_blobs(args.blobs);
+	vector<thread> threads;
+	atomic<size_t> failed(0);
+	FrameAnalysisStore store;
+	FrameAnalysisStoreStats stats;
+	TestBlob last;
+	off_t size_before_last, size;
+	FILE *fp;
+	unsigned t;
+
+	// Kept aside to be added last, so the store can be cut off part way
+	// through it:
+	last = blobs.back();
+	blobs.pop_back();
+
+	remove(args.path.c_str());
+	if (store.open(widen(args.path).c_str(), true))
+		report_mismatch("opened a store that does not exist read only");
+	if (!store.open(widen(args.path).c_str()))
+		report_mismatch("unable to create a store file");
+	check_all("empty", &store, blobs, false);
+
+	// The writer threads each add every blob, as several dumps of the same
+	// resource would, so each key must still only be stored once:
+	for (t = 0; t < 4; t++) {
+		threads.emplace_back([&, t] {
+			for (size_t i = 0; i < blobs.size(); i++) {
+				const TestBlob &b = blobs[(i + t * blobs.size() / 4) % blobs.size()];
+				if (!store.add(b.key, b.data.data(), b.data.size()))
+					failed++;
+			}
+		});
+	}
+	for (thread &th : threads)
+		th.join();
+	if (failed)
+		report_mismatch("%zu adds failed", failed.load());
+	stats = store.get_stats();
+	if (stats.blobs != blobs.size() || stats.added != blobs.size() || stats.duplicates != blobs.size() * 3)
+		report_mismatch("counted %u blobs, %u added and %u duplicates from %zu blobs added four times",
+				stats.blobs, stats.added, stats.duplicates, blobs.size());
+	if (stats.stored_bytes >= stats.raw_bytes)
+		report_mismatch("%llu bytes of blobs took %llu bytes to store",
+				(unsigned long long)stats.raw_bytes, (unsigned long long)stats.stored_bytes);
+
+	store.flush();
+	size_before_last = file_length(args.path);
+	store.add(last.key, last.data.data(), last.data.size());
+	blobs.push_back(last);
+	check_all("same session", &store, blobs);
+
+	// Next session:
+	if (!reopen(&store))
+		report_mismatch("unable to reopen store file");
+	check_stats("next session", &store, blobs.size(), false);
+	check_all("next session", &store, blobs);
+	if (!reopen(&store, true))
+		report_mismatch("unable to reopen store file read only");
+	check_all("read only", &store, blobs);
+	if (store.add("new.buf", "x", 1))
+		report_mismatch("added to a store opened read only");
+	store.close();
+
+	// Crash part way through writing the last record:
+	size = file_length(args.path);
+	if (truncate(args.path.c_str(), size_before_last + 1 + rng() % (size - size_before_last - 1)))
+		report_mismatch("unable to truncate store file");
+	reopen(&store);
+	blobs.pop_back();
+	check_stats("torn record", &store, blobs.size(), true);
+	check_all("torn record", &store, blobs);
+	check_read("torn record", &store, last, false);
+	if (file_length(args.path) != size_before_last)
+		report_mismatch("torn record was not cut off the end of the store file");
+
+	// The next record goes where the torn one was:
+	store.add(last.key, last.data.data(), last.data.size());
+	reopen(&store);
+	blobs.push_back(last);
+	check_stats("after torn record", &store, blobs.size(), false);
+	check_all("after torn record", &store, blobs);
+
+	// Flip the last byte of the newest record. The checksum catches it,
+	// and it can then be added again:
+	last.key = "corrupt.txt";
+	last.data = text_dump(vertex_buffer(64));
+	store.add(last.key, last.data.data(), last.data.size());
+	store.close();
+	flip_byte(file_length(args.path) - 1);
+	reopen(&store);
+	check_read("corrupt record", &store, last, false);
+	if (!store.add(last.key, last.data.data(), last.data.size()) || store.get_stats().added != 1)
+		report_mismatch("corrupt record was not added again");
+	check_read("corrupt record added again", &store, last, true);
+	reopen(&store);
+	check_read("corrupt record added again and reopened", &store, last, true);
+	check_all("corrupt record added again and reopened", &store, blobs);
+	store.close();
+
+	// Anything that is not a store of this version is left alone when
+	// read only, and started over otherwise:
+	fp = fopen(args.path.c_str(), "r+b");
+	fputc('X', fp);
+	fclose(fp);
+	size = file_length(args.path);
+	if (reopen(&store, true) || file_length(args.path) != size)
+		report_mismatch("read only open of a store with a bad header did not fail cleanly");
+	if (!reopen(&store))
+		report_mismatch("unable to start over a store file with a bad header");
+	check_stats("bad header", &store, 0, false);
+	check_all("bad header", &store, blobs, false);
+	store.close();
+
+	remove(args.path.c_str());
+}
+
+// ----------------------------------------------------------------------------
+// Manifest
+// ----------------------------------------------------------------------------
+
+static wstring random_name()
+{
+	static const wchar_t *parts[] = { L"000123-", L"ps-t0=", L"vb0=", L"ib=", L"-vs=a1c3c2c1cf64c2d4",
+		L"ctx-0x000001234\\", L"Résource", L"日本語", L"\U0001f600", L".dds", L".txt", L".buf" };
+	wstring name;
+	int i, n = 1 + rng() % 6;
+
+	for (i = 0; i < n; i++)
+		name += parts[rng() % (sizeof(parts) / sizeof(parts[0]))];
+	return name;
+}
+
+static void check_manifest()
+{
+	vector<FrameAnalysisManifestEntry> entries, found;
+	FrameAnalysisManifest manifest;
+	FrameAnalysisManifestEntry entry;
+	wstring path = widen(args.path + ".txt");
+	string text;
+	size_t i, half;
+	wchar_t c;
+
+	// Every code point survives the trip through UTF-8:
+	for (i = 0; i < 10000; i++) {
+		wstring str;
+		for (int j = rng() % 8; j > 0; j--) {
+			do {
+				c = (wchar_t)(rng() % 0x110000);
+			} while (c >= 0xd800 && c < 0xe000);
+			str += c;
+		}
+		text = frame_analysis_store_utf8(str.c_str(), str.size());
+		if (frame_analysis_store_widen(text.c_str(), text.size()) != str)
+			report_mismatch("manifest: a string did not survive UTF-8");
+	}
+	text = "\xc3\x28\xe2\x82\xf0\x9f\x98\x80\x80";
+	if (frame_analysis_store_widen(text.c_str(), text.size()) != L"\ufffd(\ufffd\ufffd\U0001f600\ufffd")
+		report_mismatch("manifest: bad UTF-8 was not replaced");
+
+	for (i = 0; i < 1000; i++) {
+		entry.store = rng() % 8 ? L"deduped\\deduped.fastore" : L"C:\\Games\\FrameAnalysisDeduped\\deduped.fastore";
+		entry.key = random_blobs(1)[0].key;
+		entry.name = random_name();
+		entries.push_back(entry);
+	}
+
+	// Written in two halves, as a hold mode frame analysis would:
+	remove((args.path + ".txt").c_str());
+	half = entries.size() / 2;
+	for (i = 0; i < entries.size(); i++) {
+		if (i == 0 || i == half) {
+			if (!manifest.open(path.c_str()))
+				report_mismatch("manifest: unable to open");
+		}
+		manifest.add(entries[i].store, entries[i].key, entries[i].name.c_str());
+		if (i == half - 1)
+			manifest.close();
+	}
+	manifest.close();
+
+	if (!read_frame_analysis_manifest(path.c_str(), &found))
+		report_mismatch("manifest: unable to read back");
+	if (found.size() != entries.size()) {
+		report_mismatch("manifest: read back %zu entries of %zu", found.size(), entries.size());
+	} else {
+		for (i = 0; i < entries.size(); i++) {
+			if (found[i].store != entries[i].store || found[i].key != entries[i].key
+					|| found[i].name != entries[i].name)
+				report_mismatch("manifest: entry %zu came back different", i);
+		}
+	}
+
+	remove((args.path + ".txt").c_str());
+	if (read_frame_analysis_manifest(path.c_str(), &found))
+		report_mismatch("manifest: read one that does not exist");
+}
+
+// ----------------------------------------------------------------------------
+// Benchmark
+// ----------------------------------------------------------------------------
+
+struct Frame {
+	vector<TestBlob> unique;
+	vector<pair<string, size_t>> dumps; // Name in the frame analysis directory, unique blob
+};
+
+// Each draw call dumps its constant buffers, vertex and index buffer as
+// .buf and .txt, its render target and a few textures. Most of them are
+// shared between draw calls, while the render target changes every time:
+static Frame synthetic_frame(int draws)
+{
+	Frame frame;
+	vector<size_t> cbs, vbs, ibs, textures;
+	char name[128], slot[16];
+	size_t idx;
+	int draw, i;
+
+	auto add = [&](const char *ext, vector<uint8_t> data) {
+		char key[64];
+		snprintf(key, sizeof(key), "%08x%s", (unsigned)rng(), ext);
+		frame.unique.push_back({ key, move(data) });
+		return frame.unique.size() - 1;
+	};
+	for (i = 0; i < draws / 10; i++) {
+		vector<uint8_t> cb = constant_buffer(16 * (1 + rng() % 256));
+		cbs.push_back(add(".buf", cb));
+		add(".txt", text_dump(cb));
+	}
+	for (i = 0; i < draws / 10; i++) {
+		vector<uint8_t> vb = vertex_buffer(64 + rng() % 4096);
+		vbs.push_back(add(".buf", vb));
+		add(".txt", text_dump(vb));
+		ibs.push_back(add(".buf", index_buffer(96 + rng() % 6144)));
+		add(".txt", text_dump(frame.unique[ibs.back()].data));
+	}
+	for (i = 0; i < draws / 20; i++)
+		textures.push_back(add("-R8G8B8A8_UNORM.dds", texture(256, 256)));
+
+	for (draw = 1; draw <= draws; draw++) {
+		auto dump = [&](const char *slot, size_t blob, bool txt) {
+			snprintf(name, sizeof(name), "%06d-%s%s", draw, slot, strrchr(frame.unique[blob].key.c_str(), '.'));
+			frame.dumps.push_back({ name, blob });
+			if (txt) {
+				snprintf(name, sizeof(name), "%06d-%s.txt", draw, slot);
+				frame.dumps.push_back({ name, blob + 1 });
+			}
+		};
+		for (i = 0; i < 3; i++) {
+			snprintf(slot, sizeof(slot), "vs-cb%d", i);
+			dump(slot, cbs[rng() % cbs.size()], true);
+		}
+		idx = rng() % vbs.size();
+		dump("vb0", vbs[idx], true);
+		dump("ib", ibs[idx], true);
+		for (i = 0; i < 4; i++) {
+			snprintf(slot, sizeof(slot), "ps-t%d", i);
+			dump(slot, textures[rng() % textures.size()], false);
+		}
+		// A render target that changes as the frame is drawn:
+		if (draw % 10 == 0)
+			dump("o0", add("-R8G8B8A8_UNORM.dds", texture(256, 256)), false);
+	}
+
+	return frame;
+}
+
+static void write_file(const string &path, const vector<uint8_t> &buf)
+{
+	FILE *fp = fopen(path.c_str(), "wb");
+
+	if (!fp) {
+		printf("Unable to write %s\n", path.c_str());
+		exit(EXIT_FAILURE);
+	}
+	fwrite(buf.data(), 1, buf.size(), fp);
+	fclose(fp);
+}
+
+// Disk used by a directory tree, counting each hard linked file once:
+static uint64_t disk_usage(const string &dir, unordered_set<ino_t> *seen)
+{
+	struct dirent *ent;
+	struct stat st;
+	uint64_t total = 0;
+	DIR *d = opendir(dir.c_str());
+
+	if (!d)
+		return 0;
+	while ((ent = readdir(d))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		string path = dir + "/" + ent->d_name;
+		if (lstat(path.c_str(), &st))
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			total += disk_usage(path, seen);
+		} else if (seen->insert(st.st_ino).second) {
+			total += (uint64_t)st.st_blocks * 512;
+		}
+	}
+	closedir(d);
+	return total;
+}
+
+static void remove_tree(const string &dir)
+{
+	struct dirent *ent;
+	struct stat st;
+	DIR *d = opendir(dir.c_str());
+
+	if (!d)
+		return;
+	while ((ent = readdir(d))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		string path = dir + "/" + ent->d_name;
+		if (!lstat(path.c_str(), &st) && S_ISDIR(st.st_mode))
+			remove_tree(path);
+		else
+			unlink(path.c_str());
+	}
+	closedir(d);
+	rmdir(dir.c_str());
+}
+
+template <typename F>
+static double time_ms(F f)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	f();
+	chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+	return ms.count();
+}
+
+static void benchmark()
+{
+	Frame frame = synthetic_frame(args.draws);
+	string links_dir = args.dir + "/links", store_dir = args.dir + "/store", deduped;
+	vector<uint8_t> data;
+	unordered_set<ino_t> seen;
+	struct stat st;
+	uint64_t raw = 0, links_bytes, store_bytes;
+	double links_ms, store_ms, extract_ms;
+	size_t extracted = 0;
+
+	for (const TestBlob &b : frame.unique)
+		raw += b.data.size();
+	printf("%d draw calls dumping %zu files, %zu unique, %.1f MB:\n", args.draws,
+			frame.dumps.size(), frame.unique.size(), raw / 1048576.0);
+
+	remove_tree(args.dir);
+	mkdir(args.dir.c_str(), 0755);
+
+	// Each file is written to the deduped directory the first time it is
+	// dumped, then hard linked into place, as without store_dupes:
+	mkdir(links_dir.c_str(), 0755);
+	deduped = links_dir + "/deduped";
+	mkdir(deduped.c_str(), 0755);
+	links_ms = time_ms([&]() {
+		vector<bool> written(frame.unique.size());
+		for (auto &dump : frame.dumps) {
+			string dedupe_path = deduped + "/" + frame.unique[dump.second].key;
+			if (!written[dump.second]) {
+				if (access(dedupe_path.c_str(), F_OK))
+					write_file(dedupe_path, frame.unique[dump.second].data);
+				written[dump.second] = true;
+			}
+			// rotate_when_nearing_hard_link_limit opens each file
+			// to check its link count before linking it:
+			int fd = open(dedupe_path.c_str(), O_RDONLY);
+			if (fd >= 0) {
+				fstat(fd, &st);
+				close(fd);
+			}
+			if (link(dedupe_path.c_str(), (links_dir + "/" + dump.first).c_str()))
+				report_mismatch("benchmark: unable to hard link %s", dump.first.c_str());
+		}
+		sync();
+	});
+	links_bytes = disk_usage(links_dir, &seen);
+
+	mkdir(store_dir.c_str(), 0755);
+	deduped = store_dir + "/deduped";
+	mkdir(deduped.c_str(), 0755);
+	store_ms = time_ms([&]() {
+		FrameAnalysisStore store;
+		FrameAnalysisManifest manifest;
+		wstring store_name = L"deduped\\" FRAME_ANALYSIS_STORE_NAME;
+
+		store.open(widen(deduped + "/deduped.fastore").c_str());
+		manifest.open(widen(store_dir + "/manifest.txt").c_str());
+		for (auto &dump : frame.dumps) {
+			const TestBlob &b = frame.unique[dump.second];
+			if (!store.contains(b.key))
+				store.add(b.key, b.data.data(), b.data.size());
+			manifest.add(store_name, b.key, widen(dump.first).c_str());
+		}
+		store.close();
+		manifest.close();
+		sync();
+	});
+	seen.clear();
+	store_bytes = disk_usage(store_dir, &seen);
+
+	// What fa_store_extract does for the whole frame:
+	extract_ms = time_ms([&]() {
+		vector<FrameAnalysisManifestEntry> entries;
+		FrameAnalysisStore store;
+		string last_key;
+
+		store.open(widen(deduped + "/deduped.fastore").c_str(), true);
+		read_frame_analysis_manifest(widen(store_dir + "/manifest.txt").c_str(), &entries);
+		for (auto &entry : entries) {
+			if (entry.key != last_key && !store.read(entry.key, &data))
+				continue;
+			last_key = entry.key;
+			write_file(store_dir + "/" + string(entry.name.begin(), entry.name.end()), data);
+			extracted++;
+		}
+		sync();
+	});
+
+	printf("  hard links        %10.3fms  %8.1f MB on disk\n", links_ms, links_bytes / 1048576.0);
+	printf("  store             %10.3fms  %8.1f MB on disk\n", store_ms, store_bytes / 1048576.0);
+	printf("  extract store     %10.3fms  (%zu files)\n", extract_ms, extracted);
+
+	if (extracted != frame.dumps.size())
+		report_mismatch("benchmark: extracted %zu of %zu files", extracted, frame.dumps.size());
+
+	remove_tree(args.dir);
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_lz4();
+	check_store();
+	check_manifest();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark) {
+		benchmark();
+		if (mismatches) {
+			printf("%zu mismatches\n", mismatches);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
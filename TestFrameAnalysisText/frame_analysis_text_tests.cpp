@@ -0,0 +1,610 @@
+// frame_analysis_text_tests.cpp : Checks and benchmarks the vertex and index
+// buffer text formatting in DirectX11/FrameAnalysisText.cpp.
+//
+// The float formatter is checked against snprintf %.9g for random floats,
+// every value of every 8 and 16 bit format, powers of ten and their
+// neighbours, and values exactly half way between two 9 digit decimals.
+// Random vertex buffers in every format fprint_dxgi_format() used to
+// support, interleaved at random strides, are then decoded and formatted
+// and checked to give exactly the bytes the fprintf calls it made did.
+// Finally the two are timed against each other for each format.
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FrameAnalysisText.h"
+
+using namespace std;
+
+static struct {
+	int floats = 2000000;
+	int buffers = 2000;
+	int vertices = 100000;
+	unsigned seed = 1;
+	bool all_floats;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the frame analysis buffer text formatting against fprintf, then times the two for each format.\n\n");
+
+	printf("  -n, --floats N\n");
+	printf("\t\t\tNumber of random floats to check with (default 2000000)\n");
+
+	printf("  --all-floats\n");
+	printf("\t\t\tCheck every 32 bit float instead of random ones. Takes a long time\n");
+
+	printf("  --buffers N\n");
+	printf("\t\t\tNumber of random vertex buffers to check with (default 2000)\n");
+
+	printf("  --vertices N\n");
+	printf("\t\t\tNumber of vertices to format in each benchmark (default 100000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random data (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--floats")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.floats = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--all-floats")) {
+			args.all_floats = true;
+			continue;
+		}
+		if (!strcmp(arg, "--buffers")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.buffers = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--vertices")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.vertices = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static vector<uint8_t> read_back(FILE *fp)
+{
+	vector<uint8_t> ret;
+
+	fflush(fp);
+	ret.resize(ftell(fp));
+	rewind(fp);
+	if (fread(ret.data(), 1, ret.size(), fp) != ret.size())
+		ret.clear();
+	return ret;
+}
+
+static float from_bits(uint32_t bits)
+{
+	float val;
+
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+// --- What fprint_dxgi_format() did ---
+
+static float float16(uint16_t f16)
+{
+	// Shift sign and mantissa to new positions:
+	uint32_t f32 = ((f16 & 0x8000) << 16) | ((f16 & 0x3ff) << 13);
+	// Need to check special cases of the biased exponent:
+	int biased_exponent = (f16 & 0x7c00) >> 10;
+
+	if (biased_exponent == 0) {
+		// Zero / subnormal: New biased exponent remains zero
+	} else if (biased_exponent == 0x1f) {
+		// Infinity / NaN: New biased exponent is filled with 1s
+		f32 |= 0x7f800000;
+	} else {
+		// Normal number: Adjust the exponent bias:
+		biased_exponent = biased_exponent - 15 + 127;
+		f32 |= biased_exponent << 23;
+	}
+
+	return from_bits(f32);
+}
+
+static float unorm24(uint32_t val)
+{
+	return (float)val / (float)0xffffff;
+}
+
+static float unorm16(uint16_t val)
+{
+	return (float)val / (float)0xffff;
+}
+
+static float snorm16(int16_t val)
+{
+	return (float)val / (float)0x7fff;
+}
+
+static float unorm8(uint8_t val)
+{
+	return (float)val / (float)0xff;
+}
+
+static float snorm8(int8_t val)
+{
+	return (float)val / (float)0x7f;
+}
+
+// Every format fprint_dxgi_format() showed as something other than hex
+// bytes, and what FrameAnalysis.cpp now shows it as:
+static const struct {
+	const char *name;
+	FrameAnalysisTextFormat format;
+} formats[] = {
+	{"R32G32B32A32_TYPELESS",    {FrameAnalysisTextType::HEX32, 4}},
+	{"R32G32B32_TYPELESS",       {FrameAnalysisTextType::HEX32, 3}},
+	{"R32G32_TYPELESS",          {FrameAnalysisTextType::HEX32, 2}},
+	{"R32_TYPELESS",             {FrameAnalysisTextType::HEX32, 1}},
+	{"R32G32B32A32_FLOAT",       {FrameAnalysisTextType::FLOAT32, 4}},
+	{"R32G32B32_FLOAT",          {FrameAnalysisTextType::FLOAT32, 3}},
+	{"R32G32_FLOAT",             {FrameAnalysisTextType::FLOAT32, 2}},
+	{"R32_FLOAT",                {FrameAnalysisTextType::FLOAT32, 1}},
+	{"R32G32B32A32_UINT",        {FrameAnalysisTextType::UINT32, 4}},
+	{"R32G32B32_UINT",           {FrameAnalysisTextType::UINT32, 3}},
+	{"R32G32_UINT",              {FrameAnalysisTextType::UINT32, 2}},
+	{"R32_UINT",                 {FrameAnalysisTextType::UINT32, 1}},
+	{"R32G32B32A32_SINT",        {FrameAnalysisTextType::SINT32, 4}},
+	{"R32G32B32_SINT",           {FrameAnalysisTextType::SINT32, 3}},
+	{"R32G32_SINT",              {FrameAnalysisTextType::SINT32, 2}},
+	{"R32_SINT",                 {FrameAnalysisTextType::SINT32, 1}},
+	{"R16G16B16A16_TYPELESS",    {FrameAnalysisTextType::HEX16, 4}},
+	{"R16G16_TYPELESS",          {FrameAnalysisTextType::HEX16, 2}},
+	{"R16_TYPELESS",             {FrameAnalysisTextType::HEX16, 1}},
+	{"R16G16B16A16_FLOAT",       {FrameAnalysisTextType::FLOAT16, 4}},
+	{"R16G16_FLOAT",             {FrameAnalysisTextType::FLOAT16, 2}},
+	{"R16_FLOAT",                {FrameAnalysisTextType::FLOAT16, 1}},
+	{"R16G16B16A16_UNORM",       {FrameAnalysisTextType::UNORM16, 4}},
+	{"R16G16_UNORM",             {FrameAnalysisTextType::UNORM16, 2}},
+	{"R16_UNORM",                {FrameAnalysisTextType::UNORM16, 1}},
+	{"R16G16B16A16_SNORM",       {FrameAnalysisTextType::SNORM16, 4}},
+	{"R16G16_SNORM",             {FrameAnalysisTextType::SNORM16, 2}},
+	{"R16_SNORM",                {FrameAnalysisTextType::SNORM16, 1}},
+	{"R16G16B16A16_UINT",        {FrameAnalysisTextType::UINT16, 4}},
+	{"R16G16_UINT",              {FrameAnalysisTextType::UINT16, 2}},
+	{"R16_UINT",                 {FrameAnalysisTextType::UINT16, 1}},
+	{"R16G16B16A16_SINT",        {FrameAnalysisTextType::SINT16, 4}},
+	{"R16G16_SINT",              {FrameAnalysisTextType::SINT16, 2}},
+	{"R16_SINT",                 {FrameAnalysisTextType::SINT16, 1}},
+	{"R8G8B8A8_TYPELESS",        {FrameAnalysisTextType::HEX8, 4}},
+	{"B8G8R8X8_TYPELESS",        {FrameAnalysisTextType::HEX8, 3}},
+	{"R8G8_TYPELESS",            {FrameAnalysisTextType::HEX8, 2}},
+	{"R8_TYPELESS",              {FrameAnalysisTextType::HEX8, 1}},
+	{"R8G8B8A8_UNORM",           {FrameAnalysisTextType::UNORM8, 4}},
+	{"R8G8_UNORM",               {FrameAnalysisTextType::UNORM8, 2}},
+	{"R8_UNORM",                 {FrameAnalysisTextType::UNORM8, 1}},
+	{"R8G8B8A8_SNORM",           {FrameAnalysisTextType::SNORM8, 4}},
+	{"R8G8_SNORM",               {FrameAnalysisTextType::SNORM8, 2}},
+	{"R8_SNORM",                 {FrameAnalysisTextType::SNORM8, 1}},
+	{"R8G8B8A8_UINT",            {FrameAnalysisTextType::UINT8, 4}},
+	{"R8G8_UINT",                {FrameAnalysisTextType::UINT8, 2}},
+	{"R8_UINT",                  {FrameAnalysisTextType::UINT8, 1}},
+	{"R8G8B8A8_SINT",            {FrameAnalysisTextType::SINT8, 4}},
+	{"R8G8_SINT",                {FrameAnalysisTextType::SINT8, 2}},
+	{"R8_SINT",                  {FrameAnalysisTextType::SINT8, 1}},
+	{"D32_FLOAT_S8X24_UINT",     {FrameAnalysisTextType::FLOAT32_UINT8, 2}},
+	{"D24_UNORM_S8_UINT",        {FrameAnalysisTextType::UNORM24_UINT8, 2}},
+	{"R10G10B10A2_UNORM (hex)",  {FrameAnalysisTextType::RAW, 4}},
+	{"R32G32B32A32 (hex)",       {FrameAnalysisTextType::RAW, 16}},
+};
+
+// The fprintf calls fprint_dxgi_format() made for each of the above
+static void reference_element(FILE *fd, FrameAnalysisTextFormat format, const uint8_t *buf)
+{
+	float f[4];
+	uint32_t u32[4];
+	int32_t s32[4];
+	uint16_t u16[4];
+	int16_t s16[4];
+	const uint8_t *u8 = buf;
+	const int8_t *s8 = (const int8_t*)buf;
+	unsigned n = format.components, i;
+
+	memcpy(f, buf, (min)(n, 4u) * 4);
+	memcpy(u32, buf, (min)(n, 4u) * 4);
+	memcpy(s32, buf, (min)(n, 4u) * 4);
+	memcpy(u16, buf, (min)(n, 4u) * 2);
+	memcpy(s16, buf, (min)(n, 4u) * 2);
+
+	switch (format.type) {
+		case FrameAnalysisTextType::RAW:
+			for (i = 0; i < n; i++)
+				fprintf(fd, "%02x", buf[i]);
+			return;
+		case FrameAnalysisTextType::FLOAT32_UINT8:
+			memcpy(f, buf, 4);
+			fprintf(fd, "%.9g, %d", f[0], u8[4]);
+			return;
+		case FrameAnalysisTextType::UNORM24_UINT8:
+			memcpy(u32, buf, 4);
+			fprintf(fd, "%.9g, %d", unorm24(u32[0] & 0xffffff), u8[3]);
+			return;
+		default:
+			break;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (i)
+			fprintf(fd, ", ");
+		switch (format.type) {
+			case FrameAnalysisTextType::HEX32: fprintf(fd, "%08x", u32[i]); break;
+			case FrameAnalysisTextType::HEX16: fprintf(fd, "%04x", u16[i]); break;
+			case FrameAnalysisTextType::HEX8: fprintf(fd, "%02x", u8[i]); break;
+			case FrameAnalysisTextType::FLOAT32: fprintf(fd, "%.9g", f[i]); break;
+			case FrameAnalysisTextType::FLOAT16: fprintf(fd, "%.9g", float16(u16[i])); break;
+			case FrameAnalysisTextType::UNORM16: fprintf(fd, "%.9g", unorm16(u16[i])); break;
+			case FrameAnalysisTextType::SNORM16: fprintf(fd, "%.9g", snorm16(s16[i])); break;
+			case FrameAnalysisTextType::UNORM8: fprintf(fd, "%.9g", unorm8(u8[i])); break;
+			case FrameAnalysisTextType::SNORM8: fprintf(fd, "%.9g", snorm8(s8[i])); break;
+			case FrameAnalysisTextType::UINT32: fprintf(fd, "%u", u32[i]); break;
+			case FrameAnalysisTextType::UINT16: fprintf(fd, "%u", u16[i]); break;
+			case FrameAnalysisTextType::UINT8: fprintf(fd, "%u", u8[i]); break;
+			case FrameAnalysisTextType::SINT32: fprintf(fd, "%d", s32[i]); break;
+			case FrameAnalysisTextType::SINT16: fprintf(fd, "%d", s16[i]); break;
+			case FrameAnalysisTextType::SINT8: fprintf(fd, "%d", s8[i]); break;
+			default: break;
+		}
+	}
+}
+
+// A vertex buffer of a single element, written the way dump_vb_elem() did
+static void reference_buffer(FILE *fd, FrameAnalysisTextFormat format,
+		const uint8_t *buf, size_t stride, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		fprintf(fd, "vb0[%u]+%03u TEXCOORD%u: ", (unsigned)i, 0u, 1u);
+		reference_element(fd, format, buf + i * stride);
+		fprintf(fd, "\n");
+	}
+}
+
+// The same, the way dump_vb_known_layout() now does
+static void text_buffer(FILE *fd, FrameAnalysisTextFormat format,
+		const uint8_t *buf, size_t stride, size_t count, size_t capacity = 256 * 1024)
+{
+	FrameAnalysisTextBuffer out(fd, capacity);
+	vector<uint32_t> values(count * format.components);
+	size_t i;
+
+	frame_analysis_text_decode(format, buf, stride, count, values.data());
+
+	for (i = 0; i < count; i++) {
+		out.append("vb0[");
+		out.append_uint((uint32_t)i);
+		out.append("]+", 2);
+		out.append_uint(0, 3);
+		out.append(" TEXCOORD", 9);
+		out.append_uint(1);
+		out.append(": ", 2);
+		out.append_values(format, values.data() + i * format.components);
+		out.append('\n');
+	}
+}
+
+// --- Checks ---
+
+static void check_float(float val)
+{
+	char expected[64], got[FRAME_ANALYSIS_TEXT_FLOAT_MAX + 1];
+	size_t len;
+
+	snprintf(expected, sizeof(expected), "%.9g", val);
+	len = frame_analysis_format_float(got, val);
+	got[len] = '\0';
+	if (strcmp(expected, got)) {
+		uint32_t bits;
+		memcpy(&bits, &val, sizeof(bits));
+		report_mismatch("float 0x%08x: printf gave \"%s\", got \"%s\"", bits, expected, got);
+	}
+}
+
+static void check_float_format()
+{
+	uint64_t bits;
+	uint32_t i;
+	int p, j;
+
+	if (args.all_floats) {
+		for (bits = 0; bits <= 0xffffffff; bits++) {
+			check_float(from_bits((uint32_t)bits));
+			if ((bits & 0xfffffff) == 0xfffffff)
+				printf("Checked floats up to 0x%08x\n", (uint32_t)bits);
+		}
+	} else {
+		for (j = 0; j < args.floats; j++)
+			check_float(from_bits(rng()));
+	}
+
+	for (i = 0; i < 0x10000; i++) {
+		check_float(float16((uint16_t)i));
+		check_float(unorm16((uint16_t)i));
+		check_float(snorm16((int16_t)i));
+	}
+	for (i = 0; i < 0x100; i++) {
+		check_float(unorm8((uint8_t)i));
+		check_float(snorm8((int8_t)i));
+	}
+	for (i = 0; i < 0x1000000; i += 0xfff)
+		check_float(unorm24(i));
+
+	check_float(0.0f);
+	check_float(-0.0f);
+	check_float(INFINITY);
+	check_float(-INFINITY);
+	check_float(NAN);
+	check_float(-NAN);
+	check_float(FLT_MIN);
+	check_float(FLT_MAX);
+	check_float(-FLT_MAX);
+	check_float(FLT_EPSILON);
+	check_float(from_bits(1));
+	check_float(from_bits(0x007fffff));
+
+	// Either side of every power of ten, where %g changes style and the
+	// decimal exponent estimate is most likely to be off:
+	for (p = -45; p <= 38; p++) {
+		float val = (float)pow(10.0, p);
+		uint32_t val_bits;
+
+		memcpy(&val_bits, &val, sizeof(val_bits));
+		for (j = -4; j <= 4; j++) {
+			float near = from_bits(val_bits + j);
+			check_float(near);
+			check_float(-near);
+		}
+	}
+
+	// Floats with exactly ten significant digits ending in 5, which
+	// printf rounds as ties:
+	for (i = 1; i < 1024; i += 2) {
+		check_float((float)i / 1024.0f);
+		check_float((float)i / 8192.0f);
+		check_float((float)i / 65536.0f);
+	}
+}
+
+static void check_integers()
+{
+	static const int32_t ints[] = {0, 1, -1, 9, 10, 99, 100, 999, 1000, INT_MAX, INT_MIN, -2147483647};
+	static const uint32_t uints[] = {0, 1, 9, 10, 99, 100, 999, 1000, 12345, 4294967295u};
+	static const unsigned widths[] = {0, 1, 2, 3, 5, 10};
+	FILE *fp = tmpfile();
+	string expected;
+	char buf[64];
+
+	{
+		FrameAnalysisTextBuffer out(fp, 1);
+
+		for (int32_t val : ints) {
+			out.append_int(val);
+			out.append(' ');
+			snprintf(buf, sizeof(buf), "%d ", val);
+			expected += buf;
+		}
+		for (uint32_t val : uints) {
+			for (unsigned width : widths) {
+				out.append_uint(val, width);
+				out.append(' ');
+				snprintf(buf, sizeof(buf), "%0*u ", (int)width, val);
+				expected += buf;
+			}
+			out.append_hex(val, 8);
+			out.append_hex(val & 0xffff, 4);
+			out.append_hex(val & 0xff, 2);
+			snprintf(buf, sizeof(buf), "%08x%04x%02x", val, val & 0xffff, val & 0xff);
+			expected += buf;
+		}
+	}
+
+	vector<uint8_t> got = read_back(fp);
+	fclose(fp);
+	if (string(got.begin(), got.end()) != expected)
+		report_mismatch("integers: expected \"%s\", got \"%.*s\"", expected.c_str(), (int)got.size(), got.data());
+}
+
+static void random_bytes(vector<uint8_t> *buf, size_t size)
+{
+	size_t i;
+
+	buf->resize(size);
+	switch (rng() % 4) {
+		case 0:
+			// Plausible floats, so %.9g sees more than NaNs and
+			// denormals:
+			for (i = 0; i + 4 <= size; i += 4) {
+				float val = (float)((int)(rng() % 2000001) - 1000000) / (float)(1 + rng() % 1000);
+				memcpy(buf->data() + i, &val, 4);
+			}
+			for (; i < size; i++)
+				(*buf)[i] = (uint8_t)rng();
+			break;
+		case 1:
+			// Mostly zeroes and small values
+			for (i = 0; i < size; i++)
+				(*buf)[i] = (rng() % 4) ? 0 : (uint8_t)(rng() % 3);
+			break;
+		default:
+			for (i = 0; i < size; i++)
+				(*buf)[i] = (uint8_t)rng();
+			break;
+	}
+}
+
+static void check_buffers()
+{
+	vector<uint8_t> buf;
+	int i;
+
+	for (i = 0; i < args.buffers; i++) {
+		FrameAnalysisTextFormat format = formats[rng() % (sizeof(formats) / sizeof(formats[0]))].format;
+		size_t size = format.size();
+		size_t stride = (rng() % 2) ? size : size + rng() % 24;
+		size_t count = (rng() % 4) ? 1 + rng() % 600 : 1 + rng() % 3000;
+		size_t capacity = (rng() % 8) ? 256 * 1024 : rng() % 100;
+		FILE *expected_fp = tmpfile();
+		FILE *got_fp = tmpfile();
+
+		if (!stride)
+			stride = 4;
+		random_bytes(&buf, stride * (count - 1) + size);
+
+		reference_buffer(expected_fp, format, buf.data(), stride, count);
+		text_buffer(got_fp, format, buf.data(), stride, count, capacity);
+
+		vector<uint8_t> expected = read_back(expected_fp);
+		vector<uint8_t> got = read_back(got_fp);
+		fclose(expected_fp);
+		fclose(got_fp);
+
+		if (expected != got) {
+			size_t pos = mismatch(expected.begin(), expected.end(), got.begin(), got.end()).first - expected.begin();
+			size_t line = (size_t)count_if(expected.begin(), expected.begin() + pos, [](uint8_t c) { return c == '\n'; });
+			report_mismatch("buffer %i, type %i, %u components, stride %zu, count %zu: differs at line %zu",
+					i, (int)format.type, format.components, stride, count, line + 1);
+		}
+	}
+}
+
+// --- Benchmark ---
+
+static double time_ms(FILE *fp, function<void(FILE*)> fn)
+{
+	rewind(fp);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	fn(fp);
+	fflush(fp);
+	chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+	return ms.count();
+}
+
+static void benchmark()
+{
+	double fprintf_total = 0, text_total = 0;
+	vector<uint8_t> buf;
+	FILE *fp = tmpfile();
+	size_t i;
+
+	printf("%i vertices of each format, 32 byte stride:\n", args.vertices);
+	printf("  %-26s %10s %10s %8s\n", "format", "fprintf", "buffered", "speedup");
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		FrameAnalysisTextFormat format = formats[i].format;
+		size_t stride = 32;
+
+		random_bytes(&buf, stride * args.vertices);
+
+		double fprintf_ms = time_ms(fp, [&](FILE *fp) {
+			reference_buffer(fp, format, buf.data(), stride, args.vertices);
+		});
+		double text_ms = time_ms(fp, [&](FILE *fp) {
+			text_buffer(fp, format, buf.data(), stride, args.vertices);
+		});
+
+		printf("  %-26s %8.1fms %8.1fms %7.1fx\n", formats[i].name, fprintf_ms, text_ms, fprintf_ms / text_ms);
+		fprintf_total += fprintf_ms;
+		text_total += text_ms;
+	}
+
+	printf("  %-26s %8.1fms %8.1fms %7.1fx\n", "total", fprintf_total, text_total, fprintf_total / text_total);
+	fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_float_format();
+	check_integers();
+	check_buffers();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,695 @@
+// frame_analysis_trace_tests.cpp : Checks and benchmarks the binary frame
+// analysis log that DirectX11/FrameAnalysisTrace.cpp writes and renders.
+//
+// Random log messages, built from the format strings frame analysis uses
+// along with every other printf conversion they could use, are written both
+// with fprintf as log.txt is and to a trace, and the trace is checked to
+// render back into exactly the same bytes. A trace from MSVC is checked to
+// render its pointers, wide strings and newlines the way the MSVC runtime
+// wrote them, a trace cut short at every point is checked to render as much
+// of the log as was complete, and corrupted traces are checked to be
+// rejected rather than misread. Finally a synthetic frame's worth of draw
+// calls is timed being logged as text and to a trace, and being converted
+// back.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FrameAnalysisTrace.h"
+
+using namespace std;
+
+static struct {
+	string dir = "frame_analysis_trace_tests.dir";
+	int messages = 20000;
+	int draw_calls = 20000;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the binary frame analysis log, then times logging a synthetic frame as text and to a trace.\n\n");
+
+	printf("  -n, --messages N\n");
+	printf("\t\t\tNumber of random log messages to check with (default 20000)\n");
+
+	printf("  -d, --dir DIR\n");
+	printf("\t\t\tDirectory to write the benchmark logs to (default frame_analysis_trace_tests.dir)\n");
+
+	printf("  --draw-calls N\n");
+	printf("\t\t\tNumber of draw calls to log in the benchmark (default 20000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random log messages (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--messages")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.messages = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-d") || !strcmp(arg, "--dir")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.dir = argv[i];
+			continue;
+		}
+		if (!strcmp(arg, "--draw-calls")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.draw_calls = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static vector<uint8_t> read_back(FILE *fp)
+{
+	vector<uint8_t> ret;
+
+	fflush(fp);
+	ret.resize(ftell(fp));
+	rewind(fp);
+	if (fread(ret.data(), 1, ret.size(), fp) != ret.size())
+		ret.clear();
+	return ret;
+}
+
+// Writes every message to log.txt the way FrameAnalysisContext does without
+// analyse_binary_log, and to a trace the way it does with it. Either can be
+// turned off for the benchmark.
+struct SyntheticLog {
+	FILE *text;
+	FILE *trace;
+	FrameAnalysisTraceWriter writer;
+	bool hold;
+	uint32_t frame_no;
+	uint32_t draw_call;
+
+	SyntheticLog(FILE *text, FILE *trace) :
+		text(text),
+		trace(trace),
+		hold(false),
+		frame_no(0),
+		draw_call(1)
+	{
+		if (trace)
+			writer.begin(trace);
+	}
+
+	void call(const char *fmt, ...)
+	{
+		va_list ap;
+
+		if (text) {
+			if (hold)
+				fprintf(text, "%u.", frame_no);
+			fprintf(text, "%06u ", draw_call);
+			va_start(ap, fmt);
+			vfprintf(text, fmt, ap);
+			va_end(ap);
+		}
+		if (trace) {
+			va_start(ap, fmt);
+			writer.vcall(trace, hold, frame_no, draw_call, fmt, ap);
+			va_end(ap);
+		}
+	}
+
+	void append(const char *fmt, ...)
+	{
+		va_list ap;
+
+		if (text) {
+			va_start(ap, fmt);
+			vfprintf(text, fmt, ap);
+			va_end(ap);
+		}
+		if (trace) {
+			va_start(ap, fmt);
+			writer.vappend(trace, fmt, ap);
+			va_end(ap);
+		}
+	}
+
+	void data(const void *buf, size_t size)
+	{
+		const unsigned char *ptr = (const unsigned char*)buf;
+		size_t i;
+
+		if (text) {
+			fprintf(text, "    data: ");
+			for (i = 0; i < size; i++, ptr++)
+				fprintf(text, "%02x", *ptr);
+			fprintf(text, "\n");
+		}
+		if (trace)
+			writer.data(trace, buf, size);
+	}
+};
+
+// Renders a whole trace as fa_trace_convert does. Returns false if it is
+// corrupt, and sets truncated if it was cut short.
+static bool render(const vector<uint8_t> &trace, string *out, bool *truncated = NULL)
+{
+	FrameAnalysisTraceReader reader;
+	FrameAnalysisTraceEvent event;
+
+	out->clear();
+	if (!reader.open(trace.data(), trace.size()))
+		return false;
+	while (reader.next(event))
+		reader.render(*out, event);
+	if (truncated)
+		*truncated = reader.was_truncated();
+	return reader.get_error().empty();
+}
+
+static void *random_pointer()
+{
+	switch (rng() % 4) {
+		case 0: return NULL;
+		case 1: return (void*)(uintptr_t)(rng() & ~0xfu);
+		default: return (void*)(((uintptr_t)rng() << 16) ^ rng());
+	}
+}
+
+static string random_name(size_t max_len)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_ =.\\[]$";
+	string ret(rng() % (max_len + 1), ' ');
+
+	for (char &c : ret)
+		c = chars[rng() % (sizeof(chars) - 1)];
+	return ret;
+}
+
+static double random_double()
+{
+	switch (rng() % 6) {
+		case 0: return 0.0;
+		case 1: return -(double)rng() / 3.0;
+		case 2: return (double)rng() * 1e20;
+		case 3: return 1.0 / ((double)rng() + 1.0);
+		default: return (double)(int)rng() / 7.0;
+	}
+}
+
+// Writes a random message, mostly using the format strings frame analysis
+// does, in the way it does, but also every other conversion it might:
+static void random_message(SyntheticLog &log)
+{
+	static char reused[64];
+	string name = random_name(20);
+	wstring wname(name.begin(), name.end());
+	vector<uint8_t> data;
+
+	switch (rng() % 24) {
+	case 0:
+		log.call("VSSetShader(pVertexShader:0x%p, ppClassInstances:0x%p, NumClassInstances:%u)",
+				random_pointer(), random_pointer(), (unsigned)rng() % 8);
+		log.append(" hash=%016llx", ((unsigned long long)rng() << 32) | rng());
+		log.append("\n");
+		break;
+	case 1:
+		log.call("PSSetShaderResources(StartSlot:%u, NumViews:%u, ppShaderResourceViews:0x%p)\n",
+				(unsigned)rng() % 128, (unsigned)rng() % 128, random_pointer());
+		break;
+	case 2:
+		log.append("       %u:", (unsigned)rng() % 128);
+		log.append(" view=0x%p", random_pointer());
+		log.append(" resource=0x%p", random_pointer());
+		log.append(" hash=%08x", (unsigned)rng());
+		if (rng() % 2)
+			log.append(" orig_hash=%08x", (unsigned)rng());
+		if (rng() % 4 == 0)
+			log.append(" hash_contamination=");
+		log.append("\n");
+		break;
+	case 3:
+		log.append("       %s:", rng() % 2 ? "D" : "cs-u0");
+		log.append(" handle=0x%p\n", random_pointer());
+		break;
+	case 4:
+		log.call("DrawIndexed(IndexCount:%u, StartIndexLocation:%u, BaseVertexLocation:%u)\n",
+				(unsigned)rng(), (unsigned)rng(), (unsigned)rng());
+		log.draw_call++;
+		break;
+	case 5:
+		log.call("3DMigoto%*s %S\n", (int)(rng() % 12), "", wname.c_str());
+		break;
+	case 6:
+		log.call("3DMigoto%*s [%S] %s(%p, %u)\n", (int)(rng() % 12), "", wname.c_str(),
+				name.c_str(), random_pointer(), (unsigned)rng());
+		break;
+	case 7:
+		log.call("3DMigoto%*s   Setting per-draw call %s = %f * %f = %f\n", (int)(rng() % 12), "",
+				name.c_str(), random_double(), random_double(), random_double());
+		break;
+	case 8:
+		log.call("SetPredication(pPredicate:0x%p, PredicateValue:%s)", random_pointer(),
+				rng() % 2 ? "true" : "false");
+		log.append(" type=query query=");
+		log.append("occlusion_predicate");
+		log.append(" MiscFlags=0x%x\n", (unsigned)rng() % 2);
+		break;
+	case 9:
+		data.resize(rng() % 300);
+		for (uint8_t &b : data)
+			b = (uint8_t)rng();
+		log.call("UpdateSubresource(pDstResource:0x%p, DstSubresource:%u, pDstBox:0x%p, pSrcData:0x%p, SrcRowPitch:%u, SrcDepthPitch:%u)\n",
+				random_pointer(), (unsigned)rng() % 4, random_pointer(), random_pointer(),
+				(unsigned)rng(), (unsigned)rng());
+		log.data(data.data(), data.size());
+		break;
+	case 10:
+		log.call("signed %d %i %+d % i %-6d| %06i %hd %hhd %ld %lld %zd %jd\n",
+				(int)rng(), -(int)(rng() % 1000), (int)rng() % 100, (int)rng() % 100,
+				(int)rng() % 1000, -(int)(rng() % 1000), (int)rng(), (int)rng(),
+				(long)rng() - (long)rng(), -(long long)rng() * rng(), (ptrdiff_t)rng() - (ptrdiff_t)rng(),
+				(intmax_t)rng() << 20);
+		break;
+	case 11:
+		log.append("unsigned %u %x %X %o %#x %#o %08X %hu %hhx %lu %llu %zu %ju\n",
+				(unsigned)rng(), (unsigned)rng(), (unsigned)rng(), (unsigned)rng(), (unsigned)rng(),
+				(unsigned)rng(), (unsigned)rng(), (unsigned)rng(), (unsigned)rng(),
+				(unsigned long)rng() * 3, (unsigned long long)rng() * rng(), (size_t)rng(),
+				(uintmax_t)rng() << 20);
+		break;
+	case 12:
+		log.append("float %f %.3f %10.2f %-10.1f| %e %E %g %G %a %+.0f %#g %Lf\n",
+				random_double(), random_double(), random_double(), random_double(),
+				random_double(), random_double(), random_double(), random_double(),
+				random_double(), random_double(), random_double(), (long double)random_double());
+		break;
+	case 13:
+		log.append("star %*d|%-*d|%.*f|%*.*s|%.*d\n", (int)(rng() % 10), (int)rng(),
+				(int)(rng() % 10), (int)rng(), (int)(rng() % 8), random_double(),
+				(int)(rng() % 30) - 15, (int)(rng() % 10), name.c_str(),
+				(int)(rng() % 10) - 5, (int)rng());
+		break;
+	case 14:
+		log.append("strings %s|%10s|%-10s|%.4s|%S|%ls|%12ls|%.3S\n", name.c_str(), name.c_str(),
+				name.c_str(), name.c_str(), wname.c_str(), wname.c_str(), wname.c_str(),
+				wname.c_str());
+		break;
+	case 15:
+		log.append("null %s|%S|%10s\n", (const char*)NULL, (const wchar_t*)NULL, (const char*)NULL);
+		break;
+	case 16:
+		log.append("chars %c%c %3c|%-3c| %lc\n", 'a' + (int)(rng() % 26), '0' + (int)(rng() % 10),
+				'x', 'y', (wint_t)('A' + rng() % 26));
+		break;
+	case 17:
+		log.append("percent 100%% done\n");
+		break;
+	case 18:
+		// A format string that isn't a literal, in a buffer that is
+		// reused with different contents:
+		snprintf(reused, sizeof(reused), "reused %s %%u %%p\n", name.c_str());
+		log.call(reused, (unsigned)rng(), random_pointer());
+		break;
+	case 19:
+		log.call("analyse_options: %08x\n", (unsigned)rng());
+		break;
+	case 20:
+		log.hold = !log.hold;
+		log.frame_no += rng() % 3;
+		break;
+	case 21:
+		log.call("3DMigoto Dumping Buffer %S -> %S\n", wname.c_str(), wname.c_str());
+		break;
+	case 22:
+		log.append("");
+		log.append("\n");
+		break;
+	case 23:
+		log.call("OMSetRenderTargets(NumViews:%u, ppRenderTargetViews:0x%p, pDepthStencilView:0x%p)\n",
+				(unsigned)rng() % 8, random_pointer(), random_pointer());
+		break;
+	}
+}
+
+static void write_random_log(vector<uint8_t> *text, vector<uint8_t> *trace, int messages)
+{
+	FILE *text_fp = tmpfile();
+	FILE *trace_fp = tmpfile();
+	int i;
+
+	if (!text_fp || !trace_fp) {
+		report_mismatch("Unable to create temporary files");
+		exit(EXIT_FAILURE);
+	}
+
+	{
+		SyntheticLog log(text_fp, trace_fp);
+		for (i = 0; i < messages; i++)
+			random_message(log);
+	}
+
+	*text = read_back(text_fp);
+	*trace = read_back(trace_fp);
+	fclose(text_fp);
+	fclose(trace_fp);
+}
+
+static size_t first_difference(const string &a, const vector<uint8_t> &b)
+{
+	size_t i;
+
+	for (i = 0; i < a.size() && i < b.size(); i++) {
+		if ((uint8_t)a[i] != b[i])
+			break;
+	}
+	return i;
+}
+
+static void check_round_trip()
+{
+	vector<uint8_t> text, trace;
+	string rendered;
+	size_t i;
+
+	write_random_log(&text, &trace, args.messages);
+
+	if (!render(trace, &rendered)) {
+		report_mismatch("round trip: trace of %i messages failed to read", args.messages);
+		return;
+	}
+	if (rendered.size() != text.size() || memcmp(rendered.data(), text.data(), text.size())) {
+		i = first_difference(rendered, text);
+		report_mismatch("round trip: rendered trace differs from log.txt at byte %zu:\n"
+				"  log.txt:  %.60s\n  rendered: %.60s", i,
+				string(text.begin() + min(i, text.size()), text.end()).c_str(),
+				rendered.c_str() + min(i, rendered.size()));
+	}
+
+	printf("Round trip: %i messages, %zu bytes of text in a %zu byte trace\n",
+			args.messages, text.size(), trace.size());
+}
+
+// The header flags and sizes that MSVC would have written:
+static void make_msvc(vector<uint8_t> *trace, uint8_t pointer_size)
+{
+	size_t magic_len = strlen(FRAME_ANALYSIS_TRACE_MAGIC);
+
+	(*trace)[magic_len + 1] = FRAME_ANALYSIS_TRACE_MSVC | FRAME_ANALYSIS_TRACE_CRLF;
+	(*trace)[magic_len + 2] = pointer_size;
+	(*trace)[magic_len + 3] = 2;
+}
+
+static void check_msvc()
+{
+	FILE *fp = tmpfile();
+	vector<uint8_t> trace;
+	string rendered;
+
+	{
+		SyntheticLog log(NULL, fp);
+		log.call("VSSetShader(pVertexShader:0x%p, ppClassInstances:0x%p, NumClassInstances:%u)",
+				(void*)(uintptr_t)0x1234abcd, (void*)NULL, 0u);
+		log.append(" hash=%016llx\n", 0x0123456789abcdefull);
+		log.hold = true;
+		log.frame_no = 7;
+		log.draw_call = 42;
+		log.call("3DMigoto%*s [%S] %s(%p, %u) null:%S|%s\n", 2, "", L"ShaderOverrideFoo",
+				"run", (void*)(uintptr_t)0xbeef, 3u, (const wchar_t*)NULL, (const char*)NULL);
+		log.append("%8p|%-8S|%.2S\n", (void*)(uintptr_t)0xf00d, L"abc", L"xyz");
+	}
+	trace = read_back(fp);
+	fclose(fp);
+
+	static const struct {
+		uint8_t pointer_size;
+		const char *expected;
+	} cases[] = {
+		{8,
+			"000001 VSSetShader(pVertexShader:0x000000001234ABCD, ppClassInstances:0x0000000000000000, NumClassInstances:0)"
+			" hash=0123456789abcdef\r\n"
+			"7.000042 3DMigoto   [ShaderOverrideFoo] run(000000000000BEEF, 3) null:(null)|(null)\r\n"
+			"000000000000F00D|abc     |xy\r\n"},
+		{4,
+			"000001 VSSetShader(pVertexShader:0x1234ABCD, ppClassInstances:0x00000000, NumClassInstances:0)"
+			" hash=0123456789abcdef\r\n"
+			"7.000042 3DMigoto   [ShaderOverrideFoo] run(0000BEEF, 3) null:(null)|(null)\r\n"
+			"0000F00D|abc     |xy\r\n"},
+	};
+
+	for (auto &c : cases) {
+		make_msvc(&trace, c.pointer_size);
+		if (!render(trace, &rendered)) {
+			report_mismatch("msvc: %u bit trace failed to read", c.pointer_size * 8);
+			continue;
+		}
+		if (rendered != c.expected) {
+			report_mismatch("msvc: %u bit trace rendered as:\n%s\nexpected:\n%s",
+					c.pointer_size * 8, rendered.c_str(), c.expected);
+		}
+	}
+}
+
+// A game that crashes or is killed part way through frame analysis leaves a
+// trace cut short, which should still give everything up to the last whole
+// record:
+static void check_truncation()
+{
+	vector<uint8_t> text, trace, cut;
+	string full, rendered;
+	bool truncated;
+	size_t len, step;
+
+	write_random_log(&text, &trace, 500);
+	render(trace, &full);
+
+	step = max<size_t>(1, trace.size() / 5000);
+	for (len = 0; len < trace.size(); len += step) {
+		cut.assign(trace.begin(), trace.begin() + len);
+		if (!render(cut, &rendered, &truncated)) {
+			// Only the header is allowed to be too short to read
+			if (len >= strlen(FRAME_ANALYSIS_TRACE_MAGIC) + 4)
+				report_mismatch("truncation: trace cut at %zu of %zu bytes failed to read", len, trace.size());
+			continue;
+		}
+		if (full.compare(0, rendered.size(), rendered))
+			report_mismatch("truncation: trace cut at %zu of %zu bytes is not a prefix of the log", len, trace.size());
+	}
+}
+
+// Corrupt traces must be rejected or rendered as something, never read out
+// of bounds (which this is best run under a sanitizer to catch) or crash:
+static void check_corruption()
+{
+	vector<uint8_t> text, trace, corrupt;
+	string rendered;
+	size_t header = strlen(FRAME_ANALYSIS_TRACE_MAGIC) + 4;
+	size_t rejected = 0;
+	int i, j;
+
+	write_random_log(&text, &trace, 200);
+
+	for (i = 0; i < 2000; i++) {
+		corrupt = trace;
+		for (j = rng() % 4; j >= 0; j--)
+			corrupt[header + rng() % (corrupt.size() - header)] = (uint8_t)rng();
+		if (!render(corrupt, &rendered))
+			rejected++;
+	}
+
+	// Flipping a byte in a format string or argument doesn't break the
+	// framing, so not everything is rejected, but breaking the framing
+	// mostly should be:
+	if (!rejected)
+		report_mismatch("corruption: no corrupt traces were rejected");
+
+	corrupt = trace;
+	corrupt[strlen(FRAME_ANALYSIS_TRACE_MAGIC)]++;
+	if (render(corrupt, &rendered))
+		report_mismatch("corruption: a trace from a newer version was accepted");
+	corrupt = trace;
+	corrupt[0] = 'X';
+	if (render(corrupt, &rendered))
+		report_mismatch("corruption: a trace with the wrong magic was accepted");
+}
+
+// A frame's worth of draw calls logged the way frame analysis does, which is
+// mostly handles and hashes:
+static void log_frame(SyntheticLog &log, int draw_calls)
+{
+	int i;
+	unsigned slot;
+
+	log.append("analyse_options: %08x\n", 0x1234u);
+	for (i = 0; i < draw_calls; i++) {
+		log.call("VSSetShader(pVertexShader:0x%p, ppClassInstances:0x%p, NumClassInstances:%u)",
+				(void*)(uintptr_t)(0x10000000 + i * 64), (void*)NULL, 0u);
+		log.append(" hash=%016llx", 0x123456789abcull * i);
+		log.append("\n");
+		log.call("VSSetConstantBuffers(StartSlot:%u, NumBuffers:%u, ppConstantBuffers:0x%p)\n",
+				0u, 2u, (void*)(uintptr_t)0x7ffe1000);
+		for (slot = 0; slot < 2; slot++) {
+			log.append("       %u:", slot);
+			log.append(" resource=0x%p", (void*)(uintptr_t)(0x20000000 + slot * 4096 + i));
+			log.append(" hash=%08x", 0x9e3779b9u * (i + slot));
+			log.append("\n");
+		}
+		log.call("PSSetShaderResources(StartSlot:%u, NumViews:%u, ppShaderResourceViews:0x%p)\n",
+				0u, 4u, (void*)(uintptr_t)0x7ffe2000);
+		for (slot = 0; slot < 4; slot++) {
+			log.append("       %u:", slot);
+			log.append(" view=0x%p", (void*)(uintptr_t)(0x30000000 + slot * 4096 + i));
+			log.append(" resource=0x%p", (void*)(uintptr_t)(0x40000000 + slot * 4096 + i));
+			log.append(" hash=%08x", 0x85ebca6bu * (i + slot));
+			log.append("\n");
+		}
+		log.call("3DMigoto%*s [%S] %s(%p, %u)\n", 2, "", L"ShaderOverrideCharacter", "checktextureoverride",
+				(void*)(uintptr_t)0x50000000, 0u);
+		log.call("DrawIndexed(IndexCount:%u, StartIndexLocation:%u, BaseVertexLocation:%u)\n",
+				(unsigned)(i * 3) % 30000, 0u, 0u);
+		log.draw_call++;
+	}
+}
+
+static double time_logging(const string &path, bool binary, size_t *size)
+{
+	FILE *fp = fopen(path.c_str(), "wb");
+	struct stat st;
+
+	if (!fp) {
+		printf("Unable to create %s\n", path.c_str());
+		exit(EXIT_FAILURE);
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	{
+		SyntheticLog log(binary ? NULL : fp, binary ? fp : NULL);
+		log_frame(log, args.draw_calls);
+	}
+	fclose(fp);
+	chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+
+	*size = stat(path.c_str(), &st) ? 0 : st.st_size;
+	return ms.count();
+}
+
+static void benchmark()
+{
+	string text_path = args.dir + "/log.txt";
+	string trace_path = args.dir + "/log.fatrace";
+	size_t text_size, trace_size;
+	double text_ms, trace_ms;
+	vector<uint8_t> trace;
+	string rendered;
+	FILE *fp;
+
+	mkdir(args.dir.c_str(), 0777);
+
+	text_ms = time_logging(text_path, false, &text_size);
+	trace_ms = time_logging(trace_path, true, &trace_size);
+
+	fp = fopen(trace_path.c_str(), "rb");
+	fseek(fp, 0, SEEK_END);
+	trace = read_back(fp);
+	fclose(fp);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	render(trace, &rendered);
+	chrono::duration<double, milli> convert_ms = chrono::steady_clock::now() - start;
+
+	printf("%i draw calls:\n", args.draw_calls);
+	printf("  log.txt     %10.3fms %10.1f MB\n", text_ms, text_size / 1048576.0);
+	printf("  log.fatrace %10.3fms %10.1f MB\n", trace_ms, trace_size / 1048576.0);
+	printf("  converting the trace back to text took %.3fms\n", convert_ms.count());
+
+	unlink(text_path.c_str());
+	unlink(trace_path.c_str());
+	rmdir(args.dir.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_round_trip();
+	check_msvc();
+	check_truncation();
+	check_corruption();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
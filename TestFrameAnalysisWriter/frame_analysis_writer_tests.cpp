@@ -0,0 +1,642 @@
+// frame_analysis_writer_tests.cpp : Checks and benchmarks the worker pool that
+// DirectX11/FrameAnalysisWriter.cpp writes frame analysis buffer dumps on.
+//
+// Dumps of random sizes are run through writers with different numbers of
+// threads to check each is written exactly once from an intact copy, that
+// the copies come back to the pool to be reused, and that the progress
+// counters add up. Small limits then check that the render thread waits
+// once the copies the writers haven't finished with would go over them, but
+// never for a single dump larger than the limit, and that draining throws
+// away what hasn't started. Deduplicated files are checked to be written
+// once, with everyone else waiting until they are complete. Finally a
+// synthetic dump workload (copying and hashing on the render thread,
+// formatting float4s as text and writing them to disk) is timed on the render
+// thread with and without the writers.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "FrameAnalysisWriter.h"
+
+using namespace std;
+
+static struct {
+	string dir = "frame_analysis_writer_tests.dir";
+	int dumps = 2000;
+	int threads = 4;
+	int benchmark_dumps = 400;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the frame analysis writer pool, then times a synthetic dump workload with and without it.\n\n");
+
+	printf("  -n, --dumps N\n");
+	printf("\t\t\tNumber of dumps to check with (default 2000)\n");
+
+	printf("  -j, --threads N\n");
+	printf("\t\t\tMost writer threads to check and benchmark with (default 4)\n");
+
+	printf("  -d, --dir DIR\n");
+	printf("\t\t\tDirectory to write the benchmark dumps to (default frame_analysis_writer_tests.dir)\n");
+
+	printf("  --benchmark-dumps N\n");
+	printf("\t\t\tNumber of buffers to dump in the benchmark (default 400)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random dump sizes and contents (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--dumps")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.dumps = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-j") || !strcmp(arg, "--threads")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.threads = min(max(atoi(argv[i]), 1), MAX_FRAME_ANALYSIS_WRITER_THREADS);
+			continue;
+		}
+		if (!strcmp(arg, "-d") || !strcmp(arg, "--dir")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.dir = argv[i];
+			continue;
+		}
+		if (!strcmp(arg, "--benchmark-dumps")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.benchmark_dumps = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+// Holds writers up until the test lets them go, so that the limits can be
+// checked without relying on timing:
+struct Gate {
+	mutex lock;
+	condition_variable cv;
+	bool open = false;
+
+	void wait()
+	{
+		unique_lock<mutex> guard(lock);
+		cv.wait(guard, [&] { return open; });
+	}
+
+	void release()
+	{
+		lock_guard<mutex> guard(lock);
+		open = true;
+		cv.notify_all();
+	}
+};
+
+// Fills a copy the way the render thread copies a mapped buffer into it. The
+// contents depend on the dump so that a writer given the wrong copy, or one
+// that was reused before it was finished with, notices:
+static void fill(FrameAnalysisBuffer *buffer, uint32_t dump)
+{
+	uint8_t *data = buffer->data();
+	size_t i;
+
+	for (i = 0; i < buffer->size(); i++)
+		data[i] = (uint8_t)(dump * 131 + i * 7);
+}
+
+static bool intact(const FrameAnalysisBuffer &buffer, uint32_t dump)
+{
+	const uint8_t *data = buffer.data();
+	size_t i;
+
+	for (i = 0; i < buffer.size(); i++) {
+		if (data[i] != (uint8_t)(dump * 131 + i * 7))
+			return false;
+	}
+	return true;
+}
+
+static void check_dumps(unsigned threads)
+{
+	FrameAnalysisWriter writer(threads, FRAME_ANALYSIS_WRITER_MAX_STAGED_BYTES,
+			FRAME_ANALYSIS_WRITER_MAX_QUEUED);
+	vector<atomic<int>> runs(args.dumps);
+	vector<atomic<bool>> corrupt(args.dumps);
+	FrameAnalysisWriterStats stats;
+	FrameAnalysisBufferPtr buffer;
+	size_t size;
+	int i;
+
+	for (i = 0; i < args.dumps; i++) {
+		runs[i] = 0;
+		corrupt[i] = false;
+	}
+
+	for (i = 0; i < args.dumps; i++) {
+		// Mostly constant buffer sized, with the odd vertex buffer:
+		size = rng() % 8 ? rng() % 4096 : rng() % (1024 * 1024);
+
+		buffer = writer.get_buffer(size);
+		if (buffer->size() != size)
+			report_mismatch("asked for %zu bytes, got %zu", size, buffer->size());
+		fill(buffer.get(), i);
+
+		writer.queue(move(buffer), [&, i](const FrameAnalysisBuffer &buffer) {
+			runs[i]++;
+			if (!intact(buffer, i))
+				corrupt[i] = true;
+			if (i % 97 == 0)
+				throw runtime_error("writer blew up");
+		});
+	}
+	writer.wait_idle();
+
+	for (i = 0; i < args.dumps; i++) {
+		if (runs[i] != 1)
+			report_mismatch("%u threads: dump %i was written %i times", threads, i, runs[i].load());
+		if (corrupt[i])
+			report_mismatch("%u threads: dump %i was written from a corrupt copy", threads, i);
+	}
+
+	stats = writer.get_stats();
+	if (stats.queued != (uint64_t)args.dumps || stats.written != (uint64_t)args.dumps || stats.dropped)
+		report_mismatch("%u threads: stats queued=%llu written=%llu dropped=%llu", threads,
+				(unsigned long long)stats.queued, (unsigned long long)stats.written,
+				(unsigned long long)stats.dropped);
+	if (stats.staged_bytes)
+		report_mismatch("%u threads: %llu bytes still staged once idle", threads,
+				(unsigned long long)stats.staged_bytes);
+	if (stats.buffers_reused + stats.buffers_allocated != (uint64_t)args.dumps)
+		report_mismatch("%u threads: %llu buffers reused + %llu allocated for %i dumps", threads,
+				(unsigned long long)stats.buffers_reused,
+				(unsigned long long)stats.buffers_allocated, args.dumps);
+	if (args.dumps >= 100 && stats.buffers_reused < stats.buffers_allocated)
+		report_mismatch("%u threads: only reused %llu buffers, allocated %llu", threads,
+				(unsigned long long)stats.buffers_reused,
+				(unsigned long long)stats.buffers_allocated);
+	if (!threads && stats.waits)
+		report_mismatch("waited %llu times with no writers to wait for",
+				(unsigned long long)stats.waits);
+}
+
+// Asks for buffers on another thread, like the game's render thread would,
+// so the test can see whether it is held up:
+struct RenderThread {
+	FrameAnalysisWriter *writer;
+	atomic<int> copied;
+	thread t;
+
+	RenderThread(FrameAnalysisWriter *writer, int dumps, size_t size, function<void()> work) :
+		writer(writer),
+		copied(0)
+	{
+		t = thread([=] {
+			for (int i = 0; i < dumps; i++) {
+				FrameAnalysisBufferPtr buffer = this->writer->get_buffer(size);
+				copied++;
+				this->writer->queue(move(buffer), [=](const FrameAnalysisBuffer&) { work(); });
+			}
+		});
+	}
+
+	// There's no way to see a thread is blocked, but if it hasn't moved in
+	// this long it isn't going to:
+	int settle()
+	{
+		int prev;
+
+		do {
+			prev = copied;
+			this_thread::sleep_for(chrono::milliseconds(20));
+		} while (copied != prev);
+
+		return prev;
+	}
+
+	void join()
+	{
+		t.join();
+	}
+};
+
+static void check_backpressure()
+{
+	const size_t max_staged = 64 * 1024;
+	const size_t max_queued = 8;
+	FrameAnalysisWriterStats stats;
+	int copied;
+
+	// Copies of 16K each. One is with the writer, so three more can be
+	// waiting before the next would go over the limit:
+	{
+		FrameAnalysisWriter writer(1, max_staged, 1000);
+		Gate gate;
+
+		RenderThread render(&writer, 20, 16 * 1024, [&] { gate.wait(); });
+		copied = render.settle();
+		if (copied != 4)
+			report_mismatch("render thread copied %i 16K buffers before waiting with a 64K limit", copied);
+
+		stats = writer.get_stats();
+		if (stats.staged_bytes > max_staged || stats.waits != 1)
+			report_mismatch("staged=%llu waits=%llu while held up",
+					(unsigned long long)stats.staged_bytes, (unsigned long long)stats.waits);
+
+		gate.release();
+		render.join();
+		writer.wait_idle();
+
+		stats = writer.get_stats();
+		if (stats.max_staged_bytes > max_staged || stats.written != 20)
+			report_mismatch("max staged=%llu written=%llu after the writer caught up",
+					(unsigned long long)stats.max_staged_bytes, (unsigned long long)stats.written);
+	}
+
+	// Tiny copies are held up by the number of dumps waiting instead:
+	{
+		FrameAnalysisWriter writer(1, max_staged, max_queued);
+		Gate gate;
+
+		RenderThread render(&writer, 50, 16, [&] { gate.wait(); });
+		copied = render.settle();
+		// One with the writer and max_queued waiting for it:
+		if (copied != (int)max_queued + 1)
+			report_mismatch("render thread copied %i buffers before waiting with %zu allowed to queue",
+					copied, max_queued);
+
+		gate.release();
+		render.join();
+		writer.wait_idle();
+	}
+
+	// A single dump bigger than the limit still has to go through, or a
+	// large vertex buffer could never be dumped:
+	{
+		FrameAnalysisWriter writer(1, max_staged, max_queued);
+		Gate gate;
+
+		RenderThread render(&writer, 2, max_staged * 4, [&] { gate.wait(); });
+		copied = render.settle();
+		if (copied != 1)
+			report_mismatch("render thread copied %i oversized buffers, expected just the first", copied);
+
+		gate.release();
+		render.join();
+		writer.wait_idle();
+	}
+
+	// With no writers the dump is written before queue returns, so there
+	// is never anything to wait for:
+	{
+		FrameAnalysisWriter writer(0, max_staged, 1);
+		atomic<int> written(0);
+
+		RenderThread render(&writer, 100, max_staged, [&] { written++; });
+		render.join();
+
+		stats = writer.get_stats();
+		if (written != 100 || stats.waits || stats.staged_bytes)
+			report_mismatch("no writers: written=%i waits=%llu staged=%llu", written.load(),
+					(unsigned long long)stats.waits, (unsigned long long)stats.staged_bytes);
+	}
+}
+
+static void check_drain()
+{
+	const int dumps = 10;
+	FrameAnalysisWriter writer(1, FRAME_ANALYSIS_WRITER_MAX_STAGED_BYTES, 100);
+	atomic<int> runs[dumps];
+	FrameAnalysisWriterStats stats;
+	FrameAnalysisBufferPtr buffer;
+	atomic<bool> started(false);
+	size_t dropped;
+	Gate gate;
+	int i;
+
+	for (i = 0; i < dumps; i++) {
+		runs[i] = 0;
+		buffer = writer.get_buffer(100);
+		writer.queue(move(buffer), [&, i](const FrameAnalysisBuffer&) {
+			if (!i) {
+				started = true;
+				gate.wait();
+			}
+			runs[i]++;
+		});
+	}
+
+	// Draining drops everything still queued straight away, then waits
+	// for the one being written:
+	while (!started)
+		this_thread::yield();
+	thread drainer([&] { dropped = writer.drain(); });
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(10);
+	while (writer.get_stats().dropped != dumps - 1 && chrono::steady_clock::now() < deadline)
+		this_thread::yield();
+	gate.release();
+	drainer.join();
+
+	if (dropped != dumps - 1)
+		report_mismatch("drain dropped %zu dumps, expected %i", dropped, dumps - 1);
+	if (runs[0] != 1)
+		report_mismatch("dump being written did not finish during the drain");
+	for (i = 1; i < dumps; i++) {
+		if (runs[i])
+			report_mismatch("dump %i was written after it was dropped", i);
+	}
+
+	stats = writer.get_stats();
+	if (stats.written + stats.dropped != stats.queued || stats.staged_bytes)
+		report_mismatch("after drain queued=%llu written=%llu dropped=%llu staged=%llu",
+				(unsigned long long)stats.queued, (unsigned long long)stats.written,
+				(unsigned long long)stats.dropped, (unsigned long long)stats.staged_bytes);
+}
+
+static void check_progress()
+{
+	FrameAnalysisWriter writer(1, FRAME_ANALYSIS_WRITER_MAX_STAGED_BYTES, 100);
+	FrameAnalysisBufferPtr buffer;
+	uint64_t last_written = 0;
+	int calls = 0;
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		buffer = writer.get_buffer(16);
+		writer.queue(move(buffer), [](const FrameAnalysisBuffer&) {
+			this_thread::sleep_for(chrono::milliseconds(5));
+		});
+	}
+
+	writer.wait_idle([&](const FrameAnalysisWriterStats &stats) {
+		calls++;
+		if (stats.written < last_written || stats.written > stats.queued)
+			report_mismatch("progress went from %llu to %llu of %llu",
+					(unsigned long long)last_written, (unsigned long long)stats.written,
+					(unsigned long long)stats.queued);
+		last_written = stats.written;
+	}, chrono::milliseconds(10));
+
+	if (!calls)
+		report_mismatch("no progress was reported while waiting ~100ms for the writer");
+	if (writer.get_stats().written != 20)
+		report_mismatch("wait_idle returned with %llu of 20 written",
+				(unsigned long long)writer.get_stats().written);
+}
+
+static void check_write_once()
+{
+	const int paths = 50;
+	const int callers = 8;
+	FrameAnalysisWriter writer(0, FRAME_ANALYSIS_WRITER_MAX_STAGED_BYTES, 100);
+	atomic<int> writes[paths];
+	atomic<bool> complete[paths];
+	atomic<int> called(0);
+	vector<thread> threads;
+	int i;
+
+	for (i = 0; i < paths; i++) {
+		writes[i] = 0;
+		complete[i] = false;
+	}
+
+	// Every caller writes every path, as writers do when several dumps
+	// in a frame have the same contents:
+	for (i = 0; i < callers; i++) {
+		threads.emplace_back([&, i] {
+			for (int j = 0; j < paths; j++) {
+				int path = (j + i * 7) % paths;
+				bool wrote = writer.write_once(L"deduped\\" + to_wstring(path) + L".txt", [&] {
+					writes[path]++;
+					this_thread::sleep_for(chrono::microseconds(200));
+					complete[path] = true;
+				});
+				called += wrote;
+				if (!complete[path])
+					report_mismatch("write_once returned before path %i was written", path);
+			}
+		});
+	}
+	for (thread &t : threads)
+		t.join();
+
+	for (i = 0; i < paths; i++) {
+		if (writes[i] != 1)
+			report_mismatch("path %i was written %i times", i, writes[i].load());
+	}
+	if (called != paths || writer.get_stats().deduplicated != (uint64_t)(paths * (callers - 1)))
+		report_mismatch("write_once wrote %i times and deduplicated %llu", called.load(),
+				(unsigned long long)writer.get_stats().deduplicated);
+
+	// The next frame analysis writes them afresh:
+	writer.forget_written();
+	if (!writer.write_once(L"deduped\\0.txt", [] {}))
+		report_mismatch("path was still deduplicated after forget_written()");
+}
+
+// The work DumpBufferImmediateCtx leaves to the writers for a constant
+// buffer dumped as .buf and .txt, with the files deduplicated by the hash of
+// the contents it takes on the render thread for the frame analysis log:
+struct SyntheticDump {
+	FrameAnalysisWriter *writer;
+	atomic<int> files;
+
+	void write(const uint8_t *data, size_t size, uint32_t hash)
+	{
+		const float *buf = (const float*)data;
+		const char *components = "xyzw";
+		string path;
+		FILE *fd;
+		size_t i, c;
+
+		path = args.dir + "/" + to_string(hash) + ".buf";
+		writer->write_once(wstring(path.begin(), path.end()), [&] {
+			fd = fopen(path.c_str(), "wb");
+			if (!fd)
+				return;
+			fwrite(data, 1, size, fd);
+			fclose(fd);
+			files++;
+		});
+
+		path = args.dir + "/" + to_string(hash) + ".txt";
+		writer->write_once(wstring(path.begin(), path.end()), [&] {
+			fd = fopen(path.c_str(), "w");
+			if (!fd)
+				return;
+			for (i = 0; i < size / 16; i++) {
+				for (c = 0; c < 4; c++)
+					fprintf(fd, "cb0[%zu].%c: %.9g\n", i, components[c], buf[i * 4 + c]);
+			}
+			fclose(fd);
+			files++;
+		});
+	}
+};
+
+static void remove_benchmark_files(const vector<vector<uint8_t>> &sources)
+{
+	string path;
+
+	for (const vector<uint8_t> &source : sources) {
+		uint32_t hash = crc32c_append(0, source.data(), source.size());
+		path = args.dir + "/" + to_string(hash);
+		unlink((path + ".buf").c_str());
+		unlink((path + ".txt").c_str());
+	}
+}
+
+static void benchmark()
+{
+	vector<vector<uint8_t>> sources;
+	size_t bytes = 0;
+	int i;
+
+	mkdir(args.dir.c_str(), 0777);
+
+	// A frame's worth of buffers: some big, mostly small, and a third of
+	// them the same as another, as happens with constant buffers that are
+	// dumped for every draw call:
+	for (i = 0; i < args.benchmark_dumps; i++) {
+		if (i % 3 == 2) {
+			sources.push_back(sources[rng() % sources.size()]);
+		} else {
+			vector<uint8_t> source(i % 10 ? 4096 : 65536);
+			for (float *f = (float*)source.data(); f < (float*)(source.data() + source.size()); f++)
+				*f = (float)(rng() % 100000) / 7.0f;
+			sources.push_back(move(source));
+		}
+		bytes += sources.back().size();
+	}
+
+	printf("%i dumps, %.1f MB:\n", args.benchmark_dumps, bytes / 1048576.0);
+	printf("  threads   render thread      finished   waits   files\n");
+
+	for (unsigned threads : { 0u, 1u, 2u, (unsigned)args.threads }) {
+		FrameAnalysisWriter writer(threads, FRAME_ANALYSIS_WRITER_MAX_STAGED_BYTES,
+				FRAME_ANALYSIS_WRITER_MAX_QUEUED);
+		SyntheticDump dump{&writer, {0}};
+
+		remove_benchmark_files(sources);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (const vector<uint8_t> &source : sources) {
+			FrameAnalysisBufferPtr buffer = writer.get_buffer(source.size());
+			memcpy(buffer->data(), source.data(), source.size());
+			uint32_t hash = crc32c_append(0, buffer->data(), buffer->size());
+			writer.queue(move(buffer), [&dump, hash](const FrameAnalysisBuffer &buffer) {
+				dump.write(buffer.data(), buffer.size(), hash);
+			});
+		}
+		chrono::duration<double, milli> render_ms = chrono::steady_clock::now() - start;
+		writer.wait_idle();
+		chrono::duration<double, milli> done_ms = chrono::steady_clock::now() - start;
+
+		printf("  %7u %13.3fms %11.3fms %7llu %7i\n", threads, render_ms.count(), done_ms.count(),
+				(unsigned long long)writer.get_stats().waits, dump.files.load());
+	}
+
+	remove_benchmark_files(sources);
+	rmdir(args.dir.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	for (unsigned threads : { 0u, 1u, 2u, (unsigned)args.threads })
+		check_dumps(threads);
+	check_backpressure();
+	check_drain();
+	check_progress();
+	check_write_once();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,601 @@
+// ini_file_loader_tests.cpp : Checks and benchmarks DirectX11/IniFileLoader.cpp,
+// which lists the directories pulled in by include_recursive and reads and
+// tokenises their ini files on worker threads.
+//
+// The loader is checked with a mock file system that takes a random amount
+// of time over each file and directory, so the workers finish out of order -
+// every file must still come back in the order it was queued with the tokens
+// of its contents, and every tree must be listed in the order the old
+// recursive walk visited it. Finally a synthetic mod tree is written to a
+// temporary directory and loaded with different numbers of workers. The
+// tokeniser itself is checked by TestIniTokenizer.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <wchar.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "IniFileLoader.h"
+#include "IniReload.h"
+
+using namespace std;
+
+static struct {
+	int files = 200;
+	int benchmark_files = 1000;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the parallel ini file loader, then times loading a synthetic mod tree with it.\n\n");
+
+	printf("  -n, --files N\n");
+	printf("\t\t\tNumber of ini files to check with (default 200)\n");
+
+	printf("  --benchmark-files N\n");
+	printf("\t\t\tNumber of ini files in the benchmark mod tree (default 1000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random files and trees (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--files")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.files = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--benchmark-files")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.benchmark_files = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static const unsigned thread_counts[] = {0, 1, 2, 4, MAX_INI_LOADER_THREADS};
+
+static string random_whitespace()
+{
+	static const char chars[] = " \t";
+	string ret;
+	int n = rng() % 4;
+
+	while (n--)
+		ret += chars[rng() % 2];
+	return ret;
+}
+
+static string random_word()
+{
+	static const char chars[] = "abcXYZ019_.\\$";
+	string ret;
+	int n = 1 + rng() % 8;
+
+	while (n--)
+		ret += chars[rng() % (sizeof(chars) - 1)];
+	// The odd byte outside ASCII, which is widened as a char:
+	if (rng() % 16 == 0)
+		ret += (char)(0x80 + rng() % 0x80);
+	return ret;
+}
+
+static string random_ini_line()
+{
+	string ret = random_whitespace();
+
+	switch (rng() % 10) {
+	case 0:
+		break; // Blank, or only whitespace
+	case 1:
+		ret += "; " + random_word() + " = " + random_word();
+		break;
+	case 2:
+		ret += "[" + random_word() + "]" + (rng() % 4 ? "" : " ; trailing");
+		break;
+	case 3:
+		ret += random_word() + random_whitespace() + " " + random_word();
+		break;
+	case 4:
+		ret += "=" + random_word(); // No key
+		break;
+	case 5:
+		ret += random_word() + random_whitespace() + "="; // No val
+		break;
+	case 6:
+		ret += random_word() + " = " + random_word() + " = " + random_word();
+		break;
+	case 7:
+		ret += "\r"; // Dropped before a LF, as text mode did
+		break;
+	default:
+		ret += random_word() + random_whitespace() + "=" + random_whitespace() + random_word();
+		break;
+	}
+
+	return ret + random_whitespace();
+}
+
+static string random_ini(size_t lines)
+{
+	string ret;
+
+	while (lines--) {
+		ret += random_ini_line();
+		if (lines || rng() % 2)
+			ret += "\n";
+	}
+	return ret;
+}
+
+static string view_string(IniView view)
+{
+	return string(view.data, view.len);
+}
+
+static bool same_view(IniView a, IniView b)
+{
+	return a.len == b.len && !memcmp(a.data, b.data, a.len);
+}
+
+// The tokens are views into different copies of the same contents:
+static bool same_tokens(const vector<IniToken> &a, const vector<IniToken> &b, const char *desc)
+{
+	size_t i;
+
+	if (a.size() != b.size()) {
+		report_mismatch("%s: %zu tokens, expected %zu", desc, a.size(), b.size());
+		return false;
+	}
+
+	for (i = 0; i < a.size(); i++) {
+		if (!same_view(a[i].line, b[i].line) || a[i].section != b[i].section || a[i].equals != b[i].equals
+				|| !same_view(a[i].key, b[i].key) || !same_view(a[i].val, b[i].val)) {
+			report_mismatch("%s: token %zu is \"%s\", expected \"%s\"", desc, i,
+					view_string(a[i].line).c_str(), view_string(b[i].line).c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Stands in for the file system. The workers sleep for a time that depends on
+// the name, so each one finishes out of order but the same way every time:
+static map<wstring, string> mock_files;
+static map<wstring, vector<wstring>> mock_directories;
+
+static void mock_delay(const wstring &name)
+{
+	size_t h = hash<wstring>()(name);
+
+	this_thread::sleep_for(chrono::microseconds(h % 3 ? 0 : h % 500));
+}
+
+static bool mock_read_file(const wstring &path, shared_ptr<IniFileBuffer> *buffer)
+{
+	mock_delay(path);
+
+	if (path.find(L"throw") != path.npos)
+		throw runtime_error("mock read failure");
+
+	auto i = mock_files.find(path);
+	if (i == mock_files.end())
+		return false;
+
+	*buffer = make_shared<IniStringBuffer>(i->second);
+	return true;
+}
+
+static bool is_ini(const wstring &name)
+{
+	return name.size() >= 4 && !wcscmp(name.c_str() + name.size() - 4, L".ini");
+}
+
+static bool insensitive_less(const wstring &a, const wstring &b)
+{
+	return wcscasecmp(a.c_str(), b.c_str()) < 0;
+}
+
+// Directory entries in the mock tree are marked with a trailing slash:
+static void mock_list_directory(IniDirectoryListing *listing)
+{
+	mock_delay(listing->rel_path);
+
+	auto i = mock_directories.find(listing->rel_path);
+	if (i == mock_directories.end())
+		return;
+	listing->found = true;
+
+	for (const wstring &entry : i->second) {
+		if (entry.find(L"exclude") != entry.npos)
+			listing->excluded.push_back(entry);
+		else if (entry.back() == L'/')
+			listing->directories.push_back(entry.substr(0, entry.size() - 1));
+		else if (is_ini(entry))
+			listing->ini_files.push_back(entry);
+		else
+			listing->others.push_back(entry);
+	}
+
+	sort(listing->ini_files.begin(), listing->ini_files.end(), insensitive_less);
+	sort(listing->directories.begin(), listing->directories.end(), insensitive_less);
+}
+
+static void check_files(unsigned threads)
+{
+	vector<wstring> paths;
+	IniFileFragment fragment;
+	vector<IniToken> expected;
+	size_t i, next;
+	int n;
+
+	mock_files.clear();
+	for (n = 0; n < args.files; n++)
+		mock_files[L"file" + to_wstring(n) + L".ini"] = random_ini(rng() % 256);
+
+	for (auto &file : mock_files)
+		paths.push_back(file.first);
+	// Some more that can't be read, and the same file more than once:
+	paths.push_back(L"missing.ini");
+	paths.push_back(L"throw.ini");
+	paths.push_back(paths[0]);
+	shuffle(paths.begin(), paths.end(), rng);
+
+	IniFileLoader loader(threads, mock_read_file, mock_list_directory);
+
+	// Taking files while others are still being queued, as happens when
+	// include files and include_recursive directories are mixed:
+	for (i = 0, next = 0; i < paths.size(); i++) {
+		loader.queue_file(paths[i]);
+
+		while (next < paths.size() && next <= i && (rng() % 4 == 0 || i == paths.size() - 1)) {
+			if (!loader.next_file(&fragment)) {
+				report_mismatch("%u threads: ran out of files at %zu", threads, next);
+				return;
+			}
+			if (fragment.path != paths[next]) {
+				report_mismatch("%u threads: file %zu is %S, expected %S",
+						threads, next, fragment.path.c_str(), paths[next].c_str());
+				return;
+			}
+
+			auto file = mock_files.find(fragment.path);
+			if (fragment.opened != (file != mock_files.end())) {
+				report_mismatch("%u threads: %S %s",
+						threads, fragment.path.c_str(), fragment.opened ? "opened" : "not opened");
+			} else if (fragment.opened) {
+				expected.clear();
+				tokenise_ini(file->second.data(), file->second.size(), &expected);
+				same_tokens(fragment.tokens, expected, "loaded");
+				if (fragment.hash != ini_reload_hash(0, file->second.data(), file->second.size()))
+					report_mismatch("%u threads: %S hash", threads, fragment.path.c_str());
+			}
+			next++;
+		}
+	}
+
+	if (loader.next_file(&fragment))
+		report_mismatch("%u threads: got %S after the last file", threads, fragment.path.c_str());
+}
+
+static void random_tree(const wstring &rel_path, int depth, int *files)
+{
+	vector<wstring> &entries = mock_directories[rel_path];
+	int n, i;
+
+	n = rng() % 8;
+	for (i = 0; i < n && *files > 0; i++, (*files)--) {
+		switch (rng() % 8) {
+		case 0:
+			entries.push_back(L"readme" + to_wstring(i) + L".txt");
+			break;
+		case 1:
+			entries.push_back(L"exclude" + to_wstring(i) + L".ini");
+			break;
+		default:
+			// Mixed case, to check the order is case insensitive:
+			entries.push_back((rng() % 2 ? L"Mod" : L"mod") + to_wstring(rng() % 100) + L".ini");
+		}
+	}
+
+	if (depth >= 4)
+		return;
+
+	n = rng() % 5;
+	for (i = 0; i < n && *files > 0; i++) {
+		wstring name = (rng() % 2 ? L"Dir" : L"dir") + to_wstring(i) + (rng() % 6 ? L"" : L"_exclude");
+		entries.push_back(name + L"/");
+		random_tree(rel_path + L"\\" + name, depth + 1, files);
+	}
+
+	// The listing comes back in whatever order the file system likes:
+	shuffle(entries.begin(), entries.end(), rng);
+}
+
+// How ParseIniFilesRecursive used to walk the tree, one directory at a time:
+static void reference_walk(const wstring &rel_path, vector<IniDirectoryListing> *listings)
+{
+	IniDirectoryListing listing;
+
+	listing.rel_path = rel_path;
+	listing.found = false;
+	mock_list_directory(&listing);
+	listings->push_back(listing);
+
+	for (const wstring &directory : listing.directories)
+		reference_walk(rel_path + L"\\" + directory, listings);
+}
+
+static void check_walk(unsigned threads)
+{
+	vector<IniDirectoryListing> listings, expected;
+	int files = args.files;
+	size_t i;
+
+	mock_directories.clear();
+	random_tree(L"\\Mods", 0, &files);
+
+	IniFileLoader loader(threads, mock_read_file, mock_list_directory);
+
+	loader.walk(L"\\Mods", &listings);
+	reference_walk(L"\\Mods", &expected);
+
+	// And one that is not there at all:
+	loader.walk(L"\\Missing", &listings);
+	reference_walk(L"\\Missing", &expected);
+
+	if (listings.size() != expected.size()) {
+		report_mismatch("%u threads: walked %zu directories, expected %zu",
+				threads, listings.size(), expected.size());
+		return;
+	}
+
+	for (i = 0; i < listings.size(); i++) {
+		if (listings[i].rel_path != expected[i].rel_path
+				|| listings[i].found != expected[i].found
+				|| listings[i].ini_files != expected[i].ini_files
+				|| listings[i].directories != expected[i].directories
+				|| listings[i].excluded != expected[i].excluded
+				|| listings[i].others != expected[i].others) {
+			report_mismatch("%u threads: directory %zu is %S, expected %S",
+					threads, i, listings[i].rel_path.c_str(), expected[i].rel_path.c_str());
+			return;
+		}
+	}
+}
+
+static void check_loader()
+{
+	for (unsigned threads : thread_counts) {
+		check_files(threads);
+		check_walk(threads);
+	}
+}
+
+// The benchmark uses a real directory tree, laid out like a Mods folder: a
+// directory per mod, each with a main ini and a few more in subdirectories.
+static string narrow(const wstring &path)
+{
+	string ret(path.begin(), path.end());
+
+	replace(ret.begin(), ret.end(), '\\', '/');
+	return ret;
+}
+
+static bool map_disk_file(const wstring &path, shared_ptr<IniFileBuffer> *buffer)
+{
+	string narrowed = narrow(path);
+
+	return map_ini_file(wstring(narrowed.begin(), narrowed.end()), buffer);
+}
+
+static void list_disk_directory(IniDirectoryListing *listing)
+{
+	struct dirent *entry;
+	struct stat st;
+	string path = narrow(listing->rel_path);
+	DIR *dir;
+
+	dir = opendir(path.c_str());
+	if (!dir)
+		return;
+	listing->found = true;
+
+	while ((entry = readdir(dir))) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+		wstring name(entry->d_name, entry->d_name + strlen(entry->d_name));
+		if (stat((path + "/" + entry->d_name).c_str(), &st))
+			continue;
+		if (S_ISDIR(st.st_mode))
+			listing->directories.push_back(name);
+		else if (is_ini(name))
+			listing->ini_files.push_back(name);
+		else
+			listing->others.push_back(name);
+	}
+	closedir(dir);
+
+	sort(listing->ini_files.begin(), listing->ini_files.end(), insensitive_less);
+	sort(listing->directories.begin(), listing->directories.end(), insensitive_less);
+}
+
+static string benchmark_ini(int mod, int file)
+{
+	string ret;
+	int i, j;
+
+	ret += "; Mod " + to_string(mod) + " file " + to_string(file) + "\n";
+	ret += "namespace = mod" + to_string(mod) + "\n\n";
+	for (i = 0; i < 12; i++) {
+		ret += "[TextureOverrideMod" + to_string(mod) + "Part" + to_string(file * 100 + i) + "]\n";
+		ret += "hash = " + to_string(rng()) + "\n";
+		ret += "match_first_index = " + to_string(rng() % 100000) + "\n";
+		for (j = 0; j < 8; j++)
+			ret += "ps-t" + to_string(j) + " = Resource" + to_string(mod) + "Tex" + to_string(rng() % 64) + "\n";
+		ret += "handling = skip\n";
+		ret += "drawindexed = auto\n\n";
+	}
+	return ret;
+}
+
+static void benchmark()
+{
+	vector<string> created_files, created_dirs;
+	char root_template[] = "/tmp/ini_file_loader_tests.XXXXXX";
+	size_t bytes = 0;
+	string root, dir;
+	int mod, file, files_per_mod = 10;
+
+	if (!mkdtemp(root_template)) {
+		printf("Unable to create a temporary directory for the benchmark\n");
+		return;
+	}
+	root = root_template;
+
+	for (mod = 0, file = 0; file < args.benchmark_files; mod++) {
+		dir = root + "/Mod" + to_string(mod);
+		mkdir(dir.c_str(), 0755);
+		created_dirs.push_back(dir);
+		for (int i = 0; i < files_per_mod && file < args.benchmark_files; i++, file++) {
+			// All but the first go in a subdirectory:
+			if (i == 1) {
+				dir += "/Variants";
+				mkdir(dir.c_str(), 0755);
+				created_dirs.push_back(dir);
+			}
+			string path = dir + "/part" + to_string(i) + ".ini";
+			string contents = benchmark_ini(mod, i);
+			ofstream(path, ios::binary) << contents;
+			created_files.push_back(path);
+			bytes += contents.size();
+		}
+	}
+
+	printf("%i ini files in %i mod directories, %.1f MB:\n",
+			args.benchmark_files, mod, bytes / 1048576.0);
+
+	wstring wroot(root.begin(), root.end());
+	for (unsigned threads : thread_counts) {
+		// Once to warm the page cache, then timed:
+		for (int pass = 0; pass < 2; pass++) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			IniFileLoader loader(threads, map_disk_file, list_disk_directory);
+			vector<IniDirectoryListing> listings;
+			IniFileFragment fragment;
+			size_t tokens = 0;
+
+			loader.walk(wroot, &listings);
+			for (IniDirectoryListing &listing : listings) {
+				for (wstring &ini : listing.ini_files)
+					loader.queue_file(listing.rel_path + L"\\" + ini);
+			}
+			while (loader.next_file(&fragment))
+				tokens += fragment.tokens.size();
+
+			chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+			if (pass) {
+				string desc = threads ? to_string(threads) + " threads" : string("serial");
+				printf("  %-12s %10.3fms  (%zu lines)\n", desc.c_str(), ms.count(), tokens);
+			}
+		}
+	}
+
+	for (string &path : created_files)
+		unlink(path.c_str());
+	for (auto i = created_dirs.rbegin(); i != created_dirs.rend(); i++)
+		rmdir(i->c_str());
+	rmdir(root.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_loader();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,576 @@
+// ini_keys_tests.cpp : Checks and benchmarks DirectX11/IniKeys.cpp, the
+// interned case insensitive section and key names the ini parser looks
+// everything up with.
+//
+// Random names in random case are interned and looked up, and compared with
+// a plain map of lower case names. IniNameMap is checked against the
+// std::map with a _wcsicmp comparator and linear prefix scan that it
+// replaced - same order, same prefix ranges, same results moving [Include]
+// sections out and back. Finally a config shaped like a large mod setup is
+// loaded into each and looked up the way LoadConfigFile() does, counting the
+// time and the heap allocations each takes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwctype>
+#include <map>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IniKeys.h"
+
+using namespace std;
+
+// Counts every allocation, for the benchmark to report:
+static size_t allocations;
+
+void* operator new(size_t size)
+{
+	void *ret;
+
+	allocations++;
+	ret = malloc(size ? size : 1);
+	if (!ret)
+		throw bad_alloc();
+	return ret;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+static struct {
+	int names = 5000;
+	int sections = 4000;
+	int keys = 12;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the interned ini section and key names, then times a config load with and without them.\n\n");
+
+	printf("  -n, --names N\n");
+	printf("\t\t\tNumber of random names to check with (default 5000)\n");
+
+	printf("  --sections N\n");
+	printf("\t\t\tNumber of sections in the benchmark config (default 4000)\n");
+
+	printf("  --keys N\n");
+	printf("\t\t\tNumber of keys in each benchmark section (default 12)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random names (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--names")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.names = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--sections")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.sections = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--keys")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.keys = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+// _wcsicmp in the C locale, as IniHandler.cpp used to sort sections with:
+static int reference_wcsicmp(const wchar_t *a, const wchar_t *b)
+{
+	uint32_t ca, cb;
+
+	do {
+		ca = (uint32_t)*a++;
+		cb = (uint32_t)*b++;
+		if (ca >= 'A' && ca <= 'Z')
+			ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z')
+			cb += 'a' - 'A';
+	} while (ca && ca == cb);
+
+	return ca == cb ? 0 : (ca < cb ? -1 : 1);
+}
+
+static int reference_wcsnicmp(const wchar_t *a, const wchar_t *b, size_t n)
+{
+	wstring sa(a, min(wcslen(a), n)), sb(b, min(wcslen(b), n));
+
+	return reference_wcsicmp(sa.c_str(), sb.c_str());
+}
+
+struct ReferenceLess {
+	bool operator()(const wstring &x, const wstring &y) const
+	{
+		return reference_wcsicmp(x.c_str(), y.c_str()) < 0;
+	}
+};
+
+static wstring reference_fold(wstring name)
+{
+	for (wchar_t &c : name)
+		c = ini_fold(c);
+	return name;
+}
+
+static wstring random_case(wstring name)
+{
+	for (wchar_t &c : name) {
+		if (rng() % 2)
+			c = towupper(c);
+	}
+	return name;
+}
+
+static wstring random_name()
+{
+	// Section prefixes, so there are plenty of names in the same prefix
+	// range, along with the characters either side of A-Z and a-z that a
+	// sloppy case fold would get wrong:
+	static const wchar_t *prefixes[] = {
+		L"", L"ShaderOverride", L"TextureOverride", L"Resource", L"CommandList", L"Key", L"Include",
+	};
+	static const wchar_t chars[] = L"abcxyz09_@[`{\\.";
+	wstring ret = prefixes[rng() % 7];
+	int n = 1 + rng() % 10;
+
+	while (n--)
+		ret += chars[rng() % (sizeof(chars) / sizeof(wchar_t) - 1)];
+	// The odd character widened from a byte outside ASCII:
+	if (rng() % 16 == 0)
+		ret += (wchar_t)(char)(0x80 + rng() % 0x80);
+	return random_case(ret);
+}
+
+static void check_table()
+{
+	IniKeyTable table;
+	map<wstring, IniKey> expected;
+	vector<wstring> names;
+	IniKey key;
+	int i;
+
+	for (i = 0; i < args.names; i++)
+		names.push_back(random_name());
+
+	for (wstring &name : names) {
+		key = table.intern(name);
+		auto j = expected.emplace(reference_fold(name), key);
+		if (j.first->second != key)
+			report_mismatch("intern %S = %u, was %u", name.c_str(), key, j.first->second);
+		if (table.folded(key) != reference_fold(name))
+			report_mismatch("folded %S = %S", name.c_str(), table.folded(key).c_str());
+	}
+
+	if (table.size() != expected.size())
+		report_mismatch("%zu names interned, expected %zu", table.size(), expected.size());
+
+	// Looked up again in a different case, and some that were never added:
+	for (i = 0; i < args.names; i++) {
+		wstring name = rng() % 4 ? random_case(names[rng() % names.size()]) : random_name();
+		auto j = expected.find(reference_fold(name));
+		IniKey want = j == expected.end() ? INI_KEY_NONE : j->second;
+
+		if (table.find(name) != want || table.find(name.c_str()) != want)
+			report_mismatch("find %S = %u, expected %u", name.c_str(), table.find(name), want);
+	}
+
+	table.clear();
+	if (table.find(names[0]) != INI_KEY_NONE || table.size())
+		report_mismatch("table not empty after clear");
+}
+
+static void check_compare()
+{
+	int i;
+
+	for (i = 0; i < args.names; i++) {
+		wstring a = random_name();
+		wstring b = rng() % 4 ? random_name() : random_case(a);
+		int want = reference_wcsicmp(a.c_str(), b.c_str());
+		int got = ini_fold_compare(a.data(), a.size(), b.data(), b.size());
+
+		if ((got < 0) != (want < 0) || (got > 0) != (want > 0))
+			report_mismatch("compare %S %S = %i, expected %i", a.c_str(), b.c_str(), got, want);
+		if (!want && ini_fold_hash(a.data(), a.size()) != ini_fold_hash(b.data(), b.size()))
+			report_mismatch("hash %S != %S", a.c_str(), b.c_str());
+	}
+}
+
+typedef map<wstring, int, ReferenceLess> ReferenceMap;
+
+// How prefix_upper_bound() used to find the end of a prefix range:
+template <typename Map>
+static typename Map::iterator reference_prefix_upper_bound(Map &sections, const wstring &prefix)
+{
+	typename Map::iterator i;
+
+	for (i = sections.lower_bound(prefix); i != sections.end(); i++) {
+		if (reference_wcsnicmp(i->first.c_str(), prefix.c_str(), prefix.length()) > 0)
+			return i;
+	}
+
+	return sections.end();
+}
+
+static bool same_range(IniNameMap<int>::iterator i, IniNameMap<int>::iterator end,
+		ReferenceMap::iterator j, ReferenceMap::iterator ref_end, const char *desc, const wstring &prefix)
+{
+	for (; i != end && j != ref_end; i++, j++) {
+		if (i->first != j->first || i->second != j->second) {
+			report_mismatch("%s %S: %S, expected %S", desc, prefix.c_str(), i->first.c_str(), j->first.c_str());
+			return false;
+		}
+	}
+	if (i != end || j != ref_end) {
+		report_mismatch("%s %S: range is a different length", desc, prefix.c_str());
+		return false;
+	}
+	return true;
+}
+
+static void check_name_map()
+{
+	static const wchar_t *prefixes[] = {
+		L"ShaderOverride", L"TextureOverride", L"Resource", L"CommandList", L"Key", L"Include", L"Missing", L"",
+	};
+	IniKeyTable table;
+	IniNameMap<int> sections(&table), include_sections(&table);
+	ReferenceMap expected, expected_includes;
+	int i;
+
+	for (i = 0; i < args.names; i++) {
+		wstring name = random_name();
+		auto got = sections.emplace(name);
+		auto want = expected.emplace(name, i);
+		if (got.second != want.second)
+			report_mismatch("emplace %S = %i, expected %i", name.c_str(), got.second, want.second);
+		if (got.second)
+			got.first->second = i;
+	}
+
+	same_range(sections.begin(), sections.end(), expected.begin(), expected.end(), "order", L"");
+
+	for (i = 0; i < args.names; i++) {
+		wstring name = rng() % 2 ? random_case(expected.begin()->first) : random_name();
+		if (rng() % 2) {
+			auto j = expected.begin();
+			advance(j, rng() % expected.size());
+			name = random_case(j->first);
+		}
+		auto got = sections.find(name);
+		auto want = expected.find(name);
+		if ((got == sections.end()) != (want == expected.end())
+				|| (got != sections.end() && got->second != want->second))
+			report_mismatch("find %S", name.c_str());
+
+		bool threw = false;
+		try {
+			sections.at(name.c_str());
+		} catch (std::out_of_range) {
+			threw = true;
+		}
+		if (threw != (want == expected.end()))
+			report_mismatch("at %S %s", name.c_str(), threw ? "threw" : "did not throw");
+	}
+
+	for (const wchar_t *prefix : prefixes) {
+		wstring p = random_case(prefix);
+		same_range(sections.prefix_lower_bound(p.c_str()), sections.prefix_upper_bound(p.c_str()),
+				expected.lower_bound(p), reference_prefix_upper_bound(expected, p), "prefix", p);
+	}
+
+	// Moving the [Include] sections out and adding more, as
+	// ParseIncludedIniFiles() does:
+	for (i = 0; i < 4; i++) {
+		include_sections.clear();
+		expected_includes.clear();
+
+		auto lower = sections.prefix_lower_bound(L"Include");
+		auto upper = sections.prefix_upper_bound(L"Include");
+		include_sections.insert(lower, upper);
+		sections.erase(lower, upper);
+
+		auto ref_lower = expected.lower_bound(L"Include");
+		auto ref_upper = reference_prefix_upper_bound(expected, L"Include");
+		expected_includes.insert(ref_lower, ref_upper);
+		expected.erase(ref_lower, ref_upper);
+
+		same_range(include_sections.begin(), include_sections.end(),
+				expected_includes.begin(), expected_includes.end(), "moved", L"Include");
+		same_range(sections.begin(), sections.end(), expected.begin(), expected.end(), "left", L"Include");
+
+		for (auto &include : expected_includes) {
+			if (sections.find(include.first) != sections.end())
+				report_mismatch("%S still found after erase", include.first.c_str());
+			if (include_sections.find(random_case(include.first)) == include_sections.end())
+				report_mismatch("%S not found after insert", include.first.c_str());
+		}
+
+		// New includes turn up from the files just parsed:
+		for (int j = 0; j < 8; j++) {
+			wstring name = random_case(L"Include" + to_wstring(rng() % 16));
+			if (sections.emplace(name).second) {
+				sections.find(name)->second = j;
+				expected.emplace(name, j);
+			}
+		}
+	}
+}
+
+// The benchmark loads a config shaped like a large mod setup into the
+// structures IniHandler.cpp used to use and into the new ones, then does the
+// lookups LoadConfigFile() does: every setting each [ShaderOverride*] and
+// [TextureOverride*] section could have (most of which are not there), and
+// each global setting.
+struct WStringInsensitiveHash {
+	size_t operator()(const wstring &s) const
+	{
+		std::wstring l;
+		std::hash<std::wstring> whash;
+
+		l.resize(s.size());
+		std::transform(s.begin(), s.end(), l.begin(), ::towlower);
+		return whash(l);
+	}
+};
+struct WStringInsensitiveEquality {
+	size_t operator()(const wstring &x, const wstring &y) const
+	{
+		return reference_wcsicmp(x.c_str(), y.c_str()) == 0;
+	}
+};
+
+struct OldSection {
+	unordered_map<wstring, wstring, WStringInsensitiveHash, WStringInsensitiveEquality> kv_map;
+};
+typedef map<wstring, OldSection, ReferenceLess> OldSections;
+
+struct NewSection {
+	unordered_map<IniKey, wstring> kv_map;
+};
+
+static const wchar_t *override_settings[] = {
+	L"hash", L"match_first_index", L"match_index_count", L"match_priority", L"filter_index",
+	L"handling", L"depth_filter", L"partner", L"model", L"disable_scissor", L"allow_duplicate_hash",
+	L"separation", L"convergence", L"iteration", L"indexbufferfilter", L"analyse_options",
+	L"expand_region_copy", L"deny_cpu_read", L"match_type", L"format", L"width", L"height",
+};
+
+struct BenchmarkConfig {
+	vector<pair<wstring, vector<pair<wstring, wstring>>>> sections;
+};
+
+static BenchmarkConfig benchmark_config()
+{
+	BenchmarkConfig config;
+	int i, j;
+
+	for (i = 0; i < args.sections; i++) {
+		wstring name = (i % 2 ? L"TextureOverride\\Mods\\Mod" : L"ShaderOverride\\Mods\\Mod")
+			+ to_wstring(i / 20) + L"\\mod.ini\\Part" + to_wstring(i);
+		vector<pair<wstring, wstring>> lines;
+		lines.emplace_back(L"hash", to_wstring(rng()));
+		for (j = 1; j < args.keys; j++) {
+			if (j < 4)
+				lines.emplace_back(override_settings[j], to_wstring(rng() % 1000));
+			else
+				lines.emplace_back(L"ps-t" + to_wstring(j), L"Resource\\Mods\\Mod" + to_wstring(i / 20) + L"\\Tex" + to_wstring(j));
+		}
+		config.sections.emplace_back(random_case(name), lines);
+	}
+
+	return config;
+}
+
+static const size_t nr_settings = sizeof(override_settings) / sizeof(override_settings[0]);
+
+static size_t old_load(const BenchmarkConfig &config)
+{
+	OldSections sections;
+	OldSections::iterator lower, upper, i;
+	size_t found = 0;
+
+	for (auto &section : config.sections) {
+		sections.emplace(section.first, OldSection{});
+		for (auto &line : section.second)
+			sections.at(section.first).kv_map.emplace(line.first, line.second);
+	}
+
+	for (const wchar_t *prefix : {L"ShaderOverride", L"TextureOverride"}) {
+		lower = sections.lower_bound(wstring(prefix));
+		upper = reference_prefix_upper_bound(sections, wstring(prefix));
+		for (i = lower; i != upper; i++) {
+			// GetIniString() with the section name as a wchar_t*:
+			for (const wchar_t *setting : override_settings) {
+				try {
+					wstring &val = sections.at(wstring(i->first.c_str())).kv_map.at(wstring(setting));
+					found += !val.empty();
+				} catch (std::out_of_range) {
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+static size_t new_load(const BenchmarkConfig &config)
+{
+	IniKeyTable section_names, key_names;
+	IniNameMap<NewSection> sections(&section_names);
+	IniNameMap<NewSection>::iterator lower, upper, i, j;
+	size_t found = 0;
+	IniKey key;
+
+	for (auto &section : config.sections) {
+		sections.emplace(section.first);
+		for (auto &line : section.second)
+			sections.at(section.first).kv_map.emplace(key_names.intern(line.first), line.second);
+	}
+
+	for (const wchar_t *prefix : {L"ShaderOverride", L"TextureOverride"}) {
+		lower = sections.prefix_lower_bound(prefix);
+		upper = sections.prefix_upper_bound(prefix);
+		for (i = lower; i != upper; i++) {
+			// FindIniValue() with the section name as a wchar_t*:
+			for (const wchar_t *setting : override_settings) {
+				j = sections.find(i->first.c_str());
+				if (j == sections.end())
+					continue;
+				key = key_names.find(setting);
+				if (key == INI_KEY_NONE)
+					continue;
+				auto val = j->second.kv_map.find(key);
+				if (val != j->second.kv_map.end())
+					found += !val->second.empty();
+			}
+		}
+	}
+
+	return found;
+}
+
+static void benchmark_load(const char *desc, size_t (*load)(const BenchmarkConfig &config),
+		const BenchmarkConfig &config, size_t lookups)
+{
+	chrono::steady_clock::time_point start;
+	size_t before, found;
+
+	before = allocations;
+	start = chrono::steady_clock::now();
+	found = load(config);
+	chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+
+	printf("  %-16s %10.3fms  %8zu allocations  (%zu of %zu settings found)\n",
+			desc, ms.count(), allocations - before, found, lookups);
+}
+
+static void benchmark()
+{
+	BenchmarkConfig config = benchmark_config();
+	size_t lookups = config.sections.size() * nr_settings;
+
+	printf("%zu sections of %i keys, %zu lookups:\n", config.sections.size(), args.keys, lookups);
+	benchmark_load("wstring keys", old_load, config, lookups);
+	benchmark_load("interned keys", new_load, config, lookups);
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_compare();
+	check_table();
+	check_name_map();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
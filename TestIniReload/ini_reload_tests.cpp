@@ -0,0 +1,563 @@
+// ini_reload_tests.cpp : Checks and benchmarks the change tracking that
+// DirectX11/IniReload.cpp does so that a config reload can keep the custom
+// shaders and resources from sections that have not changed.
+//
+// A random set of mod ini files is "loaded" a few times, changing a little
+// between each load - file contents, section lines, files the sections were
+// built from, and files coming and going - and every section must be reported
+// as unchanged exactly when nothing it was built from changed. The decision
+// whether to keep a custom resource is then run on stand-ins, which must
+// recreate any the command lists assigned to, cleared or bound as an output
+// since they were loaded. Finally a
+// reload of a large config is timed with every section rebuilt, as a reload
+// used to do, against one that keeps everything that did not change.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "IniReload.h"
+#include "CustomResourceKeep.h"
+
+using namespace std;
+
+static struct {
+	int files = 50;
+	int benchmark_files = 200;
+	double compile_ms = 2;
+	double resource_ms = 0.5;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the config reload change tracking, then times a full reload against an incremental one.\n\n");
+
+	printf("  -n, --files N\n");
+	printf("\t\t\tNumber of mod ini files to check with (default 50)\n");
+
+	printf("  --benchmark-files N\n");
+	printf("\t\t\tNumber of mod ini files to benchmark with (default 200)\n");
+
+	printf("  --compile-ms N\n");
+	printf("\t\t\tTime to spend \"compiling\" each custom shader in the benchmark (default 2)\n");
+
+	printf("  --resource-ms N\n");
+	printf("\t\t\tTime to spend \"loading\" each custom resource in the benchmark (default 0.5)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random configs (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--files")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.files = max(atoi(argv[i]), 2);
+			continue;
+		}
+		if (!strcmp(arg, "--benchmark-files")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.benchmark_files = max(atoi(argv[i]), 2);
+			continue;
+		}
+		if (!strcmp(arg, "--compile-ms")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.compile_ms = max(atof(argv[i]), 0.0);
+			continue;
+		}
+		if (!strcmp(arg, "--resource-ms")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.resource_ms = max(atof(argv[i]), 0.0);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+// Stands in for the file system: the stamp of every file a section can be
+// built from. Anything not in here is missing, and stamps as 0:
+static map<wstring, uint64_t> disk;
+
+static uint64_t stamp_file(const wstring &path)
+{
+	auto i = disk.find(path);
+	return i == disk.end() ? 0 : i->second;
+}
+
+struct TestSection {
+	wstring name;
+	vector<wstring> lines;
+	vector<wstring> dependencies;
+	bool failed;  // Failed to build, so forgotten
+	bool changed; // Expected to be rebuilt on the next load
+};
+
+struct TestFile {
+	wstring path;
+	string contents;
+	vector<TestSection> sections;
+	bool loaded;
+	bool changed;
+};
+
+static wstring random_name(const char *prefix, int n)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%s%d_%08x", prefix, n, (unsigned)rng());
+	return wstring(buf, buf + strlen(buf));
+}
+
+static uint32_t fingerprint(const TestSection &section)
+{
+	uint32_t crc = 0;
+
+	for (const wstring &line : section.lines)
+		crc = ini_reload_hash(crc, line);
+	return crc;
+}
+
+static vector<TestFile> random_config(int nr_files, int sections_per_file, size_t file_size)
+{
+	vector<TestFile> files(nr_files);
+	int f, s, l, d;
+
+	for (f = 0; f < nr_files; f++) {
+		TestFile &file = files[f];
+
+		file.path = random_name("Mods\\mod", f) + L".ini";
+		file.contents.resize(file_size);
+		for (char &c : file.contents)
+			c = 'a' + rng() % 26;
+		file.loaded = true;
+		file.changed = true;
+
+		for (s = 0; s < sections_per_file; s++) {
+			TestSection section;
+
+			section.name = random_name(s & 1 ? "resource" : "customshader", f * sections_per_file + s);
+			for (l = rng() % 8; l >= 0; l--)
+				section.lines.push_back(random_name("key = ", l));
+			// Some depend on files that are not there, like the
+			// first place a shader or texture is looked for:
+			for (d = rng() % 4; d > 0; d--) {
+				section.dependencies.push_back(random_name("Mods\\file", d));
+				if (rng() % 4)
+					disk[section.dependencies.back()] = rng() + 1;
+			}
+			section.failed = false;
+			section.changed = true;
+			file.sections.push_back(section);
+		}
+	}
+
+	return files;
+}
+
+// Does what LoadConfigFile() does with the tracker, and checks what it said
+// about each section against what actually changed since the last load:
+static void load(IniReloadTracker *tracker, vector<TestFile> &files, const char *desc)
+{
+	uint32_t expect_changed = 0, expect_files = 0;
+	IniReloadStats stats;
+
+	tracker->begin();
+
+	for (TestFile &file : files) {
+		if (!file.loaded)
+			continue;
+
+		expect_files++;
+		expect_changed += file.changed;
+		if (tracker->add_file(file.path, file.contents.data(), file.contents.size()) != file.changed)
+			report_mismatch("%s: file %S %s", desc, file.path.c_str(),
+					file.changed ? "changed but was not noticed" : "reported changed when it was not");
+		file.changed = false;
+
+		for (TestSection &section : file.sections) {
+			tracker->add_section(section.name, fingerprint(section));
+			if (tracker->unchanged(section.name) == section.changed)
+				report_mismatch("%s: section %S %s", desc, section.name.c_str(),
+						section.changed ? "changed but was not noticed" : "reported changed when it was not");
+			tracker->note_kept(!section.changed);
+
+			if (section.failed) {
+				tracker->forget(section.name);
+				section.changed = true;
+				continue;
+			}
+			for (const wstring &path : section.dependencies)
+				tracker->add_dependency(section.name, path);
+			section.changed = false;
+		}
+	}
+
+	stats = tracker->get_stats();
+	if (stats.files != expect_files || stats.files_changed != expect_changed)
+		report_mismatch("%s: stats say %u of %u files changed, expected %u of %u", desc,
+				stats.files_changed, stats.files, expect_changed, expect_files);
+}
+
+static void check_tracker()
+{
+	vector<TestFile> files = random_config(args.files, 6, 256);
+	IniReloadTracker tracker(stamp_file);
+	IniReloadStats stats;
+	size_t f, s;
+
+	load(&tracker, files, "first load");
+	load(&tracker, files, "nothing changed");
+	stats = tracker.get_stats();
+	if (stats.kept != stats.sections || stats.rebuilt || stats.files_removed)
+		report_mismatch("nothing changed: kept %u of %u sections, %u rebuilt, %u files removed",
+				stats.kept, stats.sections, stats.rebuilt, stats.files_removed);
+
+	// Saving a file without changing anything is not a change, but
+	// changing a comment is - the sections in it are compared separately:
+	files[0].changed = true;
+	files[0].contents[0] ^= 1;
+	load(&tracker, files, "comment changed");
+
+	for (f = 0; f < files.size(); f++) {
+		TestFile &file = files[f];
+		for (s = 0; s < file.sections.size(); s++) {
+			TestSection &section = file.sections[s];
+			switch (rng() % 8) {
+			case 0:
+				// Edited line:
+				if (section.lines.empty())
+					section.lines.push_back(L"new = line");
+				else
+					section.lines.back() += L"1";
+				section.changed = file.changed = true;
+				file.contents[1]++;
+				break;
+			case 1:
+				// Lines reordered, which matters for command lists:
+				if (section.lines.size() < 2 || section.lines[0] == section.lines[1])
+					break;
+				swap(section.lines[0], section.lines[1]);
+				section.changed = file.changed = true;
+				file.contents[2]++;
+				break;
+			case 2:
+				// A file it was built from touched, or appearing
+				// in a place it was looked for first:
+				if (section.dependencies.empty())
+					break;
+				disk[section.dependencies[0]]++;
+				section.changed = true;
+				break;
+			case 3:
+				// Failed to build, so must be rebuilt next time
+				// even though nothing changes:
+				section.failed = true;
+				break;
+			}
+		}
+	}
+	load(&tracker, files, "random changes");
+	for (TestFile &file : files) {
+		for (TestSection &section : file.sections)
+			section.failed = false;
+	}
+	load(&tracker, files, "after failures");
+
+	// Another file defines the same sections when one is removed, e.g.
+	// a mod moved to another folder:
+	files[1].loaded = false;
+	files.push_back(files[1]);
+	files.back().path += L".moved";
+	files.back().loaded = true;
+	files.back().changed = true;
+	load(&tracker, files, "file moved");
+	stats = tracker.get_stats();
+	if (stats.files_removed != 1)
+		report_mismatch("file moved: %u files removed, expected 1", stats.files_removed);
+
+	// Sections that went away and came back must not count as unchanged,
+	// since what was built from them was thrown away in between:
+	files.back().loaded = false;
+	load(&tracker, files, "file removed");
+	files.back().loaded = true;
+	files.back().changed = true;
+	for (TestSection &section : files.back().sections)
+		section.changed = true;
+	load(&tracker, files, "file restored");
+}
+
+// Stands in for CustomResource, with ints for the D3D objects:
+struct StandInResource {
+	int *resource = nullptr;
+	int *view = nullptr;
+	int *device = nullptr;
+	int *substantiated_resource = nullptr;
+	bool is_null = true;
+	bool substantiated = false;
+	bool dirty = false;
+	unsigned bind_flags = 0;
+	unsigned misc_flags = 0;
+	unsigned stride = 0;
+	unsigned offset = 0;
+	unsigned buf_size = 0;
+	int format = 0;
+	wstring filename;
+	void *initial_data = nullptr;
+};
+
+static vector<unique_ptr<int>> stand_in_objects;
+
+static int* new_stand_in_object()
+{
+	stand_in_objects.emplace_back(new int((int)stand_in_objects.size()));
+	return stand_in_objects.back().get();
+}
+
+// CustomResource::Substantiate() loading it from its file
+static void substantiate(StandInResource *resource)
+{
+	if (resource->substantiated)
+		return;
+	resource->substantiated = true;
+	if (resource->resource || resource->view)
+		return;
+
+	resource->resource = new_stand_in_object();
+	resource->is_null = false;
+	resource->substantiated_resource = resource->resource;
+}
+
+enum class ResourceUse {
+	NONE,
+	ASSIGNED,     // ResourceCopyTarget::SetResource()
+	SET_NULL,     // ResourceCopyTarget::SetResource() with nothing
+	OUTPUT,       // ResourceCopyOperation binding it as an RTV or UAV
+	CLEARED,      // ClearViewCommand
+	TRANSFERRED,  // CustomResource::expire() moving it to a new device
+	NEW_BIND_FLAG,// The reloaded config binds it in a new way
+	NO_FILE,      // Neither a file nor initial data, so not worth keeping
+	COUNT,
+};
+
+static const char *resource_use_names[] = {
+	"untouched", "assigned", "set to null", "bound as an output", "cleared",
+	"transferred", "given a new bind flag", "not loaded from a file",
+};
+
+// Loads a resource, uses it as a command list might, then reloads an
+// unchanged config as KeepUnchangedCustomResources() does. Returns whether
+// the resource was kept, after checking it is loaded either way.
+static bool reload_resource(StandInResource *previous, ResourceUse use, StandInResource *resource)
+{
+	int *loaded;
+
+	previous->filename = use == ResourceUse::NO_FILE ? L"" : L"Mods\\texture.dds";
+	previous->bind_flags = 1;
+	substantiate(previous);
+	loaded = previous->resource;
+
+	switch (use) {
+	case ResourceUse::ASSIGNED:
+		previous->dirty = true;
+		previous->resource = new_stand_in_object();
+		break;
+	case ResourceUse::SET_NULL:
+		previous->dirty = true;
+		previous->is_null = true;
+		break;
+	case ResourceUse::OUTPUT:
+	case ResourceUse::CLEARED:
+		previous->dirty = true;
+		break;
+	case ResourceUse::TRANSFERRED:
+		previous->resource = new_stand_in_object();
+		break;
+	default:
+		break;
+	}
+
+	resource->filename = previous->filename;
+	resource->bind_flags = use == ResourceUse::NEW_BIND_FLAG ? 3 : 1;
+	if (keep_substantiated_resource(resource, previous)) {
+		if (resource->resource != loaded || resource->is_null || resource->dirty)
+			report_mismatch("kept %s resource is not the one that was loaded", resource_use_names[(int)use]);
+		return true;
+	}
+
+	substantiate(resource);
+	if (!resource->resource || resource->resource == loaded || resource->is_null)
+		report_mismatch("%s resource was not recreated", resource_use_names[(int)use]);
+	return false;
+}
+
+static void check_keep_resources()
+{
+	int use;
+
+	for (use = 0; use < (int)ResourceUse::COUNT; use++) {
+		StandInResource previous, resource, reloaded, assigned;
+		bool kept = reload_resource(&previous, (ResourceUse)use, &resource);
+
+		if (kept != ((ResourceUse)use == ResourceUse::NONE))
+			report_mismatch("%s resource was %s on reload", resource_use_names[use], kept ? "kept" : "recreated");
+
+		// Whether kept or recreated, it is as good as loaded for the
+		// reload after, until it is touched again:
+		if (!reload_resource(&resource, ResourceUse::NONE, &reloaded))
+			report_mismatch("%s resource was recreated on the second reload", resource_use_names[use]);
+		if (reload_resource(&reloaded, ResourceUse::ASSIGNED, &assigned))
+			report_mismatch("%s resource was kept after it was assigned to", resource_use_names[use]);
+	}
+}
+
+static void spin_for(double ms)
+{
+	chrono::steady_clock::time_point end = chrono::steady_clock::now()
+		+ chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(ms));
+
+	while (chrono::steady_clock::now() < end)
+		;
+}
+
+// A reload as LoadConfigFile() does it, building everything that can't be
+// kept. Returns the number of sections rebuilt:
+static int reload(IniReloadTracker *tracker, vector<TestFile> &files, bool incremental)
+{
+	int rebuilt = 0;
+
+	tracker->begin();
+	for (TestFile &file : files) {
+		tracker->add_file(file.path, file.contents.data(), file.contents.size());
+		for (TestSection &section : file.sections) {
+			tracker->add_section(section.name, fingerprint(section));
+			if (!incremental || !tracker->unchanged(section.name)) {
+				spin_for(section.name[0] == L'c' ? args.compile_ms : args.resource_ms);
+				rebuilt++;
+			}
+			for (const wstring &path : section.dependencies)
+				tracker->add_dependency(section.name, path);
+		}
+	}
+
+	return rebuilt;
+}
+
+static void benchmark()
+{
+	vector<TestFile> files = random_config(args.benchmark_files, 8, 16384);
+	IniReloadTracker tracker(stamp_file);
+	size_t bytes = 0, sections = 0;
+	int rebuilt;
+
+	for (TestFile &file : files) {
+		bytes += file.contents.size();
+		sections += file.sections.size();
+	}
+
+	reload(&tracker, files, false);
+	printf("%zu ini files, %.1f MB, %zu custom shaders and resources:\n",
+			files.size(), bytes / 1048576.0, sections);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	rebuilt = reload(&tracker, files, false);
+	chrono::duration<double, milli> full_ms = chrono::steady_clock::now() - start;
+	printf("  full reload          %10.3fms  (%i rebuilt)\n", full_ms.count(), rebuilt);
+
+	start = chrono::steady_clock::now();
+	rebuilt = reload(&tracker, files, true);
+	chrono::duration<double, milli> none_ms = chrono::steady_clock::now() - start;
+	printf("  nothing changed      %10.3fms  (%i rebuilt)\n", none_ms.count(), rebuilt);
+
+	// Editing one section in one mod is the usual reason to press F10:
+	files[files.size() / 2].sections[0].lines.push_back(L"edited = 1");
+	files[files.size() / 2].contents[0] ^= 1;
+	start = chrono::steady_clock::now();
+	rebuilt = reload(&tracker, files, true);
+	chrono::duration<double, milli> one_ms = chrono::steady_clock::now() - start;
+	printf("  one section edited   %10.3fms  (%i rebuilt)\n", one_ms.count(), rebuilt);
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_tracker();
+	check_keep_resources();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,749 @@
+// ini_tokenizer_tests.cpp : Fuzzes and benchmarks the memory mapped ini
+// tokeniser (DirectX11/IniTokenizer.cpp).
+//
+// The ini files given on the command line (or found in the directories
+// given), thousands of random mutations of them, and random files are each
+// split by the tokeniser and by the parser it replaced - a text mode ifstream
+// read, the std::getline loop ParseIniStream used, each line widened a byte
+// at a time to a wstring and trimmed with substr. Every line, key and value
+// must widen to the same wstring as before, except that valid UTF-8 is now
+// decoded, which is checked against a separate decoder written from the
+// table of well formed byte sequences in the Unicode standard. The tokens
+// must be views into the file itself. The benchmark times reading the files
+// into the key, value and raw line strings the parser keeps, the old way and
+// the new.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "IniTokenizer.h"
+
+using namespace std;
+
+static struct {
+	int mutations = 500;
+	int random = 2000;
+	int repeat = 200;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+	vector<const char*> paths;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]... [FILE|DIRECTORY]...\n\n", argv0);
+	printf("Checks the ini tokeniser against the parser it replaced on the given ini files\n");
+	printf("(and any found in the given directories), random mutations of them and random\n");
+	printf("files, then times tokenising the given files both ways.\n\n");
+
+	printf("  -m, --mutations N\n");
+	printf("\t\t\tNumber of mutations of each ini file to check (default 500)\n");
+
+	printf("  -n, --random N\n");
+	printf("\t\t\tNumber of random ini files to check (default 2000)\n");
+
+	printf("  -r, --repeat N\n");
+	printf("\t\t\tNumber of passes over the ini files to time (default 200)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the mutations and random files (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-m") || !strcmp(arg, "--mutations")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.mutations = max(atoi(argv[i]), 0);
+			continue;
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--random")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.random = max(atoi(argv[i]), 0);
+			continue;
+		}
+		if (!strcmp(arg, "-r") || !strcmp(arg, "--repeat")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.repeat = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		if (arg[0] == '-') {
+			printf("Unrecognised argument: %s\n", arg);
+			PrintHelp(argv[0]); // Does not return
+		}
+		args.paths.push_back(arg);
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+// A line as the old parser produced it, or as the tokeniser's views widen:
+struct WideToken {
+	wstring line;
+	bool section;
+	bool equals;
+	wstring key;
+	wstring val;
+};
+
+// What the MSVC runtime handed the old parser from a file opened in text
+// mode: reading stops at a Ctrl+Z, and a CR followed by a LF is dropped.
+static string text_mode(const string &raw)
+{
+	string ret;
+	size_t i, end;
+
+	end = raw.find('\x1a');
+	if (end == raw.npos)
+		end = raw.size();
+
+	for (i = 0; i < end; i++) {
+		if (raw[i] == '\r' && i + 1 < end && raw[i + 1] == '\n')
+			continue;
+		ret += raw[i];
+	}
+	return ret;
+}
+
+// Trimming and key / val splitting of ParseIniStream and ParseIniKeyValLine,
+// on a line that has already been widened:
+static void reference_line(wstring wline, vector<WideToken> *tokens)
+{
+	size_t first, last, delim;
+
+	first = wline.find_first_not_of(L" \t");
+	last = wline.find_last_not_of(L" \t");
+
+	if (first == wline.npos)
+		return;
+
+	wline = wline.substr(first, last - first + 1);
+
+	if (wline[0] == L';')
+		return;
+
+	WideToken token;
+	token.line = wline;
+	token.section = wline[0] == L'[';
+	token.equals = false;
+	if (!token.section) {
+		delim = wline.find(L"=");
+		if (delim != wline.npos) {
+			token.equals = true;
+			last = wline.find_last_not_of(L" \t", delim - 1);
+			token.key = wline.substr(0, last + 1);
+			first = wline.find_first_not_of(L" \t", delim + 1);
+			if (first != wline.npos)
+				token.val = wline.substr(first);
+		}
+	}
+	tokens->push_back(token);
+}
+
+// The old parser exactly as it was, widening each byte as a char:
+static void legacy_tokenise(const string &raw, vector<WideToken> *tokens)
+{
+	std::istringstream stream(text_mode(raw));
+	string aline;
+
+	while (std::getline(stream, aline))
+		reference_line(wstring(aline.begin(), aline.end()), tokens);
+}
+
+// Decodes one sequence per Table 3-7 of the Unicode standard, "Well-Formed
+// UTF-8 Byte Sequences", returning its length or 0 if it is ill formed:
+static size_t reference_sequence(const unsigned char *p, size_t avail, uint32_t *cp)
+{
+	static const struct {
+		unsigned char lead_lo, lead_hi;
+		unsigned char second_lo, second_hi;
+		size_t len;
+	} table[] = {
+		{ 0xc2, 0xdf, 0x80, 0xbf, 2 },
+		{ 0xe0, 0xe0, 0xa0, 0xbf, 3 },
+		{ 0xe1, 0xec, 0x80, 0xbf, 3 },
+		{ 0xed, 0xed, 0x80, 0x9f, 3 },
+		{ 0xee, 0xef, 0x80, 0xbf, 3 },
+		{ 0xf0, 0xf0, 0x90, 0xbf, 4 },
+		{ 0xf1, 0xf3, 0x80, 0xbf, 4 },
+		{ 0xf4, 0xf4, 0x80, 0x8f, 4 },
+	};
+	size_t i;
+
+	for (auto &row : table) {
+		if (p[0] < row.lead_lo || p[0] > row.lead_hi)
+			continue;
+		if (avail < row.len || p[1] < row.second_lo || p[1] > row.second_hi)
+			return 0;
+		for (i = 2; i < row.len; i++) {
+			if (p[i] < 0x80 || p[i] > 0xbf)
+				return 0;
+		}
+
+		*cp = p[0] & (0xff >> (row.len + 1));
+		for (i = 1; i < row.len; i++)
+			*cp = *cp << 6 | (p[i] & 0x3f);
+		return row.len;
+	}
+	return 0;
+}
+
+static wstring reference_decode(const string &bytes, bool *multibyte)
+{
+	const unsigned char *p = (const unsigned char*)bytes.data();
+	size_t i, len;
+	uint32_t cp;
+	wstring ret;
+
+	for (i = 0; i < bytes.size(); ) {
+		len = p[i] < 0x80 ? 0 : reference_sequence(p + i, bytes.size() - i, &cp);
+		if (!len) {
+			ret += (wchar_t)(char)p[i++];
+			continue;
+		}
+		i += len;
+		*multibyte = true;
+		if (sizeof(wchar_t) == 2 && cp > 0xffff) {
+			ret += (wchar_t)(0xd800 + ((cp - 0x10000) >> 10));
+			ret += (wchar_t)(0xdc00 + ((cp - 0x10000) & 0x3ff));
+		} else {
+			ret += (wchar_t)cp;
+		}
+	}
+	return ret;
+}
+
+// The old parser with valid UTF-8 decoded and a byte order mark skipped.
+// Returns whether there was anything for that to change, i.e. whether the
+// old parser would have come out differently:
+static bool utf8_tokenise(const string &raw, vector<WideToken> *tokens)
+{
+	string contents = text_mode(raw);
+	std::istringstream stream;
+	bool multibyte = false;
+	string aline;
+
+	if (!contents.compare(0, 3, "\xef\xbb\xbf")) {
+		contents.erase(0, 3);
+		multibyte = true;
+	}
+
+	stream.str(contents);
+	while (std::getline(stream, aline))
+		reference_line(reference_decode(aline, &multibyte), tokens);
+
+	return multibyte;
+}
+
+static string printable(const wstring &str)
+{
+	string ret;
+	char buf[16];
+
+	for (wchar_t c : str) {
+		if (c >= 0x20 && c < 0x7f) {
+			ret += (char)c;
+		} else {
+			snprintf(buf, sizeof(buf), "\\x{%x}", (unsigned)c);
+			ret += buf;
+		}
+	}
+	return ret;
+}
+
+static bool in_buffer(IniView view, const char *data, size_t size)
+{
+	return view.data >= data && view.data + view.len <= data + size;
+}
+
+static void check_contents(const string &raw, const char *desc)
+{
+	vector<WideToken> expected, legacy;
+	vector<IniToken> tokens;
+	bool multibyte;
+	wstring str;
+	size_t i;
+
+	tokenise_ini(raw.data(), raw.size(), &tokens);
+	multibyte = utf8_tokenise(raw, &expected);
+
+	if (tokens.size() != expected.size()) {
+		report_mismatch("%s: %zu tokens, expected %zu", desc, tokens.size(), expected.size());
+		return;
+	}
+
+	for (i = 0; i < tokens.size(); i++) {
+		IniToken &token = tokens[i];
+		WideToken &wide = expected[i];
+
+		if (!in_buffer(token.line, raw.data(), raw.size())
+				|| !in_buffer(token.key, raw.data(), raw.size())
+				|| !in_buffer(token.val, raw.data(), raw.size())) {
+			report_mismatch("%s: token %zu is not a view of the file", desc, i);
+			return;
+		}
+
+		ini_assign(token.line, &str);
+		if (str != wide.line) {
+			report_mismatch("%s: line %zu is \"%s\", expected \"%s\"", desc, i,
+					printable(str).c_str(), printable(wide.line).c_str());
+			return;
+		}
+		if (token.section != wide.section || token.equals != wide.equals) {
+			report_mismatch("%s: line %zu \"%s\" section %i equals %i, expected %i %i", desc, i,
+					printable(str).c_str(), token.section, token.equals, wide.section, wide.equals);
+			return;
+		}
+		ini_assign(token.key, &str);
+		if (str != wide.key) {
+			report_mismatch("%s: key %zu is \"%s\", expected \"%s\"", desc, i,
+					printable(str).c_str(), printable(wide.key).c_str());
+			return;
+		}
+		ini_assign(token.val, &str);
+		if (str != wide.val) {
+			report_mismatch("%s: val %zu is \"%s\", expected \"%s\"", desc, i,
+					printable(str).c_str(), printable(wide.val).c_str());
+			return;
+		}
+	}
+
+	// Anything without UTF-8 in it must come out exactly as it always did:
+	if (!multibyte) {
+		legacy_tokenise(raw, &legacy);
+		if (legacy.size() != expected.size()) {
+			report_mismatch("%s: reference decoder disagrees with the old parser", desc);
+			return;
+		}
+		for (i = 0; i < legacy.size(); i++) {
+			if (legacy[i].line != expected[i].line || legacy[i].key != expected[i].key
+					|| legacy[i].val != expected[i].val) {
+				report_mismatch("%s: reference decoder disagrees with the old parser on line %zu", desc, i);
+				return;
+			}
+		}
+	}
+}
+
+static const char *fixed_cases[] = {
+	"", "\n", "\r\n", "\r", "\r\r\n", "\n\r", "a", "a\r", "a\r\n", "[a]", " ;", "=", " = ", "==",
+	"=a", "= a", "a=", "a =", "a=b=c", "\t[ a ] \t\n\tb\t=\tc\t", "a \r\n b",
+	"a\x1a" "b\n[c]", "\x1a", "[a]\n\r\x1a\nb=c",
+	"\xef\xbb\xbf", "\xef\xbb\xbf[Constants]\r\nx=1", "\xef\xbb\xbf\xef\xbb\xbf a", " \xef\xbb\xbf a",
+	"a=\xc3\xa9t\xc3\xa9", "\xe2\x82\xac=\xf0\x9f\x98\x80", "[\xe6\x97\xa5\xe6\x9c\xac]",
+	"a=\xe9t\xe9", "a=\xc3", "a=\xc3=b", "\xc0\x80", "\xc1\xbf", "\xe0\x80\x80", "\xe0\x9f\xbf",
+	"\xed\xa0\x80", "\xed\x9f\xbf", "\xf0\x8f\xbf\xbf", "\xf4\x90\x80\x80", "\xf4\x8f\xbf\xbf",
+	"\xf5\x80\x80\x80", "\xff\xfe", "\x80\xbf", "\xe2\x82", "\xe2\x82\n\xac",
+	"condition=\xe2\x80\x8b", "a\xc2\xa0=\xc2\xa0" "b",
+};
+
+static void check_fixed()
+{
+	char desc[32];
+	size_t i;
+
+	for (i = 0; i < sizeof(fixed_cases) / sizeof(fixed_cases[0]); i++) {
+		snprintf(desc, sizeof(desc), "fixed %zu", i);
+		check_contents(fixed_cases[i], desc);
+	}
+}
+
+// Bits and pieces the mutations are made of, chosen for the ways they could
+// trip up the tokeniser:
+static string random_fragment()
+{
+	static const char *fragments[] = {
+		"\n", "\r", "\r\n", "\x1a", " ", "\t", ";", "=", "[", "]", " = ", "\xef\xbb\xbf",
+		"\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xc3", "\xe2\x82", "\xf0\x9f\x98",
+		"\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\x80", "\xbf", "\xff",
+	};
+	uint32_t cp;
+	string ret;
+
+	switch (rng() % 4) {
+	case 0:
+		// Any byte at all:
+		return string(1, (char)(rng() % 256));
+	case 1:
+		// Any code point at all, including the invalid ones:
+		cp = rng() % 0x110000;
+		if (cp < 0x80)
+			return string(1, (char)cp);
+		if (cp < 0x800)
+			return { (char)(0xc0 | cp >> 6), (char)(0x80 | (cp & 0x3f)) };
+		if (cp < 0x10000) {
+			return { (char)(0xe0 | cp >> 12), (char)(0x80 | (cp >> 6 & 0x3f)),
+				(char)(0x80 | (cp & 0x3f)) };
+		}
+		return { (char)(0xf0 | cp >> 18), (char)(0x80 | (cp >> 12 & 0x3f)),
+			(char)(0x80 | (cp >> 6 & 0x3f)), (char)(0x80 | (cp & 0x3f)) };
+	default:
+		return fragments[rng() % (sizeof(fragments) / sizeof(fragments[0]))];
+	}
+}
+
+static string mutate(string contents)
+{
+	size_t pos, len, next;
+	int n = 1 + rng() % 8;
+
+	while (n--) {
+		pos = contents.empty() ? 0 : rng() % (contents.size() + 1);
+		switch (rng() % 6) {
+		case 0:
+			contents.insert(pos, random_fragment());
+			break;
+		case 1:
+			if (pos < contents.size())
+				contents[pos] = random_fragment()[0];
+			break;
+		case 2:
+			len = rng() % 64;
+			contents.erase(pos, len);
+			break;
+		case 3:
+			// Duplicate a line somewhere else:
+			next = contents.find('\n', pos);
+			if (next == contents.npos)
+				break;
+			contents.insert(rng() % (contents.size() + 1), contents.substr(pos, next - pos + 1));
+			break;
+		case 4:
+			// Saved with Windows line endings:
+			for (pos = 0; (pos = contents.find('\n', pos)) != contents.npos; pos += 2)
+				contents.insert(pos, "\r");
+			break;
+		default:
+			if (pos == 0)
+				contents.insert(0, "\xef\xbb\xbf");
+			else
+				contents.insert(pos, random_fragment() + random_fragment());
+			break;
+		}
+	}
+	return contents;
+}
+
+static string random_contents()
+{
+	static const char *pieces[] = {
+		"[Section]", "[TextureOverride\xc3\xa9]", "key", "Cl\xc3\xa9", "\xe6\x97\xa5\xe6\x9c\xac",
+		"\xf0\x9f\x98\x80", "=", " = ", "value", ";", "\t", " ", "\n", "\r\n", "\r",
+	};
+	string ret;
+	int n = rng() % 64;
+
+	while (n--) {
+		if (rng() % 8 == 0)
+			ret += random_fragment();
+		else
+			ret += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+	}
+	return ret;
+}
+
+static bool read_file(const string &path, string *contents)
+{
+	ifstream f(path, ios::in | ios::binary);
+	if (!f)
+		return false;
+
+	contents->assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+	return true;
+}
+
+static bool is_ini(const string &name)
+{
+	return name.size() >= 4 && !strcasecmp(name.c_str() + name.size() - 4, ".ini");
+}
+
+static void find_ini_files(const string &path, vector<string> *files)
+{
+	vector<string> entries;
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path.c_str(), &st))
+		return;
+	if (!S_ISDIR(st.st_mode)) {
+		files->push_back(path);
+		return;
+	}
+
+	dir = opendir(path.c_str());
+	if (!dir)
+		return;
+	while ((entry = readdir(dir))) {
+		if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+			entries.push_back(entry->d_name);
+	}
+	closedir(dir);
+
+	sort(entries.begin(), entries.end());
+	for (string &name : entries) {
+		string child = path + "/" + name;
+		if (!stat(child.c_str(), &st) && (S_ISDIR(st.st_mode) || is_ini(name)))
+			find_ini_files(child, files);
+	}
+}
+
+static void check_files(const vector<string> &files, const vector<string> &contents)
+{
+	string desc;
+	size_t i;
+	int n;
+
+	for (i = 0; i < files.size(); i++) {
+		check_contents(contents[i], files[i].c_str());
+		for (n = 0; n < args.mutations; n++) {
+			desc = files[i] + " mutation " + to_string(n);
+			check_contents(mutate(contents[i]), desc.c_str());
+		}
+	}
+}
+
+static void check_random()
+{
+	string desc;
+	int i;
+
+	for (i = 0; i < args.random; i++) {
+		desc = "random " + to_string(i);
+		check_contents(random_contents(), desc.c_str());
+	}
+}
+
+static void check_view_equals()
+{
+	static const struct {
+		const char *view;
+		const char *ascii;
+		bool equal;
+	} cases[] = {
+		{ "condition", "condition", true },
+		{ "Condition", "condition", true },
+		{ "CONDITION", "condition", true },
+		{ "namespace", "condition", false },
+		{ "conditio", "condition", false },
+		{ "conditions", "condition", false },
+		{ "", "", true },
+		{ "", "a", false },
+		{ "condit\xc4\xb1on", "condition", false },
+		{ "condit\xc3\xafon", "condition", false },
+		{ "[", "{", false },
+		{ "@", "`", false },
+	};
+
+	for (auto &c : cases) {
+		if (ini_view_equals(IniView{c.view, strlen(c.view)}, c.ascii) != c.equal)
+			report_mismatch("ini_view_equals(\"%s\", \"%s\") != %i", c.view, c.ascii, c.equal);
+	}
+}
+
+// Maps a few files through the real map_ini_file(), which on Linux uses
+// mmap, to check it hands back exactly what was written:
+static void check_map_file()
+{
+	static const char *contents[] = { "", "a", "[Constants]\r\nx = 1\r\n" };
+	char dir_template[] = "/tmp/ini_tokenizer_tests.XXXXXX";
+	shared_ptr<IniFileBuffer> buffer;
+	string dir, path;
+
+	if (!mkdtemp(dir_template)) {
+		report_mismatch("Unable to create a temporary directory");
+		return;
+	}
+	dir = dir_template;
+	path = dir + "/test.ini";
+
+	for (const char *text : contents) {
+		ofstream(path, ios::binary) << text;
+		buffer.reset();
+		if (!map_ini_file(wstring(path.begin(), path.end()), &buffer) || !buffer) {
+			report_mismatch("map_ini_file failed on %zu bytes", strlen(text));
+			continue;
+		}
+		if (buffer->size() != strlen(text) || memcmp(buffer->data(), text, buffer->size()))
+			report_mismatch("map_ini_file returned the wrong %zu bytes", buffer->size());
+	}
+	unlink(path.c_str());
+
+	if (map_ini_file(wstring(path.begin(), path.end()), &buffer))
+		report_mismatch("map_ini_file opened a missing file");
+
+	rmdir(dir.c_str());
+}
+
+// What the parser keeps of each line that has an = sign:
+struct Stored {
+	wstring key;
+	wstring val;
+	wstring line;
+};
+
+static size_t legacy_load(const string &path, vector<Stored> *stored)
+{
+	vector<WideToken> tokens;
+	string contents;
+
+	read_file(path, &contents);
+	legacy_tokenise(contents, &tokens);
+	for (WideToken &token : tokens) {
+		if (token.equals)
+			stored->push_back(Stored{token.key, token.val, token.line});
+	}
+	return tokens.size();
+}
+
+static size_t mapped_load(const string &path, vector<Stored> *stored)
+{
+	shared_ptr<IniFileBuffer> buffer;
+	vector<IniToken> tokens;
+
+	map_ini_file(wstring(path.begin(), path.end()), &buffer);
+	tokenise_ini(buffer->data(), buffer->size(), &tokens);
+	for (IniToken &token : tokens) {
+		if (!token.equals)
+			continue;
+		stored->emplace_back();
+		ini_widen(token.key, &stored->back().key);
+		ini_widen(token.val, &stored->back().val);
+		ini_widen(token.line, &stored->back().line);
+	}
+	return tokens.size();
+}
+
+static void benchmark(const vector<string> &files, size_t bytes)
+{
+	static const struct {
+		const char *desc;
+		size_t (*load)(const string &path, vector<Stored> *stored);
+	} loaders[] = {
+		{ "getline", legacy_load },
+		{ "mapped", mapped_load },
+	};
+	size_t tokens;
+	int pass;
+
+	printf("%zu ini files, %.1f KB, %i passes:\n", files.size(), bytes / 1024.0, args.repeat);
+
+	for (auto &loader : loaders) {
+		vector<Stored> stored;
+		tokens = 0;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (pass = 0; pass < args.repeat; pass++) {
+			stored.clear();
+			for (const string &path : files)
+				tokens += loader.load(path, &stored);
+		}
+		chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+
+		printf("  %-8s %10.3fms  %8.1f MB/s  (%zu lines)\n", loader.desc, ms.count(),
+				bytes * args.repeat / 1048576.0 / (ms.count() / 1000.0), tokens);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> files, contents;
+	size_t bytes = 0;
+	string text;
+
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	for (const char *path : args.paths)
+		find_ini_files(path, &files);
+	for (string &path : files) {
+		if (!read_file(path, &text)) {
+			printf("Unable to read %s\n", path.c_str());
+			return EXIT_FAILURE;
+		}
+		contents.push_back(text);
+		bytes += text.size();
+	}
+
+	check_fixed();
+	check_view_equals();
+	check_map_file();
+	check_files(files, contents);
+	check_random();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed on %zu ini files\n", files.size());
+
+	if (args.benchmark && !files.empty())
+		benchmark(files, bytes);
+
+	return EXIT_SUCCESS;
+}
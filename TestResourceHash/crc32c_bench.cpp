@@ -0,0 +1,320 @@
+// crc32c_bench.cpp : Checks and benchmarks the crc32c implementations that
+// resource hashing goes through (crc32c_hw() in util.h).
+//
+// Every [TextureOverride] hash in the wild was computed by the original
+// SSE 4.2 code, so every implementation the CPU supports is checked bit for
+// bit against the table driven fallback over every length up to a few
+// hundred bytes at every alignment, random lengths that straddle the block
+// sizes of the folding loops, random initial CRCs, and buffers split into
+// several appends or combined from independently hashed pieces. Then the
+// throughput of each implementation is measured across a range of buffer
+// sizes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "crc32c.h"
+
+using namespace std;
+
+static struct {
+	vector<size_t> sizes;
+	int iterations = 20000;
+	int time_ms = 200;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks that every crc32c implementation supported by this CPU gives identical\n");
+	printf("results, then measures their throughput across a range of buffer sizes.\n\n");
+
+	printf("  -s, --size N\n");
+	printf("\t\t\tBenchmark buffers of N bytes, may be specified multiple times.\n");
+	printf("\t\t\tAccepts K and M suffixes (default 64 to 16M in powers of 4)\n");
+
+	printf("  -n, --iterations N\n");
+	printf("\t\t\tNumber of random buffers to check (default 20000)\n");
+
+	printf("  -t, --time MS\n");
+	printf("\t\t\tTime each implementation for MS milliseconds per size (default 200)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random buffers (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly check the implementations against each other\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static size_t parse_size(const char *str)
+{
+	char *end;
+	size_t size = strtoul(str, &end, 0);
+
+	if (*end == 'k' || *end == 'K')
+		size *= 1024;
+	else if (*end == 'm' || *end == 'M')
+		size *= 1024 * 1024;
+	return size;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-s") || !strcmp(arg, "--size")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.sizes.push_back(max(parse_size(argv[i]), (size_t)1));
+			continue;
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--iterations")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.iterations = max(atoi(argv[i]), 0);
+			continue;
+		}
+		if (!strcmp(arg, "-t") || !strcmp(arg, "--time")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.time_ms = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+
+	if (args.sizes.empty()) {
+		for (size_t size = 64; size <= 16 * 1024 * 1024; size *= 4)
+			args.sizes.push_back(size);
+	}
+}
+
+static mt19937 rng;
+static const crc32c_implementation *implementations;
+static size_t num_implementations;
+static const crc32c_implementation *reference;
+static size_t mismatches;
+
+static const crc32c_implementation* find_implementation(const char *name)
+{
+	for (size_t i = 0; i < num_implementations; i++) {
+		if (!strcmp(implementations[i].name, name))
+			return &implementations[i];
+	}
+	return NULL;
+}
+
+static void mismatch(const char *name, uint32_t crc, size_t offset, size_t length, uint32_t expected, uint32_t got)
+{
+	mismatches++;
+	if (mismatches == 1 || args.verbose) {
+		printf("MISMATCH %s: crc 0x%08x, offset %zu, length %zu: expected 0x%08x, got 0x%08x\n",
+				name, crc, offset, length, expected, got);
+	}
+}
+
+static void check(const uint8_t *buf, uint32_t crc, size_t offset, size_t length)
+{
+	uint32_t expected = reference->append(crc, buf + offset, length);
+	uint32_t got;
+	size_t i;
+
+	for (i = 0; i < num_implementations; i++) {
+		if (!implementations[i].append || &implementations[i] == reference)
+			continue;
+		// The bitwise implementation is far too slow to run over
+		// everything, but is the ground truth for the short lengths:
+		if (!strcmp(implementations[i].name, "trivial") && length > 1024)
+			continue;
+		got = implementations[i].append(crc, buf + offset, length);
+		if (got != expected)
+			mismatch(implementations[i].name, crc, offset, length, expected, got);
+	}
+
+	got = crc32c_append(crc, buf + offset, length);
+	if (got != expected)
+		mismatch("crc32c_append", crc, offset, length, expected, got);
+}
+
+// Hashing a buffer in several pieces must be the same as hashing it in one,
+// as hash_tex2d_data() and friends append one row or subresource at a time,
+// and the same again if the pieces are hashed independently and combined:
+static void check_split(const uint8_t *buf, uint32_t crc, size_t offset, size_t length)
+{
+	uint32_t expected = reference->append(crc, buf + offset, length);
+	uint32_t got = crc, combined = crc;
+	size_t pos = 0, piece;
+
+	while (pos < length) {
+		piece = uniform_int_distribution<size_t>(1, length - pos)(rng);
+		got = crc32c_append(got, buf + offset + pos, piece);
+		combined = crc32c_combine(combined, crc32c_append(0, buf + offset + pos, piece), piece);
+		pos += piece;
+	}
+
+	if (got != expected)
+		mismatch("crc32c_append (split)", crc, offset, length, expected, got);
+	if (combined != expected)
+		mismatch("crc32c_combine", crc, offset, length, expected, combined);
+}
+
+static void run_checks()
+{
+	vector<uint8_t> buf(4 * 1024 * 1024 + 64);
+	uniform_int_distribution<size_t> length_dist(0, 64 * 1024);
+	uniform_int_distribution<size_t> big_length_dist(0, 4 * 1024 * 1024);
+	uniform_int_distribution<size_t> offset_dist(0, 63);
+	uniform_int_distribution<uint32_t> crc_dist;
+	size_t length, offset;
+	int i;
+
+	for (uint8_t &b : buf)
+		b = (uint8_t)rng();
+
+	// Standard check value for CRC-32C
+	if (crc32c_append(0, (const uint8_t*)"123456789", 9) != 0xe3069283)
+		mismatch("crc32c_append", 0, 0, 9, 0xe3069283, crc32c_append(0, (const uint8_t*)"123456789", 9));
+
+	for (length = 0; length <= 512; length++) {
+		for (offset = 0; offset < 16; offset++)
+			check(buf.data(), crc_dist(rng), offset, length);
+	}
+
+	for (i = 0; i < args.iterations; i++) {
+		if (i % 100 == 0)
+			length = big_length_dist(rng);
+		else
+			length = length_dist(rng);
+		offset = offset_dist(rng);
+		check(buf.data(), crc_dist(rng), offset, length);
+		if (i % 10 == 0)
+			check_split(buf.data(), crc_dist(rng), offset, length);
+	}
+}
+
+static void run_benchmark()
+{
+	size_t max_size = *max_element(args.sizes.begin(), args.sizes.end());
+	vector<uint8_t> buf(max_size);
+	const crc32c_implementation *hw = find_implementation("hw");
+	size_t i;
+
+	for (uint8_t &b : buf)
+		b = (uint8_t)rng();
+
+	printf("\n%10s", "size");
+	for (i = 0; i < num_implementations; i++) {
+		if (implementations[i].append)
+			printf(" %14s", implementations[i].name);
+	}
+	printf(" %14s %8s\n", "crc32c_append", "speedup");
+
+	for (size_t size : args.sizes) {
+		double hw_rate = 0, auto_rate = 0;
+
+		printf("%10zu", size);
+		for (i = 0; i <= num_implementations; i++) {
+			uint32_t (*append)(uint32_t, const uint8_t*, size_t) =
+				i < num_implementations ? implementations[i].append : crc32c_append;
+			if (!append)
+				continue;
+
+			// The same buffer is hashed over and over, so this is
+			// the in-cache throughput up until the size exceeds
+			// the last level cache:
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			chrono::steady_clock::time_point end = start + chrono::milliseconds(args.time_ms);
+			chrono::duration<double> elapsed;
+			volatile uint32_t sink = 0;
+			uint32_t crc = 0;
+			size_t bytes = 0;
+			int j;
+			do {
+				for (j = 0; j < 16; j++)
+					crc = append(crc, buf.data(), size);
+				bytes += 16 * size;
+			} while (chrono::steady_clock::now() < end);
+			elapsed = chrono::steady_clock::now() - start;
+			sink = crc;
+			(void)sink;
+
+			double rate = bytes / elapsed.count() / (1024 * 1024);
+			printf(" %9.0f MB/s", rate);
+			if (i < num_implementations && &implementations[i] == hw)
+				hw_rate = rate;
+			if (i == num_implementations)
+				auto_rate = rate;
+		}
+		if (hw_rate)
+			printf(" %7.2fx", auto_rate / hw_rate);
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t i;
+
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	implementations = crc32c_implementations(&num_implementations);
+	reference = find_implementation("table");
+	if (!reference) {
+		printf("FAIL: No table driven implementation to check against\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("Implementations:");
+	for (i = 0; i < num_implementations; i++)
+		printf(" %s%s", implementations[i].name, implementations[i].append ? "" : " (unsupported)");
+	printf("\n");
+
+	run_checks();
+	if (mismatches) {
+		printf("FAIL: %zu hashes differ from the table driven implementation\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("PASS: All supported implementations match\n");
+
+	if (args.benchmark)
+		run_benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,459 @@
+// texture_hash_bench.cpp : Checks and benchmarks the texture hashing engine
+// (DirectX11/TextureHash.cpp) against the serial row by row hashing that
+// hash_tex2d_data() used to do.
+//
+// ResourceHash.cpp can only be built as part of the DirectX11 DLL, so this
+// has stand-ins for CalcTexture2DDataHash(), CalcTexture2DDataHashAccurate()
+// and CalcTexture3DDataHash() that make the same length calculations and
+// choose between the same hashing strategies, with DirectXTK's
+// GetSurfaceInfo() cut down to the handful of formats tested here. Each one
+// is run once with the original serial loop (copied verbatim, allocation of
+// the zero padding and all) and once with the engine, over a range of
+// formats, sizes and row pitches. Any hash that differs fails the run, then
+// the two are timed against each other.
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crc32c.h"
+#include "TextureHash.h"
+
+using namespace std;
+
+static struct {
+	unsigned max_size = 4096;
+	unsigned threads = 0;
+	int repeat = 3;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Compares the parallel texture hashing engine against the serial hashing it\n");
+	printf("replaced, failing if any hash differs, then times the two.\n\n");
+
+	printf("  -s, --max-size N\n");
+	printf("\t\t\tLargest texture width and height to test (default 4096)\n");
+
+	printf("  -j, --threads N\n");
+	printf("\t\t\tSize of the hashing pool to benchmark (default: as in the game)\n");
+
+	printf("  -r, --repeat N\n");
+	printf("\t\t\tTime N passes over each texture (default 3)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the texture contents and row pitches (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly check the hashes, and skip textures over 2048x2048\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every texture checked\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-s") || !strcmp(arg, "--max-size")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.max_size = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-j") || !strcmp(arg, "--threads")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.threads = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-r") || !strcmp(arg, "--repeat")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.repeat = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+
+	if (!args.benchmark)
+		args.max_size = min(args.max_size, 2048u);
+}
+
+// Stand-in for the parts of D3D11_TEXTURE2D/3D_DESC that the hashes use,
+// with the format boiled down to what GetSurfaceInfo() and
+// CompressedFormatBlockSize() would say about it:
+struct Format {
+	const char *name;
+	unsigned bits_per_pixel;
+	unsigned block_size; // Bytes per 4x4 block, 0 if uncompressed
+};
+
+static const Format formats[] = {
+	{ "R8_UNORM",           8, 0 },
+	{ "R8G8B8A8_UNORM",    32, 0 },
+	{ "R16G16B16A16_FLOAT", 64, 0 },
+	{ "R32G32B32A32_FLOAT", 128, 0 },
+	{ "BC1_UNORM",          4, 8 },
+	{ "BC3_UNORM",          8, 16 },
+	{ "BC7_UNORM",          8, 16 },
+};
+
+struct Texture {
+	const Format *format;
+	unsigned width, height, depth;
+	size_t pitch;       // SysMemPitch
+	size_t slice_pitch; // SysMemSlicePitch
+	vector<uint8_t> data;
+};
+
+static void GetSurfaceInfo(unsigned width, unsigned height, const Format *format,
+		size_t *out_num_bytes, size_t *out_row_bytes, size_t *out_num_rows)
+{
+	size_t row_bytes, num_rows;
+
+	if (format->block_size) {
+		row_bytes = max(1u, (width + 3) / 4) * format->block_size;
+		num_rows = max(1u, (height + 3) / 4);
+	} else {
+		row_bytes = ((size_t)width * format->bits_per_pixel + 7) / 8;
+		num_rows = height;
+	}
+
+	*out_num_bytes = row_bytes * num_rows;
+	*out_row_bytes = row_bytes;
+	*out_num_rows = num_rows;
+}
+
+static size_t Texture2DLength(const Texture *tex)
+{
+	unsigned padded_width, padded_height;
+
+	if (!tex->format->block_size)
+		return tex->pitch * tex->height;
+
+	padded_width = (tex->width + 3) & ~0x3;
+	padded_height = (tex->height + 3) & ~0x3;
+
+	return padded_width * padded_height / 16 * tex->format->block_size;
+}
+
+static size_t Texture3DLength(const Texture *tex)
+{
+	unsigned padded_width, padded_height;
+
+	if (!tex->format->block_size)
+		return tex->slice_pitch * tex->depth;
+
+	padded_width = (tex->width + 3) & ~0x3;
+	padded_height = (tex->height + 3) & ~0x3;
+
+	return padded_width * padded_height * tex->depth / 16 * tex->format->block_size;
+}
+
+// The serial implementation from before the engine, verbatim but for the
+// min() macro and calling crc32c_append() directly:
+static uint32_t legacy_hash_tex2d_data(uint32_t hash, const void *data, size_t length,
+		const Texture *tex, bool zero_padding,
+		bool skip_padding, unsigned mapped_row_pitch)
+{
+	size_t row_pitch, slice_pitch, row_count;
+
+	if (!zero_padding && !skip_padding)
+		return crc32c_append(hash, (const uint8_t*)data, length);
+
+	GetSurfaceInfo(tex->width, tex->height, tex->format, &slice_pitch, &row_pitch, &row_count);
+
+	uint8_t *sptr = (uint8_t*)data;
+	size_t msize = min(row_pitch, (size_t)mapped_row_pitch);
+
+	signed padding = (signed)mapped_row_pitch - (signed)row_pitch;
+	uint8_t *zeroes = NULL;
+	if (zero_padding && padding > 0) {
+		zeroes = new uint8_t[padding];
+		memset(zeroes, 0, padding);
+	}
+
+	signed remaining = (signed)length;
+	for (size_t h = 0; h < row_count && remaining > 0; h++) {
+		hash = crc32c_append(hash, sptr, min(msize, (size_t)(unsigned)remaining));
+		sptr += mapped_row_pitch;
+		remaining -= (signed)msize;
+
+		if (zeroes && remaining > 0) {
+			hash = crc32c_append(hash, zeroes, min(padding, remaining));
+			remaining -= padding;
+		}
+	}
+
+	delete [] zeroes;
+	return hash;
+}
+
+// Same as hash_tex2d_data() and hash_texture_data() in ResourceHash.cpp
+static TextureHashPool *pool;
+
+static uint32_t hash_texture_data(uint32_t hash, const TextureHashStream &stream)
+{
+	if (!pool->hash(&hash, stream))
+		return 0;
+	return hash;
+}
+
+static uint32_t engine_hash_tex2d_data(uint32_t hash, const void *data, size_t length,
+		const Texture *tex, bool zero_padding,
+		bool skip_padding, unsigned mapped_row_pitch)
+{
+	size_t row_pitch, slice_pitch, row_count;
+
+	if (!zero_padding && !skip_padding)
+		return hash_texture_data(hash, TextureHashStream::contiguous(data, length));
+
+	GetSurfaceInfo(tex->width, tex->height, tex->format, &slice_pitch, &row_pitch, &row_count);
+
+	return hash_texture_data(hash, TextureHashStream::rows(data, length,
+			row_pitch, row_count, mapped_row_pitch, zero_padding));
+}
+
+typedef uint32_t (*HashTex2DFn)(uint32_t hash, const void *data, size_t length,
+		const Texture *tex, bool zero_padding,
+		bool skip_padding, unsigned mapped_row_pitch);
+
+static uint32_t CalcTexture2DDataHash(const Texture *tex, bool zero_padding, HashTex2DFn hash_tex2d_data)
+{
+	size_t length_v12 = (size_t)tex->width * tex->height;
+	size_t length = Texture2DLength(tex);
+
+	if (length_v12 <= length) {
+		return hash_tex2d_data(0, tex->data.data(), length_v12,
+				tex, zero_padding, false, (unsigned)tex->pitch);
+	}
+
+	return hash_tex2d_data(0, tex->data.data(), length,
+			tex, false, true, (unsigned)tex->pitch);
+}
+
+static uint32_t CalcTexture2DDataHashAccurate(const Texture *tex, HashTex2DFn hash_tex2d_data)
+{
+	return hash_tex2d_data(0, tex->data.data(), INT_MAX,
+			tex, false, true, (unsigned)tex->pitch);
+}
+
+// FrameAnalysis de-duplication hashes with the padding replaced by zeroes
+static uint32_t CalcTexture2DDataHashZeroPadding(const Texture *tex, HashTex2DFn hash_tex2d_data)
+{
+	return hash_tex2d_data(0, tex->data.data(), Texture2DLength(tex),
+			tex, true, false, (unsigned)tex->pitch);
+}
+
+static uint32_t CalcTexture3DDataHash(const Texture *tex, bool engine)
+{
+	size_t length_v12 = (size_t)tex->width * tex->height * tex->depth;
+	size_t length = Texture3DLength(tex);
+
+	if (length_v12 <= length)
+		length = length_v12;
+
+	if (engine)
+		return hash_texture_data(0, TextureHashStream::contiguous(tex->data.data(), length));
+	return crc32c_append(0, tex->data.data(), length);
+}
+
+static mt19937 rng;
+
+static void make_texture(Texture *tex, const Format *format, unsigned width, unsigned height, unsigned depth)
+{
+	size_t num_bytes, row_bytes, num_rows;
+
+	tex->format = format;
+	tex->width = width;
+	tex->height = height;
+	tex->depth = depth;
+
+	GetSurfaceInfo(width, height, format, &num_bytes, &row_bytes, &num_rows);
+
+	// Mostly tightly packed or aligned the way a GPU would, but sometimes
+	// with an odd amount of garbage at the end of each row:
+	switch (rng() % 3) {
+		case 0: tex->pitch = row_bytes; break;
+		case 1: tex->pitch = (row_bytes + 255) & ~(size_t)255; break;
+		case 2: tex->pitch = row_bytes + rng() % 100; break;
+	}
+	tex->slice_pitch = tex->pitch * num_rows;
+
+	// Buffers are sized for the legacy calculations, which can overrun
+	// what D3D would need (that is the reason they were replaced):
+	tex->data.resize(max(tex->slice_pitch * depth, (size_t)width * height * depth) + 16);
+	for (size_t i = 0; i < tex->data.size(); i += 4) {
+		uint32_t r = rng();
+		memcpy(&tex->data[i], &r, min((size_t)4, tex->data.size() - i));
+	}
+}
+
+struct Case {
+	const char *name;
+	uint32_t (*fn)(const Texture *tex, bool engine);
+};
+
+static HashTex2DFn strategy(bool engine)
+{
+	return engine ? engine_hash_tex2d_data : legacy_hash_tex2d_data;
+}
+
+static const Case cases[] = {
+	{ "CalcTexture2DDataHash", [](const Texture *tex, bool engine) {
+		return CalcTexture2DDataHash(tex, false, strategy(engine)); } },
+	{ "CalcTexture2DDataHashAccurate", [](const Texture *tex, bool engine) {
+		return CalcTexture2DDataHashAccurate(tex, strategy(engine)); } },
+	{ "zero padding", [](const Texture *tex, bool engine) {
+		return CalcTexture2DDataHashZeroPadding(tex, strategy(engine)); } },
+	{ "CalcTexture3DDataHash", CalcTexture3DDataHash },
+};
+
+static size_t mismatches;
+
+static void check_texture(const Texture *tex)
+{
+	uint32_t legacy, engine;
+
+	bool is_3d;
+
+	for (const Case &c : cases) {
+		is_3d = !strcmp(c.name, "CalcTexture3DDataHash");
+		if (is_3d != (tex->depth > 1))
+			continue;
+		legacy = c.fn(tex, false);
+		engine = c.fn(tex, true);
+		if (legacy != engine) {
+			mismatches++;
+			printf("MISMATCH %s %s %ux%ux%u pitch %zu: legacy 0x%08x, engine 0x%08x\n",
+					c.name, tex->format->name, tex->width, tex->height, tex->depth,
+					tex->pitch, legacy, engine);
+		} else if (args.verbose) {
+			printf("  %-30s %-20s %5ux%-5u x%-3u pitch %-6zu 0x%08x\n",
+					c.name, tex->format->name, tex->width, tex->height, tex->depth,
+					tex->pitch, engine);
+		}
+	}
+}
+
+static void run_checks()
+{
+	// Odd sizes to land part way through blocks, rows and padding, and
+	// large enough sizes to be split over the pool:
+	static const unsigned sizes[][3] = {
+		{ 1, 1, 1 }, { 3, 5, 1 }, { 64, 64, 1 }, { 333, 77, 1 },
+		{ 1000, 600, 1 }, { 1024, 1024, 1 }, { 1920, 1080, 1 },
+		{ 2048, 2048, 1 }, { 4096, 4096, 1 }, { 8192, 8192, 1 },
+		{ 32, 32, 32 }, { 100, 60, 7 }, { 128, 128, 128 }, { 256, 256, 64 },
+	};
+	Texture tex;
+
+	for (const Format &format : formats) {
+		for (auto &size : sizes) {
+			if (max(size[0], size[1]) > args.max_size)
+				continue;
+			make_texture(&tex, &format, size[0], size[1], size[2]);
+			check_texture(&tex);
+		}
+	}
+}
+
+static void run_benchmark()
+{
+	TextureHashPool *check_pool = pool;
+	Texture tex;
+	unsigned size;
+	int r;
+
+	if (args.threads)
+		pool = new TextureHashPool(args.threads);
+	else
+		pool = TextureHashPool::get();
+
+	printf("\n%-30s %-20s %11s %10s %10s %8s\n", "", "format", "size", "serial", "engine", "speedup");
+	for (size = 1024; size <= args.max_size; size *= 2) {
+		for (const Format &format : formats) {
+			make_texture(&tex, &format, size, size, 1);
+			for (const Case &c : cases) {
+				if (!strcmp(c.name, "CalcTexture3DDataHash"))
+					continue;
+				chrono::duration<double, milli> legacy_ms(0), engine_ms(0);
+				volatile uint32_t sink = 0;
+				for (r = 0; r < args.repeat; r++) {
+					chrono::steady_clock::time_point start = chrono::steady_clock::now();
+					sink = sink + c.fn(&tex, false);
+					chrono::steady_clock::time_point mid = chrono::steady_clock::now();
+					sink = sink + c.fn(&tex, true);
+					chrono::steady_clock::time_point end = chrono::steady_clock::now();
+					legacy_ms += mid - start;
+					engine_ms += end - mid;
+				}
+				printf("%-30s %-20s %5ux%-5u %8.3fms %8.3fms %7.2fx\n",
+						c.name, format.name, size, size,
+						legacy_ms.count() / args.repeat,
+						engine_ms.count() / args.repeat,
+						legacy_ms.count() / engine_ms.count());
+			}
+		}
+	}
+
+	pool = check_pool;
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	// Checked with a fixed size pool so that the blocks are spread over
+	// several threads even on a single core machine:
+	pool = new TextureHashPool(4);
+
+	run_checks();
+	if (mismatches) {
+		printf("FAIL: %zu texture hashes differ between the serial and parallel hashing\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("PASS: All texture hashes match\n");
+
+	if (args.benchmark)
+		run_benchmark();
+
+	return EXIT_SUCCESS;
+}
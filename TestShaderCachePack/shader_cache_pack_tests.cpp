@@ -0,0 +1,727 @@
+// shader_cache_pack_tests.cpp : Checks and benchmarks the pack file that
+// DirectX11/ShaderCachePack.cpp keeps cached ShaderRegex results in.
+//
+// Random records are stored, then looked up again both from the same
+// instance and after reopening the pack, as the next session would. The pack
+// is then damaged the ways a crash or a bad disk would - cut off part way
+// through the last record, or with a byte flipped inside one - and must lose
+// only the damaged record. Compaction must drop exactly the records it is
+// told to and the ones that have been replaced, and the converter must carry
+// the old _regex.dat and _regex.bin files over byte for byte.
+//
+// The benchmark writes a ShaderCache in the old layout with one or two files
+// per shader, converts it, and compares reading every cached result back
+// from the files against opening the pack and looking them all up - both
+// with the files already in the page cache, and with them dropped from it
+// as they would be on the first start up after a reboot.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ShaderCachePack.h"
+#include "ShaderIndex.h"
+
+using namespace std;
+
+static struct {
+	string path = "shader_cache_pack_tests.pack";
+	string dir = "shader_cache_pack_tests.dir";
+	int records = 500;
+	int benchmark_shaders = 20000;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the shader cache pack file, then compares start up with it against\n");
+	printf("the old layout of one file per cached shader.\n\n");
+
+	printf("  --file PATH\n");
+	printf("\t\t\tScratch pack file to use (default shader_cache_pack_tests.pack)\n");
+
+	printf("  --dir PATH\n");
+	printf("\t\t\tScratch directory for the old layout (default shader_cache_pack_tests.dir)\n");
+
+	printf("  -n, --records N\n");
+	printf("\t\t\tNumber of records to check with (default 500)\n");
+
+	printf("  --benchmark-shaders N\n");
+	printf("\t\t\tNumber of cached shaders to benchmark with (default 20000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random records (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "--file")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.path = argv[i];
+			continue;
+		}
+		if (!strcmp(arg, "--dir")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.dir = argv[i];
+			continue;
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--records")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.records = max(atoi(argv[i]), 4);
+			continue;
+		}
+		if (!strcmp(arg, "--benchmark-shaders")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.benchmark_shaders = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static wstring widen(const string &str)
+{
+	return wstring(str.begin(), str.end());
+}
+
+static const wchar_t *shader_types[] = { L"vs", L"hs", L"ds", L"gs", L"ps", L"cs" };
+
+struct TestRecord {
+	ShaderCacheKey key;
+	uint32_t tag;
+	vector<uint8_t> data;
+};
+
+static ShaderCacheKey random_key()
+{
+	const wchar_t *type = shader_types[rng() % 6];
+	ShaderCacheKey key;
+
+	key.hash = ((uint64_t)rng() << 32) | rng();
+	key.type = shader_index_type(type, 2);
+	key.kind = ShaderCacheKind::REGEX;
+	return key;
+}
+
+static vector<uint8_t> random_bytes(size_t max_len)
+{
+	vector<uint8_t> bytes(rng() % max_len);
+
+	for (uint8_t &b : bytes)
+		b = (uint8_t)rng();
+	return bytes;
+}
+
+// Mostly distinct shaders, with a few that differ only in their type so that
+// is shown to be part of the key:
+static vector<TestRecord> random_records(int count, size_t max_len)
+{
+	vector<TestRecord> records(count);
+	bool paired = false;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		TestRecord &r = records[i];
+		r.key = random_key();
+		paired = i && !paired && rng() % 8 == 0;
+		if (paired) {
+			r.key.hash = records[i - 1].key.hash;
+			r.key.type = records[i - 1].key.type ^ 0x0100;
+		}
+		r.tag = rng() % 2 ? 0x12345678 : rng();
+		r.data = random_bytes(max_len);
+	}
+
+	return records;
+}
+
+static void check_lookup(const char *step, ShaderCachePack *pack, const TestRecord &r, bool expect_hit)
+{
+	vector<uint8_t> found;
+	uint32_t tag = 0;
+	bool hit = pack->lookup(r.key, &tag, &found);
+
+	if (hit != expect_hit) {
+		report_mismatch("%s: %016llx %s", step, (unsigned long long)r.key.hash,
+				hit ? "found when it should not be" : "not found");
+		return;
+	}
+	if (hit && (tag != r.tag || found != r.data))
+		report_mismatch("%s: %016llx came back different", step, (unsigned long long)r.key.hash);
+}
+
+static void check_all(const char *step, ShaderCachePack *pack, const vector<TestRecord> &records, bool expect_hit = true)
+{
+	for (const TestRecord &r : records)
+		check_lookup(step, pack, r, expect_hit);
+}
+
+static void check_stats(const char *step, ShaderCachePack *pack, size_t records, bool discarded)
+{
+	ShaderCachePackStats stats = pack->get_stats();
+
+	if (stats.records != records || !!stats.discarded != discarded)
+		report_mismatch("%s: found %u records with %llu bytes discarded, expected %zu records%s",
+				step, stats.records, (unsigned long long)stats.discarded,
+				records, discarded ? " and some discarded" : "");
+}
+
+static off_t file_length(const string &path)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st))
+		return -1;
+	return st.st_size;
+}
+
+static bool reopen(ShaderCachePack *pack)
+{
+	pack->close();
+	return pack->open(widen(args.path).c_str());
+}
+
+static void flip_last_byte()
+{
+	FILE *fp = fopen(args.path.c_str(), "r+b");
+	int c;
+
+	fseek(fp, -1, SEEK_END);
+	c = fgetc(fp);
+	fseek(fp, -1, SEEK_END);
+	fputc(c ^ 0x55, fp);
+	fclose(fp);
+}
+
+static void check_pack()
+{
+	vector<TestRecord> records = random_records(args.records, 4096);
+	TestRecord last;
+	ShaderCachePack pack;
+	ShaderCachePackStats stats;
+	off_t size_before_last = 0, size;
+	vector<uint8_t> data;
+	uint32_t tag;
+	FILE *fp;
+
+	// Kept aside to be stored last, so the pack can be cut off part way
+	// through it:
+	last = records.back();
+	records.pop_back();
+
+	remove(args.path.c_str());
+	if (!pack.open(widen(args.path).c_str()))
+		report_mismatch("unable to create a pack file");
+	check_all("empty", &pack, records, false);
+	for (TestRecord &r : records) {
+		if (!pack.store(r.key, r.tag, r.data.data(), r.data.size()))
+			report_mismatch("store failed");
+	}
+	size_before_last = file_length(args.path);
+	pack.store(last.key, last.tag, last.data.data(), last.data.size());
+	records.push_back(last);
+	check_all("same session", &pack, records);
+
+	stats = pack.get_stats();
+	if (stats.stores != records.size() || stats.hits != records.size() || stats.misses != records.size() - 1)
+		report_mismatch("counted %u stores, %u hits, %u misses", stats.stores, stats.hits, stats.misses);
+
+	// Next session:
+	if (!reopen(&pack))
+		report_mismatch("unable to reopen pack file");
+	check_stats("next session", &pack, records.size(), false);
+	check_all("next session", &pack, records);
+	pack.close();
+
+	// Crash part way through writing the last record:
+	size = file_length(args.path);
+	if (truncate(args.path.c_str(), size_before_last + 1 + rng() % (size - size_before_last - 1)))
+		report_mismatch("unable to truncate pack file");
+	reopen(&pack);
+	records.pop_back();
+	check_stats("torn record", &pack, records.size(), true);
+	check_all("torn record", &pack, records);
+	check_lookup("torn record", &pack, last, false);
+	if (file_length(args.path) != size_before_last)
+		report_mismatch("torn record was not cut off the end of the pack file");
+
+	// The next record goes where the torn one was:
+	pack.store(last.key, last.tag, last.data.data(), last.data.size());
+	reopen(&pack);
+	records.push_back(last);
+	check_stats("after torn record", &pack, records.size(), false);
+	check_all("after torn record", &pack, records);
+
+	// A newer record for a key takes the place of the older one:
+	records[0].data = random_bytes(256);
+	records[0].tag++;
+	pack.store(records[0].key, records[0].tag, records[0].data.data(), records[0].data.size());
+	check_lookup("replaced", &pack, records[0], true);
+	reopen(&pack);
+	check_stats("replaced", &pack, records.size(), false);
+	check_lookup("replaced after reopening", &pack, records[0], true);
+	if (!pack.get_stats().dead_bytes)
+		report_mismatch("replaced record was not counted as dead space");
+
+	// Flip a byte of the newest record, sized so that its last byte is not
+	// padding. The checksum catches it on lookup, and storing it again
+	// gives a good copy:
+	records[0].data.resize((records[0].data.size() + 8) & ~7);
+	pack.store(records[0].key, records[0].tag, records[0].data.data(), records[0].data.size());
+	pack.close();
+	flip_last_byte();
+	reopen(&pack);
+	check_lookup("corrupt record", &pack, records[0], false);
+	pack.store(records[0].key, records[0].tag, records[0].data.data(), records[0].data.size());
+	check_lookup("corrupt record stored again", &pack, records[0], true);
+	reopen(&pack);
+	check_lookup("corrupt record stored again and reopened", &pack, records[0], true);
+	check_all("corrupt record stored again and reopened", &pack, records);
+
+	// Compaction only happens if it would at least halve the file, unless
+	// forced. Dropping a handful of stale records is not worth it:
+	auto keep_all = [](const ShaderCacheKey &, uint32_t) { return true; };
+	if (pack.compact(keep_all))
+		report_mismatch("compacted a pack that would barely shrink");
+
+	// Make most of the pack stale, as changing the ShaderRegex sections
+	// would, and compact it:
+	vector<TestRecord> stale, live;
+	for (TestRecord &r : records) {
+		if (r.tag == 0x12345678 && stale.size() < records.size() * 3 / 4) {
+			stale.push_back(r);
+		} else
+			live.push_back(r);
+	}
+	// Pad the stale ones out so they take up more than half the pack:
+	for (TestRecord &r : stale) {
+		r.data.resize(r.data.size() + 8192);
+		pack.store(r.key, r.tag, r.data.data(), r.data.size());
+	}
+	size = file_length(args.path);
+	auto keep_live = [](const ShaderCacheKey &, uint32_t tag) { return tag != 0x12345678; };
+	if (!pack.compact(keep_live))
+		report_mismatch("did not compact a pack that was mostly stale");
+	check_stats("compacted", &pack, live.size(), false);
+	check_all("compacted", &pack, live);
+	check_all("compacted", &pack, stale, false);
+	stats = pack.get_stats();
+	if (stats.dead_bytes || file_length(args.path) >= size
+			|| (uint64_t)file_length(args.path) != stats.live_bytes + 16)
+		report_mismatch("compacted pack is %lld bytes with %llu dead, was %lld",
+				(long long)file_length(args.path), (unsigned long long)stats.dead_bytes, (long long)size);
+	reopen(&pack);
+	check_stats("compacted and reopened", &pack, live.size(), false);
+	check_all("compacted and reopened", &pack, live);
+	check_all("compacted and reopened", &pack, stale, false);
+	pack.store(stale[0].key, stale[0].tag, stale[0].data.data(), stale[0].data.size());
+	check_lookup("stored after compaction", &pack, stale[0], true);
+
+	// Forced compaction drops the one replaced record:
+	pack.store(stale[0].key, stale[0].tag, stale[0].data.data(), 1);
+	if (!pack.compact(keep_all, true) || pack.get_stats().dead_bytes)
+		report_mismatch("forced compaction did not drop the replaced record");
+	pack.close();
+
+	// Anything that is not a pack file of this version is started over:
+	fp = fopen(args.path.c_str(), "r+b");
+	fputc('X', fp);
+	fclose(fp);
+	if (!reopen(&pack))
+		report_mismatch("unable to start over a pack file with a bad header");
+	check_stats("bad header", &pack, 0, false);
+	check_all("bad header", &pack, live, false);
+
+	// A directory in place of the pack stops it being replaced and then
+	// opened again after compaction, which must leave it closed:
+	pack.store(live[0].key, live[0].tag, live[0].data.data(), live[0].data.size());
+	pack.store(live[0].key, live[0].tag, live[0].data.data(), live[0].data.size());
+	remove(args.path.c_str());
+	mkdir(args.path.c_str(), 0755);
+	if (pack.compact(keep_all, true) || pack.is_open())
+		report_mismatch("pack was not left closed when it could not be reopened after compaction");
+	if (pack.lookup(live[0].key, &tag, &data))
+		report_mismatch("pack that could not be reopened after compaction still has records");
+	rmdir(args.path.c_str());
+	pack.close();
+
+	remove(args.path.c_str());
+}
+
+// The files that the old layout would have had for a shader:
+struct LegacyFiles {
+	uint64_t hash;
+	const wchar_t *type;
+	vector<uint8_t> dat;
+	vector<uint8_t> bin;
+};
+
+static LegacyFiles random_legacy_files(uint32_t shader_regex_hash)
+{
+	ShaderRegexCacheHeader header;
+	LegacyFiles files;
+	uint32_t id;
+
+	files.hash = ((uint64_t)rng() << 32) | rng();
+	files.type = shader_types[rng() % 6];
+
+	// Most shaders don't match any ShaderRegex, which is still cached so
+	// they don't have to be checked again:
+	header.version = SHADER_REGEX_CACHE_VERSION;
+	header.shader_regex_hash = shader_regex_hash;
+	header.num_matches = rng() % 4 == 0 ? 1 + rng() % 3 : 0;
+	header.patched = header.num_matches && rng() % 2;
+
+	files.dat.resize(sizeof(header));
+	memcpy(files.dat.data(), &header, sizeof(header));
+	for (uint32_t i = 0; i < header.num_matches; i++) {
+		id = rng() % 16;
+		files.dat.insert(files.dat.end(), (uint8_t*)&id, (uint8_t*)(&id + 1));
+	}
+
+	if (header.patched) {
+		files.bin = random_bytes(16384);
+		files.bin.push_back(0);
+	}
+
+	return files;
+}
+
+static void check_converter()
+{
+	static const struct {
+		const wchar_t *name;
+		bool ok;
+		uint64_t hash;
+		bool is_bin;
+	} names[] = {
+		{ L"0123456789abcdef-ps_regex.dat", true, 0x0123456789abcdefull, false },
+		{ L"0123456789ABCDEF-VS_REGEX.BIN", true, 0x0123456789abcdefull, true },
+		{ L"fedcba9876543210-cs_regex.bin", true, 0xfedcba9876543210ull, true },
+		{ L"0123456789abcdef-ps_regex.txt", false },
+		{ L"0123456789abcdef-ps_replace.bin", false },
+		{ L"0123456789abcdef-ps.bin", false },
+		{ L"0123456789abcdeg-ps_regex.dat", false },
+		{ L"0123456789abcdef_ps_regex.dat", false },
+		{ L"0123456789abcdef-p1_regex.dat", false },
+		{ L"0123456789abcdef-ps_regex.dat.bak", false },
+		{ L"123456789abcdef-ps_regex.dat", false },
+	};
+	ShaderCachePack pack;
+	ShaderCacheKey key;
+	vector<uint8_t> found, expected;
+	uint64_t hash;
+	uint32_t type, tag;
+	bool is_bin, ok;
+	int i;
+
+	for (auto &n : names) {
+		hash = 0;
+		is_bin = false;
+		ok = parse_legacy_shader_regex_cache_name(n.name, wcslen(n.name), &hash, &type, &is_bin);
+		if (ok != n.ok || (ok && (hash != n.hash || is_bin != n.is_bin)))
+			report_mismatch("parsed %ls wrong", n.name);
+	}
+
+	remove(args.path.c_str());
+	pack.open(widen(args.path).c_str());
+	for (i = 0; i < args.records; i++) {
+		LegacyFiles files = random_legacy_files(0xabcdef01);
+		ShaderRegexCacheHeader *header = (ShaderRegexCacheHeader*)files.dat.data();
+
+		key.hash = files.hash;
+		key.type = shader_index_type(files.type, 2);
+		key.kind = ShaderCacheKind::REGEX;
+
+		// Patched, but the .bin never got written because assembling
+		// the patched shader failed. Nothing to convert:
+		if (header->patched && rng() % 8 == 0) {
+			if (convert_legacy_shader_regex_cache(&pack, files.hash, key.type, files.dat, NULL))
+				report_mismatch("converted a patched shader without its .bin");
+			continue;
+		}
+
+		// From a version that cached something else:
+		if (rng() % 16 == 0) {
+			header->version++;
+			if (convert_legacy_shader_regex_cache(&pack, files.hash, key.type, files.dat, &files.bin))
+				report_mismatch("converted a ShaderRegex cache of the wrong version");
+			continue;
+		}
+
+		if (!convert_legacy_shader_regex_cache(&pack, files.hash, key.type, files.dat,
+				files.bin.empty() ? NULL : &files.bin))
+			report_mismatch("failed to convert %016llx", (unsigned long long)files.hash);
+
+		expected = files.dat;
+		expected.insert(expected.end(), files.bin.begin(), files.bin.end());
+		if (!pack.lookup(key, &tag, &found) || found != expected || tag != 0xabcdef01)
+			report_mismatch("%016llx converted wrong", (unsigned long long)files.hash);
+	}
+	pack.close();
+	remove(args.path.c_str());
+}
+
+static string legacy_path(const LegacyFiles &files, const char *ext)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "/%016llx-%ls_regex.%s",
+			(unsigned long long)files.hash, files.type, ext);
+	return args.dir + name;
+}
+
+static bool read_file(const string &path, vector<uint8_t> *buf)
+{
+	struct stat st;
+	bool ok;
+	int fd;
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	ok = !fstat(fd, &st);
+	if (ok) {
+		buf->resize(st.st_size);
+		ok = read(fd, buf->data(), st.st_size) == st.st_size;
+	}
+	close(fd);
+	return ok;
+}
+
+static void write_file(const string &path, const vector<uint8_t> &buf)
+{
+	FILE *fp = fopen(path.c_str(), "wb");
+
+	if (!fp) {
+		printf("Unable to write %s\n", path.c_str());
+		exit(EXIT_FAILURE);
+	}
+	fwrite(buf.data(), 1, buf.size(), fp);
+	fclose(fp);
+}
+
+// Asks the kernel to forget the cached contents of a file, so the next read
+// comes from the disk as it would on the first start up after a reboot. The
+// directory entries and inodes may still be cached, so this flatters the
+// old layout if anything:
+static void drop_from_page_cache(const string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void drop_all(const vector<LegacyFiles> &shaders)
+{
+	for (const LegacyFiles &files : shaders) {
+		drop_from_page_cache(legacy_path(files, "dat"));
+		if (!files.bin.empty())
+			drop_from_page_cache(legacy_path(files, "bin"));
+	}
+	drop_from_page_cache(args.path);
+}
+
+// What load_shader_regex_cache used to do for each shader the game created:
+static size_t read_legacy(const vector<LegacyFiles> &shaders)
+{
+	vector<uint8_t> dat, bin;
+	size_t hits = 0;
+
+	for (const LegacyFiles &files : shaders) {
+		if (!read_file(legacy_path(files, "dat"), &dat))
+			continue;
+		if (((ShaderRegexCacheHeader*)dat.data())->patched
+				&& !read_file(legacy_path(files, "bin"), &bin))
+			continue;
+		hits++;
+	}
+	return hits;
+}
+
+static size_t read_pack(const vector<LegacyFiles> &shaders)
+{
+	ShaderCachePack pack;
+	ShaderCacheKey key;
+	vector<uint8_t> data;
+	size_t hits = 0;
+	uint32_t tag;
+
+	pack.open(widen(args.path).c_str());
+	for (const LegacyFiles &files : shaders) {
+		key.hash = files.hash;
+		key.type = shader_index_type(files.type, 2);
+		key.kind = ShaderCacheKind::REGEX;
+		hits += pack.lookup(key, &tag, &data);
+	}
+	return hits;
+}
+
+template <typename F>
+static double time_ms(F f, size_t *hits)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	*hits = f();
+	chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+	return ms.count();
+}
+
+static void benchmark()
+{
+	vector<LegacyFiles> shaders;
+	vector<uint8_t> dat, bin;
+	size_t files = 0, bytes = 0, hits;
+	double ms;
+	int i;
+
+	mkdir(args.dir.c_str(), 0755);
+	for (i = 0; i < args.benchmark_shaders; i++) {
+		shaders.push_back(random_legacy_files(0xabcdef01));
+		LegacyFiles &s = shaders.back();
+		write_file(legacy_path(s, "dat"), s.dat);
+		files++;
+		bytes += s.dat.size();
+		if (!s.bin.empty()) {
+			write_file(legacy_path(s, "bin"), s.bin);
+			files++;
+			bytes += s.bin.size();
+		}
+	}
+
+	// Convert the way UpdateShaderCachePack does, one directory entry at
+	// a time. The shader list stands in for the directory listing:
+	remove(args.path.c_str());
+	ms = time_ms([&]() {
+		ShaderCachePack pack;
+		uint64_t hash;
+		uint32_t type;
+		bool is_bin, has_bin;
+		size_t converted = 0;
+
+		pack.open(widen(args.path).c_str());
+		for (const LegacyFiles &s : shaders) {
+			string path = legacy_path(s, "dat");
+			wstring wname = widen(path.substr(args.dir.size() + 1));
+			if (!parse_legacy_shader_regex_cache_name(wname.c_str(), wname.size(), &hash, &type, &is_bin))
+				continue;
+			if (!read_file(path, &dat))
+				continue;
+			has_bin = read_file(legacy_path(s, "bin"), &bin);
+			converted += convert_legacy_shader_regex_cache(&pack, hash, type, dat, has_bin ? &bin : NULL);
+		}
+		return converted;
+	}, &hits);
+
+	printf("%d cached shaders in %zu files, %.1f MB, pack %.1f MB:\n", args.benchmark_shaders,
+			files, bytes / 1048576.0, file_length(args.path) / 1048576.0);
+	printf("  convert           %10.3fms  (%zu shaders)\n", ms, hits);
+
+	drop_all(shaders);
+	ms = time_ms([&]() { return read_legacy(shaders); }, &hits);
+	printf("  files, cold       %10.3fms  (%zu hits)\n", ms, hits);
+	ms = time_ms([&]() { return read_legacy(shaders); }, &hits);
+	printf("  files, warm       %10.3fms  (%zu hits)\n", ms, hits);
+
+	drop_all(shaders);
+	ms = time_ms([&]() { return read_pack(shaders); }, &hits);
+	printf("  pack, cold        %10.3fms  (%zu hits)\n", ms, hits);
+	ms = time_ms([&]() { return read_pack(shaders); }, &hits);
+	printf("  pack, warm        %10.3fms  (%zu hits)\n", ms, hits);
+
+	for (const LegacyFiles &s : shaders) {
+		remove(legacy_path(s, "dat").c_str());
+		remove(legacy_path(s, "bin").c_str());
+	}
+	rmdir(args.dir.c_str());
+	remove(args.path.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_pack();
+	check_converter();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,482 @@
+// shader_compile_queue_tests.cpp : Checks and benchmarks the worker pool that
+// DirectX11/ShaderCompileQueue.cpp compiles ShaderFixes replacements on.
+//
+// Jobs are run through the queue to check each runs exactly once and ends up
+// in the right state and is forgotten once it is finished with, that a full
+// queue turns work away instead of growing, that cancelling and draining
+// never lets a dropped job run, and that the queue never releases a job while
+// holding its lock. A mock of
+// the way HackerDevice creates shaders then checks that creating a shader
+// never waits on its compile, that the replacement is only bound once it is
+// ready, and that a compile finishing after the game reused the shader's
+// handle is thrown away. Finally the time the game spends creating shaders
+// is compared with compiling them synchronously.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ShaderCompileQueue.h"
+
+using namespace std;
+
+static struct {
+	int jobs = 1000;
+	int threads = 4;
+	int benchmark_shaders = 200;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the background shader compile queue, then times creating shaders with and without it.\n\n");
+
+	printf("  -n, --jobs N\n");
+	printf("\t\t\tNumber of jobs to check with (default 1000)\n");
+
+	printf("  -j, --threads N\n");
+	printf("\t\t\tNumber of worker threads to check with (default 4)\n");
+
+	printf("  --benchmark-shaders N\n");
+	printf("\t\t\tNumber of shaders to create in the benchmark (default 200)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random job results (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--jobs")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.jobs = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-j") || !strcmp(arg, "--threads")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.threads = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--benchmark-shaders")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.benchmark_shaders = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+// Holds jobs on a worker until the test lets them go, so that the states
+// the queue passes through can be checked without relying on timing:
+struct Gate {
+	mutex lock;
+	condition_variable cv;
+	bool open = false;
+
+	void wait()
+	{
+		unique_lock<mutex> guard(lock);
+		cv.wait(guard, [&] { return open; });
+	}
+
+	void release()
+	{
+		lock_guard<mutex> guard(lock);
+		open = true;
+		cv.notify_all();
+	}
+};
+
+static void wait_for_state(ShaderCompileQueue *queue, uint64_t key, ShaderCompileState state)
+{
+	while (queue->state(key) != state)
+		this_thread::yield();
+}
+
+// Stands in for the references a BackgroundShaderCompile holds, which may
+// call back into D3D as they are released. As with creating a shader in
+// check_swap_in, this check never returns rather than failing if the queue
+// destroys a job while holding its lock:
+struct ReleasedOutsideLock {
+	ShaderCompileQueue *queue;
+
+	ReleasedOutsideLock(ShaderCompileQueue *queue) : queue(queue) {}
+	~ReleasedOutsideLock() { queue->state(0); }
+};
+
+static void check_jobs()
+{
+	ShaderCompileQueue queue(args.threads, args.jobs);
+	vector<atomic<int>> runs(args.jobs);
+	vector<atomic<bool>> saw_running(args.jobs);
+	vector<bool> succeeds(args.jobs);
+	ShaderCompileStats stats;
+	uint32_t expect_done = 0;
+	int i;
+
+	for (i = 0; i < args.jobs; i++) {
+		runs[i] = 0;
+		saw_running[i] = false;
+		succeeds[i] = !!(rng() % 4);
+		expect_done += succeeds[i];
+	}
+
+	for (i = 0; i < args.jobs; i++) {
+		bool succeed = succeeds[i];
+		auto held = make_shared<ReleasedOutsideLock>(&queue);
+		if (!queue.submit(i, [&, i, succeed, held] {
+				runs[i]++;
+				saw_running[i] = queue.state(i) == ShaderCompileState::RUNNING;
+				return succeed;
+			})) {
+			report_mismatch("job %i was turned away from a queue with room for it", i);
+		}
+	}
+	queue.wait_idle();
+
+	// A failed job is forgotten straight away, a finished one once the
+	// caller is done with it:
+	for (i = 0; i < args.jobs; i++) {
+		ShaderCompileState expect = succeeds[i] ? ShaderCompileState::DONE : ShaderCompileState::NONE;
+		if (runs[i] != 1)
+			report_mismatch("job %i ran %i times", i, runs[i].load());
+		if (!saw_running[i])
+			report_mismatch("job %i was not RUNNING while it ran", i);
+		if (queue.state(i) != expect)
+			report_mismatch("job %i finished in state %i, expected %i", i, (int)queue.state(i), (int)expect);
+		if (queue.finish(i) != expect || queue.state(i) != ShaderCompileState::NONE)
+			report_mismatch("job %i is in state %i after it was finished", i, (int)queue.state(i));
+	}
+
+	stats = queue.get_stats();
+	if (stats.submitted != (uint32_t)args.jobs || stats.done != expect_done
+			|| stats.failed != args.jobs - expect_done || stats.rejected || stats.cancelled)
+		report_mismatch("stats submitted=%u done=%u failed=%u rejected=%u cancelled=%u",
+				stats.submitted, stats.done, stats.failed, stats.rejected, stats.cancelled);
+
+	// A finished key may be queued again, e.g. after a reload:
+	if (!queue.submit(0, []() -> bool { throw runtime_error("compiler blew up"); }))
+		report_mismatch("finished job could not be queued again");
+	queue.wait_idle();
+	if (queue.state(0) != ShaderCompileState::NONE || queue.get_stats().failed != stats.failed + 1)
+		report_mismatch("job that threw finished in state %i", (int)queue.state(0));
+}
+
+static void check_limits()
+{
+	const int max_queued = 4;
+	ShaderCompileQueue queue(1, max_queued);
+	ShaderCompileQueue no_workers(0, max_queued);
+	atomic<int> runs[max_queued + 1];
+	ShaderCompileStats stats;
+	size_t cancelled;
+	Gate gate;
+	int i;
+
+	if (no_workers.submit(0, [] { return true; }))
+		report_mismatch("queue with no workers accepted a job");
+
+	// Hold the only worker up so that everything after this stays queued:
+	for (i = 0; i <= max_queued; i++)
+		runs[i] = 0;
+	queue.submit(0, [&] { gate.wait(); runs[0]++; return true; });
+	wait_for_state(&queue, 0, ShaderCompileState::RUNNING);
+
+	for (i = 1; i <= max_queued; i++) {
+		auto held = make_shared<ReleasedOutsideLock>(&queue);
+		if (!queue.submit(i, [&, i, held] { runs[i]++; return true; }))
+			report_mismatch("job %i was turned away before the queue was full", i);
+	}
+	if (queue.submit(max_queued + 1, [] { return true; }))
+		report_mismatch("full queue accepted another job");
+	if (queue.submit(0, [] { return true; }))
+		report_mismatch("accepted a second job for a key that is running");
+
+	// Cancelling a job that has not started forgets it, and makes room:
+	if (queue.cancel(1) != ShaderCompileState::QUEUED || queue.state(1) != ShaderCompileState::NONE)
+		report_mismatch("cancelled queued job is in state %i", (int)queue.state(1));
+	if (queue.submit(2, [] { return true; }))
+		report_mismatch("accepted a second job for a key that is queued");
+	if (!queue.submit(1, [&] { runs[1]++; return true; }))
+		report_mismatch("cancelled key could not be queued again");
+	if (queue.cancel(0) != ShaderCompileState::RUNNING || queue.state(0) != ShaderCompileState::RUNNING)
+		report_mismatch("cancelled running job is in state %i", (int)queue.state(0));
+
+	// Draining drops everything still queued straight away, then waits
+	// for the running job:
+	thread drainer([&] { cancelled = queue.drain(); });
+	for (i = 1; i <= max_queued; i++)
+		wait_for_state(&queue, i, ShaderCompileState::NONE);
+	gate.release();
+	drainer.join();
+
+	if (cancelled != max_queued)
+		report_mismatch("drain cancelled %zu jobs, expected %i", cancelled, max_queued);
+	if (runs[0] != 1 || queue.state(0) != ShaderCompileState::DONE)
+		report_mismatch("running job did not finish during the drain");
+	for (i = 1; i <= max_queued; i++) {
+		if (runs[i])
+			report_mismatch("job %i ran after it was cancelled", i);
+	}
+
+	stats = queue.get_stats();
+	if (stats.max_queued != max_queued || stats.rejected != 3 || stats.cancelled != max_queued + 1)
+		report_mismatch("stats max_queued=%u rejected=%u cancelled=%u",
+				stats.max_queued, stats.rejected, stats.cancelled);
+}
+
+// A stand in for the parts of HackerDevice that async_shader_compile uses.
+// Shader handles are just numbers, and a shader is "compiled" by whatever the
+// compile function does, so that the test can hold it up or make it slow.
+class MockDevice {
+	struct Reload {
+		uint64_t hash;
+		uint64_t byte_code;  // Stands in for the ID3DBlob pointer
+		uint64_t replacement;
+	};
+
+	mutex lock;                      // G->mCriticalSection
+	map<uint64_t, Reload> reloaded;  // G->mReloadedShaders
+	uint64_t next_handle = 1;
+	uint64_t next_byte_code = 1;
+	function<void()> compile;
+
+public:
+	ShaderCompileQueue *queue;
+
+	MockDevice(ShaderCompileQueue *queue, function<void()> compile) :
+		compile(compile),
+		queue(queue)
+	{}
+
+	// CreateXXXShader -> ReplaceShaderInBackground
+	uint64_t create(uint64_t hash)
+	{
+		uint64_t handle, byte_code;
+
+		{
+			lock_guard<mutex> guard(lock);
+			handle = next_handle++;
+			byte_code = next_byte_code++;
+			reloaded[handle] = Reload{hash, byte_code, 0};
+		}
+
+		if (!queue || !queue->submit(handle, [=] { return compile_in_background(hash, handle, byte_code); })) {
+			compile();
+			lock_guard<mutex> guard(lock);
+			reloaded[handle].replacement = hash | 1ull << 63;
+		}
+		return handle;
+	}
+
+	// CreateXXXShader handing out a handle the game released, which goes
+	// through CleanupShaderMaps:
+	void reuse(uint64_t handle, uint64_t hash)
+	{
+		if (queue)
+			queue->cancel(handle);
+
+		lock_guard<mutex> guard(lock);
+		reloaded[handle] = Reload{hash, next_byte_code++, 0};
+	}
+
+	// CompileShaderInBackground
+	bool compile_in_background(uint64_t hash, uint64_t handle, uint64_t byte_code)
+	{
+		compile();
+
+		lock_guard<mutex> guard(lock);
+		auto i = reloaded.find(handle);
+		if (i == reloaded.end() || i->second.byte_code != byte_code)
+			return false;
+		i->second.replacement = hash | 1ull << 63;
+		return true;
+	}
+
+	// XXSetShader: what actually gets bound for a handle
+	uint64_t bind(uint64_t handle)
+	{
+		lock_guard<mutex> guard(lock);
+		auto i = reloaded.find(handle);
+		if (i == reloaded.end() || !i->second.replacement)
+			return handle;
+		return i->second.replacement;
+	}
+};
+
+static void check_swap_in()
+{
+	ShaderCompileQueue queue(args.threads, MAX_ASYNC_SHADER_COMPILE_QUEUED);
+	int shaders = min(args.jobs, MAX_ASYNC_SHADER_COMPILE_QUEUED);
+	vector<uint64_t> handles;
+	atomic<int> compiled(0);
+	Gate gate;
+	int i;
+
+	MockDevice device(&queue, [&] { gate.wait(); compiled++; });
+
+	// No compile can finish until the gate opens, so if creating a shader
+	// waited on one this would never return:
+	for (i = 0; i < shaders; i++)
+		handles.push_back(device.create(0x1000 + i));
+
+	for (i = 0; i < shaders; i++) {
+		if (device.bind(handles[i]) != handles[i])
+			report_mismatch("shader %i bound something other than the original before it compiled", i);
+	}
+
+	// The game releases one shader and gets its handle back for an
+	// unrelated one while the old compile is still waiting to run or
+	// running - neither may replace the new shader:
+	wait_for_state(&queue, handles[0], ShaderCompileState::RUNNING);
+	device.reuse(handles[0], 0x9000);
+	device.reuse(handles[shaders - 1], 0x9001);
+
+	gate.release();
+	queue.wait_idle();
+
+	if (device.bind(handles[0]) != handles[0] || device.bind(handles[shaders - 1]) != handles[shaders - 1])
+		report_mismatch("background compile replaced a shader whose handle was reused");
+	if (queue.state(handles[0]) != ShaderCompileState::NONE)
+		report_mismatch("stale compile finished in state %i", (int)queue.state(handles[0]));
+	for (i = 1; i < shaders - 1; i++) {
+		if (device.bind(handles[i]) != ((0x1000 + i) | 1ull << 63))
+			report_mismatch("shader %i was not replaced once it compiled", i);
+		// As InstallBackgroundCompiledShaders does once it has swapped
+		// the replacement in:
+		if (queue.finish(handles[i]) != ShaderCompileState::DONE)
+			report_mismatch("shader %i compile finished in state %i", i, (int)queue.state(handles[i]));
+	}
+}
+
+static void spin_for(double ms)
+{
+	chrono::steady_clock::time_point end = chrono::steady_clock::now()
+		+ chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(ms));
+
+	while (chrono::steady_clock::now() < end)
+		;
+}
+
+static void benchmark()
+{
+	static const double compile_ms[] = { 0, 0.5, 2, 8 };
+	unsigned threads = min(max(thread::hardware_concurrency(), 2u) - 1, (unsigned)MAX_ASYNC_SHADER_COMPILE_THREADS);
+	ShaderCompileQueue queue(threads, MAX_ASYNC_SHADER_COMPILE_QUEUED);
+	int i;
+
+	printf("%i shaders, %u worker threads:\n", args.benchmark_shaders, threads);
+	printf("  compile    sync create   async create   async ready   worst create\n");
+
+	for (double ms : compile_ms) {
+		MockDevice sync_device(NULL, [=] { spin_for(ms); });
+		MockDevice async_device(&queue, [=] { spin_for(ms); });
+		chrono::duration<double, milli> worst(0);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (i = 0; i < args.benchmark_shaders; i++)
+			sync_device.create(i);
+		chrono::duration<double, milli> sync_ms = chrono::steady_clock::now() - start;
+
+		start = chrono::steady_clock::now();
+		for (i = 0; i < args.benchmark_shaders; i++) {
+			chrono::steady_clock::time_point create_start = chrono::steady_clock::now();
+			async_device.create(i);
+			worst = max(worst, chrono::duration<double, milli>(chrono::steady_clock::now() - create_start));
+		}
+		chrono::duration<double, milli> async_ms = chrono::steady_clock::now() - start;
+		queue.wait_idle();
+		chrono::duration<double, milli> ready_ms = chrono::steady_clock::now() - start;
+
+		printf("  %5.1fms %12.3fms %12.3fms %12.3fms %12.3fms\n", ms,
+				sync_ms.count(), async_ms.count(), ready_ms.count(), worst.count());
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_jobs();
+	check_limits();
+	check_swap_in();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,410 @@
+// shader_index_tests.cpp : Checks and benchmarks the shader file index
+// (DirectX11/ShaderIndex.cpp) that lets shader creation skip probing
+// ShaderFixes and ShaderCache for files that do not exist.
+//
+// The file name parser is checked against a list of names that must and
+// must not be indexed, then the table is put through a long random sequence
+// of files being added and removed and checked against a std::map after
+// each step. Finally a directory is filled with shader files and the
+// lookups a shader creation makes are timed against probing the same names
+// with stat(), which is the closest thing here to the CreateFile and
+// GetFileAttributes calls the index replaces.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwctype>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ShaderIndex.h"
+
+using namespace std;
+
+static struct {
+	int shaders = 5000;
+	int lookups = 200000;
+	int operations = 200000;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the shader file index against a reference model, then times index\n");
+	printf("lookups against probing the filesystem for each shader file.\n\n");
+
+	printf("  -s, --shaders N\n");
+	printf("\t\t\tNumber of shaders to put in the benchmark directory (default 5000)\n");
+
+	printf("  -l, --lookups N\n");
+	printf("\t\t\tNumber of shader creations to time (default 200000)\n");
+
+	printf("  -n, --operations N\n");
+	printf("\t\t\tNumber of random adds and removes to check (default 200000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random operations (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-s") || !strcmp(arg, "--shaders")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.shaders = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-l") || !strcmp(arg, "--lookups")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.lookups = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--operations")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.operations = max(atoi(argv[i]), 0);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static const wchar_t *shader_types[] = { L"vs", L"ps", L"cs", L"gs", L"hs", L"ds" };
+
+static const wchar_t *variant_suffixes[] = {
+	L"_replace.txt", L"_replace.bin", L".txt", L".bin", L"_bad.txt",
+};
+
+static wstring shader_file_name(uint64_t hash, const wchar_t *type, ShaderFileVariant variant)
+{
+	wchar_t buf[64];
+
+	swprintf(buf, 64, L"%016llx-%ls%ls", (unsigned long long)hash, type, variant_suffixes[(int)variant]);
+	return buf;
+}
+
+static void check_names()
+{
+	static const struct {
+		const wchar_t *name;
+		bool valid;
+		uint64_t hash;
+		const wchar_t *type;
+		ShaderFileVariant variant;
+	} names[] = {
+		{ L"0123456789abcdef-vs_replace.txt", true, 0x0123456789abcdefULL, L"vs", ShaderFileVariant::REPLACE_TXT },
+		{ L"0123456789abcdef-ps_replace.bin", true, 0x0123456789abcdefULL, L"ps", ShaderFileVariant::REPLACE_BIN },
+		{ L"fedcba9876543210-cs.txt",         true, 0xfedcba9876543210ULL, L"cs", ShaderFileVariant::ASM_TXT },
+		{ L"fedcba9876543210-gs.bin",         true, 0xfedcba9876543210ULL, L"gs", ShaderFileVariant::ASM_BIN },
+		{ L"00000000000000ff-hs_bad.txt",     true, 0x00000000000000ffULL, L"hs", ShaderFileVariant::BAD_TXT },
+		// The filesystem is case insensitive, so these are the same files:
+		{ L"0123456789ABCDEF-VS_Replace.TXT", true, 0x0123456789abcdefULL, L"vs", ShaderFileVariant::REPLACE_TXT },
+		{ L"0123456789AbCdEf-Ds.BIN",         true, 0x0123456789abcdefULL, L"ds", ShaderFileVariant::ASM_BIN },
+		// Things that live alongside shaders but are never looked up:
+		{ L"0123456789abcdef-vs_1.bin",       false },
+		{ L"0123456789abcdef-vs_replace.txt.bak", false },
+		{ L"0123456789abcdef-vs_replace.bak", false },
+		{ L"0123456789abcdef-vs_bad.bin",     false },
+		{ L"0123456789abcdef-vs",             false },
+		{ L"0123456789abcdef-v.txt",          false },
+		{ L"0123456789abcdef-v1.txt",         false },
+		{ L"0123456789abcdefg-vs.txt",        false },
+		{ L"0123456789abcdeg-vs.txt",         false },
+		{ L"0123456789abcde-vs.txt",          false },
+		{ L"0123456789abcdef_vs.txt",         false },
+		{ L"ShaderUsage.txt",                 false },
+		{ L"3Dmigoto.ini",                    false },
+		{ L"",                                false },
+	};
+	ShaderFileVariant variant;
+	uint64_t hash;
+	uint32_t type;
+	bool valid;
+
+	for (auto &n : names) {
+		valid = parse_shader_file_name(n.name, wcslen(n.name), &hash, &type, &variant);
+		if (valid != n.valid) {
+			mismatch("%ls: parsed as %s", n.name, valid ? "a shader file" : "not a shader file");
+			continue;
+		}
+		if (!valid)
+			continue;
+		if (hash != n.hash || type != shader_index_type(n.type, 2) || variant != n.variant)
+			mismatch("%ls: parsed as %016llx type %x variant %i", n.name,
+					(unsigned long long)hash, type, (int)variant);
+	}
+}
+
+// Random sequence of adds and removes, with names in mixed case and some
+// hashes reused across shader types, checked against a std::map:
+static void check_table()
+{
+	typedef pair<uint64_t, uint32_t> Key;
+	map<Key, ShaderIndexEntry> model;
+	ShaderIndexTable table;
+	vector<uint64_t> hashes;
+	const ShaderIndexEntry *entry;
+	uniform_int_distribution<size_t> type_dist(0, 5);
+	uniform_int_distribution<int> variant_dist(0, (int)ShaderFileVariant::COUNT - 1);
+	ShaderFileVariant variant;
+	uint64_t hash, timestamp;
+	const wchar_t *type;
+	wstring name;
+	size_t model_size;
+	int i;
+
+	// Few enough hashes that files are added and removed repeatedly:
+	for (i = 0; i < 2000; i++)
+		hashes.push_back(((uint64_t)rng() << 32) | rng());
+
+	for (i = 0; i < args.operations; i++) {
+		hash = hashes[uniform_int_distribution<size_t>(0, hashes.size() - 1)(rng)];
+		type = shader_types[type_dist(rng)];
+		variant = (ShaderFileVariant)variant_dist(rng);
+		timestamp = ((uint64_t)rng() << 32) | rng();
+		name = shader_file_name(hash, type, variant);
+		if (rng() % 2) {
+			for (wchar_t &c : name) {
+				if (rng() % 2)
+					c = towupper(c);
+			}
+		}
+
+		ShaderIndexEntry &m = model[Key(hash, shader_index_type(type, 2))];
+		if (rng() % 3) {
+			table.add_file(name.c_str(), name.size(), timestamp);
+			m.variants |= 1u << (int)variant;
+			m.timestamps[(int)variant] = timestamp;
+		} else {
+			table.remove_file(name.c_str(), name.size());
+			m.variants &= ~(1u << (int)variant);
+			m.timestamps[(int)variant] = 0;
+		}
+
+		if (i % 1000 && i != args.operations - 1)
+			continue;
+
+		model_size = 0;
+		for (auto &kv : model) {
+			entry = table.lookup(kv.first.first, kv.first.second);
+			if (kv.second.variants)
+				model_size++;
+			if (!entry) {
+				if (kv.second.variants)
+					mismatch("%016llx type %x missing from the index",
+							(unsigned long long)kv.first.first, kv.first.second);
+				continue;
+			}
+			if (entry->variants != kv.second.variants)
+				mismatch("%016llx type %x has variants %x, expected %x",
+						(unsigned long long)kv.first.first, kv.first.second,
+						entry->variants, kv.second.variants);
+			if (memcmp(entry->timestamps, kv.second.timestamps, sizeof(entry->timestamps)))
+				mismatch("%016llx type %x has the wrong timestamps",
+						(unsigned long long)kv.first.first, kv.first.second);
+		}
+		if (table.size() != model_size)
+			mismatch("index has %zu shaders, expected %zu", table.size(), model_size);
+
+		// Hashes that were never added must not be found:
+		for (int j = 0; j < 100; j++) {
+			hash = ((uint64_t)rng() << 32) | rng();
+			if (table.lookup(hash, shader_index_type(L"ps", 2)))
+				mismatch("%016llx found but never added", (unsigned long long)hash);
+		}
+	}
+}
+
+static string narrow(const wstring &w)
+{
+	return string(w.begin(), w.end());
+}
+
+// Same order of lookups as HackerDevice::_ReplaceShaderFromShaderFixes()
+// makes for a shader with decompilation enabled:
+static const ShaderFileVariant creation_lookups[] = {
+	ShaderFileVariant::REPLACE_BIN,
+	ShaderFileVariant::ASM_BIN,
+	ShaderFileVariant::REPLACE_TXT,
+	ShaderFileVariant::ASM_TXT,
+	ShaderFileVariant::BAD_TXT,
+};
+
+static void run_benchmark()
+{
+	char dir_template[] = "/tmp/shader_index_XXXXXX";
+	vector<pair<uint64_t, const wchar_t*>> shaders, creations;
+	ShaderIndexTable table;
+	const ShaderIndexEntry *entry;
+	struct dirent *ent;
+	struct stat st;
+	string dir, path;
+	wstring name;
+	DIR *d;
+	size_t probe_found = 0, index_found = 0;
+	int i;
+
+	if (!mkdtemp(dir_template)) {
+		printf("Unable to create benchmark directory\n");
+		return;
+	}
+	dir = dir_template;
+
+	// A fix's worth of shaders, each with one or two of the variants a
+	// shaderhacker would leave behind:
+	for (i = 0; i < args.shaders; i++) {
+		uint64_t hash = ((uint64_t)rng() << 32) | rng();
+		const wchar_t *type = shader_types[rng() % 6];
+		shaders.emplace_back(hash, type);
+		for (int v = 0; v < (int)ShaderFileVariant::COUNT; v++) {
+			if (v && rng() % 3)
+				continue;
+			path = dir + "/" + narrow(shader_file_name(hash, type, (ShaderFileVariant)v));
+			FILE *f = fopen(path.c_str(), "w");
+			if (f)
+				fclose(f);
+		}
+	}
+
+	// Games create far more shaders than a fix replaces, so most lookups
+	// are for shaders that have no files at all:
+	for (i = 0; i < args.lookups; i++) {
+		if (rng() % 10 == 0)
+			creations.push_back(shaders[rng() % shaders.size()]);
+		else
+			creations.emplace_back(((uint64_t)rng() << 32) | rng(), shader_types[rng() % 6]);
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	d = opendir(dir.c_str());
+	while (d && (ent = readdir(d))) {
+		name = wstring(ent->d_name, ent->d_name + strlen(ent->d_name));
+		path = dir + "/" + ent->d_name;
+		if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+			continue;
+		table.add_file(name.c_str(), name.size(), (uint64_t)st.st_mtime);
+	}
+	if (d)
+		closedir(d);
+	chrono::steady_clock::time_point built = chrono::steady_clock::now();
+
+	for (auto &c : creations) {
+		for (ShaderFileVariant v : creation_lookups) {
+			path = dir + "/" + narrow(shader_file_name(c.first, c.second, v));
+			if (!stat(path.c_str(), &st))
+				probe_found++;
+		}
+	}
+	chrono::steady_clock::time_point probed = chrono::steady_clock::now();
+
+	for (auto &c : creations) {
+		entry = table.lookup(c.first, shader_index_type(c.second, 2));
+		for (ShaderFileVariant v : creation_lookups) {
+			if (entry && entry->has(v))
+				index_found++;
+		}
+	}
+	chrono::steady_clock::time_point looked_up = chrono::steady_clock::now();
+
+	if (probe_found != index_found)
+		mismatch("probing found %zu files, the index found %zu", probe_found, index_found);
+
+	chrono::duration<double, milli> build_ms = built - start;
+	chrono::duration<double, milli> probe_ms = probed - built;
+	chrono::duration<double, milli> index_ms = looked_up - probed;
+	printf("\n%zu shaders indexed in %.2fms\n", table.size(), build_ms.count());
+	printf("%d shader creations: probing %.2fms, index %.2fms, speedup %.0fx\n",
+			args.lookups, probe_ms.count(), index_ms.count(),
+			probe_ms.count() / index_ms.count());
+
+	d = opendir(dir.c_str());
+	while (d && (ent = readdir(d))) {
+		if (ent->d_name[0] != '.')
+			unlink((dir + "/" + ent->d_name).c_str());
+	}
+	if (d)
+		closedir(d);
+	rmdir(dir.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_names();
+	check_table();
+	if (args.benchmark)
+		run_benchmark();
+
+	if (mismatches) {
+		printf("FAIL: %zu mismatches in the shader index\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("PASS: Shader index matches\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,747 @@
+// shader_regex_prefilter_tests.cpp : Checks and benchmarks the ShaderRegex
+// prefilter (DirectX11/ShaderRegexPrefilter.cpp) that rules out shaders
+// before they are handed to pcre2.
+//
+// The prefilter must never rule out a shader that a pattern would match, so
+// the literal extraction is checked against a table of expected results and
+// then against pcre2 itself (built from the bundled pcre2-10.30 source) over
+// a large number of random patterns and subjects. The Aho-Corasick scanner is
+// checked against a naive search. If a directory is given, the assembly
+// shaders in it are used as subjects for a set of patterns of the kind found
+// in ShaderRegex sections, and the benchmark times running every pattern on
+// every shader against scanning each shader once and only running the
+// patterns whose literals were found.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <pcre2.h>
+
+#include "ShaderRegexPrefilter.h"
+
+using namespace std;
+
+static struct {
+	int patterns = 20000;
+	int subjects = 40;
+	int repeat = 20;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+	const char *corpus;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]... [DIRECTORY]\n\n", argv0);
+	printf("Checks the ShaderRegex prefilter against pcre2. If a directory is given, the\n");
+	printf("assembly shaders found in it are also used to check and benchmark the\n");
+	printf("prefilter with realistic patterns.\n\n");
+
+	printf("  -p, --patterns N\n");
+	printf("\t\t\tNumber of random patterns to check (default 20000)\n");
+
+	printf("  -s, --subjects N\n");
+	printf("\t\t\tNumber of random subjects to match each pattern against (default 40)\n");
+
+	printf("  -r, --repeat N\n");
+	printf("\t\t\tNumber of passes over the shaders to time (default 20)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random patterns (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-p") || !strcmp(arg, "--patterns")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.patterns = max(atoi(argv[i]), 0);
+			continue;
+		}
+		if (!strcmp(arg, "-s") || !strcmp(arg, "--subjects")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.subjects = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "-r") || !strcmp(arg, "--repeat")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.repeat = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		if (arg[0] == '-' || args.corpus) {
+			printf("Unrecognised argument: %s\n", arg);
+			PrintHelp(argv[0]); // Does not return
+		}
+		args.corpus = arg;
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+// Makes newlines and other control characters visible in mismatch reports
+static string escape(const string &str)
+{
+	string ret;
+	char buf[8];
+
+	for (char c : str) {
+		if (c == '\n') {
+			ret += "\\n";
+		} else if ((unsigned char)c < 0x20 || (unsigned char)c >= 0x7f) {
+			snprintf(buf, sizeof(buf), "\\x%02x", (unsigned char)c);
+			ret += buf;
+		} else
+			ret.push_back(c);
+	}
+
+	return ret;
+}
+
+static string lower(const string &str)
+{
+	string ret(str);
+
+	for (char &c : ret) {
+		if (c >= 'A' && c <= 'Z')
+			c = c - 'A' + 'a';
+	}
+
+	return ret;
+}
+
+// Same options as ShaderRegexPattern::compile()
+static pcre2_code* compile(const string &pattern)
+{
+	PCRE2_SIZE err_off;
+	pcre2_code *regex;
+	int err;
+
+	regex = pcre2_compile((PCRE2_SPTR)pattern.c_str(), pattern.length(),
+			PCRE2_CASELESS | PCRE2_MULTILINE, &err, &err_off, NULL);
+	if (regex)
+		pcre2_jit_compile(regex, 0);
+	return regex;
+}
+
+// Same as ShaderRegexPattern::matches(), including the match data
+// allocation, so that the benchmark is fair to the code being replaced
+static bool matches(pcre2_code *regex, const string &subject)
+{
+	pcre2_match_data *match_data;
+	int rc;
+
+	match_data = pcre2_match_data_create_from_pattern(regex, NULL);
+	rc = pcre2_match(regex, (PCRE2_SPTR)subject.c_str(), subject.length(), 0, 0, match_data, NULL);
+	pcre2_match_data_free(match_data);
+
+	return rc >= 0;
+}
+
+static void check_literals()
+{
+	static const struct {
+		const char *pattern;
+		bool ok;
+		vector<string> literals;
+	} cases[] = {
+		{ "dp4 o0\\.x, v0\\.xyzw, cb0\\[0\\]\\.xyzw", true, { "dp4 o0.x, v0.xyzw, cb0[0].xyzw" } },
+		{ "mul r(?<tmp>\\d+)\\.xyzw, r\\d+\\.yyyy, cb1\\[13\\]\\.xyzw", true, { "mul r", ".xyzw, r", ".yyyy, cb1[13].xyzw" } },
+		{ "DCL_Temps \\d+\\n", true, { "dcl_temps " } },
+		{ "^ps_5_0$", true, { "ps_5_0" } },
+		{ "abc\\ndef\\tghi", true, { "abc\ndef\tghi" } },
+		{ "", true, { } },
+		{ "ab", true, { } },
+		// Quantifiers:
+		{ "ab?cde", true, { "cde" } },
+		{ "abc*def", true, { "def" } },
+		{ "abc+def", true, { "abc", "cdef" } },
+		{ "abc++def", true, { "abc", "cdef" } },
+		{ "abc+?def", true, { "abc", "cdef" } },
+		{ "abc{0,3}def", true, { "def" } },
+		{ "abc{2}def", true, { "abc", "cdef" } },
+		{ "abc{1,}def", true, { "abc", "cdef" } },
+		{ "abc{de", true, { "abc{de" } },
+		{ "abc{,2}de", true, { "abc{,2}de" } },
+		{ "abc\\{2}de", true, { "abc{2}de" } },
+		{ "abc(?#comment)*def", true, { "def" } },
+		{ "abc(?#comment)+(?#comment)?def", true, { "abc", "cdef" } },
+		// Groups:
+		{ "(abc)def", true, { "abc", "def" } },
+		{ "(?:abc)+def", true, { "abc", "def" } },
+		{ "(?:abc)?def", true, { "def" } },
+		{ "(?:abc)*def", true, { "def" } },
+		{ "(?:abc){0}def", true, { "def" } },
+		{ "(?<name>abc)(?'other'def)(?P<third>ghi)", true, { "abc", "def", "ghi" } },
+		{ "(?>abc)def", true, { "abc", "def" } },
+		{ "(?i:abc)(?-i:def)", true, { "abc", "def" } },
+		{ "(abc|def)ghi", true, { "ghi" } },
+		{ "(?:a(bcd|efg)h)ijk", true, { "ijk" } },
+		{ "(?|(abc)|(def))ghi", true, { "ghi" } },
+		{ "(?:(?:abc))", true, { "abc" } },
+		// Things that contribute no literals:
+		{ "(?=abc)def", true, { "def" } },
+		{ "(?!abc)def", true, { "def" } },
+		{ "(?<=abc)def", true, { "def" } },
+		{ "(?<!abc)def", true, { "def" } },
+		{ "abc(?#comment)def", true, { "abc", "def" } },
+		{ "abc(?#(unbalanced)def", true, { "abc", "def" } },
+		{ "abc(?i)def", true, { "abc", "def" } },
+		{ "(abc)(?1)def", true, { "abc", "def" } },
+		{ "(?<n>abc)(?P=n)def", true, { "abc", "def" } },
+		{ "[abc]def[^)]ghi", true, { "def", "ghi" } },
+		{ "[]abc]def", true, { "def" } },
+		{ "[^]abc]def", true, { "def" } },
+		{ "[\\]abc]def", true, { "def" } },
+		{ "[[:alpha:]]abc", true, { "abc" } },
+		{ "[[:alpha:]abc]def", true, { "def" } },
+		{ "[(]abc", true, { "abc" } },
+		{ "abc.def", true, { "abc", "def" } },
+		{ "abc\\bdef\\sghi\\d+jkl", true, { "abc", "def", "ghi", "jkl" } },
+		{ "abc\\.def", true, { "abc.def" } },
+		// Things that we do not try to understand:
+		{ "abc|def", false, { } },
+		{ "(?:abc)|def", false, { } },
+		{ "(?x)abc", false, { } },
+		{ "(?:(?x) # ) \n)?abc", false, { } },
+		{ "(?x:abc)def", false, { } },
+		{ "abc\\x41def", false, { } },
+		{ "abc\\101def", false, { } },
+		{ "(abc)\\1", false, { } },
+		{ "(?<n>abc)\\k<n>", false, { } },
+		{ "\\Qabc\\E", false, { } },
+		{ "[\\Q]\\E]abc", false, { } },
+		{ "\\p{L}abc", false, { } },
+		{ "(*UTF)abc", false, { } },
+		{ "abc)", false, { } },
+		{ "(abc", false, { } },
+		{ "abc\\", false, { } },
+	};
+	vector<string> literals;
+	string got, expected;
+	bool ok;
+
+	for (auto &c : cases) {
+		literals.clear();
+		ok = shader_regex_required_literals(c.pattern, &literals);
+
+		got.clear();
+		for (string &literal : literals)
+			got += "\"" + escape(literal) + "\" ";
+		expected.clear();
+		for (const string &literal : c.literals)
+			expected += "\"" + escape(literal) + "\" ";
+
+		if (ok != c.ok || literals != c.literals)
+			report_mismatch("%s: got %s%s, expected %s%s", escape(c.pattern).c_str(),
+					ok ? "" : "(gave up) ", got.c_str(),
+					c.ok ? "" : "(gave up) ", expected.c_str());
+	}
+}
+
+static string random_string(const char *alphabet, size_t max_length)
+{
+	size_t length = rng() % (max_length + 1), n = strlen(alphabet);
+	string ret;
+
+	while (length--)
+		ret.push_back(alphabet[rng() % n]);
+
+	return ret;
+}
+
+static void check_automaton()
+{
+	ShaderRegexPrefilter prefilter;
+	vector<string> literals;
+	vector<uint8_t> found;
+	vector<uint32_t> ids;
+	string text, folded;
+	size_t count, expected;
+	int i, j, k;
+
+	for (i = 0; i < 2000; i++) {
+		prefilter.clear();
+		literals.clear();
+		ids.clear();
+		for (j = rng() % 40; j >= 0; j--) {
+			literals.push_back(lower(random_string("abcd.\n", 8)));
+			if (literals.back().empty())
+				literals.back() = "a";
+			ids.push_back(prefilter.add_literal(literals.back()));
+		}
+		prefilter.build();
+
+		for (k = 0; k < 20; k++) {
+			text = random_string("abcdABCD.\nx", 200);
+			folded = lower(text);
+			count = prefilter.scan(text.data(), text.size(), &found);
+
+			expected = 0;
+			for (j = 0; j < (int)literals.size(); j++) {
+				bool want = folded.find(literals[j]) != string::npos;
+				if (found[ids[j]] != want)
+					report_mismatch("scanner %s \"%s\" in \"%s\"", want ? "missed" : "falsely found",
+							escape(literals[j]).c_str(), escape(text).c_str());
+			}
+			for (j = 0; j < (int)prefilter.size(); j++)
+				expected += found[j];
+			if (count != expected)
+				report_mismatch("scanner returned %zu, but found %zu literals", count, expected);
+		}
+	}
+}
+
+// Random patterns made out of the constructs the literal extractor has to
+// understand, over a small alphabet so that they often match the subjects.
+// Anything that pcre2 rejects is just skipped.
+static const char *pattern_atoms[] = {
+	".", "\\.", "\\n", "\\t", "{", "\\{", "}", "\\d", "\\w", "\\s", "\\S", "\\b", "\\B", "\\K",
+	"[ab]", "[^a]", "[]a]", "[\\]b]", "[[:alpha:]]", "[a-c]", "[[:digit:].]", "^", "$",
+	"(?i)", "(?-i)", "(?#x)", "(?=ab)", "(?!c)", "(?<=a)", "(?<!b)", "\\Z", "\\z", "\\A",
+};
+static const char *quantifiers[] = {
+	"?", "*", "+", "{0,2}", "{1,2}", "{2}", "{2,}", "{1}", "{0}", "??", "+?", "*+", "?+",
+};
+static const char *group_openers[] = {
+	"(", "(?:", "(?<n%u>", "(?'n%u'", "(?P<n%u>", "(?>", "(?i:", "(?-i:", "(?=", "(?!", "(?|",
+};
+
+static string random_quantifier(unsigned percent)
+{
+	if (rng() % 100 >= percent)
+		return "";
+	return quantifiers[rng() % (sizeof(quantifiers) / sizeof(quantifiers[0]))];
+}
+
+static string random_sequence(unsigned depth, unsigned *names)
+{
+	char buf[32];
+	string ret;
+	int n = 1 + rng() % 8;
+	unsigned r;
+
+	while (n--) {
+		r = rng() % 100;
+		if (r < 65) {
+			ret.push_back("abcAB .,"[rng() % 8]);
+			ret += random_quantifier(20);
+		} else if (r < 85 || depth >= 3) {
+			ret += pattern_atoms[rng() % (sizeof(pattern_atoms) / sizeof(pattern_atoms[0]))];
+			ret += random_quantifier(10);
+		} else {
+			snprintf(buf, sizeof(buf), group_openers[rng() % (sizeof(group_openers) / sizeof(group_openers[0]))], (*names)++);
+			ret += buf;
+			ret += random_sequence(depth + 1, names);
+			if (rng() % 4 == 0)
+				ret += "|" + random_sequence(depth + 1, names);
+			ret += ")";
+			ret += random_quantifier(30);
+		}
+	}
+
+	if (!depth && rng() % 10 == 0)
+		ret += "|" + random_sequence(depth + 1, names);
+
+	return ret;
+}
+
+// Half of the subjects are random, and half are the pattern with its
+// metacharacters stripped out, which often comes close to matching it:
+static string random_subject(const string &pattern)
+{
+	string ret;
+
+	if (rng() % 2)
+		return random_string("abcABC .,{}\n\t", 40);
+
+	for (char c : pattern) {
+		if (!strchr("\\()[]?*+|^$:<>'", c) || rng() % 8 == 0)
+			ret.push_back(c);
+	}
+	if (rng() % 2)
+		ret = random_string("abc \n", 6) + ret + random_string("abc \n", 6);
+
+	return ret;
+}
+
+// The one property that matters: if pcre2 matches, every literal that was
+// extracted from the pattern must be found in the subject. Random patterns
+// with nested quantifiers can backtrack for a very long time, so these get a
+// much lower match limit, and anything that hits it is not counted.
+static bool check_subject(const string &pattern, pcre2_code *regex, pcre2_match_data *match_data,
+		pcre2_match_context *match_context, ShaderRegexPrefilter *prefilter,
+		const vector<uint32_t> &ids, const string &subject)
+{
+	vector<uint8_t> found;
+	int rc;
+
+	rc = pcre2_match(regex, (PCRE2_SPTR)subject.c_str(), subject.length(), 0, 0, match_data, match_context);
+	if (rc < 0)
+		return false;
+
+	prefilter->scan(subject.data(), subject.size(), &found);
+	for (uint32_t id : ids) {
+		if (!found[id]) {
+			report_mismatch("pattern \"%s\" matched \"%s\" but the prefilter ruled it out",
+					escape(pattern).c_str(), escape(subject).c_str());
+			break;
+		}
+	}
+
+	return true;
+}
+
+static void check_random_patterns()
+{
+	size_t compiled = 0, filtered = 0, subjects = 0, matched = 0;
+	pcre2_match_context *match_context;
+	pcre2_match_data *match_data;
+	ShaderRegexPrefilter prefilter;
+	vector<string> literals;
+	vector<uint32_t> ids;
+	pcre2_code *regex;
+	string pattern;
+	unsigned names;
+	int i, j;
+
+	match_context = pcre2_match_context_create(NULL);
+	pcre2_set_match_limit(match_context, 10000);
+
+	for (i = 0; i < args.patterns; i++) {
+		names = 0;
+		pattern = random_sequence(0, &names);
+		regex = compile(pattern);
+		if (!regex)
+			continue;
+		compiled++;
+
+		literals.clear();
+		prefilter.clear();
+		ids.clear();
+		if (shader_regex_required_literals(pattern, &literals) && !literals.empty())
+			filtered++;
+		for (string &literal : literals)
+			ids.push_back(prefilter.add_literal(literal));
+		prefilter.build();
+
+		match_data = pcre2_match_data_create_from_pattern(regex, NULL);
+		for (j = 0; j < args.subjects; j++) {
+			subjects++;
+			matched += check_subject(pattern, regex, match_data, match_context,
+					&prefilter, ids, random_subject(pattern));
+		}
+
+		pcre2_match_data_free(match_data);
+		pcre2_code_free(regex);
+	}
+
+	pcre2_match_context_free(match_context);
+
+	printf("%zu random patterns compiled, %zu with literals, %zu of %zu subjects matched\n",
+			compiled, filtered, matched, subjects);
+}
+
+// Patterns in the style of the ShaderRegex sections shared for various
+// games, as they appear after the ini parser has joined the lines together:
+static const char *shader_regex_patterns[] = {
+	"dcl_constantbuffer cb(?<cb>\\d+)\\[(?<size>\\d+)\\], immediateIndexed\\n",
+	"dcl_output_siv o0\\.xyzw, position\\n",
+	"dcl_input_ps_siv linear noperspective v0\\.xy, position\\n",
+	"dcl_resource_texturecube \\(float,float,float,float\\) t\\d+\\n",
+	"dcl_globalFlags refactoringAllowed, skipOptimization\\n",
+	"^ps_5_0$",
+	"^vs_4_0$",
+	"dp4 o0\\.x, v0\\.xyzw, cb0\\[0\\]\\.xyzw\\n",
+	"dp4 (?<out>o\\d+)\\.w, (?<pos>r\\d+)\\.xyzw, cb(?<cb>\\d+)\\[(?<idx>\\d+)\\]\\.xyzw\\n",
+	"mul r(?<tmp>\\d+)\\.xyzw, v0\\.yyyy, cb1\\[1\\]\\.xyzw\\nmad r\\d+\\.xyzw, v0\\.xxxx, cb1\\[0\\]\\.xyzw, r\\d+\\.xyzw\\n",
+	"mad r(?<r>\\d+)\\.xyz, -cb(\\d+)\\[\\d+\\]\\.xyzx, r\\d+\\.wwww, r\\d+\\.xyzx\\n",
+	"div r\\d+\\.xy, r\\d+\\.xyxx, r\\d+\\.wwww\\n",
+	"rsq r(?<r>\\d+)\\.x, r\\d+\\.x\\nmul r\\d+\\.xyz, r\\d+\\.xxxx, r\\d+\\.xyzx\\n",
+	"sample_indexable\\(texture2d\\)\\(float,float,float,float\\) r(?<tmp>\\d+)\\.xyzw, v1\\.xyxx, t0\\.xyzw, s0\\n",
+	"sample_l\\(texture2d\\)\\(float,float,float,float\\) r\\d+\\.\\w+, r\\d+\\.\\w+, t\\d+\\.\\w+, s\\d+, l\\(0\\.000000\\)\\n",
+	"ld_indexable\\(texture2d\\)\\(float,float,float,float\\) r\\d+\\.xyzw, r\\d+\\.xyzw, t(?<tex>\\d+)\\.xyzw\\n",
+	"sample r\\d+\\.xyzw, v\\d+\\.xyxx, t0\\.xyzw, s0\\n",
+	"lt r\\d+\\.x, l\\(0\\.000000\\), r\\d+\\.z\\n",
+	"mov o0\\.xyzw, l\\(0,0,0,0\\)\\n",
+	"mov o(?<o>\\d+)\\.xyzw, r(?<r>\\d+)\\.xyzw\\nret",
+	"eq r\\d+\\.\\w+, cb\\d+\\[\\d+\\]\\.[xyzw], l\\(0\\.000000\\)",
+	"deriv_rtx_coarse",
+	"discard_nz",
+	"imm_atomic_iadd",
+	"sincos",
+	"(?:dp3|dp4) r\\d+\\.x, r\\d+\\.xyz[xw]?, r\\d+\\.xyz[xw]?\\n",
+	"mul|mad",
+	"add r(\\d+)\\.xyz, -r\\1\\.xyzx, cb\\d+\\[\\d+\\]\\.xyzx",
+};
+
+static const size_t num_shader_regex_patterns = sizeof(shader_regex_patterns) / sizeof(shader_regex_patterns[0]);
+
+static bool is_asm_shader(const string &name)
+{
+	// e.g. 72bd9b1f9ed176ea-vs.txt, but not the _replace.txt HLSL files
+	return name.size() > 7 && !name.compare(name.size() - 4, 4, ".txt")
+		&& name[name.size() - 7] == '-' && name[name.size() - 5] == 's';
+}
+
+static void find_shaders(const string &path, vector<string> *shaders)
+{
+	struct dirent *ent;
+	vector<string> entries;
+	struct stat st;
+	string contents;
+	FILE *fp;
+	DIR *dir;
+	char buf[4096];
+	size_t len;
+
+	dir = opendir(path.c_str());
+	if (!dir)
+		return;
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] != '.')
+			entries.push_back(ent->d_name);
+	}
+	closedir(dir);
+	sort(entries.begin(), entries.end());
+
+	for (string &name : entries) {
+		string child = path + "/" + name;
+		if (stat(child.c_str(), &st))
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			find_shaders(child, shaders);
+			continue;
+		}
+		if (!is_asm_shader(name))
+			continue;
+
+		fp = fopen(child.c_str(), "rb");
+		if (!fp)
+			continue;
+		contents.clear();
+		while ((len = fread(buf, 1, sizeof(buf), fp)))
+			contents.append(buf, len);
+		fclose(fp);
+
+		// The disassembler emits LF only
+		contents.erase(remove(contents.begin(), contents.end(), '\r'), contents.end());
+		shaders->push_back(contents);
+	}
+}
+
+struct Group {
+	pcre2_code *regex;
+	vector<uint32_t> ids;
+};
+
+static void build_groups(ShaderRegexPrefilter *prefilter, vector<Group> *groups)
+{
+	vector<string> literals;
+	size_t i;
+
+	prefilter->clear();
+	groups->resize(num_shader_regex_patterns);
+	for (i = 0; i < num_shader_regex_patterns; i++) {
+		(*groups)[i].regex = compile(shader_regex_patterns[i]);
+		if (!(*groups)[i].regex) {
+			report_mismatch("pcre2 failed to compile \"%s\"", shader_regex_patterns[i]);
+			continue;
+		}
+		literals.clear();
+		shader_regex_required_literals(shader_regex_patterns[i], &literals);
+		for (string &literal : literals)
+			(*groups)[i].ids.push_back(prefilter->add_literal(literal));
+	}
+	prefilter->build();
+}
+
+static void free_groups(vector<Group> *groups)
+{
+	for (Group &group : *groups)
+		pcre2_code_free(group.regex);
+	groups->clear();
+}
+
+// Mirrors apply_shader_regex_groups(), minus the patching, which would only
+// add the same cost to both sides. Returns a bitmask of the matching groups.
+static uint64_t match_groups(vector<Group> &groups, ShaderRegexPrefilter *prefilter, const string &shader, size_t *skipped)
+{
+	vector<uint8_t> found;
+	uint64_t ret = 0;
+	bool scanned = false;
+	size_t i;
+
+	for (i = 0; i < groups.size(); i++) {
+		if (!groups[i].regex)
+			continue;
+
+		if (prefilter && !groups[i].ids.empty()) {
+			if (!scanned) {
+				prefilter->scan(shader.data(), shader.size(), &found);
+				scanned = true;
+			}
+			if (any_of(groups[i].ids.begin(), groups[i].ids.end(), [&](uint32_t id) { return !found[id]; })) {
+				(*skipped)++;
+				continue;
+			}
+		}
+
+		if (matches(groups[i].regex, shader))
+			ret |= 1ULL << i;
+	}
+
+	return ret;
+}
+
+static void check_shaders(vector<string> &shaders)
+{
+	ShaderRegexPrefilter prefilter;
+	vector<Group> groups;
+	uint64_t expected, got;
+	size_t i, j, skipped = 0, matched = 0;
+
+	build_groups(&prefilter, &groups);
+
+	for (i = 0; i < shaders.size(); i++) {
+		expected = match_groups(groups, NULL, shaders[i], &skipped);
+		got = match_groups(groups, &prefilter, shaders[i], &skipped);
+		for (j = 0; j < groups.size(); j++) {
+			if ((expected ^ got) & (1ULL << j))
+				report_mismatch("\"%s\" %s shader %zu with the prefilter", escape(shader_regex_patterns[j]).c_str(),
+						got & (1ULL << j) ? "matched" : "did not match", i);
+			matched += !!(expected & (1ULL << j));
+		}
+	}
+
+	printf("%zu shaders, %zu patterns: %zu matches, %zu of %zu pattern runs ruled out by the prefilter\n",
+			shaders.size(), groups.size(), matched, skipped, shaders.size() * groups.size());
+
+	free_groups(&groups);
+}
+
+static void run_benchmark(vector<string> &shaders)
+{
+	ShaderRegexPrefilter prefilter;
+	vector<Group> groups;
+	uint64_t baseline_matches = 0, prefilter_matches = 0;
+	size_t skipped = 0;
+	int r;
+
+	build_groups(&prefilter, &groups);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (r = 0; r < args.repeat; r++) {
+		for (string &shader : shaders)
+			baseline_matches += match_groups(groups, NULL, shader, &skipped);
+	}
+	chrono::steady_clock::time_point baseline = chrono::steady_clock::now();
+	for (r = 0; r < args.repeat; r++) {
+		for (string &shader : shaders)
+			prefilter_matches += match_groups(groups, &prefilter, shader, &skipped);
+	}
+	chrono::steady_clock::time_point filtered = chrono::steady_clock::now();
+
+	if (baseline_matches != prefilter_matches)
+		report_mismatch("benchmark matches differ");
+
+	chrono::duration<double, milli> baseline_ms = baseline - start;
+	chrono::duration<double, milli> prefilter_ms = filtered - baseline;
+	printf("\n%zu patterns over %zu shaders x %d: pcre2 only %.2fms, prefiltered %.2fms, speedup %.1fx\n",
+			groups.size(), shaders.size(), args.repeat, baseline_ms.count(), prefilter_ms.count(),
+			baseline_ms.count() / prefilter_ms.count());
+	printf("Prefilter has %zu literals, %.2fus per shader including the pcre2 runs it let through\n",
+			prefilter.size(), prefilter_ms.count() * 1000.0 / (shaders.size() * args.repeat));
+
+	free_groups(&groups);
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> shaders;
+
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_literals();
+	check_automaton();
+	check_random_patterns();
+
+	if (args.corpus) {
+		find_shaders(args.corpus, &shaders);
+		if (shaders.empty()) {
+			printf("No assembly shaders found in %s\n", args.corpus);
+			return EXIT_FAILURE;
+		}
+		check_shaders(shaders);
+		if (args.benchmark)
+			run_benchmark(shaders);
+	}
+
+	if (mismatches) {
+		printf("FAIL: %zu mismatches in the ShaderRegex prefilter\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("PASS: ShaderRegex prefilter matches pcre2\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,29 @@
+//
+// Hand written: a nop, which has no operands, before and after a swapc,
+// which has the most of any instruction, to check that an instruction's
+// unused operand slots are zeroed rather than the next instruction's.
+//
+// Input signature:
+//
+// Name                 Index   Mask Register SysValue  Format   Used
+// -------------------- ----- ------ -------- -------- ------- ------
+// TEXCOORD                 0   xyzw        0     NONE   float   xyzw
+//
+//
+// Output signature:
+//
+// Name                 Index   Mask Register SysValue  Format   Used
+// -------------------- ----- ------ -------- -------- ------- ------
+// SV_Target                0   xyzw        0   TARGET   float   xyzw
+//
+ps_5_0
+dcl_globalFlags refactoringAllowed
+dcl_input_ps linear v0.xyzw
+dcl_output o0.xyzw
+dcl_temps 2
+nop 
+swapc r0.xyzw, r1.xyzw, v0.xyzw, l(1.000000, 2.000000, 3.000000, 4.000000), l(5.000000, 6.000000, 7.000000, 8.000000)
+nop 
+add o0.xyzw, r0.xyzw, r1.xyzw
+ret 
+// Approximately 0 instruction slots used
@@ -0,0 +1,960 @@
+// shader_replay.cpp : Offline test & benchmark driver for the portable parts
+// of the shader toolchain (Flugan's assembler, the signature parser,
+// BinaryDecompiler and the HLSL decompiler).
+//
+// The regular test scripts in this directory drive fxc.exe and
+// cmd_Decompiler.exe, which makes them Windows only. This replays the same
+// corpus without either of them, so it can run on a Linux build machine:
+//
+//  - Assembly (*.asm and the <hash>-<type>.txt ShaderFixes dumps in
+//    GameExamples) is assembled, then decompiled from the result.
+//
+//  - The original assembly embedded in a GameExamples *_replace.txt is used
+//    instead when there is no .txt alongside it, the same way
+//    run_game_example_tests.sh reconstructs a shader.
+//
+//  - If a _stripped.hlsl.chk exists for a shader reconstructed from its
+//    assembly the decompiled output is compared against it. We can't
+//    reconstruct the reflection information (the test scripts copy that out
+//    of an fxc compiled binary), which is why only the stripped variants
+//    can be checked here - the binary our assembler produces has no RDEF
+//    section, so is equivalent to one that has been through /Qstrip_reflect.
+//
+//  - Binary shaders (*.o, *.bin, *.shdr) are decoded with BinaryDecompiler.
+//    Decompiling these requires Microsoft's disassembler, so their .chk files
+//    can only be checked by the Windows test scripts. Assembled shaders are
+//    also decoded on their own before being decompiled, so that the decode
+//    stage covers the whole corpus.
+//
+// Every stage is timed individually and summarised at the end in the same
+// format as cmd_Decompiler, along with the peak heap usage of the decode
+// stage. Use --repeat to benchmark, --report to save the
+// per-file timings and --baseline to fail if any stage has gotten slower
+// than a previously saved report. --decompile-cache measures what the
+// decompiler cache saves: the first repeat of a shader that is not cached yet
+// is decompiled and stored, later repeats and later runs are read back from
+// the cache, and are checked against the decompiled output if both happen in
+// the same run.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#include "DecompileHLSL.h"
+#include "DecompileCache.h"
+#include "log.h"
+
+#include "BinaryDecompiler/internal_includes/structs.h"
+#include "BinaryDecompiler/internal_includes/decode.h"
+#include "BinaryDecompiler/internal_includes/reflect.h"
+
+using namespace std;
+
+FILE *LogFile = NULL; // Set to stderr with --verbose
+bool gLogDebug = false;
+
+static struct {
+	vector<string> paths;
+	string known_failures;
+	string report;
+	string baseline;
+	string decompile_cache;
+	double tolerance = 10.0;
+	int repeat = 1;
+	bool binary_front_end;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION] PATH...\n\n", argv0);
+	printf("Replays shaders through the assembler and decompilers. Directories are\n");
+	printf("searched recursively.\n\n");
+
+	printf("  -r, --repeat N\n");
+	printf("\t\t\tRun the assemble, decode and decompile stages N times per file\n");
+
+	printf("  --known-failures FILE\n");
+	printf("\t\t\tDon't fail the run for files listed in FILE (one per line,\n");
+	printf("\t\t\tmatched against the end of the path, # for comments)\n");
+
+	printf("  --report FILE\n");
+	printf("\t\t\tWrite the status, per-stage timings and errors of every file to FILE\n");
+
+	printf("  --baseline FILE\n");
+	printf("\t\t\tFail if any stage is slower than in a report previously saved to FILE\n");
+
+	printf("  --tolerance PERCENT\n");
+	printf("\t\t\tHow much slower than the baseline is acceptable (default 10)\n");
+
+	printf("  --decompile-cache FILE\n");
+	printf("\t\t\tRead decompiled shaders from the cache in FILE, adding those that are missing\n");
+
+	printf("  --binary-front-end\n");
+	printf("\t\t\tDecompile with the binary front end instead of parsing the disassembly\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tList every file and send the decompiler's log to stderr\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	bool terminated = false;
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!terminated && !strncmp(arg, "-", 1)) {
+			if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+				PrintHelp(argv[0]); // Does not return
+			}
+			if (!strcmp(arg, "--")) {
+				terminated = true;
+				continue;
+			}
+			if (!strcmp(arg, "-r") || !strcmp(arg, "--repeat")) {
+				if (++i >= argc)
+					PrintHelp(argv[0]);
+				args.repeat = max(atoi(argv[i]), 1);
+				continue;
+			}
+			if (!strcmp(arg, "--known-failures")) {
+				if (++i >= argc)
+					PrintHelp(argv[0]);
+				args.known_failures = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--report")) {
+				if (++i >= argc)
+					PrintHelp(argv[0]);
+				args.report = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--baseline")) {
+				if (++i >= argc)
+					PrintHelp(argv[0]);
+				args.baseline = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--tolerance")) {
+				if (++i >= argc)
+					PrintHelp(argv[0]);
+				args.tolerance = atof(argv[i]);
+				continue;
+			}
+			if (!strcmp(arg, "--decompile-cache")) {
+				if (++i >= argc)
+					PrintHelp(argv[0]);
+				args.decompile_cache = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--binary-front-end")) {
+				args.binary_front_end = true;
+				continue;
+			}
+			if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+				args.verbose = true;
+				continue;
+			}
+			printf("Unrecognised argument: %s\n", arg);
+			PrintHelp(argv[0]); // Does not return
+		}
+		args.paths.push_back(arg);
+	}
+
+	if (args.paths.empty())
+		PrintHelp(argv[0]); // Does not return
+}
+
+// Stages we time individually for the summary report. These match
+// cmd_Decompiler where they overlap so that the reports can be compared:
+enum Stage {
+	STAGE_READ,
+	STAGE_EXTRACT,
+	STAGE_ASSEMBLE,
+	STAGE_DECODE,
+	STAGE_DECOMPILE,
+	STAGE_COMPARE,
+	NUM_STAGES
+};
+static const char *stage_names[NUM_STAGES] = {
+	"read",
+	"extract",
+	"assemble",
+	"decode",
+	"decompile",
+	"compare",
+};
+
+enum Status {
+	STATUS_PASS,
+	STATUS_FAIL,
+	STATUS_XFAIL, // Failed, but listed in --known-failures
+	STATUS_XPASS, // Passed, but listed in --known-failures
+	STATUS_SKIP,  // Nothing to test, e.g. a hand written replacement shader
+	NUM_STATUSES
+};
+static const char *status_names[NUM_STATUSES] = {
+	"PASS",
+	"FAIL",
+	"XFAIL",
+	"XPASS",
+	"SKIP",
+};
+
+enum InputType {
+	INPUT_ASM,
+	INPUT_REPLACE,
+	INPUT_BINARY,
+};
+
+struct FileResult {
+	string path;
+	InputType type;
+	Status status;
+	bool checked;
+	double stage_ms[NUM_STAGES];
+	double total_ms;
+	size_t decode_peak_bytes;
+	string error;
+
+	FileResult(const string &path, InputType type) :
+		path(path),
+		type(type),
+		status(STATUS_PASS),
+		checked(false),
+		stage_ms(),
+		total_ms(0),
+		decode_peak_bytes(0)
+	{}
+};
+
+// Breakdown of the decompile stage, summed over every file:
+static DecompilerTimings decompiler_timings;
+
+static DecompileCache decompile_cache;
+
+// Heap accounting for the decode stage. Everything BinaryDecompiler
+// allocates goes through operator new, so replacing it here lets us see how
+// large the decoded shader gets without any help from the decoder itself.
+// This harness only runs on glibc, which tells us the real size of each
+// block, and is single threaded.
+static size_t heap_in_use;
+static size_t heap_peak;
+
+void* operator new(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+
+	if (!p)
+		throw bad_alloc();
+	heap_in_use += malloc_usable_size(p);
+	heap_peak = max(heap_peak, heap_in_use);
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	if (!p)
+		return;
+	heap_in_use -= malloc_usable_size(p);
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+class StageTimer {
+	FileResult *result;
+	Stage stage;
+	chrono::steady_clock::time_point start;
+public:
+	StageTimer(FileResult *result, Stage stage) :
+		result(result),
+		stage(stage),
+		start(chrono::steady_clock::now())
+	{}
+
+	~StageTimer()
+	{
+		chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+		result->stage_ms[stage] += elapsed.count();
+	}
+};
+
+static bool fail(FileResult *result, Stage stage, const string &msg)
+{
+	result->status = STATUS_FAIL;
+	result->error = string(stage_names[stage]) + ": " + msg;
+	return false;
+}
+
+static bool ends_with(const string &s, const char *suffix)
+{
+	size_t len = strlen(suffix);
+	return s.size() >= len && !s.compare(s.size() - len, len, suffix);
+}
+
+static bool file_exists(const string &path)
+{
+	struct stat st;
+	return !stat(path.c_str(), &st) && S_ISREG(st.st_mode);
+}
+
+static bool read_file(const string &path, string *data)
+{
+	ifstream f(path, ios::in | ios::binary);
+	if (!f)
+		return false;
+	ostringstream ss;
+	ss << f.rdbuf();
+	*data = ss.str();
+	return true;
+}
+
+// ShaderFixes dumps are named after the shader hash and type, e.g.
+// "e4957a7d53cf49e4-vs.txt". There are plenty of other notes in GameExamples
+// as .txt files that we don't want to try to assemble.
+static bool is_shader_dump(const string &path)
+{
+	size_t slash = path.rfind('/');
+	const char *name = path.c_str() + (slash == string::npos ? 0 : slash + 1);
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if (!isxdigit((unsigned char)name[i]))
+			return false;
+	}
+	return name[16] == '-' && name[18] == 's' && !strcmp(name + 19, ".txt");
+}
+
+static void find_inputs(const string &path, vector<FileResult> *results)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st)) {
+		printf("Unable to open %s\n", path.c_str());
+		exit(EXIT_FAILURE);
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		vector<string> entries;
+		DIR *dir = opendir(path.c_str());
+		struct dirent *ent;
+
+		if (!dir)
+			return;
+		while ((ent = readdir(dir))) {
+			if (ent->d_name[0] != '.')
+				entries.push_back(path + "/" + ent->d_name);
+		}
+		closedir(dir);
+
+		// Sorted so that reports from different runs line up:
+		sort(entries.begin(), entries.end());
+		for (string &entry : entries)
+			find_inputs(entry, results);
+		return;
+	}
+
+	if (ends_with(path, ".asm") || is_shader_dump(path)) {
+		results->emplace_back(path, INPUT_ASM);
+	} else if (ends_with(path, "_replace.txt")) {
+		// Only used when there is no assembly or binary version of the
+		// shader, otherwise we would be testing the same shader twice:
+		string base = path.substr(0, path.size() - 12);
+		if (!file_exists(base + ".txt") && !file_exists(base + ".bin"))
+			results->emplace_back(path, INPUT_REPLACE);
+	} else if (ends_with(path, ".o") || ends_with(path, ".bin") || ends_with(path, ".shdr")) {
+		results->emplace_back(path, INPUT_BINARY);
+	}
+}
+
+// Splits on newlines, dropping any carriage returns:
+static vector<string> split_lines(const string &text)
+{
+	vector<string> lines;
+	size_t pos = 0, end;
+
+	while (pos < text.size()) {
+		end = text.find('\n', pos);
+		if (end == string::npos)
+			end = text.size();
+		lines.emplace_back(text, pos, end - pos);
+		if (!lines.back().empty() && lines.back().back() == '\r')
+			lines.back().pop_back();
+		pos = end + 1;
+	}
+
+	return lines;
+}
+
+static bool starts_with(const string &s, const char *prefix)
+{
+	return !s.compare(0, strlen(prefix), prefix);
+}
+
+// Extracts the original assembly from the comment 3DMigoto places at the end
+// of a decompiled shader. Matches the sed script used by
+// reconstruct_shader_binary() in test_framework.sh, which deletes everything
+// up to a "/*~~~~ Original ASM ~~~~" line (older versions omit the title) and
+// everything from the closing "*/" onwards.
+static bool extract_original_asm(const string &hlsl, string *asm_text)
+{
+	vector<string> lines = split_lines(hlsl);
+	size_t i, j;
+
+	for (i = 0; i < lines.size(); i++) {
+		const string &line = lines[i];
+		if (!starts_with(line, "/*~"))
+			continue;
+		j = line.find_first_not_of('~', 2);
+		if (j == string::npos || !line.compare(j, 14, " Original ASM "))
+			break;
+	}
+	if (i == lines.size())
+		return false;
+
+	asm_text->clear();
+	for (i++; i < lines.size() && lines[i].find("*/") == string::npos; i++) {
+		asm_text->append(lines[i]);
+		asm_text->push_back('\n');
+	}
+
+	return !asm_text->empty();
+}
+
+// Removes the comment blocks describing the RDEF section from a disassembly,
+// since these are absent when a shader has been through /Qstrip_reflect. The
+// signatures are described in the same comment and are left alone. The HLSL
+// decompiler uses these comments to name resources, so we need to match what
+// the Windows test scripts passed it when generating the _stripped.hlsl.chk.
+static string strip_reflection_comments(const string &asm_text)
+{
+	vector<string> lines = split_lines(asm_text);
+	string ret;
+	bool skip = false;
+
+	ret.reserve(asm_text.size());
+	for (const string &line : lines) {
+		if (starts_with(line, "// Buffer Definitions") || starts_with(line, "// Resource Bindings"))
+			skip = true;
+		else if (!starts_with(line, "//") || starts_with(line, "// Input signature")
+				|| starts_with(line, "// Output signature")
+				|| starts_with(line, "// Patch Constant signature"))
+			skip = false;
+		if (skip)
+			continue;
+		ret.append(line);
+		ret.push_back('\n');
+	}
+
+	return ret;
+}
+
+// Skip the version & timestamp line, the same as check_decompiler_result()
+// in test_framework.sh:
+static const char *skip_created_with(const string &hlsl)
+{
+	if (!starts_with(hlsl, "// ---- Created with"))
+		return hlsl.c_str();
+	size_t nl = hlsl.find('\n');
+	return nl == string::npos ? "" : hlsl.c_str() + nl + 1;
+}
+
+static bool compare_chk(FileResult *result, const string &hlsl, const string &chk_path)
+{
+	StageTimer timer(result, STAGE_COMPARE);
+	string chk;
+
+	if (!read_file(chk_path, &chk))
+		return fail(result, STAGE_COMPARE, "unable to read " + chk_path);
+
+	result->checked = true;
+	if (strcmp(skip_created_with(hlsl), skip_created_with(chk)))
+		return fail(result, STAGE_COMPARE, "does not match " + chk_path);
+
+	return true;
+}
+
+// Parts of the HLSL decompiler read operands past ui32NumOperands by the
+// layout they expect for the opcode, so these have to be zeroed rather than
+// whatever comes next in the arena (see ShaderArena::AllocateOperands):
+static bool operand_padding_is_zero(const Operand *operands, uint32_t used, uint32_t min)
+{
+	static const char zero[sizeof(Operand)] = {};
+	uint32_t i;
+
+	for (i = used; i < min; i++) {
+		if (memcmp(&operands[i], zero, sizeof(Operand)))
+			return false;
+	}
+	return true;
+}
+
+static bool check_operand_padding(FileResult *result, Shader *shader)
+{
+	for (ShaderPhase &phase : shader->asPhase) {
+		for (auto &decls : phase.ppsDecl) {
+			for (Declaration &decl : decls) {
+				if (!operand_padding_is_zero(decl.asOperands,
+						decl.ui32NumOperands, MAX_DECLARATION_OPERANDS))
+					return fail(result, STAGE_DECODE, "declaration operands past the end are not zeroed");
+			}
+		}
+		for (auto &insts : phase.ppsInst) {
+			for (Instruction &inst : insts) {
+				if (!operand_padding_is_zero(inst.asOperands,
+						inst.ui32NumOperands, MAX_INSTRUCTION_OPERANDS))
+					return fail(result, STAGE_DECODE, "instruction operands past the end are not zeroed");
+			}
+		}
+	}
+
+	return true;
+}
+
+// Decodes the shader args.repeat times, recording the most heap any one
+// decode needed on top of what was already in use:
+static bool decode(FileResult *result, void *bytecode)
+{
+	StageTimer timer(result, STAGE_DECODE);
+	size_t base;
+	Shader *shader;
+	int i;
+
+	for (i = 0; i < args.repeat; i++) {
+		base = heap_peak = heap_in_use;
+		try {
+			shader = DecodeDXBC((uint32_t*)bytecode);
+		} catch (const exception &) {
+			// BinaryDecompiler throws a bare exception for opcodes it
+			// does not recognise, the HLSL decompiler catches it:
+			return fail(result, STAGE_DECODE, "unrecognised instruction");
+		}
+		if (!shader)
+			return fail(result, STAGE_DECODE, "not a recognised shader binary");
+		if (!i && !check_operand_padding(result, shader)) {
+			FreeShaderInfo(shader->sInfo);
+			delete shader;
+			return false;
+		}
+		FreeShaderInfo(shader->sInfo);
+		delete shader;
+		result->decode_peak_bytes = max(result->decode_peak_bytes, heap_peak - base);
+	}
+
+	return true;
+}
+
+static bool decompile(FileResult *result, const vector<byte> &bytecode,
+		const string &asm_text, string *hlsl)
+{
+	StageTimer timer(result, STAGE_DECOMPILE);
+	DecompilerSettings d;
+	ParseParameters p = {};
+	DecompileCacheKey key;
+	DecompileCacheEntry cached;
+	string model, decompiled;
+	bool patched = false;
+	bool errorOccurred = false;
+	bool have_cached = false, have_decompiled = false;
+	int i;
+
+	p.bytecode = bytecode.data();
+	p.decompiled = asm_text.c_str();
+	p.decompiledSize = asm_text.size();
+	p.G = &d;
+	d.binaryFrontEnd = args.binary_front_end;
+
+	// This has no use for 3DMigoto's own shader hashes, so leaves the
+	// bytecode crc to tell the shaders apart:
+	if (decompile_cache.is_open()) {
+		decompile_cache_key(&key, 0, bytecode.data(), bytecode.size(),
+				DecompilerSettingsHash(d), DecompilerVersion());
+	}
+
+	for (i = 0; i < args.repeat; i++) {
+		if (decompile_cache.is_open() && decompile_cache.lookup(key, &cached)) {
+			have_cached = true;
+			*hlsl = cached.error ? string() : cached.hlsl;
+			errorOccurred = cached.error;
+			continue;
+		}
+
+		*hlsl = DecompileBinaryHLSL(p, patched, model, errorOccurred, &decompiler_timings);
+		have_decompiled = true;
+		decompiled = *hlsl;
+
+		if (decompile_cache.is_open()) {
+			cached.error = hlsl->empty() || errorOccurred;
+			cached.hlsl = *hlsl;
+			cached.asm_text = asm_text;
+			cached.shader_model = model;
+			cached.patched = patched;
+			decompile_cache.store(key, cached);
+		}
+	}
+
+	// cmd_Decompiler treats either of these as a failure and won't write
+	// out the .hlsl file:
+	if (hlsl->empty() || errorOccurred)
+		return fail(result, STAGE_DECOMPILE, "error while decompiling");
+
+	if (have_cached && have_decompiled && decompiled != *hlsl)
+		return fail(result, STAGE_DECOMPILE, "cached output differs from the decompiler's");
+
+	return true;
+}
+
+static bool replay_asm(FileResult *result, const string &data)
+{
+	string asm_text;
+	vector<char> asm_buf;
+	vector<byte> bytecode;
+	string hlsl;
+	HRESULT hr = S_OK;
+	string base;
+	int i;
+
+	{
+		StageTimer timer(result, STAGE_EXTRACT);
+		if (result->type == INPUT_REPLACE) {
+			if (!extract_original_asm(data, &asm_text)) {
+				// Hand written replacement shaders, which the
+				// test scripts also skip:
+				result->status = STATUS_SKIP;
+				result->error = "no original assembly";
+				return true;
+			}
+			base = result->path.substr(0, result->path.size() - 12);
+		} else {
+			asm_text = data;
+			if (ends_with(result->path, ".txt"))
+				base = result->path.substr(0, result->path.size() - 4);
+		}
+		asm_text = strip_reflection_comments(asm_text);
+		asm_buf.assign(asm_text.begin(), asm_text.end());
+	}
+
+	{
+		StageTimer timer(result, STAGE_ASSEMBLE);
+		try {
+			for (i = 0; i < args.repeat && SUCCEEDED(hr); i++) {
+				bytecode.clear();
+				hr = AssembleFluganWithSignatureParsing(&asm_buf, &bytecode);
+			}
+		} catch (const exception &e) {
+			return fail(result, STAGE_ASSEMBLE, e.what());
+		}
+		if (FAILED(hr))
+			return fail(result, STAGE_ASSEMBLE, "assembly failed");
+	}
+
+	if (!decode(result, bytecode.data()))
+		return false;
+
+	if (!decompile(result, bytecode, asm_text, &hlsl))
+		return false;
+
+	// Shaders reconstructed from assembly. If there was a binary it is
+	// what the .chk was generated from instead.
+	if (!base.empty() && !file_exists(base + ".bin") && file_exists(base + "_stripped.hlsl.chk"))
+		return compare_chk(result, hlsl, base + "_stripped.hlsl.chk");
+
+	return true;
+}
+
+static bool replay_binary(FileResult *result, string *data)
+{
+	// DecodeDXBC works on 32bit tokens, so make sure the buffer is padded
+	// out in case the file was truncated:
+	data->resize((data->size() + 3) & ~3);
+
+	return decode(result, &(*data)[0]);
+}
+
+static void process_file(FileResult *result)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	string data;
+	bool ok;
+
+	{
+		StageTimer timer(result, STAGE_READ);
+		ok = read_file(result->path, &data);
+	}
+
+	if (!ok)
+		fail(result, STAGE_READ, "unable to read file");
+	else if (result->type == INPUT_BINARY)
+		replay_binary(result, &data);
+	else
+		replay_asm(result, data);
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	result->total_ms = elapsed.count();
+}
+
+static vector<string> read_known_failures()
+{
+	vector<string> known;
+	string data;
+
+	if (args.known_failures.empty())
+		return known;
+
+	if (!read_file(args.known_failures, &data)) {
+		printf("Unable to read %s\n", args.known_failures.c_str());
+		exit(EXIT_FAILURE);
+	}
+
+	for (string &line : split_lines(data)) {
+		line.erase(min(line.find('#'), line.size()));
+		line.erase(line.find_last_not_of(" \t") + 1);
+		if (!line.empty())
+			known.push_back(line);
+	}
+
+	return known;
+}
+
+static bool is_known_failure(const vector<string> &known, const string &path)
+{
+	for (const string &k : known) {
+		if (ends_with(path, k.c_str())
+				&& (path.size() == k.size() || path[path.size() - k.size() - 1] == '/'))
+			return true;
+	}
+	return false;
+}
+
+static void write_report(vector<FileResult> *results)
+{
+	FILE *fp;
+	unsigned stage;
+
+	fp = fopen(args.report.c_str(), "w");
+	if (!fp) {
+		printf("Unable to write report to %s\n", args.report.c_str());
+		return;
+	}
+
+	fprintf(fp, "file\tstatus\ttotal_ms");
+	for (stage = 0; stage < NUM_STAGES; stage++)
+		fprintf(fp, "\t%s_ms", stage_names[stage]);
+	fprintf(fp, "\tdecode_peak_kb\terror\n");
+
+	for (FileResult &result : *results) {
+		fprintf(fp, "%s\t%s\t%.3f", result.path.c_str(),
+				status_names[result.status], result.total_ms);
+		for (stage = 0; stage < NUM_STAGES; stage++)
+			fprintf(fp, "\t%.3f", result.stage_ms[stage]);
+		fprintf(fp, "\t%.1f\t%s\n", result.decode_peak_bytes / 1024.0, result.error.c_str());
+	}
+
+	fclose(fp);
+}
+
+// Compares the per-stage totals against a report saved by an earlier run.
+// Only files present in both reports are counted, so that adding or removing
+// test cases doesn't look like a regression, and stages that only took a
+// few milliseconds in total are ignored as they are dominated by noise.
+static bool check_baseline(vector<FileResult> *results)
+{
+	map<string, FileResult*> by_path;
+	double base_totals[NUM_STAGES] = {};
+	double totals[NUM_STAGES] = {};
+	vector<string> lines;
+	vector<int> columns;
+	string data;
+	bool ok = true;
+	unsigned stage;
+	size_t i;
+
+	if (!read_file(args.baseline, &data)) {
+		printf("Unable to read baseline %s\n", args.baseline.c_str());
+		return false;
+	}
+
+	for (FileResult &result : *results)
+		by_path[result.path] = &result;
+
+	lines = split_lines(data);
+	for (i = 0; i < lines.size(); i++) {
+		vector<string> fields;
+		stringstream ss(lines[i]);
+		string field;
+
+		while (getline(ss, field, '\t'))
+			fields.push_back(field);
+
+		if (i == 0) {
+			// Find the columns by name in case stages have been
+			// added or reordered since the baseline was saved:
+			for (stage = 0; stage < NUM_STAGES; stage++) {
+				string name = string(stage_names[stage]) + "_ms";
+				auto col = find(fields.begin(), fields.end(), name);
+				columns.push_back(col == fields.end() ? -1 : (int)(col - fields.begin()));
+			}
+			continue;
+		}
+
+		auto result = by_path.find(fields.empty() ? "" : fields[0]);
+		if (result == by_path.end())
+			continue;
+
+		for (stage = 0; stage < NUM_STAGES; stage++) {
+			if (columns[stage] < 0 || columns[stage] >= (int)fields.size())
+				continue;
+			base_totals[stage] += atof(fields[columns[stage]].c_str());
+			totals[stage] += result->second->stage_ms[stage];
+		}
+	}
+
+	printf("\n=== Comparison with baseline %s (tolerance %.1f%%) ===\n",
+			args.baseline.c_str(), args.tolerance);
+	for (stage = 0; stage < NUM_STAGES; stage++) {
+		if (base_totals[stage] < 10.0)
+			continue;
+		double change = (totals[stage] / base_totals[stage] - 1.0) * 100.0;
+		bool regressed = change > args.tolerance;
+		printf("  %-12s %10.3fs -> %10.3fs  %+7.1f%%%s\n", stage_names[stage],
+				base_totals[stage] / 1000.0, totals[stage] / 1000.0,
+				change, regressed ? "  REGRESSION" : "");
+		if (regressed)
+			ok = false;
+	}
+
+	return ok;
+}
+
+static void print_summary(vector<FileResult> *results, double wall_ms)
+{
+	double stage_totals[NUM_STAGES] = {};
+	size_t counts[NUM_STATUSES] = {};
+	size_t checked = 0;
+	size_t decoded = 0, peak_total = 0, peak_max = 0;
+	unsigned stage, phase;
+
+	for (FileResult &result : *results) {
+		counts[result.status]++;
+		if (result.checked)
+			checked++;
+		for (stage = 0; stage < NUM_STAGES; stage++)
+			stage_totals[stage] += result.stage_ms[stage];
+		if (result.decode_peak_bytes) {
+			decoded++;
+			peak_total += result.decode_peak_bytes;
+			peak_max = max(peak_max, result.decode_peak_bytes);
+		}
+	}
+
+	printf("\n=== Summary: %zu files, %zu passed, %zu failed, %zu known failures, %zu unexpected passes, %zu skipped ===\n",
+			results->size(), counts[STATUS_PASS], counts[STATUS_FAIL],
+			counts[STATUS_XFAIL], counts[STATUS_XPASS], counts[STATUS_SKIP]);
+	printf("  %zu compared against .chk files, %i repeats, %.3fs wall time\n",
+			checked, args.repeat, wall_ms / 1000.0);
+	for (stage = 0; stage < NUM_STAGES; stage++) {
+		if (stage_totals[stage] > 0)
+			printf("  %-12s %10.3fs\n", stage_names[stage], stage_totals[stage] / 1000.0);
+		if (stage == STAGE_DECOMPILE && stage_totals[stage] > 0) {
+			for (phase = 0; phase < NUM_DECOMPILER_PHASES; phase++) {
+				printf("    %-10s %10.3fs\n", DecompilerPhaseNames[phase],
+						decompiler_timings.ms[phase] / 1000.0);
+			}
+		}
+	}
+	if (decoded) {
+		printf("  decode peak heap: %.1f KB mean, %.1f KB max over %zu shaders\n",
+				peak_total / 1024.0 / decoded, peak_max / 1024.0, decoded);
+	}
+	if (decompile_cache.is_open()) {
+		DecompileCacheStats stats = decompile_cache.get_stats();
+		printf("  decompile cache: %u loaded, %u hits, %u misses, %u stored\n",
+				stats.loaded, stats.hits, stats.misses, stats.stores);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	vector<FileResult> results;
+	vector<string> known;
+	bool ok = true;
+
+	parse_args(argc, argv);
+	if (args.verbose)
+		LogFile = stderr;
+
+	known = read_known_failures();
+	if (!args.decompile_cache.empty()) {
+		FILE *fp = fopen(args.decompile_cache.c_str(), "r+b");
+		if (!fp || !decompile_cache.open(fp))
+			fp = fopen(args.decompile_cache.c_str(), "w+b");
+		if (!decompile_cache.is_open() && (!fp || !decompile_cache.open(fp))) {
+			printf("Unable to open decompile cache %s\n", args.decompile_cache.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+	for (string &path : args.paths) {
+		// Absolute paths so that --baseline can match up files from a
+		// report saved from a different working directory:
+		char *abs_path = realpath(path.c_str(), NULL);
+		find_inputs(abs_path ? abs_path : path, &results);
+		free(abs_path);
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	for (FileResult &result : results) {
+		process_file(&result);
+
+		if (result.status != STATUS_SKIP && is_known_failure(known, result.path))
+			result.status = result.status == STATUS_FAIL ? STATUS_XFAIL : STATUS_XPASS;
+		if (result.status == STATUS_FAIL)
+			ok = false;
+
+		if (args.verbose || result.status == STATUS_FAIL || result.status == STATUS_XPASS) {
+			printf("%-5s %s%s%s\n", status_names[result.status], result.path.c_str(),
+					result.error.empty() ? "" : ": ", result.error.c_str());
+		}
+	}
+
+	chrono::duration<double, milli> wall = chrono::steady_clock::now() - start;
+
+	print_summary(&results, wall.count());
+	if (!args.report.empty())
+		write_report(&results);
+	if (!args.baseline.empty() && !check_baseline(&results))
+		ok = false;
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,324 @@
+// symbol_table_tests.cpp : Checks and benchmarks the flat symbol tables
+// (HLSLDecompiler/SymbolTable.h) that the decompiler keeps its register,
+// resource and constant buffer names in.
+//
+// Both an int and a string keyed table are put through a long random
+// sequence of inserts, lookups and erases and checked against a std::map
+// after each step, including that iterating them visits the same entries in
+// the same order, since that order decides the order of declarations in the
+// generated HLSL. Then the kind of lookups the decompiler makes for each
+// operand are timed against a std::map.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "SymbolTable.h"
+
+using namespace std;
+
+static struct {
+	int operations = 200000;
+	int lookups = 2000000;
+	unsigned seed = 1;
+	bool benchmark = true;
+	bool verbose;
+} args;
+
+static void PrintHelp(char *argv0)
+{
+	printf("usage: %s [OPTION]...\n\n", argv0);
+	printf("Checks the decompiler's symbol tables against std::map, then times\n");
+	printf("register name lookups in each.\n\n");
+
+	printf("  -n, --operations N\n");
+	printf("\t\t\tNumber of random inserts, lookups and erases to check (default 200000)\n");
+
+	printf("  -l, --lookups N\n");
+	printf("\t\t\tNumber of lookups to time (default 2000000)\n");
+
+	printf("  --seed N\n");
+	printf("\t\t\tSeed for the random operations (default 1)\n");
+
+	printf("  --no-benchmark\n");
+	printf("\t\t\tOnly run the checks\n");
+
+	printf("  -v, --verbose\n");
+	printf("\t\t\tPrint every mismatch instead of only the first\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+			PrintHelp(argv[0]); // Does not return
+		}
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--operations")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.operations = max(atoi(argv[i]), 0);
+			continue;
+		}
+		if (!strcmp(arg, "-l") || !strcmp(arg, "--lookups")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.lookups = max(atoi(argv[i]), 1);
+			continue;
+		}
+		if (!strcmp(arg, "--seed")) {
+			if (++i >= argc)
+				PrintHelp(argv[0]);
+			args.seed = (unsigned)strtoul(argv[i], NULL, 0);
+			continue;
+		}
+		if (!strcmp(arg, "--no-benchmark")) {
+			args.benchmark = false;
+			continue;
+		}
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			args.verbose = true;
+			continue;
+		}
+		printf("Unrecognised argument: %s\n", arg);
+		PrintHelp(argv[0]); // Does not return
+	}
+}
+
+static mt19937 rng;
+static size_t mismatches;
+
+static void report_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	mismatches++;
+	if (mismatches > 1 && !args.verbose)
+		return;
+
+	printf("MISMATCH ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static string describe(int key)
+{
+	return to_string(key);
+}
+
+static string describe(const string &key)
+{
+	return key;
+}
+
+template <typename Key, typename Value>
+static void compare(const char *step, const SymbolTable<Key, Value> &table, const map<Key, Value> &model)
+{
+	typename map<Key, Value>::const_iterator m = model.begin();
+	typename SymbolTable<Key, Value>::const_iterator t;
+
+	if (table.size() != model.size()) {
+		report_mismatch("%s: table has %zu entries, expected %zu", step, table.size(), model.size());
+		return;
+	}
+	for (t = table.begin(); t != table.end(); ++t, ++m) {
+		if (t->first != m->first || t->second != m->second) {
+			report_mismatch("%s: iterated %s=%s, expected %s=%s", step,
+					describe(t->first).c_str(), describe(t->second).c_str(),
+					describe(m->first).c_str(), describe(m->second).c_str());
+			return;
+		}
+	}
+}
+
+// Keys are drawn from a small range so that the same ones keep coming back
+// after being erased, and the table both grows and has to shift entries
+// back into the holes erases leave in its probe chains:
+template <typename Key, typename Value>
+static void check_table(const char *name, Key (*make_key)(unsigned), Value (*make_value)(unsigned))
+{
+	SymbolTable<Key, Value> table;
+	map<Key, Value> model;
+	char step[64];
+	unsigned range = 1;
+	int i;
+
+	for (i = 0; i < args.operations; i++) {
+		// Widen the range of keys as we go, and occasionally start over:
+		if (i % 1000 == 0)
+			range = min(range * 2, 4096u);
+		if (rng() % 20000 == 0) {
+			table.clear();
+			model.clear();
+			range = 1;
+		}
+
+		Key key = make_key(rng() % range);
+		Value value = make_value(rng());
+		snprintf(step, sizeof(step), "%s step %i", name, i);
+
+		switch (rng() % 6) {
+		case 0: case 1:
+			if (table.insert(key, value) != model.insert(make_pair(key, value)).second)
+				report_mismatch("%s: insert %s disagreed on whether it was new", step, describe(key).c_str());
+			break;
+		case 2:
+			table[key] = value;
+			model[key] = value;
+			break;
+		case 3:
+			if (table.erase(key) != model.erase(key))
+				report_mismatch("%s: erase %s disagreed on whether it was present", step, describe(key).c_str());
+			break;
+		default: {
+			typename SymbolTable<Key, Value>::iterator t = table.find(key);
+			typename map<Key, Value>::iterator m = model.find(key);
+			if ((t == table.end()) != (m == model.end()))
+				report_mismatch("%s: find %s disagreed on whether it was present", step, describe(key).c_str());
+			else if (t != table.end() && t->second != m->second)
+				report_mismatch("%s: find %s found %s, expected %s", step, describe(key).c_str(),
+						describe(t->second).c_str(), describe(m->second).c_str());
+			break;
+		}
+		}
+
+		// Iterating sorts the table, so only do it now and then to keep
+		// most of the operations running on an unsorted one:
+		if (i % 97 == 0)
+			compare(step, table, model);
+	}
+	compare(name, table, model);
+}
+
+static int int_key(unsigned n)
+{
+	// Spread like constant buffer keys, (register << 16) + offset, plus
+	// the -1 register used for the immediate constant buffer:
+	return ((int)(n % 16) - 1) * 65536 + (int)(n / 16) * 4;
+}
+
+static int int_value(unsigned n)
+{
+	return (int)n;
+}
+
+static string string_key(unsigned n)
+{
+	static const char *prefixes[] = { "r", "v", "o", "cb", "x", "w", "p" };
+	static const char components[] = "xyzw";
+
+	string key = prefixes[n % 7] + to_string(n / 35);
+	if (n / 7 % 5)
+		key += string(".") + components[n / 7 % 5 - 1];
+	return key;
+}
+
+static string string_value(unsigned n)
+{
+	return "value" + to_string(n % 1000);
+}
+
+// The sets only offer what the decompiler needs of them:
+static void check_set()
+{
+	SymbolSet<string> table;
+	set<string> model;
+	char key[32];
+	int i;
+
+	for (i = 0; i < args.operations; i++) {
+		snprintf(key, sizeof(key), "r%u.%c", (unsigned)(rng() % 64), "xyzw"[rng() % 4]);
+		switch (rng() % 3) {
+		case 0:
+			if (table.insert(key) != model.insert(key).second)
+				report_mismatch("set step %i: insert %s disagreed on whether it was new", i, key);
+			break;
+		case 1:
+			if (table.erase(key) != model.erase(key))
+				report_mismatch("set step %i: erase %s disagreed on whether it was present", i, key);
+			break;
+		default:
+			if (table.count(key) != model.count(key))
+				report_mismatch("set step %i: count %s disagreed on whether it was present", i, key);
+			break;
+		}
+		if (table.size() != model.size() || table.empty() != model.empty())
+			report_mismatch("set step %i: set has %zu entries, expected %zu", i, table.size(), model.size());
+	}
+}
+
+// Times looking up register names read out of a statement, which is what
+// the decompiler does for most operands. The std::map needs a std::string
+// made for each lookup, the symbol table can take the char* directly:
+static void benchmark()
+{
+	SymbolTable<string, string> table;
+	map<string, string> model;
+	vector<string> names;
+	size_t found = 0;
+	char name[32];
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		string key = string_key(rng() % 4096);
+		table[key] = key;
+		model[key] = key;
+		names.push_back(key);
+	}
+	for (i = 0; i < 200; i++)
+		names.push_back(string_key(rng() % 4096));
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (i = 0; i < args.lookups; i++) {
+		strcpy(name, names[i % names.size()].c_str());
+		found += model.find(name) != model.end();
+	}
+	chrono::duration<double, milli> map_ms = chrono::steady_clock::now() - start;
+
+	start = chrono::steady_clock::now();
+	for (i = 0; i < args.lookups; i++) {
+		strcpy(name, names[i % names.size()].c_str());
+		found += table.find(name) != table.end();
+	}
+	chrono::duration<double, milli> table_ms = chrono::steady_clock::now() - start;
+
+	printf("%i register name lookups (%zu hits):\n", args.lookups, found / 2);
+	printf("  std::map      %10.3fms\n", map_ms.count());
+	printf("  SymbolTable   %10.3fms  (%.1fx)\n", table_ms.count(), map_ms.count() / table_ms.count());
+}
+
+int main(int argc, char *argv[])
+{
+	parse_args(argc, argv);
+	rng.seed(args.seed);
+
+	check_table("int table", int_key, int_value);
+	check_table("string table", string_key, string_value);
+	check_set();
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+
+	if (args.benchmark)
+		benchmark();
+
+	return EXIT_SUCCESS;
+}
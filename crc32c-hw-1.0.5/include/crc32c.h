@@ -12,6 +12,7 @@
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 /*
     Computes CRC-32C using Castagnoli polynomial of 0x82f63b78.
@@ -24,6 +25,28 @@ extern "C" CRC32C_API uint32_t crc32c_append(
     const uint8_t *input,       // data to be put through the CRC algorithm
     size_t length);             // length of the data in the input buffer
 
+/*
+    Computes the CRC of two buffers appended to one another from their individual CRCs, where crc2
+    was calculated with an initial CRC of 0. This allows a buffer to be hashed in several pieces at
+    once and give the same result as hashing it with a single call to crc32c_append().
+*/
+extern "C" CRC32C_API uint32_t crc32c_combine(
+    uint32_t crc1,              // CRC of the first buffer, with any initial CRC
+    uint32_t crc2,              // CRC of the second buffer, with an initial CRC of 0
+    size_t length2);            // length of the second buffer
+
+/*
+    The implementations that crc32c_append() chooses between, fastest last, so that they can be
+    checked against each other and benchmarked. append is NULL for any that the CPU or compiler
+    does not support. All of them give identical results.
+*/
+struct crc32c_implementation
+{
+    const char *name;
+    uint32_t (*append)(uint32_t crc, const uint8_t *input, size_t length);
+};
+extern "C" CRC32C_API const crc32c_implementation *crc32c_implementations(size_t *count);
+
 extern "C" CRC32C_API void crc32c_unittest();
 uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32 = 0);
 #endif
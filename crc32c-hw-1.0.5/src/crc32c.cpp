@@ -24,15 +24,38 @@
 
 #include "crc32c.h"
 
-#define NOMINMAX
-#include <windows.h>
+#ifdef _WIN32
+#include <intrin.h> // For __cpuid() under VS2017 -DarkStarSword
+#else
+#include <cpuid.h>
+#endif
 
 #include <nmmintrin.h>
-#include <intrin.h> // For __cpuid() under VS2017 -DarkStarSword
+#include <wmmintrin.h>
+#include <immintrin.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <random>
 #include <algorithm>
+#include <chrono>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CRC32C_X64
+#endif
+
+/* MSVC allows any intrinsic to be used anywhere, GCC and Clang need to be
+   told which functions may use instructions beyond the baseline */
+#ifdef _MSC_VER
+#define CRC32C_TARGET(isa)
+#else
+#define CRC32C_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* The AVX-512 VPCLMULQDQ intrinsics first shipped in VS2019 */
+#if defined(CRC32C_X64) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1920))
+#define CRC32C_VPCLMUL
+#endif
 
 
 typedef const uint8_t *buffer;
@@ -94,14 +117,14 @@ static uint32_t append_adler_table(uint32_t crci, buffer input, size_t length)
 static uint32_t append_table(uint32_t crci, buffer input, size_t length)
 {
     buffer next = input;
-#ifdef _M_X64
+#ifdef CRC32C_X64
     uint64_t crc;
 #else
     uint32_t crc;
 #endif
 
     crc = crci ^ 0xffffffff;
-#ifdef _M_X64
+#ifdef CRC32C_X64
     while (length && ((uintptr_t)next & 7) != 0)
     {
         crc = table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
@@ -175,11 +198,12 @@ static inline uint32_t shift_crc(uint32_t shift_table[][256], uint32_t crc)
 }
 
 /* Compute CRC-32C using the Intel hardware instruction. */
+CRC32C_TARGET("sse4.2")
 static uint32_t append_hw(uint32_t crc, buffer buf, size_t len)
 {
     buffer next = buf;
     buffer end;
-#ifdef _M_X64
+#ifdef CRC32C_X64
     uint64_t crc0, crc1, crc2;      /* need to be 64 bits for crc32q */
 #else
     uint32_t crc0, crc1, crc2;
@@ -197,7 +221,7 @@ static uint32_t append_hw(uint32_t crc, buffer buf, size_t len)
         --len;
     }
 
-#ifdef _M_X64
+#ifdef CRC32C_X64
     /* compute the crc on sets of LONG_SHIFT*3 bytes, executing three independent crc
        instructions, each on LONG_SHIFT bytes -- this is optimized for the Nehalem,
        Westmere, Sandy Bridge, and Ivy Bridge architectures, which have a
@@ -314,21 +338,469 @@ static uint32_t append_hw(uint32_t crc, buffer buf, size_t len)
     return static_cast<uint32_t>(crc0) ^ 0xffffffff;
 }
 
+#ifdef CRC32C_X64
+/* Carry-less multiplication folding, as described in Intel's "Fast CRC
+   Computation for Generic Polynomials Using PCLMULQDQ Instruction". Rather
+   than feeding the message through the crc32 instruction eight bytes at a
+   time, the message is kept as a set of independent 128 bit remainders, one
+   per stream. Each step multiplies every remainder by x^n mod P (where n is
+   the distance to the next block of its stream) and XORs in that block,
+   which leaves a value that is congruent to the message so far modulo P. The
+   streams are folded into one another at the end, and the final 128 bits are
+   reduced with the crc32 instruction, so the result is bit-identical to
+   append_hw() and append_table().
+
+   The constants are x^(n+63) mod P for the low quadword and x^(n-1) mod P for
+   the high quadword, bit-reflected into the top half of a quadword, which
+   places the 127 bit product back in the same bit order as the data. */
+#define FOLD_128_LO  0x3743f7bd00000000ull
+#define FOLD_128_HI  0x3171d43000000000ull
+#define FOLD_256_LO  0x33ccbbbc00000000ull
+#define FOLD_256_HI  0xa2158b3400000000ull
+#define FOLD_512_LO  0x1c19243b00000000ull
+#define FOLD_512_HI  0x75bba45b00000000ull
+#define FOLD_1024_LO 0x6577b24500000000ull
+#define FOLD_1024_HI 0x7417153f00000000ull
+#define FOLD_2048_LO 0xe9a5d8be00000000ull
+#define FOLD_2048_HI 0x1426a81500000000ull
+
+/* The crc32 instruction and PCLMULQDQ execute on different ports, so
+   append_pclmul() runs three crc32 streams alongside four folding streams.
+   Each chunk is laid out as the folded part followed by one HYBRID_SHIFT
+   byte block per crc32 stream, and the crc32 streams are appended to the
+   result of the folding with shift_crc_clmul(). HYBRID_SHIFT_K is
+   x^(8*HYBRID_SHIFT-33) mod P, bit-reflected. */
+#define HYBRID_ITERATIONS 64
+#define HYBRID_FOLD (64 * HYBRID_ITERATIONS)
+#define HYBRID_SHIFT (16 * HYBRID_ITERATIONS)
+#define HYBRID_SHIFT_K 0x170076fa
+#define HYBRID_CHUNK (HYBRID_FOLD + 3 * HYBRID_SHIFT)
+
+/* Below these the setup and final reduction cost more than the folding saves */
+#define PCLMUL_MIN_LENGTH 256
+#define VPCLMUL_MIN_LENGTH 1024
+
+CRC32C_TARGET("sse4.2,pclmul")
+static inline __m128i fold_128(__m128i x, __m128i k, __m128i data)
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), data);
+}
+
+/* Reduce a folded remainder to a (pre-processed) CRC */
+CRC32C_TARGET("sse4.2,pclmul")
+static inline uint32_t fold_reduce(__m128i x)
+{
+    uint64_t crc;
+
+    crc = _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(x)));
+    crc = _mm_crc32_u64(crc, static_cast<uint64_t>(_mm_extract_epi64(x, 1)));
+    return static_cast<uint32_t>(crc);
+}
+
+/* Fold in any whole 16 byte blocks left over from a wider loop, then reduce
+   the remainder and finish off the last few bytes with the crc32 instruction */
+CRC32C_TARGET("sse4.2,pclmul")
+static inline uint32_t fold_finish(__m128i x, buffer next, size_t len)
+{
+    __m128i k128 = _mm_set_epi64x(FOLD_128_HI, FOLD_128_LO);
+
+    while (len >= 16)
+    {
+        x = fold_128(x, k128, _mm_loadu_si128(reinterpret_cast<const __m128i *>(next)));
+        next += 16;
+        len -= 16;
+    }
+
+    return append_hw(fold_reduce(x) ^ 0xffffffff, next, len);
+}
+
+/* Multiply a pre-processed CRC by x^(8n) mod P, where k is x^(8n-33) mod P,
+   which is the same as appending n zero bytes */
+CRC32C_TARGET("sse4.2,pclmul")
+static inline uint32_t shift_crc_clmul(uint32_t crc, uint32_t k)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)), _mm_cvtsi32_si128(static_cast<int>(k)), 0x00);
+    return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+/* Compute CRC-32C by folding four 16 byte streams with PCLMULQDQ while the
+   crc32 instruction works through three more */
+CRC32C_TARGET("sse4.2,pclmul")
+static uint32_t append_pclmul(uint32_t crc, buffer buf, size_t len)
+{
+    buffer next = buf;
+    __m128i k512 = _mm_set_epi64x(FOLD_512_HI, FOLD_512_LO);
+    __m128i k128 = _mm_set_epi64x(FOLD_128_HI, FOLD_128_LO);
+    __m128i x0, x1, x2, x3;
+    uint64_t crc0, crc1, crc2;
+    const __m128i *fold;
+    buffer stream, end;
+
+    if (len < PCLMUL_MIN_LENGTH)
+        return append_hw(crc, buf, len);
+
+    crc = crc ^ 0xffffffff;
+
+    while (len >= HYBRID_CHUNK)
+    {
+        fold = reinterpret_cast<const __m128i *>(next);
+        stream = next + HYBRID_FOLD;
+        end = stream + HYBRID_SHIFT;
+
+        /* The initial CRC is equivalent to XORing it into the first four bytes */
+        x0 = _mm_xor_si128(_mm_loadu_si128(fold), _mm_cvtsi32_si128(static_cast<int>(crc)));
+        x1 = _mm_loadu_si128(fold + 1);
+        x2 = _mm_loadu_si128(fold + 2);
+        x3 = _mm_loadu_si128(fold + 3);
+        fold += 4;
+        crc0 = crc1 = crc2 = 0;
+
+        do
+        {
+            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t *>(stream));
+            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t *>(stream + HYBRID_SHIFT));
+            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t *>(stream + 2 * HYBRID_SHIFT));
+            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t *>(stream + 8));
+            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t *>(stream + HYBRID_SHIFT + 8));
+            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t *>(stream + 2 * HYBRID_SHIFT + 8));
+            stream += 16;
+            if (stream == end)
+                break;
+            x0 = fold_128(x0, k512, _mm_loadu_si128(fold));
+            x1 = fold_128(x1, k512, _mm_loadu_si128(fold + 1));
+            x2 = fold_128(x2, k512, _mm_loadu_si128(fold + 2));
+            x3 = fold_128(x3, k512, _mm_loadu_si128(fold + 3));
+            fold += 4;
+        } while (true);
+
+        x1 = fold_128(x0, k128, x1);
+        x2 = fold_128(x1, k128, x2);
+        x3 = fold_128(x2, k128, x3);
+
+        crc = fold_reduce(x3);
+        crc = shift_crc_clmul(crc, HYBRID_SHIFT_K) ^ static_cast<uint32_t>(crc0);
+        crc = shift_crc_clmul(crc, HYBRID_SHIFT_K) ^ static_cast<uint32_t>(crc1);
+        crc = shift_crc_clmul(crc, HYBRID_SHIFT_K) ^ static_cast<uint32_t>(crc2);
+
+        next += HYBRID_CHUNK;
+        len -= HYBRID_CHUNK;
+    }
+
+    if (len < 64)
+        return append_hw(crc ^ 0xffffffff, next, len);
+
+    fold = reinterpret_cast<const __m128i *>(next);
+    x0 = _mm_xor_si128(_mm_loadu_si128(fold), _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x1 = _mm_loadu_si128(fold + 1);
+    x2 = _mm_loadu_si128(fold + 2);
+    x3 = _mm_loadu_si128(fold + 3);
+    fold += 4;
+    len -= 64;
+
+    while (len >= 64)
+    {
+        x0 = fold_128(x0, k512, _mm_loadu_si128(fold));
+        x1 = fold_128(x1, k512, _mm_loadu_si128(fold + 1));
+        x2 = fold_128(x2, k512, _mm_loadu_si128(fold + 2));
+        x3 = fold_128(x3, k512, _mm_loadu_si128(fold + 3));
+        fold += 4;
+        len -= 64;
+    }
+
+    x1 = fold_128(x0, k128, x1);
+    x2 = fold_128(x1, k128, x2);
+    x3 = fold_128(x2, k128, x3);
+
+    return fold_finish(x3, reinterpret_cast<buffer>(fold), len);
+}
+
+#ifdef CRC32C_VPCLMUL
+CRC32C_TARGET("avx2,vpclmulqdq")
+static inline __m256i fold_256(__m256i x, __m256i k, __m256i data)
+{
+    __m256i lo = _mm256_clmulepi64_epi128(x, k, 0x00);
+    __m256i hi = _mm256_clmulepi64_epi128(x, k, 0x11);
+    return _mm256_xor_si256(_mm256_xor_si256(lo, hi), data);
+}
+
+/* Compute CRC-32C by folding eight 16 byte streams, two to a register, with
+   the AVX2 version of PCLMULQDQ (Zen 3, Alder Lake and later) */
+CRC32C_TARGET("sse4.2,pclmul,avx2,vpclmulqdq")
+static uint32_t append_vpclmul_avx2(uint32_t crc, buffer buf, size_t len)
+{
+    buffer next = buf;
+    __m256i k1024 = _mm256_set_epi64x(FOLD_1024_HI, FOLD_1024_LO, FOLD_1024_HI, FOLD_1024_LO);
+    __m256i k256 = _mm256_set_epi64x(FOLD_256_HI, FOLD_256_LO, FOLD_256_HI, FOLD_256_LO);
+    __m128i k128 = _mm_set_epi64x(FOLD_128_HI, FOLD_128_LO);
+    __m256i x0, x1, x2, x3;
+    __m128i x;
+
+    if (len < VPCLMUL_MIN_LENGTH)
+        return append_pclmul(crc, buf, len);
+
+    x0 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(next)), _mm256_castsi128_si256(_mm_cvtsi32_si128(static_cast<int>(crc ^ 0xffffffff))));
+    x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next + 32));
+    x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next + 64));
+    x3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next + 96));
+    next += 128;
+    len -= 128;
+
+    while (len >= 128)
+    {
+        x0 = fold_256(x0, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next)));
+        x1 = fold_256(x1, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next + 32)));
+        x2 = fold_256(x2, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next + 64)));
+        x3 = fold_256(x3, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next + 96)));
+        next += 128;
+        len -= 128;
+    }
+
+    x1 = fold_256(x0, k256, x1);
+    x2 = fold_256(x1, k256, x2);
+    x3 = fold_256(x2, k256, x3);
+
+    x = fold_128(_mm256_castsi256_si128(x3), k128, _mm256_extracti128_si256(x3, 1));
+
+    return fold_finish(x, next, len);
+}
+
+CRC32C_TARGET("avx512f,vpclmulqdq")
+static inline __m512i fold_512(__m512i x, __m512i k, __m512i data)
+{
+    __m512i lo = _mm512_clmulepi64_epi128(x, k, 0x00);
+    __m512i hi = _mm512_clmulepi64_epi128(x, k, 0x11);
+    return _mm512_ternarylogic_epi64(lo, hi, data, 0x96); /* lo ^ hi ^ data */
+}
+
+/* Compute CRC-32C by folding sixteen 16 byte streams, four to a register,
+   with the AVX-512 version of PCLMULQDQ (Ice Lake, Zen 4 and later) */
+CRC32C_TARGET("sse4.2,pclmul,avx512f,vpclmulqdq")
+static uint32_t append_vpclmul_avx512(uint32_t crc, buffer buf, size_t len)
+{
+    buffer next = buf;
+    __m512i k2048 = _mm512_set4_epi64(FOLD_2048_HI, FOLD_2048_LO, FOLD_2048_HI, FOLD_2048_LO);
+    __m512i k512 = _mm512_set4_epi64(FOLD_512_HI, FOLD_512_LO, FOLD_512_HI, FOLD_512_LO);
+    __m128i k128 = _mm_set_epi64x(FOLD_128_HI, FOLD_128_LO);
+    __m512i x0, x1, x2, x3;
+    __m128i x;
+
+    if (len < VPCLMUL_MIN_LENGTH)
+        return append_pclmul(crc, buf, len);
+
+    x0 = _mm512_xor_si512(_mm512_loadu_si512(next), _mm512_castsi128_si512(_mm_cvtsi32_si128(static_cast<int>(crc ^ 0xffffffff))));
+    x1 = _mm512_loadu_si512(next + 64);
+    x2 = _mm512_loadu_si512(next + 128);
+    x3 = _mm512_loadu_si512(next + 192);
+    next += 256;
+    len -= 256;
+
+    while (len >= 256)
+    {
+        x0 = fold_512(x0, k2048, _mm512_loadu_si512(next));
+        x1 = fold_512(x1, k2048, _mm512_loadu_si512(next + 64));
+        x2 = fold_512(x2, k2048, _mm512_loadu_si512(next + 128));
+        x3 = fold_512(x3, k2048, _mm512_loadu_si512(next + 192));
+        next += 256;
+        len -= 256;
+    }
+
+    x1 = fold_512(x0, k512, x1);
+    x2 = fold_512(x1, k512, x2);
+    x3 = fold_512(x2, k512, x3);
+
+    x = fold_128(_mm512_castsi512_si128(x3), k128, _mm512_extracti32x4_epi32(x3, 1));
+    x = fold_128(x, k128, _mm512_extracti32x4_epi32(x3, 2));
+    x = fold_128(x, k128, _mm512_extracti32x4_epi32(x3, 3));
+
+    return fold_finish(x, next, len);
+}
+#endif /* CRC32C_VPCLMUL */
+#endif /* CRC32C_X64 */
+
+static void cpuid(int info[4], int leaf)
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, 0);
+#else
+    __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+/* Which extended register state the OS saves on a context switch */
+static uint64_t xgetbv()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
 static bool detect_hw()
 {
     int info[4];
-    __cpuid(info, 1);
+    cpuid(info, 1);
     return (info[2] & (1 << 20)) != 0;
 }
 
-static bool hw_available = detect_hw();
+static bool detect_pclmul()
+{
+    int info[4];
+    cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0 && (info[2] & (1 << 1)) != 0;
+}
+
+/* OSXSAVE, the OS saves the given register state (SSE & AVX, and optionally
+   AVX-512), and the given leaf 7 feature bits */
+static bool detect_avx(uint64_t xcr0_mask, int leaf7_ebx, int leaf7_ecx)
+{
+    int info[4];
+
+    cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (xgetbv() & xcr0_mask) != xcr0_mask)
+        return false;
+
+    cpuid(info, 7);
+    return (info[1] & leaf7_ebx) == leaf7_ebx && (info[2] & leaf7_ecx) == leaf7_ecx;
+}
+
+/* AVX2 and VPCLMULQDQ */
+static bool detect_vpclmul_avx2()
+{
+    return detect_pclmul() && detect_avx(0x6, 1 << 5, 1 << 10);
+}
+
+/* AVX-512F and VPCLMULQDQ */
+static bool detect_vpclmul_avx512()
+{
+    return detect_pclmul() && detect_avx(0xe6, 1 << 16, 1 << 10);
+}
+
+typedef uint32_t(*append_fn)(uint32_t, buffer, size_t);
+
+/* Short buffers (most of the descriptions and constant buffers that get
+   hashed) are quicker with the crc32 instruction alone than they are going
+   through the size checks of the folding implementations */
+#define SHORT_LENGTH 256
+
+static append_fn select_append(bool short_buffers)
+{
+#ifdef CRC32C_VPCLMUL
+    if (!short_buffers && detect_vpclmul_avx512())
+        return append_vpclmul_avx512;
+    if (!short_buffers && detect_vpclmul_avx2())
+        return append_vpclmul_avx2;
+#endif
+#ifdef CRC32C_X64
+    if (!short_buffers && detect_pclmul())
+        return append_pclmul;
+#endif
+    if (detect_hw())
+        return append_hw;
+    return append_table;
+}
+
+/* The first call picks the fastest implementations the CPU supports. These
+   are constant initialised so that it is safe to call from other static
+   constructors, and racing first calls just pick the same functions twice. */
+static uint32_t append_first(uint32_t crc, buffer input, size_t length);
+static append_fn append_short = append_first;
+static append_fn append_long = append_first;
+
+static uint32_t append_first(uint32_t crc, buffer input, size_t length)
+{
+    append_short = select_append(true);
+    append_long = select_append(false);
+    return crc32c_append(crc, input, length);
+}
 
 extern "C" CRC32C_API uint32_t crc32c_append(uint32_t crc, buffer input, size_t length)
 {
-    if (hw_available)
-        return append_hw(crc, input, length);
-    else
-        return append_table(crc, input, length);
+    if (length < SHORT_LENGTH)
+        return append_short(crc, input, length);
+    return append_long(crc, input, length);
+}
+
+/* Multiply two bit-reflected polynomials modulo P, as in zlib's crc32_combine() */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^(8*2^k) mod P, i.e. the operator to append 2^k zero bytes */
+static const uint32_t zeroes_operators[64] =
+{
+    0x00800000, 0x00008000, 0x82f63b78, 0x6ea2d55c,
+    0x18b8ea18, 0x510ac59a, 0xb82be955, 0xb8fdb1e7,
+    0x88e56f72, 0x74c360a4, 0xe4172b16, 0x0d65762a,
+    0x35d73a62, 0x28461564, 0xbf455269, 0xe2ea32dc,
+    0xfe7740e6, 0xf946610b, 0x3c204f8f, 0x538586e3,
+    0x59726915, 0x734d5309, 0xbc1ac763, 0x7d0722cc,
+    0xd289cabe, 0xe94ca9bc, 0x05b74f3f, 0xa51e1f42,
+    0x40000000, 0x20000000, 0x08000000, 0x00800000,
+    0x00008000, 0x82f63b78, 0x6ea2d55c, 0x18b8ea18,
+    0x510ac59a, 0xb82be955, 0xb8fdb1e7, 0x88e56f72,
+    0x74c360a4, 0xe4172b16, 0x0d65762a, 0x35d73a62,
+    0x28461564, 0xbf455269, 0xe2ea32dc, 0xfe7740e6,
+    0xf946610b, 0x3c204f8f, 0x538586e3, 0x59726915,
+    0x734d5309, 0xbc1ac763, 0x7d0722cc, 0xd289cabe,
+    0xe94ca9bc, 0x05b74f3f, 0xa51e1f42, 0x40000000,
+    0x20000000, 0x08000000, 0x00800000, 0x00008000,
+};
+
+extern "C" CRC32C_API uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t length2)
+{
+    uint32_t op = 1u << 31; /* x^0 */
+    int k;
+
+    for (k = 0; length2; k++, length2 >>= 1)
+        if (length2 & 1)
+            op = multmodp(zeroes_operators[k], op);
+
+    return multmodp(op, crc1) ^ crc2;
+}
+
+extern "C" CRC32C_API const crc32c_implementation *crc32c_implementations(size_t *count)
+{
+    static crc32c_implementation implementations[] =
+    {
+        { "trivial", append_trivial },
+        { "adler_table", append_adler_table },
+        { "table", append_table },
+        { "hw", detect_hw() ? append_hw : NULL },
+#ifdef CRC32C_X64
+        { "pclmul", detect_pclmul() ? append_pclmul : NULL },
+#endif
+#ifdef CRC32C_VPCLMUL
+        { "vpclmul_avx2", detect_vpclmul_avx2() ? append_vpclmul_avx2 : NULL },
+        { "vpclmul_avx512", detect_vpclmul_avx512() ? append_vpclmul_avx512 : NULL },
+#endif
+    };
+
+    *count = sizeof(implementations) / sizeof(implementations[0]);
+    return implementations;
 }
 
 #define TEST_BUFFER 65536
@@ -336,13 +808,13 @@ extern "C" CRC32C_API uint32_t crc32c_append(uint32_t crc, buffer input, size_t
 
 static int benchmark(const char *name, uint32_t(*function)(uint32_t, buffer, size_t), buffer input, int *offsets, int *lengths, uint32_t *crcs)
 {
-    uint64_t startTime = GetTickCount64();
+    auto startTime = std::chrono::steady_clock::now();
     int slice = 0;
     uint64_t totalBytes = 0;
     bool first = true;
     int iterations = 0;
     uint32_t crc = 0;
-    while (GetTickCount64() - startTime < 1000)
+    while (std::chrono::steady_clock::now() - startTime < std::chrono::seconds(1))
     {
         crc = function(crc, input + offsets[slice], lengths[slice]);
         totalBytes += lengths[slice];
@@ -356,7 +828,7 @@ static int benchmark(const char *name, uint32_t(*function)(uint32_t, buffer, siz
             first = false;
         }
     }
-    int time = static_cast<int>(GetTickCount64() - startTime);
+    int time = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count());
     double throughput = totalBytes * 1000.0 / time;
     printf("%s: ", name);
     if (throughput > 1024.0 * 1024.0 * 1024.0)
@@ -396,15 +868,41 @@ extern "C" CRC32C_API void crc32c_unittest()
     uint32_t *crcsAdlerTable = new uint32_t[TEST_SLICES];
     uint32_t *crcsTable = new uint32_t[TEST_SLICES];
     uint32_t *crcsHw = new uint32_t[TEST_SLICES];
+    uint32_t *crcsFold = new uint32_t[TEST_SLICES];
     int iterationsTrivial = benchmark("trivial", append_trivial, input, offsets, lengths, crcsTrivial);
     int iterationsAdlerTable = benchmark("adler_table", append_adler_table, input, offsets, lengths, crcsAdlerTable);
     compare_crcs("trivial", crcsTrivial, "adler_table", crcsAdlerTable, std::min(iterationsTrivial, iterationsAdlerTable));
     int iterationsTable = benchmark("table", append_table, input, offsets, lengths, crcsTable);
     compare_crcs("adler_table", crcsAdlerTable, "table", crcsTable, std::min(iterationsAdlerTable, iterationsTable));
-    if (hw_available)
+    if (detect_hw())
     {
         int iterationsHw = benchmark("hw", append_hw, input, offsets, lengths, crcsHw);
         compare_crcs("table", crcsTable, "hw", crcsHw, std::min(iterationsTable, iterationsHw));
+#ifdef CRC32C_X64
+        if (detect_pclmul())
+        {
+            int iterationsFold = benchmark("pclmul", append_pclmul, input, offsets, lengths, crcsFold);
+            compare_crcs("hw", crcsHw, "pclmul", crcsFold, std::min(iterationsHw, iterationsFold));
+        }
+        else
+            printf("HW doesn't have pclmulqdq instruction\n");
+#endif
+#ifdef CRC32C_VPCLMUL
+        if (detect_vpclmul_avx2())
+        {
+            int iterationsFold = benchmark("vpclmul_avx2", append_vpclmul_avx2, input, offsets, lengths, crcsFold);
+            compare_crcs("hw", crcsHw, "vpclmul_avx2", crcsFold, std::min(iterationsHw, iterationsFold));
+        }
+        else
+            printf("HW doesn't have AVX2 vpclmulqdq instruction\n");
+        if (detect_vpclmul_avx512())
+        {
+            int iterationsFold = benchmark("vpclmul_avx512", append_vpclmul_avx512, input, offsets, lengths, crcsFold);
+            compare_crcs("hw", crcsHw, "vpclmul_avx512", crcsFold, std::min(iterationsHw, iterationsFold));
+        }
+        else
+            printf("HW doesn't have AVX-512 vpclmulqdq instruction\n");
+#endif
     }
     else
         printf("HW doesn't have crc instruction\n");
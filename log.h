@@ -16,21 +16,103 @@ extern bool gLogDebug;
 // probably not worth doing so unless we were switching to use a central
 // logging framework.
 
+#include <stdarg.h>
+
+// The decompiler and assembler libraries are built once for every program
+// that links them, without MIGOTO_DX, so they can't call the DirectX 11 DLL's
+// async functions below. Instead the DLL points this at one of them while
+// [Logging] async is on, and their LogInfo and LogDebug go through it rather
+// than to LogFile behind the background thread's back. It lives in an inline
+// function so that the libraries and the DLL share the one copy without any
+// of the other programs having to define it:
+typedef void (*LogRedirect_t)(const char *fmt, va_list va_args);
+
+inline LogRedirect_t& LogRedirect()
+{
+	static LogRedirect_t redirect;
+	return redirect;
+}
+
+inline void LogRedirectf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	LogRedirect()(fmt, ap);
+	va_end(ap);
+}
+
+#if MIGOTO_DX == 11
+// The DirectX 11 DLL hands messages to a background thread to write once
+// [Logging] async has started it, see DirectX11/AsyncLog.h. Until then, and in
+// everything else that uses this header, they are written to LogFile directly.
+extern bool gLogAsync;
+
+void StartAsyncLogging(FILE *fp);
+void AsyncLogInfo(const char *fmt, ...);
+void vAsyncLogInfo(const char *fmt, va_list va_args);
+void AsyncLogInfoW(const wchar_t *fmt, ...);
+void vAsyncLogInfoW(const wchar_t *fmt, va_list va_args);
+void AsyncLogWrite(const void *buf, size_t size);
+void AsyncLogFlush();
+void AsyncLogFlushLater();
+void AsyncLogFlushAfterCrash();
+void AsyncLogClose();
+
 #define LogInfo(fmt, ...) \
-	do { if (LogFile) fprintf(LogFile, fmt, __VA_ARGS__); } while (0)
+	do { if (LogFile) { if (gLogAsync) AsyncLogInfo(fmt, ##__VA_ARGS__); else fprintf(LogFile, fmt, ##__VA_ARGS__); } } while (0)
 #define vLogInfo(fmt, va_args) \
-	do { if (LogFile) vfprintf(LogFile, fmt, va_args); } while (0)
+	do { if (LogFile) { if (gLogAsync) vAsyncLogInfo(fmt, va_args); else vfprintf(LogFile, fmt, va_args); } } while (0)
 #define LogInfoW(fmt, ...) \
-	do { if (LogFile) fwprintf(LogFile, fmt, __VA_ARGS__); } while (0)
+	do { if (LogFile) { if (gLogAsync) AsyncLogInfoW(fmt, ##__VA_ARGS__); else fwprintf(LogFile, fmt, ##__VA_ARGS__); } } while (0)
+#define vLogInfoW(fmt, va_args) \
+	do { if (LogFile) { if (gLogAsync) vAsyncLogInfoW(fmt, va_args); else vfwprintf(LogFile, fmt, va_args); } } while (0)
+
+#define LogWrite(buf, size) \
+	do { if (LogFile) { if (gLogAsync) AsyncLogWrite(buf, size); else fwrite(buf, 1, size, LogFile); } } while (0)
+#define LogFlush() \
+	do { if (LogFile) { if (gLogAsync) AsyncLogFlush(); else fflush(LogFile); } } while (0)
+#define LogFlushLater() \
+	do { if (LogFile) { if (gLogAsync) AsyncLogFlushLater(); else fflush(LogFile); } } while (0)
+#define LogFlushAfterCrash() \
+	do { if (LogFile) { if (gLogAsync) AsyncLogFlushAfterCrash(); fflush(LogFile); } } while (0)
+#define LogClose() \
+	do { if (LogFile) { if (gLogAsync) AsyncLogClose(); fclose(LogFile); LogFile = 0; } } while (0)
+#else
+#define LogInfo(fmt, ...) \
+	do { if (LogFile) { if (LogRedirect()) LogRedirectf(fmt, ##__VA_ARGS__); else fprintf(LogFile, fmt, ##__VA_ARGS__); } } while (0)
+#define vLogInfo(fmt, va_args) \
+	do { if (LogFile) { if (LogRedirect()) LogRedirect()(fmt, va_args); else vfprintf(LogFile, fmt, va_args); } } while (0)
+#define LogInfoW(fmt, ...) \
+	do { if (LogFile) fwprintf(LogFile, fmt, ##__VA_ARGS__); } while (0)
 #define vLogInfoW(fmt, va_args) \
 	do { if (LogFile) vfwprintf(LogFile, fmt, va_args); } while (0)
 
+#define LogWrite(buf, size) \
+	do { if (LogFile) fwrite(buf, 1, size, LogFile); } while (0)
+#define LogFlush() \
+	do { if (LogFile) fflush(LogFile); } while (0)
+#define LogFlushLater LogFlush
+#define LogFlushAfterCrash LogFlush
+#define LogClose() \
+	do { if (LogFile) { fclose(LogFile); LogFile = 0; } } while (0)
+#endif
+
+// LogWrite() writes size bytes to the log as they are, such as a compiler's
+// messages. LogFlush() waits until everything logged so far is in the file, in
+// case the process is about to hang or exit. LogFlushLater() is called every
+// frame to bound how far behind the file can get, and only nudges the
+// background thread if there is one. LogFlushAfterCrash() is for the crash
+// handler, where the background thread may be the one that crashed, and
+// switches to writing directly to the file. LogClose() writes out anything
+// left and closes the file.
+
 #define LogDebug(fmt, ...) \
-	do { if (gLogDebug) LogInfo(fmt, __VA_ARGS__); } while (0)
+	do { if (gLogDebug) LogInfo(fmt, ##__VA_ARGS__); } while (0)
 #define vLogDebug(fmt, va_args) \
 	do { if (gLogDebug) vLogInfo(fmt, va_args); } while (0)
 #define LogDebugW(fmt, ...) \
-	do { if (gLogDebug) LogInfoW(fmt, __VA_ARGS__); } while (0)
+	do { if (gLogDebug) LogInfoW(fmt, ##__VA_ARGS__); } while (0)
 
 // Aliases for the above functions that we use to denote that omitting the
 // newline was done intentionally. For now this is just for our reference, but
@@ -563,8 +563,7 @@ static DWORD WINAPI crash_handler_switch_to_window(_In_ LPVOID lpParameter)
 		//last_fullscreen_swap_chain->ResizeBuffers(0, 0, 0, DXGI_FORMAT_UNKNOWN, DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH);
 	}
 
-	if (LogFile)
-		fflush(LogFile);
+	LogFlush();
 
 	return 0;
 }
@@ -581,10 +580,12 @@ static LONG WINAPI migoto_exception_filter(_In_ struct _EXCEPTION_POINTERS *Exce
 	Beep(200, 300); Beep(200, 200); Beep(200, 200);
 	Beep(250, 100); Beep(250, 100); Beep(250, 100);
 
-	// Before anything else, flush the log file and log exception info
+	// Before anything else, flush the log file and log exception info. If
+	// a background thread was writing it, that may be the thread that
+	// crashed, so the rest of the log is written directly from here:
 
 	if (LogFile) {
-		fflush(LogFile);
+		LogFlushAfterCrash();
 
 		LogInfo("\n\n ######################################\n"
 		            " ### 3DMigoto Crash Handler Invoked ###\n");
@@ -608,7 +609,7 @@ static LONG WINAPI migoto_exception_filter(_In_ struct _EXCEPTION_POINTERS *Exce
 			LogInfo("\n");
 		}
 
-		fflush(LogFile);
+		LogFlush();
 	}
 
 	// Next, write a minidump file so we can examine this in a debugger
@@ -642,8 +643,7 @@ static LONG WINAPI migoto_exception_filter(_In_ struct _EXCEPTION_POINTERS *Exce
 	} else
 		LogInfo("Error creating minidump file \"%S\": %d\n", path, GetLastError());
 
-	if (LogFile)
-		fflush(LogFile);
+	LogFlush();
 
 	// If crash is set to 2 instead of continuing we will stop and start
 	// responding to various key bindings, sounding a reminder tone every
@@ -658,7 +658,7 @@ static LONG WINAPI migoto_exception_filter(_In_ struct _EXCEPTION_POINTERS *Exce
 			LogInfo(" Ctrl+Alt+B: Break into the debugger (make sure one is attached)\n");
 			LogInfo(" Ctrl+Alt+W: Attempt to switch to Windowed mode\n");
 			LogInfo("\n");
-			fflush(LogFile);
+			LogFlush();
 		}
 		while (1) {
 			Beep(500, 100);
@@ -667,19 +667,19 @@ static LONG WINAPI migoto_exception_filter(_In_ struct _EXCEPTION_POINTERS *Exce
 				if (GetAsyncKeyState(VK_CONTROL) < 0 &&
 				    GetAsyncKeyState(VK_MENU) < 0) {
 					if (GetAsyncKeyState('C') < 0) {
-						LogInfo("Attempting to continue...\n"); fflush(LogFile); Beep(1000, 100);
+						LogInfo("Attempting to continue...\n"); LogFlush(); Beep(1000, 100);
 						ret = EXCEPTION_CONTINUE_EXECUTION;
 						goto unlock;
 					}
 
 					if (GetAsyncKeyState('Q') < 0) {
-						LogInfo("Executing exception handler...\n"); fflush(LogFile); Beep(1000, 100);
+						LogInfo("Executing exception handler...\n"); LogFlush(); Beep(1000, 100);
 						ret = EXCEPTION_EXECUTE_HANDLER;
 						goto unlock;
 					}
 
 					if (GetAsyncKeyState('K') < 0) {
-						LogInfo("Killing process...\n"); fflush(LogFile); Beep(1000, 100);
+						LogInfo("Killing process...\n"); LogFlush(); Beep(1000, 100);
 						ExitProcess(0x3D819070);
 					}
 
@@ -688,13 +688,13 @@ static LONG WINAPI migoto_exception_filter(_In_ struct _EXCEPTION_POINTERS *Exce
 					// R = Resume all other threads
 
 					if (GetAsyncKeyState('B') < 0) {
-						LogInfo("Dropping to debugger...\n"); fflush(LogFile); Beep(1000, 100);
+						LogInfo("Dropping to debugger...\n"); LogFlush(); Beep(1000, 100);
 						__debugbreak();
 						goto unlock;
 					}
 
 					if (GetAsyncKeyState('W') < 0) {
-						LogInfo("Attempting to switch to windowed mode...\n"); fflush(LogFile); Beep(1000, 100);
+						LogInfo("Attempting to switch to windowed mode...\n"); LogFlush(); Beep(1000, 100);
 						CreateThread(NULL, 0, crash_handler_switch_to_window, NULL, 0, NULL);
 						Sleep(1000);
 					}
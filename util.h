@@ -82,7 +82,9 @@ extern CRITICAL_SECTION resource_creation_mode_lock;
 
 // Now switching to use crc32_append instead of fnv_64_buf for performance. This
 // implementation of crc32c uses the SSE 4.2 instructions in the CPU to calculate,
-// and is some 30x faster than fnv_64_buf.
+// and is some 30x faster than fnv_64_buf. Large buffers are folded with
+// PCLMULQDQ (or VPCLMULQDQ where the CPU has it) for several times that again,
+// giving the same hashes.
 // 
 // Not changing shader hash calculation as there are thousands of shaders already
 // in the field, and there is no known bottleneck for that calculation.
@@ -202,11 +204,8 @@ static DECLSPEC_NORETURN void DoubleBeepExit()
 	Sleep(500);
 	BeepFailure2();
 	Sleep(200);
-	if (LogFile) {
-		// Make sure the log is written out so we see the failure message
-		fclose(LogFile);
-		LogFile = 0;
-	}
+	// Make sure the log is written out so we see the failure message
+	LogClose();
 	ExitProcess(0xc0000135);
 }
 